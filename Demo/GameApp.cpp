@@ -45,6 +45,13 @@ GameApp::GameApp()
 	// Because it's annoying to hear the sound of the planets hitting a wall too many
 	// times in a second, we'll limit how many can occur.
 	mLastPlanetHitSoundTime = -30;
+
+	// Keep up to 64MB of decoded images on disk so later runs can skip
+	// decoding the PNGs and JPEGs again.
+	mImageCacheSize = 64 * 1024 * 1024;
+
+	// Software rendered triangle batches are drawn in bands on a few threads
+	mRasterThreads = std::max(1, std::min(SDL_GetCPUCount(), 4));
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -72,7 +79,16 @@ void GameApp::Init()
 	
 	//SetMusicVolume(0);
 
+	// Hun-garr uses the stock ResourceManager, so it can load the manifest
+	// Tools/ResourceCompiler builds instead of parsing the XML every run
+	mResourceManager->SetUseCompiledResources(true);
 	LoadResourceManifest();
+
+	// Images and sounds can be decoded on a few threads at once while the
+	// resource manager still hands them out in order, which mostly helps the
+	// big groups loaded by LoadingThreadProc below.
+	mResourceManager->SetLoadThreads(std::max(1, std::min(SDL_GetCPUCount(), 4)));
+
 	if (!mResourceManager->LoadResources("Init"))
 	{
 		mLoadingFailed = true;
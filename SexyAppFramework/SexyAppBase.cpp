@@ -26,9 +26,11 @@
 #include "graphics/GLInterface.h"
 #include "graphics/GLImage.h"
 #include "graphics/MemoryImage.h"
+#include "graphics/SWTri.h"
 //#include "misc/HTTPTransfer.h"
 #include "widget/Dialog.h"
 #include "imagelib/ImageLib.h"
+#include "imagelib/ImageCache.h"
 #include "sound/SDLSoundManager.h"
 #include "sound/SDLSoundInstance.h"
 #include "misc/Rect.h"
@@ -301,6 +303,8 @@ SexyAppBase::SexyAppBase()
 	mSoftVSyncWait = true;
 	mUserChanged3DSetting = false;
 	mAutoEnable3D = false;
+	mImageCacheSize = 0;
+	mRasterThreads = 1;
 	mTest3D = false;
 	mMinVidMemory3D = 6;
 	mRecommendedVidMemory3D = 14;
@@ -507,6 +511,11 @@ SexyAppBase::~SexyAppBase()
 	
 	WaitForLoadingThread();	
 
+	delete ImageLib::gImageCache;
+	ImageLib::gImageCache = NULL;
+
+	SWHelper::SetRasterThreads(1);
+
 	//DestroyCursor(mHandCursor);
 	//DestroyCursor(mDraggingCursor);			
 
@@ -4952,7 +4961,15 @@ void SexyAppBase::Init()
 	strcat(aPath, "/savedata/");
 	SetAppDataFolder(aPath);
 
-	gPakInterface->AddPakFile("main.pak");
+	// No pak means the files are loose, but one that's there and rejected
+	// leaves the game without its data
+	if ((!gPakInterface->AddPakFile("main.pak")) && (Sexy::FileExists("main.pak")))
+		Popup(GetString("PAK_DAMAGED", _S("main.pak is damaged, please reinstall the game.")));
+
+	if (mImageCacheSize > 0)
+		ImageLib::gImageCache = new ImageLib::ImageCache(GetAppDataFolder() + "imagecache/", mImageCacheSize);
+
+	SWHelper::SetRasterThreads(mRasterThreads);
 
 	// Create a message we can use to talk to ourselves inter-process
 	//mNotifyGameMessage = RegisterWindowMessage((_S("Notify") + StringToSexyString(mProdName)).c_str());
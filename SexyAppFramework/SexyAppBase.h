@@ -319,6 +319,8 @@ public:
 	bool					mSoftVSyncWait;
 	bool					mUserChanged3DSetting;
 	bool					mAutoEnable3D;
+	int						mImageCacheSize;		// bytes of decoded images kept under savedata/imagecache, 0 for none
+	int						mRasterThreads;			// threads the software triangle rasterizer splits big batches across, 1 for none
 	bool					mTest3D;
 	DWORD					mMinVidMemory3D;
 	DWORD					mRecommendedVidMemory3D;
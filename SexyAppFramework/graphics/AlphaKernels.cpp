@@ -0,0 +1,206 @@
+#include "graphics/AlphaKernels.h"
+#include "misc/CPUFeatures.h"
+
+using namespace Sexy;
+
+static const int ALPHA_HAS_BOTH = ALPHA_HAS_TRANS | ALPHA_HAS_ALPHA;
+
+// Pixels between checks for an early out in the vector loops
+static const int CLASSIFY_CHUNK = 256;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static inline uint32_t PremultiplyPixel(uint32_t val, bool swapRedBlue)
+{
+	uint32_t anAlpha = val >> 24;
+	uint32_t r = (((val >> 16) & 0xFF) * (anAlpha+1)) >> 8;
+	uint32_t g = (((val >> 8) & 0xFF) * (anAlpha+1)) >> 8;
+	uint32_t b = ((val & 0xFF) * (anAlpha+1)) >> 8;
+
+	if (swapRedBlue)
+		return (anAlpha << 24) | (b << 16) | (g << 8) | r;
+	return (anAlpha << 24) | (r << 16) | (g << 8) | b;
+}
+
+#if defined(SEXY_SIMD_X86)
+
+///////////////////////////////////////////////////////////////////////////////
+// Classification ORs together "alpha is 0" and "alpha is neither 0 nor 255"
+// masks a chunk at a time and stops once both have shown up.
+///////////////////////////////////////////////////////////////////////////////
+static SEXY_TARGET_SSE2 int ClassifyAlphaSSE2(const uint32_t* theBits, int theCount, int& theFlags)
+{
+	const __m128i aZero = _mm_setzero_si128();
+	const __m128i anOpaque = _mm_set1_epi32(0xFF);
+	const __m128i anAllOnes = _mm_set1_epi32(-1);
+
+	int anEnd = theCount & ~3;
+	int i = 0;
+	while (i < anEnd && theFlags != ALPHA_HAS_BOTH)
+	{
+		int aChunkEnd = i + CLASSIFY_CHUNK < anEnd ? i + CLASSIFY_CHUNK : anEnd;
+
+		__m128i aTrans = aZero;
+		__m128i aPartial = aZero;
+		for (; i < aChunkEnd; i += 4)
+		{
+			__m128i anAlpha = _mm_srli_epi32(_mm_loadu_si128((const __m128i*)(theBits + i)), 24);
+			__m128i isTrans = _mm_cmpeq_epi32(anAlpha, aZero);
+			__m128i isOpaque = _mm_cmpeq_epi32(anAlpha, anOpaque);
+
+			aTrans = _mm_or_si128(aTrans, isTrans);
+			aPartial = _mm_or_si128(aPartial, _mm_xor_si128(_mm_or_si128(isTrans, isOpaque), anAllOnes));
+		}
+
+		if (_mm_movemask_epi8(aTrans))
+			theFlags |= ALPHA_HAS_TRANS;
+		if (_mm_movemask_epi8(aPartial))
+			theFlags |= ALPHA_HAS_ALPHA;
+	}
+	return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Premultiplying works on 16 bit lanes, c*(alpha+1) fits in one.  The alpha
+// lane gets scaled too and is put back from the source afterwards.
+///////////////////////////////////////////////////////////////////////////////
+static inline SEXY_TARGET_SSE2 __m128i Premultiply16SSE2(__m128i p, bool swapRedBlue)
+{
+	if (swapRedBlue)
+		p = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+
+	__m128i anAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, 0xFF), 0xFF);
+	return _mm_srli_epi16(_mm_mullo_epi16(p, _mm_add_epi16(anAlpha, _mm_set1_epi16(1))), 8);
+}
+
+static SEXY_TARGET_SSE2 int PremultiplyRowSSE2(uint32_t* theDest, const uint32_t* theSrc, int theCount, bool swapRedBlue)
+{
+	const __m128i aZero = _mm_setzero_si128();
+	const __m128i anAlphaMask = _mm_set1_epi32(0xFF000000);
+
+	int i = 0;
+	for (; i + 4 <= theCount; i += 4)
+	{
+		__m128i aSrc = _mm_loadu_si128((const __m128i*)(theSrc + i));
+		__m128i aLo = Premultiply16SSE2(_mm_unpacklo_epi8(aSrc, aZero), swapRedBlue);
+		__m128i aHi = Premultiply16SSE2(_mm_unpackhi_epi8(aSrc, aZero), swapRedBlue);
+
+		__m128i aResult = _mm_packus_epi16(aLo, aHi);
+		aResult = _mm_or_si128(_mm_andnot_si128(anAlphaMask, aResult), _mm_and_si128(anAlphaMask, aSrc));
+		_mm_storeu_si128((__m128i*)(theDest + i), aResult);
+	}
+	return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Same as the SSE2 versions, eight pixels at a time.
+///////////////////////////////////////////////////////////////////////////////
+static SEXY_TARGET_AVX2 int ClassifyAlphaAVX2(const uint32_t* theBits, int theCount, int& theFlags)
+{
+	const __m256i aZero = _mm256_setzero_si256();
+	const __m256i anOpaque = _mm256_set1_epi32(0xFF);
+	const __m256i anAllOnes = _mm256_set1_epi32(-1);
+
+	int anEnd = theCount & ~7;
+	int i = 0;
+	while (i < anEnd && theFlags != ALPHA_HAS_BOTH)
+	{
+		int aChunkEnd = i + CLASSIFY_CHUNK < anEnd ? i + CLASSIFY_CHUNK : anEnd;
+
+		__m256i aTrans = aZero;
+		__m256i aPartial = aZero;
+		for (; i < aChunkEnd; i += 8)
+		{
+			__m256i anAlpha = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(theBits + i)), 24);
+			__m256i isTrans = _mm256_cmpeq_epi32(anAlpha, aZero);
+			__m256i isOpaque = _mm256_cmpeq_epi32(anAlpha, anOpaque);
+
+			aTrans = _mm256_or_si256(aTrans, isTrans);
+			aPartial = _mm256_or_si256(aPartial, _mm256_xor_si256(_mm256_or_si256(isTrans, isOpaque), anAllOnes));
+		}
+
+		if (_mm256_movemask_epi8(aTrans))
+			theFlags |= ALPHA_HAS_TRANS;
+		if (_mm256_movemask_epi8(aPartial))
+			theFlags |= ALPHA_HAS_ALPHA;
+	}
+	return i;
+}
+
+static inline SEXY_TARGET_AVX2 __m256i Premultiply16AVX2(__m256i p, bool swapRedBlue)
+{
+	if (swapRedBlue)
+		p = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+
+	__m256i anAlpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, 0xFF), 0xFF);
+	return _mm256_srli_epi16(_mm256_mullo_epi16(p, _mm256_add_epi16(anAlpha, _mm256_set1_epi16(1))), 8);
+}
+
+static SEXY_TARGET_AVX2 int PremultiplyRowAVX2(uint32_t* theDest, const uint32_t* theSrc, int theCount, bool swapRedBlue)
+{
+	const __m256i aZero = _mm256_setzero_si256();
+	const __m256i anAlphaMask = _mm256_set1_epi32(0xFF000000);
+
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m256i aSrc = _mm256_loadu_si256((const __m256i*)(theSrc + i));
+		__m256i aLo = Premultiply16AVX2(_mm256_unpacklo_epi8(aSrc, aZero), swapRedBlue);
+		__m256i aHi = Premultiply16AVX2(_mm256_unpackhi_epi8(aSrc, aZero), swapRedBlue);
+
+		__m256i aResult = _mm256_packus_epi16(aLo, aHi);
+		aResult = _mm256_or_si256(_mm256_andnot_si256(anAlphaMask, aResult), _mm256_and_si256(anAlphaMask, aSrc));
+		_mm256_storeu_si256((__m256i*)(theDest + i), aResult);
+	}
+	return i;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int Sexy::ClassifyAlpha(const uint32_t* theBits, int theCount)
+{
+	int aFlags = 0;
+	int i = 0;
+
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2: i = ClassifyAlphaAVX2(theBits, theCount, aFlags); break;
+	case SIMDLevel_SSE2: i = ClassifyAlphaSSE2(theBits, theCount, aFlags); break;
+#endif
+	default: break;
+	}
+
+	for (; i < theCount && aFlags != ALPHA_HAS_BOTH; i++)
+	{
+		uchar anAlpha = (uchar) (theBits[i] >> 24);
+
+		if (anAlpha == 0)
+			aFlags |= ALPHA_HAS_TRANS;
+		else if (anAlpha != 255)
+			aFlags |= ALPHA_HAS_ALPHA;
+	}
+
+	return aFlags;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::PremultiplyRow(uint32_t* theDest, const uint32_t* theSrc, int theCount, bool swapRedBlue)
+{
+	int i = 0;
+
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2: i = PremultiplyRowAVX2(theDest, theSrc, theCount, swapRedBlue); break;
+	case SIMDLevel_SSE2: i = PremultiplyRowSSE2(theDest, theSrc, theCount, swapRedBlue); break;
+#endif
+	default: break;
+	}
+
+	for (; i < theCount; i++)
+		theDest[i] = PremultiplyPixel(theSrc[i], swapRedBlue);
+}
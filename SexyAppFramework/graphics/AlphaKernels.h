@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Common.h"
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Alpha analysis and premultiplication of ARGB8888 pixels for MemoryImage,
+// using the best SIMD level available at runtime.  Results are identical at
+// every level.
+///////////////////////////////////////////////////////////////////////////////
+
+enum
+{
+	ALPHA_HAS_TRANS		= 1,	// some pixel has alpha 0
+	ALPHA_HAS_ALPHA		= 2		// some pixel has alpha between 1 and 254
+};
+
+// ALPHA_ flags for theCount pixels, stops looking once both are found.
+int					ClassifyAlpha(const uint32_t* theBits, int theCount);
+
+// Scales red, green and blue by (alpha+1)/256 rounding down, the alpha byte is
+// kept.  swapRedBlue also exchanges red and blue for ABGR displays.
+void				PremultiplyRow(uint32_t* theDest, const uint32_t* theSrc, int theCount, bool swapRedBlue);
+
+}
@@ -0,0 +1,361 @@
+#include "graphics/BlitKernels.h"
+#include "graphics/Color.h"
+#include "misc/CPUFeatures.h"
+
+using namespace Sexy;
+
+// How theColor tints the source, each mode rounds slightly differently
+enum
+{
+	TINT_WHITE,
+	TINT_GREY,			// red, green and blue equal
+	TINT_COLOR
+};
+
+struct NormalBlend
+{
+	int mMode;
+	int mAlpha;
+	int mRed;
+	int mGreen;
+	int mBlue;
+};
+
+static void SetupNormalBlend(NormalBlend& theBlend, const Color& theColor)
+{
+	theBlend.mAlpha = theColor.mAlpha;
+	theBlend.mRed = theColor.mRed;
+	theBlend.mGreen = theColor.mGreen;
+	theBlend.mBlue = theColor.mBlue;
+
+	if (theColor == Color::White)
+		theBlend.mMode = TINT_WHITE;
+	else if (theColor.mRed == theColor.mGreen && theColor.mGreen == theColor.mBlue)
+		theBlend.mMode = TINT_GREY;
+	else
+		theBlend.mMode = TINT_COLOR;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// One pixel of MI_NormalBlt.inc.
+///////////////////////////////////////////////////////////////////////////////
+static inline uint32_t BlendPixelNormal(uint32_t dest, uint32_t src, const NormalBlend& theBlend)
+{
+	int a = src >> 24;
+	if (theBlend.mMode != TINT_WHITE)
+		a = (a * theBlend.mAlpha) / 255;
+
+	if (a == 0)
+		return dest;
+
+	int aDestAlpha = dest >> 24;
+	int aNewDestAlpha = aDestAlpha + ((255 - aDestAlpha) * a) / 255;
+	a = 255 * a / aNewDestAlpha;
+
+	int oma = 256 - a;
+	uint32_t aNewAlpha = (uint32_t)aNewDestAlpha << 24;
+
+	if (theBlend.mMode == TINT_WHITE)
+	{
+		return aNewAlpha |
+			((((dest & 0xFF00FF) * oma >> 8) + ((src & 0xFF00FF) * a >> 8)) & 0xFF00FF) |
+			((((dest & 0x00FF00) * oma >> 8) + ((src & 0x00FF00) * a >> 8)) & 0x00FF00);
+	}
+	else if (theBlend.mMode == TINT_GREY)
+	{
+		int cr = theBlend.mRed;
+		return aNewAlpha |
+			((((dest & 0xFF00FF) * oma >> 8) + ((((src & 0xFF00FF) * cr >> 8) & 0xFF00FF) * a >> 8)) & 0xFF00FF) |
+			((((dest & 0x00FF00) * oma >> 8) + ((src & 0x00FF00) * cr * a >> 16)) & 0x00FF00);
+	}
+	else
+	{
+		int cr = theBlend.mRed;
+		int cg = theBlend.mGreen;
+		int cb = theBlend.mBlue;
+		return aNewAlpha |
+			(((((dest & 0x0000FF) * oma) >> 8) + (((src & 0x0000FF) * a * cb) >> 16)) & 0x0000FF) |
+			(((((dest & 0x00FF00) * oma) >> 8) + (((src & 0x00FF00) * a * cg) >> 16)) & 0x00FF00) |
+			(((((dest & 0xFF0000) * oma) >> 8) + (((((src & 0xFF0000) * a) >> 8) * cr) >> 8)) & 0xFF0000);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// One pixel of MI_AdditiveBlt.inc, with the tint already scaled by the color's
+// alpha (256 = untinted) and theAlpha 256 for sources without alpha.
+///////////////////////////////////////////////////////////////////////////////
+static inline uint32_t BlendPixelAdditive(uint32_t dest, uint32_t src, int theAlpha, int cr, int cg, int cb)
+{
+	uint32_t b = (dest & 0x0000FF) + (((((src & 0x0000FF) * cb) >> 8) * theAlpha) >> 8);
+	uint32_t g = ((dest & 0x00FF00) >> 8) + ((((src & 0x00FF00) >> 8) * cg * theAlpha) >> 16);
+	uint32_t r = ((dest & 0xFF0000) >> 16) + ((((src & 0xFF0000) >> 16) * cr * theAlpha) >> 16);
+
+	return (dest & 0xFF000000) | (std::min(r, 255u) << 16) | (std::min(g, 255u) << 8) | std::min(b, 255u);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The vector versions work on 16 bit lanes, one per channel in B,G,R,A order.
+// With d, s the channels, a the (tinted) source alpha, k the channel tint and
+// U = d * (256 - a), MI_NormalBlt comes down to
+//
+//		blue				(U >> 8) + (s*k*a >> 16)
+//		green, red			(U + (s*k*a >> 8)) >> 8
+//
+// for opaque destinations, with k = 256 when untinted.  Grey tints round the
+// source first for blue and red: (s*k >> 8) * a instead of s*k*a >> 8.
+///////////////////////////////////////////////////////////////////////////////
+#if defined(SEXY_SIMD_X86)
+
+static inline SEXY_TARGET_SSE2 __m128i Select16SSE2(__m128i theMask, __m128i theTrue, __m128i theFalse)
+{
+	return _mm_or_si128(_mm_and_si128(theMask, theTrue), _mm_andnot_si128(theMask, theFalse));
+}
+
+static inline SEXY_TARGET_SSE2 __m128i BlendNormal16SSE2(__m128i d, __m128i s, __m128i theTint, __m128i theTintAlpha, __m128i theBlueLanes, __m128i theRoundLanes, bool grey)
+{
+	// a = alpha * ca / 255 for both pixels, the divide is exact for products of two bytes
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+	a = _mm_mullo_epi16(a, theTintAlpha);
+	a = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(a, _mm_set1_epi16(1)), _mm_srli_epi16(a, 8)), 8);
+
+	__m128i u = _mm_mullo_epi16(d, _mm_sub_epi16(_mm_set1_epi16(256), a));
+	__m128i p = _mm_mullo_epi16(s, theTint);
+	__m128i aLo = _mm_mullo_epi16(p, a);
+	__m128i aHi = _mm_mulhi_epu16(p, a);
+	__m128i aMid = _mm_or_si128(_mm_srli_epi16(aLo, 8), _mm_slli_epi16(aHi, 8));
+
+	__m128i x = aMid;
+	__m128i y = aHi;
+	if (grey)
+	{
+		__m128i aRounded = _mm_mullo_epi16(_mm_srli_epi16(p, 8), a);
+		x = Select16SSE2(theRoundLanes, aRounded, aMid);
+		y = _mm_srli_epi16(aRounded, 8);
+	}
+
+	__m128i aBlue = _mm_add_epi16(_mm_srli_epi16(u, 8), y);
+	__m128i aOther = _mm_srli_epi16(_mm_add_epi16(u, x), 8);
+	return Select16SSE2(theBlueLanes, aBlue, aOther);
+}
+
+static SEXY_TARGET_SSE2 int BlendRowNormalSSE2(uint32_t* theDest, const uint32_t* theSrc, int theCount, const NormalBlend& theBlend)
+{
+	bool grey = theBlend.mMode == TINT_GREY;
+	int kr = (theBlend.mMode == TINT_WHITE) ? 256 : theBlend.mRed;
+	int kg = (theBlend.mMode == TINT_WHITE) ? 256 : theBlend.mGreen;
+	int kb = (theBlend.mMode == TINT_WHITE) ? 256 : theBlend.mBlue;
+	int ka = (theBlend.mMode == TINT_WHITE) ? 255 : theBlend.mAlpha;
+
+	const __m128i aZero = _mm_setzero_si128();
+	const __m128i anOpaque = _mm_set1_epi32(0xFF000000);
+	const __m128i aTint = _mm_setr_epi16(kb, kg, kr, 0, kb, kg, kr, 0);
+	const __m128i aTintAlpha = _mm_set1_epi16(ka);
+	const __m128i aBlueLanes = _mm_setr_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	const __m128i aRoundLanes = _mm_setr_epi16(0, 0, -1, 0, 0, 0, -1, 0);
+
+	int i = 0;
+	for (; i + 4 <= theCount; i += 4)
+	{
+		__m128i aDest = _mm_loadu_si128((const __m128i*)(theDest + i));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(aDest, anOpaque), anOpaque)) != 0xFFFF)
+		{
+			// The new alpha needs a real divide
+			for (int j = i; j < i + 4; j++)
+				theDest[j] = BlendPixelNormal(theDest[j], theSrc[j], theBlend);
+			continue;
+		}
+
+		__m128i aSrc = _mm_loadu_si128((const __m128i*)(theSrc + i));
+		__m128i aLo = BlendNormal16SSE2(_mm_unpacklo_epi8(aDest, aZero), _mm_unpacklo_epi8(aSrc, aZero), aTint, aTintAlpha, aBlueLanes, aRoundLanes, grey);
+		__m128i aHi = BlendNormal16SSE2(_mm_unpackhi_epi8(aDest, aZero), _mm_unpackhi_epi8(aSrc, aZero), aTint, aTintAlpha, aBlueLanes, aRoundLanes, grey);
+		_mm_storeu_si128((__m128i*)(theDest + i), _mm_or_si128(_mm_packus_epi16(aLo, aHi), anOpaque));
+	}
+	return i;
+}
+
+static inline SEXY_TARGET_SSE2 __m128i AdditiveTerm16SSE2(__m128i s, __m128i theTint, __m128i theBlueLanes, bool srcHasAlpha)
+{
+	__m128i a = srcHasAlpha ? _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF) : _mm_set1_epi16(256);
+	__m128i p = _mm_mullo_epi16(s, theTint);
+
+	__m128i aBlue = _mm_srli_epi16(_mm_mullo_epi16(_mm_srli_epi16(p, 8), a), 8);
+	__m128i aOther = _mm_mulhi_epu16(p, a);
+	return Select16SSE2(theBlueLanes, aBlue, aOther);
+}
+
+static SEXY_TARGET_SSE2 int BlendRowAdditiveSSE2(uint32_t* theDest, const uint32_t* theSrc, int theCount, int cr, int cg, int cb, bool srcHasAlpha)
+{
+	const __m128i aZero = _mm_setzero_si128();
+	const __m128i aTint = _mm_setr_epi16(cb, cg, cr, 0, cb, cg, cr, 0);
+	const __m128i aBlueLanes = _mm_setr_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+
+	int i = 0;
+	for (; i + 4 <= theCount; i += 4)
+	{
+		__m128i aSrc = _mm_loadu_si128((const __m128i*)(theSrc + i));
+		__m128i aLo = AdditiveTerm16SSE2(_mm_unpacklo_epi8(aSrc, aZero), aTint, aBlueLanes, srcHasAlpha);
+		__m128i aHi = AdditiveTerm16SSE2(_mm_unpackhi_epi8(aSrc, aZero), aTint, aBlueLanes, srcHasAlpha);
+
+		__m128i aDest = _mm_loadu_si128((const __m128i*)(theDest + i));
+		_mm_storeu_si128((__m128i*)(theDest + i), _mm_adds_epu8(aDest, _mm_packus_epi16(aLo, aHi)));
+	}
+	return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Same as the SSE2 versions, eight pixels at a time.  Unpacking and packing
+// both work within 128 bit halves, so the pixels come back in order.
+///////////////////////////////////////////////////////////////////////////////
+static inline SEXY_TARGET_AVX2 __m256i Select16AVX2(__m256i theMask, __m256i theTrue, __m256i theFalse)
+{
+	return _mm256_or_si256(_mm256_and_si256(theMask, theTrue), _mm256_andnot_si256(theMask, theFalse));
+}
+
+static inline SEXY_TARGET_AVX2 __m256i BlendNormal16AVX2(__m256i d, __m256i s, __m256i theTint, __m256i theTintAlpha, __m256i theBlueLanes, __m256i theRoundLanes, bool grey)
+{
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+	a = _mm256_mullo_epi16(a, theTintAlpha);
+	a = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(a, _mm256_set1_epi16(1)), _mm256_srli_epi16(a, 8)), 8);
+
+	__m256i u = _mm256_mullo_epi16(d, _mm256_sub_epi16(_mm256_set1_epi16(256), a));
+	__m256i p = _mm256_mullo_epi16(s, theTint);
+	__m256i aLo = _mm256_mullo_epi16(p, a);
+	__m256i aHi = _mm256_mulhi_epu16(p, a);
+	__m256i aMid = _mm256_or_si256(_mm256_srli_epi16(aLo, 8), _mm256_slli_epi16(aHi, 8));
+
+	__m256i x = aMid;
+	__m256i y = aHi;
+	if (grey)
+	{
+		__m256i aRounded = _mm256_mullo_epi16(_mm256_srli_epi16(p, 8), a);
+		x = Select16AVX2(theRoundLanes, aRounded, aMid);
+		y = _mm256_srli_epi16(aRounded, 8);
+	}
+
+	__m256i aBlue = _mm256_add_epi16(_mm256_srli_epi16(u, 8), y);
+	__m256i aOther = _mm256_srli_epi16(_mm256_add_epi16(u, x), 8);
+	return Select16AVX2(theBlueLanes, aBlue, aOther);
+}
+
+static SEXY_TARGET_AVX2 int BlendRowNormalAVX2(uint32_t* theDest, const uint32_t* theSrc, int theCount, const NormalBlend& theBlend)
+{
+	bool grey = theBlend.mMode == TINT_GREY;
+	int kr = (theBlend.mMode == TINT_WHITE) ? 256 : theBlend.mRed;
+	int kg = (theBlend.mMode == TINT_WHITE) ? 256 : theBlend.mGreen;
+	int kb = (theBlend.mMode == TINT_WHITE) ? 256 : theBlend.mBlue;
+	int ka = (theBlend.mMode == TINT_WHITE) ? 255 : theBlend.mAlpha;
+
+	const __m256i aZero = _mm256_setzero_si256();
+	const __m256i anOpaque = _mm256_set1_epi32(0xFF000000);
+	const __m256i aTint = _mm256_setr_epi16(kb, kg, kr, 0, kb, kg, kr, 0, kb, kg, kr, 0, kb, kg, kr, 0);
+	const __m256i aTintAlpha = _mm256_set1_epi16(ka);
+	const __m256i aBlueLanes = _mm256_setr_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+	const __m256i aRoundLanes = _mm256_setr_epi16(0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0);
+
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m256i aDest = _mm256_loadu_si256((const __m256i*)(theDest + i));
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(aDest, anOpaque), anOpaque)) != -1)
+		{
+			for (int j = i; j < i + 8; j++)
+				theDest[j] = BlendPixelNormal(theDest[j], theSrc[j], theBlend);
+			continue;
+		}
+
+		__m256i aSrc = _mm256_loadu_si256((const __m256i*)(theSrc + i));
+		__m256i aLo = BlendNormal16AVX2(_mm256_unpacklo_epi8(aDest, aZero), _mm256_unpacklo_epi8(aSrc, aZero), aTint, aTintAlpha, aBlueLanes, aRoundLanes, grey);
+		__m256i aHi = BlendNormal16AVX2(_mm256_unpackhi_epi8(aDest, aZero), _mm256_unpackhi_epi8(aSrc, aZero), aTint, aTintAlpha, aBlueLanes, aRoundLanes, grey);
+		_mm256_storeu_si256((__m256i*)(theDest + i), _mm256_or_si256(_mm256_packus_epi16(aLo, aHi), anOpaque));
+	}
+	return i;
+}
+
+static inline SEXY_TARGET_AVX2 __m256i AdditiveTerm16AVX2(__m256i s, __m256i theTint, __m256i theBlueLanes, bool srcHasAlpha)
+{
+	__m256i a = srcHasAlpha ? _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF) : _mm256_set1_epi16(256);
+	__m256i p = _mm256_mullo_epi16(s, theTint);
+
+	__m256i aBlue = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_srli_epi16(p, 8), a), 8);
+	__m256i aOther = _mm256_mulhi_epu16(p, a);
+	return Select16AVX2(theBlueLanes, aBlue, aOther);
+}
+
+static SEXY_TARGET_AVX2 int BlendRowAdditiveAVX2(uint32_t* theDest, const uint32_t* theSrc, int theCount, int cr, int cg, int cb, bool srcHasAlpha)
+{
+	const __m256i aZero = _mm256_setzero_si256();
+	const __m256i aTint = _mm256_setr_epi16(cb, cg, cr, 0, cb, cg, cr, 0, cb, cg, cr, 0, cb, cg, cr, 0);
+	const __m256i aBlueLanes = _mm256_setr_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m256i aSrc = _mm256_loadu_si256((const __m256i*)(theSrc + i));
+		__m256i aLo = AdditiveTerm16AVX2(_mm256_unpacklo_epi8(aSrc, aZero), aTint, aBlueLanes, srcHasAlpha);
+		__m256i aHi = AdditiveTerm16AVX2(_mm256_unpackhi_epi8(aSrc, aZero), aTint, aBlueLanes, srcHasAlpha);
+
+		__m256i aDest = _mm256_loadu_si256((const __m256i*)(theDest + i));
+		_mm256_storeu_si256((__m256i*)(theDest + i), _mm256_adds_epu8(aDest, _mm256_packus_epi16(aLo, aHi)));
+	}
+	return i;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::BlendRowNormal(uint32_t* theDest, const uint32_t* theSrc, int theCount, const Color& theColor)
+{
+	NormalBlend aBlend;
+	SetupNormalBlend(aBlend, theColor);
+
+	int i = 0;
+
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2: i = BlendRowNormalAVX2(theDest, theSrc, theCount, aBlend); break;
+	case SIMDLevel_SSE2: i = BlendRowNormalSSE2(theDest, theSrc, theCount, aBlend); break;
+#endif
+	default: break;
+	}
+
+	for (; i < theCount; i++)
+		theDest[i] = BlendPixelNormal(theDest[i], theSrc[i], aBlend);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::BlendRowAdditive(uint32_t* theDest, const uint32_t* theSrc, int theCount, const Color& theColor, bool srcHasAlpha)
+{
+	int cr = 256;
+	int cg = 256;
+	int cb = 256;
+
+	if (theColor != Color::White)
+	{
+		int ca = theColor.mAlpha;
+		cr = (theColor.mRed * ca) / 255;
+		cg = (theColor.mGreen * ca) / 255;
+		cb = (theColor.mBlue * ca) / 255;
+	}
+
+	int i = 0;
+
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2: i = BlendRowAdditiveAVX2(theDest, theSrc, theCount, cr, cg, cb, srcHasAlpha); break;
+	case SIMDLevel_SSE2: i = BlendRowAdditiveSSE2(theDest, theSrc, theCount, cr, cg, cb, srcHasAlpha); break;
+#endif
+	default: break;
+	}
+
+	int anAlpha = 256;
+	for (; i < theCount; i++)
+	{
+		if (srcHasAlpha)
+			anAlpha = theSrc[i] >> 24;
+		theDest[i] = BlendPixelAdditive(theDest[i], theSrc[i], anAlpha, cr, cg, cb);
+	}
+}
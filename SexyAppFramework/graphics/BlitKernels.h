@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Common.h"
+
+namespace Sexy
+{
+
+class Color;
+
+///////////////////////////////////////////////////////////////////////////////
+// Row kernels for MemoryImage's software blits from 32 bit sources.  Each one
+// produces exactly what the per-pixel code in inc_routines (MI_NormalBlt and
+// MI_AdditiveBlt, as built with OPTIMIZE_SOFTWARE_DRAWING) produces, using the
+// best SIMD level available at runtime.
+///////////////////////////////////////////////////////////////////////////////
+
+// Alpha blends theSrc over theDest, tinted by theColor (White for none).
+// Destination pixels that aren't fully opaque take the scalar path.
+void				BlendRowNormal(uint32_t* theDest, const uint32_t* theSrc, int theCount, const Color& theColor);
+
+// Adds theSrc, scaled by its alpha when srcHasAlpha and by theColor, to
+// theDest with saturation.  The destination alpha is left alone.
+void				BlendRowAdditive(uint32_t* theDest, const uint32_t* theSrc, int theCount, const Color& theColor, bool srcHasAlpha);
+
+}
@@ -0,0 +1,294 @@
+#include <GL/glew.h>
+
+#include "graphics/GLBatcher.h"
+#include "graphics/GLStateCache.h"
+#include "graphics/GLStreamBuffer.h"
+#include "graphics/Graphics.h"
+#include "graphics/TriVertex.h"
+
+#define GetColorFromTriVertex(theVertex, theColor) (theVertex.color?theVertex.color:theColor)
+
+// Batches worth of vertices the stream buffer starts out with
+#define STREAM_BATCHES 8
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLBatcher::GLBatcher(int theCapacity)
+{
+	mCapacity = theCapacity;
+	mNumVertices = 0;
+	mVertices = new GLVertex[mCapacity];
+	memset(mVertices, 0, sizeof(GLVertex) * mCapacity);
+
+	mVao = 0;
+	mStream = new GLStreamBuffer(sizeof(GLVertex) * mCapacity * STREAM_BATCHES);
+	mFormatBuffer = 0;
+	mUfUseTexture = -1;
+	mStateCache = NULL;
+
+	mPendingState.mTexture = 0;
+	mPendingState.mDrawMode = Graphics::DRAWMODE_NORMAL;
+	mPendingState.mLinearFilter = false;
+	mPendingState.mPrimitive = GL_TRIANGLES;
+	mBatchState = mPendingState;
+
+	mFrameStats.Reset();
+	mLastFrameStats.Reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLBatcher::~GLBatcher()
+{
+	delete mStream;
+	delete[] mVertices;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::Init(GLuint theVao, GLint theUfUseTexture, GLStateCache* theStateCache)
+{
+	mStateCache = theStateCache;
+	mVao = theVao;
+	mUfUseTexture = theUfUseTexture;
+
+	mStream->Init(mStateCache);
+	if (mFormatBuffer != mStream->mBuffer)
+	{
+		mStateCache->BindVertexArray(mVao);
+		mStateCache->BindBuffer(GL_ARRAY_BUFFER, mStream->mBuffer);
+		SetupVertexFormat();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Points the vertex array at the stream buffer, which must be bound to
+// GL_ARRAY_BUFFER along with mVao.
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::SetupVertexFormat()
+{
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLVertex), 0);
+	glEnableVertexAttribArray(0);
+
+	glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GLVertex), (void*)(sizeof(float) * 3));
+	glEnableVertexAttribArray(1);
+
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GLVertex), (void*)(sizeof(float) * 3 + sizeof(uint32_t)));
+	glEnableVertexAttribArray(2);
+
+	mFormatBuffer = mStream->mBuffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Makes room for theNumVertices more vertices under the pending state,
+// flushing the current batch if the state differs or the buffer is full.
+// Returns false if the request can never fit in one batch.
+///////////////////////////////////////////////////////////////////////////////
+bool GLBatcher::Reserve(int theNumVertices)
+{
+	if (theNumVertices > mCapacity)
+		return false;
+
+	if (mNumVertices > 0)
+	{
+		if (mPendingState != mBatchState)
+		{
+			mFrameStats.mStateBreaks++;
+			Flush();
+		}
+		else if (mNumVertices + theNumVertices > mCapacity)
+		{
+			mFrameStats.mOverflowBreaks++;
+			Flush();
+		}
+	}
+
+	mBatchState = mPendingState;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::ApplyState(const GLBatchState& theState)
+{
+	if (theState.mDrawMode == Graphics::DRAWMODE_NORMAL)
+		mStateCache->BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	else // Additive
+		mStateCache->BlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+	if (theState.mTexture != 0)
+	{
+		int aFilter = (theState.mLinearFilter) ? GL_LINEAR : GL_NEAREST;
+
+		mStateCache->BindTexture(theState.mTexture);
+		mStateCache->TexParameter(GL_TEXTURE_MAG_FILTER, aFilter);
+		mStateCache->TexParameter(GL_TEXTURE_MIN_FILTER, aFilter);
+		mStateCache->Uniform1i(mUfUseTexture, 1);
+	}
+	else
+		mStateCache->Uniform1i(mUfUseTexture, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::AddTriangleStrip(const GLVertex* theVertices, int theNumVertices)
+{
+	if (theNumVertices < 3)
+		return;
+
+	mPendingState.mPrimitive = GL_TRIANGLES;
+	mFrameStats.mPrimitives++;
+
+	// Every triangle is reserved on its own so that strips longer than the
+	// buffer are split instead of dropped.
+	for (int i = 2; i < theNumVertices; i++)
+	{
+		if (!Reserve(3))
+			return;
+
+		GLVertex* aDest = mVertices + mNumVertices;
+		if (i & 1) // keep the winding of the strip
+		{
+			aDest[0] = theVertices[i - 1];
+			aDest[1] = theVertices[i - 2];
+		}
+		else
+		{
+			aDest[0] = theVertices[i - 2];
+			aDest[1] = theVertices[i - 1];
+		}
+		aDest[2] = theVertices[i];
+		mNumVertices += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::AddTriangleFan(const GLVertex* theVertices, int theNumVertices)
+{
+	if (theNumVertices < 3)
+		return;
+
+	mPendingState.mPrimitive = GL_TRIANGLES;
+	mFrameStats.mPrimitives++;
+
+	for (int i = 2; i < theNumVertices; i++)
+	{
+		if (!Reserve(3))
+			return;
+
+		GLVertex* aDest = mVertices + mNumVertices;
+		aDest[0] = theVertices[0];
+		aDest[1] = theVertices[i - 1];
+		aDest[2] = theVertices[i];
+		mNumVertices += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::AddTriangles(const GLVertex* theVertices, int theNumVertices)
+{
+	mPendingState.mPrimitive = GL_TRIANGLES;
+	mFrameStats.mPrimitives++;
+
+	for (int i = 0; i + 3 <= theNumVertices; i += 3)
+	{
+		if (!Reserve(3))
+			return;
+
+		memcpy(mVertices + mNumVertices, theVertices + i, sizeof(GLVertex) * 3);
+		mNumVertices += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::AddTriangles(const TriVertex theVertices[][3], int theNumTriangles, uint32_t theColor, float tx, float ty, float theMaxTotalU, float theMaxTotalV, float theOffsetU, float theOffsetV)
+{
+	mPendingState.mPrimitive = GL_TRIANGLES;
+	mFrameStats.mPrimitives++;
+
+	for (int aTriangleNum = 0; aTriangleNum < theNumTriangles; aTriangleNum++)
+	{
+		if (!Reserve(3))
+			return;
+
+		const TriVertex* aTriVerts = theVertices[aTriangleNum];
+		GLVertex* aDest = mVertices + mNumVertices;
+
+		for (int i = 0; i < 3; i++)
+		{
+			aDest[i].sx = aTriVerts[i].x + tx;
+			aDest[i].sy = aTriVerts[i].y + ty;
+			aDest[i].sz = 0;
+			aDest[i].color = GetColorFromTriVertex(aTriVerts[i], theColor);
+			aDest[i].tu = aTriVerts[i].u * theMaxTotalU + theOffsetU;
+			aDest[i].tv = aTriVerts[i].v * theMaxTotalV + theOffsetV;
+		}
+
+		mNumVertices += 3;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::AddLineStrip(const GLVertex* theVertices, int theNumVertices)
+{
+	if (theNumVertices < 2)
+		return;
+
+	mPendingState.mPrimitive = GL_LINES;
+	mFrameStats.mPrimitives++;
+
+	for (int i = 1; i < theNumVertices; i++)
+	{
+		if (!Reserve(2))
+			return;
+
+		mVertices[mNumVertices++] = theVertices[i - 1];
+		mVertices[mNumVertices++] = theVertices[i];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::Flush()
+{
+	if (mNumVertices == 0)
+		return;
+
+	ApplyState(mBatchState);
+	DrawBatch();
+
+	mFrameStats.mDrawCalls++;
+	mFrameStats.mVertices += mNumVertices;
+	mNumVertices = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::DrawBatch()
+{
+	mStateCache->BindVertexArray(mVao);
+	int anOffset = mStream->Upload(mVertices, sizeof(GLVertex) * mNumVertices);
+
+	// The stream grew into a new buffer
+	if (mFormatBuffer != mStream->mBuffer)
+		SetupVertexFormat();
+
+	glDrawArrays(mBatchState.mPrimitive, anOffset / sizeof(GLVertex), mNumVertices);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLBatcher::EndFrame()
+{
+	Flush();
+	mStream->EndFrame();
+
+	mLastFrameStats = mFrameStats;
+	mFrameStats.Reset();
+}
@@ -0,0 +1,103 @@
+#ifndef __GLBATCHER_H__
+#define __GLBATCHER_H__
+
+#include "graphics/GLInterface.h"
+
+namespace Sexy
+{
+
+	class GLStateCache;
+	class GLStreamBuffer;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Everything that forces a new draw call.  Clipping is done on the CPU
+	// (see DrawPolyClipped) so it never needs to break a batch.
+	///////////////////////////////////////////////////////////////////////////////
+	struct GLBatchState
+	{
+		GLuint mTexture;		// 0 = untextured
+		int mDrawMode;			// Graphics::DRAWMODE_*
+		bool mLinearFilter;
+		GLenum mPrimitive;		// GL_TRIANGLES or GL_LINES
+
+		bool operator==(const GLBatchState& theState) const
+		{
+			return mTexture == theState.mTexture && mDrawMode == theState.mDrawMode && mPrimitive == theState.mPrimitive &&
+				(mTexture == 0 || mLinearFilter == theState.mLinearFilter);
+		}
+
+		bool operator!=(const GLBatchState& theState) const { return !(*this == theState); }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct GLBatchStats
+	{
+		int mPrimitives;		// strips/fans/lists handed to the batcher
+		int mDrawCalls;			// glDrawArrays actually issued
+		int mVertices;
+		int mStateBreaks;		// flushes caused by a state change
+		int mOverflowBreaks;	// flushes caused by a full vertex buffer
+
+		void Reset() { mPrimitives = mDrawCalls = mVertices = mStateBreaks = mOverflowBreaks = 0; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Collects consecutive draws that share the same GLBatchState into one
+	// triangle (or line) list and submits it with a single draw call.  State
+	// setters only touch the pending state; the batch is flushed lazily when the
+	// next primitive doesn't match, so draw order is always preserved.
+	///////////////////////////////////////////////////////////////////////////////
+	class GLBatcher
+	{
+	public:
+		GLVertex*				mVertices;
+		int						mNumVertices;
+		int						mCapacity;
+
+		GLBatchState			mBatchState;
+		GLBatchState			mPendingState;
+
+		GLuint					mVao;
+		GLStreamBuffer*			mStream;
+		GLuint					mFormatBuffer;	// buffer the vertex attributes were last pointed at
+		GLint					mUfUseTexture;
+		GLStateCache*			mStateCache;
+
+		GLBatchStats			mFrameStats;
+		GLBatchStats			mLastFrameStats;
+
+	protected:
+		bool					Reserve(int theNumVertices);
+		void					ApplyState(const GLBatchState& theState);
+		void					SetupVertexFormat();
+
+		// Uploads mVertices and draws them as mBatchState.mPrimitive, after
+		// ApplyState has set up the rest.  A test overrides it to record the
+		// batches a scene turns into.
+		virtual void			DrawBatch();
+
+	public:
+		GLBatcher(int theCapacity);
+		virtual ~GLBatcher();
+
+		void					Init(GLuint theVao, GLint theUfUseTexture, GLStateCache* theStateCache);
+
+		void					SetTexture(GLuint theTexture) { mPendingState.mTexture = theTexture; }
+		void					SetDrawMode(int theDrawMode) { mPendingState.mDrawMode = theDrawMode; }
+		void					SetLinearFilter(bool linear) { mPendingState.mLinearFilter = linear; }
+		bool					GetLinearFilter() { return mPendingState.mLinearFilter; }
+
+		void					AddTriangleStrip(const GLVertex* theVertices, int theNumVertices);
+		void					AddTriangleFan(const GLVertex* theVertices, int theNumVertices);
+		void					AddTriangles(const GLVertex* theVertices, int theNumVertices);
+		void					AddTriangles(const TriVertex theVertices[][3], int theNumTriangles, uint32_t theColor, float tx, float ty, float theMaxTotalU, float theMaxTotalV, float theOffsetU = 0, float theOffsetV = 0);
+		void					AddLineStrip(const GLVertex* theVertices, int theNumVertices);
+
+		void					Flush();
+		void					EndFrame();
+	};
+
+}
+
+#endif // __GLBATCHER_H__
@@ -13,6 +13,11 @@
 #include "misc/CritSect.h"
 #include "graphics/Graphics.h"
 #include "graphics/MemoryImage.h"
+#include "graphics/GLBatcher.h"
+#include "graphics/GLStateCache.h"
+#include "graphics/TextureAtlas.h"
+#include "graphics/PixelConvert.h"
+#include "graphics/TextureUploadQueue.h"
 
 #define MAX_VERTICES 16384
 #define GetColorFromTriVertex(theVertex, theColor) (theVertex.color?theVertex.color:theColor)
@@ -26,101 +31,21 @@ static int gMaxTextureHeight;
 static int gSupportedPixelFormats;
 static bool gTextureSizeMustBePow2;
 static const int MAX_TEXTURE_SIZE = 1024;
-static bool gLinearFilter = false;
+static const int ATLAS_PAGE_SIZE = 1024;
+static const int ASYNC_UPLOAD_MIN_PIXELS = 128 * 128;	// smaller images are cheap enough to upload on first draw
+static const int UPLOAD_BUDGET_MICROS = 2000;
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-static GLVertex* gVertices;
-static int gNumVertices;
-static GLenum gVertexMode;
+static GLBatcher* gBatcher;
+static GLStateCache* gStateCache;
+static TextureAtlas* gTextureAtlas;
+static ScratchBuffer gScratchBuffer;
+static TextureUploadScheduler* gUploadScheduler;
 static GLuint gProgram;
-static GLuint gVao, gVbo;
+static GLuint gVao;
 static GLint gUfViewMtx, gUfProjMtx, gUfTexture, gUfUseTexture;
 
-static void GfxBegin(GLenum vertexMode)
-{
-	if (gVertexMode != (GLenum)-1) return;
-	gVertexMode = vertexMode;
-}
-
-static void GfxEnd()
-{
-	if (gVertexMode == (GLenum)-1) return;
-
-	glBindVertexArray(gVao);
-	glBindBuffer(GL_ARRAY_BUFFER, gVbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLVertex) * gNumVertices, gVertices, GL_DYNAMIC_DRAW);
-
-	glDrawArrays(gVertexMode, 0, gNumVertices);
-
-	gVertexMode = (GLenum)-1;
-	gNumVertices = 0;
-}
-
-static void GfxAddVertices(const GLVertex* arr, int arrCount)
-{
-	if (gVertexMode == (GLenum)-1) return;
-
-	if (gNumVertices + arrCount >= MAX_VERTICES)
-	{
-		GLenum oldMode = gVertexMode;
-		GfxEnd();
-		GfxBegin(oldMode);
-	}
-
-	for (int i = gNumVertices; i < gNumVertices + arrCount; i++)
-	{
-		gVertices[i] = arr[i];
-	}
-	gNumVertices += arrCount;
-}
-
-static void GfxAddVertices(VertexList& arr)
-{
-	if (gVertexMode == (GLenum)-1) return;
-
-	if (gNumVertices + arr.size() >= MAX_VERTICES)
-	{
-		GLenum oldMode = gVertexMode;
-		GfxEnd();
-		GfxBegin(oldMode);
-	}
-
-	for (int i = gNumVertices; i < gNumVertices + arr.size(); i++)
-	{
-		gVertices[i] = arr[i];
-	}
-	gNumVertices += arr.size();
-}
-
-static void GfxAddVertices(const TriVertex arr[][3], int arrCount, unsigned int theColor, float tx, float ty, float aMaxTotalU, float aMaxTotalV)
-{
-	if (gVertexMode == (GLenum)-1) return;
-
-	if (gNumVertices + arrCount * 3 >= MAX_VERTICES)
-	{
-		GLenum oldMode = gVertexMode;
-		GfxEnd();
-		GfxBegin(oldMode);
-	}
-
-	for (int aTriangleNum = 0; aTriangleNum < arrCount; aTriangleNum++)
-	{
-		TriVertex* aTriVerts = (TriVertex*)arr[aTriangleNum];
-
-		for (int i = 0; i < 3; i++)
-		{
-			gVertices[gNumVertices + i].sx = aTriVerts[i].x + tx;
-			gVertices[gNumVertices + i].sy = aTriVerts[i].y + ty;
-			gVertices[gNumVertices + i].color = GetColorFromTriVertex(aTriVerts[i], theColor);
-			gVertices[gNumVertices + i].tu = aTriVerts[i].u * aMaxTotalU;
-			gVertices[gNumVertices + i].tv = aTriVerts[i].v * aMaxTotalV;
-		}
-
-		gNumVertices += 3;
-	}
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 static const char* SHADER_CODE =
@@ -215,261 +140,264 @@ static GLuint shaderLoad(const char* shaderContents)
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-static void CopyImageToTexture8888(MemoryImage* theImage, int offx, int offy, int theWidth, int theHeight, int theDestPitch, int theDestHeight, bool rightPad, bool bottomPad, bool create)
+static TextureUploadSource GetImageSource(MemoryImage* theImage)
 {
-	uint32_t* aDest = new uint32_t[theDestPitch * theDestHeight];
+	TextureUploadSource aSource;
+	aSource.mBits = (theImage->mColorTable == NULL) ? (uint32_t*)theImage->GetBits() : NULL;
+	aSource.mIndices = (uint8_t*)theImage->mColorIndices;
+	aSource.mPalette = theImage->mColorTable;
+	aSource.mWidth = theImage->GetWidth();
+	aSource.mHeight = theImage->GetHeight();
+	return aSource;
+}
 
-	if (theImage->mColorTable == NULL)
-	{
-		uint32_t* srcRow = (uint32_t*)theImage->GetBits() + offy * theImage->GetWidth() + offx;
-		uint32_t* dstRow = aDest;
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void SetDefaultTextureParams()
+{
+	// The batcher sets the real filter every time the texture is drawn
+	gStateCache->TexParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	gStateCache->TexParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
-		for (int y = 0; y < theHeight; y++)
-		{
-			uint32_t* src = srcRow;
-			uint32_t* dst = dstRow;
-			for (int x = 0; x < theWidth; x++)
-				*dst++ = *src++;
+	gStateCache->TexParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	gStateCache->TexParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
 
-			if (rightPad)
-				*dst = *(dst - 1);
+///////////////////////////////////////////////////////////////////////////////
+// Uploads a whole piece to the bound texture.  thePixels may be NULL to just
+// allocate storage, or an offset into the bound pixel unpack buffer.
+///////////////////////////////////////////////////////////////////////////////
+static void UploadTexturePixels(PixelFormat theFormat, int theTexWidth, int theTexHeight, bool create, const void* thePixels)
+{
+	GLint anInternalFormat = GL_RGBA;
+	GLenum aFormat = GL_BGRA;
+	GLenum aType = GL_UNSIGNED_INT_8_8_8_8_REV;
 
-			srcRow += theImage->GetWidth();
-			dstRow += theDestPitch;
-		}
-	}
-	else // palette
+	if (theFormat == PixelFormat_A4R4G4B4)
+		aType = GL_UNSIGNED_SHORT_4_4_4_4_REV;
+	else if (theFormat == PixelFormat_R5G6B5)
 	{
-		uint8_t* srcRow = (uint8_t*)theImage->mColorIndices + offy * theImage->GetWidth() + offx;
-		uint32_t* dstRow = aDest;
-		uint32_t* palette = (uint32_t*)theImage->mColorTable;
+		anInternalFormat = GL_RGB;
+		aFormat = GL_RGB;
+		aType = GL_UNSIGNED_SHORT_5_6_5;
+	}
 
-		for (int y = 0; y < theHeight; y++)
-		{
-			uint8_t* src = srcRow;
-			uint32_t* dst = dstRow;
-			for (int x = 0; x < theWidth; x++)
-				*dst++ = palette[*src++];
+	if (create)
+		glTexImage2D(GL_TEXTURE_2D, 0, anInternalFormat, theTexWidth, theTexHeight, 0, aFormat, aType, thePixels);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, theTexWidth, theTexHeight, aFormat, aType, thePixels);
+}
 
-			if (rightPad)
-				*dst = *(dst - 1);
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void CopyImageToTexture(MemoryImage* theImage, int offx, int offy, int texWidth, int texHeight, PixelFormat theFormat, bool create)
+{
+	SetDefaultTextureParams();
 
-			srcRow += theImage->GetWidth();
-			dstRow += theDestPitch;
-		}
-	}
+	int aWidth = std::min(texWidth, (theImage->GetWidth() - offx));
+	int aHeight = std::min(texHeight, (theImage->GetHeight() - offy));
 
-	if (bottomPad)
+	if (aWidth > 0 && aHeight > 0 && theFormat != PixelFormat_Unknown)
 	{
-		uint32_t* dstrow = aDest + (theDestPitch * theHeight);
-		memcpy(dstrow, dstrow - (theDestPitch * 4), (theDestPitch * 4));
+		void* aDest = gScratchBuffer.Get(texWidth * texHeight * GetPixelFormatSize(theFormat));
+		ConvertTexturePiece(GetImageSource(theImage), theFormat, offx, offy, texWidth, texHeight, aDest);
+		UploadTexturePixels(theFormat, texWidth, texHeight, create, aDest);
 	}
-
-	if (create)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, theDestPitch, theDestHeight, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, aDest);
-	else
-		glTexSubImage2D(GL_TEXTURE_2D, 0, offx, offy, theDestPitch, theDestHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, aDest);
-
-	delete[] aDest;
 }
 
-static void CopyImageToTexture4444(MemoryImage* theImage, int offx, int offy, int theWidth, int theHeight, int theDestPitch, int theDestHeight, bool rightPad, bool bottomPad, bool create)
+///////////////////////////////////////////////////////////////////////////////
+// Feeds converted pieces to GL, staging them through a small ring of pixel
+// buffer objects so the driver can copy to the texture asynchronously.
+///////////////////////////////////////////////////////////////////////////////
+class GLTextureUploader : public TextureUploadBackend
 {
-	uint16_t* aDest = new uint16_t[theDestPitch * theDestHeight];
+public:
+	enum { NUM_PBOS = 4 };
 
-	if (theImage->mColorTable == NULL)
-	{
-		uint32_t* srcRow = (uint32_t*)theImage->GetBits() + offy * theImage->GetWidth() + offx;
-		uint16_t* dstRow = aDest;
+	GLuint					mPBOs[NUM_PBOS];
+	int						mNextPBO;
+	bool					mUsePBOs;
 
-		for (int y = 0; y < theHeight; y++)
-		{
-			uint32_t* src = srcRow;
-			uint16_t* dst = dstRow;
-			for (int x = 0; x < theWidth; x++)
-			{
-				uint32_t aPixel = *src++;
-				*dst++ = ((aPixel >> 16) & 0xF000) | ((aPixel >> 12) & 0x0F00) | ((aPixel >> 8) & 0x00F0) | ((aPixel >> 4) & 0x000F);
-			}
+public:
+	GLTextureUploader()
+	{
+		mNextPBO = 0;
+		mUsePBOs = GLEW_VERSION_3_0 != 0;
+		memset(mPBOs, 0, sizeof(mPBOs));
 
-			if (rightPad)
-				*dst = *(dst - 1);
+		if (mUsePBOs)
+			glGenBuffers(NUM_PBOS, mPBOs);
+	}
 
-			srcRow += theImage->GetWidth();
-			dstRow += theDestPitch;
-		}
+	virtual ~GLTextureUploader()
+	{
+		if (mUsePBOs)
+			glDeleteBuffers(NUM_PBOS, mPBOs);
 	}
-	else // palette
+
+	virtual void UploadPiece(TextureUploadJob* theJob, const TextureUploadPiece& thePiece, const void* theData)
 	{
-		uint8_t* srcRow = (uint8_t*)theImage->mColorIndices + offy * theImage->GetWidth() + offx;
-		uint16_t* dstRow = aDest;
-		uint32_t* palette = (uint32_t*)theImage->mColorTable;
+		const void* aPixels = theData;
+		int aSize = thePiece.mTexWidth * thePiece.mTexHeight * GetPixelFormatSize(theJob->mFormat);
 
-		for (int y = 0; y < theHeight; y++)
+		if (mUsePBOs)
 		{
-			uint8_t* src = srcRow;
-			uint16_t* dst = dstRow;
-			for (int x = 0; x < theWidth; x++)
+			gStateCache->BindBuffer(GL_PIXEL_UNPACK_BUFFER, mPBOs[mNextPBO]);
+			mNextPBO = (mNextPBO + 1) % NUM_PBOS;
+
+			// Orphan the old storage so we never wait on an upload still in flight
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, aSize, NULL, GL_STREAM_DRAW);
+			void* aMapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, aSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			if (aMapped != NULL)
 			{
-				uint32_t aPixel = palette[*src++];
-				*dst++ = ((aPixel >> 16) & 0xF000) | ((aPixel >> 12) & 0x0F00) | ((aPixel >> 8) & 0x00F0) | ((aPixel >> 4) & 0x000F);
+				memcpy(aMapped, theData, aSize);
+				if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+					aPixels = NULL; // offset 0 in the PBO
 			}
 
-			if (rightPad)
-				*dst = *(dst - 1);
-
-			srcRow += theImage->GetWidth();
-			dstRow += theDestPitch;
+			if (aPixels != NULL)
+				gStateCache->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 		}
+
+		gStateCache->BindTexture(thePiece.mTexture);
+		UploadTexturePixels(theJob->mFormat, thePiece.mTexWidth, thePiece.mTexHeight, false, aPixels);
+
+		if (aPixels == NULL)
+			gStateCache->BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	}
 
-	if (bottomPad)
+	virtual void JobCompleted(TextureUploadJob* theJob)
 	{
-		uint16_t* dstrow = aDest + (theDestPitch * theHeight);
-		memcpy(dstrow, dstrow - (theDestPitch * 2), (theDestPitch * 2));
+		((TextureData*)theJob->mOwner)->mUploadJob = NULL;
 	}
 
-	if (create)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, theDestPitch, theDestHeight, 0, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, aDest);
-	else
-		glTexSubImage2D(GL_TEXTURE_2D, 0, offx, offy, theDestPitch, theDestHeight, GL_BGRA, GL_UNSIGNED_SHORT_4_4_4_4_REV, aDest);
-
-	delete[] aDest;
-}
-
-static void CopyImageToTexture565(MemoryImage* theImage, int offx, int offy, int theWidth, int theHeight, int theDestPitch, int theDestHeight, bool rightPad, bool bottomPad, bool create)
-{
-	uint16_t* aDest = new uint16_t[theDestPitch * theDestHeight];
-
-	if (theImage->mColorTable == NULL)
+	virtual uint64_t GetMicroseconds()
 	{
-		uint32_t* srcRow = (uint32_t*)theImage->GetBits() + offy * theImage->GetWidth() + offx;
-		uint16_t* dstRow = aDest;
+		uint64_t aCounter = SDL_GetPerformanceCounter();
+		uint64_t aFrequency = SDL_GetPerformanceFrequency();
+		return (aCounter / aFrequency) * 1000000 + (aCounter % aFrequency) * 1000000 / aFrequency;
+	}
+};
 
-		for (int y = 0; y < theHeight; y++)
-		{
-			uint32_t* src = srcRow;
-			uint16_t* dst = dstRow;
-			for (int x = 0; x < theWidth; x++)
-			{
-				uint32_t aPixel = *src++;
-				*dst++ = ((aPixel >> 8) & 0xF800) | ((aPixel >> 5) & 0x07E0) | ((aPixel >> 3) & 0x001F);
-			}
+///////////////////////////////////////////////////////////////////////////////
+// Uploads the image plus a gutter of replicated edge pixels so filtering
+// never picks up a neighbour in the page.
+///////////////////////////////////////////////////////////////////////////////
+static void CopyImageToAtlas(MemoryImage* theImage, AtlasEntry* theEntry)
+{
+	int aGutter = gTextureAtlas->mGutter;
+	int aWidth = theEntry->mWidth;
+	int aHeight = theEntry->mHeight;
+	int aPaddedWidth = aWidth + aGutter * 2;
+	int aPaddedHeight = aHeight + aGutter * 2;
 
-			if (rightPad)
-				*dst = *(dst - 1);
+	uint32_t* aDest = (uint32_t*)gScratchBuffer.Get(aPaddedWidth * aPaddedHeight * sizeof(uint32_t));
+	uint32_t* aBits = (theImage->mColorTable == NULL) ? (uint32_t*)theImage->GetBits() : NULL;
 
-			srcRow += theImage->GetWidth();
-			dstRow += theDestPitch;
-		}
-	}
-	else
+	for (int y = 0; y < aHeight; y++)
 	{
-		uint8_t* srcRow = (uint8_t*)theImage->mColorIndices + offy * theImage->GetWidth() + offx;
-		uint16_t* dstRow = aDest;
-		uint32_t* palette = (uint32_t*)theImage->mColorTable;
-
-		for (int y = 0; y < theHeight; y++)
-		{
-			uint8_t* src = srcRow;
-			uint16_t* dst = dstRow;
-			for (int x = 0; x < theWidth; x++)
-			{
-				uint32_t aPixel = palette[*src++];
-				*dst++ = ((aPixel >> 8) & 0xF800) | ((aPixel >> 5) & 0x07E0) | ((aPixel >> 3) & 0x001F);
-			}
+		uint32_t* aDstRow = aDest + (y + aGutter) * aPaddedWidth;
+		int aSrcOffset = y * theImage->GetWidth();
 
-			if (rightPad)
-				*dst = *(dst - 1);
+		if (aBits != NULL)
+			ConvertRow8888(aDstRow + aGutter, aBits + aSrcOffset, aWidth);
+		else
+			ExpandPaletteRow8888(aDstRow + aGutter, (uint8_t*)theImage->mColorIndices + aSrcOffset, theImage->mColorTable, aWidth);
 
-			srcRow += theImage->GetWidth();
-			dstRow += theDestPitch;
+		for (int x = 0; x < aGutter; x++)
+		{
+			aDstRow[x] = aDstRow[aGutter];
+			aDstRow[aGutter + aWidth + x] = aDstRow[aGutter + aWidth - 1];
 		}
 	}
 
-	if (bottomPad)
+	for (int y = 0; y < aGutter; y++)
 	{
-		uint16_t* dstrow = aDest + (theDestPitch * theHeight);
-		memcpy(dstrow, dstrow - (theDestPitch * 2), (theDestPitch * 2));
+		memcpy(aDest + y * aPaddedWidth, aDest + aGutter * aPaddedWidth, aPaddedWidth * sizeof(uint32_t));
+		memcpy(aDest + (aGutter + aHeight + y) * aPaddedWidth, aDest + (aGutter + aHeight - 1) * aPaddedWidth, aPaddedWidth * sizeof(uint32_t));
 	}
 
-	if (create)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, theDestPitch, theDestHeight, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, aDest);
-	else
-		glTexSubImage2D(GL_TEXTURE_2D, 0, offx, offy, theDestPitch, theDestHeight, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, aDest);
-
-	delete[] aDest;
+	gStateCache->BindTexture(theEntry->mPage->mTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, theEntry->mX - aGutter, theEntry->mY - aGutter, aPaddedWidth, aPaddedHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, aDest);
 }
 
-static void CopyImageToTexturePalette8(MemoryImage* theImage, int offx, int offy, int theWidth, int theHeight, int theDestPitch, int theDestHeight, bool rightPad, bool bottomPad, bool create)
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void CreateAtlasPageTexture(AtlasPage* thePage)
 {
-	printf("PALETTE %d %d - %d %d - %d %d\n", offx, offy, theWidth, theHeight, theDestPitch, theDestHeight);
-	fflush(stdout);
+	GLuint aTexture = gStateCache->GenTexture();
+	gStateCache->BindTexture(aTexture);
 
-	uint32_t* aDest = new uint32_t[theDestPitch * theDestHeight];
+	gStateCache->TexParameter(GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	gStateCache->TexParameter(GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	gStateCache->TexParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	gStateCache->TexParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, thePage->mWidth, thePage->mHeight, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
 
-	uint8_t* srcRow = (uint8_t*)theImage->mColorIndices + offy * theImage->GetWidth() + offx;
-	uint32_t* dstRow = aDest;
-	uint16_t* palette = (uint16_t*)theImage->mColorTable;
+	thePage->mTexture = aTexture;
+}
 
-	for (int y = 0; y < theHeight; y++)
-	{
-		uint8_t* src = srcRow;
-		uint32_t* dst = dstRow;
-		for (int x = 0; x < theWidth; x++)
-		{
-			uint32_t aPixel = palette[*src++];
-			*dst++ = (aPixel & 0xFF00FF00) | ((aPixel >> 16) & 0xFF) | ((aPixel << 16) & 0xFF0000);
-		}
+///////////////////////////////////////////////////////////////////////////////
+// Repacks a fragmented page and moves the texels to match.  The page is read
+// back once, rearranged on the CPU and uploaded again.
+///////////////////////////////////////////////////////////////////////////////
+static bool CompactAtlasPage(AtlasPage* thePage)
+{
+	// Queued draws still use the old coordinates
+	gBatcher->Flush();
 
-		if (rightPad)
-			*dst = *(dst - 1);
+	AtlasMoveVector aMoves;
+	if (!gTextureAtlas->Compact(thePage, aMoves))
+		return false;
 
-		srcRow += theImage->GetWidth();
-		dstRow += theDestPitch;
-	}
+	if (aMoves.empty())
+		return true;
 
-	if (bottomPad)
+	int aPageWidth = thePage->mWidth;
+	std::vector<uint32_t> anOldBits(aPageWidth * thePage->mHeight);
+
+	gStateCache->BindTexture(thePage->mTexture);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &anOldBits[0]);
+
+	std::vector<uint32_t> aNewBits(anOldBits);
+	for (int i = 0; i < (int)aMoves.size(); i++)
 	{
-		uint32_t* dstrow = aDest + (theDestPitch * theHeight);
-		memcpy(dstrow, dstrow - (theDestPitch * 4), (theDestPitch * 4));
+		const AtlasMove& aMove = aMoves[i];
+		for (int y = 0; y < aMove.mHeight; y++)
+		{
+			memcpy(&aNewBits[(aMove.mDestY + y) * aPageWidth + aMove.mDestX],
+				&anOldBits[(aMove.mSrcY + y) * aPageWidth + aMove.mSrcX], aMove.mWidth * sizeof(uint32_t));
+		}
 	}
 
-	if (create)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, theDestPitch, theDestHeight, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, aDest);
-	else
-		glTexSubImage2D(GL_TEXTURE_2D, 0, offx, offy, theDestPitch, theDestHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, aDest);
-
-	delete[] aDest;
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, aPageWidth, thePage->mHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &aNewBits[0]);
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-static void CopyImageToTexture(MemoryImage* theImage, int offx, int offy, int texWidth, int texHeight, PixelFormat theFormat, bool create)
+static AtlasEntry* AllocateAtlasEntry(int theWidth, int theHeight)
 {
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, (gLinearFilter) ? GL_LINEAR : GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, (gLinearFilter) ? GL_LINEAR : GL_NEAREST);
+	AtlasEntry* anEntry = gTextureAtlas->Allocate(theWidth, theHeight);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	int aWidth = std::min(texWidth, (theImage->GetWidth() - offx));
-	int aHeight = std::min(texHeight, (theImage->GetHeight() - offy));
-
-	bool rightPad = aWidth < texWidth;
-	bool bottomPad = aHeight < texHeight;
+	if (anEntry == NULL)
+	{
+		AtlasPage* aPage = gTextureAtlas->FindFragmentedPage();
+		if (aPage != NULL && CompactAtlasPage(aPage))
+			anEntry = gTextureAtlas->Allocate(theWidth, theHeight);
+	}
 
-	if (aWidth > 0 && aHeight > 0)
+	if (anEntry == NULL)
 	{
-		switch (theFormat)
+		AtlasPage* aPage = gTextureAtlas->AddPage();
+		if (aPage != NULL)
 		{
-		case PixelFormat_A8R8G8B8:	CopyImageToTexture8888(theImage, offx, offy, aWidth, aHeight, texWidth, texHeight, rightPad, bottomPad, create); break;
-		case PixelFormat_A4R4G4B4:	CopyImageToTexture4444(theImage, offx, offy, aWidth, aHeight, texWidth, texHeight, rightPad, bottomPad, create); break;
-		case PixelFormat_R5G6B5:	CopyImageToTexture565(theImage, offx, offy, aWidth, aHeight, texWidth, texHeight, rightPad, bottomPad, create); break;
-		case PixelFormat_Palette8:	CopyImageToTexturePalette8(theImage, offx, offy, aWidth, aHeight, texWidth, texHeight, rightPad, bottomPad, create); break;
-		case PixelFormat_Unknown: break;
+			CreateAtlasPageTexture(aPage);
+			anEntry = gTextureAtlas->Allocate(theWidth, theHeight);
 		}
 	}
+
+	return anEntry;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -578,6 +506,8 @@ TextureData::TextureData()
 	//mPalette = NULL;
 	mPixelFormat = PixelFormat_Unknown;
 	mImageFlags = 0;
+	mAtlasEntry = NULL;
+	mUploadJob = NULL;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -591,10 +521,28 @@ TextureData::~TextureData()
 ///////////////////////////////////////////////////////////////////////////////
 void TextureData::ReleaseTextures()
 {
-	for (int i = 0; i < (int)mTextures.size(); i++)
+	if (mUploadJob != NULL)
 	{
-		GLuint* aSurface = &mTextures[i].mTexture;
-		glDeleteTextures(1, aSurface);
+		gUploadScheduler->Cancel(mUploadJob);
+		mUploadJob = NULL;
+	}
+
+	// Pending draws may still reference these textures
+	if (gBatcher != NULL && !mTextures.empty())
+		gBatcher->Flush();
+
+	if (mAtlasEntry != NULL)
+	{
+		// The page texture is shared, just give the space back
+		gTextureAtlas->Free(mAtlasEntry);
+		mAtlasEntry = NULL;
+	}
+	else
+	{
+		for (int i = 0; i < (int)mTextures.size(); i++)
+		{
+			gStateCache->DeleteTexture(mTextures[i].mTexture);
+		}
 	}
 
 	mTextures.clear();
@@ -684,10 +632,40 @@ void TextureData::CreateTextureDimensions(MemoryImage* theImage)
 	mMaxTotalV = aHeight / (float)mTexPieceHeight;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// An atlased image is a single piece exactly the size of the image; the page
+// offset is applied when UVs are generated.
+///////////////////////////////////////////////////////////////////////////////
+void TextureData::CreateAtlasTextureDimensions(MemoryImage* theImage)
+{
+	mTexPieceWidth = theImage->GetWidth();
+	mTexPieceHeight = theImage->GetHeight();
+	mTexVecWidth = 1;
+	mTexVecHeight = 1;
+
+	mTextures.resize(1);
+	mTextures[0].mTexture = mAtlasEntry->mPage->mTexture;
+	mTextures[0].mWidth = mTexPieceWidth;
+	mTextures[0].mHeight = mTexPieceHeight;
+
+	int aGutter = gTextureAtlas->mGutter;
+	mTexMemSize = (mTexPieceWidth + aGutter * 2) * (mTexPieceHeight + aGutter * 2) * 4;
+
+	mMaxTotalU = 1.0f;
+	mMaxTotalV = 1.0f;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-void TextureData::CreateTextures(MemoryImage* theImage)
+void TextureData::CreateTextures(MemoryImage* theImage, bool async)
 {
+	// Whatever was queued is stale now, the textures it was filling stay allocated
+	if (mUploadJob != NULL)
+	{
+		gUploadScheduler->Cancel(mUploadJob);
+		mUploadJob = NULL;
+	}
+
 	theImage->DeleteSWBuffers(); // don't need these buffers for 3d drawing
 
 	// Choose appropriate pixel format
@@ -727,6 +705,13 @@ void TextureData::CreateTextures(MemoryImage* theImage)
 	if (aFormat == PixelFormat_A8R8G8B8 && !(gSupportedPixelFormats & PixelFormat_A8R8G8B8))
 		aFormat = PixelFormat_A4R4G4B4;
 
+	// Small images share A8R8G8B8 atlas pages instead of getting padded textures of their own
+	bool wantAtlas = gTextureAtlas != NULL && aFormat != PixelFormat_A4R4G4B4 &&
+		!(theImage->mD3DFlags & (D3DImageFlag_NoAtlas | D3DImageFlag_Use64By64Subdivisions)) &&
+		gTextureAtlas->CanHold(theImage->mWidth, theImage->mHeight);
+	if (wantAtlas)
+		aFormat = PixelFormat_A8R8G8B8;
+
 	// Release texture if image size has changed
 	bool createTextures = false;
 	if (mWidth != theImage->mWidth || mHeight != theImage->mHeight || aFormat != mPixelFormat || theImage->mD3DFlags != mImageFlags)
@@ -735,8 +720,31 @@ void TextureData::CreateTextures(MemoryImage* theImage)
 
 		mPixelFormat = aFormat;
 		mImageFlags = theImage->mD3DFlags;
-		CreateTextureDimensions(theImage);
-		createTextures = true;
+
+		if (wantAtlas)
+			mAtlasEntry = AllocateAtlasEntry(theImage->mWidth, theImage->mHeight);
+
+		if (mAtlasEntry != NULL)
+			CreateAtlasTextureDimensions(theImage);
+		else
+		{
+			CreateTextureDimensions(theImage);
+			createTextures = true;
+		}
+	}
+
+	// Uploading into a texture that queued draws still sample would change what they show
+	gBatcher->Flush();
+
+	if (mAtlasEntry != NULL)
+	{
+		CopyImageToAtlas(theImage, mAtlasEntry);
+
+		mWidth = theImage->mWidth;
+		mHeight = theImage->mHeight;
+		mBitsChangedCount = theImage->mBitsChangedCount;
+		mPixelFormat = aFormat;
+		return;
 	}
 
 	int i, x, y;
@@ -750,6 +758,16 @@ void TextureData::CreateTextures(MemoryImage* theImage)
 	else if (aFormat == PixelFormat_A4R4G4B4)
 		aFormatSize = 2;
 
+	// New textures can be filled in later frames; until then draws using them are skipped
+	TextureUploadJob* aJob = NULL;
+	if (async && createTextures && gUploadScheduler != NULL)
+	{
+		TextureUploadSource aSource = GetImageSource(theImage);
+
+		aJob = new TextureUploadJob(this, aFormat);
+		aJob->SetSource(aSource.mBits, aSource.mIndices, aSource.mPalette, aSource.mWidth, aSource.mHeight);
+	}
+
 	i = 0;
 	for (y = 0; y < aHeight; y += mTexPieceHeight)
 	{
@@ -758,15 +776,28 @@ void TextureData::CreateTextures(MemoryImage* theImage)
 			TextureDataPiece& aPiece = mTextures[i];
 			if (createTextures)
 			{
-				glGenTextures(1, &aPiece.mTexture);
+				aPiece.mTexture = gStateCache->GenTexture();
 				mTexMemSize += aPiece.mWidth * aPiece.mHeight * aFormatSize;
 			}
-			glBindTexture(GL_TEXTURE_2D, aPiece.mTexture);
+			gStateCache->BindTexture(aPiece.mTexture);
 
-			CopyImageToTexture(theImage, x, y, aPiece.mWidth, aPiece.mHeight, aFormat, createTextures);
+			if (aJob != NULL)
+			{
+				SetDefaultTextureParams();
+				UploadTexturePixels(aFormat, aPiece.mWidth, aPiece.mHeight, true, NULL);
+				aJob->AddPiece(aPiece.mTexture, x, y, aPiece.mWidth, aPiece.mHeight);
+			}
+			else
+				CopyImageToTexture(theImage, x, y, aPiece.mWidth, aPiece.mHeight, aFormat, createTextures);
 		}
 	}
 
+	if (aJob != NULL)
+	{
+		mUploadJob = aJob;
+		gUploadScheduler->Submit(aJob);
+	}
+
 	mWidth = theImage->mWidth;
 	mHeight = theImage->mHeight;
 	mBitsChangedCount = theImage->mBitsChangedCount;
@@ -775,10 +806,10 @@ void TextureData::CreateTextures(MemoryImage* theImage)
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-void TextureData::CheckCreateTextures(MemoryImage* theImage)
+void TextureData::CheckCreateTextures(MemoryImage* theImage, bool async)
 {
 	if (mPixelFormat == PixelFormat_Unknown || theImage->mWidth != mWidth || theImage->mHeight != mHeight || theImage->mBitsChangedCount != mBitsChangedCount || theImage->mD3DFlags != mImageFlags)
-		CreateTextures(theImage);
+		CreateTextures(theImage, async);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -804,6 +835,18 @@ GLuint& TextureData::GetTexture(int x, int y, int& width, int& height, float& u1
 	width = right - left;
 	height = bottom - top;
 
+	if (mAtlasEntry != NULL)
+	{
+		AtlasPage* aPage = mAtlasEntry->mPage;
+
+		u1 = (float)(mAtlasEntry->mX + left) / aPage->mWidth;
+		v1 = (float)(mAtlasEntry->mY + top) / aPage->mHeight;
+		u2 = (float)(mAtlasEntry->mX + right) / aPage->mWidth;
+		v2 = (float)(mAtlasEntry->mY + bottom) / aPage->mHeight;
+
+		return aPiece.mTexture;
+	}
+
 	u1 = (float)left / aPiece.mWidth;
 	v1 = (float)top / aPiece.mHeight;
 	u2 = (float)right / aPiece.mWidth;
@@ -835,6 +878,18 @@ GLuint& TextureData::GetTextureF(float x, float y, float& width, float& height,
 	width = right - left;
 	height = bottom - top;
 
+	if (mAtlasEntry != NULL)
+	{
+		AtlasPage* aPage = mAtlasEntry->mPage;
+
+		u1 = (float)(mAtlasEntry->mX + left) / aPage->mWidth;
+		v1 = (float)(mAtlasEntry->mY + top) / aPage->mHeight;
+		u2 = (float)(mAtlasEntry->mX + right) / aPage->mWidth;
+		v2 = (float)(mAtlasEntry->mY + bottom) / aPage->mHeight;
+
+		return aPiece.mTexture;
+	}
+
 	u1 = (float)left / aPiece.mWidth;
 	v1 = (float)top / aPiece.mHeight;
 	u2 = (float)right / aPiece.mWidth;
@@ -843,21 +898,6 @@ GLuint& TextureData::GetTextureF(float x, float y, float& width, float& height,
 	return aPiece.mTexture;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////
-static void SetLinearFilter(bool linear)
-{
-	if (gLinearFilter != linear)
-	{
-		int aFilter = (linear) ? GL_LINEAR : GL_NEAREST;
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, aFilter);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, aFilter);
-
-		gLinearFilter = linear;
-	}
-}
-
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 void TextureData::Blt(float theX, float theY, const Rect& theSrcRect, const Color& theColor)
@@ -879,10 +919,6 @@ void TextureData::Blt(float theX, float theY, const Rect& theSrcRect, const Colo
 	if ((srcLeft >= srcRight) || (srcTop >= srcBottom))
 		return;
 
-	glEnable(GL_TEXTURE_2D);
-	glActiveTexture(GL_TEXTURE0);
-	glUniform1i(gUfUseTexture, 1);
-
 	while (srcY < srcBottom)
 	{
 		srcX = srcLeft;
@@ -903,11 +939,8 @@ void TextureData::Blt(float theX, float theY, const Rect& theSrcRect, const Colo
 				{ {x + aWidth}, {y + aHeight}, {0},{aColor},{u2},{v2} }
 			};
 
-			glBindTexture(GL_TEXTURE_2D, aTexture);
-
-			GfxBegin(GL_TRIANGLE_STRIP);
-			GfxAddVertices(aVertex, 4);
-			GfxEnd();
+			gBatcher->SetTexture(aTexture);
+			gBatcher->AddTriangleStrip(aVertex, 4);
 
 			srcX += aWidth;
 			dstX += aWidth;
@@ -1014,11 +1047,7 @@ static void DrawPolyClipped(const Rect* theClipRect, const VertexList& theList)
 	VertexList& aList = *out;
 
 	if (aList.size() >= 3)
-	{
-		GfxBegin(GL_TRIANGLE_FAN);
-		GfxAddVertices(aList);
-		GfxEnd();
-	}
+		gBatcher->AddTriangleFan(aList.mVerts, aList.size());
 }
 
 
@@ -1073,10 +1102,6 @@ void TextureData::BltTransformed(const SexyMatrix3& theTrans, const Rect& theSrc
 	if ((srcLeft >= srcRight) || (srcTop >= srcBottom))
 		return;
 
-	glEnable(GL_TEXTURE_2D);
-	glActiveTexture(GL_TEXTURE0);
-	glUniform1i(gUfUseTexture, 1);
-
 	while (srcY < srcBottom)
 	{
 		srcX = srcLeft;
@@ -1125,14 +1150,10 @@ void TextureData::BltTransformed(const SexyMatrix3& theTrans, const Rect& theSrc
 				{ {tp[3].x},{tp[3].y},{0},{aColor},{u2},{v2} }
 			};
 
-			glBindTexture(GL_TEXTURE_2D, aTexture);
+			gBatcher->SetTexture(aTexture);
 
 			if (!clipped)
-			{
-				GfxBegin(GL_TRIANGLE_STRIP);
-				GfxAddVertices(aVertex, 4);
-				GfxEnd();
-			}
+				gBatcher->AddTriangleStrip(aVertex, 4);
 			else
 			{
 				VertexList aList;
@@ -1155,16 +1176,19 @@ void TextureData::BltTransformed(const SexyMatrix3& theTrans, const Rect& theSrc
 
 void TextureData::BltTriangles(const TriVertex theVertices[][3], int theNumTriangles, unsigned int theColor, float tx, float ty)
 {
-	if ((mMaxTotalU <= 1.0) && (mMaxTotalV <= 1.0))
+	if (mAtlasEntry != NULL)
 	{
-		glEnable(GL_TEXTURE_2D);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mTextures[0].mTexture);
-		glUniform1i(gUfUseTexture, 1);
+		AtlasPage* aPage = mAtlasEntry->mPage;
 
-		GfxBegin(GL_TRIANGLES);
-		GfxAddVertices(theVertices, theNumTriangles, theColor, tx, ty, mMaxTotalU, mMaxTotalV);
-		GfxEnd();
+		gBatcher->SetTexture(mTextures[0].mTexture);
+		gBatcher->AddTriangles(theVertices, theNumTriangles, theColor, tx, ty,
+			(float)mAtlasEntry->mWidth / aPage->mWidth, (float)mAtlasEntry->mHeight / aPage->mHeight,
+			(float)mAtlasEntry->mX / aPage->mWidth, (float)mAtlasEntry->mY / aPage->mHeight);
+	}
+	else if ((mMaxTotalU <= 1.0) && (mMaxTotalV <= 1.0))
+	{
+		gBatcher->SetTexture(mTextures[0].mTexture);
+		gBatcher->AddTriangles(theVertices, theNumTriangles, theColor, tx, ty, mMaxTotalU, mMaxTotalV);
 	}
 	else
 	{
@@ -1240,10 +1264,8 @@ void TextureData::BltTriangles(const TriVertex theVertices[][3], int theNumTrian
 					DoPolyTextureClip(aList);
 					if (aList.size() >= 3)
 					{
-						glBindTexture(GL_TEXTURE_2D, aPiece.mTexture);
-						GfxBegin(GL_TRIANGLE_FAN);
-						GfxAddVertices(aList);
-						GfxEnd();
+						gBatcher->SetTexture(aPiece.mTexture);
+						gBatcher->AddTriangleFan(aList.mVerts, aList.size());
 					}
 				}
 			}
@@ -1275,16 +1297,26 @@ GLInterface::GLInterface(SexyAppBase* theApp)
 	mCursorX = 0;
 	mCursorY = 0;
 
-	gVertexMode = (GLenum)-1;
-	gNumVertices = 0;
-	gVertices = new GLVertex[MAX_VERTICES];
-	memset(gVertices, 0, sizeof(GLVertex) * MAX_VERTICES);
+	mStateCache = new GLStateCache();
+	gStateCache = mStateCache;
+
+	mBatcher = new GLBatcher(MAX_VERTICES);
+	gBatcher = mBatcher;
+	mTextureAtlas = NULL;
+
+	mTextureUploader = NULL;
+	mUploadScheduler = NULL;
+	mAsyncTextureUploads = true;
+
+	mRecorder = NULL;
 }
 
 GLInterface::~GLInterface()
 {
 	Flush();
 
+	delete mRecorder;
+
 	ImageSet::iterator anItr;
 	for (anItr = mImageSet.begin(); anItr != mImageSet.end(); ++anItr)
 	{
@@ -1293,19 +1325,29 @@ GLInterface::~GLInterface()
 		anImage->mD3DData = NULL;
 	}
 
-	delete[] gVertices;
+	gUploadScheduler = NULL;
+	delete mUploadScheduler;
+	delete mTextureUploader;
+
+	if (mTextureAtlas != NULL)
+	{
+		for (int i = 0; i < (int)mTextureAtlas->mPages.size(); i++)
+			gStateCache->DeleteTexture(mTextureAtlas->mPages[i]->mTexture);
+
+		gTextureAtlas = NULL;
+		delete mTextureAtlas;
+	}
+
+	gBatcher = NULL;
+	delete mBatcher;
+
+	gStateCache = NULL;
+	delete mStateCache;
 }
 
 void GLInterface::SetDrawMode(int theDrawMode)
 {
-	if (theDrawMode == Graphics::DRAWMODE_NORMAL)
-	{
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	}
-	else // Additive
-	{
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-	}
+	gBatcher->SetDrawMode(theDrawMode);
 }
 
 void GLInterface::AddGLImage(GLImage* theGLImage)
@@ -1326,6 +1368,9 @@ void GLInterface::RemoveGLImage(GLImage* theGLImage)
 
 void GLInterface::Remove3DData(MemoryImage* theImage)
 {
+	if (mRecorder != NULL)
+		mRecorder->ForgetImage(theImage);
+
 	if (theImage->mD3DData != NULL)
 	{
 		delete (TextureData*)theImage->mD3DData;
@@ -1353,6 +1398,7 @@ void GLInterface::UpdateViewport()
 
 	SDL_GL_GetDrawableSize((SDL_Window*)mApp->mWindow, &width, &height);
 
+	gBatcher->Flush();
 	glClear(GL_COLOR_BUFFER_BIT);
 	Flush();
 
@@ -1377,6 +1423,9 @@ void GLInterface::UpdateViewport()
 
 int GLInterface::Init(bool IsWindowed)
 {
+	// The context may be new, nothing the cache remembers can be trusted
+	gStateCache->Invalidate();
+
 	static bool inited = false;
 	if (!inited)
 	{
@@ -1393,21 +1442,6 @@ int GLInterface::Init(bool IsWindowed)
 		gUfUseTexture = glGetUniformLocation(gProgram, "UseTexture");
 
 		glGenVertexArrays(1, &gVao);
-		glGenBuffers(1, &gVbo);
-
-		glBindVertexArray(gVao);
-
-		glBindBuffer(GL_ARRAY_BUFFER, gVbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(GLVertex) * MAX_VERTICES, 0, GL_DYNAMIC_DRAW);
-
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GLVertex), 0);
-		glEnableVertexAttribArray(0);
-
-		glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GLVertex), (void*)(sizeof(float) * 3));
-		glEnableVertexAttribArray(1);
-
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GLVertex), (void*)(sizeof(float) * 3 + sizeof(uint32_t)));
-		glEnableVertexAttribArray(2);
 	}
 
 	int aMaxSize;
@@ -1422,14 +1456,32 @@ int GLInterface::Init(bool IsWindowed)
 	gMaxTextureWidth = aMaxSize;
 	gMaxTextureHeight = aMaxSize;
 	gSupportedPixelFormats = PixelFormat_A8R8G8B8 | PixelFormat_A4R4G4B4 | PixelFormat_R5G6B5 | PixelFormat_Palette8;
-	gLinearFilter = false;
+	gBatcher->Init(gVao, gUfUseTexture, gStateCache);
+
+	if (mUploadScheduler == NULL)
+	{
+		// Leave a core for the main thread, with none left uploads convert inside Flush
+		int aNumWorkers = std::max(0, std::min(SDL_GetCPUCount() - 1, 2));
+
+		mTextureUploader = new GLTextureUploader();
+		mUploadScheduler = new TextureUploadScheduler(mTextureUploader, aNumWorkers, UPLOAD_BUDGET_MICROS);
+		gUploadScheduler = mUploadScheduler;
+	}
 
-	glUseProgram(gProgram);
+	if (mTextureAtlas == NULL)
+	{
+		int aPageSize = std::min(ATLAS_PAGE_SIZE, aMaxSize);
+		mTextureAtlas = new TextureAtlas(aPageSize, aPageSize);
+		gTextureAtlas = mTextureAtlas;
+	}
+
+	gStateCache->UseProgram(gProgram);
 	glm::mat4 viewMtx{ 1.0f };
 	auto projMtx = glm::ortho<float>(0, mWidth - 1, mHeight - 1, 0, -10, 10);
 	glUniformMatrix4fv(gUfViewMtx, 1, GL_FALSE, glm::value_ptr(viewMtx));
 	glUniformMatrix4fv(gUfProjMtx, 1, GL_FALSE, glm::value_ptr(projMtx));
-	glUniform1i(gUfTexture, 0);
+	gStateCache->Uniform1i(gUfTexture, 0);
+	glActiveTexture(GL_TEXTURE0);
 
 	glEnable(GL_BLEND);
 	glDisable(GL_DITHER);
@@ -1479,17 +1531,43 @@ void GLInterface::SetCursorPos(int theCursorX, int theCursorY)
 	mNextCursorY = theCursorY;
 }
 
+void GLInterface::StartRecording()
+{
+	delete mRecorder;
+	mRecorder = new RenderCommandRecorder();
+}
+
+bool GLInterface::StopRecording(const std::string& theFileName)
+{
+	if (mRecorder == NULL)
+		return false;
+
+	bool success = mRecorder->SaveToFile(theFileName);
+	delete mRecorder;
+	mRecorder = NULL;
+	return success;
+}
+
 bool GLInterface::PreDraw()
 {
-	gLinearFilter = false;
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gBatcher->SetLinearFilter(false);
+	gBatcher->SetDrawMode(Graphics::DRAWMODE_NORMAL);
 	return true;
 }
 
 void GLInterface::Flush()
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->Flush();
+
+	gBatcher->EndFrame();
+
+	if (mUploadScheduler != NULL)
+		mUploadScheduler->Update();
+
+	gStateCache->EndFrame();
+
 	SDL_GL_SwapWindow((SDL_Window*)mApp->mWindow);
 }
 
@@ -1509,11 +1587,16 @@ bool GLInterface::CreateImageTexture(MemoryImage* theImage)
 	}
 
 	TextureData* aData = (TextureData*)theImage->mD3DData;
-	aData->CheckCreateTextures(theImage);
+	bool async = mAsyncTextureUploads && theImage->mWidth * theImage->mHeight >= ASYNC_UPLOAD_MIN_PIXELS;
+	aData->CheckCreateTextures(theImage, async);
 
 	if (wantPurge)
 		theImage->PurgeBits();
 
+	// Not resident yet, skip the draw
+	if (aData->mUploadJob != NULL)
+		return false;
+
 	return aData->mPixelFormat != PixelFormat_Unknown;
 }
 
@@ -1528,6 +1611,27 @@ bool GLInterface::RecoverBits(MemoryImage* theImage)
 
 	printf("recover\n");
 	fflush(stdout);
+	gBatcher->Flush();
+
+	// The textures only hold the image once its upload went through
+	if (aData->mUploadJob != NULL)
+		mUploadScheduler->Finish(aData->mUploadJob);
+
+	if (aData->mAtlasEntry != NULL)
+	{
+		AtlasEntry* anEntry = aData->mAtlasEntry;
+		AtlasPage* aPage = anEntry->mPage;
+		std::vector<uint32_t> aPageBits(aPage->mWidth * aPage->mHeight);
+
+		gStateCache->BindTexture(aPage->mTexture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, &aPageBits[0]);
+
+		uint32_t* aBits = (uint32_t*)theImage->GetBits();
+		for (int y = 0; y < anEntry->mHeight; y++)
+			memcpy(aBits + y * theImage->mWidth, &aPageBits[(anEntry->mY + y) * aPage->mWidth + anEntry->mX], anEntry->mWidth * sizeof(uint32_t));
+
+		return true;
+	}
 	for (int aPieceRow = 0; aPieceRow < aData->mTexVecHeight; aPieceRow++)
 	{
 		for (int aPieceCol = 0; aPieceCol < aData->mTexVecWidth; aPieceCol++)
@@ -1539,9 +1643,7 @@ bool GLInterface::RecoverBits(MemoryImage* theImage)
 			int aWidth = std::min(theImage->mWidth - offx, aPiece->mWidth);
 			int aHeight = std::min(theImage->mHeight - offy, aPiece->mHeight);
 
-			glEnable(GL_TEXTURE_2D);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, aPiece->mTexture);
+			gStateCache->BindTexture(aPiece->mTexture);
 
 			glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, theImage->GetBits());
 
@@ -1565,6 +1667,10 @@ bool GLInterface::RecoverBits(MemoryImage* theImage)
 
 void GLInterface::PushTransform(const SexyMatrix3& theTransform, bool concatenate)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->PushTransform(theTransform, concatenate);
+
 	if (mTransformStack.empty() || !concatenate)
 		mTransformStack.push_back(theTransform);
 	else
@@ -1576,12 +1682,20 @@ void GLInterface::PushTransform(const SexyMatrix3& theTransform, bool concatenat
 
 void GLInterface::PopTransform()
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->PopTransform();
+
 	if (!mTransformStack.empty())
 		mTransformStack.pop_back();
 }
 
 void GLInterface::Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->Blt(theImage, theX, theY, theSrcRect, theColor, theDrawMode, linearFilter);
+
 	if (!mTransformStack.empty())
 	{
 		BltClipF(theImage, theX, theY, theSrcRect, NULL, theColor, theDrawMode);
@@ -1600,12 +1714,16 @@ void GLInterface::Blt(Image* theImage, float theX, float theY, const Rect& theSr
 
 	TextureData* aData = (TextureData*)aSrcMemoryImage->mD3DData;
 
-	SetLinearFilter(linearFilter);
+	gBatcher->SetLinearFilter(linearFilter);
 	aData->Blt(theX, theY, theSrcRect, theColor);
 }
 
 void GLInterface::BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->BltClipF(theImage, theX, theY, theSrcRect, theClipRect, theColor, theDrawMode);
+
 	SexyTransform2D aTransform;
 	aTransform.Translate(theX, theY);
 
@@ -1614,6 +1732,10 @@ void GLInterface::BltClipF(Image* theImage, float theX, float theY, const Rect&
 
 void GLInterface::BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->BltMirror(theImage, theX, theY, theSrcRect, theColor, theDrawMode, linearFilter);
+
 	SexyTransform2D aTransform;
 
 	aTransform.Translate(-theSrcRect.mWidth, 0);
@@ -1625,6 +1747,10 @@ void GLInterface::BltMirror(Image* theImage, float theX, float theY, const Rect&
 
 void GLInterface::StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->StretchBlt(theImage, theDestRect, theSrcRect, theClipRect, theColor, theDrawMode, fastStretch, mirror);
+
 	float xScale = (float)theDestRect.mWidth / theSrcRect.mWidth;
 	float yScale = (float)theDestRect.mHeight / theSrcRect.mHeight;
 
@@ -1643,6 +1769,10 @@ void GLInterface::StretchBlt(Image* theImage, const Rect& theDestRect, const Rec
 
 void GLInterface::BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->BltRotated(theImage, theX, theY, theClipRect, theColor, theDrawMode, theRot, theRotCenterX, theRotCenterY, theSrcRect);
+
 	SexyTransform2D aTransform;
 
 	aTransform.Translate(-theRotCenterX, -theRotCenterY);
@@ -1654,6 +1784,10 @@ void GLInterface::BltRotated(Image* theImage, float theX, float theY, const Rect
 
 void GLInterface::BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX, float theY, bool center)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->BltTransformed(theImage, theClipRect, theColor, theDrawMode, theSrcRect, theTransform, linearFilter, theX, theY, center);
+
 	if (!PreDraw())
 		return;
 
@@ -1668,7 +1802,7 @@ void GLInterface::BltTransformed(Image* theImage, const Rect* theClipRect, const
 
 	if (!mTransformStack.empty())
 	{
-		SetLinearFilter(true); // force linear filtering in the case of a global transform
+		gBatcher->SetLinearFilter(true); // force linear filtering in the case of a global transform
 		if (theX != 0 || theY != 0)
 		{
 			SexyTransform2D aTransform;
@@ -1689,13 +1823,17 @@ void GLInterface::BltTransformed(Image* theImage, const Rect* theClipRect, const
 	}
 	else
 	{
-		SetLinearFilter(linearFilter);
+		gBatcher->SetLinearFilter(linearFilter);
 		aData->BltTransformed(theTransform, theSrcRect, theColor, theClipRect, theX, theY, center);
 	}
 }
 
 void GLInterface::DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->DrawLine(theStartX, theStartY, theEndX, theEndY, theColor, theDrawMode);
+
 	if (!PreDraw())
 		return;
 
@@ -1723,8 +1861,7 @@ void GLInterface::DrawLine(double theStartX, double theStartY, double theEndX, d
 		y2 = theEndY;
 	}
 
-	glDisable(GL_TEXTURE_2D);
-	glUniform1i(gUfUseTexture, 0);
+	gBatcher->SetTexture(0);
 
 	GLVertex aVertex[3] = {
 		{ {x1},{y1},{0},{theColor.ToInt()},{0},{0} },
@@ -1732,13 +1869,15 @@ void GLInterface::DrawLine(double theStartX, double theStartY, double theEndX, d
 		{ {x2 + 0.5f},{y2 + 0.5f},{0},{theColor.ToInt()},{0},{0} },
 	};
 
-	GfxBegin(GL_LINE_STRIP);
-	GfxAddVertices(aVertex, 3);
-	GfxEnd();
+	gBatcher->AddLineStrip(aVertex, 3);
 }
 
 void GLInterface::FillRect(const Rect& theRect, const Color& theColor, int theDrawMode)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->FillRect(theRect, theColor, theDrawMode);
+
 	if (!PreDraw())
 		return;
 
@@ -1771,16 +1910,17 @@ void GLInterface::FillRect(const Rect& theRect, const Color& theColor, int theDr
 		}
 	}
 
-	glDisable(GL_TEXTURE_2D);
-	glUniform1i(gUfUseTexture, 0);
+	gBatcher->SetTexture(0);
 
-	GfxBegin(GL_TRIANGLE_STRIP);
-	GfxAddVertices(aVertex, 4);
-	GfxEnd();
+	gBatcher->AddTriangleStrip(aVertex, 4);
 }
 
 void GLInterface::DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->DrawTriangle(p1, p2, p3, theColor, theDrawMode);
+
 	if (!PreDraw())
 		return;
 
@@ -1791,8 +1931,7 @@ void GLInterface::DrawTriangle(const TriVertex& p1, const TriVertex& p2, const T
 	unsigned int col2 = GetColorFromTriVertex(p1, aColor);
 	unsigned int col3 = GetColorFromTriVertex(p1, aColor);
 
-	glDisable(GL_TEXTURE_2D);
-	glUniform1i(gUfUseTexture, 0);
+	gBatcher->SetTexture(0);
 
 	GLVertex aVertex[3] = {
 		{ {p1.x}, {p1.y}, {0}, {col1}, {0},{0} },
@@ -1800,19 +1939,25 @@ void GLInterface::DrawTriangle(const TriVertex& p1, const TriVertex& p2, const T
 		{ {p3.x}, {p3.y}, {0}, {col3}, {0},{0} },
 	};
 
-	GfxBegin(GL_TRIANGLE_STRIP);
-	GfxAddVertices(aVertex, 3);
-	GfxEnd();
+	gBatcher->AddTriangleStrip(aVertex, 3);
 }
 
 void GLInterface::DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->DrawTriangleTex(p1, p2, p3, theColor, theDrawMode, theTexture, blend);
+
 	TriVertex aVertices[1][3] = { {p1, p2, p3} };
 	DrawTrianglesTex(aVertices, 1, theColor, theDrawMode, theTexture, blend);
 }
 
 void GLInterface::DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->DrawTrianglesTex(theVertices, theNumTriangles, theColor, theDrawMode, theTexture, tx, ty, blend);
+
 	if (!PreDraw()) return;
 
 	MemoryImage* aSrcMemoryImage = (MemoryImage*)theTexture;
@@ -1824,7 +1969,7 @@ void GLInterface::DrawTrianglesTex(const TriVertex theVertices[][3], int theNumT
 
 	TextureData* aData = (TextureData*)aSrcMemoryImage->mD3DData;
 
-	SetLinearFilter(blend);
+	gBatcher->SetLinearFilter(blend);
 
 	unsigned int aColor = (theColor.mRed << 0) | (theColor.mGreen << 8) | (theColor.mBlue << 16) | (theColor.mAlpha << 24);
 	aData->BltTriangles(theVertices, theNumTriangles, aColor, tx, ty);
@@ -1832,6 +1977,10 @@ void GLInterface::DrawTrianglesTex(const TriVertex theVertices[][3], int theNumT
 
 void GLInterface::DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->DrawTrianglesTexStrip(theVertices, theNumTriangles, theColor, theDrawMode, theTexture, tx, ty, blend);
+
 	TriVertex aList[100][3];
 	int aTriNum = 0;
 	while (aTriNum < theNumTriangles)
@@ -1850,6 +1999,10 @@ void GLInterface::DrawTrianglesTexStrip(const TriVertex theVertices[], int theNu
 
 void GLInterface::FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty)
 {
+	RenderRecordScope aRecordScope(mRecorder);
+	if (aRecordScope.IsOutermost())
+		mRecorder->FillPoly(theVertices, theNumVertices, theClipRect, theColor, theDrawMode, tx, ty);
+
 	if (theNumVertices < 3)
 		return;
 
@@ -1859,8 +2012,7 @@ void GLInterface::FillPoly(const Point theVertices[], int theNumVertices, const
 	SetDrawMode(theDrawMode);
 	unsigned int aColor = (theColor.mRed << 0) | (theColor.mGreen << 8) | (theColor.mBlue << 16) | (theColor.mAlpha << 24);
 
-	glDisable(GL_TEXTURE_2D);
-	glUniform1i(gUfUseTexture, 0);
+	gBatcher->SetTexture(0);
 
 	VertexList aList;
 	for (int i = 0; i < theNumVertices; i++)
@@ -1880,9 +2032,5 @@ void GLInterface::FillPoly(const Point theVertices[], int theNumVertices, const
 	if (theClipRect != NULL)
 		DrawPolyClipped(theClipRect, aList);
 	else
-	{
-		GfxBegin(GL_TRIANGLE_FAN);
-		GfxAddVertices(aList);
-		GfxEnd();
-	}
+		gBatcher->AddTriangleFan(aList.mVerts, aList.size());
 }
\ No newline at end of file
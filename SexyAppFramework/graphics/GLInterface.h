@@ -5,6 +5,7 @@
 #include "graphics/MemoryImage.h"
 #include "misc/CritSect.h"
 #include "graphics/NativeDisplay.h"
+#include "graphics/RenderCommandStream.h"
 #include "misc/Rect.h"
 #include "misc/Ratio.h"
 #include "misc/SexyMatrix.h"
@@ -16,6 +17,13 @@ namespace Sexy
 
 	class SexyAppBase;
 	class GLImage;
+	class GLBatcher;
+	class GLStateCache;
+	class TextureAtlas;
+	struct AtlasEntry;
+	class TextureUploadJob;
+	class TextureUploadScheduler;
+	class TextureUploadBackend;
 	class SexyMatrix3;
 	class TriVertex;
 
@@ -26,7 +34,8 @@ namespace Sexy
 		D3DImageFlag_MinimizeNumSubdivisions = 0x0001,		// subdivide image into fewest possible textures (may use more memory)
 		D3DImageFlag_Use64By64Subdivisions = 0x0002,		// good to use with image strips so the entire texture isn't pulled in when drawing just a piece
 		D3DImageFlag_UseA4R4G4B4 = 0x0004,		// images with not too many color gradients work well in this format
-		D3DImageFlag_UseA8R8G8B8 = 0x0008		// non-alpha images will be stored as R5G6B5 by default so use this option if you want a 32-bit non-alpha image
+		D3DImageFlag_UseA8R8G8B8 = 0x0008,		// non-alpha images will be stored as R5G6B5 by default so use this option if you want a 32-bit non-alpha image
+		D3DImageFlag_NoAtlas = 0x0010			// always give the image its own textures, even if it is small enough to share an atlas page
 	};
 
 	///////////////////////////////////////////////////////////////////////////////
@@ -142,6 +151,8 @@ namespace Sexy
 		float mMaxTotalU, mMaxTotalV;
 		PixelFormat mPixelFormat;
 		int mImageFlags;
+		AtlasEntry* mAtlasEntry;	// set when the image lives in a shared atlas page instead of mTextures owning GL textures
+		TextureUploadJob* mUploadJob;	// set while the textures are allocated but their contents are still queued
 
 		TextureData();
 		~TextureData();
@@ -149,8 +160,9 @@ namespace Sexy
 		void ReleaseTextures();
 
 		void CreateTextureDimensions(MemoryImage* theImage);
-		void CreateTextures(MemoryImage* theImage);
-		void CheckCreateTextures(MemoryImage* theImage);
+		void CreateAtlasTextureDimensions(MemoryImage* theImage);
+		void CreateTextures(MemoryImage* theImage, bool async = false);
+		void CheckCreateTextures(MemoryImage* theImage, bool async = false);
 		GLuint& GetTexture(int x, int y, int& width, int& height, float& u1, float& v1, float& u2, float& v2);
 		GLuint& GetTextureF(float x, float y, float& width, float& height, float& u1, float& v1, float& u2, float& v2);
 
@@ -159,7 +171,7 @@ namespace Sexy
 		void BltTriangles(const TriVertex theVertices[][3], int theNumTriangles, unsigned int theColor, float tx = 0, float ty = 0);
 	};
 
-	class GLInterface : public NativeDisplay
+	class GLInterface : public NativeDisplay, public RenderCommandTarget
 	{
 	public:
 		SexyAppBase* mApp;
@@ -175,6 +187,13 @@ namespace Sexy
 		int						mMillisecondsPerFrame;
 
 		GLImage* mScreenImage;
+		GLBatcher* mBatcher;
+		GLStateCache* mStateCache;
+		TextureAtlas* mTextureAtlas;
+		TextureUploadBackend* mTextureUploader;
+		TextureUploadScheduler* mUploadScheduler;
+		bool					mAsyncTextureUploads;	// fill new large textures over the next frames instead of on first draw
+		RenderCommandRecorder*	mRecorder;				// non-NULL between StartRecording and StopRecording
 
 		int						mNextCursorX;
 		int						mNextCursorY;
@@ -207,28 +226,31 @@ namespace Sexy
 
 		void					SetCursorPos(int theCursorX, int theCursorY);
 
+		void					StartRecording();
+		bool					StopRecording(const std::string& theFileName);
+
 	public:
-		void					PushTransform(const SexyMatrix3& theTransform, bool concatenate = true);
-		void					PopTransform();
+		virtual void			PushTransform(const SexyMatrix3& theTransform, bool concatenate = true);
+		virtual void			PopTransform();
 
 		bool					PreDraw();
-		void					Flush();
+		virtual void			Flush();
 
 		bool					CreateImageTexture(MemoryImage* theImage);
 		bool					RecoverBits(MemoryImage* theImage);
-		void					Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter = false);
-		void					BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode);
-		void					BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter = false);
-		void					StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror = false);
-		void					BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect);
-		void					BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX = 0, float theY = 0, bool center = false);
-		void					DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode);
-		void					FillRect(const Rect& theRect, const Color& theColor, int theDrawMode);
-		void					DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode);
-		void					DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend = true);
-		void					DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx = 0, float ty = 0, bool blend = true);
-		void					DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx = 0, float ty = 0, bool blend = true);
-		void					FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty);
+		virtual void			Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter = false);
+		virtual void			BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode);
+		virtual void			BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter = false);
+		virtual void			StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror = false);
+		virtual void			BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect);
+		virtual void			BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX = 0, float theY = 0, bool center = false);
+		virtual void			DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode);
+		virtual void			FillRect(const Rect& theRect, const Color& theColor, int theDrawMode);
+		virtual void			DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode);
+		virtual void			DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend = true);
+		virtual void			DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx = 0, float ty = 0, bool blend = true);
+		virtual void			DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx = 0, float ty = 0, bool blend = true);
+		virtual void			FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty);
 	};
 
 }
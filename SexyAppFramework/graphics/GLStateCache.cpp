@@ -0,0 +1,264 @@
+#include <GL/glew.h>
+
+#include "graphics/GLStateCache.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLStateCache::GLStateCache()
+{
+	mFrameCounters.Reset();
+	mLastFrameCounters.Reset();
+	Invalidate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Forgets everything so the next call of each kind goes through.
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::Invalidate()
+{
+	mBoundTexture = INVALID_NAME;
+	mBlendSrc = GL_NONE;
+	mBlendDst = GL_NONE;
+	mProgram = INVALID_NAME;
+	mVertexArray = INVALID_NAME;
+	mArrayBuffer = INVALID_NAME;
+	mUnpackBuffer = INVALID_NAME;
+
+	mSamplers.clear();
+	mUniforms.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::EndFrame()
+{
+	mLastFrameCounters = mFrameCounters;
+	mFrameCounters.Reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool GLStateCache::Skip(bool same)
+{
+	if (same)
+		mFrameCounters.mSkipped++;
+	else
+		mFrameCounters.mIssued++;
+
+	return same;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::BindTexture(GLuint theTexture)
+{
+	if (Skip(theTexture == mBoundTexture))
+		return;
+
+	IssueBindTexture(theTexture);
+	mBoundTexture = theTexture;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLuint GLStateCache::GenTexture()
+{
+	GLuint aTexture = IssueGenTexture();
+	mFrameCounters.mIssued++;
+
+	// Defaults of a new texture object
+	GLSamplerState& aState = mSamplers[aTexture];
+	aState.mMinFilter = GL_NEAREST_MIPMAP_LINEAR;
+	aState.mMagFilter = GL_LINEAR;
+	aState.mWrapS = GL_REPEAT;
+	aState.mWrapT = GL_REPEAT;
+
+	return aTexture;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GL hands deleted names out again, so their parameters must be forgotten.
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::DeleteTexture(GLuint theTexture)
+{
+	IssueDeleteTexture(theTexture);
+	mFrameCounters.mIssued++;
+
+	mSamplers.erase(theTexture);
+	if (mBoundTexture == theTexture)
+		mBoundTexture = 0; // deleting a bound texture binds 0
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sets a parameter of the bound texture.
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::TexParameter(GLenum theName, GLint theValue)
+{
+	GLint* aValue = NULL;
+
+	if (mBoundTexture != 0 && mBoundTexture != INVALID_NAME)
+	{
+		SamplerMap::iterator anItr = mSamplers.find(mBoundTexture);
+		if (anItr == mSamplers.end())
+		{
+			// Made before the last Invalidate, nothing is known about it
+			GLSamplerState aState;
+			aState.mMinFilter = aState.mMagFilter = aState.mWrapS = aState.mWrapT = -1;
+			anItr = mSamplers.insert(SamplerMap::value_type(mBoundTexture, aState)).first;
+		}
+
+		GLSamplerState& aState = anItr->second;
+		switch (theName)
+		{
+		case GL_TEXTURE_MIN_FILTER: aValue = &aState.mMinFilter; break;
+		case GL_TEXTURE_MAG_FILTER: aValue = &aState.mMagFilter; break;
+		case GL_TEXTURE_WRAP_S: aValue = &aState.mWrapS; break;
+		case GL_TEXTURE_WRAP_T: aValue = &aState.mWrapT; break;
+		}
+	}
+
+	if (Skip(aValue != NULL && *aValue == theValue))
+		return;
+
+	IssueTexParameter(theName, theValue);
+	if (aValue != NULL)
+		*aValue = theValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::BlendFunc(GLenum theSrc, GLenum theDst)
+{
+	if (Skip(theSrc == mBlendSrc && theDst == mBlendDst))
+		return;
+
+	IssueBlendFunc(theSrc, theDst);
+	mBlendSrc = theSrc;
+	mBlendDst = theDst;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::UseProgram(GLuint theProgram)
+{
+	if (Skip(theProgram == mProgram))
+		return;
+
+	IssueUseProgram(theProgram);
+	mProgram = theProgram;
+
+	// Uniform values belong to the program
+	mUniforms.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::Uniform1i(GLint theLocation, int theValue)
+{
+	UniformMap::iterator anItr = mUniforms.find(theLocation);
+	if (Skip(anItr != mUniforms.end() && anItr->second == theValue))
+		return;
+
+	IssueUniform1i(theLocation, theValue);
+	mUniforms[theLocation] = theValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::BindVertexArray(GLuint theVertexArray)
+{
+	if (Skip(theVertexArray == mVertexArray))
+		return;
+
+	IssueBindVertexArray(theVertexArray);
+	mVertexArray = theVertexArray;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::BindBuffer(GLenum theTarget, GLuint theBuffer)
+{
+	GLuint* aBound = NULL;
+	if (theTarget == GL_ARRAY_BUFFER)
+		aBound = &mArrayBuffer;
+	else if (theTarget == GL_PIXEL_UNPACK_BUFFER)
+		aBound = &mUnpackBuffer;
+
+	if (Skip(aBound != NULL && *aBound == theBuffer))
+		return;
+
+	IssueBindBuffer(theTarget, theBuffer);
+	if (aBound != NULL)
+		*aBound = theBuffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Deleting a bound buffer binds 0, and the name may come back from
+// glGenBuffers.
+///////////////////////////////////////////////////////////////////////////////
+void GLStateCache::DeleteBuffer(GLuint theBuffer)
+{
+	IssueDeleteBuffer(theBuffer);
+	mFrameCounters.mIssued++;
+
+	if (mArrayBuffer == theBuffer)
+		mArrayBuffer = 0;
+	if (mUnpackBuffer == theBuffer)
+		mUnpackBuffer = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLuint GLStateCache::IssueGenTexture()
+{
+	GLuint aTexture = 0;
+	glGenTextures(1, &aTexture);
+	return aTexture;
+}
+
+void GLStateCache::IssueBindTexture(GLuint theTexture)
+{
+	glBindTexture(GL_TEXTURE_2D, theTexture);
+}
+
+void GLStateCache::IssueDeleteTexture(GLuint theTexture)
+{
+	glDeleteTextures(1, &theTexture);
+}
+
+void GLStateCache::IssueTexParameter(GLenum theName, GLint theValue)
+{
+	glTexParameteri(GL_TEXTURE_2D, theName, theValue);
+}
+
+void GLStateCache::IssueBlendFunc(GLenum theSrc, GLenum theDst)
+{
+	glBlendFunc(theSrc, theDst);
+}
+
+void GLStateCache::IssueUseProgram(GLuint theProgram)
+{
+	glUseProgram(theProgram);
+}
+
+void GLStateCache::IssueUniform1i(GLint theLocation, int theValue)
+{
+	glUniform1i(theLocation, theValue);
+}
+
+void GLStateCache::IssueBindVertexArray(GLuint theVertexArray)
+{
+	glBindVertexArray(theVertexArray);
+}
+
+void GLStateCache::IssueBindBuffer(GLenum theTarget, GLuint theBuffer)
+{
+	glBindBuffer(theTarget, theBuffer);
+}
+
+void GLStateCache::IssueDeleteBuffer(GLuint theBuffer)
+{
+	glDeleteBuffers(1, &theBuffer);
+}
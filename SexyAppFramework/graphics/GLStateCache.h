@@ -0,0 +1,97 @@
+#ifndef __GLSTATECACHE_H__
+#define __GLSTATECACHE_H__
+
+#include "graphics/GLInterface.h"
+
+namespace Sexy
+{
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct GLStateCounters
+	{
+		int mIssued;			// calls that reached GL
+		int mSkipped;			// calls dropped because GL already had that state
+
+		void Reset() { mIssued = mSkipped = 0; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Texture parameters are part of the texture object, so they are tracked per
+	// texture rather than per bind.
+	///////////////////////////////////////////////////////////////////////////////
+	struct GLSamplerState
+	{
+		GLint mMinFilter;
+		GLint mMagFilter;
+		GLint mWrapS;
+		GLint mWrapT;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Shadow copy of the GL state the renderer touches.  Every change goes
+	// through here and only reaches GL when it differs from what is already set.
+	// Anything that changes this state behind the cache's back must call
+	// Invalidate afterwards.  Only texture unit 0 and GL_TEXTURE_2D are used.
+	///////////////////////////////////////////////////////////////////////////////
+	class GLStateCache
+	{
+	public:
+		enum { INVALID_NAME = 0xFFFFFFFF };
+
+		typedef std::map<GLuint, GLSamplerState> SamplerMap;
+		typedef std::map<GLint, int> UniformMap;
+
+		GLuint					mBoundTexture;	// INVALID_NAME when unknown
+		GLenum					mBlendSrc;
+		GLenum					mBlendDst;
+		GLuint					mProgram;
+		GLuint					mVertexArray;
+		GLuint					mArrayBuffer;
+		GLuint					mUnpackBuffer;
+
+		SamplerMap				mSamplers;
+		UniformMap				mUniforms;		// uniforms of mProgram
+
+		GLStateCounters			mFrameCounters;
+		GLStateCounters			mLastFrameCounters;
+
+	protected:
+		bool					Skip(bool same);
+
+		// The GL calls themselves, only made once the cache has decided they're
+		// needed.  A test overrides them to see a frame's GL traffic without a
+		// context.
+		virtual GLuint			IssueGenTexture();
+		virtual void			IssueBindTexture(GLuint theTexture);
+		virtual void			IssueDeleteTexture(GLuint theTexture);
+		virtual void			IssueTexParameter(GLenum theName, GLint theValue);
+		virtual void			IssueBlendFunc(GLenum theSrc, GLenum theDst);
+		virtual void			IssueUseProgram(GLuint theProgram);
+		virtual void			IssueUniform1i(GLint theLocation, int theValue);
+		virtual void			IssueBindVertexArray(GLuint theVertexArray);
+		virtual void			IssueBindBuffer(GLenum theTarget, GLuint theBuffer);
+		virtual void			IssueDeleteBuffer(GLuint theBuffer);
+
+	public:
+		GLStateCache();
+		virtual ~GLStateCache() {}
+
+		void					Invalidate();
+		void					EndFrame();
+
+		GLuint					GenTexture();
+		void					BindTexture(GLuint theTexture);
+		void					DeleteTexture(GLuint theTexture);
+		void					TexParameter(GLenum theName, GLint theValue);
+		void					BlendFunc(GLenum theSrc, GLenum theDst);
+		void					UseProgram(GLuint theProgram);
+		void					Uniform1i(GLint theLocation, int theValue);
+		void					BindVertexArray(GLuint theVertexArray);
+		void					BindBuffer(GLenum theTarget, GLuint theBuffer);
+		void					DeleteBuffer(GLuint theBuffer);
+	};
+
+}
+
+#endif // __GLSTATECACHE_H__
@@ -0,0 +1,296 @@
+#include <GL/glew.h>
+
+#include "graphics/GLStreamBuffer.h"
+#include "graphics/GLStateCache.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+StreamRing::StreamRing(StreamRingBackend* theBackend, int theCapacity)
+{
+	mBackend = theBackend;
+	mCapacity = 0;
+	mHead = 0;
+	mFrameStart = 0;
+	mStats.Reset();
+
+	Reset(theCapacity);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+StreamRing::~StreamRing()
+{
+	Reset(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Starts over on a new buffer.  The old fences are dropped without waiting,
+// the caller is expected to have replaced the storage they protect.
+///////////////////////////////////////////////////////////////////////////////
+void StreamRing::Reset(int theCapacity)
+{
+	for (FenceQueue::iterator anItr = mFences.begin(); anItr != mFences.end(); ++anItr)
+		mBackend->DeleteFence(anItr->mFence);
+	mFences.clear();
+
+	mCapacity = theCapacity;
+	mHead = 0;
+	mFrameStart = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int StreamRing::Allocate(int theSize)
+{
+	if (theSize <= 0)
+		return 0;
+
+	if (theSize > mCapacity)
+	{
+		Grow(theSize);
+		return Allocate(theSize);
+	}
+
+	int64_t aStart = mHead;
+	int anOffset = (int)(aStart % mCapacity);
+	if (anOffset + theSize > mCapacity)
+	{
+		// Ranges never straddle the end, skip what's left of this lap
+		aStart += mCapacity - anOffset;
+		anOffset = 0;
+		mStats.mWraps++;
+	}
+
+	// Nothing handed out yet this frame, it starts past any skipped bytes
+	if (mHead == mFrameStart)
+		mFrameStart = aStart;
+
+	// The bytes being handed out were last used by positions aReuseStart up to
+	// aReuseEnd
+	int64_t anEnd = aStart + theSize;
+	int64_t aReuseStart = aStart - mCapacity;
+	int64_t aReuseEnd = anEnd - mCapacity;
+
+	if (aReuseEnd > mFrameStart)
+	{
+		// This frame would overwrite its own vertices
+		Grow(theSize);
+		return Allocate(theSize);
+	}
+
+	while (!mFences.empty() && mFences.front().mStart < aReuseEnd)
+	{
+		// A frame that fit entirely in the stretch the wrap skipped guards
+		// nothing being handed out
+		if (mFences.front().mEnd > aReuseStart)
+		{
+			mBackend->WaitFence(mFences.front().mFence);
+			mStats.mFenceWaits++;
+		}
+
+		mBackend->DeleteFence(mFences.front().mFence);
+		mFences.pop_front();
+	}
+
+	mHead = anEnd;
+	mStats.mAllocations++;
+	return anOffset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Doubles the capacity until theSize and everything already handed out this
+// frame fit, and starts over on new storage.  The vertices of the frame so far
+// were drawn from the old buffer, which GL keeps alive until they're done.
+///////////////////////////////////////////////////////////////////////////////
+void StreamRing::Grow(int theSize)
+{
+	int64_t aNeeded = std::max((int64_t)theSize, mHead - mFrameStart + theSize);
+	int aCapacity = std::max(mCapacity, 1);
+	while (aCapacity < aNeeded)
+		aCapacity *= 2;
+	if (aCapacity == mCapacity)
+		aCapacity *= 2;
+
+	mStats.mOverflows++;
+	Reset(aCapacity);
+	mBackend->GrowStorage(aCapacity);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void StreamRing::EndFrame()
+{
+	if (mHead == mFrameStart)
+		return;
+
+	Fence aFence;
+	aFence.mStart = mFrameStart;
+	aFence.mEnd = mHead;
+	aFence.mFence = mBackend->InsertFence();
+	mFences.push_back(aFence);
+
+	mFrameStart = mHead;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLStreamBuffer::GLStreamBuffer(int theCapacity) :
+	mRing(this, theCapacity)
+{
+	mStateCache = NULL;
+	mBuffer = 0;
+	mMode = MODE_ORPHAN;
+	mMapped = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+GLStreamBuffer::~GLStreamBuffer()
+{
+	// The fences go before the buffer, and while this is still a GLStreamBuffer
+	mRing.Reset(0);
+	DestroyBuffer();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::Init(GLStateCache* theStateCache)
+{
+	mStateCache = theStateCache;
+	if (mBuffer != 0)
+		return;
+
+	bool hasSync = GLEW_VERSION_3_2 || GLEW_ARB_sync;
+	if (hasSync && (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage))
+		mMode = MODE_PERSISTENT;
+	else if (hasSync && (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range))
+		mMode = MODE_UNSYNCHRONIZED;
+	else
+		mMode = MODE_ORPHAN;
+
+	CreateBuffer(mRing.mCapacity);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::CreateBuffer(int theCapacity)
+{
+	glGenBuffers(1, &mBuffer);
+	mStateCache->BindBuffer(GL_ARRAY_BUFFER, mBuffer);
+
+	if (mMode == MODE_PERSISTENT)
+	{
+		GLbitfield aFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, theCapacity, NULL, aFlags);
+		mMapped = (uint8_t*)glMapBufferRange(GL_ARRAY_BUFFER, 0, theCapacity, aFlags);
+
+		if (mMapped == NULL)
+		{
+			// Storage is immutable, start over with a plain buffer
+			DestroyBuffer();
+			mMode = MODE_UNSYNCHRONIZED;
+			CreateBuffer(theCapacity);
+			return;
+		}
+	}
+	else if (mMode == MODE_UNSYNCHRONIZED)
+		glBufferData(GL_ARRAY_BUFFER, theCapacity, NULL, GL_STREAM_DRAW);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::DestroyBuffer()
+{
+	if (mBuffer == 0)
+		return;
+
+	if (mMapped != NULL)
+	{
+		mStateCache->BindBuffer(GL_ARRAY_BUFFER, mBuffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		mMapped = NULL;
+	}
+
+	// GL keeps the storage alive until draws already queued from it are done
+	mStateCache->DeleteBuffer(mBuffer);
+	mBuffer = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int GLStreamBuffer::Upload(const void* theData, int theSize)
+{
+	if (mMode == MODE_ORPHAN)
+	{
+		mStateCache->BindBuffer(GL_ARRAY_BUFFER, mBuffer);
+		glBufferData(GL_ARRAY_BUFFER, theSize, theData, GL_STREAM_DRAW);
+		return 0;
+	}
+
+	int anOffset = mRing.Allocate(theSize);
+	mStateCache->BindBuffer(GL_ARRAY_BUFFER, mBuffer);
+
+	if (mMode == MODE_PERSISTENT)
+		memcpy(mMapped + anOffset, theData, theSize);
+	else
+	{
+		// The ring has already made sure the GPU is done with these bytes
+		void* aDest = glMapBufferRange(GL_ARRAY_BUFFER, anOffset, theSize, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+		if (aDest != NULL)
+		{
+			memcpy(aDest, theData, theSize);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		else
+			glBufferSubData(GL_ARRAY_BUFFER, anOffset, theSize, theData);
+	}
+
+	return anOffset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::EndFrame()
+{
+	if (mMode != MODE_ORPHAN)
+		mRing.EndFrame();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void* GLStreamBuffer::InsertFence()
+{
+	return glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::WaitFence(void* theFence)
+{
+	GLbitfield aFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	for (;;)
+	{
+		GLenum aResult = glClientWaitSync((GLsync)theFence, aFlags, 1000000); // 1ms
+		if (aResult != GL_TIMEOUT_EXPIRED)
+			break; // signaled, or the context is gone and waiting won't help
+
+		aFlags = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::DeleteFence(void* theFence)
+{
+	glDeleteSync((GLsync)theFence);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void GLStreamBuffer::GrowStorage(int theCapacity)
+{
+	DestroyBuffer();
+	CreateBuffer(theCapacity);
+}
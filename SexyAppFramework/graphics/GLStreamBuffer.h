@@ -0,0 +1,128 @@
+#ifndef __GLSTREAMBUFFER_H__
+#define __GLSTREAMBUFFER_H__
+
+#include "graphics/GLInterface.h"
+
+#include <deque>
+
+namespace Sexy
+{
+
+	class GLStateCache;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// The fence and buffer operations StreamRing needs, so its bookkeeping can be
+	// driven by a fake in tests.
+	///////////////////////////////////////////////////////////////////////////////
+	class StreamRingBackend
+	{
+	public:
+		virtual ~StreamRingBackend() {}
+
+		virtual void*			InsertFence() = 0;
+		virtual void			WaitFence(void* theFence) = 0;		// returns once the GPU has passed theFence
+		virtual void			DeleteFence(void* theFence) = 0;
+		virtual void			GrowStorage(int theCapacity) = 0;	// replaces the buffer with a new one of theCapacity bytes
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct StreamRingStats
+	{
+		int mAllocations;
+		int mWraps;
+		int mFenceWaits;		// fences that had to be waited on before reusing their bytes
+		int mOverflows;			// allocations that didn't fit and grew the ring
+
+		void Reset() { mAllocations = mWraps = mFenceWaits = mOverflows = 0; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Hands out byte ranges of a buffer front to back, wrapping to the start when
+	// a range would cross the end.  EndFrame fences everything handed out during
+	// the frame, and an allocation that lands on fenced bytes waits for the fence
+	// first.  When a single frame needs more than the whole ring the capacity
+	// doubles until the allocation fits, and the backend replaces the storage.
+	//
+	// Positions are counted in bytes since the last Reset and never wrap, the
+	// offset in the buffer is the position modulo mCapacity.
+	///////////////////////////////////////////////////////////////////////////////
+	class StreamRing
+	{
+	public:
+		struct Fence
+		{
+			int64_t mStart;
+			int64_t mEnd;
+			void* mFence;
+		};
+		typedef std::deque<Fence> FenceQueue;
+
+		StreamRingBackend*		mBackend;
+		int						mCapacity;
+		int64_t					mHead;			// next free position
+		int64_t					mFrameStart;	// first position of the unfenced frame
+		FenceQueue				mFences;		// oldest first
+		StreamRingStats			mStats;
+
+	protected:
+		void					Grow(int theSize);
+
+	public:
+		StreamRing(StreamRingBackend* theBackend, int theCapacity);
+		virtual ~StreamRing();
+
+		void					Reset(int theCapacity);
+		int						Allocate(int theSize);		// offset into the buffer
+		void					EndFrame();
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Streams vertex data into one large GL_ARRAY_BUFFER through a StreamRing.
+	// Uses a persistently mapped buffer (GL_ARB_buffer_storage) when available,
+	// unsynchronized glMapBufferRange writes otherwise, and falls back to
+	// orphaning with glBufferData when the driver has no sync objects to fence
+	// with.  The buffer doubles whenever a frame outgrows it, so mBuffer may
+	// change across Upload calls and anything that captured it (vertex array
+	// attribute pointers) must be set up again.
+	///////////////////////////////////////////////////////////////////////////////
+	class GLStreamBuffer : public StreamRingBackend
+	{
+	public:
+		enum
+		{
+			MODE_PERSISTENT,
+			MODE_UNSYNCHRONIZED,
+			MODE_ORPHAN,
+		};
+
+		GLStateCache*			mStateCache;
+		GLuint					mBuffer;
+		int						mMode;
+		uint8_t*				mMapped;		// MODE_PERSISTENT only
+		StreamRing				mRing;
+
+	protected:
+		void					CreateBuffer(int theCapacity);
+		void					DestroyBuffer();
+
+	public:
+		GLStreamBuffer(int theCapacity);
+		virtual ~GLStreamBuffer();
+
+		void					Init(GLStateCache* theStateCache);
+
+		// Copies theData into the buffer, leaves mBuffer bound to GL_ARRAY_BUFFER
+		// and returns the byte offset the data starts at.
+		int						Upload(const void* theData, int theSize);
+		void					EndFrame();
+
+		virtual void*			InsertFence();
+		virtual void			WaitFence(void* theFence);
+		virtual void			DeleteFence(void* theFence);
+		virtual void			GrowStorage(int theCapacity);
+	};
+
+}
+
+#endif // __GLSTREAMBUFFER_H__
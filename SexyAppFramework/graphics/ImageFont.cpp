@@ -106,6 +106,7 @@ FontLayer::FontLayer(FontData* theFontData)
 	mColorAdd = Color(0, 0, 0, 0);
 	mLineSpacingOffset = 0;
 	mBaseOrder = 0;
+	memset(mCharDataTable, 0, sizeof(mCharDataTable));
 }
 
 FontLayer::FontLayer(const FontLayer& theFontLayer) :
@@ -136,6 +137,9 @@ FontLayer::FontLayer(const FontLayer& theFontLayer) :
 	//for (i = 0; i < 256; i++)
 	//	mCharData[i] = theFontLayer.mCharData[i];	
 
+	// The tables point into theFontLayer's map, so they start over
+	memset(mCharDataTable, 0, sizeof(mCharDataTable));
+
 	for (auto anItr = theFontLayer.mCharDataMap.begin(); anItr != theFontLayer.mCharDataMap.end(); anItr++)
 	{
 		mCharDataMap.insert(CharDataMap::value_type(anItr->first, anItr->second));
@@ -144,13 +148,24 @@ FontLayer::FontLayer(const FontLayer& theFontLayer) :
 
 CharData* FontLayer::GetCharData(SexyChar theChar)
 {
+	CharData** aCharData;
+	if (IsTableChar(theChar))
+		aCharData = &mCharDataTable[(SexyUChar) theChar];
+	else
+		aCharData = &mCharDataHash[theChar];
+
+	if (*aCharData != NULL)
+		return *aCharData;
+
 	auto anItr = mCharDataMap.find(theChar);
 	if (anItr == mCharDataMap.end())
 	{
 		anItr = mCharDataMap.insert(CharDataMap::value_type(theChar, CharData())).first;
 	}
 
-	return &anItr->second;
+	// Map entries never move, so this stays good for as long as the layer does
+	*aCharData = &anItr->second;
+	return *aCharData;
 }
 
 FontData::FontData()
@@ -160,6 +175,7 @@ FontData::FontData()
 	mApp = NULL;
 	mRefCount = 0;
 	mDefaultPointSize = 0;
+	mCharsVersion = 0;
 
 	//for (uint32_t i = 0; i < 256; i++)
 	//	mCharMap[i] = (uchar) i;
@@ -183,6 +199,11 @@ void FontData::Ref()
 	mRefCount++;
 }
 
+void FontData::CharsChanged()
+{
+	mCharsVersion++;
+}
+
 void FontData::DeRef()
 {
 	if (--mRefCount == 0)
@@ -1143,14 +1164,19 @@ bool FontData::LoadLegacy(Image* theFontImage, const std::string& theFontDescFil
 
 ActiveFontLayer::ActiveFontLayer()
 {
+	mBaseFontLayer = NULL;
 	mScaledImage = NULL;
 	mOwnsImage = false;
+
+	for (int i = 0; i < CHAR_TABLE_SIZE; i++)
+		mKerningRows[i] = -1;
 }
 
 ActiveFontLayer::ActiveFontLayer(const ActiveFontLayer& theActiveFontLayer) :
 	mBaseFontLayer(theActiveFontLayer.mBaseFontLayer),
 	mScaledImage(theActiveFontLayer.mScaledImage),
-	mOwnsImage(theActiveFontLayer.mOwnsImage)
+	mOwnsImage(theActiveFontLayer.mOwnsImage),
+	mKerningPairs(theActiveFontLayer.mKerningPairs)
 {
 	if (mOwnsImage)
 		mScaledImage = mBaseFontLayer->mFontData->mApp->CopyImage(mScaledImage);
@@ -1162,6 +1188,12 @@ ActiveFontLayer::ActiveFontLayer(const ActiveFontLayer& theActiveFontLayer) :
 	{
 		mScaledCharImageRects.insert(CharRectMap::value_type(anItr->first, anItr->second));
 	}
+
+	for (int i = 0; i < CHAR_TABLE_SIZE; i++)
+	{
+		mScaledCharImageRectTable[i] = theActiveFontLayer.mScaledCharImageRectTable[i];
+		mKerningRows[i] = theActiveFontLayer.mKerningRows[i];
+	}
 }
 
 ActiveFontLayer::~ActiveFontLayer()
@@ -1170,6 +1202,77 @@ ActiveFontLayer::~ActiveFontLayer()
 		delete mScaledImage;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Called once mScaledCharImageRects is filled in.  Like those rects, the
+// kerning is read from the base layer here and not again until the active
+// layers are next generated.
+///////////////////////////////////////////////////////////////////////////////
+void ActiveFontLayer::BuildCharTables()
+{
+	for (int i = 0; i < CHAR_TABLE_SIZE; i++)
+	{
+		mScaledCharImageRectTable[i] = Rect();
+		mKerningRows[i] = -1;
+	}
+	mKerningPairs.clear();
+
+	for (auto anItr = mScaledCharImageRects.begin(); anItr != mScaledCharImageRects.end(); anItr++)
+	{
+		if (IsTableChar(anItr->first))
+			mScaledCharImageRectTable[(SexyUChar) anItr->first] = anItr->second;
+	}
+
+	for (auto anItr = mBaseFontLayer->mCharDataMap.begin(); anItr != mBaseFontLayer->mCharDataMap.end(); anItr++)
+	{
+		if (!IsTableChar(anItr->first))
+			continue;
+
+		CharIntMap& aKerningOffsets = anItr->second.mKerningOffsets;
+		for (auto aKernItr = aKerningOffsets.begin(); aKernItr != aKerningOffsets.end(); aKernItr++)
+		{
+			if ((!IsTableChar(aKernItr->first)) || (aKernItr->second == 0))
+				continue;
+
+			int& aRow = mKerningRows[(SexyUChar) anItr->first];
+			if (aRow == -1)
+			{
+				aRow = (int) mKerningPairs.size() / CHAR_TABLE_SIZE;
+				mKerningPairs.resize(mKerningPairs.size() + CHAR_TABLE_SIZE, 0);
+			}
+
+			mKerningPairs[aRow * CHAR_TABLE_SIZE + (SexyUChar) aKernItr->first] = aKernItr->second;
+		}
+	}
+}
+
+const Rect& ActiveFontLayer::GetScaledCharImageRect(SexyChar theChar)
+{
+	if (IsTableChar(theChar))
+		return mScaledCharImageRectTable[(SexyUChar) theChar];
+
+	return mScaledCharImageRects[theChar];
+}
+
+int ActiveFontLayer::GetKerningOffset(SexyChar theChar, SexyChar theNextChar)
+{
+	CharData* aCharData = mBaseFontLayer->GetCharData(theChar);
+
+	if ((IsTableChar(theChar)) && (IsTableChar(theNextChar)))
+	{
+		int aRow = mKerningRows[(SexyUChar) theChar];
+		if (aRow == -1)
+			return 0;
+
+		return mKerningPairs[aRow * CHAR_TABLE_SIZE + (SexyUChar) theNextChar];
+	}
+
+	auto anItr = aCharData->mKerningOffsets.find(theNextChar);
+	if (anItr == aCharData->mKerningOffsets.end())
+		return 0;
+
+	return anItr->second;
+}
+
 ////
 
 ImageFont::ImageFont(SexyAppBase* theSexyApp, const std::string& theFontDescFileName)
@@ -1193,6 +1296,10 @@ ImageFont::ImageFont(Image* theFontImage)
 	mPointSize = mFontData->mDefaultPointSize;
 	mActiveListValid = false;
 	mForceScaledImagesWhite = false;
+	mCharsVersion = mFontData->mCharsVersion;
+
+	for (int i = 0; i < CHAR_TABLE_SIZE; i++)
+		mCharMapTable[i] = (SexyChar) i;
 
 	mFontData->mFontLayerList.push_back(FontLayer(mFontData));
 	FontLayer* aFontLayer = &mFontData->mFontLayerList.back();
@@ -1213,12 +1320,16 @@ ImageFont::ImageFont(const ImageFont& theImageFont) :
 	mTagVector(theImageFont.mTagVector),
 	mActiveListValid(theImageFont.mActiveListValid),
 	mScale(theImageFont.mScale),
-	mForceScaledImagesWhite(theImageFont.mForceScaledImagesWhite)
+	mForceScaledImagesWhite(theImageFont.mForceScaledImagesWhite),
+	mCharsVersion(theImageFont.mCharsVersion)
 {
 	mFontData->Ref();
 
 	if (mActiveListValid)
+	{
 		mActiveLayerList = theImageFont.mActiveLayerList;
+		memcpy(mCharMapTable, theImageFont.mCharMapTable, sizeof(mCharMapTable));
+	}
 }
 
 ImageFont::ImageFont(Image* theFontImage, const std::string& theFontDescFileName)
@@ -1251,6 +1362,14 @@ ImageFont::~ImageFont()
 
 void ImageFont::GenerateActiveFontLayers()
 {
+	mCharsVersion = mFontData->mCharsVersion;
+	for (int i = 0; i < CHAR_TABLE_SIZE; i++)
+	{
+		SexyChar aChar = (SexyChar) i;
+		auto anItr = mFontData->mCharMap.find(aChar);
+		mCharMapTable[i] = (anItr != mFontData->mCharMap.end()) ? anItr->second : aChar;
+	}
+
 	if (!mFontData->mInitialized)
 		return;
 
@@ -1398,6 +1517,8 @@ void ImageFont::GenerateActiveFontLayers()
 					aMemoryImage->Palletize();
 				}
 
+				anActiveFontLayer->BuildCharTables();
+
 				int aLayerAscent = (aFontLayer->mAscent * aPointSize) / aLayerPointSize;
 				if (aLayerAscent > mAscent)
 					mAscent = aLayerAscent;
@@ -1480,7 +1601,7 @@ int ImageFont::CharWidthKern(SexyChar theChar, SexyChar thePrevChar)
 				//aSpacing = (anActiveFontLayer->mBaseFontLayer->mSpacing + 
 				//	anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) thePrevChar].->mKerningOffsets[(uchar) theChar]) * mScale;
 				aSpacing = (anActiveFontLayer->mBaseFontLayer->mSpacing +
-					anActiveFontLayer->mBaseFontLayer->GetCharData(thePrevChar)->mKerningOffsets[theChar]) * mScale;
+					anActiveFontLayer->GetKerningOffset(thePrevChar, theChar)) * mScale;
 			}
 			else
 				aSpacing = 0;
@@ -1494,7 +1615,7 @@ int ImageFont::CharWidthKern(SexyChar theChar, SexyChar thePrevChar)
 				//aSpacing = (anActiveFontLayer->mBaseFontLayer->mSpacing + 
 				//	anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) thePrevChar].mKerningOffsets[(uchar) theChar]) * aPointSize / aLayerPointSize;
 				aSpacing = (anActiveFontLayer->mBaseFontLayer->mSpacing +
-					anActiveFontLayer->mBaseFontLayer->GetCharData(thePrevChar)->mKerningOffsets[theChar]) * aPointSize / aLayerPointSize;
+					anActiveFontLayer->GetKerningOffset(thePrevChar, theChar)) * aPointSize / aLayerPointSize;
 			}
 			else
 				aSpacing = 0;
@@ -1573,6 +1694,8 @@ void ImageFont::DrawStringEx(Graphics* g, int theX, int theY, const SexyString&
 		while (anItr != mActiveLayerList.end())
 		{
 			ActiveFontLayer* anActiveFontLayer = &*anItr;
+			CharData* aCharData = anActiveFontLayer->mBaseFontLayer->GetCharData(aChar);
+			const Rect& aCharRect = anActiveFontLayer->GetScaledCharImageRect(aChar);
 
 			int aLayerXPos = aCurXPos;
 
@@ -1592,16 +1715,16 @@ void ImageFont::DrawStringEx(Graphics* g, int theX, int theY, const SexyString&
 				//anImageX = aLayerXPos + anActiveFontLayer->mBaseFontLayer->mOffset.mX + anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mOffset.mX;
 				//anImageY = theY - (anActiveFontLayer->mBaseFontLayer->mAscent - anActiveFontLayer->mBaseFontLayer->mOffset.mY - anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mOffset.mY);
 				//aCharWidth = anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mWidth;				
-				anImageX = aLayerXPos + anActiveFontLayer->mBaseFontLayer->mOffset.mX + anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mOffset.mX;
-				anImageY = theY - (anActiveFontLayer->mBaseFontLayer->mAscent - anActiveFontLayer->mBaseFontLayer->mOffset.mY - anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mOffset.mY);
-				aCharWidth = anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mWidth;
+				anImageX = aLayerXPos + anActiveFontLayer->mBaseFontLayer->mOffset.mX + aCharData->mOffset.mX;
+				anImageY = theY - (anActiveFontLayer->mBaseFontLayer->mAscent - anActiveFontLayer->mBaseFontLayer->mOffset.mY - aCharData->mOffset.mY);
+				aCharWidth = aCharData->mWidth;
 
 				if (aNextChar != 0)
 				{
 					//aSpacing = anActiveFontLayer->mBaseFontLayer->mSpacing + 
 				   //	 anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mKerningOffsets[(uchar) aNextChar];
 					aSpacing = anActiveFontLayer->mBaseFontLayer->mSpacing +
-						anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mKerningOffsets[aNextChar];
+						anActiveFontLayer->GetKerningOffset(aChar, aNextChar);
 				}
 				else
 					aSpacing = 0;
@@ -1611,16 +1734,16 @@ void ImageFont::DrawStringEx(Graphics* g, int theX, int theY, const SexyString&
 				//anImageX = aLayerXPos + (int) ((anActiveFontLayer->mBaseFontLayer->mOffset.mX + anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mOffset.mX) * aScale);
 				//anImageY = theY - (int) ((anActiveFontLayer->mBaseFontLayer->mAscent - anActiveFontLayer->mBaseFontLayer->mOffset.mY - anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mOffset.mY) * aScale);
 				//aCharWidth = (anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mWidth * aScale);
-				anImageX = aLayerXPos + (int)((anActiveFontLayer->mBaseFontLayer->mOffset.mX + anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mOffset.mX) * aScale);
-				anImageY = theY - (int)((anActiveFontLayer->mBaseFontLayer->mAscent - anActiveFontLayer->mBaseFontLayer->mOffset.mY - anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mOffset.mY) * aScale);
-				aCharWidth = (anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mWidth * aScale);
+				anImageX = aLayerXPos + (int)((anActiveFontLayer->mBaseFontLayer->mOffset.mX + aCharData->mOffset.mX) * aScale);
+				anImageY = theY - (int)((anActiveFontLayer->mBaseFontLayer->mAscent - anActiveFontLayer->mBaseFontLayer->mOffset.mY - aCharData->mOffset.mY) * aScale);
+				aCharWidth = (aCharData->mWidth * aScale);
 
 				if (aNextChar != 0)
 				{
 					//aSpacing = (int) ((anActiveFontLayer->mBaseFontLayer->mSpacing + 
 					//	 anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mKerningOffsets[(uchar) aNextChar]) * aScale);
 					aSpacing = (int)((anActiveFontLayer->mBaseFontLayer->mSpacing +
-						anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mKerningOffsets[aNextChar]) * aScale);
+						anActiveFontLayer->GetKerningOffset(aChar, aNextChar)) * aScale);
 				}
 				else
 					aSpacing = 0;
@@ -1633,7 +1756,7 @@ void ImageFont::DrawStringEx(Graphics* g, int theX, int theY, const SexyString&
 			aColor.mAlpha = std::min((theColor.mAlpha * anActiveFontLayer->mBaseFontLayer->mColorMult.mAlpha / 255) + anActiveFontLayer->mBaseFontLayer->mColorAdd.mAlpha, 255);
 
 			//int anOrder = anActiveFontLayer->mBaseFontLayer->mBaseOrder + anActiveFontLayer->mBaseFontLayer->mCharData[(uchar) aChar].mOrder;
-			int anOrder = layerOrderOffset + anActiveFontLayer->mBaseFontLayer->mBaseOrder + anActiveFontLayer->mBaseFontLayer->GetCharData(aChar)->mOrder;
+			int anOrder = layerOrderOffset + anActiveFontLayer->mBaseFontLayer->mBaseOrder + aCharData->mOrder;
 
 			if (aCurPoolIdx >= POOL_SIZE)
 				break;
@@ -1648,10 +1771,10 @@ void ImageFont::DrawStringEx(Graphics* g, int theX, int theY, const SexyString&
 			//aRenderCommand->mSrc[1] = anActiveFontLayer->mScaledCharImageRects[(uchar) aChar].mY;
 			//aRenderCommand->mSrc[2] = anActiveFontLayer->mScaledCharImageRects[(uchar) aChar].mWidth;
 			//aRenderCommand->mSrc[3] = anActiveFontLayer->mScaledCharImageRects[(uchar) aChar].mHeight;
-			aRenderCommand->mSrc[0] = anActiveFontLayer->mScaledCharImageRects[aChar].mX;
-			aRenderCommand->mSrc[1] = anActiveFontLayer->mScaledCharImageRects[aChar].mY;
-			aRenderCommand->mSrc[2] = anActiveFontLayer->mScaledCharImageRects[aChar].mWidth;
-			aRenderCommand->mSrc[3] = anActiveFontLayer->mScaledCharImageRects[aChar].mHeight;
+			aRenderCommand->mSrc[0] = aCharRect.mX;
+			aRenderCommand->mSrc[1] = aCharRect.mY;
+			aRenderCommand->mSrc[2] = aCharRect.mWidth;
+			aRenderCommand->mSrc[3] = aCharRect.mHeight;
 			aRenderCommand->mMode = anActiveFontLayer->mBaseFontLayer->mDrawMode;
 			aRenderCommand->mNext = NULL;
 
@@ -1683,7 +1806,7 @@ void ImageFont::DrawStringEx(Graphics* g, int theX, int theY, const SexyString&
 			if (theDrawnAreas != NULL)
 			{
 				//Rect aDestRect = Rect(anImageX, anImageY, anActiveFontLayer->mScaledCharImageRects[(uchar) aChar].mWidth, anActiveFontLayer->mScaledCharImageRects[(uchar) aChar].mHeight);
-				Rect aDestRect(anImageX, anImageY, anActiveFontLayer->mScaledCharImageRects[aChar].mWidth, anActiveFontLayer->mScaledCharImageRects[aChar].mHeight);
+				Rect aDestRect(anImageX, anImageY, aCharRect.mWidth, aCharRect.mHeight);
 
 				theDrawnAreas->push_back(aDestRect);
 
@@ -1846,7 +1969,7 @@ std::string ImageFont::GetDefine(const std::string& theName)
 
 void ImageFont::Prepare()
 {
-	if (!mActiveListValid)
+	if ((!mActiveListValid) || (mCharsVersion != mFontData->mCharsVersion))
 	{
 		GenerateActiveFontLayers();
 		mActiveListValid = true;
@@ -1855,6 +1978,9 @@ void ImageFont::Prepare()
 
 SexyChar ImageFont::GetMappedChar(SexyChar theChar)
 {
+	if (IsTableChar(theChar))
+		return mCharMapTable[(SexyUChar) theChar];
+
 	auto anItr = mFontData->mCharMap.find(theChar);
 	if (anItr != mFontData->mCharMap.end())
 	{
@@ -5,6 +5,9 @@
 #include "SexyAppBase.h"
 #include "SharedImage.h"
 
+#include <type_traits>
+#include <unordered_map>
+
 namespace Sexy
 {
 
@@ -13,6 +16,15 @@ class Image;
 
 typedef std::map<SexyChar, int> CharIntMap;
 
+// Chars below CHAR_TABLE_SIZE are looked up in flat tables, the rest by hash
+enum { CHAR_TABLE_SIZE = 256 };
+typedef std::make_unsigned<SexyChar>::type SexyUChar;
+
+inline bool IsTableChar(SexyChar theChar)
+{
+	return (SexyUChar) theChar < CHAR_TABLE_SIZE;
+}
+
 class CharData
 {
 public:
@@ -39,6 +51,8 @@ public:
 	StringVector			mExcludedTags;	
 	//CharData				mCharData[256];	
 	CharDataMap				mCharDataMap;
+	CharData*				mCharDataTable[CHAR_TABLE_SIZE];	// into mCharDataMap, filled in by GetCharData
+	std::unordered_map<SexyChar, CharData*> mCharDataHash;		// the same for the chars past the table
 	Color					mColorMult;
 	Color					mColorAdd;
 	SharedImageRef			mImage;	
@@ -77,6 +91,7 @@ public:
 
 	int						mDefaultPointSize;
 	CharMap					mCharMap;
+	int						mCharsVersion;	// bumped by CharsChanged
 	FontLayerList			mFontLayerList;
 	FontLayerMap			mFontLayerMap;
 
@@ -97,6 +112,10 @@ public:
 	void					Ref();
 	void					DeRef();
 
+	// Call after changing mCharMap or any layer's kerning once fonts are using
+	// this, so they build their tables again
+	void					CharsChanged();
+
 	bool					Load(SexyAppBase* theSexyApp, const std::string& theFontDescFileName);
 	bool					LoadLegacy(Image* theFontImage, const std::string& theFontDescFileName);
 };
@@ -112,10 +131,19 @@ public:
 	bool					mOwnsImage;
 	CharRectMap				mScaledCharImageRects;
 
+	// Built from the maps by BuildCharTables, for the table chars only
+	Rect					mScaledCharImageRectTable[CHAR_TABLE_SIZE];
+	int						mKerningRows[CHAR_TABLE_SIZE];	// row in mKerningPairs, -1 if the char doesn't kern
+	std::vector<int>		mKerningPairs;					// CHAR_TABLE_SIZE offsets a row
+
 public:
 	ActiveFontLayer();
 	ActiveFontLayer(const ActiveFontLayer& theActiveFontLayer);
 	virtual ~ActiveFontLayer();
+
+	void					BuildCharTables();
+	const Rect&				GetScaledCharImageRect(SexyChar theChar);
+	int						GetKerningOffset(SexyChar theChar, SexyChar theNextChar);
 };
 
 typedef std::list<ActiveFontLayer> ActiveFontLayerList;
@@ -134,6 +162,12 @@ public:
 
 typedef std::multimap<int, RenderCommand> RenderCommandMap;
 
+///////////////////////////////////////////////////////////////////////////////
+// The char map and each layer's kerning are copied into flat tables along
+// with the scaled glyph rects when the active layers are generated.  Changing
+// them in mFontData afterwards only shows once FontData::CharsChanged is
+// called, which has every ImageFont sharing the FontData generate again.
+///////////////////////////////////////////////////////////////////////////////
 class ImageFont : public _Font
 {
 public:	
@@ -145,6 +179,8 @@ public:
 	ActiveFontLayerList		mActiveLayerList;
 	double					mScale;
 	bool					mForceScaledImagesWhite;
+	SexyChar				mCharMapTable[CHAR_TABLE_SIZE];	// mFontData->mCharMap for the table chars
+	int						mCharsVersion;					// mFontData->mCharsVersion the tables were built from
 
 public:
 	virtual void			GenerateActiveFontLayers();
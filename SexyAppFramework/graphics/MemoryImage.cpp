@@ -10,6 +10,8 @@
 #include "Quantize.h"
 #include "misc/PerfTimer.h"
 #include "SWTri.h"
+#include "graphics/BlitKernels.h"
+#include "graphics/AlphaKernels.h"
 
 #include <math.h>
 
@@ -47,7 +49,11 @@ MemoryImage::MemoryImage(const MemoryImage& theMemoryImage) :
 	mPurgeBits(theMemoryImage.mPurgeBits),
 	mWantPal(theMemoryImage.mWantPal),
 	mBitsChanged(theMemoryImage.mBitsChanged),
-	mApp(theMemoryImage.mApp)
+	mApp(theMemoryImage.mApp),
+	mRowAlphaFlags(NULL),
+	mRowAlphaCount(0),
+	mDirtyRowTop(0),
+	mDirtyRowBottom(theMemoryImage.mHeight)
 {
 	bool deleteBits = false;
 
@@ -137,6 +143,7 @@ MemoryImage::~MemoryImage()
 	delete [] mRLAdditiveData;
 	delete [] mColorIndices;
 	delete [] mColorTable;
+	delete [] mRowAlphaFlags;
 }
 
 void MemoryImage::Init()
@@ -158,6 +165,11 @@ void MemoryImage::Init()
 	mD3DFlags = 0;
 	mBitsChangedCount = 0;
 
+	mRowAlphaFlags = NULL;
+	mRowAlphaCount = 0;
+	mDirtyRowTop = 0;
+	mDirtyRowBottom = mHeight;
+
 	mPurgeBits = false;
 	mWantPal = false;
 
@@ -169,6 +181,9 @@ void MemoryImage::BitsChanged()
 	mBitsChanged = true;
 	mBitsChangedCount++;
 
+	mDirtyRowTop = 0;
+	mDirtyRowBottom = mHeight;
+
 	delete [] mNativeAlphaData;
 	mNativeAlphaData = NULL;
 
@@ -185,6 +200,23 @@ void MemoryImage::BitsChanged()
 	}
 }
 
+void MemoryImage::RowsChanged(int theY, int theHeight)
+{
+	int aTop = theY;
+	int aBottom = theY + theHeight;
+	if (mDirtyRowTop < mDirtyRowBottom)
+	{
+		aTop = std::min(aTop, mDirtyRowTop);
+		aBottom = std::max(aBottom, mDirtyRowBottom);
+	}
+
+	// Subclasses still see a BitsChanged, only the rescan is narrowed
+	BitsChanged();
+
+	mDirtyRowTop = std::max(aTop, 0);
+	mDirtyRowBottom = std::min(aBottom, mHeight);
+}
+
 void MemoryImage::NormalDrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor)
 {
 	double aMinX = std::min(theStartX, theEndX);
@@ -818,39 +850,15 @@ void MemoryImage::CommitBits()
 		// Analyze 
 		if (mBits != NULL)
 		{
-			mHasTrans = false;
-			mHasAlpha = false;
-			
-			int aSize = mWidth*mHeight;
-			uint32_t* ptr = mBits;
-			
-			for (int i = 0; i < aSize; i++)
-			{
-				uchar anAlpha = (uchar) (*ptr++ >> 24);
-
-				if (anAlpha == 0)
-					mHasTrans = true;
-				else if (anAlpha != 255)
-					mHasAlpha = true;
-			}
+			int aFlags = ClassifyAlphaRows();
+			mHasTrans = (aFlags & ALPHA_HAS_TRANS) != 0;
+			mHasAlpha = (aFlags & ALPHA_HAS_ALPHA) != 0;
 		}
 		else if (mColorTable != NULL)
 		{
-			mHasTrans = false;
-			mHasAlpha = false;
-			
-			int aSize = 256;
-			uint32_t* ptr = mColorTable;
-			
-			for (int i = 0; i < aSize; i++)
-			{
-				uchar anAlpha = (uchar) (*ptr++ >> 24);
-
-				if (anAlpha == 0)
-					mHasTrans = true;
-				else if (anAlpha != 255)
-					mHasAlpha = true;
-			}
+			int aFlags = ClassifyAlpha(mColorTable, 256);
+			mHasTrans = (aFlags & ALPHA_HAS_TRANS) != 0;
+			mHasAlpha = (aFlags & ALPHA_HAS_ALPHA) != 0;
 		}
 		else
 		{
@@ -859,12 +867,44 @@ void MemoryImage::CommitBits()
 		}
 
 		mBitsChanged = false;
+		mDirtyRowTop = 0;
+		mDirtyRowBottom = 0;
 	}
 
 	//if (gDebug)
 	//	mApp->CopyToClipboard("-MemoryImage::CommitBits");
 }
 
+int MemoryImage::ClassifyAlphaRows()
+{
+	int aTop = std::max(mDirtyRowTop, 0);
+	int aBottom = std::min(mDirtyRowBottom, mHeight);
+
+	if (mRowAlphaFlags == NULL)
+	{
+		// Whole image changes don't need the rows
+		if (aTop == 0 && aBottom == mHeight)
+			return ClassifyAlpha(mBits, mWidth*mHeight);
+	}
+
+	if (mRowAlphaCount != mHeight)
+	{
+		delete [] mRowAlphaFlags;
+		mRowAlphaFlags = new uchar[mHeight];
+		mRowAlphaCount = mHeight;
+		aTop = 0;
+		aBottom = mHeight;
+	}
+
+	for (int y = aTop; y < aBottom; y++)
+		mRowAlphaFlags[y] = (uchar) ClassifyAlpha(mBits + y*mWidth, mWidth);
+
+	int aFlags = 0;
+	for (int y = 0; y < mHeight; y++)
+		aFlags |= mRowAlphaFlags[y];
+	return aFlags;
+}
+
 void MemoryImage::SetImageMode(bool hasTrans, bool hasAlpha)
 {
 	mForcedMode = true;	
@@ -896,6 +936,12 @@ void* MemoryImage::GetNativeAlphaData(NativeDisplay *theDisplay)
 	const int gMask = theDisplay->mGreenMask;
 	const int bMask = theDisplay->mBlueMask;
 
+	// 8 bit channels in ARGB or ABGR order (GLInterface) are just a premultiply
+	bool isByteFormat = (theDisplay->mRedBits == 8) && (theDisplay->mGreenBits == 8) && (theDisplay->mBlueBits == 8) &&
+		(gLeftShift == 8) && (gMask == 0xFF00) && (rMask == (0xFF << rLeftShift)) && (bMask == (0xFF << bLeftShift));
+	bool isARGB = isByteFormat && (rLeftShift == 16) && (bLeftShift == 0);
+	bool isABGR = isByteFormat && (rLeftShift == 0) && (bLeftShift == 16);
+
 	if (mColorTable == NULL)
 	{
 		uint32_t* aSrcPtr = GetBits();
@@ -904,21 +950,26 @@ void* MemoryImage::GetNativeAlphaData(NativeDisplay *theDisplay)
 
 		uint32_t* aDestPtr = anAlphaData;
 		int aSize = mWidth*mHeight;
-		for (int i = 0; i < aSize; i++)
+		if (isARGB || isABGR)
+			PremultiplyRow(aDestPtr, aSrcPtr, aSize, isABGR);
+		else
 		{
-			uint32_t val = *(aSrcPtr++);
+			for (int i = 0; i < aSize; i++)
+			{
+				uint32_t val = *(aSrcPtr++);
 
-			int anAlpha = val >> 24;			
+				int anAlpha = val >> 24;			
 
-			uint32_t r = ((val & 0xFF0000) * (anAlpha+1)) >> 8;
-			uint32_t g = ((val & 0x00FF00) * (anAlpha+1)) >> 8;
-			uint32_t b = ((val & 0x0000FF) * (anAlpha+1)) >> 8;
+				uint32_t r = ((val & 0xFF0000) * (anAlpha+1)) >> 8;
+				uint32_t g = ((val & 0x00FF00) * (anAlpha+1)) >> 8;
+				uint32_t b = ((val & 0x0000FF) * (anAlpha+1)) >> 8;
 
-			*(aDestPtr++) =
-				(((r >> rRightShift) << rLeftShift) & rMask) |
-				(((g >> gRightShift) << gLeftShift) & gMask) |
-				(((b >> bRightShift) << bLeftShift) & bMask) |
-				(anAlpha << 24);
+				*(aDestPtr++) =
+					(((r >> rRightShift) << rLeftShift) & rMask) |
+					(((g >> gRightShift) << gLeftShift) & gMask) |
+					(((b >> bRightShift) << bLeftShift) & bMask) |
+					(anAlpha << 24);
+			}
 		}
 		
 		mNativeAlphaData = anAlphaData;	
@@ -929,24 +980,28 @@ void* MemoryImage::GetNativeAlphaData(NativeDisplay *theDisplay)
 
 		uint32_t* anAlphaData = new uint32_t[256];
 		
-		for (int i = 0; i < 256; i++)
+		if (isARGB || isABGR)
+			PremultiplyRow(anAlphaData, aSrcPtr, 256, isABGR);
+		else
 		{
-			uint32_t val = *(aSrcPtr++);
+			for (int i = 0; i < 256; i++)
+			{
+				uint32_t val = *(aSrcPtr++);
 
-			int anAlpha = val >> 24;
+				int anAlpha = val >> 24;
 
-			uint32_t r = ((val & 0xFF0000) * (anAlpha+1)) >> 8;
-			uint32_t g = ((val & 0x00FF00) * (anAlpha+1)) >> 8;
-			uint32_t b = ((val & 0x0000FF) * (anAlpha+1)) >> 8;
+				uint32_t r = ((val & 0xFF0000) * (anAlpha+1)) >> 8;
+				uint32_t g = ((val & 0x00FF00) * (anAlpha+1)) >> 8;
+				uint32_t b = ((val & 0x0000FF) * (anAlpha+1)) >> 8;
 
-			anAlphaData[i] =
-				(((r >> rRightShift) << rLeftShift) & rMask) |
-				(((g >> gRightShift) << gLeftShift) & gMask) |
-				(((b >> bRightShift) << bLeftShift) & bMask) |
-				(anAlpha << 24);
+				anAlphaData[i] =
+					(((r >> rRightShift) << rLeftShift) & rMask) |
+					(((g >> gRightShift) << gLeftShift) & gMask) |
+					(((b >> bRightShift) << bLeftShift) & bMask) |
+					(anAlpha << 24);
+			}
 		}
 		
-		
 		mNativeAlphaData = anAlphaData;	
 	}
 
@@ -1343,7 +1398,7 @@ void MemoryImage::FillRect(const Rect& theRect, const Color& theColor, int theDr
 		}
 	}
 
-	BitsChanged();
+	RowsChanged(theRect.mY, theRect.mHeight);
 }
 
 void MemoryImage::ClearRect(const Rect& theRect)
@@ -1358,7 +1413,7 @@ void MemoryImage::ClearRect(const Rect& theRect)
 			*aDestPixels++ = 0;
 	}	
 	
-	BitsChanged();
+	RowsChanged(theRect.mY, theRect.mHeight);
 }
 
 void MemoryImage::Clear()
@@ -1385,15 +1440,17 @@ void MemoryImage::AdditiveBlt(Image* theImage, int theX, int theY, const Rect& t
 	{
 		if (aSrcMemoryImage->mColorTable == NULL)
 		{			
-			uint32_t* aSrcBits = aSrcMemoryImage->GetBits();
+			uint32_t* aDestPixelsRow = ((uint32_t*) GetBits()) + (theY * mWidth) + theX;
+			uint32_t* aSrcPixelsRow = aSrcMemoryImage->GetBits() + (theSrcRect.mY * theImage->mWidth) + theSrcRect.mX;
 
-			#define NEXT_SRC_COLOR		(*(aSrcPtr++))
-			#define SRC_TYPE			uint32_t			
-
-			#include "inc_routines/MI_AdditiveBlt.inc"
+			// Same result as MI_AdditiveBlt.inc, a row at a time
+			for (int y = 0; y < theSrcRect.mHeight; y++)
+			{
+				BlendRowAdditive(aDestPixelsRow, aSrcPixelsRow, theSrcRect.mWidth, theColor, aSrcMemoryImage->mHasAlpha);
 
-			#undef NEXT_SRC_COLOR
-			#undef SRC_TYPE		
+				aDestPixelsRow += mWidth;
+				aSrcPixelsRow += theImage->mWidth;
+			}
 		}
 		else
 		{			
@@ -1409,7 +1466,7 @@ void MemoryImage::AdditiveBlt(Image* theImage, int theX, int theY, const Rect& t
 			#undef SRC_TYPE		
 		}
 
-		BitsChanged();
+		RowsChanged(theY, theSrcRect.mHeight);
 	}	
 }
 
@@ -1425,16 +1482,32 @@ void MemoryImage::NormalBlt(Image* theImage, int theX, int theY, const Rect& the
 		{			
 			uint32_t* aSrcPixelsRow = ((uint32_t*) aSrcMemoryImage->GetBits()) + (theSrcRect.mY * theImage->mWidth) + theSrcRect.mX;
 
-			#define NEXT_SRC_COLOR		(*(aSrcPtr++))
-			#define READ_SRC_COLOR		(*(aSrcPtr))
-			#undef EACH_ROW
-			#define EACH_ROW			uint32_t* aSrcPtr = aSrcPixelsRow
+			if ((mHasAlpha) || (mHasTrans) || (theColor != Color::White))
+			{
+				uint32_t* aDestPixelsRow = ((uint32_t*) GetBits()) + (theY * mWidth) + theX;
 
-			#include "inc_routines/MI_NormalBlt.inc"
+				// Same result as the blending half of MI_NormalBlt.inc, a row at a time
+				for (int y = 0; y < theSrcRect.mHeight; y++)
+				{
+					BlendRowNormal(aDestPixelsRow, aSrcPixelsRow, theSrcRect.mWidth, theColor);
 
-			#undef NEXT_SRC_COLOR	
-			#undef READ_SRC_COLOR	
-			#undef EACH_ROW			
+					aDestPixelsRow += mWidth;
+					aSrcPixelsRow += theImage->mWidth;
+				}
+			}
+			else
+			{
+				#define NEXT_SRC_COLOR		(*(aSrcPtr++))
+				#define READ_SRC_COLOR		(*(aSrcPtr))
+				#undef EACH_ROW
+				#define EACH_ROW			uint32_t* aSrcPtr = aSrcPixelsRow
+
+				#include "inc_routines/MI_NormalBlt.inc"
+
+				#undef NEXT_SRC_COLOR	
+				#undef READ_SRC_COLOR	
+				#undef EACH_ROW			
+			}
 		}
 		else
 		{			
@@ -1452,7 +1525,7 @@ void MemoryImage::NormalBlt(Image* theImage, int theX, int theY, const Rect& the
 			#undef EACH_ROW			
 		}
 
-		BitsChanged();
+		RowsChanged(theY, theSrcRect.mHeight);
 	}
 }
 
@@ -1810,6 +1883,12 @@ void MemoryImage::BltTrianglesTexHelper(Image *theTexture, const TriVertex theVe
 //	if (anImage==NULL)
 //		return;
 
+	// Big batches are binned and drawn in bands across the raster threads,
+	// unless the texture is the image being drawn on
+	bool binned = theNumTriangles>=8 && anImage!=this && SWHelper::GetRasterThreads()>1;
+	if (binned)
+		SWHelper::BeginBinning();
+
 	// int aColor = theColor.ToInt(); // unused
 	for (int i=0; i<theNumTriangles; i++)
 	{
@@ -1831,6 +1910,8 @@ void MemoryImage::BltTrianglesTexHelper(Image *theTexture, const TriVertex theVe
 		SWHelper::SWDrawShape(aVerts, 3, anImage, theColor, theDrawMode, theClipRect, theSurface, theBytePitch, thePixelFormat, blend, vertexColor);
 	}
 
+	if (binned)
+		SWHelper::EndBinning();
 }
 
 void MemoryImage::FillScanLinesWithCoverage(Span* theSpans, int theSpanCount, const Color& theColor, int theDrawMode, const BYTE* theCoverage, int theCoverX, int theCoverY, int theCoverWidth, int theCoverHeight)
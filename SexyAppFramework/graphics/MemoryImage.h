@@ -39,9 +39,17 @@ public:
 
 	bool					mBitsChanged;
 	SexyAppBase*			mApp;
+
+	// ALPHA_ flags per row, kept once RowsChanged has been used so CommitBits
+	// only rescans the rows changed since the last commit
+	uchar*					mRowAlphaFlags;
+	int						mRowAlphaCount;
+	int						mDirtyRowTop;
+	int						mDirtyRowBottom;
 	
 private:
 	void					Init();
+	int						ClassifyAlphaRows();
 
 public:
 	virtual void*			GetNativeAlphaData(NativeDisplay *theNative);
@@ -54,6 +62,7 @@ public:
 	virtual void			ReInit();
 
 	virtual void			BitsChanged();
+	void					RowsChanged(int theY, int theHeight);	// BitsChanged for changes within these rows
 	virtual void			CommitBits();
 	
 	virtual void			DeleteNativeData();	
@@ -0,0 +1,309 @@
+#include "graphics/PixelConvert.h"
+#include "misc/CPUFeatures.h"
+
+using namespace Sexy;
+
+#define ARGB_TO_4444(p) (uint16_t)((((p) >> 16) & 0xF000) | (((p) >> 12) & 0x0F00) | (((p) >> 8) & 0x00F0) | (((p) >> 4) & 0x000F))
+#define ARGB_TO_565(p) (uint16_t)((((p) >> 8) & 0xF800) | (((p) >> 5) & 0x07E0) | (((p) >> 3) & 0x001F))
+
+#if defined(SEXY_SIMD_X86)
+
+///////////////////////////////////////////////////////////////////////////////
+// The results only use the low 16 bits of each lane, sign extending them first
+// lets the saturating pack keep them unchanged.
+///////////////////////////////////////////////////////////////////////////////
+static inline SEXY_TARGET_SSE2 __m128i Pack32To16SSE2(__m128i theLo, __m128i theHi)
+{
+	theLo = _mm_srai_epi32(_mm_slli_epi32(theLo, 16), 16);
+	theHi = _mm_srai_epi32(_mm_slli_epi32(theHi, 16), 16);
+	return _mm_packs_epi32(theLo, theHi);
+}
+
+static inline SEXY_TARGET_SSE2 __m128i Convert4444SSE2(__m128i p)
+{
+	__m128i a = _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xF000));
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 12), _mm_set1_epi32(0x0F00));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0x00F0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 4), _mm_set1_epi32(0x000F));
+	return _mm_or_si128(_mm_or_si128(a, r), _mm_or_si128(g, b));
+}
+
+static inline SEXY_TARGET_SSE2 __m128i Convert565SSE2(__m128i p)
+{
+	__m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800));
+	__m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0));
+	__m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F));
+	return _mm_or_si128(r, _mm_or_si128(g, b));
+}
+
+static SEXY_TARGET_SSE2 int ConvertRow4444SSE2(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m128i aLo = Convert4444SSE2(_mm_loadu_si128((const __m128i*)(theSrc + i)));
+		__m128i aHi = Convert4444SSE2(_mm_loadu_si128((const __m128i*)(theSrc + i + 4)));
+		_mm_storeu_si128((__m128i*)(theDest + i), Pack32To16SSE2(aLo, aHi));
+	}
+	return i;
+}
+
+static SEXY_TARGET_SSE2 int ConvertRow565SSE2(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m128i aLo = Convert565SSE2(_mm_loadu_si128((const __m128i*)(theSrc + i)));
+		__m128i aHi = Convert565SSE2(_mm_loadu_si128((const __m128i*)(theSrc + i + 4)));
+		_mm_storeu_si128((__m128i*)(theDest + i), Pack32To16SSE2(aLo, aHi));
+	}
+	return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static inline SEXY_TARGET_AVX2 __m256i Pack32To16AVX2(__m256i theLo, __m256i theHi)
+{
+	theLo = _mm256_srai_epi32(_mm256_slli_epi32(theLo, 16), 16);
+	theHi = _mm256_srai_epi32(_mm256_slli_epi32(theHi, 16), 16);
+	// packs works on each 128 bit half, put the quadwords back in order
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(theLo, theHi), 0xD8);
+}
+
+static inline SEXY_TARGET_AVX2 __m256i Convert4444AVX2(__m256i p)
+{
+	__m256i a = _mm256_and_si256(_mm256_srli_epi32(p, 16), _mm256_set1_epi32(0xF000));
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 12), _mm256_set1_epi32(0x0F00));
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0x00F0));
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 4), _mm256_set1_epi32(0x000F));
+	return _mm256_or_si256(_mm256_or_si256(a, r), _mm256_or_si256(g, b));
+}
+
+static inline SEXY_TARGET_AVX2 __m256i Convert565AVX2(__m256i p)
+{
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(p, 8), _mm256_set1_epi32(0xF800));
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(p, 5), _mm256_set1_epi32(0x07E0));
+	__m256i b = _mm256_and_si256(_mm256_srli_epi32(p, 3), _mm256_set1_epi32(0x001F));
+	return _mm256_or_si256(r, _mm256_or_si256(g, b));
+}
+
+static SEXY_TARGET_AVX2 int ConvertRow4444AVX2(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 16 <= theCount; i += 16)
+	{
+		__m256i aLo = Convert4444AVX2(_mm256_loadu_si256((const __m256i*)(theSrc + i)));
+		__m256i aHi = Convert4444AVX2(_mm256_loadu_si256((const __m256i*)(theSrc + i + 8)));
+		_mm256_storeu_si256((__m256i*)(theDest + i), Pack32To16AVX2(aLo, aHi));
+	}
+	return i;
+}
+
+static SEXY_TARGET_AVX2 int ConvertRow565AVX2(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 16 <= theCount; i += 16)
+	{
+		__m256i aLo = Convert565AVX2(_mm256_loadu_si256((const __m256i*)(theSrc + i)));
+		__m256i aHi = Convert565AVX2(_mm256_loadu_si256((const __m256i*)(theSrc + i + 8)));
+		_mm256_storeu_si256((__m256i*)(theDest + i), Pack32To16AVX2(aLo, aHi));
+	}
+	return i;
+}
+
+static SEXY_TARGET_AVX2 int ExpandPaletteRow8888AVX2(uint32_t* theDest, const uint8_t* theIndices, const uint32_t* thePalette, int theCount)
+{
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m256i anIndices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(theIndices + i)));
+		__m256i aPixels = _mm256_i32gather_epi32((const int*)thePalette, anIndices, 4);
+		_mm256_storeu_si256((__m256i*)(theDest + i), aPixels);
+	}
+	return i;
+}
+
+#elif defined(SEXY_SIMD_NEON)
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static inline uint16x4_t Convert4444NEON(uint32x4_t p)
+{
+	uint32x4_t a = vandq_u32(vshrq_n_u32(p, 16), vdupq_n_u32(0xF000));
+	uint32x4_t r = vandq_u32(vshrq_n_u32(p, 12), vdupq_n_u32(0x0F00));
+	uint32x4_t g = vandq_u32(vshrq_n_u32(p, 8), vdupq_n_u32(0x00F0));
+	uint32x4_t b = vandq_u32(vshrq_n_u32(p, 4), vdupq_n_u32(0x000F));
+	return vmovn_u32(vorrq_u32(vorrq_u32(a, r), vorrq_u32(g, b)));
+}
+
+static inline uint16x4_t Convert565NEON(uint32x4_t p)
+{
+	uint32x4_t r = vandq_u32(vshrq_n_u32(p, 8), vdupq_n_u32(0xF800));
+	uint32x4_t g = vandq_u32(vshrq_n_u32(p, 5), vdupq_n_u32(0x07E0));
+	uint32x4_t b = vandq_u32(vshrq_n_u32(p, 3), vdupq_n_u32(0x001F));
+	return vmovn_u32(vorrq_u32(r, vorrq_u32(g, b)));
+}
+
+static int ConvertRow4444NEON(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		uint16x4_t aLo = Convert4444NEON(vld1q_u32(theSrc + i));
+		uint16x4_t aHi = Convert4444NEON(vld1q_u32(theSrc + i + 4));
+		vst1q_u16(theDest + i, vcombine_u16(aLo, aHi));
+	}
+	return i;
+}
+
+static int ConvertRow565NEON(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		uint16x4_t aLo = Convert565NEON(vld1q_u32(theSrc + i));
+		uint16x4_t aHi = Convert565NEON(vld1q_u32(theSrc + i + 4));
+		vst1q_u16(theDest + i, vcombine_u16(aLo, aHi));
+	}
+	return i;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ConvertRow8888(uint32_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	// Same layout on both sides, the CRT copy is already vectorized
+	memcpy(theDest, theSrc, theCount * sizeof(uint32_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ConvertRow4444(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2: i = ConvertRow4444AVX2(theDest, theSrc, theCount); break;
+	case SIMDLevel_SSE2: i = ConvertRow4444SSE2(theDest, theSrc, theCount); break;
+#elif defined(SEXY_SIMD_NEON)
+	case SIMDLevel_NEON: i = ConvertRow4444NEON(theDest, theSrc, theCount); break;
+#endif
+	default: break;
+	}
+
+	for (; i < theCount; i++)
+		theDest[i] = ARGB_TO_4444(theSrc[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ConvertRow565(uint16_t* theDest, const uint32_t* theSrc, int theCount)
+{
+	int i = 0;
+
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2: i = ConvertRow565AVX2(theDest, theSrc, theCount); break;
+	case SIMDLevel_SSE2: i = ConvertRow565SSE2(theDest, theSrc, theCount); break;
+#elif defined(SEXY_SIMD_NEON)
+	case SIMDLevel_NEON: i = ConvertRow565NEON(theDest, theSrc, theCount); break;
+#endif
+	default: break;
+	}
+
+	for (; i < theCount; i++)
+		theDest[i] = ARGB_TO_565(theSrc[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Only AVX2 has a gather, everywhere else an unrolled lookup is as fast as
+// anything we could do with shuffles.
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ExpandPaletteRow8888(uint32_t* theDest, const uint8_t* theIndices, const uint32_t* thePalette, int theCount)
+{
+	int i = 0;
+
+#if defined(SEXY_SIMD_X86)
+	if (GetSIMDLevel() == SIMDLevel_AVX2)
+		i = ExpandPaletteRow8888AVX2(theDest, theIndices, thePalette, theCount);
+#endif
+
+	for (; i + 4 <= theCount; i += 4)
+	{
+		theDest[i] = thePalette[theIndices[i]];
+		theDest[i + 1] = thePalette[theIndices[i + 1]];
+		theDest[i + 2] = thePalette[theIndices[i + 2]];
+		theDest[i + 3] = thePalette[theIndices[i + 3]];
+	}
+
+	for (; i < theCount; i++)
+		theDest[i] = thePalette[theIndices[i]];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ExpandPaletteRow16(uint16_t* theDest, const uint8_t* theIndices, const uint16_t* thePalette, int theCount)
+{
+	int i = 0;
+
+	for (; i + 4 <= theCount; i += 4)
+	{
+		theDest[i] = thePalette[theIndices[i]];
+		theDest[i + 1] = thePalette[theIndices[i + 1]];
+		theDest[i + 2] = thePalette[theIndices[i + 2]];
+		theDest[i + 3] = thePalette[theIndices[i + 3]];
+	}
+
+	for (; i < theCount; i++)
+		theDest[i] = thePalette[theIndices[i]];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+ScratchBuffer::ScratchBuffer()
+{
+	memset(mBuckets, 0, sizeof(mBuckets));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+ScratchBuffer::~ScratchBuffer()
+{
+	Release();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The returned memory stays valid until the next Get of the same bucket or
+// Release.
+///////////////////////////////////////////////////////////////////////////////
+void* ScratchBuffer::Get(size_t theSize)
+{
+	int aBucket = 0;
+	while (aBucket < NUM_BUCKETS - 1 && ((size_t)1 << (aBucket + MIN_BUCKET_SHIFT)) < theSize)
+		aBucket++;
+
+	size_t aBucketSize = (size_t)1 << (aBucket + MIN_BUCKET_SHIFT);
+	if (aBucketSize < theSize)
+		return NULL;
+
+	if (mBuckets[aBucket] == NULL)
+		mBuckets[aBucket] = new uint8_t[aBucketSize];
+
+	return mBuckets[aBucket];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void ScratchBuffer::Release()
+{
+	for (int i = 0; i < NUM_BUCKETS; i++)
+	{
+		delete[] mBuckets[i];
+		mBuckets[i] = NULL;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Common.h"
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Row kernels used when uploading MemoryImage bits to textures.  Sources are
+// ARGB8888 (or 8 bit indices into an ARGB8888 palette).  Every path picks the
+// best SIMD level at runtime and gives exactly the same output as the scalar one.
+///////////////////////////////////////////////////////////////////////////////
+void				ConvertRow8888(uint32_t* theDest, const uint32_t* theSrc, int theCount);
+void				ConvertRow4444(uint16_t* theDest, const uint32_t* theSrc, int theCount);
+void				ConvertRow565(uint16_t* theDest, const uint32_t* theSrc, int theCount);
+
+void				ExpandPaletteRow8888(uint32_t* theDest, const uint8_t* theIndices, const uint32_t* thePalette, int theCount);
+// thePalette is already in the destination format, see ConvertRow4444/565
+void				ExpandPaletteRow16(uint16_t* theDest, const uint8_t* theIndices, const uint16_t* thePalette, int theCount);
+
+///////////////////////////////////////////////////////////////////////////////
+// Hands out reusable memory in power of 2 buckets so repeated uploads of
+// similar sizes don't hit the heap.  Not thread safe, use one per thread.
+///////////////////////////////////////////////////////////////////////////////
+class ScratchBuffer
+{
+public:
+	enum
+	{
+		MIN_BUCKET_SHIFT = 12,		// 4K
+		NUM_BUCKETS = 20			// up to 2G
+	};
+
+	uint8_t*				mBuckets[NUM_BUCKETS];
+
+public:
+	ScratchBuffer();
+	virtual ~ScratchBuffer();
+
+	void*					Get(size_t theSize);
+	void					Release();
+};
+
+}
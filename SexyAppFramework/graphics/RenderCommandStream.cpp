@@ -0,0 +1,769 @@
+#include "graphics/RenderCommandStream.h"
+#include "graphics/MemoryImage.h"
+#include "graphics/TriVertex.h"
+#include "misc/SexyMatrix.h"
+
+using namespace Sexy;
+
+static const int32_t RENDER_STREAM_MAGIC = 0x43525853; // "SXRC"
+static const int32_t RENDER_STREAM_VERSION = 1;
+static const int RENDER_STREAM_TRIVERTEX_BYTES = 20;
+static const int RENDER_STREAM_MAX_IMAGE_SIZE = 16384;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+RenderCommandRecorder::RenderCommandRecorder()
+{
+	mNextImageId = 0;
+	mDepth = 0;
+	mNumFrames = 0;
+
+	mBuffer.WriteLong(RENDER_STREAM_MAGIC);
+	mBuffer.WriteLong(RENDER_STREAM_VERSION);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool RenderCommandRecorder::SaveToFile(const std::string& theFileName)
+{
+	FILE* aFile = fopen(theFileName.c_str(), "wb");
+	if (aFile == NULL)
+		return false;
+
+	bool success = fwrite(mBuffer.GetDataPtr(), 1, mBuffer.GetDataLen(), aFile) == (size_t)mBuffer.GetDataLen();
+	fclose(aFile);
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Must be called when an image is deleted, its address may be reused.
+///////////////////////////////////////////////////////////////////////////////
+void RenderCommandRecorder::ForgetImage(MemoryImage* theImage)
+{
+	mImageMap.erase(theImage);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void RenderCommandRecorder::WriteCommand(RenderCommandType theType)
+{
+	mBuffer.WriteByte((uchar)theType);
+}
+
+void RenderCommandRecorder::WriteFloat(float theFloat)
+{
+	int32_t aLong;
+	memcpy(&aLong, &theFloat, sizeof(aLong));
+	mBuffer.WriteLong(aLong);
+}
+
+void RenderCommandRecorder::WriteRect(const Rect& theRect)
+{
+	mBuffer.WriteLong(theRect.mX);
+	mBuffer.WriteLong(theRect.mY);
+	mBuffer.WriteLong(theRect.mWidth);
+	mBuffer.WriteLong(theRect.mHeight);
+}
+
+void RenderCommandRecorder::WriteClipRect(const Rect* theClipRect)
+{
+	mBuffer.WriteByte(theClipRect != NULL);
+	if (theClipRect != NULL)
+		WriteRect(*theClipRect);
+}
+
+void RenderCommandRecorder::WriteColor(const Color& theColor)
+{
+	mBuffer.WriteByte((uchar)theColor.mRed);
+	mBuffer.WriteByte((uchar)theColor.mGreen);
+	mBuffer.WriteByte((uchar)theColor.mBlue);
+	mBuffer.WriteByte((uchar)theColor.mAlpha);
+}
+
+void RenderCommandRecorder::WriteMatrix(const SexyMatrix3& theMatrix)
+{
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			WriteFloat(theMatrix.m[i][j]);
+}
+
+void RenderCommandRecorder::WriteTriVertex(const TriVertex& theVertex)
+{
+	WriteFloat(theVertex.x);
+	WriteFloat(theVertex.y);
+	WriteFloat(theVertex.u);
+	WriteFloat(theVertex.v);
+	mBuffer.WriteLong((int32_t)theVertex.color);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes the image's pixels first if the stream doesn't have the current
+// version yet, then returns its id.  The image itself is never modified, so
+// purged images are written without pixels.
+///////////////////////////////////////////////////////////////////////////////
+int RenderCommandRecorder::WriteImage(Image* theImage)
+{
+	MemoryImage* anImage = (MemoryImage*)theImage;
+	if (anImage == NULL)
+		return -1;
+
+	ImageMap::iterator anItr = mImageMap.find(anImage);
+	if (anItr != mImageMap.end() && anItr->second.mBitsChangedCount == anImage->mBitsChangedCount)
+		return anItr->second.mId;
+
+	if (anItr == mImageMap.end())
+	{
+		RecordedImage aRecordedImage;
+		aRecordedImage.mId = mNextImageId++;
+		anItr = mImageMap.insert(ImageMap::value_type(anImage, aRecordedImage)).first;
+	}
+	anItr->second.mBitsChangedCount = anImage->mBitsChangedCount;
+
+	// The image data goes in front of the command that uses it
+	int aWidth = anImage->mWidth;
+	int aHeight = anImage->mHeight;
+	bool hasPixels = anImage->mBits != NULL || anImage->mColorTable != NULL;
+
+	WriteCommand(RenderCommand_ImageData);
+	mBuffer.WriteLong(anItr->second.mId);
+	mBuffer.WriteLong(aWidth);
+	mBuffer.WriteLong(aHeight);
+	mBuffer.WriteByte(hasPixels);
+
+	if (anImage->mBits != NULL)
+		mBuffer.WriteBytes((const uchar*)anImage->mBits, aWidth * aHeight * 4);
+	else if (anImage->mColorTable != NULL)
+	{
+		for (int i = 0; i < aWidth * aHeight; i++)
+			mBuffer.WriteLong(anImage->mColorTable[anImage->mColorIndices[i]]);
+	}
+
+	return anItr->second.mId;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void RenderCommandRecorder::PushTransform(const SexyMatrix3& theTransform, bool concatenate)
+{
+	WriteCommand(RenderCommand_PushTransform);
+	WriteMatrix(theTransform);
+	mBuffer.WriteByte(concatenate);
+}
+
+void RenderCommandRecorder::PopTransform()
+{
+	WriteCommand(RenderCommand_PopTransform);
+}
+
+void RenderCommandRecorder::Flush()
+{
+	WriteCommand(RenderCommand_Flush);
+	mNumFrames++;
+}
+
+void RenderCommandRecorder::Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter)
+{
+	int anId = WriteImage(theImage);
+	WriteCommand(RenderCommand_Blt);
+	mBuffer.WriteLong(anId);
+	WriteFloat(theX);
+	WriteFloat(theY);
+	WriteRect(theSrcRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteByte(linearFilter);
+}
+
+void RenderCommandRecorder::BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode)
+{
+	int anId = WriteImage(theImage);
+	WriteCommand(RenderCommand_BltClipF);
+	mBuffer.WriteLong(anId);
+	WriteFloat(theX);
+	WriteFloat(theY);
+	WriteRect(theSrcRect);
+	WriteClipRect(theClipRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+}
+
+void RenderCommandRecorder::BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter)
+{
+	int anId = WriteImage(theImage);
+	WriteCommand(RenderCommand_BltMirror);
+	mBuffer.WriteLong(anId);
+	WriteFloat(theX);
+	WriteFloat(theY);
+	WriteRect(theSrcRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteByte(linearFilter);
+}
+
+void RenderCommandRecorder::StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror)
+{
+	int anId = WriteImage(theImage);
+	WriteCommand(RenderCommand_StretchBlt);
+	mBuffer.WriteLong(anId);
+	WriteRect(theDestRect);
+	WriteRect(theSrcRect);
+	WriteClipRect(theClipRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteByte(fastStretch);
+	mBuffer.WriteByte(mirror);
+}
+
+void RenderCommandRecorder::BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect)
+{
+	int anId = WriteImage(theImage);
+	WriteCommand(RenderCommand_BltRotated);
+	mBuffer.WriteLong(anId);
+	WriteFloat(theX);
+	WriteFloat(theY);
+	WriteClipRect(theClipRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	WriteFloat((float)theRot);
+	WriteFloat(theRotCenterX);
+	WriteFloat(theRotCenterY);
+	WriteRect(theSrcRect);
+}
+
+void RenderCommandRecorder::BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX, float theY, bool center)
+{
+	int anId = WriteImage(theImage);
+	WriteCommand(RenderCommand_BltTransformed);
+	mBuffer.WriteLong(anId);
+	WriteClipRect(theClipRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	WriteRect(theSrcRect);
+	WriteMatrix(theTransform);
+	mBuffer.WriteByte(linearFilter);
+	WriteFloat(theX);
+	WriteFloat(theY);
+	mBuffer.WriteByte(center);
+}
+
+void RenderCommandRecorder::DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode)
+{
+	WriteCommand(RenderCommand_DrawLine);
+	WriteFloat((float)theStartX);
+	WriteFloat((float)theStartY);
+	WriteFloat((float)theEndX);
+	WriteFloat((float)theEndY);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+}
+
+void RenderCommandRecorder::FillRect(const Rect& theRect, const Color& theColor, int theDrawMode)
+{
+	WriteCommand(RenderCommand_FillRect);
+	WriteRect(theRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+}
+
+void RenderCommandRecorder::DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode)
+{
+	WriteCommand(RenderCommand_DrawTriangle);
+	WriteTriVertex(p1);
+	WriteTriVertex(p2);
+	WriteTriVertex(p3);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+}
+
+void RenderCommandRecorder::DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend)
+{
+	int anId = WriteImage(theTexture);
+	WriteCommand(RenderCommand_DrawTriangleTex);
+	WriteTriVertex(p1);
+	WriteTriVertex(p2);
+	WriteTriVertex(p3);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteLong(anId);
+	mBuffer.WriteByte(blend);
+}
+
+void RenderCommandRecorder::DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend)
+{
+	int anId = WriteImage(theTexture);
+	WriteCommand(RenderCommand_DrawTrianglesTex);
+	mBuffer.WriteLong(theNumTriangles);
+	for (int i = 0; i < theNumTriangles; i++)
+		for (int j = 0; j < 3; j++)
+			WriteTriVertex(theVertices[i][j]);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteLong(anId);
+	WriteFloat(tx);
+	WriteFloat(ty);
+	mBuffer.WriteByte(blend);
+}
+
+void RenderCommandRecorder::DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend)
+{
+	int anId = WriteImage(theTexture);
+	WriteCommand(RenderCommand_DrawTrianglesTexStrip);
+	mBuffer.WriteLong(theNumTriangles);
+	for (int i = 0; i < theNumTriangles + 2; i++)
+		WriteTriVertex(theVertices[i]);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteLong(anId);
+	WriteFloat(tx);
+	WriteFloat(ty);
+	mBuffer.WriteByte(blend);
+}
+
+void RenderCommandRecorder::FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty)
+{
+	WriteCommand(RenderCommand_FillPoly);
+	mBuffer.WriteLong(theNumVertices);
+	for (int i = 0; i < theNumVertices; i++)
+	{
+		mBuffer.WriteLong(theVertices[i].mX);
+		mBuffer.WriteLong(theVertices[i].mY);
+	}
+	WriteClipRect(theClipRect);
+	WriteColor(theColor);
+	mBuffer.WriteByte((uchar)theDrawMode);
+	mBuffer.WriteLong(tx);
+	mBuffer.WriteLong(ty);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+RenderCommandPlayer::RenderCommandPlayer()
+{
+	mCorrupt = false;
+	mStats.Reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+RenderCommandPlayer::~RenderCommandPlayer()
+{
+	for (ImageMap::iterator anItr = mImageMap.begin(); anItr != mImageMap.end(); ++anItr)
+		delete anItr->second;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool RenderCommandPlayer::LoadFromFile(const std::string& theFileName)
+{
+	FILE* aFile = fopen(theFileName.c_str(), "rb");
+	if (aFile == NULL)
+		return false;
+
+	fseek(aFile, 0, SEEK_END);
+	int aSize = ftell(aFile);
+	fseek(aFile, 0, SEEK_SET);
+
+	ByteVector aData(aSize);
+	bool success = aSize > 0 && fread(&aData[0], 1, aSize, aFile) == (size_t)aSize;
+	fclose(aFile);
+
+	if (!success)
+		return false;
+
+	mBuffer.SetData(aData);
+	mBuffer.SeekFront();
+	if (mBuffer.ReadLong() != RENDER_STREAM_MAGIC || mBuffer.ReadLong() != RENDER_STREAM_VERSION)
+		return false;
+
+	Rewind();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Back to the first command, just past the header.
+///////////////////////////////////////////////////////////////////////////////
+void RenderCommandPlayer::Rewind()
+{
+	mBuffer.SeekFront();
+	mBuffer.ReadLong();
+	mBuffer.ReadLong();
+	mCorrupt = false;
+	mStats.Reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool RenderCommandPlayer::HasBytes(int64_t theCount)
+{
+	return theCount <= mBuffer.GetDataLen() - (mBuffer.mReadBitPos + 7) / 8;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Gives up on the rest of the stream.  Whatever the frame drew so far has
+// already gone to the target.
+///////////////////////////////////////////////////////////////////////////////
+bool RenderCommandPlayer::Corrupt()
+{
+	mCorrupt = true;
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+float RenderCommandPlayer::ReadFloat()
+{
+	int32_t aLong = mBuffer.ReadLong();
+	float aFloat;
+	memcpy(&aFloat, &aLong, sizeof(aFloat));
+	return aFloat;
+}
+
+Rect RenderCommandPlayer::ReadRect()
+{
+	Rect aRect;
+	aRect.mX = mBuffer.ReadLong();
+	aRect.mY = mBuffer.ReadLong();
+	aRect.mWidth = mBuffer.ReadLong();
+	aRect.mHeight = mBuffer.ReadLong();
+	return aRect;
+}
+
+bool RenderCommandPlayer::ReadClipRect(Rect& theRect)
+{
+	if (!mBuffer.ReadByte())
+		return false;
+
+	theRect = ReadRect();
+	return true;
+}
+
+Color RenderCommandPlayer::ReadColor()
+{
+	int aRed = mBuffer.ReadByte();
+	int aGreen = mBuffer.ReadByte();
+	int aBlue = mBuffer.ReadByte();
+	int anAlpha = mBuffer.ReadByte();
+	return Color(aRed, aGreen, aBlue, anAlpha);
+}
+
+void RenderCommandPlayer::ReadMatrix(SexyMatrix3& theMatrix)
+{
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			theMatrix.m[i][j] = ReadFloat();
+}
+
+void RenderCommandPlayer::ReadTriVertex(TriVertex& theVertex)
+{
+	theVertex.x = ReadFloat();
+	theVertex.y = ReadFloat();
+	theVertex.u = ReadFloat();
+	theVertex.v = ReadFloat();
+	theVertex.color = (uint32_t)mBuffer.ReadLong();
+}
+
+Image* RenderCommandPlayer::ReadImage()
+{
+	ImageMap::iterator anItr = mImageMap.find(mBuffer.ReadLong());
+	return (anItr != mImageMap.end()) ? anItr->second : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns false, leaving the image alone, if the size is out of range or the
+// stream is too short to hold the pixels.
+///////////////////////////////////////////////////////////////////////////////
+bool RenderCommandPlayer::ReadImageData()
+{
+	int anId = mBuffer.ReadLong();
+	int aWidth = mBuffer.ReadLong();
+	int aHeight = mBuffer.ReadLong();
+	bool hasPixels = mBuffer.ReadByte() != 0;
+
+	if (aWidth <= 0 || aHeight <= 0 || aWidth > RENDER_STREAM_MAX_IMAGE_SIZE || aHeight > RENDER_STREAM_MAX_IMAGE_SIZE)
+		return false;
+	if (hasPixels && !HasBytes((int64_t)aWidth * aHeight * 4))
+		return false;
+
+	MemoryImage*& anImage = mImageMap[anId];
+	if (anImage == NULL)
+		anImage = new MemoryImage();
+
+	if (anImage->mWidth != aWidth || anImage->mHeight != aHeight)
+		anImage->Create(aWidth, aHeight);
+
+	uint32_t* aBits = anImage->GetBits();
+	if (hasPixels)
+	{
+		mBuffer.ReadBytes((uchar*)aBits, aWidth * aHeight * 4);
+		mStats.mImageBytes += aWidth * aHeight * 4;
+	}
+	else
+		memset(aBits, 0, aWidth * aHeight * 4);
+
+	anImage->BitsChanged();
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plays commands up to and including the next Flush.  Returns false once the
+// stream is used up, or at the first command that doesn't make sense, after
+// which mCorrupt is set and the rest of the stream is skipped.  Sizes and
+// counts are checked against what's left of the stream before anything is
+// allocated for them, and draws whose image isn't in the stream are refused
+// rather than passed on as NULL.
+///////////////////////////////////////////////////////////////////////////////
+bool RenderCommandPlayer::PlayFrame(RenderCommandTarget* theTarget)
+{
+	std::vector<TriVertex> aVertices;
+	std::vector<Point> aPoints;
+
+	if (mCorrupt)
+		return false;
+
+	while (!mBuffer.AtEnd())
+	{
+		int aType = mBuffer.ReadByte();
+		if (aType >= NUM_RENDER_COMMANDS)
+			return Corrupt();
+
+		mStats.mNumCommands[aType]++;
+
+		switch (aType)
+		{
+		case RenderCommand_ImageData:
+			if (!ReadImageData())
+				return Corrupt();
+			break;
+
+		case RenderCommand_PushTransform:
+		{
+			SexyMatrix3 aMatrix;
+			ReadMatrix(aMatrix);
+			bool concatenate = mBuffer.ReadByte() != 0;
+			theTarget->PushTransform(aMatrix, concatenate);
+			break;
+		}
+
+		case RenderCommand_PopTransform:
+			theTarget->PopTransform();
+			break;
+
+		case RenderCommand_Flush:
+			theTarget->Flush();
+			mStats.mNumFrames++;
+			return true;
+
+		case RenderCommand_Blt:
+		{
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			float aX = ReadFloat();
+			float aY = ReadFloat();
+			Rect aSrcRect = ReadRect();
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			bool linearFilter = mBuffer.ReadByte() != 0;
+			theTarget->Blt(anImage, aX, aY, aSrcRect, aColor, aDrawMode, linearFilter);
+			break;
+		}
+
+		case RenderCommand_BltClipF:
+		{
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			float aX = ReadFloat();
+			float aY = ReadFloat();
+			Rect aSrcRect = ReadRect();
+			Rect aClipRect;
+			bool hasClip = ReadClipRect(aClipRect);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			theTarget->BltClipF(anImage, aX, aY, aSrcRect, hasClip ? &aClipRect : NULL, aColor, aDrawMode);
+			break;
+		}
+
+		case RenderCommand_BltMirror:
+		{
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			float aX = ReadFloat();
+			float aY = ReadFloat();
+			Rect aSrcRect = ReadRect();
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			bool linearFilter = mBuffer.ReadByte() != 0;
+			theTarget->BltMirror(anImage, aX, aY, aSrcRect, aColor, aDrawMode, linearFilter);
+			break;
+		}
+
+		case RenderCommand_StretchBlt:
+		{
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			Rect aDestRect = ReadRect();
+			Rect aSrcRect = ReadRect();
+			Rect aClipRect;
+			bool hasClip = ReadClipRect(aClipRect);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			bool fastStretch = mBuffer.ReadByte() != 0;
+			bool mirror = mBuffer.ReadByte() != 0;
+			theTarget->StretchBlt(anImage, aDestRect, aSrcRect, hasClip ? &aClipRect : NULL, aColor, aDrawMode, fastStretch, mirror);
+			break;
+		}
+
+		case RenderCommand_BltRotated:
+		{
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			float aX = ReadFloat();
+			float aY = ReadFloat();
+			Rect aClipRect;
+			bool hasClip = ReadClipRect(aClipRect);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			float aRot = ReadFloat();
+			float aRotCenterX = ReadFloat();
+			float aRotCenterY = ReadFloat();
+			Rect aSrcRect = ReadRect();
+			theTarget->BltRotated(anImage, aX, aY, hasClip ? &aClipRect : NULL, aColor, aDrawMode, aRot, aRotCenterX, aRotCenterY, aSrcRect);
+			break;
+		}
+
+		case RenderCommand_BltTransformed:
+		{
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			Rect aClipRect;
+			bool hasClip = ReadClipRect(aClipRect);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			Rect aSrcRect = ReadRect();
+			SexyMatrix3 aMatrix;
+			ReadMatrix(aMatrix);
+			bool linearFilter = mBuffer.ReadByte() != 0;
+			float aX = ReadFloat();
+			float aY = ReadFloat();
+			bool center = mBuffer.ReadByte() != 0;
+			theTarget->BltTransformed(anImage, hasClip ? &aClipRect : NULL, aColor, aDrawMode, aSrcRect, aMatrix, linearFilter, aX, aY, center);
+			break;
+		}
+
+		case RenderCommand_DrawLine:
+		{
+			float aStartX = ReadFloat();
+			float aStartY = ReadFloat();
+			float anEndX = ReadFloat();
+			float anEndY = ReadFloat();
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			theTarget->DrawLine(aStartX, aStartY, anEndX, anEndY, aColor, aDrawMode);
+			break;
+		}
+
+		case RenderCommand_FillRect:
+		{
+			Rect aRect = ReadRect();
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			theTarget->FillRect(aRect, aColor, aDrawMode);
+			break;
+		}
+
+		case RenderCommand_DrawTriangle:
+		{
+			TriVertex p[3];
+			for (int i = 0; i < 3; i++)
+				ReadTriVertex(p[i]);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			theTarget->DrawTriangle(p[0], p[1], p[2], aColor, aDrawMode);
+			break;
+		}
+
+		case RenderCommand_DrawTriangleTex:
+		{
+			TriVertex p[3];
+			for (int i = 0; i < 3; i++)
+				ReadTriVertex(p[i]);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			bool blend = mBuffer.ReadByte() != 0;
+			theTarget->DrawTriangleTex(p[0], p[1], p[2], aColor, aDrawMode, anImage, blend);
+			break;
+		}
+
+		case RenderCommand_DrawTrianglesTex:
+		{
+			int aNumTriangles = mBuffer.ReadLong();
+			if (aNumTriangles < 0 || !HasBytes((int64_t)aNumTriangles * 3 * RENDER_STREAM_TRIVERTEX_BYTES))
+				return Corrupt();
+			aVertices.resize(aNumTriangles * 3 + 3);
+			for (int i = 0; i < aNumTriangles * 3; i++)
+				ReadTriVertex(aVertices[i]);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			float tx = ReadFloat();
+			float ty = ReadFloat();
+			bool blend = mBuffer.ReadByte() != 0;
+			theTarget->DrawTrianglesTex((const TriVertex(*)[3])&aVertices[0], aNumTriangles, aColor, aDrawMode, anImage, tx, ty, blend);
+			break;
+		}
+
+		case RenderCommand_DrawTrianglesTexStrip:
+		{
+			int aNumTriangles = mBuffer.ReadLong();
+			if (aNumTriangles < 0 || !HasBytes(((int64_t)aNumTriangles + 2) * RENDER_STREAM_TRIVERTEX_BYTES))
+				return Corrupt();
+			aVertices.resize(aNumTriangles + 2);
+			for (int i = 0; i < aNumTriangles + 2; i++)
+				ReadTriVertex(aVertices[i]);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			Image* anImage = ReadImage();
+			if (anImage == NULL)
+				return Corrupt();
+			float tx = ReadFloat();
+			float ty = ReadFloat();
+			bool blend = mBuffer.ReadByte() != 0;
+			theTarget->DrawTrianglesTexStrip(&aVertices[0], aNumTriangles, aColor, aDrawMode, anImage, tx, ty, blend);
+			break;
+		}
+
+		case RenderCommand_FillPoly:
+		{
+			int aNumVertices = mBuffer.ReadLong();
+			if (aNumVertices < 0 || !HasBytes((int64_t)aNumVertices * 8))
+				return Corrupt();
+			aPoints.resize(aNumVertices + 1);
+			for (int i = 0; i < aNumVertices; i++)
+			{
+				aPoints[i].mX = mBuffer.ReadLong();
+				aPoints[i].mY = mBuffer.ReadLong();
+			}
+			Rect aClipRect;
+			bool hasClip = ReadClipRect(aClipRect);
+			Color aColor = ReadColor();
+			int aDrawMode = mBuffer.ReadByte();
+			int tx = mBuffer.ReadLong();
+			int ty = mBuffer.ReadLong();
+			theTarget->FillPoly(&aPoints[0], aNumVertices, hasClip ? &aClipRect : NULL, aColor, aDrawMode, tx, ty);
+			break;
+		}
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,222 @@
+#ifndef __RENDERCOMMANDSTREAM_H__
+#define __RENDERCOMMANDSTREAM_H__
+
+#include "Common.h"
+#include "misc/Buffer.h"
+#include "misc/Rect.h"
+#include "graphics/Color.h"
+
+namespace Sexy
+{
+
+	class Image;
+	class MemoryImage;
+	class SexyMatrix3;
+	class TriVertex;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// The drawing API of GLInterface.  The recorder implements it to capture
+	// calls and the player feeds captured calls back into any implementation,
+	// GLInterface itself or NullRenderTarget.
+	///////////////////////////////////////////////////////////////////////////////
+	class RenderCommandTarget
+	{
+	public:
+		virtual ~RenderCommandTarget() {}
+
+		virtual void			PushTransform(const SexyMatrix3& theTransform, bool concatenate) = 0;
+		virtual void			PopTransform() = 0;
+		virtual void			Flush() = 0;
+
+		virtual void			Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter) = 0;
+		virtual void			BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode) = 0;
+		virtual void			BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter) = 0;
+		virtual void			StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror) = 0;
+		virtual void			BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect) = 0;
+		virtual void			BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX, float theY, bool center) = 0;
+		virtual void			DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode) = 0;
+		virtual void			FillRect(const Rect& theRect, const Color& theColor, int theDrawMode) = 0;
+		virtual void			DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode) = 0;
+		virtual void			DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend) = 0;
+		virtual void			DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend) = 0;
+		virtual void			DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend) = 0;
+		virtual void			FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty) = 0;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	enum RenderCommandType
+	{
+		RenderCommand_ImageData,		// pixels of an image the following commands use
+		RenderCommand_PushTransform,
+		RenderCommand_PopTransform,
+		RenderCommand_Flush,			// end of frame
+		RenderCommand_Blt,
+		RenderCommand_BltClipF,
+		RenderCommand_BltMirror,
+		RenderCommand_StretchBlt,
+		RenderCommand_BltRotated,
+		RenderCommand_BltTransformed,
+		RenderCommand_DrawLine,
+		RenderCommand_FillRect,
+		RenderCommand_DrawTriangle,
+		RenderCommand_DrawTriangleTex,
+		RenderCommand_DrawTrianglesTex,
+		RenderCommand_DrawTrianglesTexStrip,
+		RenderCommand_FillPoly,
+		NUM_RENDER_COMMANDS
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Serializes every call into mBuffer.  Images are written out the first time
+	// a command uses them and again whenever their bits change, so a stream
+	// replays on its own without the app's resources.
+	///////////////////////////////////////////////////////////////////////////////
+	class RenderCommandRecorder : public RenderCommandTarget
+	{
+	public:
+		struct RecordedImage
+		{
+			int mId;
+			int mBitsChangedCount;
+		};
+		typedef std::map<MemoryImage*, RecordedImage> ImageMap;
+
+		Buffer					mBuffer;
+		ImageMap				mImageMap;
+		int						mNextImageId;
+		int						mDepth;			// see RenderRecordScope
+		int						mNumFrames;
+
+	protected:
+		void					WriteCommand(RenderCommandType theType);
+		void					WriteFloat(float theFloat);
+		void					WriteRect(const Rect& theRect);
+		void					WriteClipRect(const Rect* theClipRect);
+		void					WriteColor(const Color& theColor);
+		void					WriteMatrix(const SexyMatrix3& theMatrix);
+		void					WriteTriVertex(const TriVertex& theVertex);
+		int						WriteImage(Image* theImage);
+
+	public:
+		RenderCommandRecorder();
+
+		bool					SaveToFile(const std::string& theFileName);
+		void					ForgetImage(MemoryImage* theImage);
+
+		virtual void			PushTransform(const SexyMatrix3& theTransform, bool concatenate);
+		virtual void			PopTransform();
+		virtual void			Flush();
+
+		virtual void			Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter);
+		virtual void			BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode);
+		virtual void			BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter);
+		virtual void			StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror);
+		virtual void			BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect);
+		virtual void			BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX, float theY, bool center);
+		virtual void			DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode);
+		virtual void			FillRect(const Rect& theRect, const Color& theColor, int theDrawMode);
+		virtual void			DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode);
+		virtual void			DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend);
+		virtual void			DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend);
+		virtual void			DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend);
+		virtual void			FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty);
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// GLInterface calls itself for some draws (Blt -> BltTransformed etc.), only
+	// the outermost call is recorded.
+	///////////////////////////////////////////////////////////////////////////////
+	class RenderRecordScope
+	{
+	public:
+		RenderCommandRecorder*	mRecorder;
+
+	public:
+		RenderRecordScope(RenderCommandRecorder* theRecorder) : mRecorder(theRecorder) { if (mRecorder != NULL) mRecorder->mDepth++; }
+		~RenderRecordScope() { if (mRecorder != NULL) mRecorder->mDepth--; }
+
+		bool					IsOutermost() { return mRecorder != NULL && mRecorder->mDepth == 1; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct RenderCommandStats
+	{
+		int mNumCommands[NUM_RENDER_COMMANDS];
+		int mNumFrames;
+		int64_t mImageBytes;
+
+		void Reset() { memset(mNumCommands, 0, sizeof(mNumCommands)); mNumFrames = 0; mImageBytes = 0; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Plays a recorded stream back one frame at a time.  The images it creates
+	// belong to the player.  Streams are read from files, so nothing in them is
+	// trusted: a bad one stops playback and sets mCorrupt.
+	///////////////////////////////////////////////////////////////////////////////
+	class RenderCommandPlayer
+	{
+	public:
+		typedef std::map<int, MemoryImage*> ImageMap;
+
+		Buffer					mBuffer;
+		ImageMap				mImageMap;
+		RenderCommandStats		mStats;
+		bool					mCorrupt;
+
+	protected:
+		float					ReadFloat();
+		Rect					ReadRect();
+		bool					ReadClipRect(Rect& theRect);
+		Color					ReadColor();
+		void					ReadMatrix(SexyMatrix3& theMatrix);
+		void					ReadTriVertex(TriVertex& theVertex);
+		Image*					ReadImage();
+		bool					ReadImageData();
+		bool					HasBytes(int64_t theCount);
+		bool					Corrupt();
+
+	public:
+		RenderCommandPlayer();
+		virtual ~RenderCommandPlayer();
+
+		bool					LoadFromFile(const std::string& theFileName);
+		void					Rewind();
+		bool					PlayFrame(RenderCommandTarget* theTarget);
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Target that draws nothing, for timing the stream itself.
+	///////////////////////////////////////////////////////////////////////////////
+	class NullRenderTarget : public RenderCommandTarget
+	{
+	public:
+		int						mNumFrames;
+		int						mNumDraws;
+
+	public:
+		NullRenderTarget() : mNumFrames(0), mNumDraws(0) {}
+
+		virtual void			PushTransform(const SexyMatrix3& theTransform, bool concatenate) {}
+		virtual void			PopTransform() {}
+		virtual void			Flush() { mNumFrames++; }
+
+		virtual void			Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter) { mNumDraws++; }
+		virtual void			BltClipF(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode) { mNumDraws++; }
+		virtual void			BltMirror(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter) { mNumDraws++; }
+		virtual void			StretchBlt(Image* theImage, const Rect& theDestRect, const Rect& theSrcRect, const Rect* theClipRect, const Color& theColor, int theDrawMode, bool fastStretch, bool mirror) { mNumDraws++; }
+		virtual void			BltRotated(Image* theImage, float theX, float theY, const Rect* theClipRect, const Color& theColor, int theDrawMode, double theRot, float theRotCenterX, float theRotCenterY, const Rect& theSrcRect) { mNumDraws++; }
+		virtual void			BltTransformed(Image* theImage, const Rect* theClipRect, const Color& theColor, int theDrawMode, const Rect& theSrcRect, const SexyMatrix3& theTransform, bool linearFilter, float theX, float theY, bool center) { mNumDraws++; }
+		virtual void			DrawLine(double theStartX, double theStartY, double theEndX, double theEndY, const Color& theColor, int theDrawMode) { mNumDraws++; }
+		virtual void			FillRect(const Rect& theRect, const Color& theColor, int theDrawMode) { mNumDraws++; }
+		virtual void			DrawTriangle(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode) { mNumDraws++; }
+		virtual void			DrawTriangleTex(const TriVertex& p1, const TriVertex& p2, const TriVertex& p3, const Color& theColor, int theDrawMode, Image* theTexture, bool blend) { mNumDraws++; }
+		virtual void			DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend) { mNumDraws++; }
+		virtual void			DrawTrianglesTexStrip(const TriVertex theVertices[], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend) { mNumDraws++; }
+		virtual void			FillPoly(const Point theVertices[], int theNumVertices, const Rect* theClipRect, const Color& theColor, int theDrawMode, int tx, int ty) { mNumDraws++; }
+	};
+
+}
+
+#endif // __RENDERCOMMANDSTREAM_H__
@@ -1,13 +1,19 @@
 #pragma warning(disable:4244 4305 4309)
 
 #include "SWTri.h"
+#include "graphics/SWTriBinner.h"
 #include "misc/Debug.h"
 
+#include <climits>
+
 using namespace Sexy;
 
 static SWHelper::XYZStruct	vertexReservoir[64];
 static unsigned int			vertexReservoirUsed = 0;
 
+static SWTriBinner *			gSWTriBinner = NULL;
+static int					gBinningDepth = 0;
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -427,6 +433,9 @@ void SWHelper::SWDrawShape(XYZStruct *theVerts, int theNumVerts, MemoryImage *th
 			SWVertex	pVerts[64];
 			SWTextureInfo	textureInfo;
 
+			textureInfo.rowTop = INT_MIN;
+			textureInfo.rowBottom = INT_MAX;
+
 			for (unsigned int i = 0; i < vCount; ++i)
 			{
 				pVerts[i].x = static_cast<int>(clipped[i]->mX * 65536.0f);
@@ -650,10 +659,62 @@ void	SWHelper::SWDrawTriangle(bool textured, bool talpha, bool mod_argb, bool gl
 	{
 		DBG_ASSERT("You need to call SWTri_AddDrawTriFunc or SWTri_AddAllDrawTriFuncs"==NULL);
 	}
+	else if (gSWTriBinner!=NULL && gBinningDepth>0)
+	{
+		gSWTriBinner->Add(aFunc, pVerts, pFrameBuffer, bytepitch, textureInfo, globalDiffuse);
+
+		// Drawing modulates the caller's vertices by the global color, and
+		// SWDrawShape reuses the first one for the rest of a fan
+		if (mod_argb && global_argb)
+		{
+			for (int i = 0; i < 3; i++)
+			{
+				pVerts[i].a = (pVerts[i].a * globalDiffuse.a) >> 8;
+				pVerts[i].r = (pVerts[i].r * globalDiffuse.r) >> 8;
+				pVerts[i].g = (pVerts[i].g * globalDiffuse.g) >> 8;
+				pVerts[i].b = (pVerts[i].b * globalDiffuse.b) >> 8;
+			}
+		}
+	}
 	else
 		aFunc(pVerts, pFrameBuffer, bytepitch, textureInfo, globalDiffuse);
 
 //	#include "SWTri_DrawTriangleInc2.cpp"
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// One thread (the default) draws every triangle as it comes in.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void	SWHelper::SetRasterThreads(int theNumThreads)
+{
+	if (theNumThreads==GetRasterThreads())
+		return;
+
+	delete gSWTriBinner; // flushes
+	gSWTriBinner = NULL;
+
+	if (theNumThreads > 1)
+		gSWTriBinner = new SWTriBinner(theNumThreads-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+int		SWHelper::GetRasterThreads()
+{
+	return gSWTriBinner!=NULL ? gSWTriBinner->GetNumThreads() : 1;
+}
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void	SWHelper::BeginBinning()
+{
+	gBinningDepth++;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void	SWHelper::EndBinning()
+{
+	if (--gBinningDepth==0 && gSWTriBinner!=NULL)
+		gSWTriBinner->Flush();
+}
@@ -33,6 +33,7 @@ public:
 		int pitch;
 		unsigned int endpos;
 		int height;
+		int rowTop, rowBottom;		// only rows in [rowTop, rowBottom) are drawn
 	};
 	struct	SWDiffuse
 	{
@@ -45,6 +46,15 @@ public:
 	// For drawing
 	static void						SWDrawShape(XYZStruct *theVerts, int theNumVerts, MemoryImage *theImage, const Color &theColor, int theDrawMode, const Rect &theClipRect, void *theSurface, int thePitch, int thePixelFormat, bool blend, bool vertexColor);
 	static void						SWDrawTriangle(bool textured, bool talpha, bool mod_argb, bool global_argb, SWVertex * pVerts, unsigned int * pFrameBuffer, const unsigned int pitch, const SWTextureInfo * textureInfo, SWDiffuse & globalDiffuse, int thePixelFormat, bool blend);
+
+	// Banded rendering.  Between BeginBinning and EndBinning triangles are
+	// queued instead of drawn, and EndBinning rasterizes them across
+	// SetRasterThreads threads.  The caller must leave the target and the
+	// textures alone until EndBinning returns.
+	static void						SetRasterThreads(int theNumThreads);
+	static int						GetRasterThreads();
+	static void						BeginBinning();
+	static void						EndBinning();
 };
 
 typedef void(*DrawTriFunc)(SWHelper::SWVertex * pVerts, void * pFrameBuffer, const unsigned int bytepitch, const SWHelper::SWTextureInfo * textureInfo, SWHelper::SWDiffuse & globalDiffuse);
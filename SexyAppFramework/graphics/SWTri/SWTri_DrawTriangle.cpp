@@ -116,6 +116,14 @@ void	Sexy::funcname(SWHelper::SWVertex * pVerts, void * pFrameBuffer, const unsi
 	if (y0 == y2) return;   // Null polygon (no height)?
 	int	y1 = (v1->y + 0xffff) >> 16;
 
+	// Only rows in [rowTop, rowBottom) are written.  The edges are still walked
+	// from y0 so a banded triangle steps exactly like the whole one does.
+
+	const int	rowTop = textureInfo->rowTop;
+	const int	rowBottom = textureInfo->rowBottom;
+	if (y2 <= rowTop || y0 >= rowBottom) return;
+	int	row = y0;
+
 	// Calculate long-edge deltas
 
 	SWHelper::signed64	oneOverHeight = bigOne / (v2->y - v0->y);
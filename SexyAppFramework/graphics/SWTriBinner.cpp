@@ -0,0 +1,227 @@
+#include "graphics/SWTriBinner.h"
+
+#include <SDL.h>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SWTriBinner::SWTriBinner(int theNumWorkers)
+{
+	mFrameBuffer = NULL;
+	mBytePitch = 0;
+	mStats.Reset();
+
+	mGeneration = 0;
+	mNextBand = 0;
+	mBandsLeft = 0;
+	mShutdown = false;
+
+	mMutex = SDL_CreateMutex();
+	mWorkCond = SDL_CreateCond();
+	mDoneCond = SDL_CreateCond();
+
+	for (int i = 0; i < theNumWorkers; i++)
+	{
+		SDL_Thread* aThread = SDL_CreateThread(WorkerProcStub, "SWTriBinner", this);
+		if (aThread != NULL)
+			mWorkers.push_back(aThread);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SWTriBinner::~SWTriBinner()
+{
+	Flush();
+
+	SDL_LockMutex(mMutex);
+	mShutdown = true;
+	SDL_CondBroadcast(mWorkCond);
+	SDL_UnlockMutex(mMutex);
+
+	for (int i = 0; i < (int)mWorkers.size(); i++)
+		SDL_WaitThread(mWorkers[i], NULL);
+
+	SDL_DestroyCond(mDoneCond);
+	SDL_DestroyCond(mWorkCond);
+	SDL_DestroyMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int SWTriBinner::WorkerProcStub(void* theArg)
+{
+	((SWTriBinner*)theArg)->WorkerProc();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void SWTriBinner::WorkerProc()
+{
+	SDL_LockMutex(mMutex);
+	int aGeneration = mGeneration;
+
+	for (;;)
+	{
+		while (mGeneration == aGeneration && !mShutdown)
+			SDL_CondWait(mWorkCond, mMutex);
+
+		if (mShutdown)
+			break;
+
+		aGeneration = mGeneration;
+
+		SDL_UnlockMutex(mMutex);
+		DrawBands();
+		SDL_LockMutex(mMutex);
+	}
+
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Takes bands until there are none left.  A worker that wakes up after the
+// flush it was woken for has finished finds no bands and goes back to sleep.
+///////////////////////////////////////////////////////////////////////////////
+void SWTriBinner::DrawBands()
+{
+	SDL_LockMutex(mMutex);
+
+	while (mBandsLeft > 0 && mNextBand < (int)mBands.size())
+	{
+		int aBand = mNextBand++;
+
+		SDL_UnlockMutex(mMutex);
+		DrawBand(aBand);
+		SDL_LockMutex(mMutex);
+
+		mStats.mBandTriangles += (int)mBands[aBand].size();
+		if (--mBandsLeft == 0)
+			SDL_CondBroadcast(mDoneCond);
+	}
+
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void SWTriBinner::DrawBand(int theBand)
+{
+	const IndexList& aList = mBands[theBand];
+	int aTop = theBand * BAND_HEIGHT;
+	int aBottom = aTop + BAND_HEIGHT;
+
+	for (int i = 0; i < (int)aList.size(); i++)
+	{
+		const SWBinnedTriangle& aTri = mTriangles[aList[i]];
+
+		// The DrawTriFuncs sort and modulate the vertices in place, so every
+		// band gets its own copy
+		SWHelper::SWVertex aVerts[3] = { aTri.mVerts[0], aTri.mVerts[1], aTri.mVerts[2] };
+		SWHelper::SWTextureInfo anInfo = aTri.mTextureInfo;
+		SWHelper::SWDiffuse aDiffuse = aTri.mDiffuse;
+
+		if (anInfo.rowTop < aTop)
+			anInfo.rowTop = aTop;
+		if (anInfo.rowBottom > aBottom)
+			anInfo.rowBottom = aBottom;
+
+		aTri.mFunc(aVerts, mFrameBuffer, mBytePitch, &anInfo, aDiffuse);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void SWTriBinner::Add(DrawTriFunc theFunc, const SWHelper::SWVertex* theVerts, void* theFrameBuffer, unsigned int theBytePitch, const SWHelper::SWTextureInfo* theTextureInfo, const SWHelper::SWDiffuse& theDiffuse)
+{
+	if (theFrameBuffer != mFrameBuffer || theBytePitch != mBytePitch)
+	{
+		Flush();
+		mFrameBuffer = theFrameBuffer;
+		mBytePitch = theBytePitch;
+	}
+
+	// Same rows the DrawTriFunc will cover, ceil() of the top and bottom Y
+	int aMinY = theVerts[0].y;
+	int aMaxY = theVerts[0].y;
+	for (int i = 1; i < 3; i++)
+	{
+		if (theVerts[i].y < aMinY)
+			aMinY = theVerts[i].y;
+		if (theVerts[i].y > aMaxY)
+			aMaxY = theVerts[i].y;
+	}
+
+	int aTop = (aMinY + 0xffff) >> 16;
+	int aBottom = (aMaxY + 0xffff) >> 16;
+	if (aTop < theTextureInfo->rowTop)
+		aTop = theTextureInfo->rowTop;
+	if (aBottom > theTextureInfo->rowBottom)
+		aBottom = theTextureInfo->rowBottom;
+	if (aTop < 0)
+		aTop = 0;
+	if (aTop >= aBottom)
+		return;
+
+	int anIndex = (int)mTriangles.size();
+	mTriangles.resize(anIndex + 1);
+
+	SWBinnedTriangle& aTri = mTriangles.back();
+	aTri.mFunc = theFunc;
+	aTri.mVerts[0] = theVerts[0];
+	aTri.mVerts[1] = theVerts[1];
+	aTri.mVerts[2] = theVerts[2];
+	aTri.mTextureInfo = *theTextureInfo;
+	aTri.mDiffuse = theDiffuse;
+	mStats.mTriangles++;
+
+	int aFirstBand = aTop / BAND_HEIGHT;
+	int aLastBand = (aBottom - 1) / BAND_HEIGHT;
+	if (aLastBand >= (int)mBands.size())
+		mBands.resize(aLastBand + 1);
+
+	for (int aBand = aFirstBand; aBand <= aLastBand; aBand++)
+		mBands[aBand].push_back(anIndex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void SWTriBinner::Flush()
+{
+	if (mTriangles.empty())
+		return;
+
+	mStats.mFlushes++;
+
+	if (mWorkers.empty())
+	{
+		for (int aBand = 0; aBand < (int)mBands.size(); aBand++)
+		{
+			DrawBand(aBand);
+			mStats.mBandTriangles += (int)mBands[aBand].size();
+		}
+	}
+	else
+	{
+		SDL_LockMutex(mMutex);
+		mNextBand = 0;
+		mBandsLeft = (int)mBands.size();
+		mGeneration++;
+		SDL_CondBroadcast(mWorkCond);
+		SDL_UnlockMutex(mMutex);
+
+		DrawBands();
+
+		SDL_LockMutex(mMutex);
+		while (mBandsLeft > 0)
+			SDL_CondWait(mDoneCond, mMutex);
+		SDL_UnlockMutex(mMutex);
+	}
+
+	// Keep the band lists' storage for the next batch
+	mTriangles.clear();
+	for (int aBand = 0; aBand < (int)mBands.size(); aBand++)
+		mBands[aBand].clear();
+}
@@ -0,0 +1,88 @@
+#ifndef __SWTRIBINNER_H__
+#define __SWTRIBINNER_H__
+
+#include "graphics/SWTri.h"
+
+#include <vector>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+namespace Sexy
+{
+
+	///////////////////////////////////////////////////////////////////////////////
+	// A triangle as SWDrawTriangle would have handed it to its DrawTriFunc.
+	///////////////////////////////////////////////////////////////////////////////
+	struct SWBinnedTriangle
+	{
+		DrawTriFunc					mFunc;
+		SWHelper::SWVertex			mVerts[3];
+		SWHelper::SWTextureInfo		mTextureInfo;
+		SWHelper::SWDiffuse			mDiffuse;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct SWTriBinnerStats
+	{
+		int mTriangles;
+		int mBandTriangles;			// triangle draws summed over every band
+		int mFlushes;
+
+		void Reset() { mTriangles = mBandTriangles = mFlushes = 0; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Queues software triangles for one target and draws them band by band.  A
+	// band is BAND_HEIGHT full rows of the target; each one is drawn by a single
+	// thread, through the regular DrawTriFuncs limited to its rows, and in
+	// submission order, so the result matches drawing the triangles one at a
+	// time.  Flush is called on the submitting thread, which draws bands too.
+	///////////////////////////////////////////////////////////////////////////////
+	class SWTriBinner
+	{
+	public:
+		enum
+		{
+			BAND_HEIGHT = 16
+		};
+
+		typedef std::vector<int> IndexList;
+
+		std::vector<SWBinnedTriangle> mTriangles;
+		std::vector<IndexList>	mBands;			// indices into mTriangles
+		void*					mFrameBuffer;
+		unsigned int			mBytePitch;
+		SWTriBinnerStats		mStats;
+
+		SDL_mutex*				mMutex;
+		SDL_cond*				mWorkCond;
+		SDL_cond*				mDoneCond;
+		std::vector<SDL_Thread*> mWorkers;
+		int						mGeneration;	// bumped for every Flush that needs the workers
+		int						mNextBand;
+		int						mBandsLeft;
+		bool					mShutdown;
+
+	protected:
+		static int				WorkerProcStub(void* theArg);
+		void					WorkerProc();
+		void					DrawBands();
+		void					DrawBand(int theBand);
+
+	public:
+		SWTriBinner(int theNumWorkers);
+		virtual ~SWTriBinner();
+
+		// Queues a triangle, flushing first if it's for a different target.
+		void					Add(DrawTriFunc theFunc, const SWHelper::SWVertex* theVerts, void* theFrameBuffer, unsigned int theBytePitch, const SWHelper::SWTextureInfo* theTextureInfo, const SWHelper::SWDiffuse& theDiffuse);
+		void					Flush();
+
+		int						GetNumThreads() { return (int)mWorkers.size() + 1; }
+	};
+
+}
+
+#endif // __SWTRIBINNER_H__
@@ -0,0 +1,366 @@
+#include "TextureAtlas.h"
+
+#include <climits>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+AtlasPage::AtlasPage(int theWidth, int theHeight)
+{
+	mWidth = theWidth;
+	mHeight = theHeight;
+	mShelfTop = 0;
+	mUsedArea = 0;
+	mHasFreed = false;
+	mTexture = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Best-fit by shelf height.  The first pass refuses shelves more than twice
+// as tall as the rect so small images don't eat tall shelves while there is
+// still room to open a new one.
+///////////////////////////////////////////////////////////////////////////////
+bool AtlasPage::Place(int thePaddedWidth, int thePaddedHeight, int& theX, int& theY, int& theShelf)
+{
+	if (thePaddedWidth > mWidth || thePaddedHeight > mHeight)
+		return false;
+
+	for (int aPass = 0; aPass < 2; aPass++)
+	{
+		int aBestShelf = -1;
+		int aBestSpan = -1;
+		int aBestWaste = INT_MAX;
+
+		for (int i = 0; i < (int)mShelves.size(); i++)
+		{
+			AtlasShelf& aShelf = mShelves[i];
+			if (aShelf.mHeight < thePaddedHeight)
+				continue;
+
+			int aWaste = aShelf.mHeight - thePaddedHeight;
+			if (aWaste >= aBestWaste)
+				continue;
+
+			if (aPass == 0 && aShelf.mNumEntries > 0 && aShelf.mHeight > thePaddedHeight * 2)
+				continue;
+
+			for (int j = 0; j < (int)aShelf.mFreeSpans.size(); j++)
+			{
+				if (aShelf.mFreeSpans[j].mWidth >= thePaddedWidth)
+				{
+					aBestShelf = i;
+					aBestSpan = j;
+					aBestWaste = aWaste;
+					break;
+				}
+			}
+		}
+
+		if (aBestShelf != -1)
+		{
+			AtlasShelf& aShelf = mShelves[aBestShelf];
+			AtlasSpan& aSpan = aShelf.mFreeSpans[aBestSpan];
+
+			theX = aSpan.mX;
+			theY = aShelf.mY;
+			theShelf = aBestShelf;
+
+			aSpan.mX += thePaddedWidth;
+			aSpan.mWidth -= thePaddedWidth;
+			if (aSpan.mWidth == 0)
+				aShelf.mFreeSpans.erase(aShelf.mFreeSpans.begin() + aBestSpan);
+
+			aShelf.mNumEntries++;
+			mUsedArea += thePaddedWidth * thePaddedHeight;
+			return true;
+		}
+
+		// Open a new shelf before settling for a badly fitting one
+		if (aPass == 0 && mShelfTop + thePaddedHeight <= mHeight)
+		{
+			AtlasShelf aShelf;
+			aShelf.mY = mShelfTop;
+			aShelf.mHeight = thePaddedHeight;
+			aShelf.mNumEntries = 1;
+
+			if (thePaddedWidth < mWidth)
+			{
+				AtlasSpan aSpan = { thePaddedWidth, mWidth - thePaddedWidth };
+				aShelf.mFreeSpans.push_back(aSpan);
+			}
+
+			theX = 0;
+			theY = mShelfTop;
+			theShelf = (int)mShelves.size();
+
+			mShelves.push_back(aShelf);
+			mShelfTop += thePaddedHeight;
+			mUsedArea += thePaddedWidth * thePaddedHeight;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void AtlasPage::Release(int theShelf, int theX, int thePaddedWidth)
+{
+	AtlasShelf& aShelf = mShelves[theShelf];
+	AtlasShelf::SpanVector& aSpans = aShelf.mFreeSpans;
+
+	aShelf.mNumEntries--;
+
+	int anIndex = 0;
+	while (anIndex < (int)aSpans.size() && aSpans[anIndex].mX < theX)
+		anIndex++;
+
+	AtlasSpan aSpan = { theX, thePaddedWidth };
+	aSpans.insert(aSpans.begin() + anIndex, aSpan);
+
+	// Merge with the following span, then with the preceding one
+	if (anIndex + 1 < (int)aSpans.size() && aSpans[anIndex].mX + aSpans[anIndex].mWidth == aSpans[anIndex + 1].mX)
+	{
+		aSpans[anIndex].mWidth += aSpans[anIndex + 1].mWidth;
+		aSpans.erase(aSpans.begin() + anIndex + 1);
+	}
+
+	if (anIndex > 0 && aSpans[anIndex - 1].mX + aSpans[anIndex - 1].mWidth == aSpans[anIndex].mX)
+	{
+		aSpans[anIndex - 1].mWidth += aSpans[anIndex].mWidth;
+		aSpans.erase(aSpans.begin() + anIndex);
+	}
+
+	// Empty shelves at the top of the page give their rows back
+	while (!mShelves.empty() && mShelves.back().mNumEntries == 0)
+		mShelves.pop_back();
+
+	mShelfTop = mShelves.empty() ? 0 : mShelves.back().mY + mShelves.back().mHeight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fraction of the shelf rows that isn't covered by live entries.
+///////////////////////////////////////////////////////////////////////////////
+float AtlasPage::GetFragmentation()
+{
+	int aShelfArea = mShelfTop * mWidth;
+	if (aShelfArea == 0)
+		return 0;
+
+	return 1.0f - (float)mUsedArea / aShelfArea;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TextureAtlas::TextureAtlas(int thePageWidth, int thePageHeight, int theGutter, int theMaxImageSize, int theMaxPages)
+{
+	mPageWidth = thePageWidth;
+	mPageHeight = thePageHeight;
+	mGutter = theGutter;
+	mMaxImageSize = theMaxImageSize;
+	mMaxPages = theMaxPages;
+	mCompactThreshold = 0.5f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TextureAtlas::~TextureAtlas()
+{
+	for (int i = 0; i < (int)mPages.size(); i++)
+	{
+		AtlasPage* aPage = mPages[i];
+
+		AtlasPage::EntrySet::iterator anItr;
+		for (anItr = aPage->mEntries.begin(); anItr != aPage->mEntries.end(); ++anItr)
+			delete *anItr;
+
+		delete aPage;
+	}
+
+	mPages.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool TextureAtlas::CanHold(int theWidth, int theHeight)
+{
+	if (theWidth <= 0 || theHeight <= 0)
+		return false;
+
+	if (theWidth > mMaxImageSize || theHeight > mMaxImageSize)
+		return false;
+
+	return theWidth + mGutter * 2 <= mPageWidth && theHeight + mGutter * 2 <= mPageHeight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Only tries the existing pages; the caller decides whether to compact or to
+// add a page (both need the renderer's help).
+///////////////////////////////////////////////////////////////////////////////
+AtlasEntry* TextureAtlas::Allocate(int theWidth, int theHeight)
+{
+	if (!CanHold(theWidth, theHeight))
+		return NULL;
+
+	int aPaddedWidth = theWidth + mGutter * 2;
+	int aPaddedHeight = theHeight + mGutter * 2;
+
+	for (int i = 0; i < (int)mPages.size(); i++)
+	{
+		AtlasPage* aPage = mPages[i];
+
+		int x, y, aShelf;
+		if (aPage->Place(aPaddedWidth, aPaddedHeight, x, y, aShelf))
+		{
+			AtlasEntry* anEntry = new AtlasEntry();
+			anEntry->mPage = aPage;
+			anEntry->mX = x + mGutter;
+			anEntry->mY = y + mGutter;
+			anEntry->mWidth = theWidth;
+			anEntry->mHeight = theHeight;
+			anEntry->mShelf = aShelf;
+
+			aPage->mEntries.insert(anEntry);
+			return anEntry;
+		}
+	}
+
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+AtlasPage* TextureAtlas::AddPage()
+{
+	if ((int)mPages.size() >= mMaxPages)
+		return NULL;
+
+	AtlasPage* aPage = new AtlasPage(mPageWidth, mPageHeight);
+	mPages.push_back(aPage);
+	return aPage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureAtlas::Free(AtlasEntry* theEntry)
+{
+	if (theEntry == NULL)
+		return;
+
+	AtlasPage* aPage = theEntry->mPage;
+	int aPaddedWidth = theEntry->mWidth + mGutter * 2;
+	int aPaddedHeight = theEntry->mHeight + mGutter * 2;
+
+	aPage->Release(theEntry->mShelf, theEntry->mX - mGutter, aPaddedWidth);
+	aPage->mUsedArea -= aPaddedWidth * aPaddedHeight;
+	aPage->mHasFreed = true;
+	aPage->mEntries.erase(theEntry);
+
+	delete theEntry;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+AtlasPage* TextureAtlas::FindFragmentedPage()
+{
+	for (int i = 0; i < (int)mPages.size(); i++)
+	{
+		AtlasPage* aPage = mPages[i];
+		if (aPage->mHasFreed && aPage->GetFragmentation() > mCompactThreshold)
+			return aPage;
+	}
+
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static bool AtlasEntryTaller(const AtlasEntry* theEntry1, const AtlasEntry* theEntry2)
+{
+	if (theEntry1->mHeight != theEntry2->mHeight)
+		return theEntry1->mHeight > theEntry2->mHeight;
+
+	return theEntry1->mWidth > theEntry2->mWidth;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Repacks every entry of thePage from scratch, tallest first.  Entries are
+// only updated if everything fits; theMoves lists the padded rects the
+// renderer has to copy (old position -> new position).
+///////////////////////////////////////////////////////////////////////////////
+bool TextureAtlas::Compact(AtlasPage* thePage, AtlasMoveVector& theMoves)
+{
+	theMoves.clear();
+	thePage->mHasFreed = false;
+
+	std::vector<AtlasEntry*> anEntries(thePage->mEntries.begin(), thePage->mEntries.end());
+	std::sort(anEntries.begin(), anEntries.end(), AtlasEntryTaller);
+
+	AtlasPage aNewPage(thePage->mWidth, thePage->mHeight);
+	std::vector<int> aNewX(anEntries.size()), aNewY(anEntries.size()), aNewShelf(anEntries.size());
+
+	int i;
+	for (i = 0; i < (int)anEntries.size(); i++)
+	{
+		AtlasEntry* anEntry = anEntries[i];
+		if (!aNewPage.Place(anEntry->mWidth + mGutter * 2, anEntry->mHeight + mGutter * 2, aNewX[i], aNewY[i], aNewShelf[i]))
+			return false;
+	}
+
+	for (i = 0; i < (int)anEntries.size(); i++)
+	{
+		AtlasEntry* anEntry = anEntries[i];
+
+		int aSrcX = anEntry->mX - mGutter;
+		int aSrcY = anEntry->mY - mGutter;
+		if (aSrcX != aNewX[i] || aSrcY != aNewY[i])
+		{
+			AtlasMove aMove = { aSrcX, aSrcY, aNewX[i], aNewY[i], anEntry->mWidth + mGutter * 2, anEntry->mHeight + mGutter * 2 };
+			theMoves.push_back(aMove);
+		}
+
+		anEntry->mX = aNewX[i] + mGutter;
+		anEntry->mY = aNewY[i] + mGutter;
+		anEntry->mShelf = aNewShelf[i];
+	}
+
+	thePage->mShelves.swap(aNewPage.mShelves);
+	thePage->mShelfTop = aNewPage.mShelfTop;
+	thePage->mUsedArea = aNewPage.mUsedArea;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int TextureAtlas::GetUsedArea()
+{
+	int anArea = 0;
+	for (int i = 0; i < (int)mPages.size(); i++)
+	{
+		AtlasPage::EntrySet::iterator anItr;
+		for (anItr = mPages[i]->mEntries.begin(); anItr != mPages[i]->mEntries.end(); ++anItr)
+			anArea += (*anItr)->mWidth * (*anItr)->mHeight;
+	}
+
+	return anArea;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int TextureAtlas::GetPageArea()
+{
+	return (int)mPages.size() * mPageWidth * mPageHeight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+float TextureAtlas::GetPackingEfficiency()
+{
+	int aPageArea = GetPageArea();
+	if (aPageArea == 0)
+		return 0;
+
+	return (float)GetUsedArea() / aPageArea;
+}
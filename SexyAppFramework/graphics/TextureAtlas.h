@@ -0,0 +1,118 @@
+#ifndef __TEXTUREATLAS_H__
+#define __TEXTUREATLAS_H__
+
+#include "Common.h"
+
+namespace Sexy
+{
+
+	class AtlasPage;
+
+	///////////////////////////////////////////////////////////////////////////////
+	// One image placed in an atlas page.  mX/mY is the top-left of the image
+	// itself; the gutter surrounds it.  Pointers stay valid across compaction.
+	///////////////////////////////////////////////////////////////////////////////
+	struct AtlasEntry
+	{
+		AtlasPage* mPage;
+		int mX, mY;
+		int mWidth, mHeight;
+		int mShelf;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct AtlasSpan
+	{
+		int mX;
+		int mWidth;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct AtlasShelf
+	{
+		typedef std::vector<AtlasSpan> SpanVector;
+
+		int mY;
+		int mHeight;
+		int mNumEntries;
+		SpanVector mFreeSpans;	// sorted by mX, adjacent spans always merged
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// A padded rect that moved during compaction (gutter included).
+	///////////////////////////////////////////////////////////////////////////////
+	struct AtlasMove
+	{
+		int mSrcX, mSrcY;
+		int mDestX, mDestY;
+		int mWidth, mHeight;
+	};
+
+	typedef std::vector<AtlasMove> AtlasMoveVector;
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	class AtlasPage
+	{
+	public:
+		typedef std::vector<AtlasShelf> ShelfVector;
+		typedef std::set<AtlasEntry*> EntrySet;
+
+		int mWidth, mHeight;
+		int mShelfTop;			// y where the next shelf would start
+		int mUsedArea;			// padded area of all live entries
+		bool mHasFreed;			// something was freed since the last compaction
+		unsigned int mTexture;	// owned by the renderer, 0 for CPU-only use
+
+		ShelfVector mShelves;
+		EntrySet mEntries;
+
+	public:
+		AtlasPage(int theWidth, int theHeight);
+
+		bool Place(int thePaddedWidth, int thePaddedHeight, int& theX, int& theY, int& theShelf);
+		void Release(int theShelf, int theX, int thePaddedWidth);
+		float GetFragmentation();
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Shelf allocator that packs small images into fixed size pages.  Knows
+	// nothing about GL: the renderer creates a texture for each page and copies
+	// texels around when Compact reports moves.
+	///////////////////////////////////////////////////////////////////////////////
+	class TextureAtlas
+	{
+	public:
+		typedef std::vector<AtlasPage*> PageVector;
+
+		int mPageWidth, mPageHeight;
+		int mGutter;			// pixels of edge replication around every image
+		int mMaxImageSize;		// images larger than this in either dimension are not atlased, 0 disables atlasing
+		int mMaxPages;
+		float mCompactThreshold;// fragmentation above which a page is worth compacting
+
+		PageVector mPages;
+
+	public:
+		TextureAtlas(int thePageWidth, int thePageHeight, int theGutter = 2, int theMaxImageSize = 128, int theMaxPages = 8);
+		virtual ~TextureAtlas();
+
+		bool CanHold(int theWidth, int theHeight);
+
+		AtlasEntry* Allocate(int theWidth, int theHeight);
+		AtlasPage* AddPage();
+		void Free(AtlasEntry* theEntry);
+
+		AtlasPage* FindFragmentedPage();
+		bool Compact(AtlasPage* thePage, AtlasMoveVector& theMoves);
+
+		int GetUsedArea();
+		int GetPageArea();
+		float GetPackingEfficiency(); // live texels / allocated page texels
+	};
+
+}
+
+#endif // __TEXTUREATLAS_H__
@@ -0,0 +1,441 @@
+#include "graphics/TextureUploadQueue.h"
+#include "graphics/PixelConvert.h"
+
+#include <SDL2/SDL.h>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int Sexy::GetPixelFormatSize(PixelFormat theFormat)
+{
+	switch (theFormat)
+	{
+	case PixelFormat_A4R4G4B4:
+	case PixelFormat_R5G6B5:
+		return 2;
+	default:
+		return 4;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fills the pad column/row past the image with its last pixel/row so linear
+// filtering at the edge doesn't pull in garbage.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+static void PadTextureEdges(T* theDest, int theWidth, int theHeight, int theDestPitch, bool rightPad, bool bottomPad)
+{
+	if (rightPad)
+	{
+		T* aDstRow = theDest + theWidth;
+		for (int y = 0; y < theHeight; y++, aDstRow += theDestPitch)
+			*aDstRow = *(aDstRow - 1);
+	}
+
+	if (bottomPad)
+	{
+		T* aDstRow = theDest + (theDestPitch * theHeight);
+		memcpy(aDstRow, aDstRow - theDestPitch, theDestPitch * sizeof(T));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void ConvertPiece16(const TextureUploadSource& theSource, void (*theConvertRow)(uint16_t*, const uint32_t*, int), int offx, int offy, int theWidth, int theHeight, int theDestPitch, uint16_t* theDest)
+{
+	if (theSource.mBits != NULL)
+	{
+		const uint32_t* srcRow = theSource.mBits + offy * theSource.mWidth + offx;
+		for (int y = 0; y < theHeight; y++, srcRow += theSource.mWidth)
+			theConvertRow(theDest + y * theDestPitch, srcRow, theWidth);
+	}
+	else // palette, convert the 256 entries once and look them up
+	{
+		uint16_t aPalette[256];
+		theConvertRow(aPalette, theSource.mPalette, 256);
+
+		const uint8_t* srcRow = theSource.mIndices + offy * theSource.mWidth + offx;
+		for (int y = 0; y < theHeight; y++, srcRow += theSource.mWidth)
+			ExpandPaletteRow16(theDest + y * theDestPitch, srcRow, aPalette, theWidth);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ConvertTexturePiece(const TextureUploadSource& theSource, PixelFormat theFormat, int offx, int offy, int theTexWidth, int theTexHeight, void* theDest)
+{
+	int aWidth = std::min(theTexWidth, theSource.mWidth - offx);
+	int aHeight = std::min(theTexHeight, theSource.mHeight - offy);
+	if (aWidth <= 0 || aHeight <= 0)
+		return;
+
+	bool rightPad = aWidth < theTexWidth;
+	bool bottomPad = aHeight < theTexHeight;
+
+	switch (theFormat)
+	{
+	case PixelFormat_A8R8G8B8:
+	{
+		uint32_t* aDest = (uint32_t*)theDest;
+		if (theSource.mBits != NULL)
+		{
+			const uint32_t* srcRow = theSource.mBits + offy * theSource.mWidth + offx;
+			for (int y = 0; y < aHeight; y++, srcRow += theSource.mWidth)
+				ConvertRow8888(aDest + y * theTexWidth, srcRow, aWidth);
+		}
+		else // palette
+		{
+			const uint8_t* srcRow = theSource.mIndices + offy * theSource.mWidth + offx;
+			for (int y = 0; y < aHeight; y++, srcRow += theSource.mWidth)
+				ExpandPaletteRow8888(aDest + y * theTexWidth, srcRow, theSource.mPalette, aWidth);
+		}
+
+		PadTextureEdges(aDest, aWidth, aHeight, theTexWidth, rightPad, bottomPad);
+		break;
+	}
+
+	case PixelFormat_A4R4G4B4:
+		ConvertPiece16(theSource, ConvertRow4444, offx, offy, aWidth, aHeight, theTexWidth, (uint16_t*)theDest);
+		PadTextureEdges((uint16_t*)theDest, aWidth, aHeight, theTexWidth, rightPad, bottomPad);
+		break;
+
+	case PixelFormat_R5G6B5:
+		ConvertPiece16(theSource, ConvertRow565, offx, offy, aWidth, aHeight, theTexWidth, (uint16_t*)theDest);
+		PadTextureEdges((uint16_t*)theDest, aWidth, aHeight, theTexWidth, rightPad, bottomPad);
+		break;
+
+	case PixelFormat_Palette8:
+	{
+		uint32_t* aDest = (uint32_t*)theDest;
+		const uint8_t* srcRow = theSource.mIndices + offy * theSource.mWidth + offx;
+		const uint16_t* palette = (const uint16_t*)theSource.mPalette;
+
+		for (int y = 0; y < aHeight; y++, srcRow += theSource.mWidth)
+		{
+			uint32_t* dst = aDest + y * theTexWidth;
+			for (int x = 0; x < aWidth; x++)
+			{
+				uint32_t aPixel = palette[srcRow[x]];
+				*dst++ = (aPixel & 0xFF00FF00) | ((aPixel >> 16) & 0xFF) | ((aPixel << 16) & 0xFF0000);
+			}
+		}
+
+		PadTextureEdges(aDest, aWidth, aHeight, theTexWidth, rightPad, bottomPad);
+		break;
+	}
+
+	case PixelFormat_Unknown:
+		break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TextureUploadJob::TextureUploadJob(void* theOwner, PixelFormat theFormat)
+{
+	mOwner = theOwner;
+	mFormat = theFormat;
+	memset(&mSource, 0, sizeof(mSource));
+	mNextPiece = 0;
+	mState = STATE_QUEUED;
+	mCancelled = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadJob::SetSource(const uint32_t* theBits, const uint8_t* theIndices, const uint32_t* thePalette, int theWidth, int theHeight)
+{
+	int aNumPixels = theWidth * theHeight;
+
+	if (theBits != NULL)
+		mSourceBits.assign(theBits, theBits + aNumPixels);
+	else
+	{
+		mSourceIndices.assign(theIndices, theIndices + aNumPixels);
+		mSourcePalette.assign(thePalette, thePalette + 256);
+	}
+
+	mSource.mBits = mSourceBits.empty() ? NULL : &mSourceBits[0];
+	mSource.mIndices = mSourceIndices.empty() ? NULL : &mSourceIndices[0];
+	mSource.mPalette = mSourcePalette.empty() ? NULL : &mSourcePalette[0];
+	mSource.mWidth = theWidth;
+	mSource.mHeight = theHeight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadJob::AddPiece(GLuint theTexture, int theX, int theY, int theTexWidth, int theTexHeight)
+{
+	TextureUploadPiece aPiece;
+	aPiece.mTexture = theTexture;
+	aPiece.mX = theX;
+	aPiece.mY = theY;
+	aPiece.mTexWidth = theTexWidth;
+	aPiece.mTexHeight = theTexHeight;
+	aPiece.mDataOffset = (int)mConverted.size();
+	mPieces.push_back(aPiece);
+
+	mConverted.resize(mConverted.size() + theTexWidth * theTexHeight * GetPixelFormatSize(mFormat));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadJob::Convert()
+{
+	for (int i = 0; i < (int)mPieces.size(); i++)
+	{
+		TextureUploadPiece& aPiece = mPieces[i];
+		ConvertTexturePiece(mSource, mFormat, aPiece.mX, aPiece.mY, aPiece.mTexWidth, aPiece.mTexHeight, &mConverted[aPiece.mDataOffset]);
+	}
+
+	// The copy isn't needed once everything is converted
+	std::vector<uint32_t>().swap(mSourceBits);
+	std::vector<uint8_t>().swap(mSourceIndices);
+	memset(&mSource, 0, sizeof(mSource));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TextureUploadScheduler::TextureUploadScheduler(TextureUploadBackend* theBackend, int theNumWorkers, int theBudgetMicros)
+{
+	mBackend = theBackend;
+	mBudgetMicros = theBudgetMicros;
+	mStats.Reset();
+	mShutdown = false;
+
+	mMutex = SDL_CreateMutex();
+	mWorkCond = SDL_CreateCond();
+	mDoneCond = SDL_CreateCond();
+
+	for (int i = 0; i < theNumWorkers; i++)
+	{
+		SDL_Thread* aThread = SDL_CreateThread(WorkerProcStub, "TextureUpload", this);
+		if (aThread != NULL)
+			mWorkers.push_back(aThread);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TextureUploadScheduler::~TextureUploadScheduler()
+{
+	SDL_LockMutex(mMutex);
+	mShutdown = true;
+	SDL_CondBroadcast(mWorkCond);
+	SDL_UnlockMutex(mMutex);
+
+	for (int i = 0; i < (int)mWorkers.size(); i++)
+		SDL_WaitThread(mWorkers[i], NULL);
+
+	for (JobList::iterator anItr = mJobs.begin(); anItr != mJobs.end(); ++anItr)
+		delete *anItr;
+
+	SDL_DestroyCond(mDoneCond);
+	SDL_DestroyCond(mWorkCond);
+	SDL_DestroyMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int TextureUploadScheduler::WorkerProcStub(void* theArg)
+{
+	((TextureUploadScheduler*)theArg)->WorkerProc();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadScheduler::WorkerProc()
+{
+	SDL_LockMutex(mMutex);
+
+	for (;;)
+	{
+		while (mConvertQueue.empty() && !mShutdown)
+			SDL_CondWait(mWorkCond, mMutex);
+
+		if (mShutdown)
+			break;
+
+		TextureUploadJob* aJob = mConvertQueue.front();
+		mConvertQueue.pop_front();
+		aJob->mState = TextureUploadJob::STATE_CONVERTING;
+
+		SDL_UnlockMutex(mMutex);
+		aJob->Convert();
+		SDL_LockMutex(mMutex);
+
+		aJob->mState = TextureUploadJob::STATE_READY;
+		SDL_CondBroadcast(mDoneCond);
+	}
+
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadScheduler::Submit(TextureUploadJob* theJob)
+{
+	theJob->mState = TextureUploadJob::STATE_QUEUED;
+	mJobs.push_back(theJob);
+	mStats.mJobsSubmitted++;
+
+	if (mWorkers.empty())
+		return;
+
+	SDL_LockMutex(mMutex);
+	mConvertQueue.push_back(theJob);
+	SDL_CondSignal(mWorkCond);
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadScheduler::RemoveJob(TextureUploadJob* theJob)
+{
+	mJobs.remove(theJob);
+	delete theJob;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A job a worker is still converting can't be deleted yet, it is flagged and
+// thrown away by Update once the worker is done with it.
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadScheduler::Cancel(TextureUploadJob* theJob)
+{
+	mStats.mJobsCancelled++;
+
+	SDL_LockMutex(mMutex);
+	bool converting = theJob->mState == TextureUploadJob::STATE_CONVERTING;
+	if (converting)
+		theJob->mCancelled = true;
+	else if (theJob->mState == TextureUploadJob::STATE_QUEUED)
+	{
+		std::deque<TextureUploadJob*>::iterator anItr = std::find(mConvertQueue.begin(), mConvertQueue.end(), theJob);
+		if (anItr != mConvertQueue.end())
+			mConvertQueue.erase(anItr);
+	}
+	SDL_UnlockMutex(mMutex);
+
+	if (!converting)
+		RemoveJob(theJob);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns true once every piece of the job has been handed to the backend.
+// The first piece of a frame always goes through so big images can't stall.
+///////////////////////////////////////////////////////////////////////////////
+bool TextureUploadScheduler::UploadPieces(TextureUploadJob* theJob, uint64_t theStartTime, int& theFramePieces, bool force)
+{
+	while (theJob->mNextPiece < (int)theJob->mPieces.size())
+	{
+		if (!force && theFramePieces > 0 && mBackend->GetMicroseconds() - theStartTime >= (uint64_t)mBudgetMicros)
+			return false;
+
+		const TextureUploadPiece& aPiece = theJob->mPieces[theJob->mNextPiece++];
+		mBackend->UploadPiece(theJob, aPiece, &theJob->mConverted[aPiece.mDataOffset]);
+
+		theFramePieces++;
+		mStats.mPiecesUploaded++;
+		mStats.mBytesUploaded += aPiece.mTexWidth * aPiece.mTexHeight * GetPixelFormatSize(theJob->mFormat);
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called once per frame on the GL thread.
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadScheduler::Update()
+{
+	uint64_t aStartTime = mBackend->GetMicroseconds();
+	int aFramePieces = 0;
+
+	JobList::iterator anItr = mJobs.begin();
+	while (anItr != mJobs.end())
+	{
+		TextureUploadJob* aJob = *anItr;
+
+		SDL_LockMutex(mMutex);
+		int aState = aJob->mState;
+		bool cancelled = aJob->mCancelled;
+		SDL_UnlockMutex(mMutex);
+
+		if (cancelled)
+		{
+			if (aState == TextureUploadJob::STATE_READY)
+			{
+				anItr = mJobs.erase(anItr);
+				delete aJob;
+			}
+			else
+				++anItr;
+			continue;
+		}
+
+		if (aState == TextureUploadJob::STATE_QUEUED && mWorkers.empty())
+		{
+			if (aFramePieces > 0 && mBackend->GetMicroseconds() - aStartTime >= (uint64_t)mBudgetMicros)
+				break;
+
+			aJob->Convert();
+			aJob->mState = aState = TextureUploadJob::STATE_READY;
+		}
+
+		if (aState != TextureUploadJob::STATE_READY)
+		{
+			++anItr;
+			continue;
+		}
+
+		if (!UploadPieces(aJob, aStartTime, aFramePieces, false))
+			break;
+
+		anItr = mJobs.erase(anItr);
+		mBackend->JobCompleted(aJob);
+		mStats.mJobsCompleted++;
+		delete aJob;
+	}
+
+	mStats.mLastUpdateMicros = (int)(mBackend->GetMicroseconds() - aStartTime);
+	mStats.mPendingJobs = (int)mJobs.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Completes the job right now, for when the texture contents are needed
+// before the queue would get to them.
+///////////////////////////////////////////////////////////////////////////////
+void TextureUploadScheduler::Finish(TextureUploadJob* theJob)
+{
+	SDL_LockMutex(mMutex);
+	bool convertHere = theJob->mState == TextureUploadJob::STATE_QUEUED;
+	if (convertHere)
+	{
+		std::deque<TextureUploadJob*>::iterator anItr = std::find(mConvertQueue.begin(), mConvertQueue.end(), theJob);
+		if (anItr != mConvertQueue.end())
+			mConvertQueue.erase(anItr);
+		theJob->mState = TextureUploadJob::STATE_CONVERTING;
+	}
+	else
+	{
+		while (theJob->mState == TextureUploadJob::STATE_CONVERTING)
+			SDL_CondWait(mDoneCond, mMutex);
+	}
+	SDL_UnlockMutex(mMutex);
+
+	if (convertHere)
+	{
+		theJob->Convert();
+		theJob->mState = TextureUploadJob::STATE_READY;
+	}
+
+	int aFramePieces = 0;
+	UploadPieces(theJob, 0, aFramePieces, true);
+
+	mJobs.remove(theJob);
+	mBackend->JobCompleted(theJob);
+	mStats.mJobsCompleted++;
+	mStats.mPendingJobs = (int)mJobs.size();
+	delete theJob;
+}
@@ -0,0 +1,154 @@
+#ifndef __TEXTUREUPLOADQUEUE_H__
+#define __TEXTUREUPLOADQUEUE_H__
+
+#include "graphics/GLInterface.h"
+
+#include <deque>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+namespace Sexy
+{
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Read only view of an image's pixels.  mBits is ARGB8888, palettized images
+	// set mIndices/mPalette instead.
+	///////////////////////////////////////////////////////////////////////////////
+	struct TextureUploadSource
+	{
+		const uint32_t* mBits;
+		const uint8_t* mIndices;
+		const uint32_t* mPalette;
+		int mWidth, mHeight;
+	};
+
+	int						GetPixelFormatSize(PixelFormat theFormat);
+
+	// Converts the theTexWidth x theTexHeight piece at offx,offy of the source into
+	// theDest, repeating the last column/row into any padding past the image.
+	void					ConvertTexturePiece(const TextureUploadSource& theSource, PixelFormat theFormat, int offx, int offy, int theTexWidth, int theTexHeight, void* theDest);
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct TextureUploadPiece
+	{
+		GLuint mTexture;
+		int mX, mY;					// offset of the piece in the image
+		int mTexWidth, mTexHeight;
+		int mDataOffset;			// into TextureUploadJob::mConverted
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// One image's worth of pieces.  The source pixels are copied when the job is
+	// made so the image is free to change or purge its bits while it is queued.
+	///////////////////////////////////////////////////////////////////////////////
+	class TextureUploadJob
+	{
+	public:
+		enum
+		{
+			STATE_QUEUED,			// waiting for a worker
+			STATE_CONVERTING,
+			STATE_READY,			// converted, waiting for the GL thread
+		};
+
+		void*					mOwner;			// handed back to the backend, never touched by the queue
+		PixelFormat				mFormat;
+		TextureUploadSource		mSource;
+		std::vector<uint32_t>	mSourceBits;
+		std::vector<uint8_t>	mSourceIndices;
+		std::vector<uint32_t>	mSourcePalette;
+
+		std::vector<TextureUploadPiece> mPieces;
+		std::vector<uint8_t>	mConverted;
+		int						mNextPiece;		// next piece to hand to the backend
+
+		int						mState;
+		bool					mCancelled;
+
+	public:
+		TextureUploadJob(void* theOwner, PixelFormat theFormat);
+
+		void					SetSource(const uint32_t* theBits, const uint8_t* theIndices, const uint32_t* thePalette, int theWidth, int theHeight);
+		void					AddPiece(GLuint theTexture, int theX, int theY, int theTexWidth, int theTexHeight);
+		void					Convert();
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Everything the queue needs from the graphics API, so the scheduling can be
+	// driven by a fake in tests.
+	///////////////////////////////////////////////////////////////////////////////
+	class TextureUploadBackend
+	{
+	public:
+		virtual ~TextureUploadBackend() {}
+
+		virtual void			UploadPiece(TextureUploadJob* theJob, const TextureUploadPiece& thePiece, const void* theData) = 0;
+		virtual void			JobCompleted(TextureUploadJob* theJob) = 0;
+		virtual uint64_t		GetMicroseconds() = 0;
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	///////////////////////////////////////////////////////////////////////////////
+	struct TextureUploadStats
+	{
+		int mJobsSubmitted;
+		int mJobsCompleted;
+		int mJobsCancelled;
+		int mPiecesUploaded;
+		int64_t mBytesUploaded;
+		int mLastUpdateMicros;		// time spent in the last Update
+		int mPendingJobs;
+
+		void Reset() { mJobsSubmitted = mJobsCompleted = mJobsCancelled = mPiecesUploaded = mLastUpdateMicros = mPendingJobs = 0; mBytesUploaded = 0; }
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	// Converts jobs on worker threads and feeds the results to the backend from
+	// Update, stopping once mBudgetMicros is used up (at least one piece always
+	// goes through so big images can't stall forever).  With no workers the
+	// conversion happens inside Update instead.
+	//
+	// Everything except the workers runs on the GL thread.
+	///////////////////////////////////////////////////////////////////////////////
+	class TextureUploadScheduler
+	{
+	public:
+		typedef std::list<TextureUploadJob*> JobList;
+
+		TextureUploadBackend*	mBackend;
+		int						mBudgetMicros;
+		TextureUploadStats		mStats;
+
+		JobList					mJobs;			// every live job, in submit order
+		std::deque<TextureUploadJob*> mConvertQueue;
+
+		SDL_mutex*				mMutex;
+		SDL_cond*				mWorkCond;
+		SDL_cond*				mDoneCond;
+		std::vector<SDL_Thread*> mWorkers;
+		bool					mShutdown;
+
+	protected:
+		static int				WorkerProcStub(void* theArg);
+		void					WorkerProc();
+		bool					UploadPieces(TextureUploadJob* theJob, uint64_t theStartTime, int& theFramePieces, bool force);
+		void					RemoveJob(TextureUploadJob* theJob);
+
+	public:
+		TextureUploadScheduler(TextureUploadBackend* theBackend, int theNumWorkers, int theBudgetMicros = 2000);
+		virtual ~TextureUploadScheduler();
+
+		void					Submit(TextureUploadJob* theJob);
+		void					Cancel(TextureUploadJob* theJob);
+		void					Finish(TextureUploadJob* theJob);
+		void					Update();
+
+		int						GetPendingCount() { return (int)mJobs.size(); }
+	};
+
+}
+
+#endif // __TEXTUREUPLOADQUEUE_H__
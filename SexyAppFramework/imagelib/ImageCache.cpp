@@ -0,0 +1,310 @@
+#include "ImageCache.h"
+#include "ImageLib.h"
+#include "Common.h"
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+#include <stdio.h>
+
+using namespace ImageLib;
+
+namespace fs = std::filesystem;
+
+ImageCache* ImageLib::gImageCache = NULL;
+
+static const uint32_t IMAGECACHE_MAGIC = 0x48434953;	// "SICH"
+static const uint32_t IMAGECACHE_VERSION = 1;
+
+// Entry files are this header, the key, then mWidth*mHeight ARGB pixels, all
+// in native byte order since they never leave the machine
+struct ImageCacheHeader
+{
+	uint32_t				mMagic;
+	uint32_t				mVersion;
+	uint64_t				mFingerprint;
+	int32_t					mWidth;
+	int32_t					mHeight;
+	uint32_t				mKeyLength;
+	uint32_t				mReserved;
+};
+
+static std::string GetEntryName(const std::string& theKey)
+{
+	char aName[32];
+	sprintf(aName, "%016llx.img", (unsigned long long) ImageCache::Hash(theKey.c_str(), theKey.length()));
+	return aName;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Picks up the entries left by earlier runs, oldest first, and deletes any
+// half written ones.
+///////////////////////////////////////////////////////////////////////////////
+ImageCache::ImageCache(const std::string& theDir, int64_t theMaxBytes)
+{
+	mDir = theDir;
+	if ((!mDir.empty()) && (mDir[mDir.length() - 1] != '/') && (mDir[mDir.length() - 1] != '\\'))
+		mDir += '/';
+	mMaxBytes = theMaxBytes;
+	mTotalBytes = 0;
+	mUseCount = 0;
+	mTempCount = 0;
+	mHits = 0;
+	mMisses = 0;
+	mMutex = SDL_CreateMutex();
+
+	Sexy::MkDir(mDir);
+
+	typedef std::pair<fs::file_time_type, std::string> FoundEntry;
+	std::vector<FoundEntry> aFoundEntries;
+
+	std::error_code anError;
+	for (fs::directory_iterator anItr(mDir, anError), anEnd; (!anError) && (anItr != anEnd); anItr.increment(anError))
+	{
+		if (!anItr->is_regular_file(anError))
+			continue;
+
+		std::string aName = anItr->path().filename().string();
+		std::string anExt = anItr->path().extension().string();
+		if (anExt == ".tmp")
+			fs::remove(anItr->path(), anError);
+		else if (anExt == ".img")
+		{
+			Entry& anEntry = mEntries[aName];
+			anEntry.mSize = (int64_t) anItr->file_size(anError);
+			anEntry.mLastUse = 0;
+			mTotalBytes += anEntry.mSize;
+			aFoundEntries.push_back(FoundEntry(anItr->last_write_time(anError), aName));
+		}
+	}
+
+	std::sort(aFoundEntries.begin(), aFoundEntries.end());
+	for (int i = 0; i < (int)aFoundEntries.size(); i++)
+		mEntries[aFoundEntries[i].second].mLastUse = ++mUseCount;
+
+	Evict();
+}
+
+ImageCache::~ImageCache()
+{
+	SDL_DestroyMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// 64 bit FNV-1a, used for entry names and source fingerprints.
+///////////////////////////////////////////////////////////////////////////////
+uint64_t ImageCache::Hash(const void* theData, size_t theSize, uint64_t theHash)
+{
+	const uint8_t* aData = (const uint8_t*) theData;
+	for (size_t i = 0; i < theSize; i++)
+		theHash = (theHash ^ aData[i]) * 1099511628211ULL;
+	return theHash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The file's time is what orders entries from one run to the next.  Touch,
+// Remove and Evict are called with mMutex held.
+///////////////////////////////////////////////////////////////////////////////
+void ImageCache::Touch(const std::string& theName)
+{
+	EntryMap::iterator anItr = mEntries.find(theName);
+	if (anItr == mEntries.end())
+		return;
+
+	anItr->second.mLastUse = ++mUseCount;
+
+	std::error_code anError;
+	fs::last_write_time(mDir + theName, fs::file_time_type::clock::now(), anError);
+}
+
+void ImageCache::Remove(const std::string& theName)
+{
+	EntryMap::iterator anItr = mEntries.find(theName);
+	if (anItr == mEntries.end())
+		return;
+
+	mTotalBytes -= anItr->second.mSize;
+	mEntries.erase(anItr);
+
+	std::error_code anError;
+	fs::remove(mDir + theName, anError);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Deletes the least recently used entries until they fit the budget again.
+///////////////////////////////////////////////////////////////////////////////
+void ImageCache::Evict()
+{
+	while ((mTotalBytes > mMaxBytes) && (!mEntries.empty()))
+	{
+		EntryMap::iterator anOldest = mEntries.begin();
+		for (EntryMap::iterator anItr = mEntries.begin(); anItr != mEntries.end(); ++anItr)
+		{
+			if (anItr->second.mLastUse < anOldest->second.mLastUse)
+				anOldest = anItr;
+		}
+
+		mTotalBytes -= anOldest->second.mSize;
+
+		std::error_code anError;
+		fs::remove(mDir + anOldest->first, anError);
+		mEntries.erase(anOldest);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns the image stored for theKey, or NULL if there isn't one made from
+// the same source files.
+///////////////////////////////////////////////////////////////////////////////
+Image* ImageCache::Load(const std::string& theKey, uint64_t theFingerprint)
+{
+	std::string aName = GetEntryName(theKey);
+
+	SDL_LockMutex(mMutex);
+	bool found = mEntries.find(aName) != mEntries.end();
+	if (!found)
+		mMisses++;
+	SDL_UnlockMutex(mMutex);
+
+	if (!found)
+		return NULL;
+
+	FILE* aFP = fopen((mDir + aName).c_str(), "rb");
+	if (aFP == NULL)
+	{
+		SDL_LockMutex(mMutex);
+		Remove(aName);
+		mMisses++;
+		SDL_UnlockMutex(mMutex);
+		return NULL;
+	}
+
+	ImageCacheHeader aHeader;
+	bool valid = (fread(&aHeader, sizeof(aHeader), 1, aFP) == 1) &&
+		(aHeader.mMagic == IMAGECACHE_MAGIC) && (aHeader.mVersion == IMAGECACHE_VERSION) &&
+		(aHeader.mWidth > 0) && (aHeader.mHeight > 0) && (aHeader.mWidth <= 0x8000) && (aHeader.mHeight <= 0x8000);
+
+	// Another key with the same name hash owns the entry, so leave it be
+	bool otherKey = false;
+	if ((valid) && (aHeader.mKeyLength == theKey.length()))
+	{
+		std::string aKey(aHeader.mKeyLength, '\0');
+		otherKey = (aHeader.mKeyLength > 0) && ((fread(&aKey[0], aHeader.mKeyLength, 1, aFP) != 1) || (aKey != theKey));
+	}
+	else
+		otherKey = valid;
+
+	Image* anImage = NULL;
+	if ((valid) && (!otherKey) && (aHeader.mFingerprint == theFingerprint))
+	{
+		int aSize = aHeader.mWidth * aHeader.mHeight;
+
+		anImage = new Image();
+		anImage->mWidth = aHeader.mWidth;
+		anImage->mHeight = aHeader.mHeight;
+		anImage->mBits = new uint32_t[aSize];
+
+		if (fread(anImage->mBits, sizeof(uint32_t), aSize, aFP) != (size_t) aSize)
+		{
+			delete anImage;
+			anImage = NULL;
+		}
+	}
+
+	fclose(aFP);
+
+	SDL_LockMutex(mMutex);
+	if (anImage != NULL)
+	{
+		Touch(aName);
+		mHits++;
+	}
+	else
+	{
+		if (!otherKey)
+			Remove(aName);		// stale or damaged
+		mMisses++;
+	}
+	SDL_UnlockMutex(mMutex);
+
+	return anImage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes theImage to a temporary file first so a crash never leaves a torn
+// entry behind under the real name.
+///////////////////////////////////////////////////////////////////////////////
+void ImageCache::Store(const std::string& theKey, uint64_t theFingerprint, Image* theImage)
+{
+	if ((theImage == NULL) || (theImage->mBits == NULL) || (theImage->mWidth <= 0) || (theImage->mHeight <= 0))
+		return;
+
+	int aSize = theImage->mWidth * theImage->mHeight;
+	int64_t aFileSize = sizeof(ImageCacheHeader) + theKey.length() + (int64_t) aSize * sizeof(uint32_t);
+	if (aFileSize > mMaxBytes)
+		return;
+
+	std::string aName = GetEntryName(theKey);
+	std::string aTempName;
+
+	SDL_LockMutex(mMutex);
+	aTempName = mDir + aName + "." + std::to_string(++mTempCount) + ".tmp";
+	SDL_UnlockMutex(mMutex);
+
+	FILE* aFP = fopen(aTempName.c_str(), "wb");
+	if (aFP == NULL)
+		return;
+
+	ImageCacheHeader aHeader;
+	aHeader.mMagic = IMAGECACHE_MAGIC;
+	aHeader.mVersion = IMAGECACHE_VERSION;
+	aHeader.mFingerprint = theFingerprint;
+	aHeader.mWidth = theImage->mWidth;
+	aHeader.mHeight = theImage->mHeight;
+	aHeader.mKeyLength = (uint32_t) theKey.length();
+	aHeader.mReserved = 0;
+
+	bool written = (fwrite(&aHeader, sizeof(aHeader), 1, aFP) == 1) &&
+		((theKey.empty()) || (fwrite(theKey.c_str(), theKey.length(), 1, aFP) == 1)) &&
+		(fwrite(theImage->mBits, sizeof(uint32_t), aSize, aFP) == (size_t) aSize);
+	written = (fclose(aFP) == 0) && written;
+
+	std::error_code anError;
+	if (written)
+	{
+		SDL_LockMutex(mMutex);
+		fs::rename(aTempName, mDir + aName, anError);
+		if (!anError)
+		{
+			Entry& anEntry = mEntries[aName];
+			if (anEntry.mLastUse != 0)
+				mTotalBytes -= anEntry.mSize;
+			anEntry.mSize = aFileSize;
+			anEntry.mLastUse = ++mUseCount;
+			mTotalBytes += aFileSize;
+
+			Evict();
+		}
+		SDL_UnlockMutex(mMutex);
+
+		if (!anError)
+			return;
+	}
+
+	fs::remove(aTempName, anError);
+}
+
+void ImageCache::Clear()
+{
+	SDL_LockMutex(mMutex);
+
+	std::error_code anError;
+	for (EntryMap::iterator anItr = mEntries.begin(); anItr != mEntries.end(); ++anItr)
+		fs::remove(mDir + anItr->first, anError);
+
+	mEntries.clear();
+	mTotalBytes = 0;
+
+	SDL_UnlockMutex(mMutex);
+}
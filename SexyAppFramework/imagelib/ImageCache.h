@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+struct SDL_mutex;
+
+namespace ImageLib
+{
+
+class Image;
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps decoded, alpha-composed images on disk so GetImage can skip the PNG,
+// JPEG, TGA and GIF decoders next time.  Each entry is one raw ARGB file named
+// after a hash of its key, stamped with a fingerprint of the source files; an
+// entry whose fingerprint no longer matches is thrown away.  The least
+// recently used entries are deleted once the files add up to more than the
+// size budget.
+//
+// Load and Store can be called from any thread.
+///////////////////////////////////////////////////////////////////////////////
+class ImageCache
+{
+public:
+	struct Entry
+	{
+		int64_t				mSize;
+		uint64_t			mLastUse;
+	};
+
+	typedef std::map<std::string, Entry> EntryMap;	// by file name within mDir
+
+	std::string				mDir;
+	int64_t					mMaxBytes;
+	int64_t					mTotalBytes;
+	uint64_t				mUseCount;
+	int						mTempCount;
+	EntryMap				mEntries;
+	SDL_mutex*				mMutex;
+
+	int						mHits;
+	int						mMisses;
+
+protected:
+	void					Touch(const std::string& theName);
+	void					Remove(const std::string& theName);
+	void					Evict();
+
+public:
+	ImageCache(const std::string& theDir, int64_t theMaxBytes);
+	virtual ~ImageCache();
+
+	Image*					Load(const std::string& theKey, uint64_t theFingerprint);
+	void					Store(const std::string& theKey, uint64_t theFingerprint, Image* theImage);
+	void					Clear();
+
+	static uint64_t			Hash(const void* theData, size_t theSize, uint64_t theHash = 14695981039346656037ULL);
+
+	int64_t					GetTotalBytes() { return mTotalBytes; }
+};
+
+extern ImageCache* gImageCache;	// NULL unless the app turns the cache on
+
+}
@@ -2,6 +2,7 @@
 
 #include "Common.h"
 #include "ImageLib.h"
+#include "ImageCache.h"
 #include "png.h"
 #include <math.h>
 #include "paklib/PakInterface.h"
@@ -1254,15 +1255,12 @@ Image* GetJPEGImage(const std::string& theFileName)
 	return anImage;
 }
 
-int ImageLib::gAlphaComposeColor = 0xFFFFFF;
+thread_local int ImageLib::gAlphaComposeColor = 0xFFFFFF;
 bool ImageLib::gAutoLoadAlpha = true;
 bool ImageLib::gIgnoreJPEG2000Alpha = true;
 
-Image* ImageLib::GetImage(const std::string& theFilename, bool lookForAlphaImage)
+static Image* DecodeImage(const std::string& theFilename, bool lookForAlphaImage)
 {
-	if (!gAutoLoadAlpha)
-		lookForAlphaImage = false;
-
 	int aLastDotPos = theFilename.rfind('.');
 	int aLastSlashPos = (int)theFilename.rfind('/');
 
@@ -1279,16 +1277,17 @@ Image* ImageLib::GetImage(const std::string& theFilename, bool lookForAlphaImage
 
 	Image* anImage = NULL;
 
-	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".tga") == 0) || (anExt.length() == 0)))
+	// p_fexists rules out the candidates that aren't there without opening them
+	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".tga") == 0) || (anExt.length() == 0)) && (p_fexists((aFilename + ".tga").c_str())))
 		anImage = GetTGAImage(aFilename + ".tga");
 
-	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".jpg") == 0) || (anExt.length() == 0)))
+	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".jpg") == 0) || (anExt.length() == 0)) && (p_fexists((aFilename + ".jpg").c_str())))
 		anImage = GetJPEGImage(aFilename + ".jpg");
 
-	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".png") == 0) || (anExt.length() == 0)))
+	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".png") == 0) || (anExt.length() == 0)) && (p_fexists((aFilename + ".png").c_str())))
 		anImage = GetPNGImage(aFilename + ".png");
 
-	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".gif") == 0) || (anExt.length() == 0)))
+	if ((anImage == NULL) && ((strcasecmp(anExt.c_str(), ".gif") == 0) || (anExt.length() == 0)) && (p_fexists((aFilename + ".gif").c_str())))
 		anImage = GetGIFImage(aFilename + ".gif");
 
 	//if ((anImage == NULL) && (strcasecmp(anExt.c_str(), ".j2k") == 0))
@@ -1304,12 +1303,12 @@ Image* ImageLib::GetImage(const std::string& theFilename, bool lookForAlphaImage
 	if(lookForAlphaImage)
 	{
 		// Check _ImageName
-		anAlphaImage = GetImage(theFilename.substr(0, aLastSlashPos+1) + "_" +
+		anAlphaImage = DecodeImage(theFilename.substr(0, aLastSlashPos+1) + "_" +
 			theFilename.substr(aLastSlashPos+1, theFilename.length() - aLastSlashPos - 1), false);
 
 		// Check ImageName_
 		if(anAlphaImage==NULL)
-			anAlphaImage = GetImage(theFilename + "_", false);
+			anAlphaImage = DecodeImage(theFilename + "_", false);
 	}
 
 
@@ -1367,3 +1366,110 @@ Image* ImageLib::GetImage(const std::string& theFilename, bool lookForAlphaImage
 
 	return anImage;
 }
+
+//////////////////////////////////////////////////////////////////////////
+// Every file DecodeImage might open for theFilename, in the same order
+//////////////////////////////////////////////////////////////////////////
+static void GetSourceFileNames(const std::string& theFilename, bool lookForAlphaImage, std::vector<std::string>& theFileNames)
+{
+	static const char* EXTENSIONS[] = { ".tga", ".jpg", ".png", ".gif" };
+
+	int aLastDotPos = theFilename.rfind('.');
+	int aLastSlashPos = (int)theFilename.rfind('/');
+
+	std::string anExt;
+	std::string aFilename = theFilename;
+	if (aLastDotPos > aLastSlashPos)
+	{
+		anExt = theFilename.substr(aLastDotPos, theFilename.length() - aLastDotPos);
+		aFilename = theFilename.substr(0, aLastDotPos);
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		if ((anExt.length() == 0) || (strcasecmp(anExt.c_str(), EXTENSIONS[i]) == 0))
+			theFileNames.push_back(aFilename + EXTENSIONS[i]);
+	}
+
+	if (lookForAlphaImage)
+	{
+		GetSourceFileNames(theFilename.substr(0, aLastSlashPos+1) + "_" +
+			theFilename.substr(aLastSlashPos+1, theFilename.length() - aLastSlashPos - 1), false, theFileNames);
+		GetSourceFileNames(theFilename + "_", false, theFileNames);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Hashes the names of the source files that exist along with their
+// contents, or just their size and time for pak records.  Returns false if
+// there is nothing to decode.
+//////////////////////////////////////////////////////////////////////////
+static bool GetSourceFingerprint(const std::vector<std::string>& theFileNames, uint64_t& theFingerprint)
+{
+	bool found = false;
+	uint64_t aHash = ImageCache::Hash(NULL, 0);
+	std::vector<uint8_t> aBuffer;
+
+	for (int i = 0; i < (int)theFileNames.size(); i++)
+	{
+		if (!p_fexists(theFileNames[i].c_str()))
+			continue;
+
+		PFILE* aFP = p_fopen(theFileNames[i].c_str(), "rb");
+		if (aFP == NULL)
+			continue;
+
+		found = true;
+		aHash = ImageCache::Hash(theFileNames[i].c_str(), theFileNames[i].length() + 1, aHash);
+
+		if (aFP->mRecord != NULL)
+		{
+			aHash = ImageCache::Hash(&aFP->mRecord->mSize, sizeof(aFP->mRecord->mSize), aHash);
+			aHash = ImageCache::Hash(&aFP->mRecord->mFileTime, sizeof(aFP->mRecord->mFileTime), aHash);
+		}
+		else
+		{
+			aBuffer.resize(65536);
+
+			size_t aCount;
+			while ((aCount = p_fread(&aBuffer[0], 1, (int)aBuffer.size(), aFP)) > 0)
+				aHash = ImageCache::Hash(&aBuffer[0], aCount, aHash);
+		}
+
+		p_fclose(aFP);
+	}
+
+	theFingerprint = aHash;
+	return found;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Decodes theFilename and its alpha image, going through gImageCache when
+// the app has one.
+//////////////////////////////////////////////////////////////////////////
+Image* ImageLib::GetImage(const std::string& theFilename, bool lookForAlphaImage)
+{
+	if (!gAutoLoadAlpha)
+		lookForAlphaImage = false;
+
+	if (gImageCache == NULL)
+		return DecodeImage(theFilename, lookForAlphaImage);
+
+	std::vector<std::string> aFileNames;
+	GetSourceFileNames(theFilename, lookForAlphaImage, aFileNames);
+
+	uint64_t aFingerprint;
+	if (!GetSourceFingerprint(aFileNames, aFingerprint))
+		return NULL;
+
+	// An image made only from an alpha image takes its color from gAlphaComposeColor
+	std::string aKey = theFilename + (lookForAlphaImage ? "|a" : "|") + Sexy::StrFormat("%06X", gAlphaComposeColor);
+
+	Image* anImage = gImageCache->Load(aKey, aFingerprint);
+	if (anImage != NULL)
+		return anImage;
+
+	anImage = DecodeImage(theFilename, lookForAlphaImage);
+	gImageCache->Store(aKey, aFingerprint, anImage);
+	return anImage;
+}
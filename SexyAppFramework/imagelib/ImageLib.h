@@ -25,7 +25,7 @@ bool WriteJPEGImage(const std::string& theFileName, Image* theImage);
 bool WritePNGImage(const std::string& theFileName, Image* theImage);
 bool WriteTGAImage(const std::string& theFileName, Image* theImage);
 bool WriteBMPImage(const std::string& theFileName, Image* theImage);
-extern int gAlphaComposeColor;
+extern thread_local int gAlphaComposeColor;	// per thread so resource loaders can decode in parallel
 extern bool gAutoLoadAlpha;
 extern bool gIgnoreJPEG2000Alpha;  // I've noticed alpha in jpeg2000's that shouldn't have alpha so this defaults to true
 
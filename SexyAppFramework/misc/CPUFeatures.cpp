@@ -0,0 +1,49 @@
+#include "CPUFeatures.h"
+#include <SDL2/SDL.h>
+
+using namespace Sexy;
+
+static int gDetectedSIMDLevel = -1;
+static int gMaxSIMDLevel = SIMDLevel_NEON;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static SIMDLevel DetectSIMDLevel()
+{
+#if defined(SEXY_SIMD_X86)
+	if (SDL_HasAVX2())
+		return SIMDLevel_AVX2;
+	if (SDL_HasSSE2())
+		return SIMDLevel_SSE2;
+#elif defined(SEXY_SIMD_NEON)
+	if (SDL_HasNEON())
+		return SIMDLevel_NEON;
+#endif
+
+	return SIMDLevel_None;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SIMDLevel Sexy::GetSIMDLevel()
+{
+	if (gDetectedSIMDLevel == -1)
+		gDetectedSIMDLevel = DetectSIMDLevel();
+
+	if (gDetectedSIMDLevel > gMaxSIMDLevel)
+	{
+		// AVX2 machines can still run the SSE2 paths, nothing else degrades
+		if (gDetectedSIMDLevel == SIMDLevel_AVX2 && gMaxSIMDLevel == SIMDLevel_SSE2)
+			return SIMDLevel_SSE2;
+		return SIMDLevel_None;
+	}
+
+	return (SIMDLevel)gDetectedSIMDLevel;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::SetSIMDLevel(SIMDLevel theMaxLevel)
+{
+	gMaxSIMDLevel = theMaxLevel;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Common.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SEXY_SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__) || defined(__ARM_NEON)
+#define SEXY_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// GCC and Clang only let a function use AVX2 intrinsics if it is compiled for
+// AVX2, MSVC accepts them anywhere.  Callers still have to check the CPU first.
+#if defined(SEXY_SIMD_X86) && !defined(_MSC_VER)
+#define SEXY_TARGET_SSE2	__attribute__((target("sse2")))
+#define SEXY_TARGET_AVX2	__attribute__((target("avx2")))
+#else
+#define SEXY_TARGET_SSE2
+#define SEXY_TARGET_AVX2
+#endif
+
+namespace Sexy
+{
+
+enum SIMDLevel
+{
+	SIMDLevel_None,
+	SIMDLevel_SSE2,
+	SIMDLevel_AVX2,
+	SIMDLevel_NEON
+};
+
+// Best level the CPU supports, capped by SetSIMDLevel
+SIMDLevel			GetSIMDLevel();
+// Caps the level used by all kernels, e.g. SIMDLevel_None to check the scalar paths
+void				SetSIMDLevel(SIMDLevel theMaxLevel);
+
+}
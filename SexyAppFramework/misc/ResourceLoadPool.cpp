@@ -0,0 +1,172 @@
+#include "ResourceLoadPool.h"
+#include "sound/SoundManager.h"
+#include "graphics/GLImage.h"
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+ResourceLoadJob::ResourceLoadJob(ResourceManager::BaseRes* theRes)
+{
+	mRes = theRes;
+	mImage = NULL;
+	mSound = NULL;
+	mState = STATE_QUEUED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+ResourceLoadJob::~ResourceLoadJob()
+{
+	delete mImage;
+
+	if (mSound != NULL)
+		gSexyAppBase->mSoundManager->FreeDecodedSound(mSound);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+ResourceLoadPool::ResourceLoadPool(ResourceManager* theResourceManager, int theNumWorkers)
+{
+	mResourceManager = theResourceManager;
+	mShutdown = false;
+
+	mMutex = SDL_CreateMutex();
+	mWorkCond = SDL_CreateCond();
+	mDoneCond = SDL_CreateCond();
+
+	for (int i = 0; i < theNumWorkers; i++)
+	{
+		SDL_Thread* aThread = SDL_CreateThread(WorkerProcStub, "ResourceLoad", this);
+		if (aThread != NULL)
+			mWorkers.push_back(aThread);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+ResourceLoadPool::~ResourceLoadPool()
+{
+	Clear();
+
+	SDL_LockMutex(mMutex);
+	mShutdown = true;
+	SDL_CondBroadcast(mWorkCond);
+	SDL_UnlockMutex(mMutex);
+
+	for (int i = 0; i < (int)mWorkers.size(); i++)
+		SDL_WaitThread(mWorkers[i], NULL);
+
+	SDL_DestroyCond(mDoneCond);
+	SDL_DestroyCond(mWorkCond);
+	SDL_DestroyMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int ResourceLoadPool::WorkerProcStub(void* theArg)
+{
+	((ResourceLoadPool*)theArg)->WorkerProc();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void ResourceLoadPool::WorkerProc()
+{
+	SDL_LockMutex(mMutex);
+
+	for (;;)
+	{
+		while (mDecodeQueue.empty() && !mShutdown)
+			SDL_CondWait(mWorkCond, mMutex);
+
+		if (mShutdown)
+			break;
+
+		ResourceLoadJob* aJob = mDecodeQueue.front();
+		mDecodeQueue.pop_front();
+		aJob->mState = ResourceLoadJob::STATE_DECODING;
+
+		SDL_UnlockMutex(mMutex);
+		mResourceManager->DecodeResource(aJob);
+		SDL_LockMutex(mMutex);
+
+		aJob->mState = ResourceLoadJob::STATE_DONE;
+		SDL_CondBroadcast(mDoneCond);
+	}
+
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void ResourceLoadPool::Submit(ResourceManager::BaseRes* theRes)
+{
+	ResourceLoadJob*& aJob = mJobs[theRes];
+	if (aJob != NULL)
+		return;
+
+	aJob = new ResourceLoadJob(theRes);
+
+	SDL_LockMutex(mMutex);
+	mDecodeQueue.push_back(aJob);
+	SDL_CondSignal(mWorkCond);
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hands back theRes's job once it is decoded, or NULL if it was never
+// submitted.  A job no worker has started yet is decoded right here rather
+// than waited on.
+///////////////////////////////////////////////////////////////////////////////
+ResourceLoadJob* ResourceLoadPool::Take(ResourceManager::BaseRes* theRes)
+{
+	JobMap::iterator anItr = mJobs.find(theRes);
+	if (anItr == mJobs.end())
+		return NULL;
+
+	ResourceLoadJob* aJob = anItr->second;
+	mJobs.erase(anItr);
+
+	SDL_LockMutex(mMutex);
+	bool queued = aJob->mState == ResourceLoadJob::STATE_QUEUED;
+	if (queued)
+		mDecodeQueue.erase(std::find(mDecodeQueue.begin(), mDecodeQueue.end(), aJob));
+	else
+	{
+		while (aJob->mState != ResourceLoadJob::STATE_DONE)
+			SDL_CondWait(mDoneCond, mMutex);
+	}
+	SDL_UnlockMutex(mMutex);
+
+	if (queued)
+	{
+		mResourceManager->DecodeResource(aJob);
+		aJob->mState = ResourceLoadJob::STATE_DONE;
+	}
+
+	return aJob;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Throws away every job, waiting for the ones the workers are busy with.
+///////////////////////////////////////////////////////////////////////////////
+void ResourceLoadPool::Clear()
+{
+	SDL_LockMutex(mMutex);
+	mDecodeQueue.clear();
+	for (JobMap::iterator anItr = mJobs.begin(); anItr != mJobs.end(); ++anItr)
+	{
+		while (anItr->second->mState == ResourceLoadJob::STATE_DECODING)
+			SDL_CondWait(mDoneCond, mMutex);
+	}
+	SDL_UnlockMutex(mMutex);
+
+	for (JobMap::iterator anItr = mJobs.begin(); anItr != mJobs.end(); ++anItr)
+		delete anItr->second;
+	mJobs.clear();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "ResourceManager.h"
+
+#include <deque>
+
+struct SDL_mutex;
+struct SDL_cond;
+struct SDL_Thread;
+
+namespace Sexy
+{
+
+class GLImage;
+
+///////////////////////////////////////////////////////////////////////////////
+// The file work for one resource, done ahead of the loading thread.  Whatever
+// the job still holds when it is deleted is freed.
+///////////////////////////////////////////////////////////////////////////////
+class ResourceLoadJob
+{
+public:
+	enum
+	{
+		STATE_QUEUED,			// waiting for a worker
+		STATE_DECODING,
+		STATE_DONE
+	};
+
+	ResourceManager::BaseRes* mRes;
+	GLImage*				mImage;			// NULL if the decode failed
+	void*					mSound;			// from SoundManager::DecodeSound
+	int						mState;
+
+public:
+	ResourceLoadJob(ResourceManager::BaseRes* theRes);
+	~ResourceLoadJob();
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Decodes resources on worker threads for ResourceManager::LoadNextResource,
+// which takes the jobs back in list order and commits them itself.
+//
+// Everything except the workers runs on the loading thread.
+///////////////////////////////////////////////////////////////////////////////
+class ResourceLoadPool
+{
+public:
+	typedef std::map<ResourceManager::BaseRes*, ResourceLoadJob*> JobMap;
+
+	ResourceManager*		mResourceManager;
+	JobMap					mJobs;			// every job that hasn't been taken
+	std::deque<ResourceLoadJob*> mDecodeQueue;
+
+	SDL_mutex*				mMutex;
+	SDL_cond*				mWorkCond;
+	SDL_cond*				mDoneCond;
+	std::vector<SDL_Thread*> mWorkers;
+	bool					mShutdown;
+
+protected:
+	static int				WorkerProcStub(void* theArg);
+	void					WorkerProc();
+
+public:
+	ResourceLoadPool(ResourceManager* theResourceManager, int theNumWorkers);
+	virtual ~ResourceLoadPool();
+
+	void					Submit(ResourceManager::BaseRes* theRes);
+	ResourceLoadJob*		Take(ResourceManager::BaseRes* theRes);
+	void					Clear();
+
+	int						GetNumThreads() { return (int)mWorkers.size(); }
+	int						GetPendingCount() { return (int)mJobs.size(); }
+};
+
+}
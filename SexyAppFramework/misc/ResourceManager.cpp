@@ -1,5 +1,6 @@
 #include <memory>
 #include "ResourceManager.h"
+#include "ResourceLoadPool.h"
 #include "XMLParser.h"
 #include "sound/SoundManager.h"
 #include "graphics/GLImage.h"
@@ -7,6 +8,7 @@
 #include "graphics/ImageFont.h"
 //#include "graphics/SysFont.h"
 #include "imagelib/ImageLib.h"
+#include "paklib/PakInterface.h"
 
 //#define SEXY_PERF_ENABLED
 #include "PerfTimer.h"
@@ -51,13 +53,19 @@ ResourceManager::ResourceManager(SexyAppBase *theApp)
 
 	mAllowMissingProgramResources = false;
 	mAllowAlreadyDefinedResources = false;
+	mUseCompiledResources = false;
 	mCurResGroupList = NULL;
+	mCurResGroupListPos = 0;
+	mLoadPool = NULL;
+	mLoadAheadPos = 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ResourceManager::~ResourceManager()
 {
+	delete mLoadPool;
+
 	DeleteMap(mImageMap);
 	DeleteMap(mSoundMap);
 	DeleteMap(mFontMap);
@@ -215,6 +223,7 @@ bool ResourceManager::ParseSoundResource(XMLElement &theElement)
 	aRes->mSoundId = -1;
 	aRes->mVolume = -1;
 	aRes->mPanning = 0;
+	aRes->mStreaming = SoundStreaming_Auto;
 
 	if (!ParseCommonResource(theElement, aRes, mSoundMap))
 	{
@@ -245,6 +254,11 @@ bool ResourceManager::ParseSoundResource(XMLElement &theElement)
 	if (anItr != theElement.mAttributes.end())
 		sexysscanf(anItr->second.c_str(),_S("%d"),&aRes->mPanning);
 
+	// stream="true" or "false" overrides the sound manager's size threshold
+	anItr = theElement.mAttributes.find(_S("stream"));
+	if (anItr != theElement.mAttributes.end())
+		aRes->mStreaming = ((anItr->second == _S("false")) || (anItr->second == _S("0"))) ? SoundStreaming_Never : SoundStreaming_Always;
+
 	return true;
 }
 
@@ -585,6 +599,14 @@ bool ResourceManager::DoParseResources()
 ///////////////////////////////////////////////////////////////////////////////
 bool ResourceManager::ParseResourcesFile(const std::string& theFilename)
 {
+	if (mUseCompiledResources)
+	{
+		std::string aCompiledName = GetCompiledResourcesName(theFilename);
+		std::vector<uchar> aData;
+		if (ReadCompiledResources(aCompiledName, theFilename, aData))
+			return LoadCompiledResources(aCompiledName, aData);
+	}
+
 	mXMLParser = new XMLParser();
 	if (!mXMLParser->OpenFile(theFilename))
 		Fail("Resource file not found: " + theFilename);
@@ -624,12 +646,509 @@ bool ResourceManager::ReparseResourcesFile(const std::string& theFilename)
 }
 
 ///////////////////////////////////////////////////////////////////////////////
+// Compiled manifests.  Everything is in native byte order:
+//
+//   header		magic, version, size and hash of the XML it was compiled from
+//   strings	count, then each string's length and bytes
+//   groups		count, then for each group its name and resources in order
+//
+// A resource is its type, id, path and XML attributes followed by its typed
+// fields.  Strings are indices into the string table.
+///////////////////////////////////////////////////////////////////////////////
+enum
+{
+	COMPILEDRES_MAGIC = 0x43524D53,		// "SMRC"
+	COMPILEDRES_VERSION = 2
+};
+
+enum
+{
+	COMPILEDIMAGE_PALLETIZE			= 0x0001,
+	COMPILEDIMAGE_A4R4G4B4			= 0x0002,
+	COMPILEDIMAGE_DDSURFACE			= 0x0004,
+	COMPILEDIMAGE_NOBITS			= 0x0008,
+	COMPILEDIMAGE_NOBITS3D			= 0x0010,
+	COMPILEDIMAGE_NOBITS2D			= 0x0020,
+	COMPILEDIMAGE_A8R8G8B8			= 0x0040,
+	COMPILEDIMAGE_MINSUBDIVIDE		= 0x0080,
+	COMPILEDIMAGE_AUTOFINDALPHA		= 0x0100
+};
+
+enum
+{
+	COMPILEDFONT_SYSFONT			= 0x01,
+	COMPILEDFONT_BOLD				= 0x02,
+	COMPILEDFONT_ITALIC				= 0x04,
+	COMPILEDFONT_UNDERLINE			= 0x08,
+	COMPILEDFONT_SHADOW				= 0x10
+};
+
+// 64 bit FNV-1a, for telling whether the XML changed since it was compiled
+static bool HashResourcesFile(const std::string& theFilename, uint64_t& theSize, uint64_t& theHash)
+{
+	PFILE* aFP = p_fopen(theFilename.c_str(), "rb");
+	if (aFP == NULL)
+		return false;
+
+	theSize = 0;
+	theHash = 14695981039346656037ULL;
+
+	uchar aBuffer[16384];
+	size_t aCount;
+	while ((aCount = p_fread(aBuffer, 1, sizeof(aBuffer), aFP)) > 0)
+	{
+		for (size_t i = 0; i < aCount; i++)
+			theHash = (theHash ^ aBuffer[i]) * 1099511628211ULL;
+		theSize += aCount;
+	}
+
+	p_fclose(aFP);
+	return true;
+}
+
+class CompiledResWriter
+{
+public:
+	std::vector<uchar>		mData;
+	std::map<std::string, uint32_t> mStringIds;
+	std::vector<const std::string*> mStrings;
+
+	template <typename T> void Write(const T& theValue)
+	{
+		const uchar* aBytes = (const uchar*) &theValue;
+		mData.insert(mData.end(), aBytes, aBytes + sizeof(T));
+	}
+
+	void WriteString(const std::string& theString)
+	{
+		std::pair<std::map<std::string, uint32_t>::iterator, bool> aRet = mStringIds.insert(std::make_pair(theString, (uint32_t) mStrings.size()));
+		if (aRet.second)
+			mStrings.push_back(&aRet.first->first);
+		Write(aRet.first->second);
+	}
+
+	void WriteIntVector(const std::vector<int>& theVector)
+	{
+		Write((uint32_t) theVector.size());
+		for (int i = 0; i < (int)theVector.size(); i++)
+			Write((int32_t) theVector[i]);
+	}
+};
+
+class CompiledResReader
+{
+public:
+	const uchar*			mData;
+	size_t					mSize;
+	size_t					mPos;
+	bool					mFailed;
+	std::vector<std::string> mStrings;
+
+	CompiledResReader(const std::vector<uchar>& theData) : mData(theData.empty() ? NULL : &theData[0]), mSize(theData.size()), mPos(0), mFailed(false) {}
+
+	template <typename T> T Read()
+	{
+		T aValue = T();
+		if (mSize - mPos < sizeof(T))
+			mFailed = true;
+		else
+		{
+			memcpy(&aValue, mData + mPos, sizeof(T));
+			mPos += sizeof(T);
+		}
+		return aValue;
+	}
+
+	const std::string& ReadString()
+	{
+		static const std::string anEmpty;
+
+		uint32_t anIdx = Read<uint32_t>();
+		if (anIdx >= mStrings.size())
+		{
+			mFailed = true;
+			return anEmpty;
+		}
+		return mStrings[anIdx];
+	}
+
+	void ReadIntVector(std::vector<int>& theVector)
+	{
+		uint32_t aCount = Read<uint32_t>();
+		if (aCount > (mSize - mPos) / sizeof(int32_t))
+		{
+			mFailed = true;
+			return;
+		}
+
+		theVector.resize(aCount);
+		for (uint32_t i = 0; i < aCount; i++)
+			theVector[i] = Read<int32_t>();
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+std::string ResourceManager::GetCompiledResourcesName(const std::string& theFilename)
+{
+	int aDotPos = (int)theFilename.rfind('.');
+	int aSlashPos = (int)theFilename.find_last_of("\\/");
+	if (aDotPos > aSlashPos)
+		return theFilename.substr(0, aDotPos) + ".bin";
+	return theFilename + ".bin";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads a compiled manifest into theData if there is one that matches
+// theXMLFilename.  Without the XML around, any compiled manifest goes.
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::ReadCompiledResources(const std::string& theFilename, const std::string& theXMLFilename, std::vector<uchar>& theData)
+{
+	if (!p_fexists(theFilename.c_str()))
+		return false;
+
+	PFILE* aFP = p_fopen(theFilename.c_str(), "rb");
+	if (aFP == NULL)
+		return false;
+
+	uchar aBuffer[16384];
+	size_t aCount;
+	while ((aCount = p_fread(aBuffer, 1, sizeof(aBuffer), aFP)) > 0)
+		theData.insert(theData.end(), aBuffer, aBuffer + aCount);
+	p_fclose(aFP);
+
+	CompiledResReader aReader(theData);
+	uint32_t aMagic = aReader.Read<uint32_t>();
+	uint32_t aVersion = aReader.Read<uint32_t>();
+	uint64_t aXMLSize = aReader.Read<uint64_t>();
+	uint64_t aXMLHash = aReader.Read<uint64_t>();
+	if ((aReader.mFailed) || (aMagic != COMPILEDRES_MAGIC) || (aVersion != COMPILEDRES_VERSION))
+		return false;
+
+	uint64_t aSize;
+	uint64_t aHash;
+	if ((HashResourcesFile(theXMLFilename, aSize, aHash)) && ((aSize != aXMLSize) || (aHash != aXMLHash)))
+		return false;
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Adds theRes to theMap and the current group like ParseCommonResource does.
+// When reparsing, theRes is swapped for the resource already defined with
+// its id, which keeps its place and only takes the new path and attributes.
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::AddCompiledResource(BaseRes *&theRes, ResMap &theMap)
+{
+	std::pair<ResMap::iterator,bool> aRet = theMap.insert(ResMap::value_type(theRes->mId,theRes));
+	if (aRet.second)
+	{
+		mCurResGroupList->push_back(theRes);
+		return true;
+	}
+
+	if (!mAllowAlreadyDefinedResources)
+	{
+		delete theRes;
+		theRes = NULL;
+		return Fail("Resource already defined.");
+	}
+
+	BaseRes *anOldRes = aRet.first->second;
+	anOldRes->mPath = theRes->mPath;
+	anOldRes->mXMLAttributes.swap(theRes->mXMLAttributes);
+	delete theRes;
+	theRes = anOldRes;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::LoadCompiledResources(const std::string& theFilename, const std::vector<uchar>& theData)
+{
+	CompiledResReader aReader(theData);
+	aReader.mPos = 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+	uint32_t aNumStrings = aReader.Read<uint32_t>();
+	if (aNumStrings > theData.size() / sizeof(uint32_t))
+		aReader.mFailed = true;
+	else
+		aReader.mStrings.resize(aNumStrings);
+
+	for (uint32_t i = 0; (i < aNumStrings) && (!aReader.mFailed); i++)
+	{
+		uint32_t aLength = aReader.Read<uint32_t>();
+		if (aLength > aReader.mSize - aReader.mPos)
+			aReader.mFailed = true;
+		else
+		{
+			aReader.mStrings[i].assign((const char*) aReader.mData + aReader.mPos, aLength);
+			aReader.mPos += aLength;
+		}
+	}
+
+	uint32_t aNumGroups = aReader.Read<uint32_t>();
+	for (uint32_t aGroupIdx = 0; (aGroupIdx < aNumGroups) && (!aReader.mFailed) && (!mHasFailed); aGroupIdx++)
+	{
+		mCurResGroup = aReader.ReadString();
+		mCurResGroupList = &mResGroupMap[mCurResGroup];
+
+		uint32_t aNumResources = aReader.Read<uint32_t>();
+		for (uint32_t aResIdx = 0; (aResIdx < aNumResources) && (!aReader.mFailed) && (!mHasFailed); aResIdx++)
+		{
+			uchar aType = aReader.Read<uchar>();
+
+			BaseRes *aRes;
+			if (aType == ResType_Image)
+			{
+				ImageRes *anImageRes = new ImageRes;
+				aRes = anImageRes;
+			}
+			else if (aType == ResType_Sound)
+			{
+				SoundRes *aSoundRes = new SoundRes;
+				aSoundRes->mSoundId = -1;
+				aRes = aSoundRes;
+			}
+			else if (aType == ResType_Font)
+			{
+				FontRes *aFontRes = new FontRes;
+				aFontRes->mFont = NULL;
+				aFontRes->mImage = NULL;
+				aRes = aFontRes;
+			}
+			else
+			{
+				aReader.mFailed = true;
+				break;
+			}
+
+			aRes->mId = aReader.ReadString();
+			aRes->mPath = aReader.ReadString();
+			aRes->mResGroup = mCurResGroup;
+			aRes->mFromProgram = aRes->mPath == "!program";
+
+			uint32_t aNumAttributes = aReader.Read<uint32_t>();
+			for (uint32_t i = 0; (i < aNumAttributes) && (!aReader.mFailed); i++)
+			{
+				const std::string& aName = aReader.ReadString();
+				aRes->mXMLAttributes[StringToSexyStringFast(aName)] = StringToSexyStringFast(aReader.ReadString());
+			}
+
+			if (aReader.mFailed)
+			{
+				delete aRes;
+				break;
+			}
+
+			if (aType == ResType_Image)
+			{
+				if (!AddCompiledResource(aRes, mImageMap))
+					break;
+
+				ImageRes *anImageRes = (ImageRes*) aRes;
+				uint32_t aFlags = aReader.Read<uint16_t>();
+				anImageRes->mPalletize = (aFlags & COMPILEDIMAGE_PALLETIZE) != 0;
+				anImageRes->mA4R4G4B4 = (aFlags & COMPILEDIMAGE_A4R4G4B4) != 0;
+				anImageRes->mDDSurface = (aFlags & COMPILEDIMAGE_DDSURFACE) != 0;
+				anImageRes->mPurgeBits = ((aFlags & COMPILEDIMAGE_NOBITS) != 0) ||
+					((mApp->Is3DAccelerated()) && ((aFlags & COMPILEDIMAGE_NOBITS3D) != 0)) ||
+					((!mApp->Is3DAccelerated()) && ((aFlags & COMPILEDIMAGE_NOBITS2D) != 0));
+				anImageRes->mA8R8G8B8 = (aFlags & COMPILEDIMAGE_A8R8G8B8) != 0;
+				anImageRes->mMinimizeSubdivisions = (aFlags & COMPILEDIMAGE_MINSUBDIVIDE) != 0;
+				anImageRes->mAutoFindAlpha = (aFlags & COMPILEDIMAGE_AUTOFINDALPHA) != 0;
+				anImageRes->mAlphaImage = aReader.ReadString();
+				anImageRes->mAlphaGridImage = aReader.ReadString();
+				anImageRes->mVariant = aReader.ReadString();
+				anImageRes->mAlphaColor = aReader.Read<uint32_t>();
+				anImageRes->mRows = aReader.Read<int32_t>();
+				anImageRes->mCols = aReader.Read<int32_t>();
+				anImageRes->mAnimInfo.mAnimType = (AnimType) aReader.Read<int32_t>();
+				anImageRes->mAnimInfo.mFrameDelay = aReader.Read<int32_t>();
+				anImageRes->mAnimInfo.mNumCels = aReader.Read<int32_t>();
+				anImageRes->mAnimInfo.mTotalAnimTime = aReader.Read<int32_t>();
+				aReader.ReadIntVector(anImageRes->mAnimInfo.mPerFrameDelay);
+				aReader.ReadIntVector(anImageRes->mAnimInfo.mFrameMap);
+			}
+			else if (aType == ResType_Sound)
+			{
+				if (!AddCompiledResource(aRes, mSoundMap))
+					break;
+
+				SoundRes *aSoundRes = (SoundRes*) aRes;
+				aSoundRes->mVolume = aReader.Read<double>();
+				aSoundRes->mPanning = aReader.Read<int32_t>();
+				aSoundRes->mStreaming = (SoundStreaming) aReader.Read<uchar>();
+			}
+			else
+			{
+				if (!AddCompiledResource(aRes, mFontMap))
+					break;
+
+				FontRes *aFontRes = (FontRes*) aRes;
+				aFontRes->mImagePath = aReader.ReadString();
+				aFontRes->mTags = aReader.ReadString();
+				uchar aFlags = aReader.Read<uchar>();
+				aFontRes->mSysFont = (aFlags & COMPILEDFONT_SYSFONT) != 0;
+				aFontRes->mBold = (aFlags & COMPILEDFONT_BOLD) != 0;
+				aFontRes->mItalic = (aFlags & COMPILEDFONT_ITALIC) != 0;
+				aFontRes->mUnderline = (aFlags & COMPILEDFONT_UNDERLINE) != 0;
+				aFontRes->mShadow = (aFlags & COMPILEDFONT_SHADOW) != 0;
+				aFontRes->mSize = aReader.Read<int32_t>();
+			}
+		}
+	}
+
+	if ((aReader.mFailed) || ((!mHasFailed) && (aReader.mPos != aReader.mSize)))
+		Fail("Invalid compiled resource file: " + theFilename);
+
+	return !mHasFailed;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
-bool ResourceManager::LoadAlphaGridImage(ImageRes *theRes, GLImage *theImage)
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::WriteCompiledResources(const std::string& theFilename, uint64_t theXMLSize, uint64_t theXMLHash)
+{
+	CompiledResWriter aGroupWriter;
+
+	aGroupWriter.Write((uint32_t) mResGroupMap.size());
+	for (ResGroupMap::iterator aGroupItr = mResGroupMap.begin(); aGroupItr != mResGroupMap.end(); ++aGroupItr)
+	{
+		ResList &aList = aGroupItr->second;
+		aGroupWriter.WriteString(aGroupItr->first);
+		aGroupWriter.Write((uint32_t) aList.size());
+
+		for (ResList::iterator aResItr = aList.begin(); aResItr != aList.end(); ++aResItr)
+		{
+			BaseRes *aRes = *aResItr;
+			aGroupWriter.Write((uchar) aRes->mType);
+			aGroupWriter.WriteString(aRes->mId);
+			aGroupWriter.WriteString(aRes->mPath);
+
+			aGroupWriter.Write((uint32_t) aRes->mXMLAttributes.size());
+			for (XMLParamMap::iterator anItr = aRes->mXMLAttributes.begin(); anItr != aRes->mXMLAttributes.end(); ++anItr)
+			{
+				aGroupWriter.WriteString(SexyStringToStringFast(anItr->first));
+				aGroupWriter.WriteString(SexyStringToStringFast(anItr->second));
+			}
+
+			if (aRes->mType == ResType_Image)
+			{
+				ImageRes *anImageRes = (ImageRes*) aRes;
+				const XMLParamMap &anAttributes = aRes->mXMLAttributes;
+
+				// mPurgeBits depends on the renderer, so the attributes behind it are kept
+				uint16_t aFlags = 0;
+				if (anImageRes->mPalletize) aFlags |= COMPILEDIMAGE_PALLETIZE;
+				if (anImageRes->mA4R4G4B4) aFlags |= COMPILEDIMAGE_A4R4G4B4;
+				if (anImageRes->mDDSurface) aFlags |= COMPILEDIMAGE_DDSURFACE;
+				if (anAttributes.find(_S("nobits")) != anAttributes.end()) aFlags |= COMPILEDIMAGE_NOBITS;
+				if (anAttributes.find(_S("nobits3d")) != anAttributes.end()) aFlags |= COMPILEDIMAGE_NOBITS3D;
+				if (anAttributes.find(_S("nobits2d")) != anAttributes.end()) aFlags |= COMPILEDIMAGE_NOBITS2D;
+				if (anImageRes->mA8R8G8B8) aFlags |= COMPILEDIMAGE_A8R8G8B8;
+				if (anImageRes->mMinimizeSubdivisions) aFlags |= COMPILEDIMAGE_MINSUBDIVIDE;
+				if (anImageRes->mAutoFindAlpha) aFlags |= COMPILEDIMAGE_AUTOFINDALPHA;
+
+				const AnimInfo &anAnimInfo = anImageRes->mAnimInfo;
+				bool isAnimated = anAnimInfo.mAnimType != AnimType_None;
+
+				aGroupWriter.Write(aFlags);
+				aGroupWriter.WriteString(anImageRes->mAlphaImage);
+				aGroupWriter.WriteString(anImageRes->mAlphaGridImage);
+				aGroupWriter.WriteString(anImageRes->mVariant);
+				aGroupWriter.Write((uint32_t) anImageRes->mAlphaColor);
+				aGroupWriter.Write((int32_t) anImageRes->mRows);
+				aGroupWriter.Write((int32_t) anImageRes->mCols);
+				aGroupWriter.Write((int32_t) anAnimInfo.mAnimType);
+				aGroupWriter.Write((int32_t) anAnimInfo.mFrameDelay);
+				aGroupWriter.Write((int32_t) anAnimInfo.mNumCels);
+				aGroupWriter.Write((int32_t) (isAnimated ? anAnimInfo.mTotalAnimTime : 0));
+				aGroupWriter.WriteIntVector(anAnimInfo.mPerFrameDelay);
+				aGroupWriter.WriteIntVector(anAnimInfo.mFrameMap);
+			}
+			else if (aRes->mType == ResType_Sound)
+			{
+				SoundRes *aSoundRes = (SoundRes*) aRes;
+				aGroupWriter.Write(aSoundRes->mVolume);
+				aGroupWriter.Write((int32_t) aSoundRes->mPanning);
+				aGroupWriter.Write((uchar) aSoundRes->mStreaming);
+			}
+			else
+			{
+				FontRes *aFontRes = (FontRes*) aRes;
+				uchar aFlags = 0;
+				if (aFontRes->mSysFont)
+				{
+					aFlags |= COMPILEDFONT_SYSFONT;
+					if (aFontRes->mBold) aFlags |= COMPILEDFONT_BOLD;
+					if (aFontRes->mItalic) aFlags |= COMPILEDFONT_ITALIC;
+					if (aFontRes->mUnderline) aFlags |= COMPILEDFONT_UNDERLINE;
+					if (aFontRes->mShadow) aFlags |= COMPILEDFONT_SHADOW;
+				}
+
+				aGroupWriter.WriteString(aFontRes->mImagePath);
+				aGroupWriter.WriteString(aFontRes->mTags);
+				aGroupWriter.Write(aFlags);
+				aGroupWriter.Write((int32_t) (aFontRes->mSysFont ? aFontRes->mSize : 0));
+			}
+		}
+	}
+
+	// The string table goes first but is only complete now
+	CompiledResWriter aWriter;
+	aWriter.Write((uint32_t) COMPILEDRES_MAGIC);
+	aWriter.Write((uint32_t) COMPILEDRES_VERSION);
+	aWriter.Write(theXMLSize);
+	aWriter.Write(theXMLHash);
+	aWriter.Write((uint32_t) aGroupWriter.mStrings.size());
+	for (int i = 0; i < (int)aGroupWriter.mStrings.size(); i++)
+	{
+		const std::string &aString = *aGroupWriter.mStrings[i];
+		aWriter.Write((uint32_t) aString.length());
+		aWriter.mData.insert(aWriter.mData.end(), aString.begin(), aString.end());
+	}
+	aWriter.mData.insert(aWriter.mData.end(), aGroupWriter.mData.begin(), aGroupWriter.mData.end());
+
+	// Through p_fopen so p_fexists sees the new file
+	PFILE* aFP = p_fopen(theFilename.c_str(), "wb");
+	if (aFP == NULL)
+		return Fail("Unable to write compiled resource file: " + theFilename);
+
+	bool written = p_fwrite(&aWriter.mData[0], 1, (int)aWriter.mData.size(), aFP) == aWriter.mData.size();
+	p_fclose(aFP);
+	if (!written)
+		return Fail("Unable to write compiled resource file: " + theFilename);
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compiling goes through a scratch manager, so this one isn't touched.
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::CompileResourcesFile(const std::string& theFilename)
+{
+	uint64_t aSize;
+	uint64_t aHash;
+	if (!HashResourcesFile(theFilename, aSize, aHash))
+		return Fail("Resource file not found: " + theFilename);
+
+	ResourceManager aCompiler(mApp);
+	aCompiler.mUseCompiledResources = false;
+
+	if ((!aCompiler.ParseResourcesFile(theFilename)) ||
+		(!aCompiler.WriteCompiledResources(GetCompiledResourcesName(theFilename), aSize, aHash)))
+		return Fail(aCompiler.GetErrorText());
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::LoadAlphaGridImage(ImageRes *theRes, GLImage *theImage, bool reportErrors)
 {	
 	ImageLib::Image* anAlphaImage = ImageLib::GetImage(theRes->mAlphaGridImage,true);	
 	if (anAlphaImage==NULL)
-		return Fail(StrFormat("Failed to load image: %s",theRes->mAlphaGridImage.c_str()));
+		return reportErrors && Fail(StrFormat("Failed to load image: %s",theRes->mAlphaGridImage.c_str()));
 
 	std::unique_ptr<ImageLib::Image> aDelAlphaImage(anAlphaImage);
 
@@ -641,7 +1160,7 @@ bool ResourceManager::LoadAlphaGridImage(ImageRes *theRes, GLImage *theImage)
 
 
 	if (anAlphaImage->mWidth!=aCelWidth || anAlphaImage->mHeight!=aCelHeight)
-		return Fail(StrFormat("GridAlphaImage size mismatch between %s and %s",theRes->mPath.c_str(),theRes->mAlphaGridImage.c_str()));
+		return reportErrors && Fail(StrFormat("GridAlphaImage size mismatch between %s and %s",theRes->mPath.c_str(),theRes->mAlphaGridImage.c_str()));
 
 	uint32_t *aMasterRowPtr = theImage->mBits;
 	for (int i=0; i < aNumRows; i++)
@@ -674,19 +1193,19 @@ bool ResourceManager::LoadAlphaGridImage(ImageRes *theRes, GLImage *theImage)
 
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-bool ResourceManager::LoadAlphaImage(ImageRes *theRes, GLImage *theImage)
+bool ResourceManager::LoadAlphaImage(ImageRes *theRes, GLImage *theImage, bool reportErrors)
 {
 	SEXY_PERF_BEGIN("ResourceManager::GetImage");
 	ImageLib::Image* anAlphaImage = ImageLib::GetImage(theRes->mAlphaImage,true);
 	SEXY_PERF_END("ResourceManager::GetImage");
 
 	if (anAlphaImage==NULL)
-		return Fail(StrFormat("Failed to load image: %s",theRes->mAlphaImage.c_str()));
+		return reportErrors && Fail(StrFormat("Failed to load image: %s",theRes->mAlphaImage.c_str()));
 
 	std::unique_ptr<ImageLib::Image> aDelAlphaImage(anAlphaImage);
 
 	if (anAlphaImage->mWidth!=theImage->mWidth || anAlphaImage->mHeight!=theImage->mHeight)
-		return Fail(StrFormat("AlphaImage size mismatch between %s and %s",theRes->mPath.c_str(),theRes->mAlphaImage.c_str()));
+		return reportErrors && Fail(StrFormat("AlphaImage size mismatch between %s and %s",theRes->mPath.c_str(),theRes->mAlphaImage.c_str()));
 
 	uint32_t* aBits1 = theImage->mBits;
 	uint32_t* aBits2 = anAlphaImage->mBits;
@@ -738,9 +1257,18 @@ bool ResourceManager::DoLoadImage(ImageRes *theRes)
 				return false;
 		}
 	}
-	
+
+	return FinishLoadImage(theRes, aSharedImageRef);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::FinishLoadImage(ImageRes *theRes, SharedImageRef &theImageRef)
+{
+	GLImage* aGLImage = (GLImage*) theImageRef;
+
 	aGLImage->CommitBits();
-	theRes->mImage = aSharedImageRef;
+	theRes->mImage = theImageRef;
 	aGLImage->mPurgeBits = theRes->mPurgeBits;
 
 	if (theRes->mDDSurface)
@@ -831,17 +1359,24 @@ bool ResourceManager::DoLoadSound(SoundRes* theRes)
 	if (aSoundId<0)
 		return Fail("Out of free sound ids");
 
-	if(!mApp->mSoundManager->LoadSound(aSoundId, aRes->mPath))
+	if(!mApp->mSoundManager->LoadSound(aSoundId, aRes->mPath, aRes->mStreaming))
 		return Fail(StrFormat("Failed to load sound: %s",aRes->mPath.c_str()));
 	SEXY_PERF_END("ResourceManager:LoadSound");
 
-	if (aRes->mVolume >= 0)
-		mApp->mSoundManager->SetBaseVolume(aSoundId, aRes->mVolume);
+	return FinishLoadSound(aRes, aSoundId);
+}
 
-	if (aRes->mPanning != 0)
-		mApp->mSoundManager->SetBasePan(aSoundId, aRes->mPanning);
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::FinishLoadSound(SoundRes *theRes, int theSoundId)
+{
+	if (theRes->mVolume >= 0)
+		mApp->mSoundManager->SetBaseVolume(theSoundId, theRes->mVolume);
+
+	if (theRes->mPanning != 0)
+		mApp->mSoundManager->SetBasePan(theSoundId, theRes->mPanning);
 
-	aRes->mSoundId = aSoundId;
+	theRes->mSoundId = theSoundId;
 
 	ResourceLoadedHook(theRes);
 	return true;
@@ -963,9 +1498,16 @@ bool ResourceManager::LoadNextResource()
 	if (mCurResGroupList==NULL)
 		return false;
 
+	if (mLoadPool!=NULL)
+		QueueLoadJobs();
+
 	while (mCurResGroupListItr!=mCurResGroupList->end())
 	{
 		BaseRes *aRes = *mCurResGroupListItr++;
+		mCurResGroupListPos++;
+
+		// Anything the job still holds is freed if the resource is skipped
+		std::unique_ptr<ResourceLoadJob> aJob(mLoadPool!=NULL ? mLoadPool->Take(aRes) : NULL);
 		if (aRes->mFromProgram)
 			continue;
 
@@ -977,6 +1519,9 @@ bool ResourceManager::LoadNextResource()
 				if ((GLImage*)anImageRes->mImage!=NULL)
 					continue;
 
+				if (aJob!=NULL)
+					return CommitImage(anImageRes, aJob.get());
+
 				return DoLoadImage(anImageRes); 
 			}
 			
@@ -986,6 +1531,9 @@ bool ResourceManager::LoadNextResource()
 				if (aSoundRes->mSoundId!=-1)
 					continue;
 
+				if (aJob!=NULL)
+					return CommitSound(aSoundRes, aJob.get());
+
 				return DoLoadSound(aSoundRes); 
 			}
 			
@@ -1003,6 +1551,142 @@ bool ResourceManager::LoadNextResource()
 	return false;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Fonts aren't pooled, they share images through GetSharedImage and "!ref:"
+// fonts need the fonts before them.
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::WantsLoadJob(BaseRes *theRes)
+{
+	if (theRes->mFromProgram)
+		return false;
+
+	if (theRes->mType == ResType_Image)
+	{
+		ImageRes *anImageRes = (ImageRes*)theRes;
+		return (GLImage*)anImageRes->mImage==NULL && !anImageRes->mPath.empty() && anImageRes->mPath[0]!='!';
+	}
+	else if (theRes->mType == ResType_Sound)
+		return ((SoundRes*)theRes)->mSoundId==-1;
+
+	return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps a few jobs per thread queued ahead of mCurResGroupListItr, any more
+// would only hold decoded images in memory for longer.
+///////////////////////////////////////////////////////////////////////////////
+void ResourceManager::QueueLoadJobs()
+{
+	if (mLoadAheadPos < mCurResGroupListPos)
+	{
+		mLoadAheadItr = mCurResGroupListItr;
+		mLoadAheadPos = mCurResGroupListPos;
+	}
+
+	int aMaxPending = (mLoadPool->GetNumThreads() + 1) * 4;
+	while (mLoadPool->GetPendingCount() < aMaxPending && mLoadAheadItr!=mCurResGroupList->end())
+	{
+		BaseRes *aRes = *mLoadAheadItr++;
+		mLoadAheadPos++;
+
+		if (WantsLoadJob(aRes))
+			mLoadPool->Submit(aRes);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called from the pool's threads, so it may only read theJob's resource.
+///////////////////////////////////////////////////////////////////////////////
+void ResourceManager::DecodeResource(ResourceLoadJob *theJob)
+{
+	if (theJob->mRes->mType == ResType_Image)
+		theJob->mImage = DecodeImage((ImageRes*)theJob->mRes);
+	else if (theJob->mRes->mType == ResType_Sound)
+		theJob->mSound = mApp->mSoundManager->DecodeSound(theJob->mRes->mPath, ((SoundRes*)theJob->mRes)->mStreaming);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The file half of DoLoadImage.  Failures just return NULL, CommitImage loads
+// those again with DoLoadImage so the error is reported the usual way.
+///////////////////////////////////////////////////////////////////////////////
+GLImage* ResourceManager::DecodeImage(ImageRes *theRes)
+{
+	ImageLib::gAlphaComposeColor = theRes->mAlphaColor;
+	GLImage* anImage = mApp->GetImage(theRes->mPath, false);
+	ImageLib::gAlphaComposeColor = 0xFFFFFF;
+
+	if (anImage == NULL)
+		return NULL;
+
+	if ((!theRes->mAlphaImage.empty() && !LoadAlphaImage(theRes, anImage, false)) ||
+		(!theRes->mAlphaGridImage.empty() && !LoadAlphaGridImage(theRes, anImage, false)))
+	{
+		delete anImage;
+		return NULL;
+	}
+
+	anImage->CommitBits();
+	return anImage;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::CommitImage(ImageRes *theRes, ResourceLoadJob *theJob)
+{
+	if (theJob->mImage == NULL)
+		return DoLoadImage(theRes);
+
+	// An image someone else already shared wins, the decoded one is thrown away
+	bool isNew;
+	SharedImageRef aSharedImageRef = mApp->SetSharedImage(theRes->mPath, theRes->mVariant, theJob->mImage, &isNew);
+	if (isNew)
+		theJob->mImage = NULL;
+
+	if ((GLImage*) aSharedImageRef == NULL)
+		return Fail(StrFormat("Failed to load image: %s",theRes->mPath.c_str()));
+
+	return FinishLoadImage(theRes, aSharedImageRef);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+bool ResourceManager::CommitSound(SoundRes *theRes, ResourceLoadJob *theJob)
+{
+	if (theJob->mSound == NULL)
+		return DoLoadSound(theRes);
+
+	int aSoundId = mApp->mSoundManager->GetFreeSoundId();
+	if (aSoundId<0)
+		return Fail("Out of free sound ids");
+
+	if (!mApp->mSoundManager->LoadDecodedSound(aSoundId, theRes->mPath, theJob->mSound))
+		return Fail(StrFormat("Failed to load sound: %s",theRes->mPath.c_str()));
+	theJob->mSound = NULL;
+
+	return FinishLoadSound(theRes, aSoundId);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void ResourceManager::SetLoadThreads(int theNumThreads)
+{
+	if (theNumThreads==GetLoadThreads())
+		return;
+
+	delete mLoadPool;
+	mLoadPool = NULL;
+
+	if (theNumThreads > 1)
+		mLoadPool = new ResourceLoadPool(this, theNumThreads-1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int ResourceManager::GetLoadThreads()
+{
+	return mLoadPool!=NULL ? mLoadPool->GetNumThreads()+1 : 1;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -1018,6 +1702,12 @@ void ResourceManager::StartLoadResources(const std::string &theGroup)
 	mCurResGroup = theGroup;
 	mCurResGroupList = &mResGroupMap[theGroup];
 	mCurResGroupListItr = mCurResGroupList->begin();
+	mCurResGroupListPos = 0;
+
+	if (mLoadPool!=NULL)
+		mLoadPool->Clear();
+	mLoadAheadItr = mCurResGroupListItr;
+	mLoadAheadPos = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -1216,6 +1906,13 @@ void ResourceManager::SetAllowMissingProgramImages(bool allow)
 	mAllowMissingProgramResources = allow;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void ResourceManager::SetUseCompiledResources(bool use)
+{
+	mUseCompiledResources = use;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 bool ResourceManager::ReplaceImage(const std::string &theId, Image *theImage)
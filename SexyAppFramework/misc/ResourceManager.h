@@ -3,6 +3,7 @@
 #include "Common.h"
 #include "graphics/Image.h"
 #include "SexyAppBase.h"
+#include "sound/SoundManager.h"
 #include <string>
 #include <map>
 
@@ -20,6 +21,8 @@ class Image;
 class SoundInstance;
 class SexyAppBase;
 class _Font;
+class ResourceLoadPool;
+class ResourceLoadJob;
 
 typedef std::map<std::string, std::string>	StringToStringMap;
 typedef std::map<SexyString, SexyString>	XMLParamMap;
@@ -77,6 +80,7 @@ public: // @Patoke todo: revert to protected
 		int mSoundId;
 		double mVolume;
 		int mPanning;
+		SoundStreaming mStreaming;
 
 		SoundRes() { mType = ResType_Sound; }
 		virtual void DeleteResource();
@@ -122,10 +126,16 @@ public: // @Patoke todo: revert to protected
 	bool					mAllowMissingProgramResources;
 	bool					mAllowAlreadyDefinedResources; // for reparsing file while running
 	bool					mHadAlreadyDefinedError;
+	bool					mUseCompiledResources;	// ParseResourcesFile prefers an up to date compiled manifest, see SetUseCompiledResources
 
 	ResGroupMap				mResGroupMap;
 	ResList*				mCurResGroupList;
 	ResList::iterator		mCurResGroupListItr;
+	int						mCurResGroupListPos;
+
+	ResourceLoadPool*		mLoadPool;
+	ResList::iterator		mLoadAheadItr;		// next resource to hand to the pool
+	int						mLoadAheadPos;
 
 
 	bool					Fail(const std::string& theErrorText);
@@ -138,15 +148,34 @@ public: // @Patoke todo: revert to protected
 	virtual bool			ParseResources();
 
 	bool					DoParseResources();
+
+	// Compiled manifests hold the parsed groups in order with every resource's
+	// fields already worked out, so loading one doesn't go through XMLParser
+	// or the Parse functions above.
+	bool					AddCompiledResource(BaseRes *&theRes, ResMap &theMap);
+	bool					ReadCompiledResources(const std::string& theFilename, const std::string& theXMLFilename, std::vector<uchar>& theData);
+	bool					LoadCompiledResources(const std::string& theFilename, const std::vector<uchar>& theData);
+	bool					WriteCompiledResources(const std::string& theFilename, uint64_t theXMLSize, uint64_t theXMLHash);
+
 	void					DeleteMap(ResMap &theMap);
 	virtual void			DeleteResources(ResMap &theMap, const std::string &theGroup);
 
-	bool					LoadAlphaGridImage(ImageRes *theRes, GLImage *theImage);
-	bool					LoadAlphaImage(ImageRes *theRes, GLImage *theImage);
+	bool					LoadAlphaGridImage(ImageRes *theRes, GLImage *theImage, bool reportErrors = true);
+	bool					LoadAlphaImage(ImageRes *theRes, GLImage *theImage, bool reportErrors = true);
+	bool					FinishLoadImage(ImageRes *theRes, SharedImageRef &theImageRef);
+	bool					FinishLoadSound(SoundRes *theRes, int theSoundId);
 	virtual bool			DoLoadImage(ImageRes *theRes);
 	virtual bool			DoLoadFont(FontRes* theRes);
 	virtual bool			DoLoadSound(SoundRes* theRes);
 
+	// Pooled loading.  DecodeResource does the file work for a job on any
+	// thread, the Commit functions finish it on the loading thread.
+	bool					WantsLoadJob(BaseRes *theRes);
+	void					QueueLoadJobs();
+	virtual GLImage*		DecodeImage(ImageRes *theRes);
+	virtual bool			CommitImage(ImageRes *theRes, ResourceLoadJob *theJob);
+	virtual bool			CommitSound(SoundRes *theRes, ResourceLoadJob *theJob);
+
 	int						GetNumResources(const std::string &theGroup, ResMap &theMap);
 
 public:
@@ -156,6 +185,17 @@ public:
 	bool					ParseResourcesFile(const std::string& theFilename);
 	bool					ReparseResourcesFile(const std::string& theFilename);
 
+	// Parses theFilename and writes it out compiled next to it, as
+	// GetCompiledResourcesName names it.  Tools/ResourceCompiler does this
+	// for a game's manifests before they're packed.
+	bool					CompileResourcesFile(const std::string& theFilename);
+	static std::string		GetCompiledResourcesName(const std::string& theFilename);
+
+	// With this on, ParseResourcesFile loads the compiled manifest in place of
+	// the XML until the XML changes.  Loading one doesn't call the Parse
+	// functions, so leave it off if a subclass overrides them.  Off by default.
+	void					SetUseCompiledResources(bool use);
+
 	std::string				GetErrorText();
 	bool					HadError();
 	bool					IsGroupLoaded(const std::string &theGroup);
@@ -167,6 +207,14 @@ public:
 
 	virtual bool			LoadNextResource();
 	virtual void			ResourceLoadedHook(BaseRes *theRes);
+	virtual void			DecodeResource(ResourceLoadJob *theJob);
+
+	// With more than one thread images and sounds are decoded ahead on a pool
+	// while LoadNextResource commits them in order, so progress and errors are
+	// reported just like the single threaded loader.  Fonts always load on
+	// the calling thread.  Defaults to 1.
+	void					SetLoadThreads(int theNumThreads);
+	int						GetLoadThreads();
 
 	virtual void			StartLoadResources(const std::string &theGroup);
 	virtual bool			LoadResources(const std::string &theGroup);
@@ -11,6 +11,12 @@ XMLParser::XMLParser()
 	mAllowComments = false;
 	mGetCharFunc = &XMLParser::GetUTF8Char;
 	mForcedEncodingType = false;
+	mInMemory = false;
+	mPos = NULL;
+	mEnd = NULL;
+	mInPending = false;
+	mResumePos = NULL;
+	mResumeEnd = NULL;
 }
 
 XMLParser::~XMLParser()
@@ -45,6 +51,8 @@ void XMLParser::Init()
 	mErrorText = _S("");
 	mFirstChar = true;
 	mByteSwap = false;
+	mInPending = false;
+	mNodeSection.clear();
 }
 
 bool XMLParser::AddAttribute(XMLElement* theElement, const SexyString& theAttributeKey, const SexyString& theAttributeValue)
@@ -251,6 +259,10 @@ bool XMLParser::GetUTF16BEChar(wchar_t* theChar, bool* error)
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Anything but UTF-16 is read into memory in one go (or used where it lies,
+// for a stored pak record) and tokenized from there by NextNode.
+///////////////////////////////////////////////////////////////////////////////
 bool XMLParser::OpenFile(const std::string& theFileName)
 {		
 	mFile = p_fopen(theFileName.c_str(), "r");
@@ -261,40 +273,51 @@ bool XMLParser::OpenFile(const std::string& theFileName)
 		Fail(StringToSexyString("Unable to open file " + theFileName));
 		return false;
 	}
-	else if (!mForcedEncodingType)
-	{
-		p_fseek(mFile, 0, SEEK_END);
-		long aFileLen = p_ftell(mFile);
-		p_fseek(mFile, 0, SEEK_SET);
 
-		mGetCharFunc = &XMLParser::GetAsciiChar;
-		if (aFileLen >= 2) // UTF-16?
+	bool isUTF16 = (mGetCharFunc == &XMLParser::GetUTF16Char) || (mGetCharFunc == &XMLParser::GetUTF16LEChar) || (mGetCharFunc == &XMLParser::GetUTF16BEChar);
+	if ((!mForcedEncodingType) || (!isUTF16))
+	{
+		int64_t aSize = 0;
+		const uchar* aData = p_fdata(mFile, &aSize);
+		if (aData == NULL)
 		{
-			int aChar1 = p_fgetc(mFile);
-			int aChar2 = p_fgetc(mFile);
+			p_fseek(mFile, 0, SEEK_END);
+			long aFileLen = p_ftell(mFile);
+			p_fseek(mFile, 0, SEEK_SET);
 
-			if ( (aChar1 == 0xFF && aChar2 == 0xFE) || (aChar1 == 0xFE && aChar2 == 0xFF) )
-				mGetCharFunc = &XMLParser::GetUTF16Char;
+			// Text mode can hand back fewer bytes than the file's length
+			mOwnedData.resize(aFileLen);
+			if (aFileLen > 0)
+				mOwnedData.resize(p_fread(&mOwnedData[0], 1, aFileLen, mFile));
 
-			p_ungetc(aChar2, mFile);
-			p_ungetc(aChar1, mFile);			
+			aData = (const uchar*) mOwnedData.data();
+			aSize = mOwnedData.size();
 		}
-		if ((mGetCharFunc = &XMLParser::GetAsciiChar))
+
+		isUTF16 = (!mForcedEncodingType) && (aSize >= 2) &&
+			(((aData[0] == 0xFF) && (aData[1] == 0xFE)) || ((aData[0] == 0xFE) && (aData[1] == 0xFF)));
+
+		if (!isUTF16)
 		{
-			if (aFileLen >= 3) // UTF-8?
+			bool hasUTF8BOM = (aSize >= 3) && (aData[0] == 0xEF) && (aData[1] == 0xBB) && (aData[2] == 0xBF);
+			if ((hasUTF8BOM) && ((!mForcedEncodingType) || (mGetCharFunc == &XMLParser::GetUTF8Char)))
 			{
-				int aChar1 = p_fgetc(mFile);
-				int aChar2 = p_fgetc(mFile);
-				int aChar3 = p_fgetc(mFile);
+				aData += 3;
+				aSize -= 3;
+			}
 
-				if (aChar1 == 0xEF && aChar2 == 0xBB && aChar3 == 0xBF)
-					mGetCharFunc = &XMLParser::GetUTF8Char;
+			p_fclose(mFile);
+			mFile = NULL;
 
-				p_ungetc(aChar3, mFile);
-				p_ungetc(aChar2, mFile);
-				p_ungetc(aChar1, mFile);			
-			}
+			mFileName = theFileName.c_str();
+			Init();
+			SetMemorySource((const char*) aData, (int) aSize);
+			return true;
 		}
+
+		mOwnedData.clear();
+		p_fseek(mFile, 0, SEEK_SET);
+		mGetCharFunc = &XMLParser::GetUTF16Char;
 	}
 
 	mFileName = theFileName.c_str();
@@ -302,12 +325,34 @@ bool XMLParser::OpenFile(const std::string& theFileName)
 	return true;
 }
 
+void XMLParser::SetMemorySource(const char* theData, int theLength)
+{
+	mInMemory = true;
+	mPos = theData;
+	mEnd = theData + theLength;
+	mInPending = false;
+}
+
 void XMLParser::SetStringSource(const std::wstring& theString)
 {
 	Init();
 
 	int aSize = theString.size();
 
+	// Plain ASCII reads the same either way, so it can go through NextNode
+	bool isAscii = true;
+	for (int i = 0; (i < aSize) && (isAscii); i++)
+		isAscii = (unsigned) theString[i] < 0x80;
+
+	if (isAscii)
+	{
+		mOwnedData.resize(aSize);
+		for (int i = 0; i < aSize; i++)
+			mOwnedData[i] = (char) theString[i];
+		SetMemorySource(mOwnedData.data(), aSize);
+		return;
+	}
+
 	mBufferedText.resize(aSize);	
 	for (int i = 0; i < aSize; i++)
 		mBufferedText[i] = theString[aSize - i - 1];	
@@ -315,11 +360,54 @@ void XMLParser::SetStringSource(const std::wstring& theString)
 
 void XMLParser::SetStringSource(const std::string& theString)
 {
-	SetStringSource(StringToWString(theString));
+	Init();
+	mOwnedData.assign(theString.begin(), theString.end());
+	SetMemorySource(mOwnedData.data(), (int) mOwnedData.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parses theData where it lies, so it has to outlive the parse.
+///////////////////////////////////////////////////////////////////////////////
+void XMLParser::SetBufferSource(const char* theData, int theLength)
+{
+	Init();
+	SetMemorySource(theData, theLength);
+}
+
+static void AssignView(SexyString& theString, const XMLView& theView)
+{
+#ifdef _USE_WIDE_STRING
+	theString.assign((const uchar*) theView.mData, (const uchar*) theView.mData + theView.mLength);
+#else
+	theString.assign(theView.mData, theView.mLength);
+#endif
 }
 
 bool XMLParser::NextElement(XMLElement* theElement)
 {
+	if (mInMemory)
+	{
+		if (!NextNode(&mElementNode))
+			return false;
+
+		theElement->mType = mElementNode.mType;
+		AssignView(theElement->mSection, mElementNode.mSection);
+		AssignView(theElement->mValue, mElementNode.mValue);
+		AssignView(theElement->mInstruction, mElementNode.mInstruction);
+		theElement->mAttributes.clear();
+
+		SexyString aKey;
+		SexyString aValue;
+		for (int i = 0; i < (int)mElementNode.mAttributes.size(); i++)
+		{
+			AssignView(aKey, mElementNode.mAttributes[i].mKey);
+			AssignView(aValue, mElementNode.mAttributes[i].mValue);
+			AddAttribute(theElement, aKey, aValue);
+		}
+
+		return true;
+	}
+
 	for (;;)
 	{		
 		theElement->mType = XMLElement::TYPE_NONE;
@@ -703,6 +791,503 @@ bool XMLParser::NextElement(XMLElement* theElement)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+XMLArena::XMLArena()
+{
+	mBlock = 0;
+	mUsed = 0;
+}
+
+XMLArena::~XMLArena()
+{
+	for (int i = 0; i < (int)mBlocks.size(); i++)
+		delete [] mBlocks[i];
+}
+
+char* XMLArena::AllocBlock(int theSize)
+{
+	while (mBlock + 1 < (int)mBlocks.size())
+	{
+		mBlock++;
+		mUsed = 0;
+
+		if (theSize <= mBlockSizes[mBlock])
+		{
+			mUsed = theSize;
+			return mBlocks[mBlock];
+		}
+	}
+
+	int aBlockSize = std::max(theSize, mBlocks.empty() ? 4096 : mBlockSizes.back() * 2);
+	mBlocks.push_back(new char[aBlockSize]);
+	mBlockSizes.push_back(aBlockSize);
+
+	mBlock = (int)mBlocks.size() - 1;
+	mUsed = theSize;
+	return mBlocks[mBlock];
+}
+
+const XMLView* XMLNode::GetAttribute(const char* theKey) const
+{
+	for (int i = (int)mAttributes.size() - 1; i >= 0; i--)
+	{
+		if (mAttributes[i].mKey == theKey)
+			return &mAttributes[i].mValue;
+	}
+
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies theData into the arena, running it through XMLDecodeString's entity
+// rules on the way if asked to.
+///////////////////////////////////////////////////////////////////////////////
+XMLView XMLParser::AddView(const char* theData, int theLength, bool decode)
+{
+	static const struct { const char* mName; int mLength; char mChar; } aEntities[] = {
+		{ "lt", 2, '<' }, { "amp", 3, '&' }, { "gt", 2, '>' }, { "quot", 4, '"' },
+		{ "apos", 4, '\'' }, { "nbsp", 4, ' ' }, { "cr", 2, '\n' }
+	};
+
+	char* aDest = mArena.Alloc(theLength + 1);
+	int aLength = 0;
+
+	if ((!decode) || (memchr(theData, '&', theLength) == NULL))
+	{
+		memcpy(aDest, theData, theLength);
+		aLength = theLength;
+	}
+	else
+	{
+		for (int i = 0; i < theLength; i++)
+		{
+			char c = theData[i];
+
+			if (c == '&')
+			{
+				const char* aSemi = (const char*) memchr(theData + i, ';', theLength - i);
+				if (aSemi != NULL)
+				{
+					const char* aName = theData + i + 1;
+					int aNameLength = (int)(aSemi - aName);
+					i = (int)(aSemi - theData);
+
+					for (int j = 0; j < (int)(sizeof(aEntities)/sizeof(aEntities[0])); j++)
+					{
+						if ((aNameLength == aEntities[j].mLength) && (memcmp(aName, aEntities[j].mName, aNameLength) == 0))
+						{
+							c = aEntities[j].mChar;
+							break;
+						}
+					}
+				}
+			}
+
+			aDest[aLength++] = c;
+		}
+	}
+
+	aDest[aLength] = 0;
+	mArena.Unalloc(theLength - aLength);
+
+	XMLView aView;
+	aView.mData = aDest;
+	aView.mLength = aLength;
+	return aView;
+}
+
+void XMLParser::AddNodeAttribute(XMLNode* theNode, const std::string& theKey, const std::string& theValue)
+{
+	XMLNodeAttribute anAttribute;
+	anAttribute.mKey = AddView(theKey.c_str(), (int)theKey.length(), true);
+	anAttribute.mValue = AddView(theValue.c_str(), (int)theValue.length(), true);
+	theNode->mAttributes.push_back(anAttribute);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// NextNode for the sources that still go through mGetCharFunc.
+///////////////////////////////////////////////////////////////////////////////
+bool XMLParser::NextLegacyNode(XMLNode* theNode)
+{
+	mLegacyElement.mAttributeIteratorList.clear();
+	if (!NextElement(&mLegacyElement))
+		return false;
+
+	mArena.Reset();
+
+	std::string aString = SexyStringToString(mLegacyElement.mSection);
+	theNode->mSection = AddView(aString.c_str(), (int)aString.length(), false);
+	aString = SexyStringToString(mLegacyElement.mValue);
+	theNode->mValue = AddView(aString.c_str(), (int)aString.length(), false);
+	aString = SexyStringToString(mLegacyElement.mInstruction);
+	theNode->mInstruction = AddView(aString.c_str(), (int)aString.length(), false);
+	theNode->mType = mLegacyElement.mType;
+	theNode->mAttributes.clear();
+
+	XMLParamMapIteratorList::iterator anItr = mLegacyElement.mAttributeIteratorList.begin();
+	for (; anItr != mLegacyElement.mAttributeIteratorList.end(); ++anItr)
+	{
+		XMLNodeAttribute anAttribute;
+		aString = SexyStringToString((*anItr)->first);
+		anAttribute.mKey = AddView(aString.c_str(), (int)aString.length(), false);
+		aString = SexyStringToString((*anItr)->second);
+		anAttribute.mValue = AddView(aString.c_str(), (int)aString.length(), false);
+		theNode->mAttributes.push_back(anAttribute);
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The same grammar NextElement has always accepted, quirks included, but run
+// over the whole source at once: runs of name, text and quoted characters
+// are appended in bulk, and the results are views into mArena instead of
+// strings and maps built per element.  NextElement is a thin copy of this
+// for in-memory sources.
+///////////////////////////////////////////////////////////////////////////////
+bool XMLParser::NextNode(XMLNode* theNode)
+{
+	if (!mInMemory)
+		return NextLegacyNode(theNode);
+
+	std::string& aValue = mNodeValue;
+	std::string& anInstruction = mNodeInstruction;
+	std::string& aKey = mNodeKey;
+	std::string& anAttributeValue = mNodeAttributeValue;
+
+	for (;;)
+	{
+		mArena.Reset();
+		theNode->mSection = AddView(mNodeSection.c_str(), (int)mNodeSection.length(), false);
+		theNode->mAttributes.clear();
+
+		aValue.clear();
+		anInstruction.clear();
+		aKey.clear();
+		anAttributeValue.clear();
+
+		int aType = XMLElement::TYPE_NONE;
+		bool hasSpace = false;
+		bool inQuote = false;
+		bool gotEndQuote = false;
+		bool doingAttribute = false;
+		bool attributeVal = false;
+
+		for (;;)
+		{
+			if (mPos == mEnd)
+			{
+				if (mInPending)
+				{
+					mPos = mResumePos;
+					mEnd = mResumeEnd;
+					mInPending = false;
+					continue;
+				}
+
+				if (aType != XMLElement::TYPE_NONE)
+					Fail(_S("Unexpected End of File"));
+
+				return false;
+			}
+
+			if (aType == XMLElement::TYPE_COMMENT)
+			{
+				// Everything up to and including the next '>', then see if that ended in -->
+				const char* aClose = (const char*) memchr(mPos, '>', mEnd - mPos);
+				const char* aStop = (aClose != NULL) ? aClose + 1 : mEnd;
+				for (const char* aPtr = mPos; aPtr < aStop; aPtr++)
+				{
+					if (*aPtr == '\n')
+						mLineNum++;
+				}
+
+				anInstruction.append(mPos, aStop);
+				mPos = aStop;
+
+				int aLen = (int)anInstruction.length();
+				if ((aClose != NULL) && (aLen >= 3) && (anInstruction[aLen - 2] == '-') && (anInstruction[aLen - 3] == '-'))
+				{
+					anInstruction.resize(aLen - 3);
+					break;
+				}
+
+				continue;
+			}
+
+			char c = *mPos++;
+			if (c == '\n')
+				mLineNum++;
+
+			if (aType == XMLElement::TYPE_INSTRUCTION)
+			{
+				std::string* aStrPtr = &aValue;
+				if ((anInstruction.length() != 0) || (::iswspace((uchar) c)))
+					aStrPtr = &anInstruction;
+
+				*aStrPtr += c;
+
+				int aLen = (int)aStrPtr->length();
+				if ((c == '>') && (aLen >= 2) && ((*aStrPtr)[aLen - 2] == '?'))
+				{
+					aStrPtr->resize(aLen - 2);
+					break;
+				}
+
+				continue;
+			}
+
+			bool processChar = false;
+
+			if (c == '"')
+			{
+				inQuote = !inQuote;
+				if ((aType == XMLElement::TYPE_NONE) || (aType == XMLElement::TYPE_ELEMENT))
+					processChar = true;
+
+				if (!inQuote)
+					gotEndQuote = true;
+			}
+			else if (!inQuote)
+			{
+				if (c == '<')
+				{
+					if (aType == XMLElement::TYPE_ELEMENT)
+					{
+						mPos--;
+						break;
+					}
+
+					if (aType == XMLElement::TYPE_NONE)
+					{
+						aType = XMLElement::TYPE_START;
+					}
+					else
+					{
+						Fail(_S("Unexpected '<'"));
+						return false;
+					}
+				}
+				else if (c == '>')
+				{
+					if (aType == XMLElement::TYPE_START)
+					{
+						bool insertEnd = false;
+
+						if (aKey == "/")
+						{
+							// A space before the />
+							insertEnd = true;
+						}
+						else if (aKey.length() > 0)
+						{
+							AddNodeAttribute(theNode, aKey, anAttributeValue);
+
+							XMLView& aVal = theNode->mAttributes.back().mValue;
+							if ((aVal.mLength > 0) && (aVal.mData[aVal.mLength - 1] == '/'))
+							{
+								// Its an empty element, the / was taken as the end of the value
+								aVal = AddView(aVal.mData, aVal.mLength - 1, true);
+								insertEnd = true;
+							}
+						}
+						else if ((aValue.length() > 0) && (aValue[aValue.length() - 1] == '/'))
+						{
+							aValue.resize(aValue.length() - 1);
+							insertEnd = true;
+						}
+
+						aKey.clear();
+						anAttributeValue.clear();
+
+						// Fake an end tag, read before whatever was left to read
+						if (insertEnd)
+						{
+							std::string anEnd = "</" + aValue + ">";
+							if (mInPending)
+								anEnd.append(mPos, mEnd);
+							else
+							{
+								mResumePos = mPos;
+								mResumeEnd = mEnd;
+								mInPending = true;
+							}
+
+							mPendingText.swap(anEnd);
+							mPos = mPendingText.data();
+							mEnd = mPos + mPendingText.length();
+						}
+
+						if (mNodeSection.length() != 0)
+							mNodeSection += '/';
+
+						mNodeSection += aValue;
+						break;
+					}
+					else if (aType == XMLElement::TYPE_END)
+					{
+						size_t aLastSlash = mNodeSection.rfind('/');
+						if ((aLastSlash == std::string::npos) && (mNodeSection.length() == 0))
+						{
+							Fail(_S("Unexpected End"));
+							return false;
+						}
+
+						size_t aLastSectionPos = (aLastSlash == std::string::npos) ? 0 : aLastSlash + 1;
+						if (mNodeSection.compare(aLastSectionPos, std::string::npos, aValue) != 0)
+						{
+							Fail(StringToSexyString("End '" + aValue + "' Doesn't Match Start '" + mNodeSection.substr(aLastSectionPos) + "'"));
+							return false;
+						}
+
+						mNodeSection.erase((aLastSlash == std::string::npos) ? 0 : aLastSlash);
+						break;
+					}
+					else
+					{
+						Fail(_S("Unexpected '>'"));
+						return false;
+					}
+				}
+				else if ((c == '/') && (aType == XMLElement::TYPE_START) && (aValue.length() == 0))
+				{
+					aType = XMLElement::TYPE_END;
+				}
+				else if ((c == '?') && (aType == XMLElement::TYPE_START) && (aValue.length() == 0))
+				{
+					aType = XMLElement::TYPE_INSTRUCTION;
+				}
+				else if (::isspace((uchar) c))
+				{
+					if (aValue.length() != 0)
+						hasSpace = true;
+
+					// It's a comment!
+					if ((aType == XMLElement::TYPE_START) && (aValue == "!--"))
+						aType = XMLElement::TYPE_COMMENT;
+					else
+					{
+						// The rest of the run can't change anything
+						while ((mPos < mEnd) && (::isspace((uchar) *mPos)))
+						{
+							if (*mPos == '\n')
+								mLineNum++;
+							mPos++;
+						}
+					}
+				}
+				else if ((uchar) c > 32)
+				{
+					processChar = true;
+				}
+				else
+				{
+					Fail(_S("Illegal Character"));
+					return false;
+				}
+			}
+			else
+			{
+				processChar = true;
+			}
+
+			if (processChar)
+			{
+				if (aType == XMLElement::TYPE_NONE)
+					aType = XMLElement::TYPE_ELEMENT;
+
+				std::string* aStrPtr = NULL;
+
+				if (aType == XMLElement::TYPE_START)
+				{
+					if (hasSpace)
+					{
+						if ((!doingAttribute) || ((!attributeVal) && (c != '=')) ||
+							((attributeVal) && ((anAttributeValue.length() > 0) || gotEndQuote)))
+						{
+							if (doingAttribute)
+							{
+								AddNodeAttribute(theNode, aKey, anAttributeValue);
+								aKey.clear();
+								anAttributeValue.clear();
+							}
+							else
+							{
+								doingAttribute = true;
+							}
+
+							attributeVal = false;
+						}
+
+						hasSpace = false;
+					}
+
+					if (!doingAttribute)
+						aStrPtr = &aValue;
+					else if (c == '=')
+					{
+						attributeVal = true;
+						gotEndQuote = false;
+					}
+					else if (!attributeVal)
+						aStrPtr = &aKey;
+					else
+						aStrPtr = &anAttributeValue;
+				}
+				else
+				{
+					if (hasSpace)
+					{
+						aValue += ' ';
+						hasSpace = false;
+					}
+
+					aStrPtr = &aValue;
+				}
+
+				if (aStrPtr != NULL)
+				{
+					// Take the rest of the run that would land in the same string
+					bool stopAtEquals = (aType == XMLElement::TYPE_START) && (doingAttribute);
+					const char* aRunEnd = mPos;
+
+					if (inQuote)
+					{
+						while ((aRunEnd < mEnd) && (*aRunEnd != '"') && ((!stopAtEquals) || (*aRunEnd != '=')))
+						{
+							if (*aRunEnd == '\n')
+								mLineNum++;
+							aRunEnd++;
+						}
+					}
+					else
+					{
+						while ((aRunEnd < mEnd) && ((uchar) *aRunEnd > 32) && (*aRunEnd != '"') && (*aRunEnd != '<') && (*aRunEnd != '>') &&
+							((!stopAtEquals) || (*aRunEnd != '=')))
+							aRunEnd++;
+					}
+
+					*aStrPtr += c;
+					aStrPtr->append(mPos, aRunEnd);
+					mPos = aRunEnd;
+				}
+			}
+		}
+
+		if (aKey.length() > 0)
+			AddNodeAttribute(theNode, aKey, anAttributeValue);
+
+		theNode->mType = aType;
+		theNode->mValue = AddView(aValue.c_str(), (int)aValue.length(), true);
+		theNode->mInstruction = AddView(anInstruction.c_str(), (int)anInstruction.length(), false);
+
+		// Ignore comments
+		if ((aType != XMLElement::TYPE_COMMENT) || mAllowComments)
+			return true;
+	}
+}
+
 bool XMLParser::HasFailed()
 {
 	return mHasFailed;
@@ -4,6 +4,8 @@
 
 #include "PerfTimer.h"
 
+#include <cstring>
+
 struct PFILE;
 
 namespace Sexy
@@ -43,6 +45,80 @@ public:
 	XMLParamMapIteratorList	mAttributeIteratorList; // stores attribute iterators in their original order
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// A NUL terminated run of characters in an XMLArena.
+///////////////////////////////////////////////////////////////////////////////
+class XMLView
+{
+public:
+	const char*				mData;
+	int						mLength;
+
+public:
+	std::string				ToString() const { return std::string(mData, mLength); }
+	bool					operator==(const char* theString) const { return (strlen(theString) == (size_t)mLength) && (memcmp(mData, theString, mLength) == 0); }
+	bool					operator!=(const char* theString) const { return !(*this == theString); }
+};
+
+class XMLNodeAttribute
+{
+public:
+	XMLView					mKey;
+	XMLView					mValue;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// What XMLParser::NextNode returns: an XMLElement whose strings all live in
+// the parser's arena, so they are only good until the next call.  Attributes
+// are kept in the order they were given, repeats included.
+///////////////////////////////////////////////////////////////////////////////
+class XMLNode
+{
+public:
+	int						mType;			// XMLElement::TYPE_*
+	XMLView					mSection;
+	XMLView					mValue;
+	XMLView					mInstruction;
+	std::vector<XMLNodeAttribute> mAttributes;
+
+public:
+	const XMLView*			GetAttribute(const char* theKey) const;	// the last one given wins, like XMLElement::mAttributes
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Hands out memory in blocks that stay put until the arena is destroyed.
+// Reset makes all of it available again without freeing anything.
+///////////////////////////////////////////////////////////////////////////////
+class XMLArena
+{
+public:
+	std::vector<char*>		mBlocks;
+	std::vector<int>		mBlockSizes;
+	int						mBlock;			// the block being filled
+	int						mUsed;			// bytes taken from it
+
+protected:
+	char*					AllocBlock(int theSize);
+
+public:
+	XMLArena();
+	~XMLArena();
+
+	char*					Alloc(int theSize)
+	{
+		if ((mBlock < (int)mBlocks.size()) && (mUsed + theSize <= mBlockSizes[mBlock]))
+		{
+			char* aPtr = mBlocks[mBlock] + mUsed;
+			mUsed += theSize;
+			return aPtr;
+		}
+		return AllocBlock(theSize);
+	}
+
+	void					Unalloc(int theSize) { mUsed -= theSize; }	// gives back the end of the last Alloc
+	void					Reset() { mBlock = 0; mUsed = 0; }
+};
+
 class XMLParser
 {
 protected:
@@ -59,6 +135,25 @@ protected:
 	bool					mFirstChar;
 	bool					mByteSwap;
 
+	// In-memory sources (see NextNode).  mPos runs through mPendingText first
+	// when there is some, then carries on from mResumePos.
+	bool					mInMemory;
+	std::vector<char>		mOwnedData;		// the source unless it's a pak record or the caller's buffer
+	const char*				mPos;
+	const char*				mEnd;
+	bool					mInPending;
+	std::string				mPendingText;	// the end tag faked for an empty element
+	const char*				mResumePos;
+	const char*				mResumeEnd;
+	std::string				mNodeSection;
+	std::string				mNodeValue;
+	std::string				mNodeInstruction;
+	std::string				mNodeKey;
+	std::string				mNodeAttributeValue;
+	XMLArena				mArena;
+	XMLNode					mElementNode;	// for NextElement over an in-memory source
+	XMLElement				mLegacyElement;	// for NextNode over any other source
+
 protected:
 	void					Fail(const SexyString& theErrorText);
 	void					Init();
@@ -71,6 +166,11 @@ protected:
 	bool					GetUTF16LEChar(wchar_t* theChar, bool* error);
 	bool					GetUTF16BEChar(wchar_t* theChar, bool* error);
 
+	void					SetMemorySource(const char* theData, int theLength);
+	XMLView					AddView(const char* theData, int theLength, bool decode);
+	void					AddNodeAttribute(XMLNode* theNode, const std::string& theKey, const std::string& theValue);
+	bool					NextLegacyNode(XMLNode* theNode);
+
 public:
 	enum XMLEncodingType
 	{
@@ -89,7 +189,9 @@ public:
 	bool					OpenFile(const std::string& theFilename);
 	void					SetStringSource(const std::wstring& theString);
 	void					SetStringSource(const std::string& theString);
+	void					SetBufferSource(const char* theData, int theLength);
 	bool					NextElement(XMLElement* theElement);
+	bool					NextNode(XMLNode* theNode);
 	SexyString				GetErrorText();
 	int						GetCurrentLineNum();
 	std::string				GetFileName();
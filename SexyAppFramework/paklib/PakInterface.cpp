@@ -2,8 +2,15 @@
 #include "PakInterface.h"
 #include "fcaseopen/fcaseopen.h"
 
-#ifndef _WIN32
+#include <zlib.h>
+#include <SDL2/SDL.h>
+#include <filesystem>
+
+#ifdef _WIN32
+#include <io.h>
+#else
 #include <unistd.h>
+#include <sys/mman.h>
 #endif
 
 typedef unsigned char uchar;
@@ -15,8 +22,42 @@ enum
 	FILEFLAGS_END = 0x80
 };
 
+// Version 0 stores every record uncompressed, back to back after the directory.
+// Version 1 gives every record a codec, a 64-bit offset from the end of the
+// directory and, when compressed, the stored size of each of its blocks.
+enum
+{
+	PAK_MAGIC = 0xBAC04AC0,
+	PAK_VERSION_MAX = 1,
+	PAK_MAX_BLOCK_SIZE = 16 * 1024 * 1024
+};
+
+enum
+{
+	PFILE_BUFFER_SIZE = 16 * 1024
+};
+
 PakInterface* gPakInterface = new PakInterface();
 
+// fseek and ftell with 64-bit offsets, long is only 32 bits on Windows
+static int FileSeek(FILE* theFile, int64_t theOffset, int theOrigin)
+{
+#ifdef _WIN32
+	return _fseeki64(theFile, theOffset, theOrigin);
+#else
+	return fseeko(theFile, (off_t) theOffset, theOrigin);
+#endif
+}
+
+static int64_t FileTell(FILE* theFile)
+{
+#ifdef _WIN32
+	return _ftelli64(theFile);
+#else
+	return (int64_t) ftello(theFile);
+#endif
+}
+
 static std::string StringToUpper(const std::string& theString)
 {
 	std::string aString;
@@ -27,14 +68,186 @@ static std::string StringToUpper(const std::string& theString)
 	return aString;
 }
 
+PakCollection::~PakCollection()
+{
+	if (mDataPtr == NULL)
+		return;
+
+	if (mMapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mDataPtr);
+#else
+		munmap(mDataPtr, mDataSize);
+#endif
+	}
+	else
+		free(mDataPtr);
+}
+
+// Maps the whole file read only.  Nothing is decoded up front, pages are only
+// read in when a record touching them is read.
+bool PakCollection::MapFile(FILE* theFile, size_t theSize)
+{
+	if (theSize == 0)
+		return false;
+
+#ifdef _WIN32
+	HANDLE aFileHandle = (HANDLE) _get_osfhandle(_fileno(theFile));
+	HANDLE aFileMapping = CreateFileMapping(aFileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (aFileMapping == NULL)
+		return false;
+
+	void* aPtr = MapViewOfFile(aFileMapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(aFileMapping); // the view keeps the mapping alive
+	if (aPtr == NULL)
+		return false;
+#else
+	void* aPtr = mmap(NULL, theSize, PROT_READ, MAP_PRIVATE, fileno(theFile), 0);
+	if (aPtr == MAP_FAILED)
+		return false;
+#endif
+
+	mDataPtr = aPtr;
+	mDataSize = theSize;
+	mMapped = true;
+	mXorKey = 0xF7;
+	return true;
+}
+
+// Reads and decodes the whole file into memory.
+bool PakCollection::LoadFile(FILE* theFile, size_t theSize)
+{
+	mDataPtr = malloc(theSize);
+	mDataSize = theSize;
+	mMapped = false;
+	mXorKey = 0;
+
+	if (mDataPtr == NULL || fread(mDataPtr, 1, theSize, theFile) != theSize)
+		return false;
+
+	uint8_t* aDataPtr = static_cast<uint8_t*>(mDataPtr);
+	for (size_t i = 0; i < theSize; i++)
+		aDataPtr[i] ^= 0xF7;
+	return true;
+}
+
+void PakCollection::Read(void* theDest, size_t theOffset, size_t theSize) const
+{
+	uint8_t* aDest = (uint8_t*) theDest;
+	memcpy(aDest, (const uint8_t*) mDataPtr + theOffset, theSize);
+
+	if (mXorKey != 0)
+	{
+		for (size_t i = 0; i < theSize; i++)
+			aDest[i] ^= mXorKey;
+	}
+}
+
+const uint8_t* PakCollection::GetBytes(size_t theOffset, size_t theSize, uint8_t* theScratch) const
+{
+	if (mXorKey == 0)
+		return (const uint8_t*) mDataPtr + theOffset;
+
+	Read(theScratch, theOffset, theSize);
+	return theScratch;
+}
+
+// FNV-1a
+uint32_t PakRecordIndex::HashKey(const char* theKey)
+{
+	uint32_t aHash = 2166136261U;
+	while (*theKey != 0)
+	{
+		aHash ^= (uchar) *(theKey++);
+		aHash *= 16777619U;
+	}
+	return aHash;
+}
+
+void PakRecordIndex::Grow()
+{
+	std::vector<Slot> anOldSlots;
+	anOldSlots.swap(mSlots);
+
+	Slot anEmpty = { 0, NULL, NULL };
+	mSlots.resize(anOldSlots.empty() ? 256 : anOldSlots.size() * 2, anEmpty);
+
+	size_t aMask = mSlots.size() - 1;
+	for (size_t i = 0; i < anOldSlots.size(); i++)
+	{
+		if (anOldSlots[i].mKey == NULL)
+			continue;
+
+		size_t anIdx = anOldSlots[i].mHash & aMask;
+		while (mSlots[anIdx].mKey != NULL)
+			anIdx = (anIdx + 1) & aMask;
+		mSlots[anIdx] = anOldSlots[i];
+	}
+}
+
+// theKey must outlive the index, it is the key of the record's map entry
+void PakRecordIndex::Insert(const std::string& theKey, PakRecord* theRecord)
+{
+	if ((mCount + 1) * 2 > (int) mSlots.size())
+		Grow();
+
+	uint32_t aHash = HashKey(theKey.c_str());
+	size_t aMask = mSlots.size() - 1;
+	size_t anIdx = aHash & aMask;
+
+	while (mSlots[anIdx].mKey != NULL)
+	{
+		if (mSlots[anIdx].mHash == aHash && strcmp(mSlots[anIdx].mKey, theKey.c_str()) == 0)
+		{
+			mSlots[anIdx].mRecord = theRecord;
+			return;
+		}
+		anIdx = (anIdx + 1) & aMask;
+	}
+
+	mSlots[anIdx].mHash = aHash;
+	mSlots[anIdx].mKey = theKey.c_str();
+	mSlots[anIdx].mRecord = theRecord;
+	mCount++;
+}
+
+PakRecord* PakRecordIndex::Find(const char* theKey) const
+{
+	if (mCount == 0)
+		return NULL;
+
+	uint32_t aHash = HashKey(theKey);
+	size_t aMask = mSlots.size() - 1;
+
+	for (size_t anIdx = aHash & aMask; mSlots[anIdx].mKey != NULL; anIdx = (anIdx + 1) & aMask)
+	{
+		if (mSlots[anIdx].mHash == aHash && strcmp(mSlots[anIdx].mKey, theKey) == 0)
+			return mSlots[anIdx].mRecord;
+	}
+	return NULL;
+}
+
 PakInterface::PakInterface()
 {
 	//if (GetPakPtr() == NULL)
 		//*gPakInterfaceP = this;
+	mMapPakFiles = true;
+	mIndexDirs = true;
+	mDirListingsMutex = SDL_CreateMutex();
+	mSkippedOpens = 0;
 }
 
 PakInterface::~PakInterface()
 {
+	SDL_DestroyMutex(mDirListingsMutex);
+}
+
+PakRecord* PakInterface::AddRecord(const std::string& theKey)
+{
+	PakRecordMap::iterator aRecordItr = mPakRecordMap.insert(PakRecordMap::value_type(theKey, PakRecord())).first;
+	mPakRecordIndex.Insert(aRecordItr->first, &aRecordItr->second);
+	return &aRecordItr->second;
 }
 
 //0x5D84D0
@@ -88,6 +301,22 @@ static void FixFileName(const char* theFileName, char* theUpperName)
 	}
 }
 
+static PFILE* NewPFile(PakRecord* theRecord, FILE* theFP, bool readAhead, bool stripCR)
+{
+	PFILE* aPFP = new PFILE;
+	aPFP->mRecord = theRecord;
+	aPFP->mPos = 0;
+	aPFP->mFP = theFP;
+	aPFP->mFilePos = 0;
+	aPFP->mReadAhead = readAhead;
+	aPFP->mStripCR = stripCR;
+	aPFP->mBuffer = NULL;
+	aPFP->mWindow = NULL;
+	aPFP->mWindowPos = 0;
+	aPFP->mWindowSize = 0;
+	return aPFP;
+}
+
 bool PakInterface::AddPakFile(const std::string& theFileName)
 {
 	/*
@@ -117,11 +346,16 @@ bool PakInterface::AddPakFile(const std::string& theFileName)
 	FILE *aFileHandle = fcaseopen(theFileName.c_str(), "rb");
     if (!aFileHandle) return false;
 
-    fseek(aFileHandle, 0, SEEK_END);
-    size_t aFileSize = ftell(aFileHandle);
-    fseek(aFileHandle, 0, SEEK_SET);
+	int64_t aFileTell = (FileSeek(aFileHandle, 0, SEEK_END) == 0) ? FileTell(aFileHandle) : -1;
+	if ((aFileTell < 0) || ((uint64_t) aFileTell > SIZE_MAX))
+	{
+		fclose(aFileHandle);
+		return false;
+	}
+	size_t aFileSize = (size_t) aFileTell;
+	FileSeek(aFileHandle, 0, SEEK_SET);
 
-	mPakCollectionList.emplace_back(aFileSize);
+	mPakCollectionList.emplace_back();
 	PakCollection* aPakCollection = &mPakCollectionList.back();
 	/*
 	aPakCollection->mFileHandle = aFileHandle;
@@ -129,48 +363,36 @@ bool PakInterface::AddPakFile(const std::string& theFileName)
 	aPakCollection->mDataPtr = aPtr;
 	*/
 
-	if (fread(aPakCollection->mDataPtr, 1, aFileSize, aFileHandle) != aFileSize) {
-        fclose(aFileHandle);
-        return false;
-    }
+	// Mapping falls back to reading the whole file when it isn't available
+	bool isLoaded = (mMapPakFiles && aPakCollection->MapFile(aFileHandle, aFileSize)) || aPakCollection->LoadFile(aFileHandle, aFileSize);
     fclose(aFileHandle);
 
-    {
-        auto *aDataPtr = static_cast<uint8_t *>(aPakCollection->mDataPtr);
-        for (size_t i = 0; i < aFileSize; i++)
-            *aDataPtr++ ^= 0xF7;
-    }
-
-	PakRecordMap::iterator aRecordItr = mPakRecordMap.insert(PakRecordMap::value_type(StringToUpper(theFileName), PakRecord())).first;
-	PakRecord* aPakRecord = &(aRecordItr->second);
-	aPakRecord->mCollection = aPakCollection;
-	aPakRecord->mFileName = theFileName;
-	aPakRecord->mStartPos = 0;
-	aPakRecord->mSize = aFileSize;
-	
-	PFILE* aFP = FOpen(theFileName.c_str(), "rb");
-	if (aFP == NULL)
-		return false;
-
-	uint32_t aMagic = 0;
-	FRead(&aMagic, sizeof(uint32_t), 1, aFP);
-	if (aMagic != 0xBAC04AC0)
+	if (!isLoaded)
 	{
-		FClose(aFP);
+		mPakCollectionList.pop_back();
 		return false;
 	}
 
+	// The directory is read through a record of the whole pak, and nothing is
+	// registered until all of it checks out
+	PakRecord aPakFileRecord;
+	aPakFileRecord.mCollection = aPakCollection;
+	aPakFileRecord.mFileName = theFileName;
+	aPakFileRecord.mStartPos = 0;
+	aPakFileRecord.mSize = aFileSize;
+
+	PFILE* aFP = NewPFile(&aPakFileRecord, NULL, false, true);
+
+	uint32_t aMagic = 0;
 	uint32_t aVersion = 0;
+	FRead(&aMagic, sizeof(uint32_t), 1, aFP);
 	FRead(&aVersion, sizeof(uint32_t), 1, aFP);
-	if (aVersion > 0)
-	{
-		FClose(aFP);
-		return false;
-	}
 
-	int aPos = 0;
+	std::vector<std::pair<std::string, PakRecord> > aRecords;
+	int64_t aPos = 0;
+	bool isValid = (aMagic == PAK_MAGIC) && (aVersion <= PAK_VERSION_MAX);
 
-	for (;;)
+	while (isValid)
 	{
 		uchar aFlags = 0;
 		int aCount = FRead(&aFlags, 1, 1, aFP);
@@ -182,10 +404,78 @@ bool PakInterface::AddPakFile(const std::string& theFileName)
 		FRead(&aNameWidth, 1, 1, aFP);
 		FRead(aName, 1, aNameWidth, aFP);
 		aName[aNameWidth] = 0;
-		int aSrcSize = 0;
-		FRead(&aSrcSize, sizeof(int), 1, aFP);
-		int64_t aFileTime;
-		FRead(&aFileTime, sizeof(int64_t), 1, aFP);
+
+		int64_t aSrcSize = 0;
+		int64_t aFileTime = 0;
+		int64_t aStartPos = aPos;
+		uint8_t aCodec = PAKCODEC_STORE;
+		uint32_t aBlockSize = 0;
+		std::vector<int64_t> aBlockStarts;
+
+		if (aVersion == 0)
+		{
+			int aSize = 0;
+			FRead(&aSize, sizeof(int), 1, aFP);
+			FRead(&aFileTime, sizeof(int64_t), 1, aFP);
+			aSrcSize = aSize;
+			aPos += aSrcSize;
+		}
+		else
+		{
+			uint64_t anOffset = 0;
+			uint64_t aSize = 0;
+			FRead(&aCodec, 1, 1, aFP);
+			FRead(&aFileTime, sizeof(int64_t), 1, aFP);
+			FRead(&anOffset, sizeof(uint64_t), 1, aFP);
+			FRead(&aSize, sizeof(uint64_t), 1, aFP);
+
+			// Checked before the casts, so nothing huge can come out negative.
+			// Compressed sizes can be bigger than the pak, the block count
+			// check below sees to those.
+			if ((anOffset > aFileSize) || (aSize > (uint64_t) INT64_MAX))
+			{
+				isValid = false;
+				break;
+			}
+			aStartPos = (int64_t) anOffset;
+			aSrcSize = (int64_t) aSize;
+
+			if (aCodec != PAKCODEC_STORE)
+			{
+				FRead(&aBlockSize, sizeof(uint32_t), 1, aFP);
+				if ((aCodec != PAKCODEC_ZLIB) || (aBlockSize == 0) || (aBlockSize > PAK_MAX_BLOCK_SIZE))
+				{
+					isValid = false;
+					break;
+				}
+
+				// Every block has a 4 byte size in the directory, so a count the rest
+				// of the pak couldn't hold is a damaged entry rather than an allocation
+				int64_t aNumBlocks = (aSrcSize >= 0) ? (aSrcSize + aBlockSize - 1) / aBlockSize : -1;
+				if ((aNumBlocks < 0) || (aNumBlocks > ((int64_t) aFileSize - FTell(aFP)) / (int64_t) sizeof(uint32_t)))
+				{
+					isValid = false;
+					break;
+				}
+
+				aBlockStarts.resize(aNumBlocks + 1);
+				aBlockStarts[0] = 0;
+				for (int64_t i = 0; i < aNumBlocks; i++)
+				{
+					uint32_t aStoredSize = 0;
+					FRead(&aStoredSize, sizeof(uint32_t), 1, aFP);
+					if (aStoredSize > aBlockSize)
+						isValid = false;
+					aBlockStarts[i + 1] = aBlockStarts[i] + aStoredSize;
+				}
+			}
+		}
+
+		if (FEof(aFP))
+		{
+			isValid = false;
+			break;
+		}
 
 		for (int i=0; i<aNameWidth; i++)
 		{
@@ -196,30 +486,42 @@ bool PakInterface::AddPakFile(const std::string& theFileName)
 		char anUpperName[256];
 		FixFileName(aName, anUpperName);
 
-		PakRecordMap::iterator aRecordItr = mPakRecordMap.insert(PakRecordMap::value_type(StringToUpper(aName), PakRecord())).first;
-		PakRecord* aPakRecord = &(aRecordItr->second);
+		aRecords.push_back(std::make_pair(StringToUpper(aName), PakRecord()));
+		PakRecord* aPakRecord = &aRecords.back().second;
 		aPakRecord->mCollection = aPakCollection;
 		aPakRecord->mFileName = anUpperName;
-		aPakRecord->mStartPos = aPos;
+		aPakRecord->mStartPos = aStartPos;
 		aPakRecord->mSize = aSrcSize;
 		aPakRecord->mFileTime = aFileTime;
-
-		aPos += aSrcSize;
+		aPakRecord->mCodec = aCodec;
+		aPakRecord->mBlockSize = aBlockSize;
+		aPakRecord->mBlockStarts.swap(aBlockStarts);
 	}
 
-	int anOffset = FTell(aFP);
+	int64_t aDataStart = aFP->mPos;
+	FClose(aFP);
 
-	// Now fix file starts
-	aRecordItr = mPakRecordMap.begin();
-	while (aRecordItr != mPakRecordMap.end())
+	// Now fix file starts, and every file has to lie inside the pak
+	int64_t aDataSize = (int64_t) aPakCollection->mDataSize;
+	for (size_t i = 0; (isValid) && (i < aRecords.size()); i++)
 	{
-		PakRecord* aPakRecord = &(aRecordItr->second);
-		if (aPakRecord->mCollection == aPakCollection)
-			aPakRecord->mStartPos += anOffset;
-		++aRecordItr;
+		PakRecord* aPakRecord = &aRecords[i].second;
+		aPakRecord->mStartPos += aDataStart;
+
+		int64_t aStoredSize = (aPakRecord->mCodec == PAKCODEC_STORE) ? aPakRecord->mSize : aPakRecord->mBlockStarts.back();
+		if ((aPakRecord->mSize < 0) || (aPakRecord->mStartPos < 0) || (aPakRecord->mStartPos > aDataSize) || (aStoredSize > aDataSize - aPakRecord->mStartPos))
+			isValid = false;
 	}
 
-	FClose(aFP);
+	if (!isValid)
+	{
+		mPakCollectionList.pop_back();
+		return false;
+	}
+
+	*AddRecord(StringToUpper(theFileName)) = aPakFileRecord;
+	for (size_t i = 0; i < aRecords.size(); i++)
+		*AddRecord(aRecords[i].first) = aRecords[i].second;
 
 	return true;
 }
@@ -227,40 +529,40 @@ bool PakInterface::AddPakFile(const std::string& theFileName)
 //0x5D85C0
 PFILE* PakInterface::FOpen(const char* theFileName, const char* anAccess)
 {
-	if ((strcasecmp(anAccess, "r") == 0) || (strcasecmp(anAccess, "rb") == 0) || (strcasecmp(anAccess, "rt") == 0))
+	bool isText = (strcasecmp(anAccess, "r") == 0) || (strcasecmp(anAccess, "rt") == 0);
+	if ((isText) || (strcasecmp(anAccess, "rb") == 0))
 	{
 		char anUpperName[256];
 		FixFileName(theFileName, anUpperName);
 		
-		PakRecordMap::iterator anItr = mPakRecordMap.find(anUpperName);
-		if (anItr != mPakRecordMap.end())
-		{
-			PFILE* aPFP = new PFILE;
-			aPFP->mRecord = &anItr->second;
-			aPFP->mPos = 0;
-			aPFP->mFP = NULL;
-			return aPFP;
-		}
-
-		anItr = mPakRecordMap.find(theFileName);
-		if (anItr != mPakRecordMap.end())
-		{
-			PFILE* aPFP = new PFILE;
-			aPFP->mRecord = &anItr->second;
-			aPFP->mPos = 0;
-			aPFP->mFP = NULL;
-			return aPFP;
-		}
+		PakRecord* aRecord = mPakRecordIndex.Find(anUpperName);
+		if (aRecord == NULL)
+			aRecord = mPakRecordIndex.Find(theFileName);
+
+		if (aRecord != NULL)
+			return NewPFile(aRecord, NULL, false, true);
+
+		// Read through our own buffer, so '\r' is skipped by FGetC and FGetS
+		// like it is for pak records rather than by the C library
+		FILE* aFP = fcaseopen(theFileName, "rb");
+		if (aFP == NULL)
+			return NULL;
+		return NewPFile(NULL, aFP, true, isText);
 	}
 
 	FILE* aFP = fcaseopen(theFileName, anAccess);
 	if (aFP == NULL)
 		return NULL;
-	PFILE* aPFP = new PFILE;
-	aPFP->mRecord = NULL;
-	aPFP->mPos = 0;
-	aPFP->mFP = aFP;
-	return aPFP;
+
+	// The file may be new, so its directory has to be listed again
+	std::string aDir;
+	std::string aName;
+	SplitDiskPath(theFileName, aDir, aName);
+	SDL_LockMutex(mDirListingsMutex);
+	mDirListings.erase(aDir);
+	SDL_UnlockMutex(mDirListingsMutex);
+
+	return NewPFile(NULL, aFP, false, false);
 }
 
 //0x5D8780
@@ -268,52 +570,210 @@ int PakInterface::FClose(PFILE* theFile)
 {
 	if (theFile->mRecord == NULL)
 		fclose(theFile->mFP);
+	delete[] theFile->mBuffer;
 	delete theFile;
 	return 0;
 }
 
 //0x5D87B0
-int PakInterface::FSeek(PFILE* theFile, long theOffset, int theOrigin)
+int PakInterface::FSeek(PFILE* theFile, int64_t theOffset, int theOrigin)
 {
 	if (theFile->mRecord != NULL)
 	{
 		if (theOrigin == SEEK_SET)
 			theFile->mPos = theOffset;
 		else if (theOrigin == SEEK_END)
-			theFile->mPos = theFile->mRecord->mSize - theOffset;
+			theFile->mPos = theFile->mRecord->mSize + theOffset;
 		else if (theOrigin == SEEK_CUR)
 			theFile->mPos += theOffset;
 
 		// 当前指针位置不能超过整个文件的大小，且不能小于 0
-		theFile->mPos = std::max(std::min(theFile->mPos, theFile->mRecord->mSize), 0);
+		theFile->mPos = std::max(std::min(theFile->mPos, theFile->mRecord->mSize), (int64_t) 0);
+		return 0;
+	}
+	else if (theFile->mReadAhead)
+	{
+		int64_t aPos = theFile->mPos;
+		if (theOrigin == SEEK_SET)
+			aPos = theOffset;
+		else if (theOrigin == SEEK_CUR)
+			aPos += theOffset;
+		else
+		{
+			// The size isn't known, let the C library find the end
+			if (FileSeek(theFile->mFP, theOffset, SEEK_END) != 0)
+				return -1;
+			aPos = theFile->mFilePos = FileTell(theFile->mFP);
+		}
+
+		if (aPos < 0)
+			return -1;
+
+		// Like fseek, moving clears the end of file flag.  The window stays
+		// valid, it's only refilled when the position leaves it.
+		theFile->mPos = aPos;
+		clearerr(theFile->mFP);
 		return 0;
 	}
 	else
-		return fseek(theFile->mFP, theOffset, theOrigin);
+		return FileSeek(theFile->mFP, theOffset, theOrigin);
 }
 
 //0x5D8830
-int PakInterface::FTell(PFILE* theFile)
+int64_t PakInterface::FTell(PFILE* theFile)
 {
-	if (theFile->mRecord != NULL)
+	if ((theFile->mRecord != NULL) || (theFile->mReadAhead))
 		return theFile->mPos;
 	else
-		return ftell(theFile->mFP);	
+		return FileTell(theFile->mFP);
+}
+
+// Decompresses theBlock of a compressed record into theFile->mBuffer and makes
+// it the window.  Blocks that didn't get smaller were stored as they are.
+bool PakInterface::LoadBlock(PFILE* theFile, int theBlock)
+{
+	PakRecord* aRecord = theFile->mRecord;
+	if (theFile->mBuffer == NULL)
+		theFile->mBuffer = new uint8_t[aRecord->mBlockSize * 2];
+
+	theFile->mWindowSize = 0;
+
+	int64_t aBlockPos = (int64_t) theBlock * aRecord->mBlockSize;
+	int aSize = (int) std::min((int64_t) aRecord->mBlockSize, aRecord->mSize - aBlockPos);
+	int aStoredSize = (int) (aRecord->mBlockStarts[theBlock + 1] - aRecord->mBlockStarts[theBlock]);
+	size_t aStoredPos = aRecord->mStartPos + aRecord->mBlockStarts[theBlock];
+
+	if (aStoredSize == aSize)
+		aRecord->mCollection->Read(theFile->mBuffer, aStoredPos, aSize);
+	else
+	{
+		const uint8_t* aSrc = aRecord->mCollection->GetBytes(aStoredPos, aStoredSize, theFile->mBuffer + aRecord->mBlockSize);
+		uLongf aDestLen = aSize;
+		if ((uncompress(theFile->mBuffer, &aDestLen, aSrc, aStoredSize) != Z_OK) || (aDestLen != (uLongf) aSize))
+			return false;
+	}
+
+	theFile->mWindow = theFile->mBuffer;
+	theFile->mWindowPos = aBlockPos;
+	theFile->mWindowSize = aSize;
+	return true;
+}
+
+// Moves the window over the current position.  Returns false at the end of
+// the file, or if nothing could be read.
+bool PakInterface::FillWindow(PFILE* theFile)
+{
+	PakRecord* aRecord = theFile->mRecord;
+
+	if (aRecord == NULL)
+	{
+		if (!theFile->mReadAhead)
+			return false;
+
+		if (theFile->mBuffer == NULL)
+			theFile->mBuffer = new uint8_t[PFILE_BUFFER_SIZE];
+
+		theFile->mWindowSize = 0;
+		if ((theFile->mFilePos != theFile->mPos) && (FileSeek(theFile->mFP, theFile->mPos, SEEK_SET) != 0))
+			return false;
+
+		int aCount = (int) fread(theFile->mBuffer, 1, PFILE_BUFFER_SIZE, theFile->mFP);
+		theFile->mFilePos = theFile->mPos + aCount;
+		theFile->mWindow = theFile->mBuffer;
+		theFile->mWindowPos = theFile->mPos;
+		theFile->mWindowSize = aCount;
+		return aCount > 0;
+	}
+
+	if (theFile->mPos >= aRecord->mSize)
+		return false;
+
+	if (aRecord->mCodec != PAKCODEC_STORE)
+		return LoadBlock(theFile, (int) (theFile->mPos / aRecord->mBlockSize));
+
+	PakCollection* aCollection = aRecord->mCollection;
+	if (aCollection->mXorKey == 0)
+	{
+		// Already decoded, the window is the record itself
+		int64_t aStart = (aRecord->mSize <= 0x7FFFFFFF) ? 0 : theFile->mPos;
+		theFile->mWindow = (const uint8_t*) aCollection->mDataPtr + aRecord->mStartPos + aStart;
+		theFile->mWindowPos = aStart;
+		theFile->mWindowSize = (int) std::min(aRecord->mSize - aStart, (int64_t) 0x7FFFFFFF);
+		return true;
+	}
+
+	if (theFile->mBuffer == NULL)
+		theFile->mBuffer = new uint8_t[PFILE_BUFFER_SIZE];
+
+	int aSize = (int) std::min(aRecord->mSize - theFile->mPos, (int64_t) PFILE_BUFFER_SIZE);
+	aCollection->Read(theFile->mBuffer, aRecord->mStartPos + theFile->mPos, aSize);
+	theFile->mWindow = theFile->mBuffer;
+	theFile->mWindowPos = theFile->mPos;
+	theFile->mWindowSize = aSize;
+	return true;
+}
+
+// Copies up to theSize bytes from the current position of a pak record or
+// read ahead file, returns how many were copied.
+int PakInterface::ReadBytes(PFILE* theFile, void* theDest, int theSize)
+{
+	PakRecord* aRecord = theFile->mRecord;
+	if (aRecord != NULL)
+		theSize = (int) std::max(std::min((int64_t) theSize, aRecord->mSize - theFile->mPos), (int64_t) 0);
+
+	uint8_t* aDest = (uint8_t*) theDest;
+	int aDone = 0;
+	while (aDone < theSize)
+	{
+		int aLeft = theFile->WindowLeft();
+		if (aLeft == 0)
+		{
+			// Big reads skip the buffer when it would only add a copy
+			if ((theSize - aDone >= PFILE_BUFFER_SIZE) && ((aRecord == NULL) || ((aRecord->mCodec == PAKCODEC_STORE) && (aRecord->mCollection->mXorKey != 0))))
+			{
+				int aCount = theSize - aDone;
+				if (aRecord != NULL)
+					aRecord->mCollection->Read(aDest + aDone, aRecord->mStartPos + theFile->mPos, aCount);
+				else
+				{
+					if ((theFile->mFilePos != theFile->mPos) && (FileSeek(theFile->mFP, theFile->mPos, SEEK_SET) != 0))
+						break;
+					aCount = (int) fread(aDest + aDone, 1, aCount, theFile->mFP);
+					theFile->mFilePos = theFile->mPos + aCount;
+				}
+				aDone += aCount;
+				theFile->mPos += aCount;
+				break;
+			}
+
+			if (!FillWindow(theFile))
+				break;
+			aLeft = theFile->WindowLeft();
+		}
+
+		int aCount = std::min(theSize - aDone, aLeft);
+		memcpy(aDest + aDone, theFile->mWindow + (theFile->mPos - theFile->mWindowPos), aCount);
+		aDone += aCount;
+		theFile->mPos += aCount;
+	}
+	return aDone;
+}
+
+// Next byte of a pak record or read ahead file, or EOF.
+int PakInterface::GetByte(PFILE* theFile)
+{
+	if ((theFile->WindowLeft() == 0) && (!FillWindow(theFile)))
+		return EOF;
+	return theFile->mWindow[theFile->mPos++ - theFile->mWindowPos];
 }
 
 //0x5D8850
 size_t PakInterface::FRead(void* thePtr, int theElemSize, int theCount, PFILE* theFile)
 {
-	if (theFile->mRecord != NULL)
+	if ((theFile->mRecord != NULL) || (theFile->mReadAhead))
 	{
-		// 实际读取的字节数不能超过当前资源文件剩余可读取的字节数
-		int aSizeBytes = std::min(theElemSize*theCount, theFile->mRecord->mSize - theFile->mPos);
-
-		// 取得在整个 pak 中开始读取的位置的指针
-		uchar* src = (uchar*) theFile->mRecord->mCollection->mDataPtr + theFile->mRecord->mStartPos + theFile->mPos;
-		uchar* dest = (uchar*) thePtr;
-		memcpy(dest, src, aSizeBytes);
-		theFile->mPos += aSizeBytes;  // 读取完成后，移动当前读取位置的指针
+		// 实际读取的字节数不能超过当前资源文件剩余可读取的字节数，从整个 pak 中的读取位置复制并解码
+		int aSizeBytes = ReadBytes(theFile, thePtr, theElemSize*theCount);
 		return aSizeBytes / theElemSize;  // 返回实际读取的项数
 	}
 	
@@ -322,15 +782,13 @@ size_t PakInterface::FRead(void* thePtr, int theElemSize, int theCount, PFILE* t
 
 int PakInterface::FGetC(PFILE* theFile)
 {
-	if (theFile->mRecord != NULL)
+	if ((theFile->mRecord != NULL) || (theFile->mReadAhead))
 	{
 		for (;;)
 		{
-			if (theFile->mPos >= theFile->mRecord->mSize)
-				return EOF;		
-			char aChar = *((char*) theFile->mRecord->mCollection->mDataPtr + theFile->mRecord->mStartPos + theFile->mPos++);
-			if (aChar != '\r')
-				return (uchar) aChar;
+			int aChar = GetByte(theFile);
+			if ((aChar != '\r') || (!theFile->mStripCR))
+				return aChar;
 		}
 	}
 
@@ -339,10 +797,10 @@ int PakInterface::FGetC(PFILE* theFile)
 
 int PakInterface::UnGetC(int theChar, PFILE* theFile)
 {
-	if (theFile->mRecord != NULL)
+	if ((theFile->mRecord != NULL) || (theFile->mReadAhead))
 	{
 		// This won't work if we're not pushing the same chars back in the stream
-		theFile->mPos = std::max(theFile->mPos - 1, 0);
+		theFile->mPos = std::max(theFile->mPos - 1, (int64_t) 0);
 		return theChar;
 	}
 
@@ -351,22 +809,43 @@ int PakInterface::UnGetC(int theChar, PFILE* theFile)
 
 char* PakInterface::FGetS(char* thePtr, int theSize, PFILE* theFile)
 {
-	if (theFile->mRecord != NULL)
+	if ((theFile->mRecord != NULL) || (theFile->mReadAhead))
 	{
+		// Copies a window's worth at a time, leaving room for the terminator like fgets
 		int anIdx = 0;
-		while (anIdx < theSize)
+		bool gotLine = false;
+		while ((anIdx < theSize - 1) && (!gotLine))
 		{
-			if (theFile->mPos >= theFile->mRecord->mSize)
+			if ((theFile->WindowLeft() == 0) && (!FillWindow(theFile)))
 			{
 				if (anIdx == 0)
 					return NULL;
 				break;
 			}
-			char aChar = *((char*) theFile->mRecord->mCollection->mDataPtr + theFile->mRecord->mStartPos + theFile->mPos++);
-			if (aChar != '\r')
-				thePtr[anIdx++] = aChar;
-			if (aChar == '\n')
-				break;
+
+			const char* aSrc = (const char*) theFile->mWindow + (theFile->mPos - theFile->mWindowPos);
+			int aCount = std::min(theFile->WindowLeft(), theSize - 1 - anIdx);
+			const char* anEnd = (const char*) memchr(aSrc, '\n', aCount);
+			if (anEnd != NULL)
+			{
+				aCount = (int) (anEnd - aSrc) + 1;
+				gotLine = true;
+			}
+			theFile->mPos += aCount;
+
+			if (!theFile->mStripCR)
+			{
+				memcpy(thePtr + anIdx, aSrc, aCount);
+				anIdx += aCount;
+				continue;
+			}
+
+			// The skipped '\r's make room for more bytes on the next pass
+			for (int i = 0; i < aCount; i++)
+			{
+				if (aSrc[i] != '\r')
+					thePtr[anIdx++] = aSrc[i];
+			}
 		}
 		thePtr[anIdx] = 0;
 		return thePtr;
@@ -379,10 +858,102 @@ int PakInterface::FEof(PFILE* theFile)
 {
 	if (theFile->mRecord != NULL)
 		return theFile->mPos >= theFile->mRecord->mSize;
+	else if (theFile->mReadAhead)
+		return (theFile->WindowLeft() == 0) && (theFile->mPos == theFile->mFilePos) && feof(theFile->mFP);
 	else
 		return feof(theFile->mFP);
 }
 
+const uint8_t* PakInterface::FGetData(PFILE* theFile, int64_t* theSize)
+{
+	PakRecord* aRecord = theFile->mRecord;
+	if ((aRecord == NULL) || (aRecord->mCodec != PAKCODEC_STORE) || (aRecord->mCollection->mXorKey != 0))
+		return NULL;
+
+	*theSize = aRecord->mSize;
+	return (const uint8_t*) aRecord->mCollection->mDataPtr + aRecord->mStartPos;
+}
+
+// Splits theFileName into the key of its directory in mDirListings and its name in that directory
+void PakInterface::SplitDiskPath(const char* theFileName, std::string& theDir, std::string& theName)
+{
+	std::string aPath = theFileName;
+	std::replace(aPath.begin(), aPath.end(), '\\', '/');
+#ifdef _WIN32
+	aPath = StringToUpper(aPath);
+#endif
+
+	size_t aSlashPos = aPath.rfind('/');
+	if (aSlashPos == std::string::npos)
+	{
+		theDir = "./";
+		theName = aPath;
+	}
+	else
+	{
+		theDir = aPath.substr(0, aSlashPos + 1);
+		theName = aPath.substr(aSlashPos + 1);
+	}
+}
+
+// Answers from the pak records first, then from a listing of the file's directory made the first
+// time it is asked about.  Probing for files that mostly aren't there, like ImageLib does for
+// every extension and alpha image, then costs a lookup rather than a failed open.
+bool PakInterface::FExists(const char* theFileName)
+{
+	char anUpperName[256];
+	FixFileName(theFileName, anUpperName);
+
+	if ((mPakRecordIndex.Find(anUpperName) != NULL) || (mPakRecordIndex.Find(theFileName) != NULL))
+		return true;
+
+	if (!mIndexDirs)
+		return true;
+
+	std::string aDir;
+	std::string aName;
+	SplitDiskPath(theFileName, aDir, aName);
+
+	SDL_LockMutex(mDirListingsMutex);
+
+	PakDirListingMap::iterator anItr = mDirListings.find(aDir);
+	if (anItr == mDirListings.end())
+	{
+		PakDirListing& aListing = mDirListings[aDir];
+
+		std::error_code anError;
+		std::filesystem::directory_iterator aDirItr(aDir, anError), anEnd;
+		for (; (!anError) && (aDirItr != anEnd); aDirItr.increment(anError))
+		{
+#ifdef _WIN32
+			aListing.mFileNames.insert(StringToUpper(aDirItr->path().filename().string()));
+#else
+			aListing.mFileNames.insert(aDirItr->path().filename().string());
+#endif
+		}
+
+		aListing.mListed = !anError;
+		if (!aListing.mListed)
+			aListing.mFileNames.clear();
+
+		anItr = mDirListings.find(aDir);
+	}
+
+	bool exists = (!anItr->second.mListed) || (anItr->second.mFileNames.count(aName) > 0);
+	if (!exists)
+		mSkippedOpens++;
+
+	SDL_UnlockMutex(mDirListingsMutex);
+	return exists;
+}
+
+void PakInterface::ClearDirListings()
+{
+	SDL_LockMutex(mDirListingsMutex);
+	mDirListings.clear();
+	SDL_UnlockMutex(mDirListingsMutex);
+}
+
 /*
 bool PakInterface::PFindNext(PFindData* theFindData, LPWIN32_FIND_DATA lpFindFileData)
 {
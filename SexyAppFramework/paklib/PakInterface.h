@@ -1,11 +1,24 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <list>
 #include <string>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 
 class PakCollection;
+struct SDL_mutex;
+
+// Codec of a record's data.  Compressed records are split into mBlockSize
+// blocks compressed on their own, so a seek only decompresses what it reads.
+enum PakCodec
+{
+	PAKCODEC_STORE = 0,
+	PAKCODEC_ZLIB = 1
+};
 
 // [定义]资源包文件：包含了若干游戏资源的 .pak 文件。例如：main.pak
 // [定义]资源文件：资源包文件中的一项具体资源的文件。例如：zombie_falling_1.ogg
@@ -19,12 +32,46 @@ public:
 	PakCollection*			mCollection;			//+0x0：指向该资源文件所在的资源包的 PakCollection
 	std::string				mFileName;				//+0x4：资源文件的名称及路径（路径从 .pak 开始），例如 sounds\zombie_falling_1.ogg
 	int64_t				mFileTime;				//+0x20：八字节型的资源文件的时间戳
-	int						mStartPos;				//+0x28：该资源文件在资源包中的位置（即在 mCollection->mDataPtr 中的偏移量）
-	int						mSize;					//+0x2C：资源文件的大小，单位为 Byte（字节数）
+	int64_t					mStartPos;				//+0x28：该资源文件在资源包中的位置（即在 mCollection->mDataPtr 中的偏移量）
+	int64_t					mSize;					//+0x2C：资源文件的大小，单位为 Byte（字节数）
+	uint8_t					mCodec;					// PAKCODEC_
+	int						mBlockSize;				// uncompressed size of each block but the last
+	std::vector<int64_t>	mBlockStarts;			// block offsets from mStartPos, plus the end of the last one
+
+	PakRecord() : mCollection(NULL), mFileTime(0), mStartPos(0), mSize(0), mCodec(PAKCODEC_STORE), mBlockSize(0) {}
 };
 
 typedef std::map<std::string, PakRecord> PakRecordMap;
 
+// ====================================================================================================
+// ★ Open addressing index over mPakRecordMap, so p_fopen doesn't build a std::string and walk a tree.
+//   Keys are the map keys (upper case, forward slashes) and are hashed once when a record is added.
+// ====================================================================================================
+class PakRecordIndex
+{
+public:
+	struct Slot
+	{
+		uint32_t			mHash;
+		const char*			mKey;					// NULL for an empty slot
+		PakRecord*			mRecord;
+	};
+
+	std::vector<Slot>		mSlots;					// power of two sized, at most half full
+	int						mCount;
+
+protected:
+	void					Grow();
+
+public:
+	PakRecordIndex() : mCount(0) {}
+
+	static uint32_t			HashKey(const char* theKey);
+
+	void					Insert(const std::string& theKey, PakRecord* theRecord);
+	PakRecord*				Find(const char* theKey) const;
+};
+
 // ====================================================================================================
 // ★ 一个 PakCollection 实例对应一个 pak 资源包在内存中的映射文件
 // ====================================================================================================
@@ -34,19 +81,57 @@ public:
 	//HANDLE					mFileHandle;
 	//HANDLE					mMappingHandle;
 	void*						mDataPtr;				//+0x8：资源包中的所有数据
+	size_t						mDataSize;
+	bool						mMapped;				// mDataPtr is a read only view of the file
+	uint8_t						mXorKey;				// still applied to every byte read, 0 once decoded
+
+	PakCollection() : mDataPtr(NULL), mDataSize(0), mMapped(false), mXorKey(0) {}
+	~PakCollection();
 
-	explicit PakCollection(size_t size) { mDataPtr = malloc(size); }
+	bool						MapFile(FILE* theFile, size_t theSize);
+	bool						LoadFile(FILE* theFile, size_t theSize);
 
-	~PakCollection() { free(mDataPtr); }
+	// Copies theSize bytes from theOffset into theDest, decoding them on the way
+	void						Read(void* theDest, size_t theOffset, size_t theSize) const;
+	uint8_t						ReadByte(size_t theOffset) const { return ((const uint8_t*) mDataPtr)[theOffset] ^ mXorKey; }
+	// Decoded bytes in place when nothing is left to decode, otherwise read into theScratch
+	const uint8_t*				GetBytes(size_t theOffset, size_t theSize, uint8_t* theScratch) const;
 };
 
 typedef std::list<PakCollection> PakCollectionList;
 
+// ====================================================================================================
+// ★ The names in one disk directory, read the first time FExists looks in it.  mListed is false when
+//   the directory couldn't be read, in which case FExists leaves it to the open to find out.
+// ====================================================================================================
+struct PakDirListing
+{
+	bool					mListed;
+	std::set<std::string>	mFileNames;				// upper case on Windows, where names are case insensitive
+};
+
+typedef std::map<std::string, PakDirListing> PakDirListingMap;
+
+// ====================================================================================================
+// ★ An open file, either a pak record or a file on disk.  Reads go through a window of decoded bytes:
+//   the record itself for loaded paks, a decoded chunk or decompressed block otherwise, and a read
+//   ahead buffer for files opened for reading from disk.  Files opened for writing use mFP directly.
+// ====================================================================================================
 struct PFILE
 {
 	PakRecord*				mRecord;
-	int						mPos;
+	int64_t					mPos;
 	FILE*					mFP;
+	int64_t					mFilePos;				// where mFP is, for read ahead files
+	bool					mReadAhead;				// disk file read through mBuffer
+	bool					mStripCR;				// FGetC and FGetS skip '\r'
+	uint8_t*				mBuffer;				// read ahead or decoded data, followed by scratch space for compressed blocks
+	const uint8_t*			mWindow;				// bytes [mWindowPos, mWindowPos + mWindowSize) of the file
+	int64_t					mWindowPos;
+	int						mWindowSize;
+
+	// How many bytes from mPos on are in the window
+	int						WindowLeft() const { int64_t anOffset = mPos - mWindowPos; return ((anOffset >= 0) && (anOffset < mWindowSize)) ? (int) (mWindowSize - anOffset) : 0; }
 };
 
 struct PFindData
@@ -62,14 +147,15 @@ public:
 	virtual PFILE*			FOpen(const char* theFileName, const char* theAccess) = 0;
 //	virtual PFILE*			FOpen(const wchar_t* theFileName, const wchar_t* theAccess) { return NULL; }
 	virtual int				FClose(PFILE* theFile) = 0;
-	virtual int				FSeek(PFILE* theFile, long theOffset, int theOrigin) = 0;
-	virtual int				FTell(PFILE* theFile) = 0;
+	virtual int				FSeek(PFILE* theFile, int64_t theOffset, int theOrigin) = 0;
+	virtual int64_t			FTell(PFILE* theFile) = 0;
 	virtual size_t			FRead(void* thePtr, int theElemSize, int theCount, PFILE* theFile) = 0;
 	virtual int				FGetC(PFILE* theFile) = 0;
 	virtual int				UnGetC(int theChar, PFILE* theFile) = 0;
 	virtual char*			FGetS(char* thePtr, int theSize, PFILE* theFile) = 0;
 //	virtual wchar_t*		FGetS(wchar_t* thePtr, int theSize, PFILE* theFile) { return thePtr; }
 	virtual int				FEof(PFILE* theFile) = 0;
+	virtual const uint8_t*	FGetData(PFILE* theFile, int64_t* theSize) = 0;
 
 	/*
 	virtual HANDLE			FindFirstFile(LPCTSTR lpFileName, LPWIN32_FIND_DATA lpFindFileData) = 0;	
@@ -83,10 +169,24 @@ class PakInterface : public PakInterfaceBase
 public:
 	PakCollectionList		mPakCollectionList;		//+0x4：通过 AddPakFile() 添加的各个资源包的内存映射文件数据的链表
 	PakRecordMap			mPakRecordMap;			//+0x10：所有已添加的资源包中的所有资源文件的、从文件名到文件数据的映射容器
+	PakRecordIndex			mPakRecordIndex;		// hashed lookup into mPakRecordMap
+	bool					mMapPakFiles;			// map .pak files and decode on read instead of loading them
+	bool					mIndexDirs;				// FExists answers for disk files from directory listings
+	PakDirListingMap		mDirListings;			// by directory, '/' separated and ending in '/'
+	SDL_mutex*				mDirListingsMutex;
+	int						mSkippedOpens;			// FExists calls that saved a failed open
 
 public:
 	//bool					PFindNext(PFindData* theFindData, LPWIN32_FIND_DATA lpFindFileData);
 
+protected:
+	PakRecord*				AddRecord(const std::string& theKey);
+	bool					LoadBlock(PFILE* theFile, int theBlock);
+	bool					FillWindow(PFILE* theFile);
+	int						ReadBytes(PFILE* theFile, void* theDest, int theSize);
+	int						GetByte(PFILE* theFile);
+	static void				SplitDiskPath(const char* theFileName, std::string& theDir, std::string& theName);
+
 public:
 	PakInterface();
 	~PakInterface();
@@ -94,13 +194,22 @@ public:
 	bool					AddPakFile(const std::string& theFileName);
 	PFILE*					FOpen(const char* theFileName, const char* theAccess);
 	int						FClose(PFILE* theFile);
-	int						FSeek(PFILE* theFile, long theOffset, int theOrigin);
-	int						FTell(PFILE* theFile);
+	int						FSeek(PFILE* theFile, int64_t theOffset, int theOrigin);
+	int64_t					FTell(PFILE* theFile);
 	size_t					FRead(void* thePtr, int theElemSize, int theCount, PFILE* theFile);
 	int						FGetC(PFILE* theFile);
 	int						UnGetC(int theChar, PFILE* theFile);
 	char*					FGetS(char* thePtr, int theSize, PFILE* theFile);
 	int						FEof(PFILE* theFile);
+	// The whole of a pak record when it sits in memory as is (paks loaded rather than mapped),
+	// NULL for anything else.
+	const uint8_t*			FGetData(PFILE* theFile, int64_t* theSize);
+	// Whether FOpen could open theFileName for reading, without touching the disk after the
+	// first look in its directory.  Files opened for writing through FOpen are picked up, ones
+	// made any other way after that first look aren't until ClearDirListings.
+	bool					FExists(const char* theFileName);
+	void					ClearDirListings();
+	int						GetSkippedOpens() { return mSkippedOpens; }
 
 	/*
 	HANDLE					FindFirstFile(LPCTSTR lpFileName, LPWIN32_FIND_DATA lpFindFileData);
@@ -164,6 +273,12 @@ static PFILE* p_fopen(const wchar_t* theFileName, const wchar_t* theAccess)
 }
 */
 
+[[maybe_unused]]
+static bool p_fexists(const char* theFileName)
+{
+	return gPakInterface->FExists(theFileName);
+}
+
 [[maybe_unused]]
 static int p_fclose(PFILE* theFile)
 {
@@ -178,7 +293,7 @@ static int p_fclose(PFILE* theFile)
 }
 
 [[maybe_unused]]
-static int p_fseek(PFILE* theFile, long theOffset, int theOrigin)
+static int p_fseek(PFILE* theFile, int64_t theOffset, int theOrigin)
 {
 	/*
 	if (GetPakPtr() != NULL)
@@ -189,7 +304,7 @@ static int p_fseek(PFILE* theFile, long theOffset, int theOrigin)
 }
 
 [[maybe_unused]]
-static int p_ftell(PFILE* theFile)
+static int64_t p_ftell(PFILE* theFile)
 {
 	/*
 	if (GetPakPtr() != NULL)
@@ -207,6 +322,14 @@ static size_t p_fread(void* thePtr, int theSize, int theCount, PFILE* theFile)
 		return (*gPakInterfaceP)->FRead(thePtr, theSize, theCount, theFile);
 	return fread(thePtr, theSize, theCount, theFile->mFP);
 	*/
+	// Small reads are served straight from the window
+	int aSizeBytes = theSize * theCount;
+	if ((aSizeBytes > 0) && (aSizeBytes <= theFile->WindowLeft()))
+	{
+		memcpy(thePtr, theFile->mWindow + (theFile->mPos - theFile->mWindowPos), aSizeBytes);
+		theFile->mPos += aSizeBytes;
+		return theCount;
+	}
 	return gPakInterface->FRead(thePtr, theSize, theCount, theFile);
 }
 
@@ -226,6 +349,15 @@ static int p_fgetc(PFILE* theFile)
 		return (*gPakInterfaceP)->FGetC(theFile);
 	return fgetc(theFile->mFP);
 	*/
+	if (theFile->WindowLeft() > 0)
+	{
+		uint8_t aByte = theFile->mWindow[theFile->mPos - theFile->mWindowPos];
+		if ((aByte != '\r') || (!theFile->mStripCR))
+		{
+			theFile->mPos++;
+			return aByte;
+		}
+	}
 	return gPakInterface->FGetC(theFile);
 }
 
@@ -272,6 +404,12 @@ static int p_feof(PFILE* theFile)
 	return gPakInterface->FEof(theFile);
 }
 
+[[maybe_unused]]
+static const uint8_t* p_fdata(PFILE* theFile, int64_t* theSize)
+{
+	return gPakInterface->FGetData(theFile, theSize);
+}
+
 /*
 [[maybe_unused]]
 static HANDLE p_FindFirstFile(LPCTSTR lpFileName, LPWIN32_FIND_DATA lpFindFileData)
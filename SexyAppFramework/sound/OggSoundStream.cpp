@@ -0,0 +1,197 @@
+#include "OggSoundStream.h"
+#include "Common.h"
+#include "paklib/PakInterface.h"
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+
+using namespace Sexy;
+
+static size_t PakRead(void* thePtr, size_t theSize, size_t theCount, void* theFile)
+{
+	return p_fread(thePtr, (int) theSize, (int) theCount, (PFILE*) theFile);
+}
+
+static int PakSeek(void* theFile, ogg_int64_t theOffset, int theOrigin)
+{
+	return p_fseek((PFILE*) theFile, theOffset, theOrigin);
+}
+
+static int PakClose(void* theFile)
+{
+	return p_fclose((PFILE*) theFile);
+}
+
+static long PakTell(void* theFile)
+{
+	return p_ftell((PFILE*) theFile);
+}
+
+OggSoundStream::OggSoundStream()
+{
+	mFile = NULL;
+	mOpen = false;
+	mChannels = 0;
+	mRate = 0;
+	mLooping = false;
+	mReadFrame = 0;
+	mWriteFrame = 0;
+	mDecodeEnded = false;
+	mMutex = SDL_CreateMutex();
+}
+
+OggSoundStream::~OggSoundStream()
+{
+	// ov_clear closes mFile too
+	if (mOpen)
+		ov_clear(&mVorbisFile);
+	else if (mFile != NULL)
+		p_fclose(mFile);
+
+	SDL_DestroyMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Takes theFile over whether it succeeds or not.  Only 16 bit mono or stereo
+// comes out of SoundMixer, so other channel counts are turned down here.
+///////////////////////////////////////////////////////////////////////////////
+bool OggSoundStream::OpenVorbis(PFILE* theFile)
+{
+	ov_callbacks aCallbacks = { PakRead, PakSeek, PakClose, PakTell };
+
+	mFile = theFile;
+	if (ov_open_callbacks(theFile, &mVorbisFile, NULL, 0, aCallbacks) < 0)
+		return false;
+	mOpen = true;
+
+	vorbis_info* anInfo = ov_info(&mVorbisFile, -1);
+	if ((anInfo == NULL) || ((anInfo->channels != 1) && (anInfo->channels != 2)) || (anInfo->rate <= 0))
+		return false;
+
+	mChannels = anInfo->channels;
+	mRate = anInfo->rate;
+	return true;
+}
+
+bool OggSoundStream::Open(const std::string& theFileName, bool looping)
+{
+	PFILE* aFile = p_fopen(theFileName.c_str(), "rb");
+	if ((aFile == NULL) || (!OpenVorbis(aFile)))
+		return false;
+
+	mLooping = looping;
+	mRing.resize(RING_FRAMES * mChannels);
+	Decode(PRIME_FRAMES);
+	return true;
+}
+
+bool OggSoundStream::GetInfo(const std::string& theFileName, int* theChannels, int* theRate)
+{
+	PFILE* aFile = p_fopen(theFileName.c_str(), "rb");
+	if (aFile == NULL)
+		return false;
+
+	OggSoundStream aStream;
+	if (!aStream.OpenVorbis(aFile))
+		return false;
+
+	*theChannels = aStream.mChannels;
+	*theRate = aStream.mRate;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Each block is published as soon as it's in, so a stream that's just been
+// started has something to play long before the ring is full.  A looping
+// stream that hits the end twice without decoding anything is given up on.
+///////////////////////////////////////////////////////////////////////////////
+bool OggSoundStream::Decode(int theMaxFrames)
+{
+	SDL_LockMutex(mMutex);
+	int64_t aReadFrame = mReadFrame;
+	bool ended = mDecodeEnded;
+	SDL_UnlockMutex(mMutex);
+
+	if ((ended) || (!mOpen))
+		return false;
+
+	int16_t aBuffer[DECODE_BYTES / sizeof(int16_t)];
+	int aFrameBytes = mChannels * sizeof(int16_t);
+	bool decodedSinceLoop = true;
+
+	while (mWriteFrame - aReadFrame + DECODE_BYTES / aFrameBytes <= theMaxFrames)
+	{
+		int aBitstream;
+		long aBytes = ov_read(&mVorbisFile, (char*) aBuffer, DECODE_BYTES, &aBitstream);
+
+		if (aBytes == OV_HOLE)
+			continue;
+
+		if (aBytes == 0)
+		{
+			if ((mLooping) && (decodedSinceLoop) && (ov_pcm_seek(&mVorbisFile, 0) == 0))
+			{
+				decodedSinceLoop = false;
+				continue;
+			}
+			ended = true;
+		}
+		else if ((aBytes < 0) || (ov_info(&mVorbisFile, -1)->channels != mChannels))
+			ended = true;
+
+		if (ended)
+			break;
+
+		decodedSinceLoop = true;
+
+		int aFrames = (int) aBytes / aFrameBytes;
+		int anOffset = (int)(mWriteFrame % RING_FRAMES);
+		int aFirst = std::min(aFrames, RING_FRAMES - anOffset);
+		memcpy(&mRing[anOffset * mChannels], aBuffer, aFirst * aFrameBytes);
+		memcpy(&mRing[0], aBuffer + aFirst * mChannels, (aFrames - aFirst) * aFrameBytes);
+
+		SDL_LockMutex(mMutex);
+		mWriteFrame += aFrames;
+		aReadFrame = mReadFrame;
+		SDL_UnlockMutex(mMutex);
+	}
+
+	if (ended)
+	{
+		SDL_LockMutex(mMutex);
+		mDecodeEnded = true;
+		SDL_UnlockMutex(mMutex);
+	}
+
+	return !ended;
+}
+
+int OggSoundStream::Read(int16_t* theDest, int theMaxFrames)
+{
+	SDL_LockMutex(mMutex);
+	int aFrames = (int) std::min<int64_t>(theMaxFrames, mWriteFrame - mReadFrame);
+	int64_t aReadFrame = mReadFrame;
+	SDL_UnlockMutex(mMutex);
+
+	if (aFrames <= 0)
+		return 0;
+
+	int anOffset = (int)(aReadFrame % RING_FRAMES);
+	int aFirst = std::min(aFrames, RING_FRAMES - anOffset);
+	memcpy(theDest, &mRing[anOffset * mChannels], aFirst * mChannels * sizeof(int16_t));
+	memcpy(theDest + aFirst * mChannels, &mRing[0], (aFrames - aFirst) * mChannels * sizeof(int16_t));
+
+	SDL_LockMutex(mMutex);
+	mReadFrame += aFrames;
+	SDL_UnlockMutex(mMutex);
+
+	return aFrames;
+}
+
+bool OggSoundStream::IsFinished()
+{
+	SDL_LockMutex(mMutex);
+	bool finished = (mDecodeEnded) && (mReadFrame == mWriteFrame);
+	SDL_UnlockMutex(mMutex);
+	return finished;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "SoundMixer.h"
+#include "ogg/ivorbiscodec.h"
+#include "ogg/ivorbisfile.h"
+
+#include <string>
+#include <vector>
+
+struct PFILE;
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Decodes an Ogg Vorbis file through PakInterface a little at a time, so a
+// long sound only ever holds RING_FRAMES of samples.  Decode runs on
+// SDLSoundManager's stream thread and tops up the ring, SoundMixer's Read
+// empties it from the audio thread.  Only the two positions are shared, the
+// samples between them belong to whichever side is due to touch them next.
+//
+// Samples come out as Tremor decodes them: 16 bit, in the file's own channel
+// count and rate.  A looping stream goes back to the start by itself.
+///////////////////////////////////////////////////////////////////////////////
+class OggSoundStream : public SoundMixerStream
+{
+public:
+	enum
+	{
+		RING_FRAMES = 16384,
+		PRIME_FRAMES = 4096,			// decoded by Open so the first mix isn't kept waiting
+		DECODE_BYTES = 4096				// most ov_read is asked for at once
+	};
+
+	PFILE*					mFile;
+	OggVorbis_File			mVorbisFile;
+	bool					mOpen;
+	int						mChannels;
+	int						mRate;
+	bool					mLooping;
+
+	// Frame N lives at mRing[(N % RING_FRAMES) * mChannels] while mReadFrame <= N < mWriteFrame
+	std::vector<int16_t>	mRing;
+	int64_t					mReadFrame;
+	int64_t					mWriteFrame;
+	bool					mDecodeEnded;	// no more will be written
+	SDL_mutex*				mMutex;			// guards the two positions and mDecodeEnded
+
+protected:
+	bool					OpenVorbis(PFILE* theFile);
+
+public:
+	OggSoundStream();
+	virtual ~OggSoundStream();
+
+	bool					Open(const std::string& theFileName, bool looping);
+
+	// Decodes until theMaxFrames are waiting or the sound ends, and returns
+	// whether there's any more to come
+	bool					Decode(int theMaxFrames = RING_FRAMES);
+
+	virtual int				Read(int16_t* theDest, int theMaxFrames);
+	virtual bool			IsFinished();
+
+	// Reads just the headers, to check a file can be streamed
+	static bool				GetInfo(const std::string& theFileName, int* theChannels, int* theRate);
+};
+
+}
@@ -0,0 +1,416 @@
+#include "sound/ResampleKernels.h"
+#include "misc/CPUFeatures.h"
+
+using namespace Sexy;
+
+static const int RESAMPLE_ONE = 1 << 14;
+
+///////////////////////////////////////////////////////////////////////////////
+// Weights for the taps from k-1 to k+2 (cubic) or k to k+1 (linear).  They
+// are worked out from the top 16 bits of the position's fraction in integers,
+// the same steps the vector code takes, and rounded to 14 bits; the weight on
+// frame k takes up the rounding so they always add up to exactly one.
+///////////////////////////////////////////////////////////////////////////////
+static inline void GetWeights(uint64_t thePos, ResampleMode theMode, int* theWeights)
+{
+	int t = (int)(thePos >> 16) & 0xFFFF;
+
+	if (theMode != RESAMPLE_CUBIC)
+	{
+		theWeights[1] = (t + 2) >> 2;
+		theWeights[0] = RESAMPLE_ONE - theWeights[1];
+		return;
+	}
+
+	int t2 = (int)(((uint32_t) t * t) >> 16);
+	int t3 = (int)(((uint32_t) t2 * t) >> 16);
+	theWeights[0] = (2*t2 - t3 - t + 4) >> 3;
+	theWeights[2] = (4*t2 - 3*t3 + t + 4) >> 3;
+	theWeights[3] = (t3 - t2 + 4) >> 3;
+	theWeights[1] = RESAMPLE_ONE - theWeights[0] - theWeights[2] - theWeights[3];
+}
+
+static inline int TapIndex(int theIndex, int theFrames, bool looping)
+{
+	if ((theIndex >= 0) && (theIndex < theFrames))
+		return theIndex;
+
+	if (!looping)
+		return (theIndex < 0) ? 0 : theFrames - 1;
+
+	theIndex %= theFrames;
+	return (theIndex < 0) ? theIndex + theFrames : theIndex;
+}
+
+// How many frames from thePos on are still before theLimit, at most theMax
+static inline int CountBefore(uint64_t thePos, uint64_t theStep, uint64_t theLimit, int theMax)
+{
+	if (thePos >= theLimit)
+		return 0;
+
+	uint64_t aCount = (theLimit - thePos + theStep - 1) / theStep;
+	return (aCount < (uint64_t) theMax) ? (int) aCount : theMax;
+}
+
+// The gains are already scaled for the weights, and halved for a mono output
+static inline void Accumulate(float* theDest, int theDestChannels, int theFrame, float theLeft, float theRight, float theGainLeft, float theGainRight)
+{
+	if (theDestChannels == 2)
+	{
+		theDest[theFrame*2] += theLeft * theGainLeft;
+		theDest[theFrame*2+1] += theRight * theGainRight;
+	}
+	else
+		theDest[theFrame] += theLeft * theGainLeft + theRight * theGainRight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The scalar versions fetch every tap through TapIndex, so they also do the
+// frames near the ends of the data that the vector versions leave alone.
+///////////////////////////////////////////////////////////////////////////////
+static void ResampleInt16Scalar(float* theDest, int theDestChannels, const int16_t* theSrc, int theSrcChannels, int theSrcFrames, bool looping,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	int aTaps = (theMode == RESAMPLE_CUBIC) ? 4 : 2;
+	int aFirstTap = (theMode == RESAMPLE_CUBIC) ? -1 : 0;
+
+	for (int i = 0; i < theCount; i++, thePos += theStep)
+	{
+		int aWeights[4];
+		GetWeights(thePos, theMode, aWeights);
+
+		int k = (int)(thePos >> 32) + aFirstTap;
+		int aLeft = 0;
+		int aRight = 0;
+		for (int j = 0; j < aTaps; j++)
+		{
+			const int16_t* aFrame = theSrc + TapIndex(k + j, theSrcFrames, looping) * theSrcChannels;
+			aLeft += aFrame[0] * aWeights[j];
+			aRight += aFrame[theSrcChannels - 1] * aWeights[j];
+		}
+
+		Accumulate(theDest, theDestChannels, i, (float) aLeft, (float) aRight, theGainLeft, theGainRight);
+	}
+}
+
+static void ResampleFloatScalar(float* theDest, int theDestChannels, const float* theSrc, int theSrcChannels, int theSrcFrames, bool looping,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	for (int i = 0; i < theCount; i++, thePos += theStep)
+	{
+		int aWeights[4];
+		GetWeights(thePos, theMode, aWeights);
+
+		int k = (int)(thePos >> 32);
+		float aSums[2];
+		for (int c = 0; c < 2; c++)
+		{
+			int aChannel = (c < theSrcChannels) ? c : 0;
+			if (theMode == RESAMPLE_CUBIC)
+			{
+				float t0 = theSrc[TapIndex(k - 1, theSrcFrames, looping) * theSrcChannels + aChannel];
+				float t1 = theSrc[TapIndex(k, theSrcFrames, looping) * theSrcChannels + aChannel];
+				float t2 = theSrc[TapIndex(k + 1, theSrcFrames, looping) * theSrcChannels + aChannel];
+				float t3 = theSrc[TapIndex(k + 2, theSrcFrames, looping) * theSrcChannels + aChannel];
+				aSums[c] = (t0 * (float) aWeights[0] + t1 * (float) aWeights[1]) + (t2 * (float) aWeights[2] + t3 * (float) aWeights[3]);
+			}
+			else
+			{
+				float t0 = theSrc[TapIndex(k, theSrcFrames, looping) * theSrcChannels + aChannel];
+				float t1 = theSrc[TapIndex(k + 1, theSrcFrames, looping) * theSrcChannels + aChannel];
+				aSums[c] = t0 * (float) aWeights[0] + t1 * (float) aWeights[1];
+			}
+		}
+
+		Accumulate(theDest, theDestChannels, i, aSums[0], aSums[1], theGainLeft, theGainRight);
+	}
+}
+
+#if defined(SEXY_SIMD_X86)
+
+static inline int32_t Load32(const int16_t* theSrc)
+{
+	int32_t aValue;
+	memcpy(&aValue, theSrc, sizeof(aValue));
+	return aValue;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GetWeights for four frames at once, from the low 32 bits of their
+// positions.  Linear leaves (w0, w1) in theWeights[0] and [1], cubic
+// (w-1, w0, w1, w2) in [0] to [3].  mulhi_epu16 is the 16x16 multiply, as the
+// upper half of every 32 bit lane is zero.
+///////////////////////////////////////////////////////////////////////////////
+static inline SEXY_TARGET_SSE2 void GetWeightsSSE2(__m128i theFractions, ResampleMode theMode, __m128i* theWeights)
+{
+	const __m128i aOne = _mm_set1_epi32(RESAMPLE_ONE);
+	const __m128i aRound = _mm_set1_epi32(4);
+	__m128i t = _mm_srli_epi32(theFractions, 16);
+
+	if (theMode != RESAMPLE_CUBIC)
+	{
+		theWeights[1] = _mm_srli_epi32(_mm_add_epi32(t, _mm_set1_epi32(2)), 2);
+		theWeights[0] = _mm_sub_epi32(aOne, theWeights[1]);
+		return;
+	}
+
+	__m128i t2 = _mm_mulhi_epu16(t, t);
+	__m128i t3 = _mm_mulhi_epu16(t2, t);
+	theWeights[0] = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_sub_epi32(_mm_slli_epi32(t2, 1), t3), t), aRound), 3);
+	theWeights[2] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(t2, 2), _mm_add_epi32(_mm_slli_epi32(t3, 1), t3)), t), aRound), 3);
+	theWeights[3] = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(t3, t2), aRound), 3);
+	theWeights[1] = _mm_sub_epi32(_mm_sub_epi32(_mm_sub_epi32(aOne, theWeights[0]), theWeights[2]), theWeights[3]);
+}
+
+// Packs two weights per lane, theFirst in the low 16 bits, for _mm_madd_epi16
+static inline SEXY_TARGET_SSE2 __m128i PackWeightsSSE2(__m128i theFirst, __m128i theSecond)
+{
+	return _mm_or_si128(_mm_and_si128(theFirst, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(theSecond, 16));
+}
+
+static inline SEXY_TARGET_SSE2 __m128i GetFractionsSSE2(uint64_t thePos, uint64_t theStep)
+{
+	uint32_t aPos = (uint32_t) thePos;
+	uint32_t aStep = (uint32_t) theStep;
+	return _mm_setr_epi32((int) aPos, (int)(aPos + aStep), (int)(aPos + aStep*2), (int)(aPos + aStep*3));
+}
+
+static inline SEXY_TARGET_SSE2 void AccumulateSSE2(float* theDest, int theDestChannels, __m128 theLeft, __m128 theRight, float theGainLeft, float theGainRight)
+{
+	__m128 aLeft = _mm_mul_ps(theLeft, _mm_set1_ps(theGainLeft));
+	__m128 aRight = _mm_mul_ps(theRight, _mm_set1_ps(theGainRight));
+
+	if (theDestChannels == 2)
+	{
+		_mm_storeu_ps(theDest, _mm_add_ps(_mm_loadu_ps(theDest), _mm_unpacklo_ps(aLeft, aRight)));
+		_mm_storeu_ps(theDest + 4, _mm_add_ps(_mm_loadu_ps(theDest + 4), _mm_unpackhi_ps(aLeft, aRight)));
+	}
+	else
+		_mm_storeu_ps(theDest, _mm_add_ps(_mm_loadu_ps(theDest), _mm_add_ps(aLeft, aRight)));
+}
+
+// Adds the odd lanes of two madd results to the even ones: (a0+a1, a2+a3, b0+b1, b2+b3)
+static inline SEXY_TARGET_SSE2 __m128i AddPairsSSE2(__m128i a, __m128i b)
+{
+	__m128 aEven = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0));
+	__m128 anOdd = _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1));
+	return _mm_add_epi32(_mm_castps_si128(aEven), _mm_castps_si128(anOdd));
+}
+
+// Splits interleaved (L0 R0 L1 R1) (L2 R2 L3 R3) sums into left and right
+static inline SEXY_TARGET_SSE2 void SplitFramesSSE2(__m128i theFrames01, __m128i theFrames23, __m128* theLeft, __m128* theRight)
+{
+	__m128 aFrames01 = _mm_cvtepi32_ps(theFrames01);
+	__m128 aFrames23 = _mm_cvtepi32_ps(theFrames23);
+	*theLeft = _mm_shuffle_ps(aFrames01, aFrames23, _MM_SHUFFLE(2, 0, 2, 0));
+	*theRight = _mm_shuffle_ps(aFrames01, aFrames23, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Four output frames at a time, all of whose taps are inside the data.  The
+// taps of a frame are loaded together and arranged so each channel's sit
+// next to each other, then weighted and summed by _mm_madd_epi16.  Returns
+// how many frames were done.
+///////////////////////////////////////////////////////////////////////////////
+static SEXY_TARGET_SSE2 int ResampleInt16SSE2(float* theDest, int theDestChannels, const int16_t* theSrc, int theSrcChannels,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	const __m128i aFractionStep = _mm_set1_epi32((int)(uint32_t)(theStep * 4));
+	__m128i aFractions = GetFractionsSSE2(thePos, theStep);
+	bool isStereo = theSrcChannels == 2;
+
+	int i = 0;
+	for (; i + 4 <= theCount; i += 4)
+	{
+		__m128i w[4];
+		GetWeightsSSE2(aFractions, theMode, w);
+		aFractions = _mm_add_epi32(aFractions, aFractionStep);
+
+		int k0 = (int)(thePos >> 32);
+		int k1 = (int)((thePos + theStep) >> 32);
+		int k2 = (int)((thePos + theStep*2) >> 32);
+		int k3 = (int)((thePos + theStep*3) >> 32);
+		thePos += theStep * 4;
+
+		__m128 aLeft;
+		__m128 aRight;
+		if (theMode == RESAMPLE_CUBIC)
+		{
+			// (w-1 w0) (w1 w2) for frames 0 and 1, then 2 and 3
+			__m128i aPairs01 = PackWeightsSSE2(w[0], w[1]);
+			__m128i aPairs23 = PackWeightsSSE2(w[2], w[3]);
+			__m128i aWeights01 = _mm_unpacklo_epi32(aPairs01, aPairs23);
+			__m128i aWeights23 = _mm_unpackhi_epi32(aPairs01, aPairs23);
+
+			if (isStereo)
+			{
+				// L-1 R-1 L0 R0 L1 R1 L2 R2 -> L-1 L0 L1 L2 R-1 R0 R1 R2, each madd
+				// then gives a frame's two halves of left and of right
+				const int16_t* aSrc = theSrc - 2;
+				__m128i aTaps[4];
+				aTaps[0] = _mm_loadu_si128((const __m128i*)(aSrc + k0 * 2));
+				aTaps[1] = _mm_loadu_si128((const __m128i*)(aSrc + k1 * 2));
+				aTaps[2] = _mm_loadu_si128((const __m128i*)(aSrc + k2 * 2));
+				aTaps[3] = _mm_loadu_si128((const __m128i*)(aSrc + k3 * 2));
+				for (int j = 0; j < 4; j++)
+					aTaps[j] = _mm_shuffle_epi32(_mm_shufflehi_epi16(_mm_shufflelo_epi16(aTaps[j], _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+
+				__m128i aSums01 = AddPairsSSE2(_mm_madd_epi16(aTaps[0], _mm_unpacklo_epi64(aWeights01, aWeights01)), _mm_madd_epi16(aTaps[1], _mm_unpackhi_epi64(aWeights01, aWeights01)));
+				__m128i aSums23 = AddPairsSSE2(_mm_madd_epi16(aTaps[2], _mm_unpacklo_epi64(aWeights23, aWeights23)), _mm_madd_epi16(aTaps[3], _mm_unpackhi_epi64(aWeights23, aWeights23)));
+				SplitFramesSSE2(aSums01, aSums23, &aLeft, &aRight);
+			}
+			else
+			{
+				const int16_t* aSrc = theSrc - 1;
+				__m128i aTaps01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(aSrc + k0)), _mm_loadl_epi64((const __m128i*)(aSrc + k1)));
+				__m128i aTaps23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(aSrc + k2)), _mm_loadl_epi64((const __m128i*)(aSrc + k3)));
+				aLeft = _mm_cvtepi32_ps(AddPairsSSE2(_mm_madd_epi16(aTaps01, aWeights01), _mm_madd_epi16(aTaps23, aWeights23)));
+				aRight = aLeft;
+			}
+		}
+		else
+		{
+			__m128i aPairs = PackWeightsSSE2(w[0], w[1]);
+
+			if (isStereo)
+			{
+				// L0 R0 L1 R1 -> L0 L1 R0 R1
+				__m128i aTaps01 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(theSrc + k0 * 2)), _mm_loadl_epi64((const __m128i*)(theSrc + k1 * 2)));
+				__m128i aTaps23 = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(theSrc + k2 * 2)), _mm_loadl_epi64((const __m128i*)(theSrc + k3 * 2)));
+				aTaps01 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(aTaps01, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+				aTaps23 = _mm_shufflehi_epi16(_mm_shufflelo_epi16(aTaps23, _MM_SHUFFLE(3, 1, 2, 0)), _MM_SHUFFLE(3, 1, 2, 0));
+
+				__m128i aSums01 = _mm_madd_epi16(aTaps01, _mm_unpacklo_epi32(aPairs, aPairs));
+				__m128i aSums23 = _mm_madd_epi16(aTaps23, _mm_unpackhi_epi32(aPairs, aPairs));
+				SplitFramesSSE2(aSums01, aSums23, &aLeft, &aRight);
+			}
+			else
+			{
+				__m128i aTaps = _mm_setr_epi32(Load32(theSrc + k0), Load32(theSrc + k1), Load32(theSrc + k2), Load32(theSrc + k3));
+				aLeft = _mm_cvtepi32_ps(_mm_madd_epi16(aTaps, aPairs));
+				aRight = aLeft;
+			}
+		}
+
+		AccumulateSSE2(theDest + i * theDestChannels, theDestChannels, aLeft, aRight, theGainLeft, theGainRight);
+	}
+	return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Float taps can't be paired up like 16 bit ones, so they're gathered one
+// tap at a time across four frames and summed in the scalar version's order.
+///////////////////////////////////////////////////////////////////////////////
+static SEXY_TARGET_SSE2 int ResampleFloatSSE2(float* theDest, int theDestChannels, const float* theSrc, int theSrcChannels,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	const __m128i aFractionStep = _mm_set1_epi32((int)(uint32_t)(theStep * 4));
+	__m128i aFractions = GetFractionsSSE2(thePos, theStep);
+	int aTaps = (theMode == RESAMPLE_CUBIC) ? 4 : 2;
+	int aFirstTap = (theMode == RESAMPLE_CUBIC) ? -1 : 0;
+	int aRightOffset = theSrcChannels - 1;
+
+	int i = 0;
+	for (; i + 4 <= theCount; i += 4)
+	{
+		__m128i w[4];
+		GetWeightsSSE2(aFractions, theMode, w);
+		aFractions = _mm_add_epi32(aFractions, aFractionStep);
+
+		const float* aFrames[4];
+		for (int j = 0; j < 4; j++, thePos += theStep)
+			aFrames[j] = theSrc + ((int)(thePos >> 32) + aFirstTap) * theSrcChannels;
+
+		__m128 aSums[2];
+		for (int c = 0; c < 2; c++)
+		{
+			int anOffset = c * aRightOffset;
+			__m128 aProducts[4];
+			for (int t = 0; t < aTaps; t++)
+			{
+				int aTapOffset = t * theSrcChannels + anOffset;
+				__m128 aTap = _mm_setr_ps(aFrames[0][aTapOffset], aFrames[1][aTapOffset], aFrames[2][aTapOffset], aFrames[3][aTapOffset]);
+				aProducts[t] = _mm_mul_ps(aTap, _mm_cvtepi32_ps(w[t]));
+			}
+
+			if (theMode == RESAMPLE_CUBIC)
+				aSums[c] = _mm_add_ps(_mm_add_ps(aProducts[0], aProducts[1]), _mm_add_ps(aProducts[2], aProducts[3]));
+			else
+				aSums[c] = _mm_add_ps(aProducts[0], aProducts[1]);
+		}
+
+		AccumulateSSE2(theDest + i * theDestChannels, theDestChannels, aSums[0], aSums[1], theGainLeft, theGainRight);
+	}
+	return i;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Splits the frames into those near the start whose taps reach back before
+// it, the run whose taps are all inside the data, and the rest.  Only the
+// middle run goes to the vector code.
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::ResampleInt16(float* theDest, int theDestChannels, const int16_t* theSrc, int theSrcChannels, int theSrcFrames, bool looping,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	float aScale = (theDestChannels == 2) ? 1.0f / RESAMPLE_ONE : 0.5f / RESAMPLE_ONE;
+	float aGainLeft = theGainLeft * aScale;
+	float aGainRight = theGainRight * aScale;
+
+	int aTapsBefore = (theMode == RESAMPLE_CUBIC) ? 1 : 0;
+	int aTapsAfter = (theMode == RESAMPLE_CUBIC) ? 2 : 1;
+
+	int aHead = CountBefore(thePos, theStep, (uint64_t) aTapsBefore << 32, theCount);
+	ResampleInt16Scalar(theDest, theDestChannels, theSrc, theSrcChannels, theSrcFrames, looping, thePos, theStep, aHead, aGainLeft, aGainRight, theMode);
+
+	int i = aHead;
+	thePos += aHead * theStep;
+
+	int aSafe = (theSrcFrames > aTapsAfter) ? CountBefore(thePos, theStep, (uint64_t)(theSrcFrames - aTapsAfter) << 32, theCount - i) : 0;
+	int aDone = 0;
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2:
+	case SIMDLevel_SSE2: aDone = ResampleInt16SSE2(theDest + i * theDestChannels, theDestChannels, theSrc, theSrcChannels, thePos, theStep, aSafe, aGainLeft, aGainRight, theMode); break;
+#endif
+	default: break;
+	}
+
+	i += aDone;
+	thePos += aDone * theStep;
+	ResampleInt16Scalar(theDest + i * theDestChannels, theDestChannels, theSrc, theSrcChannels, theSrcFrames, looping, thePos, theStep, theCount - i, aGainLeft, aGainRight, theMode);
+}
+
+void Sexy::ResampleFloat(float* theDest, int theDestChannels, const float* theSrc, int theSrcChannels, int theSrcFrames, bool looping,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	float aScale = (theDestChannels == 2) ? 1.0f / RESAMPLE_ONE : 0.5f / RESAMPLE_ONE;
+	float aGainLeft = theGainLeft * aScale;
+	float aGainRight = theGainRight * aScale;
+
+	int aTapsBefore = (theMode == RESAMPLE_CUBIC) ? 1 : 0;
+	int aTapsAfter = (theMode == RESAMPLE_CUBIC) ? 2 : 1;
+
+	int aHead = CountBefore(thePos, theStep, (uint64_t) aTapsBefore << 32, theCount);
+	ResampleFloatScalar(theDest, theDestChannels, theSrc, theSrcChannels, theSrcFrames, looping, thePos, theStep, aHead, aGainLeft, aGainRight, theMode);
+
+	int i = aHead;
+	thePos += aHead * theStep;
+
+	int aSafe = (theSrcFrames > aTapsAfter) ? CountBefore(thePos, theStep, (uint64_t)(theSrcFrames - aTapsAfter) << 32, theCount - i) : 0;
+	int aDone = 0;
+	switch (GetSIMDLevel())
+	{
+#if defined(SEXY_SIMD_X86)
+	case SIMDLevel_AVX2:
+	case SIMDLevel_SSE2: aDone = ResampleFloatSSE2(theDest + i * theDestChannels, theDestChannels, theSrc, theSrcChannels, thePos, theStep, aSafe, aGainLeft, aGainRight, theMode); break;
+#endif
+	default: break;
+	}
+
+	i += aDone;
+	thePos += aDone * theStep;
+	ResampleFloatScalar(theDest + i * theDestChannels, theDestChannels, theSrc, theSrcChannels, theSrcFrames, looping, thePos, theStep, theCount - i, aGainLeft, aGainRight, theMode);
+}
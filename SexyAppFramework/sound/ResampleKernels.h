@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Common.h"
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Resampling for SoundMixer, using the best SIMD level available at runtime.
+// Results are identical at every level.
+//
+// Positions and steps are in source frames, 32.32 fixed point.  Each output
+// frame is interpolated from the source frames around its position, weighted
+// by 14 bit fixed point weights: two taps for RESAMPLE_LINEAR, four for
+// RESAMPLE_CUBIC (Catmull-Rom).  Taps before the start or past the end of
+// the data wrap around when looping and repeat the end frame otherwise.
+//
+// Output is added into theDest, interleaved in theDestChannels (1 or 2), the
+// left side scaled by theGainLeft and the right by theGainRight.  A mono
+// source plays on both sides, a stereo source going to a mono output is
+// averaged.  Sources are 1 or 2 channels, and float ones are on the same
+// scale as 16 bit ones rather than -1 to 1.
+///////////////////////////////////////////////////////////////////////////////
+
+enum ResampleMode
+{
+	RESAMPLE_LINEAR,
+	RESAMPLE_CUBIC
+};
+
+void				ResampleInt16(float* theDest, int theDestChannels, const int16_t* theSrc, int theSrcChannels, int theSrcFrames, bool looping,
+						uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode);
+
+void				ResampleFloat(float* theDest, int theDestChannels, const float* theSrc, int theSrcChannels, int theSrcFrames, bool looping,
+						uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode);
+
+}
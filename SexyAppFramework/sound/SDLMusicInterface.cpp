@@ -1,4 +1,5 @@
 #include "SDLMusicInterface.h"
+#include "SDLMusicStream.h"
 #include "paklib/PakInterface.h"
 
 using namespace Sexy;
@@ -53,7 +54,14 @@ bool SDLMusicInterface::LoadMusic(int theSongId, const std::string& theFileName)
 		delete[] aData;
 	}
 	*/
-	aHMusic = Mix_LoadMUS(theFileName.c_str());
+
+	// Stream through PakInterface so songs can live in a pak, falling back to
+	// SDL_mixer's own loader for anything the stream can't open
+	SDL_RWops* aRW = SDLMusicStream::CreateRW(theFileName);
+	if (aRW != NULL)
+		aHMusic = Mix_LoadMUS_RW(aRW, 1);
+	if (aHMusic == NULL)
+		aHMusic = Mix_LoadMUS(theFileName.c_str());
 
 	if (aHMusic==0)
 		return false;
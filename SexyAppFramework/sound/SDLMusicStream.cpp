@@ -0,0 +1,296 @@
+#include "SDLMusicStream.h"
+#include "Common.h"
+#include "paklib/PakInterface.h"
+
+#include <algorithm>
+
+using namespace Sexy;
+
+SDLMusicStream::SDLMusicStream(PFILE* theFile)
+{
+	mFile = theFile;
+	mSize = 0;
+	mReadPos = 0;
+	mHeadSize = 0;
+	mRingStart = 0;
+	mRingEnd = 0;
+	mRingGeneration = 0;
+	mReadFailed = false;
+	mFilePos = 0;
+	mMutex = NULL;
+	mFillCond = NULL;
+	mDataCond = NULL;
+	mThread = NULL;
+	mShutdown = false;
+	mStalls = 0;
+}
+
+SDLMusicStream::~SDLMusicStream()
+{
+	if (mThread != NULL)
+	{
+		SDL_LockMutex(mMutex);
+		mShutdown = true;
+		SDL_CondSignal(mFillCond);
+		SDL_UnlockMutex(mMutex);
+
+		SDL_WaitThread(mThread, NULL);
+	}
+
+	if (mMutex != NULL)
+	{
+		SDL_DestroyCond(mDataCond);
+		SDL_DestroyCond(mFillCond);
+		SDL_DestroyMutex(mMutex);
+	}
+
+	if (mFile != NULL)
+		p_fclose(mFile);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the start of the file, and starts the worker on the rest unless the
+// whole thing fit.
+///////////////////////////////////////////////////////////////////////////////
+bool SDLMusicStream::Open()
+{
+	p_fseek(mFile, 0, SEEK_END);
+	mSize = p_ftell(mFile);
+	p_fseek(mFile, 0, SEEK_SET);
+
+	if (mSize <= 0)
+		return false;
+
+	mHeadSize = (mSize <= HEAD_SIZE + RING_SIZE) ? (int) mSize : HEAD_SIZE;
+	mHead.resize(mHeadSize);
+	if (p_fread(&mHead[0], 1, mHeadSize, mFile) != (size_t) mHeadSize)
+		return false;
+
+	mFilePos = mHeadSize;
+	if (mHeadSize == mSize)
+		return true;
+
+	mRing.resize(RING_SIZE);
+	mChunk.resize(CHUNK_SIZE);
+	mRingStart = mHeadSize;
+	mRingEnd = mHeadSize;
+
+	mMutex = SDL_CreateMutex();
+	mFillCond = SDL_CreateCond();
+	mDataCond = SDL_CreateCond();
+	mThread = SDL_CreateThread(FillProcStub, "MusicStream", this);
+
+	return mThread != NULL;
+}
+
+int SDLMusicStream::FillProcStub(void* theArg)
+{
+	((SDLMusicStream*)theArg)->FillProc();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps the ring full ahead of the reader, which moves mRingStart up behind
+// itself as it goes.  The file is read with mMutex released, into mChunk,
+// and only copied in if the reader didn't send the ring elsewhere meanwhile.
+///////////////////////////////////////////////////////////////////////////////
+void SDLMusicStream::FillProc()
+{
+	SDL_LockMutex(mMutex);
+
+	while (!mShutdown)
+	{
+		int aRoom = RING_SIZE - (int)(mRingEnd - mRingStart);
+		if ((aRoom <= 0) || (mRingEnd >= mSize) || (mReadFailed))
+		{
+			SDL_CondWait(mFillCond, mMutex);
+			continue;
+		}
+
+		int64_t aPos = mRingEnd;
+		int aGeneration = mRingGeneration;
+		int aCount = (int) std::min<int64_t>(std::min(aRoom, (int) CHUNK_SIZE), mSize - aPos);
+
+		SDL_UnlockMutex(mMutex);
+
+		bool success = true;
+		if (mFilePos != aPos)
+			success = p_fseek(mFile, aPos, SEEK_SET) == 0;
+		if (success)
+			success = p_fread(&mChunk[0], 1, aCount, mFile) == (size_t) aCount;
+		mFilePos = success ? aPos + aCount : -1;
+
+		SDL_LockMutex(mMutex);
+
+		if (aGeneration != mRingGeneration)
+			continue;
+
+		if (!success)
+			mReadFailed = true;
+		else
+		{
+			int anOffset = (int)(aPos % RING_SIZE);
+			int aFirst = std::min(aCount, RING_SIZE - anOffset);
+			memcpy(&mRing[anOffset], &mChunk[0], aFirst);
+			memcpy(&mRing[0], &mChunk[aFirst], aCount - aFirst);
+			mRingEnd += aCount;
+		}
+
+		SDL_CondSignal(mDataCond);
+	}
+
+	SDL_UnlockMutex(mMutex);
+}
+
+// Called with mMutex held
+void SDLMusicStream::Restart(int64_t thePos)
+{
+	mRingStart = thePos;
+	mRingEnd = thePos;
+	mRingGeneration++;
+	mReadFailed = false;
+	SDL_CondSignal(mFillCond);
+}
+
+size_t SDLMusicStream::Read(void* theDest, size_t theSize)
+{
+	uint8_t* aDest = (uint8_t*) theDest;
+	size_t aTotal = 0;
+
+	while ((aTotal < theSize) && (mReadPos < mSize))
+	{
+		size_t aWant = theSize - aTotal;
+
+		if (mReadPos < mHeadSize)
+		{
+			int aCount = (int) std::min<int64_t>(aWant, mHeadSize - mReadPos);
+			memcpy(aDest + aTotal, &mHead[(size_t) mReadPos], aCount);
+			mReadPos += aCount;
+			aTotal += aCount;
+			continue;
+		}
+
+		SDL_LockMutex(mMutex);
+
+		if ((mReadPos < mRingStart) || (mReadPos > mRingEnd))
+			Restart(mReadPos);
+
+		if ((mReadPos == mRingEnd) && (!mReadFailed))
+		{
+			mStalls++;
+			while ((mReadPos == mRingEnd) && (!mReadFailed))
+				SDL_CondWait(mDataCond, mMutex);
+		}
+
+		if (mReadPos == mRingEnd)
+		{
+			SDL_UnlockMutex(mMutex);
+			break;
+		}
+
+		int aCount = (int) std::min<int64_t>(aWant, mRingEnd - mReadPos);
+		int anOffset = (int)(mReadPos % RING_SIZE);
+		int aFirst = std::min(aCount, RING_SIZE - anOffset);
+		memcpy(aDest + aTotal, &mRing[anOffset], aFirst);
+		memcpy(aDest + aTotal + aFirst, &mRing[0], aCount - aFirst);
+		mReadPos += aCount;
+		aTotal += aCount;
+
+		// Let the worker have back what's been read
+		mRingStart = std::max(mRingStart, mReadPos - BACK_SIZE);
+		SDL_CondSignal(mFillCond);
+		SDL_UnlockMutex(mMutex);
+	}
+
+	return aTotal;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Seeking back into the head (a song looping) sends the worker to the bytes
+// that follow it, so they're ready by the time the head runs out.
+///////////////////////////////////////////////////////////////////////////////
+int64_t SDLMusicStream::Seek(int64_t theOffset, int theOrigin)
+{
+	int64_t aPos = theOffset;
+	if (theOrigin == RW_SEEK_CUR)
+		aPos += mReadPos;
+	else if (theOrigin == RW_SEEK_END)
+		aPos += mSize;
+
+	if (aPos < 0)
+		return -1;
+
+	mReadPos = std::min(aPos, mSize);
+
+	if (mThread != NULL)
+	{
+		int64_t aNeedPos = std::max(mReadPos, (int64_t) mHeadSize);
+
+		SDL_LockMutex(mMutex);
+		if ((aNeedPos < mRingStart) || (aNeedPos > mRingEnd))
+			Restart(aNeedPos);
+		SDL_UnlockMutex(mMutex);
+	}
+
+	return mReadPos;
+}
+
+static SDLMusicStream* GetStream(SDL_RWops* theRW)
+{
+	return (SDLMusicStream*) theRW->hidden.unknown.data1;
+}
+
+static Sint64 SDLCALL MusicStreamSize(SDL_RWops* theRW)
+{
+	return GetStream(theRW)->mSize;
+}
+
+static Sint64 SDLCALL MusicStreamSeek(SDL_RWops* theRW, Sint64 theOffset, int theWhence)
+{
+	return GetStream(theRW)->Seek(theOffset, theWhence);
+}
+
+static size_t SDLCALL MusicStreamRead(SDL_RWops* theRW, void* thePtr, size_t theSize, size_t theMaxNum)
+{
+	if (theSize == 0)
+		return 0;
+
+	return GetStream(theRW)->Read(thePtr, theSize * theMaxNum) / theSize;
+}
+
+static size_t SDLCALL MusicStreamWrite(SDL_RWops* theRW, const void* thePtr, size_t theSize, size_t theNum)
+{
+	SDL_SetError("Music streams are read only");
+	return 0;
+}
+
+static int SDLCALL MusicStreamClose(SDL_RWops* theRW)
+{
+	delete GetStream(theRW);
+	SDL_FreeRW(theRW);
+	return 0;
+}
+
+SDL_RWops* SDLMusicStream::CreateRW(const std::string& theFileName)
+{
+	PFILE* aFile = p_fopen(theFileName.c_str(), "rb");
+	if (aFile == NULL)
+		return NULL;
+
+	SDLMusicStream* aStream = new SDLMusicStream(aFile);
+	SDL_RWops* aRW = aStream->Open() ? SDL_AllocRW() : NULL;
+	if (aRW == NULL)
+	{
+		delete aStream;
+		return NULL;
+	}
+
+	aRW->type = SDL_RWOPS_UNKNOWN;
+	aRW->size = MusicStreamSize;
+	aRW->seek = MusicStreamSeek;
+	aRW->read = MusicStreamRead;
+	aRW->write = MusicStreamWrite;
+	aRW->close = MusicStreamClose;
+	aRW->hidden.unknown.data1 = aStream;
+	return aRW;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct PFILE;
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Feeds SDL_mixer a music file through PakInterface, so songs can be read out
+// of a pak.  Only a fixed amount of the file is ever held: its start, which
+// is where a looping song goes back to, and a ring of what comes next, which
+// a worker thread keeps topped up.  The audio callback then only copies out
+// of memory, and waits only when it seeks somewhere nothing is buffered yet.
+//
+// Read and Seek come from one thread at a time (SDL_mixer's), the worker
+// runs on its own.
+///////////////////////////////////////////////////////////////////////////////
+class SDLMusicStream
+{
+public:
+	enum
+	{
+		HEAD_SIZE = 64 * 1024,
+		RING_SIZE = 256 * 1024,
+		CHUNK_SIZE = 32 * 1024,			// most the worker reads at once
+		BACK_SIZE = 16 * 1024			// kept behind the read position for short seeks back
+	};
+
+	PFILE*					mFile;
+	int64_t					mSize;
+	int64_t					mReadPos;
+	std::vector<uint8_t>	mHead;			// the first mHeadSize bytes, or the whole file if it's small
+	int						mHeadSize;
+
+	// File byte N lives at mRing[N % RING_SIZE] while mRingStart <= N < mRingEnd
+	std::vector<uint8_t>	mRing;
+	int64_t					mRingStart;
+	int64_t					mRingEnd;
+	int						mRingGeneration;	// bumped when the ring starts over somewhere else
+	bool					mReadFailed;
+	std::vector<uint8_t>	mChunk;			// the worker's read buffer
+	int64_t					mFilePos;		// where the worker left mFile
+
+	SDL_mutex*				mMutex;
+	SDL_cond*				mFillCond;		// the worker waits on this for room
+	SDL_cond*				mDataCond;		// and a stalled read for data
+	SDL_Thread*				mThread;
+	bool					mShutdown;
+
+	int						mStalls;		// reads that had to wait on the worker
+
+protected:
+	static int				FillProcStub(void* theArg);
+	void					FillProc();
+	void					Restart(int64_t thePos);
+
+public:
+	SDLMusicStream(PFILE* theFile);
+	virtual ~SDLMusicStream();
+
+	bool					Open();
+	size_t					Read(void* theDest, size_t theSize);
+	int64_t					Seek(int64_t theOffset, int theOrigin);
+
+	// Returns an SDL_RWops that deletes the stream when closed, or NULL if
+	// the file can't be read
+	static SDL_RWops*		CreateRW(const std::string& theFileName);
+};
+
+}
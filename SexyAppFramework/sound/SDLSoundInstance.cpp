@@ -1,153 +1,93 @@
 #include "SDLSoundInstance.h"
 #include "SDLSoundManager.h"
+#include "SoundMixer.h"
+#include "OggSoundStream.h"
+
+#include <math.h>
 
 using namespace Sexy;
 
-SDLSoundInstance::SDLSoundInstance(SDLSoundManager* theSoundManager, Mix_Chunk* theSourceSound)
+SDLSoundInstance::SDLSoundInstance(SDLSoundManager* theSoundManager, int theChannel)
 {
 	mSoundManagerP = theSoundManager;
+	mChannel = theChannel;
+	mStream = NULL;
+	Reset(NULL, NULL, 0);
+}
+
+SDLSoundInstance::~SDLSoundInstance()
+{
+	
+}
+
+// Readies a pooled instance for its next sound
+void SDLSoundInstance::Reset(Mix_Chunk* theSourceSound, SDLStreamedSound* theStreamedSound, int thePriority)
+{
+	FreeStream();
+
 	mMixChunk = theSourceSound;
+	mStreamedSound = theStreamedSound;
+	mRateScale = 1.0;
+	mPriority = thePriority;
+	mPlayOrder = 0;
 	mReleased = false;
 	mAutoRelease = false;
 	mHasPlayed = false;
-	mChannel = -1;
+	mVoice = -1;
 
 	mBaseVolume = 1.0;
 	mBasePan = 0;
 
 	mVolume = 1.0;
 	mPan = 0;
-	mPitch = 1.0f;
-
-	mDefaultFrequency = 44100;
-
-	RehupVolume();
+	mPitch = 1.0;
 }
 
-SDLSoundInstance::~SDLSoundInstance()
+///////////////////////////////////////////////////////////////////////////////
+// Volumes are linear.  Pans are in hundredths of a dB like DirectSound's: a
+// pan to the left turns the right side down by that much and vice versa.
+///////////////////////////////////////////////////////////////////////////////
+void SDLSoundInstance::GetGains(float* theGainLeft, float* theGainRight)
 {
-	
-}
+	double aVolume = mBaseVolume * mVolume * mSoundManagerP->mMasterVolume;
 
-void SDLSoundInstance::RehupVolume()
-{
-	Mix_VolumeChunk(mMixChunk, (mBaseVolume * mVolume * mSoundManagerP->mMasterVolume) * 128);
-}
+	int aPan = std::max(-10000, std::min(10000, mBasePan + mPan));
+	double anAttenuation = pow(10.0, -abs(aPan) / 2000.0);
 
-void SDLSoundInstance::RehupPan()
-{
-	//if (mSoundBuffer != NULL)
-		//mSoundBuffer->SetPan(mBasePan + mPan);
+	*theGainLeft = (float) (aPan > 0 ? aVolume * anAttenuation : aVolume);
+	*theGainRight = (float) (aPan < 0 ? aVolume * anAttenuation : aVolume);
 }
 
-// SDL_mixer chunk pitching
-// https://gist.github.com/hydren/ea794e65e95c7713c00c88f74b71f8b1
-
-uint16_t SDLSoundInstance::FormatSampleSize(uint16_t format)
+void SDLSoundInstance::RehupVolume()
 {
-	return (format & 0xFF) / 8;
-}
+	if (mVoice == -1)
+		return;
 
-int SDLSoundInstance::GetChunkDurationMS(int chunkSize)
-{
-	const uint32_t points = chunkSize / FormatSampleSize(mSoundManagerP->mMixerFormat);  // bytes / samplesize == sample points
-	const uint32_t frames = (points / mSoundManagerP->mMixerChannels);  // sample points / channels == sample frames
-	return ((frames * 1000) / mSoundManagerP->mMixerFreq);  // (sample frames * 1000) / frequency == play length, in ms
+	float aGainLeft, aGainRight;
+	GetGains(&aGainLeft, &aGainRight);
+	mSoundManagerP->mMixer->SetGain(mVoice, aGainLeft, aGainRight);
 }
 
-void SDLSoundInstance::CreateSoundPitchHandler(const Mix_Chunk* chunk, const float* speed, int loop, int self_halt)
+void SDLSoundInstance::RehupPan()
 {
-	mPitchHandler.self = this;
-	mPitchHandler.chunk = chunk;
-	mPitchHandler.speed = speed;
-	mPitchHandler.position = 0;
-	mPitchHandler.altered = 0;
-	mPitchHandler.loop = loop;
-	mPitchHandler.duration = GetChunkDurationMS(chunk->alen);
-	mPitchHandler.chunk_size = chunk->alen / FormatSampleSize(mSoundManagerP->mMixerFormat);
-	mPitchHandler.self_halt = self_halt;
+	RehupVolume();
 }
 
-void SDLSoundInstance::PitchHandlerFuncCallback(int mix_channel, void* stream, int length, void* user_data)
+///////////////////////////////////////////////////////////////////////////////
+// Gives the channel straight back, so the instance mustn't be touched after
+// this; it'll be handed out again for some other sound.
+///////////////////////////////////////////////////////////////////////////////
+void SDLSoundInstance::Release()
 {
-	SDLSoundPitchHandler* handler = (SDLSoundPitchHandler*) user_data;
-	SDLSoundInstance* pThis = handler->self;
-	const int16_t* chunk_data = (int16_t*) handler->chunk->abuf;
-
-	int16_t* buffer = (int16_t*) stream;
-	const int buffer_size = length / sizeof(int16_t);  // buffer size (as array)
-	const float speed_factor = *handler->speed;  // take a "snapshot" of speed factor
-
-	// if there is still sound to be played
-	if(handler->position < handler->duration || handler->loop)
-	{
-		const float delta = 1000.0 / pThis->mSoundManagerP->mMixerFreq,  // normal duration of each sample
-			    vdelta = delta * speed_factor;  // virtual stretched duration, scaled by 'speedFactor'
-		
-		// if playback is unaltered and pitch is required (for the first time)
-		if(!handler->altered && speed_factor != 1.0f)
-		    handler->altered = 1;  // flags playback modification and proceed to the pitch routine
-
-		if(handler->altered)  // if unaltered, this pitch routine is skipped
-		{
-			for(int i = 0; i < buffer_size; i += pThis->mSoundManagerP->mMixerChannels)
-			{
-				const int j = i / pThis->mSoundManagerP->mMixerChannels; // j goes from 0 to size/channelCount, incremented 1 by 1
-				const float x = handler->position + j * vdelta;  // get "virtual" index. its corresponding value will be interpolated.
-				const int k = floor(x / delta);  // get left index to interpolate from original chunk data (right index will be this plus 1)
-				const float prop = (x / delta) - k;  // get the proportion of the right value (left will be 1.0 minus this)
-				// const float prop2 = prop * prop;  // cache the square of the proportion (needed only for cubic interpolation)
-
-				// usually just 2 channels: 0 (left) and 1 (right), but who knows...
-				for(int c = 0; c < pThis->mSoundManagerP->mMixerChannels; c++)
-				{
-					// check if k will be within bounds
-					if(k * pThis->mSoundManagerP->mMixerChannels + pThis->mSoundManagerP->mMixerChannels - 1 < handler->chunk_size || handler->loop)
-					{
-						int16_t v0 = chunk_data[(  k   * pThis->mSoundManagerP->mMixerChannels + c) % handler->chunk_size],
-								  // v_ = chunk_data[((k-1) * mSoundManagerP->mMixerChannels + c) % handler->chunk_size],
-								  // v2 = chunk_data[((k+2) * mSoundManagerP->mMixerChannels + c) % handler->chunk_size],
-						                  v1 = chunk_data[((k+1) * pThis->mSoundManagerP->mMixerChannels + c) % handler->chunk_size];
-					
-						// put interpolated value on 'data'
-						// buffer[i + c] = (1 - prop) * v0 + prop * v1;  // linear interpolation
-						buffer[i + c] = v0 + prop * (v1 - v0);  // linear interpolation (single-multiplication version)
-						// buffer[i + c] = v0 + 0.5f * prop * ((prop - 3) * v0 - (prop - 2) * 2 * v1 + (prop - 1) * v2);  // quadratic interpolation
-						// buffer[i + c] = v0 + (prop / 6) * ((3 * prop - prop2 - 2) * v_ + (prop2 - 2 * prop - 1) * 3 * v0 + (prop - prop2 + 2) * 3 * v1 + (prop2 - 1) * v2);  // cubic interpolation
-						// buffer[i + c] = v0 + 0.5f * prop * ((2 * prop2 - 3 * prop - 1) * (v0 - v1) + (prop2 - 2 * prop + 1) * (v0 - v_) + (prop2 - prop) * (v2 - v2));  // cubic spline interpolation
-					}
-					else  // if k will be out of bounds (chunk bounds), it means we already finished; thus, we'll pass silence
-					{
-						buffer[i + c] = 0;
-					}
-				}
-			}
-		}
-
-		// update position
-		handler->position += (buffer_size / pThis->mSoundManagerP->mMixerChannels) * vdelta;
+	Stop();
 
-		// reset position if looping
-		if(handler->loop) while(handler->position > handler->duration)
-			handler->position -= handler->duration;
-	}
-	else  // if we already played the whole sound but finished earlier than expected by SDL_mixer (due to faster playback speed)
+	if (!mReleased)
 	{
-		// set silence on the buffer since Mix_HaltChannel() poops out some of it for a few ms.
-		for(int i = 0; i < buffer_size; i++)
-			buffer[i] = 0;
-
-		if(handler->self_halt)
-			Mix_HaltChannel(mix_channel);  // XXX unsafe call, since it locks audio; but no safer solution was found yet...
+		mReleased = true;
+		mSoundManagerP->FreeChannel(mChannel);
 	}
 }
 
-void SDLSoundInstance::Release()
-{
-	Stop();
-	mReleased = true;
-}
-
 void SDLSoundInstance::SetBaseVolume(double theBaseVolume)
 {
 	mBaseVolume = theBaseVolume;
@@ -162,7 +102,10 @@ void SDLSoundInstance::SetBasePan(int theBasePan)
 
 void SDLSoundInstance::AdjustPitch(double theNumSteps)
 {
-	mPitch = powf(1.0594630943592952645618252949463, theNumSteps);
+	mPitch = pow(1.0594630943592952645618252949463, theNumSteps);
+
+	if (mVoice != -1)
+		mSoundManagerP->mMixer->SetRate(mVoice, mPitch * mRateScale);
 }
 
 void SDLSoundInstance::SetVolume(double theVolume)
@@ -184,33 +127,76 @@ bool SDLSoundInstance::Play(bool looping, bool autoRelease)
 	mHasPlayed = true;	
 	mAutoRelease = autoRelease;	
 
-	if (!mMixChunk)
+	if (((!mMixChunk) && (!mStreamedSound)) || (mSoundManagerP->mMixer == NULL))
 		return false;
 
-	mChannel = Mix_PlayChannel(-1, mMixChunk, (looping) ? -1 : 0);
-	if (mChannel != -1)
+	SoundMixer* aMixer = mSoundManagerP->mMixer;
+	float aGainLeft, aGainRight;
+	GetGains(&aGainLeft, &aGainRight);
+
+	if (mStreamedSound != NULL)
+	{
+		// A streamed sound keeps its own channel count and rate
+		mStream = new OggSoundStream();
+		if ((!mStream->Open(mStreamedSound->mFileName, looping)) || (!mSoundManagerP->AddStream(mStream)))
+		{
+			delete mStream;
+			mStream = NULL;
+			return false;
+		}
+
+		mRateScale = (double) mStream->mRate / aMixer->mFreq;
+		mVoice = aMixer->PlayStream(mStream, mStream->mChannels, aGainLeft, aGainRight, mPitch * mRateScale);
+	}
+	else
+	{
+		// Chunks are converted to the mixer's format when they're loaded, 16
+		// bit samples at its frequency and channel count
+		int aFrames = mMixChunk->alen / (sizeof(int16_t) * aMixer->mChannels);
+		mVoice = aMixer->Play((const int16_t*) mMixChunk->abuf, aFrames, aMixer->mChannels, aGainLeft, aGainRight, mPitch, looping);
+	}
+
+	if (mVoice == -1)
 	{
-		CreateSoundPitchHandler(mMixChunk, &mPitch, looping, 0);
-		Mix_RegisterEffect(mChannel, PitchHandlerFuncCallback, 0, &mPitchHandler);
-		return true;
+		FreeStream();
+		return false;
 	}
-	return false;
+
+	mSoundManagerP->mVoiceChannels[mVoice & (SoundMixer::MAX_VOICES - 1)] = mChannel;
+	mPlayOrder = ++mSoundManagerP->mPlayCount;
+	return true;
 }
 
 void SDLSoundInstance::Stop()
 {
-	if (mChannel != -1)
+	if (mVoice != -1)
 	{
-		Mix_HaltChannel(mChannel);
+		mSoundManagerP->mMixer->Stop(mVoice);
 		mAutoRelease = false;
 	}
+
+	FreeStream();
+}
+
+// The voice is stopped first, so the audio thread is done with mStream
+void SDLSoundInstance::FreeStream()
+{
+	if (mStream == NULL)
+		return;
+
+	if (mVoice != -1)
+		mSoundManagerP->mMixer->Stop(mVoice);
+
+	mSoundManagerP->RemoveStream(mStream);
+	delete mStream;
+	mStream = NULL;
 }
 
 bool SDLSoundInstance::IsPlaying()
 {
-	if (!mMixChunk || !mHasPlayed || mChannel == -1)
+	if (!mHasPlayed || mVoice == -1)
 		return false;
-	return Mix_Playing(mChannel);
+	return mSoundManagerP->mMixer->IsPlaying(mVoice);
 }
 
 bool SDLSoundInstance::IsReleased()
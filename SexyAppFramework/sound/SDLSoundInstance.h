@@ -8,24 +8,8 @@ namespace Sexy
 {
 
 class SDLSoundManager;
-class SDLSoundInstance;
-
-// SDL_mixer chunk pitching
-// https://gist.github.com/hydren/ea794e65e95c7713c00c88f74b71f8b1
-struct SDLSoundPitchHandler
-{
-	SDLSoundInstance* self;
-	const Mix_Chunk* chunk;
-	const float* speed;  /* ptr to the desired playback speed */
-	float position;  /* current position of the sound, in ms */
-	int altered;   /* false if this playback has never been pitched. */
-
-	// read-only!
-	int loop;       /* whether this is a looped playback */
-	int duration;   /* the duration of the sound, in ms */
-	int chunk_size;  /* the size of the sound, as a number of indexes (or sample points). thinks of this as a array size when using the proper array type (instead of just Uint8*). */
-	int self_halt;   /* flags whether playback should be halted by this callback when playback is finished */
-};
+class OggSoundStream;
+struct SDLStreamedSound;
 
 class SDLSoundInstance : public SoundInstance
 {
@@ -33,32 +17,34 @@ class SDLSoundInstance : public SoundInstance
 
 protected:
 	SDLSoundManager*		mSoundManagerP;
+	int						mChannel;		// this instance's slot in the manager's pool
 	Mix_Chunk*				mMixChunk;
+	SDLStreamedSound*		mStreamedSound;	// played instead of mMixChunk
+	OggSoundStream*			mStream;		// mStreamedSound's while it's being played
+	double					mRateScale;		// the sound's rate over the mixer's
 	bool					mAutoRelease;
 	bool					mHasPlayed;
 	bool					mReleased;
-	int						mChannel;
+	int						mVoice;			// SoundMixer handle, -1 before the first Play
+	int						mPriority;
+	uint32_t				mPlayOrder;		// when Play was last called, for stealing the oldest
 
 	int						mBasePan;
 	double					mBaseVolume;
 
 	int						mPan;
 	double					mVolume;	
-	float					mPitch;
-	SDLSoundPitchHandler	mPitchHandler;
-
-	uint32_t				mDefaultFrequency;
+	double					mPitch;
 
 protected:
+	void					GetGains(float* theGainLeft, float* theGainRight);
 	void					RehupVolume();
 	void					RehupPan();
-	uint16_t				FormatSampleSize(uint16_t format);
-	int						GetChunkDurationMS(int chunkSize);
-	void					CreateSoundPitchHandler(const Mix_Chunk* chunk, const float* speed, int loop, int self_halt);
-	static void				PitchHandlerFuncCallback(int mix_channel, void* stream, int length, void* user_data);
+	void					Reset(Mix_Chunk* theSourceSound, SDLStreamedSound* theStreamedSound, int thePriority);
+	void					FreeStream();
 
 public:
-	SDLSoundInstance(SDLSoundManager* theSoundManager, Mix_Chunk* theSourceSound);
+	SDLSoundInstance(SDLSoundManager* theSoundManager, int theChannel);
 	virtual ~SDLSoundInstance();
 	virtual void			Release();
 		
@@ -1,29 +1,50 @@
 #include "SDLSoundManager.h"
 #include "SDLSoundInstance.h"
+#include "SoundMixer.h"
+#include "OggSoundStream.h"
 #include "paklib/PakInterface.h"
 
+#include <algorithm>
+
 using namespace Sexy;
 
 SDLSoundManager::SDLSoundManager()
 {
 	mInitializedMixer = false;
-	mLastReleaseTick = 0;
+	mPlayCount = 0;
+	memset(&mStats, 0, sizeof(mStats));
 	mMasterVolume = 1.0;
 	mMixerFreq = 0;
 	mMixerFormat = 0;
 	mMixerChannels = 0;
+	mMixer = NULL;
+	mStreamThreshold = 512 * 1024;
+	mStreamMutex = NULL;
+	mStreamCond = NULL;
+	mStreamThread = NULL;
+	mStreamShutdown = false;
 
 	int i;
 
 	for (i = 0; i < MAX_SOURCE_SOUNDS; i++)
 	{
 		mSourceSounds[i] = NULL;
+		mStreamedSounds[i] = NULL;
 		mBaseVolumes[i] = 1;
 		mBasePans[i] = 0;
+		mBasePriorities[i] = 0;
 	}
 
-	for (i = 0; i < MAX_CHANNELS; i++)
+	// Pushed backwards so the first channels get used first
+	mNumFreeChannels = 0;
+	for (i = MAX_CHANNELS - 1; i >= 0; i--)
+	{
 		mPlayingSounds[i] = NULL;
+		mInstancePool[i] = new SDLSoundInstance(this, i);
+		mFreeChannels[mNumFreeChannels++] = i;
+		mVoiceChannels[i] = -1;
+	}
+	mStats.mAllocations = MAX_CHANNELS;
 
 	if (SDL_InitSubSystem(SDL_INIT_AUDIO))
     {
@@ -31,7 +52,9 @@ SDLSoundManager::SDLSoundManager()
 		return;
     }
 
-	if (Mix_OpenAudio(44100, AUDIO_S16SYS, 2, 2048))
+	// SoundMixer needs 16 bit samples in one or two channels, so only the
+	// frequency is left up to the device
+	if (Mix_OpenAudioDevice(44100, AUDIO_S16SYS, 2, 2048, NULL, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE))
 	{
 		printf("Failed to initialize SDL mixer\n");
 		return;
@@ -39,36 +62,144 @@ SDLSoundManager::SDLSoundManager()
 	mInitializedMixer = true;
 
 	Mix_QuerySpec(&mMixerFreq, &mMixerFormat, &mMixerChannels);
+
+	// Sounds are mixed on top of what SDL_mixer has made of the music
+	mMixer = new SoundMixer(mMixerFreq, mMixerChannels, MAX_CHANNELS);
+	Mix_SetPostMix(PostMixProc, this);
 }
 
 SDLSoundManager::~SDLSoundManager()
 {
+	// Lets go of every stream before the thread that decodes them goes
+	for (int i = 0; i < MAX_CHANNELS; i++)
+		mInstancePool[i]->Stop();
+
+	if (mStreamThread != NULL)
+	{
+		SDL_LockMutex(mStreamMutex);
+		mStreamShutdown = true;
+		SDL_CondSignal(mStreamCond);
+		SDL_UnlockMutex(mStreamMutex);
+
+		SDL_WaitThread(mStreamThread, NULL);
+	}
+
+	if (mStreamMutex != NULL)
+	{
+		SDL_DestroyCond(mStreamCond);
+		SDL_DestroyMutex(mStreamMutex);
+	}
+
+	for (int i = 0; i < MAX_SOURCE_SOUNDS; i++)
+		delete mStreamedSounds[i];
+
 	if (mInitializedMixer)
+	{
+		Mix_SetPostMix(NULL, NULL);
 		Mix_CloseAudio();
+	}
+
+	delete mMixer;
+
+	for (int i = 0; i < MAX_CHANNELS; i++)
+		delete mInstancePool[i];
 
 	if (SDL_WasInit(SDL_INIT_AUDIO))
 		SDL_QuitSubSystem(SDL_INIT_AUDIO);
 }
 
+void SDLCALL SDLSoundManager::PostMixProc(void* theManager, Uint8* theStream, int theLength)
+{
+	SoundMixer* aMixer = ((SDLSoundManager*) theManager)->mMixer;
+	aMixer->Mix((int16_t*) theStream, theLength / (sizeof(int16_t) * aMixer->mChannels));
+}
+
 bool SDLSoundManager::Initialized()
 {
 	return SDL_WasInit(SDL_INIT_AUDIO) && mInitializedMixer;
 }
 
-bool SDLSoundManager::LoadAUSound(unsigned int theSfxID, const std::string& theFilename)
+///////////////////////////////////////////////////////////////////////////////
+// 8 bit .au samples are turned into 16 bit through a table, built once from
+// the same expansion the µ-law decoder has always used
+///////////////////////////////////////////////////////////////////////////////
+struct AUSampleTables
+{
+	int16_t					mULaw[256];
+	int16_t					mLinear8[256];
+
+	AUSampleTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			int ch = i;
+
+			int sign = (ch < 128) ? -1 : 1;
+			ch = ch | 0x80;
+			if (ch > 239)
+				ch = ((0xF0 | 15) - ch) * 2;
+			else if (ch > 223)
+				ch = (((0xE0 | 15) - ch) * 4) + 32;
+			else if (ch > 207)
+				ch = (((0xD0 | 15) - ch) * 8) + 96;
+			else if (ch > 191)
+				ch = (((0xC0 | 15) - ch) * 16) + 224;
+			else if (ch > 175)
+				ch = (((0xB0 | 15) - ch) * 32) + 480;
+			else if (ch > 159)
+				ch = (((0xA0 | 15) - ch) * 64) + 992;
+			else if (ch > 143)
+				ch = (((0x90 | 15) - ch) * 128) + 2016;
+			else if (ch > 128)
+				ch = (((0x80 | 15) - ch) * 256) + 4064;
+			else
+				ch = 0xff;
+
+			mULaw[i] = (int16_t) (sign * ch * 4);
+			mLinear8[i] = (int16_t) ((int8_t) i * 256);
+		}
+	}
+};
+
+static const AUSampleTables gAUSampleTables;
+
+// theSrc can be the back half of theDest, as it is when decoding in place
+static void DecodeAU8(int16_t* theDest, const uint8_t* theSrc, uint32_t theCount, const int16_t* theTable)
+{
+	for (uint32_t i = 0; i < theCount; i++)
+		theDest[i] = theTable[theSrc[i]];
+}
+
+static void DecodeAU16(int16_t* theSamples, uint32_t theCount)
+{
+	uint16_t* aSamples = (uint16_t*) theSamples;
+	for (uint32_t i = 0; i < theCount; i++)
+		aSamples[i] = (uint16_t) WORD_BIGE_TO_NATIVE(aSamples[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The samples are read straight into the buffer SDL_ConvertAudio works in and
+// decoded to 16 bit there, so the file is only copied once on its way to the
+// mixer's format.  The rate conversion itself is still SDL's, which keeps the
+// result the same as it has always been.
+///////////////////////////////////////////////////////////////////////////////
+Mix_Chunk* SDLSoundManager::LoadAUSound(const std::string& theFilename)
 {
 	PFILE* fp;
 
 	fp = p_fopen(theFilename.c_str(), "rb");
 
 	if (fp == NULL)
-		return false;	
+		return NULL;
 
 	char aHeaderId[5];	
 	aHeaderId[4] = '\0';	
 	p_fread(aHeaderId, 1, 4, fp);	
 	if ((!strcmp(aHeaderId, ".snd")) == 0)
-		return false;
+	{
+		p_fclose(fp);
+		return NULL;
+	}
 
 	uint32_t aHeaderSize;	
 	p_fread(&aHeaderSize, 4, 1, fp);
@@ -90,30 +221,34 @@ bool SDLSoundManager::LoadAUSound(unsigned int theSfxID, const std::string& theF
 	p_fread(&aChannelCount, 4, 1, fp);
 	aChannelCount = LONG_BIGE_TO_NATIVE(aChannelCount);
 
-	p_fseek(fp, aHeaderSize, SEEK_SET);	
+	// A size of ~0 means it wasn't known when the file was written, so the
+	// data is everything after the header
+	if (aDataSize == 0xFFFFFFFF)
+	{
+		p_fseek(fp, 0, SEEK_END);
+		int64_t aFileSize = p_ftell(fp);
+		aDataSize = (aFileSize > (int64_t) aHeaderSize) ? (uint32_t) std::min<int64_t>(aFileSize - aHeaderSize, 0xFFFFFFFE) : 0;
+	}
 
-	bool ulaw = false;
+	p_fseek(fp, aHeaderSize, SEEK_SET);
 
+	const int16_t* aTable = NULL;
 	uint32_t aSrcBitCount = 8;
-	uint32_t aBitCount = 16;			
 	switch (anEncoding)
 	{
 	case 1:
-		aSrcBitCount = 8;
-		aBitCount = 16;
-		ulaw = true;
+		aTable = gAUSampleTables.mULaw;
 		break;
 	case 2:
-		aSrcBitCount = 8;
-		aBitCount = 8;
+		aTable = gAUSampleTables.mLinear8;
 		break;
-	
+	case 3:
+		aSrcBitCount = 16;
+		break;
+
 	/*
 	Support these formats?
 	
-	case 3:
-		aBitCount = 16;
-		break;
 	case 4:
 		aBitCount = 24;
 		break;
@@ -122,99 +257,65 @@ bool SDLSoundManager::LoadAUSound(unsigned int theSfxID, const std::string& theF
 		break;*/
 
 	default:
-		return false;		
-	}
-
-	uint32_t aDestSize = aDataSize * aBitCount/aSrcBitCount;
-
-	Mix_Chunk* aMixChunk = (Mix_Chunk *)SDL_malloc(sizeof(Mix_Chunk));
-	uint8_t* aDest = (uint8_t*)SDL_malloc(aDestSize);
-	uint8_t* aSrcBuffer = (uint8_t*)malloc(aDataSize);
-	
-	uint32_t aReadSize = p_fread(aSrcBuffer, 1, aDataSize, fp);
-	p_fclose(fp);
-
-	if (ulaw)
-	{
-		short* aDestBuffer = (short*)aDest;
-
-		for (ulong i = 0; i < aDataSize; i++)
-		{
-			int ch = aSrcBuffer[i];
-
-			int sign = (ch < 128) ? -1 : 1;
-			ch = ch | 0x80;
-			if (ch > 239)
-				ch = ((0xF0 | 15) - ch) * 2;
-			else if (ch > 223)
-				ch = (((0xE0 | 15) - ch) * 4) + 32;
-			else if (ch > 207)
-				ch = (((0xD0 | 15) - ch) * 8) + 96;
-			else if (ch > 191)
-				ch = (((0xC0 | 15) - ch) * 16) + 224;
-			else if (ch > 175)
-				ch = (((0xB0 | 15) - ch) * 32) + 480;
-			else if (ch > 159)
-				ch = (((0xA0 | 15) - ch) * 64) + 992;
-			else if (ch > 143)
-				ch = (((0x90 | 15) - ch) * 128) + 2016;
-			else if (ch > 128)
-				ch = (((0x80 | 15) - ch) * 256) + 4064;
-			else
-				ch = 0xff;			
-
-			aDestBuffer[i] = sign * ch * 4;
-		}		
+		p_fclose(fp);
+		return NULL;
 	}
-	else
-		memcpy(aDest, aSrcBuffer, aDataSize);
-
-	free(aSrcBuffer);
 
-	if (aReadSize != aDataSize)
+	if (((aChannelCount != 1) && (aChannelCount != 2)) || (aSampleRate == 0) || (aDataSize > 0x10000000))
 	{
-		SDL_free(aMixChunk);
-		SDL_free(aDest);
-		return false;
+		p_fclose(fp);
+		return NULL;
 	}
 
-	int freq; uint16_t format; int channels;
-	int srcfreq; uint16_t srcformat; int srcchannels;
-	Mix_QuerySpec(&freq, &format, &channels);
-	srcfreq = 8000; srcformat = AUDIO_S16SYS; srcchannels = 1;
+	uint32_t aSampleCount = aDataSize / (aSrcBitCount / 8);
+	aDataSize = aSampleCount * (aSrcBitCount / 8);
+	uint32_t aDestSize = aSampleCount * sizeof(int16_t);
 
 	// https://github.com/libsdl-org/SDL_mixer/blob/SDL2/src/mixer.c#L852
-	// Build the audio converter and create conversion buffers
 	SDL_AudioCVT wavecvt;
 	if (SDL_BuildAudioCVT(&wavecvt,
-			srcformat, srcchannels, srcfreq,
-			format, channels, freq) < 0)
+			AUDIO_S16SYS, (Uint8) aChannelCount, (int) aSampleRate,
+			mMixerFormat, (Uint8) mMixerChannels, mMixerFreq) < 0)
 	{
-		SDL_free(aMixChunk);
-		SDL_free(aDest);
-		return false;
+		p_fclose(fp);
+		return NULL;
 	}
-	uint32_t samplesize = ((srcfreq & 0xFF)/8)*srcchannels;
-	wavecvt.len = aDestSize & ~(samplesize - 1);
-	wavecvt.buf = (uint8_t*)SDL_calloc(1, wavecvt.len*wavecvt.len_mult);
+
+	// Always cut to 8 bytes, which is whole frames in mono or stereo
+	wavecvt.len = aDestSize & ~7;
+	wavecvt.buf = (uint8_t*) SDL_malloc(std::max<size_t>((size_t) wavecvt.len * wavecvt.len_mult, aDestSize));
 	if (wavecvt.buf == NULL)
 	{
+		p_fclose(fp);
 		Mix_OutOfMemory();
-		SDL_free(aMixChunk);
-		SDL_free(aDest);
-		return false;
+		return NULL;
+	}
+
+	// 8 bit samples go in the back half, to be spread out over the whole thing
+	uint8_t* aSrc = wavecvt.buf + aDestSize - aDataSize;
+	uint32_t aReadSize = p_fread(aSrc, 1, aDataSize, fp);
+	p_fclose(fp);
+
+	if (aReadSize != aDataSize)
+	{
+		SDL_free(wavecvt.buf);
+		return NULL;
 	}
-	SDL_memcpy(wavecvt.buf, aDest, wavecvt.len);
-	SDL_free(aDest);
+
+	if (aTable != NULL)
+		DecodeAU8((int16_t*) wavecvt.buf, aSrc, aSampleCount, aTable);
+	else
+		DecodeAU16((int16_t*) wavecvt.buf, aSampleCount);
 
 	// Run the audio converter
-	if (SDL_ConvertAudio(&wavecvt) < 0) {
+	if (SDL_ConvertAudio(&wavecvt) < 0)
+	{
 		SDL_free(wavecvt.buf);
-		SDL_free(aMixChunk);
-		return false;
+		return NULL;
 	}
 
-	aDest = (uint8_t*)SDL_realloc(wavecvt.buf, wavecvt.len_cvt);
+	Mix_Chunk* aMixChunk = (Mix_Chunk*) SDL_malloc(sizeof(Mix_Chunk));
+	uint8_t* aDest = (uint8_t*) SDL_realloc(wavecvt.buf, wavecvt.len_cvt);
 	if (aDest == NULL) {
 		aMixChunk->abuf = wavecvt.buf;
 	} else {
@@ -224,11 +325,15 @@ bool SDLSoundManager::LoadAUSound(unsigned int theSfxID, const std::string& theF
 	aMixChunk->allocated = 1;
 	aMixChunk->volume = 128;
 
-	mSourceSounds[theSfxID] = aMixChunk;
-	return true;
+	return aMixChunk;
 }
 
 bool SDLSoundManager::LoadSound(unsigned int theSfxID, const std::string& theFilename)
+{
+	return LoadSound(theSfxID, theFilename, SoundStreaming_Auto);
+}
+
+bool SDLSoundManager::LoadSound(unsigned int theSfxID, const std::string& theFilename, SoundStreaming theStreaming)
 {
 	if ((theSfxID < 0) || (theSfxID >= MAX_SOURCE_SOUNDS))
 		return false;
@@ -238,7 +343,34 @@ bool SDLSoundManager::LoadSound(unsigned int theSfxID, const std::string& theFil
 	if (!Initialized())
 		return true;
 
-	mSourceFileNames[theSfxID] = theFilename;
+	void* aSound = DecodeSound(theFilename, theStreaming);
+	if (aSound == NULL)
+		return false;
+
+	return LoadDecodedSound(theSfxID, theFilename, aSound);
+}
+
+static SDLDecodedSound* NewDecodedSound(Mix_Chunk* theChunk, SDLStreamedSound* theStreamed)
+{
+	if ((theChunk == NULL) && (theStreamed == NULL))
+		return NULL;
+
+	SDLDecodedSound* aSound = new SDLDecodedSound;
+	aSound->mChunk = theChunk;
+	aSound->mStreamed = theStreamed;
+	return aSound;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Only reads the mixer spec and mStreamThreshold, so loaders may call it from
+// their own threads.  An .ogg that's to be streamed just has its headers
+// checked here.
+///////////////////////////////////////////////////////////////////////////////
+void* SDLSoundManager::DecodeSound(const std::string& theFilename, SoundStreaming theStreaming)
+{
+	if (!Initialized())
+		return NULL;
+
 	const char* formats[] = {".wav", ".mp3", ".ogg"};
 	for (int i=0; i<3; i++)
 	{
@@ -251,20 +383,59 @@ bool SDLSoundManager::LoadSound(unsigned int theSfxID, const std::string& theFil
 		p_fseek(fp, 0, SEEK_END);
 		size_t fileSize = p_ftell(fp);
 		p_fseek(fp, 0, SEEK_SET);
+
+		bool isOgg = strcmp(formats[i], ".ogg") == 0;
+		if ((isOgg) && ((theStreaming == SoundStreaming_Always) || ((theStreaming == SoundStreaming_Auto) && (fileSize >= (size_t) mStreamThreshold))))
+		{
+			SDLStreamedSound* aStreamed = new SDLStreamedSound;
+			aStreamed->mFileName = aFilename;
+			if (OggSoundStream::GetInfo(aFilename, &aStreamed->mChannels, &aStreamed->mRate))
+			{
+				p_fclose(fp);
+				return NewDecodedSound(NULL, aStreamed);
+			}
+			delete aStreamed;
+		}
+
 		uint8_t *data = new uint8_t[fileSize];
 		p_fread(data, 1, fileSize, fp);
 		p_fclose(fp);
 
-		mSourceSounds[theSfxID] = Mix_LoadWAV_RW(SDL_RWFromConstMem(data, fileSize), 1);
+		Mix_Chunk* aMixChunk = Mix_LoadWAV_RW(SDL_RWFromConstMem(data, fileSize), 1);
 		delete[] data;
 
-		if (mSourceSounds[theSfxID]) break;
+		if (aMixChunk)
+			return NewDecodedSound(aMixChunk, NULL);
 	}
 
-	if (!mSourceSounds[theSfxID])
-		LoadAUSound(theSfxID, theFilename + ".au");
+	return NewDecodedSound(LoadAUSound(theFilename + ".au"), NULL);
+}
+
+bool SDLSoundManager::LoadDecodedSound(unsigned int theSfxID, const std::string& theFilename, void* theSound)
+{
+	if ((theSfxID >= MAX_SOURCE_SOUNDS) || (theSound == NULL))
+		return false;
+
+	ReleaseSound(theSfxID);
+
+	SDLDecodedSound* aSound = (SDLDecodedSound*) theSound;
+	mSourceFileNames[theSfxID] = theFilename;
+	mSourceSounds[theSfxID] = aSound->mChunk;
+	mStreamedSounds[theSfxID] = aSound->mStreamed;
+	delete aSound;
+	return true;
+}
+
+void SDLSoundManager::FreeDecodedSound(void* theSound)
+{
+	SDLDecodedSound* aSound = (SDLDecodedSound*) theSound;
+	if (aSound == NULL)
+		return;
 
-	return !!mSourceSounds[theSfxID];
+	if (aSound->mChunk != NULL)
+		Mix_FreeChunk(aSound->mChunk);
+	delete aSound->mStreamed;
+	delete aSound;
 }
 
 int SDLSoundManager::LoadSound(const std::string& theFilename)
@@ -276,7 +447,7 @@ int SDLSoundManager::LoadSound(const std::string& theFilename)
 
 	for (i = MAX_SOURCE_SOUNDS-1; i >= 0; i--)
 	{		
-		if (mSourceSounds[i] == NULL)
+		if ((mSourceSounds[i] == NULL) && (mStreamedSounds[i] == NULL))
 		{
 			if (!LoadSound(i, theFilename))
 				return -1;
@@ -292,10 +463,39 @@ void SDLSoundManager::ReleaseSound(unsigned int theSfxID)
 {
 	if (mSourceSounds[theSfxID] != NULL)
 	{
+		mMixer->StopSource((const int16_t*) mSourceSounds[theSfxID]->abuf);
 		Mix_FreeChunk(mSourceSounds[theSfxID]);
 		mSourceSounds[theSfxID] = NULL;
 		mSourceFileNames[theSfxID] = "";
 	}
+
+	if (mStreamedSounds[theSfxID] != NULL)
+	{
+		ReleaseStreamedSound(theSfxID);
+		mSourceFileNames[theSfxID] = "";
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Instances stream from their own copy of the file, but are stopped anyway so
+// releasing a sound silences it whichever way it's played.
+///////////////////////////////////////////////////////////////////////////////
+void SDLSoundManager::ReleaseStreamedSound(unsigned int theSfxID)
+{
+	SDLStreamedSound* aStreamed = mStreamedSounds[theSfxID];
+
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		SDLSoundInstance* anInstance = mPlayingSounds[i];
+		if ((anInstance != NULL) && (anInstance->mStreamedSound == aStreamed))
+		{
+			anInstance->Stop();
+			anInstance->mStreamedSound = NULL;
+		}
+	}
+
+	delete aStreamed;
+	mStreamedSounds[theSfxID] = NULL;
 }
 
 void SDLSoundManager::SetVolume(double theVolume)
@@ -325,24 +525,37 @@ bool SDLSoundManager::SetBasePan(unsigned int theSfxID, int theBasePan)
 	return true;
 }
 
+bool SDLSoundManager::SetBasePriority(unsigned int theSfxID, int theBasePriority)
+{
+	if (theSfxID >= MAX_SOURCE_SOUNDS)
+		return false;
+
+	mBasePriorities[theSfxID] = theBasePriority;
+	return true;
+}
+
 SoundInstance* SDLSoundManager::GetSoundInstance(unsigned int theSfxID)
 {
-	if (theSfxID > MAX_SOURCE_SOUNDS)
+	if ((theSfxID >= MAX_SOURCE_SOUNDS) || ((mSourceSounds[theSfxID] == NULL) && (mStreamedSounds[theSfxID] == NULL)))
 		return NULL;
 
-	int aFreeChannel = FindFreeChannel();
-	if (aFreeChannel < 0)
-		return NULL;
+	mStats.mRequests++;
 
-	if (mSourceSounds[theSfxID] == NULL)
+	int aChannel = AllocChannel(mBasePriorities[theSfxID]);
+	if (aChannel < 0)
+	{
+		mStats.mDropped++;
 		return NULL;
+	}
 
-	mPlayingSounds[aFreeChannel] = new SDLSoundInstance(this, mSourceSounds[theSfxID]);
+	SDLSoundInstance* anInstance = mInstancePool[aChannel];
+	anInstance->Reset(mSourceSounds[theSfxID], mStreamedSounds[theSfxID], mBasePriorities[theSfxID]);
+	mPlayingSounds[aChannel] = anInstance;
 
-	mPlayingSounds[aFreeChannel]->SetBasePan(mBasePans[theSfxID]);
-	mPlayingSounds[aFreeChannel]->SetBaseVolume(mBaseVolumes[theSfxID]);
+	anInstance->SetBasePan(mBasePans[theSfxID]);
+	anInstance->SetBaseVolume(mBaseVolumes[theSfxID]);
 
-	return mPlayingSounds[aFreeChannel];
+	return anInstance;
 }
 
 void SDLSoundManager::ReleaseSounds()
@@ -351,9 +564,13 @@ void SDLSoundManager::ReleaseSounds()
 	{
 		if (mSourceSounds[i] != NULL)
 		{
+			mMixer->StopSource((const int16_t*) mSourceSounds[i]->abuf);
 			Mix_FreeChunk(mSourceSounds[i]);
 			mSourceSounds[i] = NULL;
 		}
+
+		if (mStreamedSounds[i] != NULL)
+			ReleaseStreamedSound(i);
 	}
 }
 
@@ -362,21 +579,21 @@ void SDLSoundManager::ReleaseChannels()
 	for (int i = 0; i < MAX_CHANNELS; i++)
 	{
 		if (mPlayingSounds[i] != NULL)
-		{
-			delete mPlayingSounds[i];
-			mPlayingSounds[i] = NULL;
-		}
+			mPlayingSounds[i]->Release();
 	}
 }
 
 double SDLSoundManager::GetMasterVolume()
 {
-	return Mix_MasterVolume(-1) / 128.;
+	if (mMixer == NULL)
+		return 0;
+	return mMixer->GetMasterVolume();
 }
 
 void SDLSoundManager::SetMasterVolume(double theVolume)
 {
-	Mix_MasterVolume((int)(theVolume * 128));
+	if (mMixer != NULL)
+		mMixer->SetMasterVolume(theVolume);
 }
 
 void SDLSoundManager::Flush()
@@ -406,7 +623,7 @@ int SDLSoundManager::GetFreeSoundId()
 {
 	for (int i=0; i<MAX_SOURCE_SOUNDS; i++)
 	{
-		if (mSourceSounds[i]==NULL)
+		if ((mSourceSounds[i]==NULL) && (mStreamedSounds[i]==NULL))
 			return i;
 	}
 
@@ -418,46 +635,167 @@ int SDLSoundManager::GetNumSounds()
 	int aCount = 0;
 	for (int i=0; i<MAX_SOURCE_SOUNDS; i++)
 	{
-		if (mSourceSounds[i]!=NULL)
+		if ((mSourceSounds[i]!=NULL) || (mStreamedSounds[i]!=NULL))
 			aCount++;
 	}
 
 	return aCount;
 }
 
-int SDLSoundManager::FindFreeChannel()
+const SDLSoundStats& SDLSoundManager::GetStats()
+{
+	return mStats;
+}
+
+void SDLSoundManager::SetStreamThreshold(int theBytes)
 {
-	uint64_t aTick = SDL_GetTicks();
-	if (aTick-mLastReleaseTick > 1000)
+	mStreamThreshold = theBytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Starts the stream thread the first time it's needed.  Returns false if
+// there's no thread to decode theStream.
+///////////////////////////////////////////////////////////////////////////////
+bool SDLSoundManager::AddStream(OggSoundStream* theStream)
+{
+	if (mStreamMutex == NULL)
 	{
-		ReleaseFreeChannels();
-		mLastReleaseTick = aTick;
+		mStreamMutex = SDL_CreateMutex();
+		mStreamCond = SDL_CreateCond();
+		mStreamThread = SDL_CreateThread(StreamProcStub, "SoundStreams", this);
 	}
 
+	if (mStreamThread == NULL)
+		return false;
+
+	SDL_LockMutex(mStreamMutex);
+	mStreams.push_back(theStream);
+	SDL_CondSignal(mStreamCond);
+	SDL_UnlockMutex(mStreamMutex);
+	return true;
+}
+
+// The stream thread holds mStreamMutex while decoding, so theStream is left alone once this returns
+void SDLSoundManager::RemoveStream(OggSoundStream* theStream)
+{
+	if (mStreamMutex == NULL)
+		return;
+
+	SDL_LockMutex(mStreamMutex);
+	std::vector<OggSoundStream*>::iterator anItr = std::find(mStreams.begin(), mStreams.end(), theStream);
+	if (anItr != mStreams.end())
+		mStreams.erase(anItr);
+	SDL_UnlockMutex(mStreamMutex);
+}
+
+int SDLSoundManager::StreamProcStub(void* theManager)
+{
+	((SDLSoundManager*) theManager)->StreamProc();
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tops up every stream, then sleeps for a fraction of what an
+// OggSoundStream's ring holds, or until a new stream comes along.
+///////////////////////////////////////////////////////////////////////////////
+void SDLSoundManager::StreamProc()
+{
+	SDL_LockMutex(mStreamMutex);
+
+	while (!mStreamShutdown)
+	{
+		for (int i = 0; i < (int)mStreams.size(); i++)
+			mStreams[i]->Decode();
+
+		SDL_CondWaitTimeout(mStreamCond, mStreamMutex, STREAM_POLL_MS);
+	}
+
+	SDL_UnlockMutex(mStreamMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Takes back the channels of auto-released sounds that have finished, then
+// hands out a free one.  Failing that, any stopped sounds the mixer didn't
+// report (freed along with their source) are swept up, and as a last resort
+// a playing sound is stolen.
+///////////////////////////////////////////////////////////////////////////////
+int SDLSoundManager::AllocChannel(int thePriority)
+{
+	ReclaimFinishedChannels();
+
+	if (mNumFreeChannels == 0)
+		ReleaseFreeChannels();
+
+	if ((mNumFreeChannels == 0) && (StealChannel(thePriority)))
+		mStats.mStolen++;
+
+	if (mNumFreeChannels == 0)
+		return -1;
+
+	return mFreeChannels[--mNumFreeChannels];
+}
+
+void SDLSoundManager::FreeChannel(int theChannel)
+{
+	if (mPlayingSounds[theChannel] == NULL)
+		return;
+
+	mPlayingSounds[theChannel] = NULL;
+	mFreeChannels[mNumFreeChannels++] = theChannel;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Only auto-released sounds can be stolen, as nobody holds on to those.  The
+// one with the lowest priority goes, the oldest of those, provided it's no
+// more important than thePriority.
+///////////////////////////////////////////////////////////////////////////////
+bool SDLSoundManager::StealChannel(int thePriority)
+{
+	SDLSoundInstance* aVictim = NULL;
+
 	for (int i = 0; i < MAX_CHANNELS; i++)
-	{		
-		if (mPlayingSounds[i] == NULL)
-			return i;
-		
-		if (mPlayingSounds[i]->IsReleased())
-		{
-			delete mPlayingSounds[i];
-			mPlayingSounds[i] = NULL;
-			return i;
-		}
+	{
+		SDLSoundInstance* anInstance = mPlayingSounds[i];
+		if ((anInstance == NULL) || (!anInstance->mAutoRelease) || (anInstance->mPriority > thePriority))
+			continue;
+
+		if ((aVictim == NULL) || (anInstance->mPriority < aVictim->mPriority) ||
+			((anInstance->mPriority == aVictim->mPriority) && ((int32_t)(anInstance->mPlayOrder - aVictim->mPlayOrder) < 0)))
+			aVictim = anInstance;
+	}
+
+	if (aVictim == NULL)
+		return false;
+
+	aVictim->Release();
+	return true;
+}
+
+void SDLSoundManager::ReclaimFinishedChannels()
+{
+	if (mMixer == NULL)
+		return;
+
+	int aVoices[SoundMixer::MAX_VOICES];
+	int aCount = mMixer->TakeFinished(aVoices, SoundMixer::MAX_VOICES);
+
+	for (int i = 0; i < aCount; i++)
+	{
+		int aChannel = mVoiceChannels[aVoices[i] & (SoundMixer::MAX_VOICES - 1)];
+		if (aChannel < 0)
+			continue;
+
+		SDLSoundInstance* anInstance = mPlayingSounds[aChannel];
+		if ((anInstance != NULL) && (anInstance->mVoice == aVoices[i]) && (anInstance->IsReleased()))
+			mStats.mReclaimed++;
 	}
-	
-	return -1;
 }
 
 void SDLSoundManager::ReleaseFreeChannels()
 {
 	for (int i = 0; i < MAX_CHANNELS; i++)
 	{
-		if (mPlayingSounds[i] != NULL && mPlayingSounds[i]->IsReleased())
-		{
-			delete mPlayingSounds[i];
-			mPlayingSounds[i] = NULL;
-		}
+		if (mPlayingSounds[i] != NULL)
+			mPlayingSounds[i]->IsReleased();
 	}
 }
@@ -8,28 +8,93 @@ namespace Sexy
 {
 
 class SDLSoundInstance;
+class SoundMixer;
+class OggSoundStream;
 
+// An Ogg Vorbis sound that's decoded from its file each time it plays
+struct SDLStreamedSound
+{
+	std::string				mFileName;
+	int						mChannels;
+	int						mRate;
+};
+
+// What DecodeSound hands LoadDecodedSound, one or the other
+struct SDLDecodedSound
+{
+	Mix_Chunk*				mChunk;
+	SDLStreamedSound*		mStreamed;
+};
+
+struct SDLSoundStats
+{
+	int						mRequests;		// GetSoundInstance calls
+	int						mReclaimed;		// channels freed when their sound finished
+	int						mStolen;		// playing sounds cut off for a new one
+	int						mDropped;		// requests that got no channel
+	int						mAllocations;	// SDLSoundInstances ever created
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Channels are slots in a pool of SDLSoundInstances made up front, handed
+// out from a stack of free ones.  An auto-released instance gives its
+// channel back as soon as the mixer says its voice has stopped, and an
+// explicitly released one at once, so nothing has to sweep for dead ones.
+//
+// Long Ogg Vorbis sounds are streamed rather than decoded whole: each play
+// opens the file again, and one thread decodes for every playing stream.
+///////////////////////////////////////////////////////////////////////////////
 class SDLSoundManager : public SoundManager
 {
 	friend class SDLSoundInstance;
 
+public:
+	enum
+	{
+		STREAM_POLL_MS = 20			// the stream thread's nap between top ups
+	};
+
 protected:
 	bool					mInitializedMixer;
 	Mix_Chunk*				mSourceSounds[MAX_SOURCE_SOUNDS];
+	SDLStreamedSound*		mStreamedSounds[MAX_SOURCE_SOUNDS];	// instead of mSourceSounds
 	std::string				mSourceFileNames[MAX_SOURCE_SOUNDS];
 	double					mBaseVolumes[MAX_SOURCE_SOUNDS];
 	int						mBasePans[MAX_SOURCE_SOUNDS];
-	SDLSoundInstance*		mPlayingSounds[MAX_CHANNELS];
+	int						mBasePriorities[MAX_SOURCE_SOUNDS];
+	SDLSoundInstance*		mPlayingSounds[MAX_CHANNELS];	// NULL for a free channel
+	SDLSoundInstance*		mInstancePool[MAX_CHANNELS];
+	int						mFreeChannels[MAX_CHANNELS];
+	int						mNumFreeChannels;
+	int						mVoiceChannels[MAX_CHANNELS];	// by mixer voice index
+	uint32_t				mPlayCount;
+	SDLSoundStats			mStats;
 	double					mMasterVolume;
-	uint64_t				mLastReleaseTick;
 	int						mMixerFreq;
 	uint16_t				mMixerFormat;
 	int						mMixerChannels;
+	SoundMixer*				mMixer;			// plays every SDLSoundInstance, NULL without audio
+
+	int						mStreamThreshold;	// bytes of .ogg from which SoundStreaming_Auto streams
+	std::vector<OggSoundStream*> mStreams;		// being played
+	SDL_mutex*				mStreamMutex;
+	SDL_cond*				mStreamCond;
+	SDL_Thread*				mStreamThread;
+	bool					mStreamShutdown;
 
 protected:
-	int						FindFreeChannel();
-	bool					LoadAUSound(unsigned int theSfxID, const std::string& theFilename);
+	int						AllocChannel(int thePriority);
+	void					FreeChannel(int theChannel);
+	bool					StealChannel(int thePriority);
+	void					ReclaimFinishedChannels();
+	Mix_Chunk*				LoadAUSound(const std::string& theFilename);
 	void					ReleaseFreeChannels();
+	void					ReleaseStreamedSound(unsigned int theSfxID);
+	static void SDLCALL		PostMixProc(void* theManager, Uint8* theStream, int theLength);
+	bool					AddStream(OggSoundStream* theStream);
+	void					RemoveStream(OggSoundStream* theStream);
+	static int				StreamProcStub(void* theManager);
+	void					StreamProc();
 
 public:
 	SDLSoundManager();
@@ -39,11 +104,17 @@ public:
 
 	virtual bool			LoadSound(unsigned int theSfxID, const std::string& theFilename);
 	virtual int				LoadSound(const std::string& theFilename);
+	virtual bool			LoadSound(unsigned int theSfxID, const std::string& theFilename, SoundStreaming theStreaming);
 	virtual void			ReleaseSound(unsigned int theSfxID);
 
+	virtual void*			DecodeSound(const std::string& theFilename, SoundStreaming theStreaming);
+	virtual bool			LoadDecodedSound(unsigned int theSfxID, const std::string& theFilename, void* theSound);
+	virtual void			FreeDecodedSound(void* theSound);
+
 	virtual void			SetVolume(double theVolume);
 	virtual bool			SetBaseVolume(unsigned int theSfxID, double theBaseVolume);
 	virtual bool			SetBasePan(unsigned int theSfxID, int theBasePan);
+	virtual bool			SetBasePriority(unsigned int theSfxID, int theBasePriority);
 
 	virtual SoundInstance*	GetSoundInstance(unsigned int theSfxID);
 
@@ -58,6 +129,9 @@ public:
 	virtual void			StopAllSounds();
 	virtual int				GetFreeSoundId();
 	virtual int				GetNumSounds();
+
+	const SDLSoundStats&	GetStats();
+	void					SetStreamThreshold(int theBytes);
 };
 
 }
@@ -10,6 +10,15 @@ class SoundInstance;
 #define MAX_SOURCE_SOUNDS	256
 #define MAX_CHANNELS		32
 
+// Whether a sound is decoded up front or as it plays.  Managers that can't
+// stream treat them all as SoundStreaming_Never.
+enum SoundStreaming
+{
+	SoundStreaming_Auto,		// streamed if its file is over the manager's size threshold
+	SoundStreaming_Never,
+	SoundStreaming_Always
+};
+
 class SoundManager
 {
 public:
@@ -20,12 +29,26 @@ public:
 
 	virtual bool			LoadSound(unsigned int theSfxID, const std::string& theFilename) = 0;
 	virtual int				LoadSound(const std::string& theFilename) = 0;
+	virtual bool			LoadSound(unsigned int theSfxID, const std::string& theFilename, SoundStreaming theStreaming) { return LoadSound(theSfxID, theFilename); }
 	virtual void			ReleaseSound(unsigned int theSfxID) = 0;
 
+	// LoadSound in two halves.  DecodeSound leaves the manager alone so it can
+	// run on any thread, LoadDecodedSound then takes ownership of the result on
+	// the thread that loads sounds.  Managers that can't split the work return
+	// NULL and get loaded with LoadSound instead.
+	virtual void*			DecodeSound(const std::string& theFilename, SoundStreaming theStreaming) { return NULL; }
+	virtual bool			LoadDecodedSound(unsigned int theSfxID, const std::string& theFilename, void* theSound) { return false; }
+	virtual void			FreeDecodedSound(void* theSound) { }
+
 	virtual void			SetVolume(double theVolume) = 0;
 	virtual bool			SetBaseVolume(unsigned int theSfxID, double theBaseVolume) = 0;
 	virtual bool			SetBasePan(unsigned int theSfxID, int theBasePan) = 0;	
 
+	// When every channel is taken, a new sound may cut off an auto-released
+	// one of no higher priority, oldest first.  Managers that never steal
+	// channels ignore this.
+	virtual bool			SetBasePriority(unsigned int theSfxID, int theBasePriority) { return false; }
+
 	virtual SoundInstance*	GetSoundInstance(unsigned int theSfxID) = 0;
 
 	virtual void			ReleaseSounds() = 0;
@@ -0,0 +1,569 @@
+#include "SoundMixer.h"
+#include "misc/CPUFeatures.h"
+
+#include <SDL2/SDL.h>
+#include <algorithm>
+#include <math.h>
+
+using namespace Sexy;
+
+static const uint64_t MIX_ONE = 1ULL << 32;
+static const uint64_t MIX_FRACTION_MASK = MIX_ONE - 1;
+
+static const double MIN_RATE = 1.0 / 256;
+static const double MAX_RATE = 256.0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Adds theCount source frames into theDest at the given gains.  A stereo
+// source going to a mono output is averaged, a mono one going to stereo is
+// copied to both sides.
+///////////////////////////////////////////////////////////////////////////////
+static void AddFrames(float* theDest, int theDestChannels, const int16_t* theSrc, int theSrcChannels, int theCount, float theGainLeft, float theGainRight)
+{
+	if (theDestChannels == 2)
+	{
+		if (theSrcChannels == 2)
+		{
+			for (int i = 0; i < theCount; i++)
+			{
+				theDest[i*2] += theSrc[i*2] * theGainLeft;
+				theDest[i*2+1] += theSrc[i*2+1] * theGainRight;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < theCount; i++)
+			{
+				theDest[i*2] += theSrc[i] * theGainLeft;
+				theDest[i*2+1] += theSrc[i] * theGainRight;
+			}
+		}
+	}
+	else
+	{
+		if (theSrcChannels == 2)
+		{
+			for (int i = 0; i < theCount; i++)
+				theDest[i] += (theSrc[i*2] * theGainLeft + theSrc[i*2+1] * theGainRight) * 0.5f;
+		}
+		else
+		{
+			float aGain = (theGainLeft + theGainRight) * 0.5f;
+			for (int i = 0; i < theCount; i++)
+				theDest[i] += theSrc[i] * aGain;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Rounds the mix to nearest and adds it to what's already in the output,
+// clamping to 16 bits.
+///////////////////////////////////////////////////////////////////////////////
+static void AddToOutput(int16_t* theDest, const float* theSrc, int theCount)
+{
+	for (int i = 0; i < theCount; i++)
+	{
+		int aValue = theDest[i] + (int) lrintf(theSrc[i]);
+		theDest[i] = (int16_t) (aValue < -32768 ? -32768 : (aValue > 32767 ? 32767 : aValue));
+	}
+}
+
+#if defined(SEXY_SIMD_X86)
+
+///////////////////////////////////////////////////////////////////////////////
+// Four frames at a time for the three layouts SDLSoundManager actually uses;
+// a stereo source going to mono is left to the scalar loop.  Returns how many
+// frames were done.
+///////////////////////////////////////////////////////////////////////////////
+static SEXY_TARGET_SSE2 int AddFramesSSE2(float* theDest, int theDestChannels, const int16_t* theSrc, int theSrcChannels, int theCount, float theGainLeft, float theGainRight)
+{
+	int i = 0;
+
+	if ((theDestChannels == 2) && (theSrcChannels == 2))
+	{
+		const __m128 aGains = _mm_setr_ps(theGainLeft, theGainRight, theGainLeft, theGainRight);
+		for (; i + 4 <= theCount; i += 4)
+		{
+			__m128i aSrc = _mm_loadu_si128((const __m128i*)(theSrc + i*2));
+			__m128 aLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(aSrc, aSrc), 16));
+			__m128 aHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(aSrc, aSrc), 16));
+
+			_mm_storeu_ps(theDest + i*2, _mm_add_ps(_mm_loadu_ps(theDest + i*2), _mm_mul_ps(aLo, aGains)));
+			_mm_storeu_ps(theDest + i*2 + 4, _mm_add_ps(_mm_loadu_ps(theDest + i*2 + 4), _mm_mul_ps(aHi, aGains)));
+		}
+	}
+	else if ((theDestChannels == 2) && (theSrcChannels == 1))
+	{
+		const __m128 aGains = _mm_setr_ps(theGainLeft, theGainRight, theGainLeft, theGainRight);
+		for (; i + 4 <= theCount; i += 4)
+		{
+			__m128i aSrc = _mm_loadl_epi64((const __m128i*)(theSrc + i));
+			__m128 aMono = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(aSrc, aSrc), 16));
+			__m128 aLo = _mm_unpacklo_ps(aMono, aMono);
+			__m128 aHi = _mm_unpackhi_ps(aMono, aMono);
+
+			_mm_storeu_ps(theDest + i*2, _mm_add_ps(_mm_loadu_ps(theDest + i*2), _mm_mul_ps(aLo, aGains)));
+			_mm_storeu_ps(theDest + i*2 + 4, _mm_add_ps(_mm_loadu_ps(theDest + i*2 + 4), _mm_mul_ps(aHi, aGains)));
+		}
+	}
+	else if ((theDestChannels == 1) && (theSrcChannels == 1))
+	{
+		const __m128 aGain = _mm_set1_ps((theGainLeft + theGainRight) * 0.5f);
+		for (; i + 8 <= theCount; i += 8)
+		{
+			__m128i aSrc = _mm_loadu_si128((const __m128i*)(theSrc + i));
+			__m128 aLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(aSrc, aSrc), 16));
+			__m128 aHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(aSrc, aSrc), 16));
+
+			_mm_storeu_ps(theDest + i, _mm_add_ps(_mm_loadu_ps(theDest + i), _mm_mul_ps(aLo, aGain)));
+			_mm_storeu_ps(theDest + i + 4, _mm_add_ps(_mm_loadu_ps(theDest + i + 4), _mm_mul_ps(aHi, aGain)));
+		}
+	}
+
+	return i;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The conversion rounds to nearest like lrintf, and packing saturates, which
+// is the clamp.
+///////////////////////////////////////////////////////////////////////////////
+static SEXY_TARGET_SSE2 int AddToOutputSSE2(int16_t* theDest, const float* theSrc, int theCount)
+{
+	int i = 0;
+	for (; i + 8 <= theCount; i += 8)
+	{
+		__m128i aDest = _mm_loadu_si128((const __m128i*)(theDest + i));
+		__m128i aLo = _mm_srai_epi32(_mm_unpacklo_epi16(aDest, aDest), 16);
+		__m128i aHi = _mm_srai_epi32(_mm_unpackhi_epi16(aDest, aDest), 16);
+
+		aLo = _mm_add_epi32(aLo, _mm_cvtps_epi32(_mm_loadu_ps(theSrc + i)));
+		aHi = _mm_add_epi32(aHi, _mm_cvtps_epi32(_mm_loadu_ps(theSrc + i + 4)));
+		_mm_storeu_si128((__m128i*)(theDest + i), _mm_packs_epi32(aLo, aHi));
+	}
+	return i;
+}
+
+#endif
+
+SoundMixer::SoundMixer(int theFreq, int theChannels, int theMaxVoices)
+{
+	mFreq = theFreq;
+	mChannels = (theChannels == 1) ? 1 : 2;
+	mMasterVolume = 1.0f;
+	mResampleMode = RESAMPLE_LINEAR;
+	mStreamUnderruns = 0;
+	mMutex = SDL_CreateMutex();
+
+	int aNumVoices = std::max(1, std::min(theMaxVoices, (int) MAX_VOICES));
+	mVoices.resize(aNumVoices);
+	mActiveVoices.reserve(aNumVoices);
+	mFinishedBits.resize((aNumVoices + 31) / 32, 0);
+
+	// Pushed backwards so the first voices get used first
+	mFreeVoices.reserve(aNumVoices);
+	for (int i = aNumVoices - 1; i >= 0; i--)
+	{
+		SoundMixerVoice& aVoice = mVoices[i];
+		memset(&aVoice, 0, sizeof(aVoice));
+		mFreeVoices.push_back(i);
+	}
+}
+
+SoundMixer::~SoundMixer()
+{
+	SDL_DestroyMutex(mMutex);
+}
+
+// Called with mMutex held
+SoundMixerVoice* SoundMixer::GetVoice(int theVoice)
+{
+	if (theVoice < 0)
+		return NULL;
+
+	int anIndex = theVoice & (MAX_VOICES - 1);
+	if (anIndex >= (int)mVoices.size())
+		return NULL;
+
+	SoundMixerVoice* aVoice = &mVoices[anIndex];
+	if ((!aVoice->mPlaying) || (aVoice->mGeneration != (theVoice >> 8)))
+		return NULL;
+	return aVoice;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stops a playing voice and gives it back, swapping the last active voice
+// into its place.  Called with mMutex held.
+///////////////////////////////////////////////////////////////////////////////
+void SoundMixer::FreeVoice(int theIndex)
+{
+	SoundMixerVoice& aVoice = mVoices[theIndex];
+	if (!aVoice.mPlaying)
+		return;
+
+	int aLast = mActiveVoices.back();
+	mActiveVoices[aVoice.mActiveIndex] = aLast;
+	mVoices[aLast].mActiveIndex = aVoice.mActiveIndex;
+	mActiveVoices.pop_back();
+
+	aVoice.mPlaying = false;
+	aVoice.mStream = NULL;
+	mFreeVoices.push_back(theIndex);
+	mFinishedBits[theIndex / 32] |= 1U << (theIndex % 32);
+}
+
+static uint64_t RateToStep(double theRate)
+{
+	theRate = std::max(MIN_RATE, std::min(MAX_RATE, theRate));
+	return (uint64_t)(theRate * MIX_ONE + 0.5);
+}
+
+int SoundMixer::Play(const int16_t* theData, int theFrames, int theChannels, float theGainLeft, float theGainRight, double theRate, bool looping)
+{
+	if ((theData == NULL) || (theFrames <= 0) || ((theChannels != 1) && (theChannels != 2)))
+		return -1;
+
+	SDL_LockMutex(mMutex);
+
+	int aHandle = -1;
+	if (!mFreeVoices.empty())
+	{
+		int anIndex = mFreeVoices.back();
+		mFreeVoices.pop_back();
+
+		SoundMixerVoice& aVoice = mVoices[anIndex];
+		aVoice.mData = theData;
+		aVoice.mFrames = theFrames;
+		aVoice.mChannels = theChannels;
+		aVoice.mPos = 0;
+		aVoice.mStep = RateToStep(theRate);
+		aVoice.mGainLeft = theGainLeft;
+		aVoice.mGainRight = theGainRight;
+		aVoice.mLooping = looping;
+		aVoice.mStream = NULL;
+		aVoice.mPlaying = true;
+		aVoice.mGeneration = (aVoice.mGeneration + 1) & 0x7FFFFF;
+		aVoice.mActiveIndex = (int)mActiveVoices.size();
+		mActiveVoices.push_back(anIndex);
+		mFinishedBits[anIndex / 32] &= ~(1U << (anIndex % 32));
+
+		aHandle = (aVoice.mGeneration << 8) | anIndex;
+	}
+
+	SDL_UnlockMutex(mMutex);
+	return aHandle;
+}
+
+int SoundMixer::PlayStream(SoundMixerStream* theStream, int theChannels, float theGainLeft, float theGainRight, double theRate)
+{
+	if ((theStream == NULL) || ((theChannels != 1) && (theChannels != 2)))
+		return -1;
+
+	SDL_LockMutex(mMutex);
+
+	// Only grown while no streamed voice is using it
+	if (mStreamWindows.empty())
+		mStreamWindows.resize(mVoices.size() * STREAM_WINDOW * 2);
+
+	int aHandle = -1;
+	if (!mFreeVoices.empty())
+	{
+		int anIndex = mFreeVoices.back();
+		mFreeVoices.pop_back();
+
+		SoundMixerVoice& aVoice = mVoices[anIndex];
+		aVoice.mData = &mStreamWindows[anIndex * STREAM_WINDOW * 2];
+		aVoice.mFrames = 0;
+		aVoice.mChannels = theChannels;
+		aVoice.mPos = 0;
+		aVoice.mStep = RateToStep(theRate);
+		aVoice.mGainLeft = theGainLeft;
+		aVoice.mGainRight = theGainRight;
+		aVoice.mLooping = false;
+		aVoice.mStream = theStream;
+		aVoice.mPlaying = true;
+		aVoice.mGeneration = (aVoice.mGeneration + 1) & 0x7FFFFF;
+		aVoice.mActiveIndex = (int)mActiveVoices.size();
+		mActiveVoices.push_back(anIndex);
+		mFinishedBits[anIndex / 32] &= ~(1U << (anIndex % 32));
+
+		aHandle = (aVoice.mGeneration << 8) | anIndex;
+	}
+
+	SDL_UnlockMutex(mMutex);
+	return aHandle;
+}
+
+void SoundMixer::Stop(int theVoice)
+{
+	SDL_LockMutex(mMutex);
+	if (GetVoice(theVoice) != NULL)
+		FreeVoice(theVoice & (MAX_VOICES - 1));
+	SDL_UnlockMutex(mMutex);
+}
+
+bool SoundMixer::IsPlaying(int theVoice)
+{
+	SDL_LockMutex(mMutex);
+	bool playing = GetVoice(theVoice) != NULL;
+	SDL_UnlockMutex(mMutex);
+	return playing;
+}
+
+void SoundMixer::SetGain(int theVoice, float theGainLeft, float theGainRight)
+{
+	SDL_LockMutex(mMutex);
+	SoundMixerVoice* aVoice = GetVoice(theVoice);
+	if (aVoice != NULL)
+	{
+		aVoice->mGainLeft = theGainLeft;
+		aVoice->mGainRight = theGainRight;
+	}
+	SDL_UnlockMutex(mMutex);
+}
+
+void SoundMixer::SetRate(int theVoice, double theRate)
+{
+	SDL_LockMutex(mMutex);
+	SoundMixerVoice* aVoice = GetVoice(theVoice);
+	if (aVoice != NULL)
+		aVoice->mStep = RateToStep(theRate);
+	SDL_UnlockMutex(mMutex);
+}
+
+void SoundMixer::StopSource(const int16_t* theData)
+{
+	SDL_LockMutex(mMutex);
+	for (int i = (int)mActiveVoices.size() - 1; i >= 0; i--)
+	{
+		int anIndex = mActiveVoices[i];
+		if (mVoices[anIndex].mData == theData)
+			FreeVoice(anIndex);
+	}
+	SDL_UnlockMutex(mMutex);
+}
+
+void SoundMixer::StopAll()
+{
+	SDL_LockMutex(mMutex);
+	while (!mActiveVoices.empty())
+		FreeVoice(mActiveVoices.back());
+	SDL_UnlockMutex(mMutex);
+}
+
+int SoundMixer::GetNumPlaying()
+{
+	SDL_LockMutex(mMutex);
+	int aCount = (int)mActiveVoices.size();
+	SDL_UnlockMutex(mMutex);
+
+	return aCount;
+}
+
+int SoundMixer::TakeFinished(int* theVoices, int theMaxVoices)
+{
+	int aCount = 0;
+
+	SDL_LockMutex(mMutex);
+	for (int i = 0; (i < (int)mFinishedBits.size()) && (aCount < theMaxVoices); i++)
+	{
+		while ((mFinishedBits[i] != 0) && (aCount < theMaxVoices))
+		{
+			int aBit = 0;
+			while ((mFinishedBits[i] & (1U << aBit)) == 0)
+				aBit++;
+			mFinishedBits[i] &= ~(1U << aBit);
+
+			int anIndex = i * 32 + aBit;
+			theVoices[aCount++] = (mVoices[anIndex].mGeneration << 8) | anIndex;
+		}
+	}
+	SDL_UnlockMutex(mMutex);
+
+	return aCount;
+}
+
+void SoundMixer::SetMasterVolume(double theVolume)
+{
+	SDL_LockMutex(mMutex);
+	mMasterVolume = (float) theVolume;
+	SDL_UnlockMutex(mMutex);
+}
+
+double SoundMixer::GetMasterVolume()
+{
+	return mMasterVolume;
+}
+
+void SoundMixer::SetResampleMode(ResampleMode theMode)
+{
+	SDL_LockMutex(mMutex);
+	mResampleMode = theMode;
+	SDL_UnlockMutex(mMutex);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Mixes theCount output frames of theVoice from where it is into theDest,
+// all of which the caller has made sure come before the end of its data.
+///////////////////////////////////////////////////////////////////////////////
+void SoundMixer::MixRun(SoundMixerVoice* theVoice, float* theDest, int theCount, float theGainLeft, float theGainRight)
+{
+	if ((theVoice->mStep == MIX_ONE) && ((theVoice->mPos & MIX_FRACTION_MASK) == 0))
+	{
+		const int16_t* aSrc = theVoice->mData + (theVoice->mPos >> 32) * theVoice->mChannels;
+
+		int i = 0;
+		switch (GetSIMDLevel())
+		{
+#if defined(SEXY_SIMD_X86)
+		case SIMDLevel_AVX2:
+		case SIMDLevel_SSE2: i = AddFramesSSE2(theDest, mChannels, aSrc, theVoice->mChannels, theCount, theGainLeft, theGainRight); break;
+#endif
+		default: break;
+		}
+
+		AddFrames(theDest + i * mChannels, mChannels, aSrc + i * theVoice->mChannels, theVoice->mChannels, theCount - i, theGainLeft, theGainRight);
+	}
+	else
+		ResampleInt16(theDest, mChannels, theVoice->mData, theVoice->mChannels, theVoice->mFrames, theVoice->mLooping,
+			theVoice->mPos, theVoice->mStep, theCount, theGainLeft, theGainRight, mResampleMode);
+
+	theVoice->mPos += theCount * theVoice->mStep;
+}
+
+// Output frames from thePos on that come before theLimit, at most theMax
+static int CountFrames(uint64_t thePos, uint64_t theStep, uint64_t theLimit, int theMax)
+{
+	if (thePos >= theLimit)
+		return 0;
+
+	uint64_t aCount = (theLimit - thePos + theStep - 1) / theStep;
+	return (aCount < (uint64_t) theMax) ? (int) aCount : theMax;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Mixes theFrames output frames of theVoice into mMixBuffer, a run at a time
+// up to the end of its data.  Called with mMutex held.
+///////////////////////////////////////////////////////////////////////////////
+void SoundMixer::MixVoice(SoundMixerVoice* theVoice, int theFrames)
+{
+	if (theVoice->mStream != NULL)
+	{
+		MixStreamVoice(theVoice, theFrames);
+		return;
+	}
+
+	float aGainLeft = theVoice->mGainLeft * mMasterVolume;
+	float aGainRight = theVoice->mGainRight * mMasterVolume;
+	uint64_t anEnd = (uint64_t) theVoice->mFrames << 32;
+
+	int aDone = 0;
+	while (aDone < theFrames)
+	{
+		if (theVoice->mPos >= anEnd)
+		{
+			if (!theVoice->mLooping)
+				break;
+			theVoice->mPos %= anEnd;
+		}
+
+		int aCount = CountFrames(theVoice->mPos, theVoice->mStep, anEnd, theFrames - aDone);
+		MixRun(theVoice, mMixBuffer + aDone * mChannels, aCount, aGainLeft, aGainRight);
+		aDone += aCount;
+	}
+
+	if ((!theVoice->mLooping) && (theVoice->mPos >= anEnd))
+		FreeVoice((int)(theVoice - &mVoices[0]));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The window keeps one frame from before the position and is topped up from
+// the stream each time round.  Frames are only mixed once the two after them
+// are in too, so the taps never run off the end of the window until the end
+// of the stream.  Called with mMutex held.
+///////////////////////////////////////////////////////////////////////////////
+void SoundMixer::MixStreamVoice(SoundMixerVoice* theVoice, int theFrames)
+{
+	float aGainLeft = theVoice->mGainLeft * mMasterVolume;
+	float aGainRight = theVoice->mGainRight * mMasterVolume;
+	int16_t* aWindow = (int16_t*) theVoice->mData;
+	int aChannels = theVoice->mChannels;
+	bool ended = false;
+
+	int aDone = 0;
+	while (aDone < theFrames)
+	{
+		int aDrop = (int)(theVoice->mPos >> 32) - 1;
+		if (aDrop > 0)
+		{
+			aDrop = std::min(aDrop, theVoice->mFrames);
+			memmove(aWindow, aWindow + aDrop * aChannels, (theVoice->mFrames - aDrop) * aChannels * sizeof(int16_t));
+			theVoice->mFrames -= aDrop;
+			theVoice->mPos -= (uint64_t) aDrop << 32;
+		}
+
+		// Whatever's left once the stream says it's finished is all there is
+		bool wasFinished = theVoice->mStream->IsFinished();
+		int aRoom = STREAM_WINDOW - theVoice->mFrames;
+		int aRead = theVoice->mStream->Read(aWindow + theVoice->mFrames * aChannels, aRoom);
+		theVoice->mFrames += aRead;
+		ended = wasFinished && (aRead < aRoom);
+
+		int aReady = ended ? theVoice->mFrames : theVoice->mFrames - 2;
+		int aCount = CountFrames(theVoice->mPos, theVoice->mStep, (uint64_t) std::max(aReady, 0) << 32, theFrames - aDone);
+		if (aCount == 0)
+		{
+			if (!ended)
+				mStreamUnderruns++;
+			break;
+		}
+
+		MixRun(theVoice, mMixBuffer + aDone * mChannels, aCount, aGainLeft, aGainRight);
+		aDone += aCount;
+	}
+
+	if ((ended) && (theVoice->mPos >= ((uint64_t) theVoice->mFrames << 32)))
+		FreeVoice((int)(theVoice - &mVoices[0]));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Leaves theBuffer alone when nothing is playing.  A voice that finishes is
+// swapped out for the last active one, which is then mixed in its place.
+///////////////////////////////////////////////////////////////////////////////
+void SoundMixer::Mix(int16_t* theBuffer, int theFrames)
+{
+	SDL_LockMutex(mMutex);
+
+	while (theFrames > 0)
+	{
+		if (mActiveVoices.empty())
+			break;
+
+		int aFrames = std::min(theFrames, (int) MIX_BLOCK);
+		memset(mMixBuffer, 0, aFrames * mChannels * sizeof(float));
+
+		for (int i = 0; i < (int)mActiveVoices.size(); )
+		{
+			int anIndex = mActiveVoices[i];
+			MixVoice(&mVoices[anIndex], aFrames);
+			if (mVoices[anIndex].mPlaying)
+				i++;
+		}
+
+		int aCount = aFrames * mChannels;
+		int j = 0;
+		switch (GetSIMDLevel())
+		{
+#if defined(SEXY_SIMD_X86)
+		case SIMDLevel_AVX2:
+		case SIMDLevel_SSE2: j = AddToOutputSSE2(theBuffer, mMixBuffer, aCount); break;
+#endif
+		default: break;
+		}
+		AddToOutput(theBuffer + j, mMixBuffer + j, aCount - j);
+
+		theBuffer += aCount;
+		theFrames -= aFrames;
+	}
+
+	SDL_UnlockMutex(mMutex);
+}
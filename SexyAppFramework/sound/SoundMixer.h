@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Common.h"
+#include "ResampleKernels.h"
+
+#include <vector>
+
+struct SDL_mutex;
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Where a streamed voice gets its samples, in the voice's channel count.
+// Both calls come from the audio thread with the mixer locked, so they must
+// only hand over what's already been decoded, never wait for more.
+///////////////////////////////////////////////////////////////////////////////
+class SoundMixerStream
+{
+public:
+	virtual ~SoundMixerStream() {}
+
+	// Copies up to theMaxFrames frames into theDest, returns how many
+	virtual int				Read(int16_t* theDest, int theMaxFrames) = 0;
+
+	// True once there's nothing left for Read to return, ever
+	virtual bool			IsFinished() = 0;
+};
+
+struct SoundMixerVoice
+{
+	const int16_t*			mData;			// shared, never written; a streamed voice's window
+	int						mFrames;
+	int						mChannels;		// of mData, 1 or 2
+	uint64_t				mPos;			// in source frames, 32.32 fixed point
+	uint64_t				mStep;			// source frames per output frame, 32.32
+	float					mGainLeft;
+	float					mGainRight;
+	bool					mLooping;
+	bool					mPlaying;
+	int						mGeneration;
+	int						mActiveIndex;	// in SoundMixer::mActiveVoices while playing
+	SoundMixerStream*		mStream;		// NULL unless streamed
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Mixes sound effects for SDLSoundManager.  Every voice plays a shared,
+// read-only buffer of 16 bit samples at its own left and right gain and its
+// own rate, and all of them are summed into one float buffer before that is
+// added to the output.  Nothing here talks to a device, so the same Mix call
+// serves SDL_mixer's post-mix hook and rendering to memory.
+//
+// Voices are named by handles that go stale once the voice is reused, so a
+// sound instance can safely ask after a sound that has long finished.  Free
+// voices are kept on a stack and playing ones in a list of their own, so
+// starting a voice and mixing don't look at idle ones.  All calls can be made
+// from any thread.
+//
+// A streamed voice reads from a SoundMixerStream into a window of its own,
+// mixes what the window holds and slides it along.  If the stream falls
+// behind the voice waits where it is rather than skipping ahead.
+///////////////////////////////////////////////////////////////////////////////
+class SoundMixer
+{
+public:
+	enum
+	{
+		MIX_BLOCK = 256,		// frames mixed at once in mMixBuffer
+		MAX_VOICES = 256,		// handles keep the voice index in their low 8 bits
+		STREAM_WINDOW = 1024	// frames in a streamed voice's window
+	};
+
+	int						mFreq;
+	int						mChannels;		// of the output, 1 or 2
+	std::vector<SoundMixerVoice> mVoices;
+	std::vector<int>		mFreeVoices;
+	std::vector<int>		mActiveVoices;
+	std::vector<uint32_t>	mFinishedBits;	// voices stopped since the last TakeFinished, one bit each
+	std::vector<int16_t>	mStreamWindows;	// STREAM_WINDOW stereo frames per voice, made on first use
+	int						mStreamUnderruns;	// times a streamed voice had to wait for its stream
+	float					mMasterVolume;
+	ResampleMode			mResampleMode;	// for voices not playing at rate 1
+	SDL_mutex*				mMutex;
+	float					mMixBuffer[MIX_BLOCK * 2];
+
+protected:
+	SoundMixerVoice*		GetVoice(int theVoice);
+	void					FreeVoice(int theIndex);
+	void					MixRun(SoundMixerVoice* theVoice, float* theDest, int theCount, float theGainLeft, float theGainRight);
+	void					MixVoice(SoundMixerVoice* theVoice, int theFrames);
+	void					MixStreamVoice(SoundMixerVoice* theVoice, int theFrames);
+
+public:
+	SoundMixer(int theFreq, int theChannels, int theMaxVoices);
+	virtual ~SoundMixer();
+
+	// Starts theData playing on a free voice, and returns its handle or -1 if
+	// every voice is busy.  theRate 1 plays at the mixer's frequency.
+	int						Play(const int16_t* theData, int theFrames, int theChannels, float theGainLeft, float theGainRight, double theRate, bool looping);
+
+	// Starts a voice reading theStream, which mustn't be deleted until the
+	// voice has been stopped or is no longer playing
+	int						PlayStream(SoundMixerStream* theStream, int theChannels, float theGainLeft, float theGainRight, double theRate);
+	void					Stop(int theVoice);
+	bool					IsPlaying(int theVoice);
+	void					SetGain(int theVoice, float theGainLeft, float theGainRight);
+	void					SetRate(int theVoice, double theRate);
+
+	// Stops every voice reading theData, so it can be freed
+	void					StopSource(const int16_t* theData);
+	void					StopAll();
+	int						GetNumPlaying();
+
+	// Fills theVoices with the handles of voices that have stopped, for
+	// whatever reason, since the last call, and returns how many there were.
+	// A voice that's been reused since isn't included.
+	int						TakeFinished(int* theVoices, int theMaxVoices);
+
+	void					SetMasterVolume(double theVolume);
+	double					GetMasterVolume();
+	void					SetResampleMode(ResampleMode theMode);
+
+	// Adds theFrames frames of every playing voice into theBuffer, which holds
+	// interleaved samples in the mixer's channel count
+	void					Mix(int16_t* theBuffer, int theFrames);
+};
+
+}
@@ -0,0 +1,193 @@
+#include "TestHarness.h"
+#include "sound/SDLSoundManager.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Opens up the .au loader, on SDL's dummy audio driver so there's a mixer
+// format to convert to.
+///////////////////////////////////////////////////////////////////////////////
+class AUSoundManager : public SDLSoundManager
+{
+public:
+	using SDLSoundManager::LoadAUSound;
+
+	static AUSoundManager* Create()
+	{
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+		return new AUSoundManager();
+	}
+};
+
+static void PutBigEndian(std::vector<uint8_t>& theData, uint32_t theValue, int theBytes = 4)
+{
+	for (int aShift = theBytes * 8 - 8; aShift >= 0; aShift -= 8)
+		theData.push_back((uint8_t) (theValue >> aShift));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// An .au file with the header every .au loader reads: encoding 1 is µ-law, 2
+// 8 bit linear and 3 16 bit linear.  theDataSize is what goes in the header.
+///////////////////////////////////////////////////////////////////////////////
+static std::string WriteAUFile(const std::string& theName, uint32_t theEncoding, uint32_t theRate, uint32_t theChannels, const std::vector<uint8_t>& theSamples, uint32_t theDataSize)
+{
+	std::vector<uint8_t> aData;
+	aData.insert(aData.end(), (const uint8_t*) ".snd", (const uint8_t*) ".snd" + 4);
+	PutBigEndian(aData, 32);
+	PutBigEndian(aData, theDataSize);
+	PutBigEndian(aData, theEncoding);
+	PutBigEndian(aData, theRate);
+	PutBigEndian(aData, theChannels);
+	aData.resize(32, 0);
+	aData.insert(aData.end(), theSamples.begin(), theSamples.end());
+
+	std::string aFileName = TestGetTempDir() + theName;
+	FILE* aFP = fopen(aFileName.c_str(), "wb");
+	fwrite(&aData[0], 1, aData.size(), aFP);
+	fclose(aFP);
+	return aFileName;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The µ-law expansion LoadAUSound worked out for every sample before it went
+// to a table
+///////////////////////////////////////////////////////////////////////////////
+static int16_t OldULawSample(int ch)
+{
+	int sign = (ch < 128) ? -1 : 1;
+	ch = ch | 0x80;
+	if (ch > 239)
+		ch = ((0xF0 | 15) - ch) * 2;
+	else if (ch > 223)
+		ch = (((0xE0 | 15) - ch) * 4) + 32;
+	else if (ch > 207)
+		ch = (((0xD0 | 15) - ch) * 8) + 96;
+	else if (ch > 191)
+		ch = (((0xC0 | 15) - ch) * 16) + 224;
+	else if (ch > 175)
+		ch = (((0xB0 | 15) - ch) * 32) + 480;
+	else if (ch > 159)
+		ch = (((0xA0 | 15) - ch) * 64) + 992;
+	else if (ch > 143)
+		ch = (((0x90 | 15) - ch) * 128) + 2016;
+	else if (ch > 128)
+		ch = (((0x80 | 15) - ch) * 256) + 4064;
+	else
+		ch = 0xff;
+
+	return (int16_t) (sign * ch * 4);
+}
+
+static bool SameChunks(Mix_Chunk* theFirst, Mix_Chunk* theSecond)
+{
+	return (theFirst != NULL) && (theSecond != NULL) && (theFirst->alen == theSecond->alen) && (memcmp(theFirst->abuf, theSecond->abuf, theFirst->alen) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Every µ-law and 8 bit value, a few times over, has to come out of the mixer
+// format conversion exactly as the same samples expanded the old way and
+// stored as 16 bit do.  A size of ~0 reads to the end of the file.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(AUSoundDecodesLikeOld)
+{
+	AUSoundManager* aManager = AUSoundManager::Create();
+	if (!aManager->Initialized())
+	{
+		printf("  no dummy audio driver, skipped\n");
+		delete aManager;
+		return;
+	}
+
+	const int NUM_SWEEPS = 8;
+	std::vector<uint8_t> aSweep;
+	std::vector<uint8_t> aULawWant;
+	std::vector<uint8_t> aLinearWant;
+	for (int i = 0; i < 256 * NUM_SWEEPS; i++)
+	{
+		uint8_t aValue = (uint8_t) (i * 167 + i / 256);
+		aSweep.push_back(aValue);
+
+		PutBigEndian(aULawWant, (uint16_t) OldULawSample(aValue), 2);
+		PutBigEndian(aLinearWant, (uint16_t) ((int8_t) aValue * 256), 2);
+	}
+
+	// Every value turns up
+	std::vector<bool> aSeen(256, false);
+	for (size_t i = 0; i < aSweep.size(); i++)
+		aSeen[aSweep[i]] = true;
+	SEXY_CHECK(std::count(aSeen.begin(), aSeen.end(), false) == 0);
+
+	static const uint32_t aRates[] = { 8000, 22050, 44100 };
+	for (int aRate = 0; aRate < 3; aRate++)
+	{
+		for (uint32_t aChannels = 1; aChannels <= 2; aChannels++)
+		{
+			uint32_t aSize = (uint32_t) aSweep.size();
+			Mix_Chunk* aULaw = aManager->LoadAUSound(WriteAUFile("ulaw.au", 1, aRates[aRate], aChannels, aSweep, aSize));
+			Mix_Chunk* aULawToEnd = aManager->LoadAUSound(WriteAUFile("ulaw_to_end.au", 1, aRates[aRate], aChannels, aSweep, 0xFFFFFFFF));
+			Mix_Chunk* aULawOld = aManager->LoadAUSound(WriteAUFile("ulaw_old.au", 3, aRates[aRate], aChannels, aULawWant, aSize * 2));
+			Mix_Chunk* aLinear = aManager->LoadAUSound(WriteAUFile("linear8.au", 2, aRates[aRate], aChannels, aSweep, aSize));
+			Mix_Chunk* aLinearOld = aManager->LoadAUSound(WriteAUFile("linear8_old.au", 3, aRates[aRate], aChannels, aLinearWant, 0xFFFFFFFF));
+
+			SEXY_CHECK(SameChunks(aULaw, aULawOld));
+			SEXY_CHECK(SameChunks(aULaw, aULawToEnd));
+			SEXY_CHECK(SameChunks(aLinear, aLinearOld));
+
+			Mix_FreeChunk(aULaw);
+			Mix_FreeChunk(aULawToEnd);
+			Mix_FreeChunk(aULawOld);
+			Mix_FreeChunk(aLinear);
+			Mix_FreeChunk(aLinearOld);
+		}
+	}
+
+	// A size past the end of the file is still an error, as is one too big
+	// to be believed
+	SEXY_CHECK(aManager->LoadAUSound(WriteAUFile("short.au", 1, 8000, 1, aSweep, (uint32_t) aSweep.size() + 1)) == NULL);
+	SEXY_CHECK(aManager->LoadAUSound(WriteAUFile("huge.au", 1, 8000, 1, aSweep, 0x20000000)) == NULL);
+
+	delete aManager;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load times for generated .au files of each encoding, with the conversion
+// to the mixer's format included, as a load screen would see them
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(AUSoundLoad)
+{
+	AUSoundManager* aManager = AUSoundManager::Create();
+	if (!aManager->Initialized())
+	{
+		printf("  no dummy audio driver, skipped\n");
+		delete aManager;
+		return;
+	}
+
+	static const char* anEncodingNames[] = { "", "u-law", "8 bit", "16 bit" };
+	static const int aSizes[] = { 8000, 400000, 4000000 };
+
+	for (uint32_t anEncoding = 1; anEncoding <= 3; anEncoding++)
+	{
+		for (int aSize = 0; aSize < 3; aSize++)
+		{
+			std::vector<uint8_t> aSamples(aSizes[aSize]);
+			for (size_t i = 0; i < aSamples.size(); i++)
+				aSamples[i] = (uint8_t) (i * 7 + i / 1000);
+			std::string aFileName = WriteAUFile("bench.au", anEncoding, 22050, 1, aSamples, (uint32_t) aSamples.size());
+
+			double aBest = 1e9;
+			for (int aRun = 0; aRun < 10; aRun++)
+			{
+				PerfTimer aTimer;
+				aTimer.Start();
+				Mix_Chunk* aChunk = aManager->LoadAUSound(aFileName);
+				aBest = std::min(aBest, aTimer.GetDuration());
+				Mix_FreeChunk(aChunk);
+			}
+
+			printf("  %-6s %8d bytes: %8.3f ms, %6.1f MB/s\n", anEncodingNames[anEncoding], aSizes[aSize], aBest, aSizes[aSize] / (aBest * 1000));
+		}
+	}
+
+	delete aManager;
+}
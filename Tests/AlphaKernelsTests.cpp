@@ -0,0 +1,246 @@
+#include "TestHarness.h"
+#include "graphics/AlphaKernels.h"
+#include "misc/CPUFeatures.h"
+#include "misc/MTRand.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// The loops CommitBits and GetNativeAlphaData ran before the kernels, which
+// every level has to match bit for bit.
+///////////////////////////////////////////////////////////////////////////////
+static int OldClassify(const uint32_t* theBits, int theCount)
+{
+	bool hasTrans = false;
+	bool hasAlpha = false;
+
+	for (int i = 0; i < theCount; i++)
+	{
+		uchar anAlpha = (uchar) (theBits[i] >> 24);
+
+		if (anAlpha == 0)
+			hasTrans = true;
+		else if (anAlpha != 255)
+			hasAlpha = true;
+	}
+
+	return (hasTrans ? ALPHA_HAS_TRANS : 0) | (hasAlpha ? ALPHA_HAS_ALPHA : 0);
+}
+
+// 8 bit channels, red at rLeftShift and blue at bLeftShift
+static uint32_t OldNativeAlpha(uint32_t val, int rLeftShift, int bLeftShift)
+{
+	int anAlpha = val >> 24;
+
+	uint32_t r = ((val & 0xFF0000) * (anAlpha+1)) >> 8;
+	uint32_t g = ((val & 0x00FF00) * (anAlpha+1)) >> 8;
+	uint32_t b = ((val & 0x0000FF) * (anAlpha+1)) >> 8;
+
+	return
+		(((r >> 16) << rLeftShift) & (0xFF << rLeftShift)) |
+		(((g >> 8) << 8) & 0xFF00) |
+		(((b >> 0) << bLeftShift) & (0xFF << bLeftShift)) |
+		(anAlpha << 24);
+}
+
+static const char* gSIMDLevelNames[] = { "scalar", "SSE2", "AVX2", "NEON" };
+
+// Written just past the end of every row, and must still be there after
+static const uint32_t GUARD = 0xDEADBEEF;
+
+enum
+{
+	ROW_OPAQUE,
+	ROW_BINARY,				// 0 and 255 only, like a color keyed sprite
+	ROW_TRANSLUCENT,
+	ROW_ONE_ODD_PIXEL,		// opaque but for one pixel somewhere
+	NUM_ROW_KINDS
+};
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void MakeRow(MTRand& theRand, uint32_t* theRow, int theCount, int theKind)
+{
+	for (int i = 0; i < theCount; i++)
+	{
+		uint32_t aColor = (uint32_t)theRand.Next() & 0xFFFFFF;
+		uint32_t anAlpha;
+		switch (theKind)
+		{
+		case ROW_BINARY:		anAlpha = theRand.Next(2UL) ? 255 : 0; break;
+		case ROW_TRANSLUCENT:	anAlpha = theRand.Next(256UL); break;
+		default:				anAlpha = 255; break;
+		}
+		theRow[i] = (anAlpha << 24) | aColor;
+	}
+
+	if (theKind == ROW_ONE_ODD_PIXEL && theCount > 0)
+	{
+		static const uint32_t ODD_ALPHAS[] = { 0, 1, 128, 254 };
+		theRow[theRand.Next((unsigned long)theCount)] = (ODD_ALPHAS[theRand.Next(4UL)] << 24) | 0x123456;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Random rows of every length up to a few AVX2 registers and some as wide as
+// a background, starting at odd offsets so the kernels see unaligned
+// pointers.  Returns how many rows or pixels differ from the old loops, or
+// were written past the row.
+///////////////////////////////////////////////////////////////////////////////
+static int CheckRows(MTRand& theRand, int theIterations)
+{
+	int aNumBad = 0;
+	for (int anIteration = 0; anIteration < theIterations; anIteration++)
+	{
+		int aCount = (anIteration % 10 == 0) ? 1000 + theRand.Next(3000UL) : theRand.Next(100UL);
+		int anOffset = theRand.Next(8UL);
+		int aKind = theRand.Next((unsigned long)NUM_ROW_KINDS);
+
+		std::vector<uint32_t> aSrc(anOffset + aCount + 1);
+		MakeRow(theRand, &aSrc[anOffset], aCount, aKind);
+
+		aNumBad += ClassifyAlpha(&aSrc[anOffset], aCount) != OldClassify(&aSrc[anOffset], aCount);
+
+		std::vector<uint32_t> anARGB(anOffset + aCount + 1, GUARD);
+		std::vector<uint32_t> anABGR(anOffset + aCount + 1, GUARD);
+		PremultiplyRow(&anARGB[anOffset], &aSrc[anOffset], aCount, false);
+		PremultiplyRow(&anABGR[anOffset], &aSrc[anOffset], aCount, true);
+
+		for (int i = anOffset; i < anOffset + aCount; i++)
+		{
+			aNumBad += anARGB[i] != OldNativeAlpha(aSrc[i], 16, 0);
+			aNumBad += anABGR[i] != OldNativeAlpha(aSrc[i], 0, 16);
+		}
+
+		int anEnd = anOffset + aCount;
+		aNumBad += (anARGB[anEnd] != GUARD) + (anABGR[anEnd] != GUARD);
+
+		// In place, as a caller converting its own buffer would
+		PremultiplyRow(&aSrc[anOffset], &aSrc[anOffset], aCount, false);
+		for (int i = anOffset; i < anOffset + aCount; i++)
+			aNumBad += aSrc[i] != anARGB[i];
+	}
+
+	return aNumBad;
+}
+
+SEXY_TEST(AlphaKernelsMatchOld)
+{
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel)aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue; // not on this CPU
+
+		MTRand aRand(4321);
+		int aNumBad = CheckRows(aRand, 2000);
+		printf("  %s: %d rows or pixels differ\n", gSIMDLevelNames[aLevel], aNumBad);
+		SEXY_CHECK(aNumBad == 0);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The one pixel that decides the answer can be in any lane of any chunk, and
+// the early out mustn't stop before both flags are seen.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ClassifyAlphaFindsEveryPosition)
+{
+	const int COUNT = 600;
+	std::vector<uint32_t> aRow(COUNT);
+
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel)aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue;
+
+		int aNumBad = 0;
+		for (int aPos = 0; aPos < COUNT; aPos++)
+		{
+			std::fill(aRow.begin(), aRow.end(), 0xFF808080);
+			aRow[aPos] = 0x00808080;
+			aNumBad += ClassifyAlpha(&aRow[0], COUNT) != ALPHA_HAS_TRANS;
+			aRow[aPos] = 0xFE808080;
+			aNumBad += ClassifyAlpha(&aRow[0], COUNT) != ALPHA_HAS_ALPHA;
+
+			// Transparent first, translucent last, so the early out has to
+			// keep going
+			aRow[aPos] = 0x00808080;
+			aRow[COUNT - 1] = 0x01808080;
+			aNumBad += ClassifyAlpha(&aRow[0], COUNT) != (aPos == COUNT - 1 ? ALPHA_HAS_ALPHA : ALPHA_HAS_TRANS | ALPHA_HAS_ALPHA);
+		}
+
+		printf("  %s: %d wrong\n", gSIMDLevelNames[aLevel], aNumBad);
+		SEXY_CHECK(aNumBad == 0);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Classifying and premultiplying 1920x1080 and 2048x2048 backgrounds, opaque
+// (the worst case for classify, which can't stop early) and translucent, at
+// each level the CPU has, against the old loops.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(AlphaKernelBackgrounds)
+{
+	static const int SIZES[][2] = { { 1920, 1080 }, { 2048, 2048 } };
+	const int NUM_PASSES = 10;
+
+	MTRand aRand(17);
+	for (int aSize = 0; aSize < 2; aSize++)
+	{
+		int aCount = SIZES[aSize][0] * SIZES[aSize][1];
+		std::vector<uint32_t> anOpaque(aCount);
+		std::vector<uint32_t> aTranslucent(aCount);
+		std::vector<uint32_t> aDest(aCount);
+		MakeRow(aRand, &anOpaque[0], aCount, ROW_OPAQUE);
+		MakeRow(aRand, &aTranslucent[0], aCount, ROW_TRANSLUCENT);
+
+		printf("  %dx%d\n", SIZES[aSize][0], SIZES[aSize][1]);
+
+		int aFlags = 0;
+		PerfTimer aTimer;
+		aTimer.Start();
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+			aFlags |= OldClassify(&anOpaque[0], aCount);
+		double aClassifyTime = aTimer.GetDuration();
+
+		aTimer.Start();
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			for (int i = 0; i < aCount; i++)
+				aDest[i] = OldNativeAlpha(aTranslucent[i], 16, 0);
+		}
+		double aPremultiplyTime = aTimer.GetDuration();
+
+		printf("    %-6s classify %6.2f ms, premultiply %6.2f ms\n", "old",
+			aClassifyTime / NUM_PASSES, aPremultiplyTime / NUM_PASSES);
+
+		for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+		{
+			SetSIMDLevel((SIMDLevel)aLevel);
+			if (GetSIMDLevel() != aLevel)
+				continue;
+
+			aTimer.Start();
+			for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+				aFlags |= ClassifyAlpha(&anOpaque[0], aCount);
+			aClassifyTime = aTimer.GetDuration();
+
+			aTimer.Start();
+			for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+				PremultiplyRow(&aDest[0], &aTranslucent[0], aCount, false);
+			aPremultiplyTime = aTimer.GetDuration();
+
+			printf("    %-6s classify %6.2f ms, premultiply %6.2f ms\n", gSIMDLevelNames[aLevel],
+				aClassifyTime / NUM_PASSES, aPremultiplyTime / NUM_PASSES);
+		}
+
+		SEXY_CHECK(aFlags == 0);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
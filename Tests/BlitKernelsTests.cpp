@@ -0,0 +1,232 @@
+#include "TestHarness.h"
+#include "graphics/BlitKernels.h"
+#include "graphics/Color.h"
+#include "misc/CPUFeatures.h"
+#include "misc/MTRand.h"
+#include "misc/Rect.h"
+
+// The reference routines are the ones MemoryImage uses
+#define OPTIMIZE_SOFTWARE_DRAWING
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Just enough of MemoryImage for MI_NormalBlt.inc and MI_AdditiveBlt.inc to
+// build, so the kernels are checked against the per-pixel code itself.
+///////////////////////////////////////////////////////////////////////////////
+struct ReferenceTables
+{
+	uchar					mAdd8BitMaxTable[512];
+
+	ReferenceTables()
+	{
+		// As SexyAppBase fills it in
+		for (int i = 0; i < 512; i++)
+			mAdd8BitMaxTable[i] = (i < 256) ? i : 255;
+	}
+};
+
+class ReferenceImage
+{
+public:
+	int						mWidth;
+	int						mHeight;
+	bool					mHasAlpha;
+	bool					mHasTrans;
+	std::vector<uint32_t>	mBits;
+	ReferenceTables*		mApp;
+
+public:
+	uint32_t*				GetBits() { return &mBits[0]; }
+	uchar*					GetRLAlphaData() { return NULL; } // only the opaque path wants it
+
+	void NormalBlt(ReferenceImage* theImage, int theX, int theY, const Rect& theSrcRect, const Color& theColor)
+	{
+		ReferenceImage* aSrcMemoryImage = theImage;
+		uint32_t* aSrcPixelsRow = theImage->GetBits() + (theSrcRect.mY * theImage->mWidth) + theSrcRect.mX;
+
+		#define NEXT_SRC_COLOR		(*(aSrcPtr++))
+		#define READ_SRC_COLOR		(*(aSrcPtr))
+		#define EACH_ROW			uint32_t* aSrcPtr = aSrcPixelsRow
+
+		#include "graphics/inc_routines/MI_NormalBlt.inc"
+
+		#undef NEXT_SRC_COLOR
+		#undef READ_SRC_COLOR
+		#undef EACH_ROW
+	}
+
+	void AdditiveBlt(ReferenceImage* theImage, int theX, int theY, const Rect& theSrcRect, const Color& theColor)
+	{
+		ReferenceImage* aSrcMemoryImage = theImage;
+		uchar* aMaxTable = mApp->mAdd8BitMaxTable;
+		uint32_t* aSrcBits = theImage->GetBits();
+
+		#define NEXT_SRC_COLOR		(*(aSrcPtr++))
+		#define SRC_TYPE			uint32_t
+
+		#include "graphics/inc_routines/MI_AdditiveBlt.inc"
+
+		#undef NEXT_SRC_COLOR
+		#undef SRC_TYPE
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Mostly random pixels, with plenty of the alphas the kernels special case.
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t RandomPixel(MTRand& theRand, bool opaque)
+{
+	uint32_t aPixel = (uint32_t)theRand.Next();
+	int aKind = theRand.Next(8UL);
+	if (opaque || aKind == 1)
+		aPixel |= 0xFF000000;
+	else if (aKind == 0)
+		aPixel &= 0x00FFFFFF;
+	return aPixel;
+}
+
+static void FillRandom(ReferenceImage* theImage, int theWidth, int theHeight, MTRand& theRand, bool opaque)
+{
+	theImage->mWidth = theWidth;
+	theImage->mHeight = theHeight;
+	theImage->mHasTrans = false;
+	theImage->mBits.resize(theWidth * theHeight);
+	for (int i = 0; i < theWidth * theHeight; i++)
+		theImage->mBits[i] = RandomPixel(theRand, opaque);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns how many pixels differ.
+///////////////////////////////////////////////////////////////////////////////
+static int CheckBlits(MTRand& theRand, int theIterations)
+{
+	// Grey and non grey tints take different paths through MI_NormalBlt.inc
+	static const Color aColors[] =
+	{
+		Color::White, Color(128, 128, 128, 255), Color(200, 200, 200, 100), Color(255, 0, 0, 255), Color(10, 200, 77, 180),
+		Color(255, 255, 255, 0), Color(3, 3, 3, 3), Color(0, 0, 0, 255), Color(255, 255, 255, 254)
+	};
+	const int aNumColors = sizeof(aColors) / sizeof(aColors[0]);
+
+	ReferenceTables aTables;
+	int aNumBad = 0;
+	for (int anIteration = 0; anIteration < theIterations; anIteration++)
+	{
+		// Widths past two AVX2 registers, so every kernel's tail is covered
+		int aWidth = 1 + theRand.Next(40UL);
+		int aHeight = 1 + theRand.Next(4UL);
+		const Color& aColor = aColors[anIteration % aNumColors];
+
+		ReferenceImage aSrc;
+		FillRandom(&aSrc, aWidth, aHeight, theRand, false);
+		aSrc.mHasAlpha = (anIteration & 8) != 0;
+
+		ReferenceImage aDest;
+		FillRandom(&aDest, aWidth, aHeight, theRand, anIteration % 3 != 0);
+		aDest.mHasAlpha = (anIteration & 4) != 0;
+		aDest.mApp = &aTables;
+
+		Rect aRect(0, 0, aWidth, aHeight);
+
+		// MemoryImage only uses the normal kernel when it would blend
+		if (aDest.mHasAlpha || aColor != Color::White)
+		{
+			ReferenceImage aWant = aDest;
+			aWant.NormalBlt(&aSrc, 0, 0, aRect, aColor);
+
+			std::vector<uint32_t> aGot = aDest.mBits;
+			for (int y = 0; y < aHeight; y++)
+				BlendRowNormal(&aGot[y * aWidth], &aSrc.mBits[y * aWidth], aWidth, aColor);
+
+			for (int i = 0; i < aWidth * aHeight; i++)
+				aNumBad += aGot[i] != aWant.mBits[i];
+		}
+
+		ReferenceImage aWant = aDest;
+		aWant.AdditiveBlt(&aSrc, 0, 0, aRect, aColor);
+
+		std::vector<uint32_t> aGot = aDest.mBits;
+		for (int y = 0; y < aHeight; y++)
+			BlendRowAdditive(&aGot[y * aWidth], &aSrc.mBits[y * aWidth], aWidth, aColor, aSrc.mHasAlpha);
+
+		for (int i = 0; i < aWidth * aHeight; i++)
+			aNumBad += aGot[i] != aWant.mBits[i];
+	}
+
+	return aNumBad;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static const char* gSIMDLevelNames[] = { "scalar", "SSE2", "AVX2", "NEON" };
+
+SEXY_TEST(BlitKernelsMatchIncRoutines)
+{
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel)aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue; // not on this CPU
+
+		// Same pixels at every level
+		MTRand aRand(1234);
+		int aNumBad = CheckBlits(aRand, 2000);
+		printf("  %s: %d pixels differ\n", gSIMDLevelNames[aLevel], aNumBad);
+		SEXY_CHECK(aNumBad == 0);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A 1024x1024 blit of each kind, at each level the CPU has.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(BlitKernelRows)
+{
+	const int SIZE = 1024;
+
+	MTRand aRand(99);
+	std::vector<uint32_t> aSrc(SIZE * SIZE);
+	std::vector<uint32_t> aDest(SIZE * SIZE);
+	for (int i = 0; i < SIZE * SIZE; i++)
+	{
+		aSrc[i] = RandomPixel(aRand, false);
+		aDest[i] = RandomPixel(aRand, true);
+	}
+
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel)aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue;
+
+		const int NUM_PASSES = 10;
+		double aTimes[3] = { 0, 0, 0 };
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			for (int aKind = 0; aKind < 3; aKind++)
+			{
+				PerfTimer aTimer;
+				aTimer.Start();
+				for (int y = 0; y < SIZE; y++)
+				{
+					uint32_t* aDestRow = &aDest[y * SIZE];
+					const uint32_t* aSrcRow = &aSrc[y * SIZE];
+					if (aKind == 0)
+						BlendRowNormal(aDestRow, aSrcRow, SIZE, Color::White);
+					else if (aKind == 1)
+						BlendRowNormal(aDestRow, aSrcRow, SIZE, Color(10, 200, 77, 180));
+					else
+						BlendRowAdditive(aDestRow, aSrcRow, SIZE, Color::White, true);
+				}
+				aTimes[aKind] += aTimer.GetDuration();
+			}
+		}
+
+		printf("  %-6s normal %.2f ms, tinted %.2f ms, additive %.2f ms\n", gSIMDLevelNames[aLevel],
+			aTimes[0] / NUM_PASSES, aTimes[1] / NUM_PASSES, aTimes[2] / NUM_PASSES);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
@@ -0,0 +1,196 @@
+#include "TestHarness.h"
+#include "graphics/GLBatcher.h"
+#include "graphics/Graphics.h"
+#include "misc/MTRand.h"
+#include "RecordingGL.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static GLBatchState MakeBatchState(GLuint theTexture, int theDrawMode, bool linear, GLenum thePrimitive)
+{
+	GLBatchState aState;
+	aState.mTexture = theTexture;
+	aState.mDrawMode = theDrawMode;
+	aState.mLinearFilter = linear;
+	aState.mPrimitive = thePrimitive;
+	return aState;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(BatchStateBreaksOnTextureModeAndPrimitive)
+{
+	GLBatchState aState = MakeBatchState(1, Graphics::DRAWMODE_NORMAL, true, GL_TRIANGLES);
+
+	SEXY_CHECK(aState == MakeBatchState(1, Graphics::DRAWMODE_NORMAL, true, GL_TRIANGLES));
+	SEXY_CHECK(aState != MakeBatchState(2, Graphics::DRAWMODE_NORMAL, true, GL_TRIANGLES));
+	SEXY_CHECK(aState != MakeBatchState(1, Graphics::DRAWMODE_ADDITIVE, true, GL_TRIANGLES));
+	SEXY_CHECK(aState != MakeBatchState(1, Graphics::DRAWMODE_NORMAL, true, GL_LINES));
+	SEXY_CHECK(aState != MakeBatchState(1, Graphics::DRAWMODE_NORMAL, false, GL_TRIANGLES));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(BatchStateIgnoresFilterWhenUntextured)
+{
+	// Untextured draws never sample, so switching filters between them
+	// mustn't cost a draw call
+	SEXY_CHECK(MakeBatchState(0, Graphics::DRAWMODE_NORMAL, true, GL_TRIANGLES) == MakeBatchState(0, Graphics::DRAWMODE_NORMAL, false, GL_TRIANGLES));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The kinds of thing a particle heavy screen draws, back to front.
+///////////////////////////////////////////////////////////////////////////////
+enum SceneDrawKind
+{
+	SceneDraw_Board,		// texture 1
+	SceneDraw_Particle,		// texture 2, additive
+	SceneDraw_Widget,		// texture 3, unfiltered
+	SceneDraw_Fill,			// untextured, whatever filter was last set
+	SceneDraw_Line,
+	NUM_SCENE_DRAW_KINDS
+};
+
+static GLBatchState GetSceneDrawState(int theKind, bool linear)
+{
+	switch (theKind)
+	{
+	case SceneDraw_Board: return MakeBatchState(1, Graphics::DRAWMODE_NORMAL, true, GL_TRIANGLES);
+	case SceneDraw_Particle: return MakeBatchState(2, Graphics::DRAWMODE_ADDITIVE, true, GL_TRIANGLES);
+	case SceneDraw_Widget: return MakeBatchState(3, Graphics::DRAWMODE_NORMAL, false, GL_TRIANGLES);
+	case SceneDraw_Fill: return MakeBatchState(0, Graphics::DRAWMODE_NORMAL, linear, GL_TRIANGLES);
+	default: return MakeBatchState(0, Graphics::DRAWMODE_NORMAL, linear, GL_LINES);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Runs of random length of each kind, the way sprites sorted by layer come
+// out.  Every vertex carries the index of its draw in color, so the order
+// they reach GL in can be checked.
+///////////////////////////////////////////////////////////////////////////////
+static void DrawScene(GLBatcher* theBatcher, std::vector<GLBatchState>& theStates, int theNumDraws, MTRand& theRand)
+{
+	theStates.clear();
+	while ((int)theStates.size() < theNumDraws)
+	{
+		int aKind = theRand.Next((unsigned long)NUM_SCENE_DRAW_KINDS);
+		int aRunLength = 1 + theRand.Next((aKind == SceneDraw_Particle) ? 300UL : 40UL);
+
+		for (int i = 0; i < aRunLength && (int)theStates.size() < theNumDraws; i++)
+		{
+			bool linear = theRand.Next(2UL) != 0;
+			GLBatchState aState = GetSceneDrawState(aKind, linear);
+			theBatcher->SetTexture(aState.mTexture);
+			theBatcher->SetDrawMode(aState.mDrawMode);
+			theBatcher->SetLinearFilter(aState.mLinearFilter);
+
+			float aX = (float)theRand.Next(800UL);
+			float aY = (float)theRand.Next(600UL);
+			GLVertex aQuad[4];
+			for (int j = 0; j < 4; j++)
+			{
+				aQuad[j].sx = aX + (j & 1) * 16;
+				aQuad[j].sy = aY + (j >> 1) * 16;
+				aQuad[j].sz = 0;
+				aQuad[j].color = (uint32_t)theStates.size();
+				aQuad[j].tu = (float)(j & 1);
+				aQuad[j].tv = (float)(j >> 1);
+			}
+
+			if (aKind == SceneDraw_Line)
+				theBatcher->AddLineStrip(aQuad, 2);
+			else
+				theBatcher->AddTriangleStrip(aQuad, 4);
+			theStates.push_back(aState);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A scene goes to GL as one draw per run of matching state, split only where
+// a run overflows the vertex buffer, with every vertex in the order it was
+// drawn in.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(BatcherDrawsSceneInOrder)
+{
+	// A multiple of 6 and 2, so runs split exactly where the buffer fills
+	const int CAPACITY = 600;
+	const int NUM_DRAWS = 5000;
+
+	MTRand aRand(1);
+	RecordingBatcher aBatcher(CAPACITY);
+	std::vector<GLBatchState> aStates;
+	DrawScene(&aBatcher, aStates, NUM_DRAWS, aRand);
+	aBatcher.EndFrame();
+
+	// One draw for every buffer's worth of each run
+	int aWantDraws = 0;
+	int aNumRuns = 0;
+	for (int aStart = 0; aStart < NUM_DRAWS; )
+	{
+		int aRunVertices = 0;
+		int anEnd = aStart;
+		for (; anEnd < NUM_DRAWS && aStates[anEnd] == aStates[aStart]; anEnd++)
+			aRunVertices += (aStates[anEnd].mPrimitive == GL_LINES) ? 2 : 6;
+
+		aWantDraws += (aRunVertices + CAPACITY - 1) / CAPACITY;
+		aNumRuns++;
+		aStart = anEnd;
+	}
+
+	SEXY_CHECK((int)aBatcher.mBatches.size() == aWantDraws);
+	SEXY_CHECK(aBatcher.mLastFrameStats.mDrawCalls == aWantDraws);
+	SEXY_CHECK(aBatcher.mLastFrameStats.mPrimitives == NUM_DRAWS);
+	SEXY_CHECK(aBatcher.mLastFrameStats.mStateBreaks == aNumRuns - 1);
+	SEXY_CHECK(aBatcher.mLastFrameStats.mOverflowBreaks == aWantDraws - aNumRuns);
+	printf("  %d draws in %d runs went out as %d draw calls\n", NUM_DRAWS, aNumRuns, aWantDraws);
+
+	// Back to front, each draw whole and under its own state
+	uint32_t aNextDraw = 0;
+	int aVerticesLeft = 0;
+	int aNumBadOrder = 0;
+	int aNumBadState = 0;
+	int aNumVertices = 0;
+	for (size_t aBatchNum = 0; aBatchNum < aBatcher.mBatches.size(); aBatchNum++)
+	{
+		RecordedBatch& aBatch = aBatcher.mBatches[aBatchNum];
+		SEXY_CHECK((int)aBatch.mVertices.size() <= CAPACITY);
+
+		for (size_t i = 0; i < aBatch.mVertices.size(); i++)
+		{
+			uint32_t aDraw = aBatch.mVertices[i].color;
+			if (aVerticesLeft == 0)
+			{
+				aNumBadOrder += aDraw != aNextDraw;
+				aVerticesLeft = (aStates[aDraw].mPrimitive == GL_LINES) ? 2 : 6;
+				aNextDraw = aDraw + 1;
+			}
+			else
+				aNumBadOrder += aDraw != aNextDraw - 1;
+
+			aNumBadState += aStates[aDraw] != aBatch.mState;
+			aVerticesLeft--;
+			aNumVertices++;
+		}
+	}
+	SEXY_CHECK(aNumBadOrder == 0);
+	SEXY_CHECK(aNumBadState == 0);
+	SEXY_CHECK(aNextDraw == NUM_DRAWS);
+	SEXY_CHECK(aNumVertices == aBatcher.mLastFrameStats.mVertices);
+
+	// Textures are only bound when the batch's texture changes
+	int aWantBinds = 0;
+	GLuint aBoundTexture = 0;
+	for (size_t aBatchNum = 0; aBatchNum < aBatcher.mBatches.size(); aBatchNum++)
+	{
+		GLuint aTexture = aBatcher.mBatches[aBatchNum].mState.mTexture;
+		if (aTexture != 0 && aTexture != aBoundTexture)
+		{
+			aWantBinds++;
+			aBoundTexture = aTexture;
+		}
+	}
+	SEXY_CHECK(aBatcher.mRecordingCache.CountCalls("BindTexture") == aWantBinds);
+}
@@ -0,0 +1,121 @@
+#include <GL/glew.h>
+
+#include "TestHarness.h"
+#include "RecordingGL.h"
+
+using namespace Sexy;
+
+static const GLint UF_USE_TEXTURE = 3;
+
+///////////////////////////////////////////////////////////////////////////////
+// What GLImage::PreDraw used to send for every blit, whether anything had
+// changed or not.
+///////////////////////////////////////////////////////////////////////////////
+static void PreDraw(GLStateCache* theCache, GLuint theTexture, bool additive, bool linear)
+{
+	GLint aFilter = linear ? GL_LINEAR : GL_NEAREST;
+
+	theCache->BlendFunc(GL_SRC_ALPHA, additive ? GL_ONE : GL_ONE_MINUS_SRC_ALPHA);
+	theCache->BindTexture(theTexture);
+	theCache->TexParameter(GL_TEXTURE_MAG_FILTER, aFilter);
+	theCache->TexParameter(GL_TEXTURE_MIN_FILTER, aFilter);
+	theCache->Uniform1i(UF_USE_TEXTURE, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A frame of blits from two textures drawn in runs, the way a board full of
+// sprites goes.  Only the changes reach GL, and the counters agree with what
+// actually got through.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(StateCacheSkipsRedundantFrame)
+{
+	RecordingStateCache aCache;
+	aCache.UseProgram(7);
+	GLuint aTextures[2] = { aCache.GenTexture(), aCache.GenTexture() };
+	aCache.EndFrame();
+
+	const int NUM_RUNS = 10;
+	const int RUN_LENGTH = 50;
+	for (int aFrame = 0; aFrame < 2; aFrame++)
+	{
+		aCache.mCalls.clear();
+		for (int aRun = 0; aRun < NUM_RUNS; aRun++)
+		{
+			for (int i = 0; i < RUN_LENGTH; i++)
+				PreDraw(&aCache, aTextures[aRun & 1], false, true);
+		}
+		aCache.EndFrame();
+
+		GLStateCounters& aCounters = aCache.mLastFrameCounters;
+		SEXY_CHECK(aCounters.mIssued + aCounters.mSkipped == NUM_RUNS * RUN_LENGTH * 5);
+		SEXY_CHECK(aCounters.mIssued == (int)aCache.mCalls.size());
+		SEXY_CHECK(aCache.CountCalls("BindTexture") == NUM_RUNS);
+
+		// Filters are kept per texture, so each only has its min filter set
+		// the first time it's seen (new textures are already magnified
+		// linearly)
+		int aWantFilters = (aFrame == 0) ? 2 : 0;
+		SEXY_CHECK(aCache.CountCalls("TexParameter") == aWantFilters);
+		SEXY_CHECK(aCache.CountCalls("BlendFunc") == ((aFrame == 0) ? 1 : 0));
+		SEXY_CHECK(aCache.CountCalls("Uniform1i") == ((aFrame == 0) ? 1 : 0));
+		SEXY_CHECK(aCounters.mIssued == NUM_RUNS + aWantFilters + ((aFrame == 0) ? 2 : 0));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The cases where the cache has to let a call through again.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(StateCacheForgetsWhenGLWould)
+{
+	RecordingStateCache aCache;
+	aCache.UseProgram(1);
+	GLuint aTexture = aCache.GenTexture();
+
+	// A new texture starts with GL's defaults, so setting one is free
+	aCache.BindTexture(aTexture);
+	aCache.mCalls.clear();
+	aCache.TexParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	aCache.TexParameter(GL_TEXTURE_WRAP_S, GL_REPEAT);
+	SEXY_CHECK(aCache.mCalls.empty());
+
+	aCache.TexParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	aCache.Uniform1i(UF_USE_TEXTURE, 1);
+	SEXY_CHECK(aCache.mCalls.size() == 2);
+
+	// Uniforms belong to the program
+	aCache.UseProgram(2);
+	aCache.mCalls.clear();
+	aCache.Uniform1i(UF_USE_TEXTURE, 1);
+	SEXY_CHECK(aCache.CountCalls("Uniform1i") == 1);
+
+	// A deleted name comes back from GenTexture with the defaults again, and
+	// deleting the bound texture binds 0
+	aCache.DeleteTexture(aTexture);
+	SEXY_CHECK(aCache.mBoundTexture == 0);
+	SEXY_CHECK(aCache.GenTexture() == aTexture);
+	aCache.BindTexture(aTexture);
+	aCache.mCalls.clear();
+	aCache.TexParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	SEXY_CHECK(aCache.CountCalls("TexParameter") == 1);
+
+	// Only the buffer targets the cache knows about are tracked
+	aCache.mCalls.clear();
+	aCache.BindBuffer(GL_ARRAY_BUFFER, 4);
+	aCache.BindBuffer(GL_ARRAY_BUFFER, 4);
+	aCache.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 5);
+	aCache.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 5);
+	SEXY_CHECK(aCache.mCalls.size() == 3);
+	aCache.DeleteBuffer(4);
+	SEXY_CHECK(aCache.mArrayBuffer == 0);
+
+	// After Invalidate everything goes through once
+	aCache.Invalidate();
+	aCache.mCalls.clear();
+	aCache.EndFrame();
+	for (int i = 0; i < 3; i++)
+		PreDraw(&aCache, aTexture, true, false);
+	aCache.EndFrame();
+	SEXY_CHECK(aCache.mCalls.size() == 5);
+	SEXY_CHECK(aCache.mLastFrameCounters.mIssued == 5);
+	SEXY_CHECK(aCache.mLastFrameCounters.mSkipped == 10);
+}
@@ -0,0 +1,242 @@
+#include <GL/glew.h>
+
+#include "TestHarness.h"
+#include "graphics/GLStreamBuffer.h"
+#include "misc/MTRand.h"
+
+#include <map>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Fences are numbers, and the test tells the backend which positions each one
+// covers so it can check every wait against what's being handed out.
+///////////////////////////////////////////////////////////////////////////////
+class FakeRingBackend : public StreamRingBackend
+{
+public:
+	struct FakeFence
+	{
+		int64_t mStart;
+		int64_t mEnd;
+		bool mWaited;
+	};
+	typedef std::map<intptr_t, FakeFence> FenceMap;
+
+	FenceMap				mLive;
+	intptr_t				mNextFence;
+	std::vector<FakeFence>	mWaits;			// since the last Allocate
+	std::vector<int>		mGrowths;
+	int						mBadCalls;		// waits or deletes of fences that aren't live
+
+public:
+	FakeRingBackend()
+	{
+		mNextFence = 1;
+		mBadCalls = 0;
+	}
+
+	virtual void* InsertFence()
+	{
+		FakeFence aFence = { 0, 0, false };
+		mLive[mNextFence] = aFence;
+		return (void*)mNextFence++;
+	}
+
+	virtual void WaitFence(void* theFence)
+	{
+		FenceMap::iterator anItr = mLive.find((intptr_t)theFence);
+		if (anItr == mLive.end() || anItr->second.mWaited)
+		{
+			mBadCalls++;
+			return;
+		}
+
+		anItr->second.mWaited = true;
+		mWaits.push_back(anItr->second);
+	}
+
+	virtual void DeleteFence(void* theFence)
+	{
+		mBadCalls += mLive.erase((intptr_t)theFence) != 1;
+	}
+
+	virtual void GrowStorage(int theCapacity)
+	{
+		mGrowths.push_back(theCapacity);
+	}
+
+	// Call after StreamRing::EndFrame
+	void NoteFrame(StreamRing& theRing)
+	{
+		if (!theRing.mFences.empty())
+		{
+			const StreamRing::Fence& aFence = theRing.mFences.back();
+			FakeFence& aFake = mLive[(intptr_t)aFence.mFence];
+			aFake.mStart = aFence.mStart;
+			aFake.mEnd = aFence.mEnd;
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Frames of batches of random sizes lap a small ring many times over.  Every
+// range lies inside the buffer, every byte handed out was last used by a
+// frame whose fence was waited on first, and every fence waited on covers
+// some of the bytes handed out.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(StreamRingWaitsOnlyOnCoveringFences)
+{
+	const int CAPACITY = 4096;
+
+	FakeRingBackend aBackend;
+	int aNumBad = 0;
+	int aNumDropped = 0;
+	{
+		StreamRing aRing(&aBackend, CAPACITY);
+		std::vector<int64_t> aLastUse(CAPACITY, -1);	// position that last wrote each byte
+		MTRand aRand(21);
+
+		for (int aFrame = 0; aFrame < 2000; aFrame++)
+		{
+			int aNumBatches = 1 + aRand.Next(6UL);
+			for (int aBatch = 0; aBatch < aNumBatches; aBatch++)
+			{
+				int aSize = 1 + aRand.Next(300UL);
+				size_t aLiveBefore = aBackend.mLive.size();
+				aBackend.mWaits.clear();
+
+				int anOffset = aRing.Allocate(aSize);
+				int64_t aStart = aRing.mHead - aSize;
+				if (anOffset < 0 || anOffset + aSize > CAPACITY || aStart % CAPACITY != anOffset)
+				{
+					aNumBad++;
+					continue;
+				}
+
+				for (size_t i = 0; i < aBackend.mWaits.size(); i++)
+				{
+					const FakeRingBackend::FakeFence& aFence = aBackend.mWaits[i];
+					aNumBad += aFence.mEnd <= aStart - CAPACITY || aFence.mStart >= aStart + aSize - CAPACITY;
+				}
+				aNumDropped += (int)(aLiveBefore - aBackend.mLive.size() - aBackend.mWaits.size());
+
+				// The previous user of each byte is either long done or its
+				// fence was just waited on
+				for (int i = anOffset; i < anOffset + aSize; i++)
+				{
+					int64_t aPos = aLastUse[i];
+					for (FakeRingBackend::FenceMap::iterator anItr = aBackend.mLive.begin(); anItr != aBackend.mLive.end(); ++anItr)
+						aNumBad += aPos >= anItr->second.mStart && aPos < anItr->second.mEnd;
+					aNumBad += aPos >= aRing.mFrameStart;
+					aLastUse[i] = aStart + (i - anOffset);
+				}
+			}
+
+			aRing.EndFrame();
+			aBackend.NoteFrame(aRing);
+		}
+
+		StreamRingStats& aStats = aRing.mStats;
+		printf("  %d allocations, %d wraps, %d fence waits, %d fences dropped unwaited\n", aStats.mAllocations, aStats.mWraps, aStats.mFenceWaits, aNumDropped);
+		SEXY_CHECK(aStats.mWraps > 100);
+		SEXY_CHECK(aStats.mOverflows == 0 && aBackend.mGrowths.empty());
+		SEXY_CHECK(aNumDropped > 0);
+		SEXY_CHECK(aStats.mFenceWaits + aNumDropped + (int)aBackend.mLive.size() == (int)aBackend.mNextFence - 1);
+	}
+
+	SEXY_CHECK(aNumBad == 0);
+	SEXY_CHECK(aBackend.mBadCalls == 0);
+	SEXY_CHECK(aBackend.mLive.empty());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The wrap skips the end of the buffer, and a frame that fit there is never
+// waited on.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(StreamRingWrapSkipsTail)
+{
+	FakeRingBackend aBackend;
+	StreamRing aRing(&aBackend, 1000);
+
+	SEXY_CHECK(aRing.Allocate(700) == 0);
+	aRing.EndFrame();
+	aBackend.NoteFrame(aRing);
+	SEXY_CHECK(aRing.Allocate(250) == 700);
+	aRing.EndFrame();
+	aBackend.NoteFrame(aRing);
+
+	// Doesn't fit in the last 50 bytes, so it goes to the start and reuses
+	// the first frame's bytes, but not the second's
+	aBackend.mWaits.clear();
+	SEXY_CHECK(aRing.Allocate(600) == 0);
+	SEXY_CHECK(aRing.mStats.mWraps == 1);
+	SEXY_CHECK(aBackend.mWaits.size() == 1 && aBackend.mWaits[0].mStart == 0);
+	aRing.EndFrame();
+	aBackend.NoteFrame(aRing);
+
+	// Wraps again before reaching the second frame's bytes, so that frame is
+	// dropped without a wait and only the third is waited on
+	aBackend.mWaits.clear();
+	SEXY_CHECK(aRing.Allocate(500) == 0);
+	SEXY_CHECK(aRing.mStats.mWraps == 2);
+	SEXY_CHECK(aBackend.mWaits.size() == 1 && aBackend.mWaits[0].mStart == 1000);
+	SEXY_CHECK(aBackend.mLive.empty());
+	SEXY_CHECK(aRing.mStats.mFenceWaits == 2);
+	SEXY_CHECK(aBackend.mBadCalls == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A frame bigger than the ring doubles it until the whole frame fits, so the
+// next one like it doesn't grow again.  Growing drops the old fences without
+// waiting, GL keeps the old storage alive for the draws that still read it.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(StreamRingGrowsOnOverflow)
+{
+	FakeRingBackend aBackend;
+	{
+		StreamRing aRing(&aBackend, 1000);
+
+		SEXY_CHECK(aRing.Allocate(400) == 0);
+		aRing.EndFrame();
+		aBackend.NoteFrame(aRing);
+
+		// 3x400 in one frame can't fit, the second wraps and the third starts a
+		// 2000 byte buffer
+		aBackend.mWaits.clear();
+		SEXY_CHECK(aRing.Allocate(400) == 400);
+		SEXY_CHECK(aRing.Allocate(400) == 0);
+		SEXY_CHECK(aRing.Allocate(400) == 0);
+		SEXY_CHECK(aBackend.mGrowths.size() == 1 && aBackend.mGrowths[0] == 2000);
+		SEXY_CHECK(aRing.mCapacity == 2000 && aRing.mStats.mOverflows == 1);
+		SEXY_CHECK(aBackend.mWaits.size() == 1);
+		aRing.EndFrame();
+		aBackend.NoteFrame(aRing);
+		SEXY_CHECK(aBackend.mLive.size() == 1);
+
+		// Frames of 3x400 now run for ever without growing again
+		for (int aFrame = 0; aFrame < 50; aFrame++)
+		{
+			for (int i = 0; i < 3; i++)
+				SEXY_CHECK(aRing.Allocate(400) >= 0);
+			aRing.EndFrame();
+			aBackend.NoteFrame(aRing);
+		}
+		SEXY_CHECK(aBackend.mGrowths.size() == 1);
+
+		// One batch bigger than the whole ring, and one that's exactly all of it
+		SEXY_CHECK(aRing.Allocate(5000) == 0);
+		SEXY_CHECK(aRing.mCapacity == 8000 && aBackend.mGrowths.back() == 8000);
+		aRing.EndFrame();
+		aBackend.NoteFrame(aRing);
+		SEXY_CHECK(aRing.Allocate(8000) == 0);
+		SEXY_CHECK(aRing.mCapacity == 8000);
+		SEXY_CHECK(aRing.mStats.mOverflows == 2);
+
+		SEXY_CHECK(aRing.Allocate(0) == 0);
+		SEXY_CHECK(aRing.mStats.mAllocations == 156);
+	}
+
+	SEXY_CHECK(aBackend.mBadCalls == 0);
+	SEXY_CHECK(aBackend.mLive.empty());
+}
@@ -0,0 +1,149 @@
+#include "TestFiles.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Overwrites theFileName with a flat theSize x theSize PNG of theColor.
+///////////////////////////////////////////////////////////////////////////////
+static bool WriteFlatPNG(const std::string& theFileName, int theSize, uint32_t theColor)
+{
+	ImageLib::Image anImage;
+	anImage.mWidth = theSize;
+	anImage.mHeight = theSize;
+	anImage.mBits = new uint32_t[theSize * theSize];
+	std::fill(anImage.mBits, anImage.mBits + theSize * theSize, theColor);
+	return ImageLib::WritePNGImage(theFileName, &anImage);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Loads the group through the cache and checks that only the image at
+// theChanged (or none, if it's negative) differs from theLastHashes, and
+// that the cache missed theMisses times and hit for everything else.
+///////////////////////////////////////////////////////////////////////////////
+static void CheckCachedLoad(ResourceManager& theManager, std::vector<uint64_t>& theLastHashes, int theChanged, int theMisses)
+{
+	int aHits = ImageLib::gImageCache->mHits;
+	int aMisses = ImageLib::gImageCache->mMisses;
+	size_t aNumEntries = ImageLib::gImageCache->mEntries.size();
+
+	std::vector<uint64_t> aHashes;
+	SEXY_CHECK(TestLoadImageGroup(theManager, "Cache", 1, aHashes) >= 0);
+	SEXY_CHECK(aHashes.size() == theLastHashes.size());
+
+	for (int i = 0; i < (int)aHashes.size() && i < (int)theLastHashes.size(); i++)
+		SEXY_CHECK((aHashes[i] != theLastHashes[i]) == (i == theChanged));
+
+	aMisses = ImageLib::gImageCache->mMisses - aMisses;
+	aHits = ImageLib::gImageCache->mHits - aHits;
+	printf("  %d hits, %d misses\n", aHits, aMisses);
+	SEXY_CHECK(aMisses == theMisses);
+	SEXY_CHECK(aHits == (int)aNumEntries - theMisses);
+	SEXY_CHECK(ImageLib::gImageCache->mEntries.size() == aNumEntries);
+
+	theLastHashes = aHashes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A warm load decodes nothing and gives the same pixels.  Editing one image,
+// or the alpha image a JPEG is composed with, throws away that one entry and
+// no other, and the new pixels are the ones a load without the cache gives.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ImageCacheEditInvalidatesOnlyThatEntry)
+{
+	const int NUM_IMAGES = 12;
+	const int SIZE = 32;
+
+	TestInitGLInterface();
+
+	std::string aDir = TestGetTempDir() + "cachegroup/";
+	SEXY_CHECK(TestWriteFile(aDir + "resources.xml", TestMakeImageGroup(aDir, "Cache", NUM_IMAGES, SIZE)));
+
+	ResourceManager aManager(gSexyAppBase);
+	SEXY_CHECK(aManager.ParseResourcesFile(aDir + "resources.xml"));
+
+	std::vector<uint64_t> aWant;
+	SEXY_CHECK(TestLoadImageGroup(aManager, "Cache", 1, aWant) >= 0);
+
+	ImageLib::gImageCache = new ImageLib::ImageCache(TestGetTempDir() + "imagecache/", 64 * 1024 * 1024);
+
+	// Every fourth image is a JPEG with an alpha image, cached on its own
+	std::vector<uint64_t> aHashes;
+	SEXY_CHECK(TestLoadImageGroup(aManager, "Cache", 1, aHashes) >= 0);
+	SEXY_CHECK(aHashes == aWant);
+	int aNumEntries = NUM_IMAGES + NUM_IMAGES / 4;
+	SEXY_CHECK(ImageLib::gImageCache->mHits == 0 && ImageLib::gImageCache->mMisses == aNumEntries);
+	SEXY_CHECK((int)ImageLib::gImageCache->mEntries.size() == aNumEntries);
+
+	CheckCachedLoad(aManager, aHashes, -1, 0);
+
+	ResourceManager::ResMap& anImages = aManager.mImageMap;
+	SEXY_CHECK(WriteFlatPNG(aDir + "Cache5.png", SIZE, 0x80FF0000));
+	CheckCachedLoad(aManager, aHashes, (int)std::distance(anImages.begin(), anImages.find("IMAGE_Cache5")), 1);
+
+	SEXY_CHECK(WriteFlatPNG(aDir + "Cache3_alpha.png", SIZE, 0xFF404040));
+	CheckCachedLoad(aManager, aHashes, (int)std::distance(anImages.begin(), anImages.find("IMAGE_Cache3")), 1);
+
+	CheckCachedLoad(aManager, aHashes, -1, 0);
+
+	delete ImageLib::gImageCache;
+	ImageLib::gImageCache = NULL;
+
+	SEXY_CHECK(TestLoadImageGroup(aManager, "Cache", 1, aWant) >= 0);
+	SEXY_CHECK(aHashes == aWant);
+
+	TestDeleteImages(aManager);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Loading a group of 64 512x512 images without the cache, through an empty
+// one that stores every image, and through a full one.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(ImageCacheColdWarm)
+{
+	const int NUM_PASSES = 3;
+
+	TestInitGLInterface();
+
+	std::string aDir = TestGetTempDir() + "cachebench/";
+	SEXY_CHECK(TestWriteFile(aDir + "resources.xml", TestMakeImageGroup(aDir, "Cache", 64, 512)));
+
+	ResourceManager aManager(gSexyAppBase);
+	SEXY_CHECK(aManager.ParseResourcesFile(aDir + "resources.xml"));
+
+	static const char* KINDS[] = { "no cache", "cold", "warm" };
+	std::vector<uint64_t> aWant;
+	for (int aKind = 0; aKind < 3; aKind++)
+	{
+		if (aKind == 1)
+			ImageLib::gImageCache = new ImageLib::ImageCache(TestGetTempDir() + "imagecache/", 256 * 1024 * 1024);
+
+		double aBest = 0;
+		bool isSame = true;
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			if (aKind == 1)
+				ImageLib::gImageCache->Clear();
+
+			std::vector<uint64_t> aHashes;
+			double aTime = TestLoadImageGroup(aManager, "Cache", 1, aHashes);
+			SEXY_CHECK(aTime >= 0);
+			if (aPass == 0 || aTime < aBest)
+				aBest = aTime;
+
+			if (aWant.empty())
+				aWant = aHashes;
+			isSame &= aHashes == aWant;
+		}
+
+		printf("  %-8s %7.1f ms, %s\n", KINDS[aKind], aBest, isSame ? "same pixels" : "PIXELS DIFFER");
+		SEXY_CHECK(isSame);
+	}
+
+	printf("  %d hits, %d misses, %.1f MB cached\n", ImageLib::gImageCache->mHits, ImageLib::gImageCache->mMisses, ImageLib::gImageCache->GetTotalBytes() / (1024.0 * 1024.0));
+	SEXY_CHECK(ImageLib::gImageCache->mHits == NUM_PASSES * (64 + 64 / 4));
+
+	delete ImageLib::gImageCache;
+	ImageLib::gImageCache = NULL;
+
+	TestDeleteImages(aManager);
+}
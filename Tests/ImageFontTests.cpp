@@ -0,0 +1,150 @@
+#include "TestFiles.h"
+#include "graphics/ImageFont.h"
+#include "graphics/MemoryImage.h"
+#include "graphics/Graphics.h"
+#include "misc/MTRand.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Glyphs for every printable Latin-1 char, cut from theImage at random, with
+// some kerning pairs among them.
+///////////////////////////////////////////////////////////////////////////////
+static void FillLayer(FontLayer* theLayer, MemoryImage* theImage, int theNumKerningPairs, MTRand& theRand)
+{
+	theLayer->mImage = theImage;
+	theLayer->mAscent = theImage->mHeight - 4;
+	theLayer->mDefaultHeight = theImage->mHeight;
+	theLayer->mSpacing = 1;
+
+	for (int aChar = 32; aChar < 256; aChar++)
+	{
+		if ((aChar >= 127) && (aChar < 160))
+			continue;
+
+		CharData* aCharData = theLayer->GetCharData((SexyChar) aChar);
+		aCharData->mWidth = 4 + theRand.Next(12UL);
+		aCharData->mImageRect = Rect(theRand.Next((unsigned long) theImage->mWidth - 16), 0, 3 + theRand.Next(12UL), theImage->mHeight);
+		aCharData->mOffset = Point(theRand.Next(3UL) - 1, 0);
+	}
+
+	for (int i = 0; i < theNumKerningPairs; i++)
+		theLayer->GetCharData((SexyChar) (32 + theRand.Next(95UL)))->mKerningOffsets[(SexyChar) (32 + theRand.Next(95UL))] = theRand.Next(7UL) - 3;
+}
+
+static ImageFont* MakeFont(MemoryImage* theImage, int theNumLayers, MTRand& theRand)
+{
+	ImageFont* aFont = new ImageFont(theImage);
+	aFont->mFontData->mApp = gSexyAppBase;
+	FillLayer(&aFont->mFontData->mFontLayerList.back(), theImage, 100, theRand);
+
+	for (int i = 1; i < theNumLayers; i++)
+	{
+		aFont->mFontData->mFontLayerList.push_back(FontLayer(aFont->mFontData));
+		FillLayer(&aFont->mFontData->mFontLayerList.back(), theImage, 100, theRand);
+	}
+
+	return aFont;
+}
+
+static SexyString MakeText(int theLength, MTRand& theRand)
+{
+	SexyString aText;
+	for (int i = 0; i < theLength; i++)
+		aText += (SexyChar) (32 + theRand.Next(95UL));
+	return aText;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Kerning and the char map are read from tables made when the active layers
+// are generated, so editing them only shows after CharsChanged, and then for
+// every font sharing the data.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ImageFontCharsChanged)
+{
+	TestInitGLInterface();
+
+	MTRand aRand(25);
+	MemoryImage anImage;
+	anImage.Create(512, 24);
+
+	ImageFont* aFont = MakeFont(&anImage, 1, aRand);
+	ImageFont* aCopy = (ImageFont*) aFont->Duplicate();
+	FontLayer* aLayer = &aFont->mFontData->mFontLayerList.back();
+
+	aLayer->GetCharData('A')->mKerningOffsets['V'] = -3;
+	aFont->mFontData->CharsChanged();
+	int aKernedWidth = aFont->StringWidth(_S("AV"));
+	SEXY_CHECK(aCopy->StringWidth(_S("AV")) == aKernedWidth);
+
+	// Not yet seen
+	aLayer->GetCharData('A')->mKerningOffsets['V'] = 0;
+	SEXY_CHECK(aFont->StringWidth(_S("AV")) == aKernedWidth);
+
+	aFont->mFontData->CharsChanged();
+	SEXY_CHECK(aFont->StringWidth(_S("AV")) == aKernedWidth + 3);
+	SEXY_CHECK(aCopy->StringWidth(_S("AV")) == aKernedWidth + 3);
+
+	// Mapping a char makes it as wide as the one it maps to
+	int aWideWidth = aFont->CharWidth('W');
+	aFont->mFontData->mCharMap['i'] = 'W';
+	aFont->mFontData->CharsChanged();
+	SEXY_CHECK(aFont->CharWidth('i') == aWideWidth);
+	SEXY_CHECK(aCopy->StringWidth(_S("ii")) == aFont->StringWidth(_S("WW")));
+
+	// Drawing goes by the same tables
+	MemoryImage aDest;
+	aDest.Create(256, 32);
+	Graphics aGraphics(&aDest);
+	int aDrawnWidth = 0;
+	aFont->DrawStringEx(&aGraphics, 0, 20, _S("AViW"), Color::White, NULL, &aDrawnWidth);
+	SEXY_CHECK(aDrawnWidth == aFont->StringWidth(_S("AViW")));
+
+	delete aCopy;
+	delete aFont;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Time per char measuring and drawing long strings with one and two layers.
+// The strings are drawn off the edge of the image, so only the font's own
+// work is timed and not the blits.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(ImageFontStringWidthAndDraw)
+{
+	TestInitGLInterface();
+
+	MTRand aRand(3);
+	MemoryImage anImage;
+	anImage.Create(512, 24);
+	MemoryImage aDest;
+	aDest.Create(1024, 32);
+	Graphics aGraphics(&aDest);
+
+	SexyString aText = MakeText(2000, aRand);
+	// DrawString queues every glyph of every layer in a fixed pool first
+	SexyString aDrawText = aText.substr(0, 1000);
+
+	for (int aNumLayers = 1; aNumLayers <= 2; aNumLayers++)
+	{
+		ImageFont* aFont = MakeFont(&anImage, aNumLayers, aRand);
+
+		const int NUM_WIDTHS = 200;
+		PerfTimer aTimer;
+		aTimer.Start();
+		int aWidth = 0;
+		for (int i = 0; i < NUM_WIDTHS; i++)
+			aWidth = std::max(aWidth, aFont->StringWidth(aText));
+		double aWidthTime = aTimer.GetDuration();
+
+		const int NUM_DRAWS = 50;
+		aTimer.Start();
+		for (int i = 0; i < NUM_DRAWS; i++)
+			aFont->DrawString(&aGraphics, -aWidth, 20, aDrawText, Color::White, Rect(0, 0, aDest.mWidth, aDest.mHeight));
+		double aDrawTime = aTimer.GetDuration();
+
+		printf("  %d layer%s: StringWidth %.1f ns per char, DrawString %.1f ns per char\n", aNumLayers, aNumLayers == 1 ? " " : "s",
+			aWidthTime * 1e6 / (NUM_WIDTHS * aText.length()), aDrawTime * 1e6 / (NUM_DRAWS * aDrawText.length()));
+
+		delete aFont;
+	}
+}
@@ -0,0 +1,193 @@
+#include "TestHarness.h"
+#include "sound/OggSoundStream.h"
+#include "sound/SDLSoundManager.h"
+#include "sound/SoundInstance.h"
+
+using namespace Sexy;
+
+// Clips in Tests/data: 120 seconds of 44.1kHz stereo and 45 of 22.05kHz mono
+static const char* gOggClips[] = { "ambient_loop", "voiceover" };
+
+///////////////////////////////////////////////////////////////////////////////
+// The whole clip decoded straight from memory, without PakInterface or a ring
+///////////////////////////////////////////////////////////////////////////////
+struct OggMemoryFile
+{
+	std::vector<uint8_t>	mData;
+	size_t					mPos;
+};
+
+static size_t OggMemoryRead(void* thePtr, size_t theSize, size_t theCount, void* theFile)
+{
+	OggMemoryFile* aFile = (OggMemoryFile*) theFile;
+	size_t aCount = std::min(theCount, (aFile->mData.size() - aFile->mPos) / theSize);
+	memcpy(thePtr, &aFile->mData[aFile->mPos], aCount * theSize);
+	aFile->mPos += aCount * theSize;
+	return aCount;
+}
+
+static int OggMemorySeek(void* theFile, ogg_int64_t theOffset, int theOrigin)
+{
+	OggMemoryFile* aFile = (OggMemoryFile*) theFile;
+	ogg_int64_t aBase = (theOrigin == SEEK_SET) ? 0 : (theOrigin == SEEK_CUR) ? aFile->mPos : aFile->mData.size();
+	if ((aBase + theOffset < 0) || (aBase + theOffset > (ogg_int64_t) aFile->mData.size()))
+		return -1;
+	aFile->mPos = (size_t) (aBase + theOffset);
+	return 0;
+}
+
+static int OggMemoryClose(void* theFile)
+{
+	return 0;
+}
+
+static long OggMemoryTell(void* theFile)
+{
+	return (long) ((OggMemoryFile*) theFile)->mPos;
+}
+
+static bool DecodeOggClip(const std::string& theFileName, std::vector<int16_t>& theSamples, int* theChannels)
+{
+	OggMemoryFile aFile;
+	aFile.mPos = 0;
+
+	FILE* aFP = fopen(theFileName.c_str(), "rb");
+	if (aFP == NULL)
+		return false;
+	uint8_t aBuffer[65536];
+	size_t aRead;
+	while ((aRead = fread(aBuffer, 1, sizeof(aBuffer), aFP)) > 0)
+		aFile.mData.insert(aFile.mData.end(), aBuffer, aBuffer + aRead);
+	fclose(aFP);
+
+	ov_callbacks aCallbacks = { OggMemoryRead, OggMemorySeek, OggMemoryClose, OggMemoryTell };
+	OggVorbis_File aVorbisFile;
+	if (ov_open_callbacks(&aFile, &aVorbisFile, NULL, 0, aCallbacks) < 0)
+		return false;
+
+	*theChannels = ov_info(&aVorbisFile, -1)->channels;
+	theSamples.clear();
+
+	int aBitstream;
+	long aBytes;
+	while ((aBytes = ov_read(&aVorbisFile, (char*) aBuffer, sizeof(aBuffer), &aBitstream)) > 0)
+		theSamples.insert(theSamples.end(), (int16_t*) aBuffer, (int16_t*) (aBuffer + aBytes));
+
+	ov_clear(&aVorbisFile);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Everything that comes out of a stream, decoding in small steps the way the
+// stream thread does, or theMaxFrames if it loops
+///////////////////////////////////////////////////////////////////////////////
+static void ReadOggStream(OggSoundStream& theStream, std::vector<int16_t>& theSamples, int theMaxFrames)
+{
+	std::vector<int16_t> aBuffer(1024 * theStream.mChannels);
+	theSamples.clear();
+
+	while ((int) theSamples.size() < theMaxFrames * theStream.mChannels)
+	{
+		theStream.Decode(OggSoundStream::RING_FRAMES / 4);
+		int aFrames = theStream.Read(&aBuffer[0], 1024);
+		if ((aFrames == 0) && (theStream.IsFinished()))
+			break;
+		theSamples.insert(theSamples.end(), aBuffer.begin(), aBuffer.begin() + aFrames * theStream.mChannels);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A stream reads through PakInterface and wraps round its ring many times
+// over a long clip, and has to give exactly what decoding it whole does.
+// Looping goes back to the start without a gap.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(OggStreamMatchesDecode)
+{
+	for (int aClip = 0; aClip < 2; aClip++)
+	{
+		std::string aFileName = TestGetDataDir() + gOggClips[aClip] + ".ogg";
+
+		int aChannels = 0;
+		std::vector<int16_t> aWant;
+		if (!DecodeOggClip(aFileName, aWant, &aChannels))
+		{
+			printf("  no %s, skipped\n", aFileName.c_str());
+			continue;
+		}
+		int aNumFrames = (int) aWant.size() / aChannels;
+
+		OggSoundStream aStream;
+		SEXY_CHECK(aStream.Open(aFileName, false));
+		SEXY_CHECK(aStream.mChannels == aChannels);
+
+		std::vector<int16_t> aGot;
+		ReadOggStream(aStream, aGot, aNumFrames * 2);
+		SEXY_CHECK(aGot == aWant);
+
+		OggSoundStream aLoopingStream;
+		SEXY_CHECK(aLoopingStream.Open(aFileName, true));
+		ReadOggStream(aLoopingStream, aGot, aNumFrames * 2 + 1000);
+		SEXY_CHECK(!aLoopingStream.IsFinished());
+
+		int aNumBad = 0;
+		for (size_t i = 0; i < aGot.size(); i++)
+			aNumBad += aGot[i] != aWant[i % aWant.size()];
+		printf("  %s: %d frames, %d samples off when looping\n", gOggClips[aClip], aNumFrames, aNumBad);
+		SEXY_CHECK(aNumBad == 0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// What a long clip costs decoded whole at load time, against streamed: the
+// load, the first play (which primes the ring), and the samples each keeps
+// in memory.  Plays on SDL's dummy audio driver.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(OggStreamLoadAndMemory)
+{
+	SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+	SDLSoundManager* aManager = new SDLSoundManager();
+	if (!aManager->Initialized())
+	{
+		printf("  no dummy audio driver, skipped\n");
+		delete aManager;
+		return;
+	}
+
+	printf("  %-14s %12s %12s   %12s %12s %12s\n", "clip", "whole load", "whole mem", "stream load", "first play", "ring");
+	for (int aClip = 0; aClip < 2; aClip++)
+	{
+		std::string aFileName = TestGetDataDir() + gOggClips[aClip];
+
+		PerfTimer aTimer;
+		aTimer.Start();
+		void* aWhole = aManager->DecodeSound(aFileName, SoundStreaming_Never);
+		double aWholeTime = aTimer.GetDuration();
+		if (aWhole == NULL)
+		{
+			printf("  no %s.ogg, skipped\n", aFileName.c_str());
+			continue;
+		}
+		double aWholeBytes = ((SDLDecodedSound*) aWhole)->mChunk->alen;
+		aManager->FreeDecodedSound(aWhole);
+
+		aTimer.Start();
+		aManager->LoadSound(0, aFileName, SoundStreaming_Always);
+		double aStreamTime = aTimer.GetDuration();
+
+		aTimer.Start();
+		SoundInstance* anInstance = aManager->GetSoundInstance(0);
+		anInstance->Play(false, false);
+		double aPlayTime = aTimer.GetDuration();
+		anInstance->Release();
+		aManager->ReleaseSound(0);
+
+		OggSoundStream aStream;
+		aStream.Open(aFileName + ".ogg", false);
+		double aStreamBytes = aStream.mRing.size() * sizeof(int16_t);
+
+		printf("  %-14s %9.1f ms %9.1f MB   %9.2f ms %9.2f ms %9.0f KB\n", gOggClips[aClip],
+			aWholeTime, aWholeBytes / (1024 * 1024), aStreamTime, aPlayTime, aStreamBytes / 1024);
+	}
+
+	delete aManager;
+}
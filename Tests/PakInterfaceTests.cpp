@@ -0,0 +1,763 @@
+#include "TestFiles.h"
+#include "Tools/PakBuilder/PakBuild.h"
+
+#include <zlib.h>
+
+using namespace Sexy;
+
+// As PakInterface.cpp and PakBuilder write them
+enum
+{
+	TEST_PAK_MAGIC = 0xBAC04AC0,
+	TEST_PAK_XOR_KEY = 0xF7,
+	TEST_PAK_END = 0x80
+};
+
+struct TestPakFile
+{
+	std::string				mName;			// as it goes in the pak, '\\' separated
+	std::vector<uint8_t>	mData;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Builds a pak in memory, unencoded until Save.
+///////////////////////////////////////////////////////////////////////////////
+class TestPakWriter
+{
+public:
+	std::vector<uint8_t>	mDirectory;
+	std::vector<uint8_t>	mData;
+
+public:
+	void					Write(const void* theData, size_t theSize) { mDirectory.insert(mDirectory.end(), (const uint8_t*) theData, (const uint8_t*) theData + theSize); }
+	template <typename T> void WriteValue(const T& theValue) { Write(&theValue, sizeof(T)); }
+
+	void					Begin(int theVersion)
+	{
+		WriteValue((uint32_t) TEST_PAK_MAGIC);
+		WriteValue((uint32_t) theVersion);
+	}
+
+	void					WriteName(const std::string& theName)
+	{
+		WriteValue((uint8_t) 0);
+		WriteValue((uint8_t) theName.length());
+		Write(theName.c_str(), theName.length());
+	}
+
+	bool					Save(const std::string& theFileName)
+	{
+		WriteValue((uint8_t) TEST_PAK_END);
+
+		std::vector<uint8_t> aPak = mDirectory;
+		aPak.insert(aPak.end(), mData.begin(), mData.end());
+		for (size_t i = 0; i < aPak.size(); i++)
+			aPak[i] ^= TEST_PAK_XOR_KEY;
+
+		FILE* aFP = fopen(theFileName.c_str(), "wb");
+		if (aFP == NULL)
+			return false;
+		bool isWritten = aPak.empty() || (fwrite(&aPak[0], 1, aPak.size(), aFP) == aPak.size());
+		return (fclose(aFP) == 0) && isWritten;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Version 0, or version 1 stored, or compressed in theBlockSize blocks when
+// theBlockSize isn't 0.
+///////////////////////////////////////////////////////////////////////////////
+static bool WritePak(const std::string& theFileName, const std::vector<TestPakFile>& theFiles, int theVersion, uint32_t theBlockSize)
+{
+	TestPakWriter aWriter;
+	aWriter.Begin(theVersion);
+
+	for (size_t i = 0; i < theFiles.size(); i++)
+	{
+		const std::vector<uint8_t>& aData = theFiles[i].mData;
+		aWriter.WriteName(theFiles[i].mName);
+
+		if (theVersion == 0)
+		{
+			aWriter.WriteValue((int) aData.size());
+			aWriter.WriteValue((int64_t) i);
+			aWriter.mData.insert(aWriter.mData.end(), aData.begin(), aData.end());
+			continue;
+		}
+
+		aWriter.WriteValue((uint8_t) (theBlockSize != 0 ? PAKCODEC_ZLIB : PAKCODEC_STORE));
+		aWriter.WriteValue((int64_t) i);
+		aWriter.WriteValue((uint64_t) aWriter.mData.size());
+		aWriter.WriteValue((uint64_t) aData.size());
+
+		if (theBlockSize == 0)
+		{
+			aWriter.mData.insert(aWriter.mData.end(), aData.begin(), aData.end());
+			continue;
+		}
+
+		// Blocks that don't shrink are stored as they are
+		aWriter.WriteValue(theBlockSize);
+		std::vector<uint8_t> aBlock(compressBound(theBlockSize));
+		for (size_t aPos = 0; aPos < aData.size(); aPos += theBlockSize)
+		{
+			uLong aSize = (uLong) std::min(aData.size() - aPos, (size_t) theBlockSize);
+			uLongf aDestLen = (uLongf) aBlock.size();
+			if ((compress2(&aBlock[0], &aDestLen, &aData[aPos], aSize, 6) == Z_OK) && (aDestLen < aSize))
+				aWriter.mData.insert(aWriter.mData.end(), aBlock.begin(), aBlock.begin() + aDestLen);
+			else
+			{
+				aDestLen = aSize;
+				aWriter.mData.insert(aWriter.mData.end(), aData.begin() + aPos, aData.begin() + aPos + aSize);
+			}
+			aWriter.WriteValue((uint32_t) aDestLen);
+		}
+	}
+
+	return aWriter.Save(theFileName);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sizes around the block size, text with '\r's for FGetC, and noise that
+// doesn't compress.
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<TestPakFile> MakeFiles(uint32_t theBlockSize)
+{
+	static const int aSizes[] = { 0, 1, 1000, (int) theBlockSize - 1, (int) theBlockSize, (int) theBlockSize + 1, 3 * (int) theBlockSize + 17, 100000, 300000 };
+	const int aNumSizes = sizeof(aSizes) / sizeof(aSizes[0]);
+
+	MTRand aRand(555);
+	std::vector<TestPakFile> aFiles(aNumSizes);
+	for (int i = 0; i < aNumSizes; i++)
+	{
+		char aName[64];
+		sprintf(aName, "dir%d\\file%d.dat", i % 3, i);
+		aFiles[i].mName = aName;
+		aFiles[i].mData.resize(aSizes[i]);
+
+		bool isNoise = (i % 2) == 1;
+		for (int j = 0; j < aSizes[i]; j++)
+			aFiles[i].mData[j] = isNoise ? (uint8_t) aRand.Next() : (uint8_t) "Line of text\r\n"[(j + i) % 14];
+	}
+	return aFiles;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static std::string GetPakName(const TestPakFile& theFile)
+{
+	std::string aName = theFile.mName;
+	std::replace(aName.begin(), aName.end(), '\\', '/');
+	return aName;
+}
+
+static const char* gPakKindNames[] = { "version 0", "stored", "compressed" };
+
+static bool WritePakKind(const std::string& theFileName, const std::vector<TestPakFile>& theFiles, int theKind, uint32_t theBlockSize)
+{
+	return WritePak(theFileName, theFiles, theKind == 0 ? 0 : 1, theKind == 2 ? theBlockSize : 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The same pak kinds, but written out as a directory tree and packed by
+// PakBuilder's own code, which keeps noise files stored.
+///////////////////////////////////////////////////////////////////////////////
+static bool BuildPakKind(const std::string& theFileName, const std::vector<TestPakFile>& theFiles, int theKind, uint32_t theBlockSize)
+{
+	std::string aDir = TestGetTempDir() + "paktree/";
+	for (size_t i = 0; i < theFiles.size(); i++)
+	{
+		std::string aName = aDir + GetPakName(theFiles[i]);
+		MkDir(GetFileDir(aName));
+
+		FILE* aFP = fopen(aName.c_str(), "wb");
+		if (aFP == NULL)
+			return false;
+		const std::vector<uint8_t>& aData = theFiles[i].mData;
+		bool isWritten = aData.empty() || (fwrite(&aData[0], 1, aData.size(), aFP) == aData.size());
+		if ((fclose(aFP) != 0) || (!isWritten))
+			return false;
+	}
+
+	PakBuildOptions anOptions;
+	anOptions.mVersion = (theKind == 0) ? 0 : 1;
+	anOptions.mLevel = (theKind == 2) ? 6 : 0;
+	anOptions.mBlockSize = theBlockSize;
+
+	PakBuildResult aResult = BuildPak(theFileName, aDir, anOptions);
+	if (aResult.mError != 0)
+		printf("  PakBuilder: %s\n", aResult.mMessage.c_str());
+	return (aResult.mError == 0) && (aResult.mNumFiles == theFiles.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(PakRoundTrip)
+{
+	const uint32_t BLOCK_SIZE = 4096;
+	std::vector<TestPakFile> aFiles = MakeFiles(BLOCK_SIZE);
+
+	for (int aBuilt = 0; aBuilt < 2; aBuilt++)
+	{
+		for (int aKind = 0; aKind < 3; aKind++)
+		{
+			std::string aPakName = TestGetTempDir() + "roundtrip.pak";
+			if (aBuilt)
+				SEXY_CHECK(BuildPakKind(aPakName, aFiles, aKind, BLOCK_SIZE));
+			else
+				SEXY_CHECK(WritePakKind(aPakName, aFiles, aKind, BLOCK_SIZE));
+
+			for (int aMapped = 0; aMapped < 2; aMapped++)
+			{
+				PakInterface aPak;
+				aPak.mMapPakFiles = aMapped != 0;
+				SEXY_CHECK(aPak.AddPakFile(aPakName));
+
+				int aNumBad = 0;
+				int aNumCompressed = 0;
+				for (size_t i = 0; i < aFiles.size(); i++)
+				{
+					PFILE* aFP = aPak.FOpen(GetPakName(aFiles[i]).c_str(), "rb");
+					if ((aFP == NULL) || (aFP->mRecord == NULL))
+					{
+						aNumBad++;
+						if (aFP != NULL)
+							aPak.FClose(aFP);
+						continue;
+					}
+					aNumCompressed += aFP->mRecord->mCodec != PAKCODEC_STORE;
+
+					// One byte more than there is, to see it stop
+					std::vector<uint8_t> aData(aFiles[i].mData.size() + 1);
+					size_t aCount = aPak.FRead(&aData[0], 1, (int) aData.size(), aFP);
+					aData.pop_back();
+					if ((aCount != aFiles[i].mData.size()) || (aData != aFiles[i].mData) || (aPak.FTell(aFP) != (int64_t) aCount) || (!aPak.FEof(aFP)))
+						aNumBad++;
+					aPak.FClose(aFP);
+				}
+
+				if (aNumBad != 0)
+					printf("  %s%s, %s: %d files differ\n", aBuilt ? "PakBuilder " : "", gPakKindNames[aKind], aMapped ? "mapped" : "loaded", aNumBad);
+				SEXY_CHECK(aNumBad == 0);
+				SEXY_CHECK((aKind == 2) == (aNumCompressed > 0));
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Random seeks, reads and FGetCs on theFP, checked against theData.  Returns
+// how many results differ.
+///////////////////////////////////////////////////////////////////////////////
+static int FuzzFile(PakInterface* thePak, PFILE* theFP, const std::vector<uint8_t>& theData, bool stripCR, MTRand& theRand, int theNumOps)
+{
+	int64_t aSize = (int64_t) theData.size();
+	int64_t aPos = 0;
+	int aNumBad = 0;
+	std::vector<uint8_t> aBuffer;
+
+	for (int anOp = 0; anOp < theNumOps; anOp++)
+	{
+		switch (theRand.Next(5UL))
+		{
+		case 0:
+			aPos = theRand.Next((unsigned long) aSize + 1);
+			aNumBad += thePak->FSeek(theFP, aPos, SEEK_SET) != 0;
+			break;
+
+		case 1:
+		{
+			int64_t aNewPos = theRand.Next((unsigned long) aSize + 1);
+			aNumBad += thePak->FSeek(theFP, aNewPos - aPos, SEEK_CUR) != 0;
+			aPos = aNewPos;
+			break;
+		}
+
+		case 2:
+			aPos = theRand.Next((unsigned long) aSize + 1);
+			aNumBad += thePak->FSeek(theFP, aPos - aSize, SEEK_END) != 0;
+			break;
+
+		case 3:
+		{
+			// Reads past the read ahead buffer and several blocks too
+			int aWant = (int) theRand.Next(theRand.Next(4UL) == 0 ? 70000UL : 300UL);
+			int aCount = (int) std::min((int64_t) aWant, aSize - aPos);
+			aBuffer.resize(aWant + 1);
+			aNumBad += (int) thePak->FRead(&aBuffer[0], 1, aWant, theFP) != aCount;
+			aNumBad += (aCount > 0) && (memcmp(&aBuffer[0], &theData[aPos], aCount) != 0);
+			aPos += aCount;
+			break;
+		}
+
+		case 4:
+		{
+			while ((stripCR) && (aPos < aSize) && (theData[aPos] == '\r'))
+				aPos++;
+			int aWant = (aPos < aSize) ? theData[aPos++] : EOF;
+			aNumBad += thePak->FGetC(theFP) != aWant;
+			break;
+		}
+		}
+
+		aNumBad += thePak->FTell(theFP) != aPos;
+	}
+
+	return aNumBad;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Every kind of pak record, and the same files read from disk, go through the
+// same random seeks and reads.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(PakSeekReadFuzz)
+{
+	const uint32_t BLOCK_SIZE = 4096;
+	std::vector<TestPakFile> aFiles = MakeFiles(BLOCK_SIZE);
+	MTRand aRand(999);
+
+	for (int aKind = 0; aKind < 3; aKind++)
+	{
+		std::string aPakName = TestGetTempDir() + "fuzz.pak";
+		SEXY_CHECK(WritePakKind(aPakName, aFiles, aKind, BLOCK_SIZE));
+
+		for (int aMapped = 0; aMapped < 2; aMapped++)
+		{
+			PakInterface aPak;
+			aPak.mMapPakFiles = aMapped != 0;
+			SEXY_CHECK(aPak.AddPakFile(aPakName));
+
+			int aNumBad = 0;
+			for (size_t i = 0; i < aFiles.size(); i++)
+			{
+				PFILE* aFP = aPak.FOpen(GetPakName(aFiles[i]).c_str(), "rb");
+				SEXY_CHECK(aFP != NULL);
+				if (aFP == NULL)
+					continue;
+				aNumBad += FuzzFile(&aPak, aFP, aFiles[i].mData, true, aRand, 2000);
+				aPak.FClose(aFP);
+			}
+
+			if (aNumBad != 0)
+				printf("  %s, %s: %d results differ\n", gPakKindNames[aKind], aMapped ? "mapped" : "loaded", aNumBad);
+			SEXY_CHECK(aNumBad == 0);
+		}
+	}
+
+	// Disk files go through the read ahead buffer instead
+	PakInterface aPak;
+	int aNumBad = 0;
+	for (size_t i = 0; i < aFiles.size(); i++)
+	{
+		std::string aFileName = TestGetTempDir() + "fuzz.dat";
+		FILE* aDiskFP = fopen(aFileName.c_str(), "wb");
+		SEXY_CHECK(aDiskFP != NULL);
+		if (aDiskFP == NULL)
+			continue;
+		if (!aFiles[i].mData.empty())
+			fwrite(&aFiles[i].mData[0], 1, aFiles[i].mData.size(), aDiskFP);
+		fclose(aDiskFP);
+
+		PFILE* aFP = aPak.FOpen(aFileName.c_str(), "rb");
+		SEXY_CHECK(aFP != NULL);
+		if (aFP == NULL)
+			continue;
+		aNumBad += FuzzFile(&aPak, aFP, aFiles[i].mData, false, aRand, 2000);
+		aPak.FClose(aFP);
+	}
+
+	if (aNumBad != 0)
+		printf("  disk: %d results differ\n", aNumBad);
+	SEXY_CHECK(aNumBad == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A compressed entry whose size gives more blocks than the pak has room to
+// list sizes for.
+///////////////////////////////////////////////////////////////////////////////
+static bool AddPakWithBlockCount(uint64_t theSize, uint32_t theBlockSize, int theNumBlocksListed)
+{
+	TestPakWriter aWriter;
+	aWriter.Begin(1);
+	aWriter.WriteName("bad.dat");
+	aWriter.WriteValue((uint8_t) PAKCODEC_ZLIB);
+	aWriter.WriteValue((int64_t) 0);
+	aWriter.WriteValue((uint64_t) 0);
+	aWriter.WriteValue(theSize);
+	aWriter.WriteValue(theBlockSize);
+	for (int i = 0; i < theNumBlocksListed; i++)
+	{
+		aWriter.WriteValue(theBlockSize);
+		aWriter.mData.resize(aWriter.mData.size() + theBlockSize, 'x');
+	}
+
+	std::string aPakName = TestGetTempDir() + "blocks.pak";
+	if (!aWriter.Save(aPakName))
+		return false;
+
+	PakInterface aPak;
+	return aPak.AddPakFile(aPakName);
+}
+
+SEXY_TEST(PakRejectsBadBlockCounts)
+{
+	// What's listed is fine
+	SEXY_CHECK(AddPakWithBlockCount(3 * 16, 16, 3));
+
+	// More blocks than listed, by a little and by a lot
+	SEXY_CHECK(!AddPakWithBlockCount(3 * 16 + 1, 16, 3));
+	SEXY_CHECK(!AddPakWithBlockCount(1000000 * 16, 16, 3));
+	SEXY_CHECK(!AddPakWithBlockCount(0x4000000000000000ULL, 1, 3));
+	SEXY_CHECK(!AddPakWithBlockCount(0xFFFFFFFFFFFFFFFFULL, 1, 3));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A pak of "good.dat", ten bytes of 'g', followed by a stored record with the
+// offset and size given.  Version 0 has no offsets, theSize goes in its int.
+///////////////////////////////////////////////////////////////////////////////
+static std::string WritePakWithRecord(int theVersion, uint64_t theOffset, uint64_t theSize)
+{
+	TestPakWriter aWriter;
+	aWriter.Begin(theVersion);
+
+	aWriter.WriteName("good.dat");
+	if (theVersion == 0)
+	{
+		aWriter.WriteValue((int) 10);
+		aWriter.WriteValue((int64_t) 0);
+	}
+	else
+	{
+		aWriter.WriteValue((uint8_t) PAKCODEC_STORE);
+		aWriter.WriteValue((int64_t) 0);
+		aWriter.WriteValue((uint64_t) 0);
+		aWriter.WriteValue((uint64_t) 10);
+	}
+	aWriter.mData.resize(10, 'g');
+
+	aWriter.WriteName("bad.dat");
+	if (theVersion == 0)
+	{
+		aWriter.WriteValue((int) theSize);
+		aWriter.WriteValue((int64_t) 0);
+	}
+	else
+	{
+		aWriter.WriteValue((uint8_t) PAKCODEC_STORE);
+		aWriter.WriteValue((int64_t) 0);
+		aWriter.WriteValue(theOffset);
+		aWriter.WriteValue(theSize);
+	}
+
+	std::string aPakName = TestGetTempDir() + "records.pak";
+	SEXY_CHECK(aWriter.Save(aPakName));
+	return aPakName;
+}
+
+// Whether theName opens as a pak record and reads back as theFill bytes
+static bool ReadsAs(PakInterface& thePak, const char* theName, char theFill, int theSize)
+{
+	PFILE* aFP = thePak.FOpen(theName, "rb");
+	if (aFP == NULL)
+		return false;
+
+	std::vector<char> aData(theSize + 1);
+	bool isSame = (aFP->mRecord != NULL) && ((int) thePak.FRead(&aData[0], 1, theSize + 1, aFP) == theSize) &&
+		(std::count(aData.begin(), aData.begin() + theSize, theFill) == theSize);
+	thePak.FClose(aFP);
+	return isSame;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A record reaching outside the pak rejects the whole pak, and none of it,
+// not even the records that were fine or the pak itself, can be opened.  A
+// pak added before keeps its records.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(PakRejectsRecordsOutsideThePak)
+{
+	struct BadRecord
+	{
+		int					mVersion;
+		uint64_t			mOffset;
+		uint64_t			mSize;
+	};
+
+	static const BadRecord aBadRecords[] =
+	{
+		{ 1, 0, 100000 },						// far past the end
+		{ 1, 0xFFFFFFFFFFFF0000ULL, 10 },		// negative once cast
+		{ 1, 0x8000000000000000ULL, 0 },
+		{ 1, 5, 6 },							// one byte past the end
+		{ 1, 11, 0 },
+		{ 1, 0, 0x8000000000000000ULL },
+		{ 1, 0, 0xFFFFFFFFFFFFFFFFULL },
+		{ 0, 0, 100000 },
+		{ 0, 0, (uint64_t) -5 }
+	};
+
+	for (int aMapped = 0; aMapped < 2; aMapped++)
+	{
+		// What fits is fine, right up to the end
+		{
+			PakInterface aPak;
+			aPak.mMapPakFiles = aMapped != 0;
+			SEXY_CHECK(aPak.AddPakFile(WritePakWithRecord(1, 4, 6)));
+			SEXY_CHECK(aPak.AddPakFile(WritePakWithRecord(1, 10, 0)));
+			SEXY_CHECK(ReadsAs(aPak, "good.dat", 'g', 10));
+			SEXY_CHECK(ReadsAs(aPak, "bad.dat", 'g', 0));
+		}
+
+		for (size_t i = 0; i < sizeof(aBadRecords) / sizeof(aBadRecords[0]); i++)
+		{
+			const BadRecord& aBad = aBadRecords[i];
+
+			PakInterface aPak;
+			aPak.mMapPakFiles = aMapped != 0;
+			std::string aPakName = WritePakWithRecord(aBad.mVersion, aBad.mOffset, aBad.mSize);
+			bool isAdded = aPak.AddPakFile(aPakName);
+			SEXY_CHECK(!isAdded);
+			SEXY_CHECK(aPak.mPakRecordMap.empty() && aPak.mPakCollectionList.empty());
+			SEXY_CHECK(aPak.FOpen("bad.dat", "rb") == NULL);
+			SEXY_CHECK(aPak.FOpen("good.dat", "rb") == NULL);
+			if (isAdded)
+				printf("  record %d accepted\n", (int) i);
+		}
+
+		// An earlier pak's "good.dat" isn't replaced by the rejected one's
+		TestPakWriter aWriter;
+		aWriter.Begin(0);
+		aWriter.WriteName("good.dat");
+		aWriter.WriteValue((int) 20);
+		aWriter.WriteValue((int64_t) 0);
+		aWriter.mData.resize(20, 'e');
+		std::string anEarlierName = TestGetTempDir() + "earlier.pak";
+		SEXY_CHECK(aWriter.Save(anEarlierName));
+
+		PakInterface aPak;
+		aPak.mMapPakFiles = aMapped != 0;
+		SEXY_CHECK(aPak.AddPakFile(anEarlierName));
+		SEXY_CHECK(!aPak.AddPakFile(WritePakWithRecord(1, 0, 100000)));
+		SEXY_CHECK(ReadsAs(aPak, "good.dat", 'e', 20));
+		SEXY_CHECK(aPak.FOpen("bad.dat", "rb") == NULL);
+		SEXY_CHECK(aPak.mPakCollectionList.size() == 1);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decodes each of theNames the way ResourceManager asks for them, without an
+// extension and looking for alpha images, and hashes the pixels, 0 for the
+// ones that aren't there.  Returns how many opens FExists saved.
+///////////////////////////////////////////////////////////////////////////////
+static int ProbeImages(PakInterface& thePak, const std::vector<std::string>& theNames, std::vector<uint64_t>& theHashes)
+{
+	TestPakScope aScope(&thePak);
+	int aSkippedOpens = thePak.GetSkippedOpens();
+
+	theHashes.clear();
+	for (int i = 0; i < (int)theNames.size(); i++)
+	{
+		ImageLib::Image* anImage = ImageLib::GetImage(theNames[i], true);
+		theHashes.push_back(anImage != NULL ? ImageLib::ImageCache::Hash(anImage->mBits, anImage->mWidth * anImage->mHeight * sizeof(uint32_t)) : 0);
+		delete anImage;
+	}
+
+	return thePak.GetSkippedOpens() - aSkippedOpens;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Every probe for an extension or alpha image that isn't there is answered
+// from the directory listing or the pak without an open, and the images that
+// are there decode the same as they did with every probe opened.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(PakFExistsSkipsMissingImageProbes)
+{
+	std::string aDir = TestGetTempDir() + "probetree/";
+	TestMakeImageGroup(aDir, "Probe", 8, 16);
+
+	// Probe1 also has a _Probe1 alpha image, found on the third of its probes
+	ImageLib::Image anAlpha;
+	anAlpha.mWidth = 16;
+	anAlpha.mHeight = 16;
+	anAlpha.mBits = new uint32_t[16 * 16];
+	std::fill(anAlpha.mBits, anAlpha.mBits + 16 * 16, 0xFF000080);
+	SEXY_CHECK(ImageLib::WritePNGImage(aDir + "_Probe1.png", &anAlpha));
+
+	std::vector<std::string> aNames;
+	for (int i = 0; i < 8; i++)
+		aNames.push_back(StrFormat("Probe%d", i));
+	aNames.push_back("Missing");
+	aNames.push_back("sub/Missing");
+
+	// A PNG misses .tga and .jpg, a JPEG misses .tga, and everything misses
+	// all four extensions of both alpha names but for Probe1, which misses
+	// .tga and .jpg of _Probe1 and then stops.  Missing misses all twelve,
+	// and sub/ can't be listed, so sub/Missing is left to the opens.
+	const int NUM_MISSES = 5 * (2 + 8) + 2 * (1 + 8) + (2 + 2) + 12;
+
+	std::vector<uint64_t> aWant;
+	{
+		PakInterface aPak;
+		aPak.mIndexDirs = false;
+		std::vector<std::string> aDiskNames;
+		for (int i = 0; i < (int)aNames.size(); i++)
+			aDiskNames.push_back(aDir + aNames[i]);
+		SEXY_CHECK(ProbeImages(aPak, aDiskNames, aWant) == 0);
+
+		std::vector<uint64_t> aHashes;
+		aPak.mIndexDirs = true;
+		int aSkipped = ProbeImages(aPak, aDiskNames, aHashes);
+		printf("  disk: %d opens skipped\n", aSkipped);
+		SEXY_CHECK(aSkipped == NUM_MISSES);
+		SEXY_CHECK(aHashes == aWant);
+
+		// A file made behind the listing's back isn't seen until it's cleared
+		SEXY_CHECK(!aPak.FExists((aDir + "Late.png").c_str()));
+		SEXY_CHECK(ImageLib::WritePNGImage(aDir + "Late.png", &anAlpha));
+		SEXY_CHECK(!aPak.FExists((aDir + "Late.png").c_str()));
+		aPak.ClearDirListings();
+		SEXY_CHECK(aPak.FExists((aDir + "Late.png").c_str()));
+		remove((aDir + "Late.png").c_str());
+	}
+
+	for (int i = 0; i < 8; i++)
+		SEXY_CHECK(aWant[i] != 0);
+	SEXY_CHECK(aWant[8] == 0 && aWant[9] == 0);
+
+	// The same from a pak, where every name that isn't a record is looked for
+	// on disk, relative to where the tests run
+	PakBuildOptions anOptions;
+	SEXY_CHECK(BuildPak(TestGetTempDir() + "probe.pak", aDir, anOptions).mError == 0);
+
+	PakInterface aPak;
+	SEXY_CHECK(aPak.AddPakFile(TestGetTempDir() + "probe.pak"));
+	std::vector<uint64_t> aHashes;
+	int aSkipped = ProbeImages(aPak, aNames, aHashes);
+	printf("  pak: %d opens skipped\n", aSkipped);
+	SEXY_CHECK(aSkipped == NUM_MISSES);
+	SEXY_CHECK(aHashes == aWant);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes a version 0 pak of theNumFiles files averaging theAverageSize bytes
+// a piece, a chunk at a time so it never has to sit in memory.  Each file's
+// bytes are its index, so a read can be checked without keeping them.
+///////////////////////////////////////////////////////////////////////////////
+static bool WriteLargePak(const std::string& theFileName, int theNumFiles, int theAverageSize, std::vector<std::string>& theNames)
+{
+	MTRand aRand(2024);
+	TestPakWriter aWriter;
+	aWriter.Begin(0);
+
+	std::vector<int> aSizes(theNumFiles);
+	theNames.resize(theNumFiles);
+	for (int i = 0; i < theNumFiles; i++)
+	{
+		char aName[64];
+		sprintf(aName, "images\\set%d\\sprite%d.png", i % 50, i);
+		theNames[i] = aName;
+		aSizes[i] = 1 + aRand.Next((unsigned long) theAverageSize * 2);
+
+		aWriter.WriteName(aName);
+		aWriter.WriteValue(aSizes[i]);
+		aWriter.WriteValue((int64_t) i);
+	}
+	aWriter.WriteValue((uint8_t) TEST_PAK_END);
+
+	FILE* aFP = fopen(theFileName.c_str(), "wb");
+	if (aFP == NULL)
+		return false;
+
+	bool isWritten = true;
+	for (size_t i = 0; i < aWriter.mDirectory.size(); i++)
+		aWriter.mDirectory[i] ^= TEST_PAK_XOR_KEY;
+	isWritten &= fwrite(&aWriter.mDirectory[0], 1, aWriter.mDirectory.size(), aFP) == aWriter.mDirectory.size();
+
+	std::vector<uint8_t> aData;
+	for (int i = 0; i < theNumFiles; i++)
+	{
+		aData.assign(aSizes[i], (uint8_t) (i ^ TEST_PAK_XOR_KEY));
+		isWritten &= fwrite(&aData[0], 1, aData.size(), aFP) == aData.size();
+	}
+
+	return (fclose(aFP) == 0) && isWritten;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A 256 MB pak of 20000 files.  Time to the first byte of one file with the
+// pak loaded and decoded up front, as AddPakFile always used to, and mapped;
+// then opening every file, and looking each one up in the hashed index against
+// the std::map lookup, with a std::string built for every open, FOpen used to
+// do.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(PakOpenAndLookup)
+{
+	const int NUM_FILES = 20000;
+	const int NUM_PASSES = 10;
+
+	std::string aPakName = TestGetTempDir() + "large.pak";
+	std::vector<std::string> aNames;
+	SEXY_CHECK(WriteLargePak(aPakName, NUM_FILES, 12800, aNames));
+
+	for (int aMapped = 0; aMapped < 2; aMapped++)
+	{
+		PakInterface aPak;
+		aPak.mMapPakFiles = aMapped != 0;
+
+		PerfTimer aTimer;
+		aTimer.Start();
+		SEXY_CHECK(aPak.AddPakFile(aPakName));
+		PFILE* aFP = aPak.FOpen(aNames[NUM_FILES / 2].c_str(), "rb");
+		SEXY_CHECK(aFP != NULL);
+		uint8_t aByte = 0;
+		SEXY_CHECK(aFP != NULL && aPak.FRead(&aByte, 1, 1, aFP) == 1);
+		aPak.FClose(aFP);
+		double aFirstOpenTime = aTimer.GetDuration();
+		SEXY_CHECK(aByte == (uint8_t) (NUM_FILES / 2));
+
+		int aNumFound = 0;
+		aTimer.Start();
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			for (int i = 0; i < NUM_FILES; i++)
+			{
+				aFP = aPak.FOpen(aNames[i].c_str(), "rb");
+				aNumFound += (aFP != NULL) && (aFP->mRecord != NULL);
+				aPak.FClose(aFP);
+			}
+		}
+		double anOpenTime = aTimer.GetDuration();
+		SEXY_CHECK(aNumFound == NUM_FILES * NUM_PASSES);
+
+		// The same case folding for both, so only the lookups differ
+		double aLookupTimes[2];
+		for (int aKind = 0; aKind < 2; aKind++)
+		{
+			aNumFound = 0;
+			aTimer.Start();
+			for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+			{
+				for (int i = 0; i < NUM_FILES; i++)
+				{
+					char anUpperName[256];
+					const char* aSrc = aNames[i].c_str();
+					char* aDest = anUpperName;
+					for (; *aSrc != 0; aSrc++)
+						*(aDest++) = (*aSrc == '\\') ? '/' : toupper(*aSrc);
+					*aDest = 0;
+
+					if (aKind == 0)
+						aNumFound += aPak.mPakRecordIndex.Find(anUpperName) != NULL;
+					else
+						aNumFound += aPak.mPakRecordMap.find(anUpperName) != aPak.mPakRecordMap.end();
+				}
+			}
+			aLookupTimes[aKind] = aTimer.GetDuration();
+			SEXY_CHECK(aNumFound == NUM_FILES * NUM_PASSES);
+		}
+
+		int aNumOpens = NUM_FILES * NUM_PASSES;
+		printf("  %s: first open %7.1f ms, FOpen+FClose %4.0f ns, index lookup %4.0f ns, old map lookup %4.0f ns\n", aMapped ? "mapped" : "loaded",
+			aFirstOpenTime, anOpenTime * 1000000.0 / aNumOpens, aLookupTimes[0] * 1000000.0 / aNumOpens, aLookupTimes[1] * 1000000.0 / aNumOpens);
+	}
+
+	remove(aPakName.c_str());
+}
@@ -0,0 +1,197 @@
+#include "TestHarness.h"
+#include "graphics/PixelConvert.h"
+#include "misc/CPUFeatures.h"
+#include "misc/MTRand.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// The per-pixel conversions CopyImageToTexture4444/565 did before the row
+// kernels, which every level has to match bit for bit.
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t OldPixel4444(uint32_t aPixel)
+{
+	return ((aPixel >> 16) & 0xF000) | ((aPixel >> 12) & 0x0F00) | ((aPixel >> 8) & 0x00F0) | ((aPixel >> 4) & 0x000F);
+}
+
+static uint16_t OldPixel565(uint32_t aPixel)
+{
+	return ((aPixel >> 8) & 0xF800) | ((aPixel >> 5) & 0x07E0) | ((aPixel >> 3) & 0x001F);
+}
+
+static const char* gSIMDLevelNames[] = { "scalar", "SSE2", "AVX2", "NEON" };
+
+// Written just past the end of every row, and must still be there after
+static const uint32_t GUARD = 0xDEADBEEF;
+
+///////////////////////////////////////////////////////////////////////////////
+// Random rows of every length up to a few AVX2 registers, starting at odd
+// offsets so the kernels see unaligned pointers.  Returns how many pixels
+// differ from the old conversions, or were written past the row.
+///////////////////////////////////////////////////////////////////////////////
+static int CheckRows(MTRand& theRand, int theIterations)
+{
+	std::vector<uint32_t> aPalette(256);
+	for (int i = 0; i < 256; i++)
+		aPalette[i] = (uint32_t)theRand.Next();
+
+	std::vector<uint16_t> aPalette4444(256), aPalette565(256);
+	ConvertRow4444(&aPalette4444[0], &aPalette[0], 256);
+	ConvertRow565(&aPalette565[0], &aPalette[0], 256);
+
+	int aNumBad = 0;
+	for (int i = 0; i < 256; i++)
+		aNumBad += (aPalette4444[i] != OldPixel4444(aPalette[i])) + (aPalette565[i] != OldPixel565(aPalette[i]));
+
+	for (int anIteration = 0; anIteration < theIterations; anIteration++)
+	{
+		int aCount = theRand.Next(100UL);
+		int anOffset = theRand.Next(8UL);
+
+		std::vector<uint32_t> aSrc(anOffset + aCount);
+		std::vector<uint8_t> anIndices(anOffset + aCount);
+		for (int i = 0; i < anOffset + aCount; i++)
+		{
+			aSrc[i] = (uint32_t)theRand.Next();
+			anIndices[i] = (uint8_t)theRand.Next(256UL);
+		}
+
+		std::vector<uint16_t> a4444(anOffset + aCount + 1, (uint16_t)GUARD);
+		std::vector<uint16_t> a565(anOffset + aCount + 1, (uint16_t)GUARD);
+		std::vector<uint32_t> a8888(anOffset + aCount + 1, GUARD);
+		std::vector<uint32_t> aPalette8888(anOffset + aCount + 1, GUARD);
+		std::vector<uint16_t> aPalette16(anOffset + aCount + 1, (uint16_t)GUARD);
+
+		ConvertRow4444(&a4444[anOffset], &aSrc[anOffset], aCount);
+		ConvertRow565(&a565[anOffset], &aSrc[anOffset], aCount);
+		ConvertRow8888(&a8888[anOffset], &aSrc[anOffset], aCount);
+		ExpandPaletteRow8888(&aPalette8888[anOffset], &anIndices[anOffset], &aPalette[0], aCount);
+		ExpandPaletteRow16(&aPalette16[anOffset], &anIndices[anOffset], &aPalette4444[0], aCount);
+
+		for (int i = anOffset; i < anOffset + aCount; i++)
+		{
+			aNumBad += a4444[i] != OldPixel4444(aSrc[i]);
+			aNumBad += a565[i] != OldPixel565(aSrc[i]);
+			aNumBad += a8888[i] != aSrc[i];
+			aNumBad += aPalette8888[i] != aPalette[anIndices[i]];
+			aNumBad += aPalette16[i] != OldPixel4444(aPalette[anIndices[i]]);
+		}
+
+		int anEnd = anOffset + aCount;
+		aNumBad += (a4444[anEnd] != (uint16_t)GUARD) + (a565[anEnd] != (uint16_t)GUARD) + (a8888[anEnd] != GUARD);
+		aNumBad += (aPalette8888[anEnd] != GUARD) + (aPalette16[anEnd] != (uint16_t)GUARD);
+	}
+
+	return aNumBad;
+}
+
+SEXY_TEST(PixelConvertMatchesOld)
+{
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel)aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue; // not on this CPU
+
+		MTRand aRand(77);
+		int aNumBad = CheckRows(aRand, 3000);
+		printf("  %s: %d pixels differ\n", gSIMDLevelNames[aLevel], aNumBad);
+		SEXY_CHECK(aNumBad == 0);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ScratchBufferReusesBuckets)
+{
+	ScratchBuffer aScratch;
+
+	void* aSmall = aScratch.Get(100);
+	SEXY_CHECK(aSmall != NULL);
+	SEXY_CHECK(aScratch.Get(4096) == aSmall);
+
+	void* aBig = aScratch.Get(4097);
+	SEXY_CHECK(aBig != NULL && aBig != aSmall);
+	SEXY_CHECK(aScratch.Get(8192) == aBig);
+	SEXY_CHECK(aScratch.Get(1) == aSmall);
+
+	// Writable all the way to the size asked for
+	memset(aScratch.Get(100000), 0xAB, 100000);
+
+	aScratch.Release();
+	for (int i = 0; i < ScratchBuffer::NUM_BUCKETS; i++)
+		SEXY_CHECK(aScratch.mBuckets[i] == NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Converting a 1024x1024 texture to each upload format, at each level the CPU
+// has, against the old per-pixel loop.  CPU only, no GL needed.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(PixelConvertRows)
+{
+	const int SIZE = 1024;
+	const int NUM_PASSES = 20;
+
+	MTRand aRand(5);
+	std::vector<uint32_t> aSrc(SIZE * SIZE);
+	std::vector<uint8_t> anIndices(SIZE * SIZE);
+	std::vector<uint32_t> aPalette(256);
+	std::vector<uint16_t> aPalette16(256);
+	for (int i = 0; i < SIZE * SIZE; i++)
+	{
+		aSrc[i] = (uint32_t)aRand.Next();
+		anIndices[i] = (uint8_t)aRand.Next(256UL);
+	}
+	for (int i = 0; i < 256; i++)
+	{
+		aPalette[i] = (uint32_t)aRand.Next();
+		aPalette16[i] = OldPixel565(aPalette[i]);
+	}
+
+	std::vector<uint16_t> aDest16(SIZE * SIZE);
+	std::vector<uint32_t> aDest32(SIZE * SIZE);
+
+	PerfTimer aTimer;
+	aTimer.Start();
+	for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+	{
+		for (int i = 0; i < SIZE * SIZE; i++)
+			aDest16[i] = OldPixel4444(aSrc[i]);
+	}
+	printf("  %-6s 4444 %6.2f ms\n", "old", aTimer.GetDuration() / NUM_PASSES);
+
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel)aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue;
+
+		double aTimes[4] = { 0, 0, 0, 0 };
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			for (int aKind = 0; aKind < 4; aKind++)
+			{
+				aTimer.Start();
+				for (int y = 0; y < SIZE; y++)
+				{
+					int aRow = y * SIZE;
+					switch (aKind)
+					{
+					case 0: ConvertRow4444(&aDest16[aRow], &aSrc[aRow], SIZE); break;
+					case 1: ConvertRow565(&aDest16[aRow], &aSrc[aRow], SIZE); break;
+					case 2: ExpandPaletteRow8888(&aDest32[aRow], &anIndices[aRow], &aPalette[0], SIZE); break;
+					default: ExpandPaletteRow16(&aDest16[aRow], &anIndices[aRow], &aPalette16[0], SIZE); break;
+					}
+				}
+				aTimes[aKind] += aTimer.GetDuration();
+			}
+		}
+
+		printf("  %-6s 4444 %6.2f ms, 565 %6.2f ms, palette 8888 %6.2f ms, palette 16 %6.2f ms\n", gSIMDLevelNames[aLevel],
+			aTimes[0] / NUM_PASSES, aTimes[1] / NUM_PASSES, aTimes[2] / NUM_PASSES, aTimes[3] / NUM_PASSES);
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
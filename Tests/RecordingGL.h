@@ -0,0 +1,105 @@
+#pragma once
+
+#include "graphics/GLStateCache.h"
+#include "graphics/GLBatcher.h"
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// One call that would have reached GL.
+///////////////////////////////////////////////////////////////////////////////
+struct RecordedGLCall
+{
+	const char*				mName;
+	int						mArg1;
+	int						mArg2;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps the calls GLStateCache lets through instead of making them, so a test
+// can see a frame's state traffic without a GL context.  Texture names are
+// handed out like GL does, lowest free one first.
+///////////////////////////////////////////////////////////////////////////////
+class RecordingStateCache : public GLStateCache
+{
+public:
+	std::vector<RecordedGLCall> mCalls;
+	std::set<GLuint>		mLiveTextures;
+
+protected:
+	void					Record(const char* theName, int theArg1 = 0, int theArg2 = 0)
+	{
+		RecordedGLCall aCall = { theName, theArg1, theArg2 };
+		mCalls.push_back(aCall);
+	}
+
+	virtual GLuint			IssueGenTexture()
+	{
+		GLuint aTexture = 1;
+		while (mLiveTextures.count(aTexture) != 0)
+			aTexture++;
+		mLiveTextures.insert(aTexture);
+		Record("GenTexture", aTexture);
+		return aTexture;
+	}
+
+	virtual void			IssueBindTexture(GLuint theTexture) { Record("BindTexture", theTexture); }
+	virtual void			IssueDeleteTexture(GLuint theTexture) { mLiveTextures.erase(theTexture); Record("DeleteTexture", theTexture); }
+	virtual void			IssueTexParameter(GLenum theName, GLint theValue) { Record("TexParameter", theName, theValue); }
+	virtual void			IssueBlendFunc(GLenum theSrc, GLenum theDst) { Record("BlendFunc", theSrc, theDst); }
+	virtual void			IssueUseProgram(GLuint theProgram) { Record("UseProgram", theProgram); }
+	virtual void			IssueUniform1i(GLint theLocation, int theValue) { Record("Uniform1i", theLocation, theValue); }
+	virtual void			IssueBindVertexArray(GLuint theVertexArray) { Record("BindVertexArray", theVertexArray); }
+	virtual void			IssueBindBuffer(GLenum theTarget, GLuint theBuffer) { Record("BindBuffer", theTarget, theBuffer); }
+	virtual void			IssueDeleteBuffer(GLuint theBuffer) { Record("DeleteBuffer", theBuffer); }
+
+public:
+	int						CountCalls(const char* theName)
+	{
+		int aCount = 0;
+		for (size_t i = 0; i < mCalls.size(); i++)
+			aCount += strcmp(mCalls[i].mName, theName) == 0;
+		return aCount;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// A batch GLBatcher would have drawn.
+///////////////////////////////////////////////////////////////////////////////
+struct RecordedBatch
+{
+	GLBatchState			mState;
+	std::vector<GLVertex>	mVertices;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps every batch instead of uploading and drawing it, and sends the state
+// changes to a RecordingStateCache, so the draw calls a scene turns into can
+// be counted without a context.
+///////////////////////////////////////////////////////////////////////////////
+class RecordingBatcher : public GLBatcher
+{
+public:
+	RecordingStateCache		mRecordingCache;
+	std::vector<RecordedBatch> mBatches;
+
+protected:
+	virtual void			DrawBatch()
+	{
+		RecordedBatch aBatch;
+		aBatch.mState = mBatchState;
+		aBatch.mVertices.assign(mVertices, mVertices + mNumVertices);
+		mBatches.push_back(aBatch);
+	}
+
+public:
+	RecordingBatcher(int theCapacity) : GLBatcher(theCapacity)
+	{
+		mStateCache = &mRecordingCache;
+		mUfUseTexture = 1;
+		mRecordingCache.UseProgram(1);
+	}
+};
+
+}
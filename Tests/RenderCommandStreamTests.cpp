@@ -0,0 +1,271 @@
+#include "TestFiles.h"
+#include "graphics/RenderCommandStream.h"
+#include "graphics/MemoryImage.h"
+#include "graphics/TriVertex.h"
+#include "misc/SexyMatrix.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Counts what reaches it and checks every image it's handed.
+///////////////////////////////////////////////////////////////////////////////
+class CheckingRenderTarget : public NullRenderTarget
+{
+public:
+	int						mNumNullImages;
+	uint32_t				mFirstPixels;	// sum of the first pixel of every image blitted
+
+public:
+	CheckingRenderTarget() : mNumNullImages(0), mFirstPixels(0) {}
+
+	void					CheckImage(Image* theImage)
+	{
+		mNumDraws++;
+		if (theImage == NULL)
+			mNumNullImages++;
+		else
+			mFirstPixels += ((MemoryImage*)theImage)->GetBits()[0];
+	}
+
+	virtual void			Blt(Image* theImage, float theX, float theY, const Rect& theSrcRect, const Color& theColor, int theDrawMode, bool linearFilter) { CheckImage(theImage); }
+	virtual void			DrawTrianglesTex(const TriVertex theVertices[][3], int theNumTriangles, const Color& theColor, int theDrawMode, Image* theTexture, float tx, float ty, bool blend) { CheckImage(theTexture); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void FillImage(MemoryImage* theImage, uint32_t theFirstPixel)
+{
+	uint32_t* aBits = theImage->GetBits();
+	for (int i = 0; i < theImage->mWidth * theImage->mHeight; i++)
+		aBits[i] = theFirstPixel + i;
+	theImage->BitsChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Saves theRecorder's stream and loads it into thePlayer.
+///////////////////////////////////////////////////////////////////////////////
+static bool ReloadStream(RenderCommandRecorder* theRecorder, RenderCommandPlayer* thePlayer)
+{
+	std::string aFileName = TestGetTempDir() + "stream.sxrc";
+	return theRecorder->SaveToFile(aFileName) && thePlayer->LoadFromFile(aFileName);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Plays the stream to the end, returns how many frames there were.
+///////////////////////////////////////////////////////////////////////////////
+static int PlayAll(RenderCommandPlayer* thePlayer, RenderCommandTarget* theTarget)
+{
+	int aNumFrames = 0;
+	while (thePlayer->PlayFrame(theTarget))
+		aNumFrames++;
+	return aNumFrames;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(RenderStreamRoundTrip)
+{
+	TestInitGLInterface();
+
+	MemoryImage anImage;
+	anImage.Create(4, 2);
+	FillImage(&anImage, 100);
+
+	RenderCommandRecorder aRecorder;
+	aRecorder.Blt(&anImage, 1.5f, 2.25f, Rect(0, 0, 4, 2), Color::White, 0, true);
+	aRecorder.FillRect(Rect(1, 2, 3, 4), Color::Black, 0);
+	aRecorder.Flush();
+
+	// Changed bits go into the stream again
+	FillImage(&anImage, 1000);
+	TriVertex aTris[2][3];
+	memset(aTris, 0, sizeof(aTris));
+	aRecorder.Blt(&anImage, 0, 0, Rect(0, 0, 4, 2), Color::White, 0, false);
+	aRecorder.DrawTrianglesTex(aTris, 2, Color::White, 0, &anImage, 0, 0, true);
+	aRecorder.Flush();
+
+	RenderCommandPlayer aPlayer;
+	SEXY_CHECK(ReloadStream(&aRecorder, &aPlayer));
+
+	CheckingRenderTarget aTarget;
+	SEXY_CHECK(PlayAll(&aPlayer, &aTarget) == 2);
+	SEXY_CHECK(!aPlayer.mCorrupt);
+	SEXY_CHECK(aTarget.mNumFrames == 2);
+	SEXY_CHECK(aTarget.mNumDraws == 4);
+	SEXY_CHECK(aTarget.mNumNullImages == 0);
+	SEXY_CHECK(aTarget.mFirstPixels == 100 + 1000 + 1000);
+	SEXY_CHECK(aPlayer.mStats.mNumCommands[RenderCommand_ImageData] == 2);
+
+	// And again from the top
+	aPlayer.Rewind();
+	SEXY_CHECK(PlayAll(&aPlayer, &aTarget) == 2);
+	SEXY_CHECK(aTarget.mNumDraws == 8);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Records one good frame, lets theBadCommand append to the stream, and checks
+// that the good frame plays, the bad one is refused and nothing after it runs.
+///////////////////////////////////////////////////////////////////////////////
+static void CheckBadCommandRejected(void (*theBadCommand)(Buffer& theBuffer))
+{
+	MemoryImage anImage;
+	anImage.Create(2, 2);
+	FillImage(&anImage, 1);
+
+	RenderCommandRecorder aRecorder;
+	aRecorder.Blt(&anImage, 0, 0, Rect(0, 0, 2, 2), Color::White, 0, false);
+	aRecorder.Flush();
+	theBadCommand(aRecorder.mBuffer);
+	aRecorder.FillRect(Rect(0, 0, 1, 1), Color::White, 0);
+	aRecorder.Flush();
+
+	RenderCommandPlayer aPlayer;
+	SEXY_CHECK(ReloadStream(&aRecorder, &aPlayer));
+
+	CheckingRenderTarget aTarget;
+	SEXY_CHECK(aPlayer.PlayFrame(&aTarget));
+	SEXY_CHECK(!aPlayer.PlayFrame(&aTarget));
+	SEXY_CHECK(aPlayer.mCorrupt);
+	SEXY_CHECK(!aPlayer.PlayFrame(&aTarget));
+	SEXY_CHECK(aTarget.mNumDraws == 1);
+	SEXY_CHECK(aTarget.mNumNullImages == 0);
+}
+
+static void WriteHugeTriangles(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_DrawTrianglesTex);
+	theBuffer.WriteLong(0x7FFFFFFF);
+}
+
+static void WriteNegativeTriangles(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_DrawTrianglesTex);
+	theBuffer.WriteLong(-2);
+}
+
+static void WriteHugeStrip(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_DrawTrianglesTexStrip);
+	theBuffer.WriteLong(0x7FFFFFFE);
+}
+
+static void WriteHugePoly(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_FillPoly);
+	theBuffer.WriteLong(100000000);
+}
+
+static void WriteHugeImage(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_ImageData);
+	theBuffer.WriteLong(7);
+	theBuffer.WriteLong(100000);
+	theBuffer.WriteLong(100000);
+	theBuffer.WriteByte(0);
+}
+
+static void WriteTruncatedImage(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_ImageData);
+	theBuffer.WriteLong(7);
+	theBuffer.WriteLong(256);
+	theBuffer.WriteLong(256);
+	theBuffer.WriteByte(1);
+	theBuffer.WriteLong(0);
+}
+
+static void WriteMissingImage(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(RenderCommand_Blt);
+	theBuffer.WriteLong(12345);
+	for (int i = 0; i < 6; i++)
+		theBuffer.WriteLong(0);
+	theBuffer.WriteLong(-1);
+	theBuffer.WriteByte(0);
+	theBuffer.WriteByte(0);
+}
+
+static void WriteUnknownCommand(Buffer& theBuffer)
+{
+	theBuffer.WriteByte(NUM_RENDER_COMMANDS);
+}
+
+SEXY_TEST(RenderStreamRejectsBadCommands)
+{
+	CheckBadCommandRejected(WriteHugeTriangles);
+	CheckBadCommandRejected(WriteNegativeTriangles);
+	CheckBadCommandRejected(WriteHugeStrip);
+	CheckBadCommandRejected(WriteHugePoly);
+	CheckBadCommandRejected(WriteHugeImage);
+	CheckBadCommandRejected(WriteTruncatedImage);
+	CheckBadCommandRejected(WriteMissingImage);
+	CheckBadCommandRejected(WriteUnknownCommand);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoding cost of a stream, replayed into NullRenderTarget: 300 frames of
+// 400 draws spread over 16 images, the kind of load a busy board produces.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(RenderStreamReplay)
+{
+	TestInitGLInterface();
+
+	const int NUM_IMAGES = 16;
+	const int NUM_FRAMES = 300;
+	const int DRAWS_PER_FRAME = 400;
+
+	MemoryImage* anImages[NUM_IMAGES];
+	for (int i = 0; i < NUM_IMAGES; i++)
+	{
+		anImages[i] = new MemoryImage();
+		anImages[i]->Create(64, 64);
+		FillImage(anImages[i], i);
+	}
+
+	TriVertex aTris[8][3];
+	memset(aTris, 0, sizeof(aTris));
+	Point aPoly[6] = { Point(0, 0), Point(10, 0), Point(15, 5), Point(10, 10), Point(0, 10), Point(-5, 5) };
+	SexyMatrix3 aTransform;
+	aTransform.LoadIdentity();
+
+	RenderCommandRecorder aRecorder;
+	PerfTimer aTimer;
+	aTimer.Start();
+	for (int aFrame = 0; aFrame < NUM_FRAMES; aFrame++)
+	{
+		for (int i = 0; i < DRAWS_PER_FRAME; i++)
+		{
+			MemoryImage* anImage = anImages[(aFrame + i) % NUM_IMAGES];
+			switch (i % 5)
+			{
+			case 0:
+			case 1: aRecorder.Blt(anImage, (float)i, (float)aFrame, Rect(0, 0, 64, 64), Color::White, 0, false); break;
+			case 2: aRecorder.BltTransformed(anImage, NULL, Color::White, 0, Rect(0, 0, 32, 32), aTransform, true, 1.0f, 2.0f, true); break;
+			case 3: aRecorder.DrawTrianglesTex(aTris, 8, Color::White, 0, anImage, 0, 0, true); break;
+			case 4: aRecorder.FillPoly(aPoly, 6, NULL, Color::Black, 0, i, aFrame); break;
+			}
+		}
+		aRecorder.Flush();
+	}
+	double aRecordTime = aTimer.GetDuration();
+
+	RenderCommandPlayer aPlayer;
+	SEXY_CHECK(ReloadStream(&aRecorder, &aPlayer));
+
+	const int NUM_PASSES = 10;
+	NullRenderTarget aTarget;
+	aTimer.Start();
+	for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+	{
+		aPlayer.Rewind();
+		SEXY_CHECK(PlayAll(&aPlayer, &aTarget) == NUM_FRAMES);
+	}
+	double aPlayTime = aTimer.GetDuration() / NUM_PASSES;
+
+	SEXY_CHECK(aTarget.mNumDraws == NUM_PASSES * NUM_FRAMES * DRAWS_PER_FRAME);
+	printf("  %d frames, %d draws, %.1f MB\n", NUM_FRAMES, NUM_FRAMES * DRAWS_PER_FRAME, aRecorder.mBuffer.GetDataLen() / (1024.0 * 1024.0));
+	printf("  record %.2f ms/frame, replay %.3f ms/frame, %.0f draws/ms\n", aRecordTime / NUM_FRAMES, aPlayTime / NUM_FRAMES, NUM_FRAMES * DRAWS_PER_FRAME / aPlayTime);
+
+	for (int i = 0; i < NUM_IMAGES; i++)
+		delete anImages[i];
+}
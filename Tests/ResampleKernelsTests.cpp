@@ -0,0 +1,260 @@
+#include "TestHarness.h"
+#include "sound/ResampleKernels.h"
+#include "misc/CPUFeatures.h"
+#include "misc/MTRand.h"
+
+#include <math.h>
+
+using namespace Sexy;
+
+static const char* gSIMDLevelNames[] = { "scalar", "SSE2", "AVX2", "NEON" };
+static const char* gResampleModeNames[] = { "linear", "cubic " };
+static const char* gSampleTypeNames[] = { "int16", "float" };
+
+///////////////////////////////////////////////////////////////////////////////
+// Full scale noise, or a sine at theCycles per frame for a smooth signal.
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<int16_t> MakeSamples(int theNumSamples, double theCycles, MTRand& theRand)
+{
+	std::vector<int16_t> aSamples(theNumSamples);
+	for (int i = 0; i < theNumSamples; i++)
+		aSamples[i] = (theCycles == 0) ? (int16_t) theRand.Next() : (int16_t) (30000 * sin(i * theCycles * 2 * 3.14159265358979));
+	return aSamples;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Same taps as ResampleKernels.h describes, with exact weights in doubles.
+///////////////////////////////////////////////////////////////////////////////
+static double ReferenceTap(const std::vector<int16_t>& theSrc, int theSrcChannels, int theChannel, int theIndex, bool looping)
+{
+	int aNumFrames = (int) theSrc.size() / theSrcChannels;
+	if (looping)
+		theIndex = ((theIndex % aNumFrames) + aNumFrames) % aNumFrames;
+	else
+		theIndex = std::max(0, std::min(aNumFrames - 1, theIndex));
+	return theSrc[theIndex * theSrcChannels + std::min(theChannel, theSrcChannels - 1)];
+}
+
+static void ResampleReference(std::vector<double>& theDest, int theDestChannels, const std::vector<int16_t>& theSrc, int theSrcChannels, bool looping,
+	uint64_t thePos, uint64_t theStep, int theCount, float theGainLeft, float theGainRight, ResampleMode theMode)
+{
+	for (int i = 0; i < theCount; i++, thePos += theStep)
+	{
+		int k = (int) (thePos >> 32);
+		double t = (thePos & 0xFFFFFFFF) / 4294967296.0;
+
+		double aSides[2];
+		for (int c = 0; c < 2; c++)
+		{
+			double p0 = ReferenceTap(theSrc, theSrcChannels, c, k, looping);
+			double p1 = ReferenceTap(theSrc, theSrcChannels, c, k + 1, looping);
+			if (theMode == RESAMPLE_CUBIC)
+			{
+				double pm = ReferenceTap(theSrc, theSrcChannels, c, k - 1, looping);
+				double p2 = ReferenceTap(theSrc, theSrcChannels, c, k + 2, looping);
+				aSides[c] = 0.5 * ((2 * p0) + (-pm + p1) * t + (2 * pm - 5 * p0 + 4 * p1 - p2) * t * t + (-pm + 3 * p0 - 3 * p1 + p2) * t * t * t);
+			}
+			else
+				aSides[c] = p0 + (p1 - p0) * t;
+		}
+
+		if (theDestChannels == 2)
+		{
+			theDest[i * 2] += aSides[0] * theGainLeft;
+			theDest[i * 2 + 1] += aSides[1] * theGainRight;
+		}
+		else
+			theDest[i] += (aSides[0] * theGainLeft + aSides[1] * theGainRight) * 0.5;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// One random run of frames, starting anywhere in the data or right at its
+// start, and running off the end of it when looping.
+///////////////////////////////////////////////////////////////////////////////
+struct ResampleRun
+{
+	int						mDestChannels;
+	int						mSrcChannels;
+	bool					mLooping;
+	uint64_t				mPos;
+	uint64_t				mStep;
+	int						mCount;
+	float					mGainLeft;
+	float					mGainRight;
+};
+
+static ResampleRun MakeRun(MTRand& theRand, int theSrcFrames)
+{
+	ResampleRun aRun;
+	aRun.mDestChannels = 1 + theRand.Next(2UL);
+	aRun.mSrcChannels = 1 + theRand.Next(2UL);
+	aRun.mLooping = theRand.Next(2UL) != 0;
+
+	int aStart = theRand.Next((unsigned long) theSrcFrames);
+	if (theRand.Next(4UL) == 0)
+		aStart = std::min(theRand.Next(3UL), (unsigned long) theSrcFrames - 1);
+	aRun.mPos = ((uint64_t) aStart << 32) | theRand.Next();
+	aRun.mStep = (theRand.Next(4UL) == 0) ? ((uint64_t) 1 << 32) : (((uint64_t) theRand.Next(3UL) << 32) | theRand.Next());
+	if (aRun.mStep == 0)
+		aRun.mStep = 1;
+
+	// Non looping runs stop at the end like SoundMixer stops them
+	int aMaxCount = 1 + theRand.Next(300UL);
+	uint64_t anEnd = (uint64_t) theSrcFrames << 32;
+	if ((!aRun.mLooping) && (aRun.mPos + aMaxCount * aRun.mStep > anEnd))
+		aMaxCount = (int) ((anEnd - aRun.mPos + aRun.mStep - 1) / aRun.mStep);
+	aRun.mCount = aMaxCount;
+
+	aRun.mGainLeft = theRand.Next(1000UL) / 1000.0f;
+	aRun.mGainRight = theRand.Next(1000UL) / 1000.0f;
+	return aRun;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Through ResampleFloat the samples are the same values as floats.
+///////////////////////////////////////////////////////////////////////////////
+static void Resample(std::vector<float>& theDest, const std::vector<int16_t>& theSrc, const ResampleRun& theRun, ResampleMode theMode, bool isFloat)
+{
+	theDest.assign(theRun.mCount * theRun.mDestChannels, 0.0f);
+	if (isFloat)
+	{
+		std::vector<float> aFloatSrc(theSrc.begin(), theSrc.end());
+		ResampleFloat(&theDest[0], theRun.mDestChannels, &aFloatSrc[0], theRun.mSrcChannels, (int) theSrc.size() / theRun.mSrcChannels, theRun.mLooping,
+			theRun.mPos, theRun.mStep, theRun.mCount, theRun.mGainLeft, theRun.mGainRight, theMode);
+	}
+	else
+		ResampleInt16(&theDest[0], theRun.mDestChannels, &theSrc[0], theRun.mSrcChannels, (int) theSrc.size() / theRun.mSrcChannels, theRun.mLooping,
+			theRun.mPos, theRun.mStep, theRun.mCount, theRun.mGainLeft, theRun.mGainRight, theMode);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Weights are rounded to 14 bits from a 16 bit fraction, so the result is
+// within a few steps of the exact one even for full scale noise.  A smooth
+// signal is much closer.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ResampleMatchesReference)
+{
+	static const double aCycles[] = { 0, 0.01 };
+	static const double aMaxErrors[] = { 8, 2 };
+
+	SetSIMDLevel(SIMDLevel_None);
+	for (int isFloat = 0; isFloat < 2; isFloat++)
+	{
+		MTRand aRand(2024);
+		for (int aMode = RESAMPLE_LINEAR; aMode <= RESAMPLE_CUBIC; aMode++)
+		{
+			for (int aSignal = 0; aSignal < 2; aSignal++)
+			{
+				std::vector<int16_t> aSrc = MakeSamples(2 * 501, aCycles[aSignal], aRand);
+				double aMaxError = 0;
+				for (int aRunNum = 0; aRunNum < 500; aRunNum++)
+				{
+					ResampleRun aRun = MakeRun(aRand, (int) aSrc.size() / 2);
+					aRun.mSrcChannels = 2;
+
+					std::vector<float> aGot;
+					Resample(aGot, aSrc, aRun, (ResampleMode) aMode, isFloat != 0);
+
+					std::vector<double> aWant(aGot.size(), 0.0);
+					ResampleReference(aWant, aRun.mDestChannels, aSrc, aRun.mSrcChannels, aRun.mLooping, aRun.mPos, aRun.mStep, aRun.mCount, aRun.mGainLeft, aRun.mGainRight, (ResampleMode) aMode);
+
+					for (size_t i = 0; i < aGot.size(); i++)
+						aMaxError = std::max(aMaxError, fabs(aGot[i] - aWant[i]));
+				}
+
+				printf("  %s %s %s: %.2f most off\n", gSampleTypeNames[isFloat], gResampleModeNames[aMode], aSignal == 0 ? "noise" : "sine ", aMaxError);
+				SEXY_CHECK(aMaxError <= aMaxErrors[aSignal]);
+			}
+		}
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ResampleLevelsMatchScalar)
+{
+	for (int isFloat = 0; isFloat < 2; isFloat++)
+	{
+		for (int aMode = RESAMPLE_LINEAR; aMode <= RESAMPLE_CUBIC; aMode++)
+		{
+			for (int aLevel = SIMDLevel_SSE2; aLevel <= SIMDLevel_NEON; aLevel++)
+			{
+				SetSIMDLevel((SIMDLevel) aLevel);
+				if (GetSIMDLevel() != aLevel)
+					continue;
+
+				// Same runs at every level
+				MTRand aRand(77);
+				std::vector<int16_t> aSrc = MakeSamples(2 * 333, 0, aRand);
+				int aNumBad = 0;
+				for (int aRunNum = 0; aRunNum < 2000; aRunNum++)
+				{
+					ResampleRun aRun = MakeRun(aRand, (int) aSrc.size() / 2);
+
+					std::vector<float> aGot;
+					Resample(aGot, aSrc, aRun, (ResampleMode) aMode, isFloat != 0);
+
+					SetSIMDLevel(SIMDLevel_None);
+					std::vector<float> aWant;
+					Resample(aWant, aSrc, aRun, (ResampleMode) aMode, isFloat != 0);
+					SetSIMDLevel((SIMDLevel) aLevel);
+
+					aNumBad += memcmp(&aGot[0], &aWant[0], aGot.size() * sizeof(float)) != 0;
+				}
+
+				printf("  %s %s %s: %d runs differ\n", gSampleTypeNames[isFloat], gResampleModeNames[aMode], gSIMDLevelNames[aLevel], aNumBad);
+				SEXY_CHECK(aNumBad == 0);
+			}
+		}
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// How many voices a millisecond resamples, a voice being one SoundMixer block
+// of 256 stereo frames.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(ResampleVoicesPerMs)
+{
+	const int BLOCK_FRAMES = 256;
+	const int NUM_BLOCKS = 20000;
+
+	MTRand aRand(5);
+	std::vector<int16_t> aSrc = MakeSamples(2 * 44100, 0, aRand);
+	std::vector<float> aDest(BLOCK_FRAMES * 2);
+	uint64_t aStep = (uint64_t) (1.1 * 4294967296.0);
+	uint64_t anEnd = (uint64_t) (aSrc.size() / 2 - 2 * BLOCK_FRAMES) << 32;
+
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel) aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue;
+
+		for (int aMode = RESAMPLE_LINEAR; aMode <= RESAMPLE_CUBIC; aMode++)
+		{
+			for (int aSrcChannels = 2; aSrcChannels >= 1; aSrcChannels--)
+			{
+				uint64_t aPos = 0;
+				PerfTimer aTimer;
+				aTimer.Start();
+				for (int aBlock = 0; aBlock < NUM_BLOCKS; aBlock++)
+				{
+					ResampleInt16(&aDest[0], 2, &aSrc[0], aSrcChannels, (int) aSrc.size() / aSrcChannels, true, aPos, aStep, BLOCK_FRAMES, 0.5f, 0.5f, (ResampleMode) aMode);
+					aPos += BLOCK_FRAMES * aStep;
+					if (aPos >= anEnd)
+						aPos -= anEnd;
+				}
+				double aTime = aTimer.GetDuration();
+
+				printf("  %-6s %s %s: %.0f voices/ms\n", gSIMDLevelNames[aLevel], gResampleModeNames[aMode], aSrcChannels == 2 ? "stereo" : "mono  ", NUM_BLOCKS / aTime);
+			}
+		}
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
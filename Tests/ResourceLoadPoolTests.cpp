@@ -0,0 +1,75 @@
+#include "TestFiles.h"
+
+using namespace Sexy;
+
+static const int THREAD_COUNTS[] = { 1, 2, 4, 8 };
+
+///////////////////////////////////////////////////////////////////////////////
+// Whatever the number of threads, the group loads to the same pixels as it
+// does on the loading thread alone.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ResourceLoadPoolMatchesSerial)
+{
+	TestInitGLInterface();
+
+	std::string aDir = TestGetTempDir() + "poolsmall/";
+	SEXY_CHECK(TestWriteFile(aDir + "resources.xml", TestMakeImageGroup(aDir, "Pool", 24, 64)));
+
+	ResourceManager aManager(gSexyAppBase);
+	SEXY_CHECK(aManager.ParseResourcesFile(aDir + "resources.xml"));
+
+	std::vector<uint64_t> aWant;
+	SEXY_CHECK(TestLoadImageGroup(aManager, "Pool", 1, aWant) >= 0);
+	SEXY_CHECK(aWant.size() == 24);
+
+	for (int i = 1; i < 4; i++)
+	{
+		std::vector<uint64_t> aHashes;
+		SEXY_CHECK(TestLoadImageGroup(aManager, "Pool", THREAD_COUNTS[i], aHashes) >= 0);
+		SEXY_CHECK(aManager.GetLoadThreads() == THREAD_COUNTS[i]);
+		SEXY_CHECK(aHashes == aWant);
+	}
+
+	TestDeleteImages(aManager);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Loading a group of 64 512x512 images on 1, 2, 4 and 8 threads.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(ResourceLoadPoolThreads)
+{
+	const int NUM_PASSES = 3;
+
+	TestInitGLInterface();
+
+	std::string aDir = TestGetTempDir() + "poolbench/";
+	SEXY_CHECK(TestWriteFile(aDir + "resources.xml", TestMakeImageGroup(aDir, "Pool", 64, 512)));
+
+	ResourceManager aManager(gSexyAppBase);
+	SEXY_CHECK(aManager.ParseResourcesFile(aDir + "resources.xml"));
+
+	std::vector<uint64_t> aWant;
+	for (int i = 0; i < 4; i++)
+	{
+		double aBest = 0;
+		bool isSame = true;
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			std::vector<uint64_t> aHashes;
+			double aTime = TestLoadImageGroup(aManager, "Pool", THREAD_COUNTS[i], aHashes);
+			SEXY_CHECK(aTime >= 0);
+			if (aPass == 0 || aTime < aBest)
+				aBest = aTime;
+
+			if (aWant.empty())
+				aWant = aHashes;
+			isSame &= aHashes == aWant;
+		}
+
+		printf("  %d thread%s %7.1f ms, %s\n", THREAD_COUNTS[i], THREAD_COUNTS[i] == 1 ? " " : "s", aBest,
+			isSame ? "same pixels as 1 thread" : "PIXELS DIFFER");
+		SEXY_CHECK(isSame);
+	}
+
+	TestDeleteImages(aManager);
+}
@@ -0,0 +1,244 @@
+#include "TestFiles.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Every group in order with every field of its resources, so a manifest read
+// one way can be compared with the same one read another.  Fields that only
+// mean something for animated images or system fonts are left out for the
+// rest, since the XML parse leaves them as they were.
+///////////////////////////////////////////////////////////////////////////////
+static std::string DumpResources(ResourceManager& theManager)
+{
+	std::string aDump;
+	for (ResourceManager::ResGroupMap::iterator aGroupItr = theManager.mResGroupMap.begin(); aGroupItr != theManager.mResGroupMap.end(); ++aGroupItr)
+	{
+		aDump += "group " + aGroupItr->first + "\n";
+
+		ResourceManager::ResList& aList = aGroupItr->second;
+		for (ResourceManager::ResList::iterator aResItr = aList.begin(); aResItr != aList.end(); ++aResItr)
+		{
+			ResourceManager::BaseRes* aRes = *aResItr;
+			aDump += StrFormat("%d %s %s %s %d", aRes->mType, aRes->mId.c_str(), aRes->mPath.c_str(), aRes->mResGroup.c_str(), aRes->mFromProgram);
+			for (XMLParamMap::iterator anItr = aRes->mXMLAttributes.begin(); anItr != aRes->mXMLAttributes.end(); ++anItr)
+				aDump += " " + anItr->first + "=" + anItr->second;
+
+			if (aRes->mType == ResourceManager::ResType_Image)
+			{
+				ResourceManager::ImageRes* anImageRes = (ResourceManager::ImageRes*)aRes;
+				const AnimInfo& anAnimInfo = anImageRes->mAnimInfo;
+				aDump += StrFormat(" | %d%d%d%d%d%d%d %s %s %s %lx %d %d %d %d %d", anImageRes->mPalletize, anImageRes->mA4R4G4B4, anImageRes->mDDSurface,
+					anImageRes->mPurgeBits, anImageRes->mA8R8G8B8, anImageRes->mMinimizeSubdivisions, anImageRes->mAutoFindAlpha,
+					anImageRes->mAlphaImage.c_str(), anImageRes->mAlphaGridImage.c_str(), anImageRes->mVariant.c_str(), (unsigned long)anImageRes->mAlphaColor,
+					anImageRes->mRows, anImageRes->mCols, anAnimInfo.mAnimType, anAnimInfo.mFrameDelay, anAnimInfo.mNumCels);
+
+				if (anAnimInfo.mAnimType != AnimType_None)
+				{
+					aDump += StrFormat(" %d", anAnimInfo.mTotalAnimTime);
+					for (int i = 0; i < (int)anAnimInfo.mPerFrameDelay.size(); i++)
+						aDump += StrFormat(",%d", anAnimInfo.mPerFrameDelay[i]);
+					for (int i = 0; i < (int)anAnimInfo.mFrameMap.size(); i++)
+						aDump += StrFormat(";%d", anAnimInfo.mFrameMap[i]);
+				}
+			}
+			else if (aRes->mType == ResourceManager::ResType_Sound)
+			{
+				ResourceManager::SoundRes* aSoundRes = (ResourceManager::SoundRes*)aRes;
+				aDump += StrFormat(" | %g %d %d %d", aSoundRes->mVolume, aSoundRes->mPanning, aSoundRes->mStreaming, aSoundRes->mSoundId);
+			}
+			else
+			{
+				ResourceManager::FontRes* aFontRes = (ResourceManager::FontRes*)aRes;
+				aDump += StrFormat(" | %s %s %d", aFontRes->mImagePath.c_str(), aFontRes->mTags.c_str(), aFontRes->mSysFont);
+				if (aFontRes->mSysFont)
+					aDump += StrFormat(" %d%d%d%d %d", aFontRes->mBold, aFontRes->mItalic, aFontRes->mUnderline, aFontRes->mShadow, aFontRes->mSize);
+			}
+
+			aDump += "\n";
+		}
+	}
+
+	return aDump;
+}
+
+static std::string ParseAndDump(const std::string& theFileName, bool useCompiled, bool* theResult = NULL)
+{
+	ResourceManager aManager(gSexyAppBase);
+	aManager.SetUseCompiledResources(useCompiled);
+	bool aResult = aManager.ParseResourcesFile(theFileName);
+	if (theResult != NULL)
+		*theResult = aResult;
+	return DumpResources(aManager);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A compiled manifest loads to exactly what the XML parses to, including
+// when parsed twice and reparsed after an edit.  A compiled manifest older
+// than the XML is passed over for the XML, and a damaged one is rejected
+// rather than loaded in part.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ResourceManagerCompiledMatchesXML)
+{
+	std::string aDir = TestGetTempDir() + "compiled/";
+	std::string aXMLName = aDir + "resources.xml";
+	std::string aBinName = ResourceManager::GetCompiledResourcesName(aXMLName);
+	std::string aManifest = TestMakeManifest(2000);
+	SEXY_CHECK(TestWriteFile(aXMLName, aManifest));
+
+	bool aResult = false;
+	std::string aWant = ParseAndDump(aXMLName, false, &aResult);
+	SEXY_CHECK(aResult);
+
+	{
+		ResourceManager aCompiler(gSexyAppBase);
+		SEXY_CHECK(aCompiler.CompileResourcesFile(aXMLName));
+		SEXY_CHECK(aCompiler.mResGroupMap.empty() && aCompiler.mImageMap.empty());
+	}
+	SEXY_CHECK(p_fexists(aBinName.c_str()));
+
+	// Read from the compiled manifest, which with the XML out of the way is
+	// the only way it could load
+	SEXY_CHECK(ParseAndDump(aXMLName, true, &aResult) == aWant && aResult);
+	SEXY_CHECK(rename(aXMLName.c_str(), (aXMLName + ".off").c_str()) == 0);
+	SEXY_CHECK(ParseAndDump(aXMLName, true, &aResult) == aWant && aResult);
+	SEXY_CHECK(rename((aXMLName + ".off").c_str(), aXMLName.c_str()) == 0);
+
+	// Parsing twice fails on the first resource either way, reparsing
+	// changes nothing
+	for (int useCompiled = 0; useCompiled < 2; useCompiled++)
+	{
+		ResourceManager aManager(gSexyAppBase);
+		aManager.SetUseCompiledResources(useCompiled != 0);
+		SEXY_CHECK(aManager.ParseResourcesFile(aXMLName));
+		SEXY_CHECK(aManager.ReparseResourcesFile(aXMLName));
+		SEXY_CHECK(DumpResources(aManager) == aWant);
+		SEXY_CHECK(!aManager.ParseResourcesFile(aXMLName));
+		SEXY_CHECK(aManager.GetErrorText().find("Resource already defined") != std::string::npos);
+	}
+
+	// Reparsing an edited manifest over the original, from the XML and from
+	// the manifest compiled from the edit
+	std::string anEdited = aManifest;
+	anEdited.insert(anEdited.find('"', anEdited.find("path=\"img") + 6), "b");
+	anEdited[anEdited.find("volume=\"0.") + 10] = '1';
+	std::string aReparsed[2];
+	for (int useCompiled = 0; useCompiled < 2; useCompiled++)
+	{
+		SEXY_CHECK(TestWriteFile(aXMLName, aManifest));
+		ResourceManager aManager(gSexyAppBase);
+		SEXY_CHECK(aManager.ParseResourcesFile(aXMLName));
+
+		SEXY_CHECK(TestWriteFile(aXMLName, anEdited));
+		if (useCompiled)
+		{
+			SEXY_CHECK(aManager.CompileResourcesFile(aXMLName));
+			aManager.SetUseCompiledResources(true);
+		}
+		SEXY_CHECK(aManager.ReparseResourcesFile(aXMLName));
+		aReparsed[useCompiled] = DumpResources(aManager);
+	}
+	SEXY_CHECK(aReparsed[0] == aReparsed[1]);
+	SEXY_CHECK(aReparsed[0] != aWant && aReparsed[0].find(" 0.1 ") != std::string::npos);
+	SEXY_CHECK(aReparsed[0].size() == aWant.size() + 2);	// the b in the path and its attribute, and no resource twice
+
+	// Out of date: the XML has moved on since it was compiled
+	std::string aWantEdited = ParseAndDump(aXMLName, false);
+	SEXY_CHECK(TestWriteFile(aXMLName, aManifest));
+	SEXY_CHECK(ParseAndDump(aXMLName, true, &aResult) == aWant && aResult);
+	SEXY_CHECK(TestWriteFile(aXMLName, anEdited));
+	SEXY_CHECK(ParseAndDump(aXMLName, true, &aResult) == aWantEdited && aResult);
+
+	// Truncated anywhere, or with a bad header, it's rejected whether or not
+	// there's XML to fall back on
+	std::vector<uint8_t> aCompiled;
+	{
+		FILE* aFP = fopen(aBinName.c_str(), "rb");
+		SEXY_CHECK(aFP != NULL);
+		if (aFP != NULL)
+		{
+			uint8_t aBuffer[65536];
+			size_t aCount;
+			while ((aCount = fread(aBuffer, 1, sizeof(aBuffer), aFP)) > 0)
+				aCompiled.insert(aCompiled.end(), aBuffer, aBuffer + aCount);
+			fclose(aFP);
+		}
+	}
+
+	remove(aXMLName.c_str());
+	int aNumLoaded = 0;
+	for (size_t aCut = 0; aCut < aCompiled.size(); aCut += (aCut < 64) ? 1 : 997)
+	{
+		SEXY_CHECK(TestWriteFile(aBinName, aCompiled.empty() ? NULL : &aCompiled[0], aCut));
+		ResourceManager aManager(gSexyAppBase);
+		aManager.SetUseCompiledResources(true);
+		aNumLoaded += aManager.ParseResourcesFile(aXMLName);
+	}
+	SEXY_CHECK(aNumLoaded == 0);
+
+	aCompiled[4] ^= 1;	// the version
+	SEXY_CHECK(TestWriteFile(aBinName, &aCompiled[0], aCompiled.size()));
+	SEXY_CHECK(TestWriteFile(aXMLName, anEdited));
+	SEXY_CHECK(ParseAndDump(aXMLName, true, &aResult) == aWantEdited && aResult);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parsing a manifest of 20000 resources from XML and compiled.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(ResourceManagerCompiledParse)
+{
+	const int NUM_PASSES = 5;
+
+	std::string aXMLName = TestGetTempDir() + "compiledbench/resources.xml";
+	std::string aBinName = ResourceManager::GetCompiledResourcesName(aXMLName);
+	SEXY_CHECK(TestWriteFile(aXMLName, TestMakeManifest(20000)));
+
+	PerfTimer aTimer;
+	aTimer.Start();
+	{
+		ResourceManager aCompiler(gSexyAppBase);
+		SEXY_CHECK(aCompiler.CompileResourcesFile(aXMLName));
+	}
+	double aCompileTime = aTimer.GetDuration();
+
+	double aTimes[2];
+	std::string aDumps[2];
+	for (int useCompiled = 0; useCompiled < 2; useCompiled++)
+	{
+		aTimes[useCompiled] = 0;
+		for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+		{
+			ResourceManager aManager(gSexyAppBase);
+			aManager.SetUseCompiledResources(useCompiled != 0);
+
+			aTimer.Start();
+			SEXY_CHECK(aManager.ParseResourcesFile(aXMLName));
+			double aTime = aTimer.GetDuration();
+			if (aPass == 0 || aTime < aTimes[useCompiled])
+				aTimes[useCompiled] = aTime;
+
+			if (aPass == 0)
+				aDumps[useCompiled] = DumpResources(aManager);
+		}
+	}
+
+	int64_t aXMLSize = 0;
+	int64_t aBinSize = 0;
+	PFILE* aFP = p_fopen(aXMLName.c_str(), "rb");
+	if (aFP != NULL)
+	{
+		p_fseek(aFP, 0, SEEK_END);
+		aXMLSize = p_ftell(aFP);
+		p_fclose(aFP);
+	}
+	aFP = p_fopen(aBinName.c_str(), "rb");
+	if (aFP != NULL)
+	{
+		p_fseek(aFP, 0, SEEK_END);
+		aBinSize = p_ftell(aFP);
+		p_fclose(aFP);
+	}
+
+	printf("  XML      %7.1f ms (%lld bytes)\n", aTimes[0], (long long)aXMLSize);
+	printf("  compiled %7.1f ms (%lld bytes), %.1fx faster, compiling took %.1f ms\n", aTimes[1], (long long)aBinSize, aTimes[0] / aTimes[1], aCompileTime);
+	SEXY_CHECK(aDumps[0] == aDumps[1]);
+}
@@ -0,0 +1,304 @@
+#include "TestFiles.h"
+#include "sound/SDLMusicStream.h"
+#include "sound/SDLSoundManager.h"
+#include "ogg/ivorbisfile.h"
+#include "Tools/PakBuilder/PakBuild.h"
+
+#include <SDL2/SDL_mixer_ext.h>
+
+using namespace Sexy;
+
+static const int PULL_BYTES = 4096;		// what the mixer asks for a callback at a time
+static const int MAX_OPEN_STALLS = 30;	// opening a chained track bisects each of its three links
+static const int MAX_SEEK_STALLS = 4;
+
+///////////////////////////////////////////////////////////////////////////////
+// The track on disk through stdio, and the one in the pak through the
+// stream's SDL_RWops, decoded by the same Tremor SDL_mixer's own decoder
+// would be fed from.
+///////////////////////////////////////////////////////////////////////////////
+static size_t FileRead(void* thePtr, size_t theSize, size_t theCount, void* theFile)
+{
+	return fread(thePtr, theSize, theCount, (FILE*) theFile);
+}
+
+static int FileSeek(void* theFile, ogg_int64_t theOffset, int theOrigin)
+{
+	return fseek((FILE*) theFile, (long) theOffset, theOrigin);
+}
+
+static int FileClose(void* theFile)
+{
+	return fclose((FILE*) theFile);
+}
+
+static long FileTell(void* theFile)
+{
+	return ftell((FILE*) theFile);
+}
+
+static size_t RWRead(void* thePtr, size_t theSize, size_t theCount, void* theRW)
+{
+	return SDL_RWread((SDL_RWops*) theRW, thePtr, theSize, theCount);
+}
+
+static int RWSeek(void* theRW, ogg_int64_t theOffset, int theOrigin)
+{
+	return (SDL_RWseek((SDL_RWops*) theRW, theOffset, theOrigin) < 0) ? -1 : 0;
+}
+
+static int RWClose(void* theRW)
+{
+	return SDL_RWclose((SDL_RWops*) theRW);
+}
+
+static long RWTell(void* theRW)
+{
+	return (long) SDL_RWtell((SDL_RWops*) theRW);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fills theBuffer the way the mixer does, going back to the start when the
+// track runs out.
+///////////////////////////////////////////////////////////////////////////////
+static bool PullMusic(OggVorbis_File* theFile, char* theBuffer, int* theNumLoops)
+{
+	int aFilled = 0;
+	while (aFilled < PULL_BYTES)
+	{
+		int aBitstream;
+		long aBytes = ov_read(theFile, theBuffer + aFilled, PULL_BYTES - aFilled, &aBitstream);
+		if (aBytes == 0)
+		{
+			if (ov_pcm_seek(theFile, 0) != 0)
+				return false;
+			(*theNumLoops)++;
+		}
+		else if (aBytes < 0)
+			return false;
+		else
+			aFilled += aBytes;
+	}
+
+	return true;
+}
+
+static bool CheckStreamMemory(SDLMusicStream* theStream)
+{
+	return (theStream->mHead.capacity() == SDLMusicStream::HEAD_SIZE) && (theStream->mRing.capacity() == SDLMusicStream::RING_SIZE) &&
+		(theStream->mChunk.capacity() == SDLMusicStream::CHUNK_SIZE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Renumbers every page of theClip as logical stream theSerial, so copies of
+// it can be chained, and fixes up each page's CRC.
+///////////////////////////////////////////////////////////////////////////////
+static void SetOggSerial(std::string& theClip, uint32_t theSerial)
+{
+	size_t aPos = 0;
+	while ((aPos + 27 <= theClip.size()) && (theClip.compare(aPos, 4, "OggS") == 0))
+	{
+		int aNumSegments = (uint8_t) theClip[aPos + 26];
+		size_t aSize = 27 + aNumSegments;
+		for (int i = 0; i < aNumSegments; i++)
+			aSize += (uint8_t) theClip[aPos + 27 + i];
+		if (aPos + aSize > theClip.size())
+			break;
+
+		for (int i = 0; i < 4; i++)
+		{
+			theClip[aPos + 14 + i] = (char) (theSerial >> (i * 8));
+			theClip[aPos + 22 + i] = 0;
+		}
+
+		uint32_t aCRC = 0;
+		for (size_t i = 0; i < aSize; i++)
+		{
+			aCRC ^= (uint32_t) (uint8_t) theClip[aPos + i] << 24;
+			for (int aBit = 0; aBit < 8; aBit++)
+				aCRC = (aCRC & 0x80000000) ? (aCRC << 1) ^ 0x04C11DB7 : (aCRC << 1);
+		}
+		for (int i = 0; i < 4; i++)
+			theClip[aPos + 22 + i] = (char) (aCRC >> (i * 8));
+
+		aPos += aSize;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Packs a six minute track, three copies of ambient_loop chained, into a
+// compressed pak as music/long.ogg.  Returns false if the clip is missing.
+///////////////////////////////////////////////////////////////////////////////
+static bool WriteLongTrack(std::string* theDiskName)
+{
+	FILE* aFP = fopen((TestGetDataDir() + "ambient_loop.ogg").c_str(), "rb");
+	if (aFP == NULL)
+		return false;
+
+	std::string aClip;
+	char aBuffer[65536];
+	size_t aCount;
+	while ((aCount = fread(aBuffer, 1, sizeof(aBuffer), aFP)) > 0)
+		aClip.append(aBuffer, aCount);
+	fclose(aFP);
+
+	std::string aTrack;
+	for (int i = 0; i < 3; i++)
+	{
+		SetOggSerial(aClip, 1000 + i);
+		aTrack += aClip;
+	}
+
+	std::string aDir = TestGetTempDir() + "musictree/";
+	*theDiskName = aDir + "music/long.ogg";
+	SEXY_CHECK(TestWriteFile(*theDiskName, aTrack));
+
+	PakBuildOptions anOptions;
+	anOptions.mBlockSize = 16 * 1024;
+	anOptions.mMinSavingsPct = 0;
+	SEXY_CHECK(BuildPak(TestGetTempDir() + "music.pak", aDir, anOptions).mError == 0);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decoding a long track out of a compressed pak through the stream, through
+// its end and around and with seeks near and far, gives the same samples
+// byte for byte as decoding it from disk.  Only seeks outside what's
+// buffered wait on the worker, and the stream never holds more than its
+// head and ring.  Then the same track plays on SDL's dummy audio driver.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SDLMusicStreamPlaysFromPak)
+{
+	// Where to seek to (or -1 to play on) and how long to play for, in ms
+	static const int STEPS[][2] = { { -1, 20000 }, { 330000, 40000 }, { 9000, 3000 }, { 200000, 2000 }, { 50000, 2000 },
+		{ 300000, 2000 }, { 1000, 2000 }, { 120000, 2000 }, { 359000, 3000 } };
+	const int NUM_STEPS = sizeof(STEPS) / sizeof(STEPS[0]);
+
+	std::string aDiskName;
+	if (!WriteLongTrack(&aDiskName))
+	{
+		printf("  no %sambient_loop.ogg, skipped\n", TestGetDataDir().c_str());
+		return;
+	}
+
+	PakInterface aPak;
+	aPak.mMapPakFiles = true;
+	SEXY_CHECK(aPak.AddPakFile(TestGetTempDir() + "music.pak"));
+	TestPakScope aScope(&aPak);
+
+	SDL_RWops* aRW = SDLMusicStream::CreateRW("music/long.ogg");
+	SEXY_CHECK(aRW != NULL);
+	if (aRW == NULL)
+		return;
+	SDLMusicStream* aStream = (SDLMusicStream*) aRW->hidden.unknown.data1;
+	SEXY_CHECK(aStream->mThread != NULL && CheckStreamMemory(aStream));
+
+	OggVorbis_File aWantFile;
+	OggVorbis_File aFile;
+	ov_callbacks aFileCallbacks = { FileRead, FileSeek, FileClose, FileTell };
+	ov_callbacks aRWCallbacks = { RWRead, RWSeek, RWClose, RWTell };
+	SEXY_CHECK(ov_open_callbacks(fopen(aDiskName.c_str(), "rb"), &aWantFile, NULL, 0, aFileCallbacks) == 0);
+	SEXY_CHECK(ov_open_callbacks(aRW, &aFile, NULL, 0, aRWCallbacks) == 0);
+
+	vorbis_info* anInfo = ov_info(&aFile, -1);
+	int aPullMs = PULL_BYTES * 1000 / (anInfo->rate * anInfo->channels * 2);
+	SEXY_CHECK(ov_time_total(&aFile, -1) == ov_time_total(&aWantFile, -1) && ov_time_total(&aFile, -1) > 359000);
+
+	int aStallsAtOpen = aStream->mStalls;
+	int aSeekStalls = 0;
+	int aPlayStalls = 0;
+	int aNumLoops = 0;
+	int aWantNumLoops = 0;
+	int aNumDiffering = 0;
+	bool isMemoryFixed = true;
+	char aBuffer[PULL_BYTES];
+	char aWantBuffer[PULL_BYTES];
+	for (int aStep = 0; aStep < NUM_STEPS; aStep++)
+	{
+		int aStalls = aStream->mStalls;
+		if (STEPS[aStep][0] >= 0)
+		{
+			SEXY_CHECK(ov_time_seek(&aWantFile, STEPS[aStep][0]) == 0);
+			SEXY_CHECK(ov_time_seek(&aFile, STEPS[aStep][0]) == 0);
+		}
+
+		for (int aMs = 0; aMs < STEPS[aStep][1]; aMs += aPullMs)
+		{
+			SEXY_CHECK(PullMusic(&aWantFile, aWantBuffer, &aWantNumLoops));
+			SEXY_CHECK(PullMusic(&aFile, aBuffer, &aNumLoops));
+			if (memcmp(aBuffer, aWantBuffer, PULL_BYTES) != 0)
+				aNumDiffering++;
+			isMemoryFixed &= CheckStreamMemory(aStream);
+
+			// Whatever the seek cost, playing on from it never waits
+			if (aMs == 0)
+			{
+				aSeekStalls += aStream->mStalls - aStalls;
+				aStalls = aStream->mStalls;
+			}
+		}
+
+		aPlayStalls += aStream->mStalls - aStalls;
+	}
+
+	printf("  %d loops, %d stalls opening, %d seeking, %d playing\n", aNumLoops, aStallsAtOpen, aSeekStalls, aPlayStalls);
+	SEXY_CHECK(aNumDiffering == 0);
+	SEXY_CHECK(aNumLoops == 2 && aWantNumLoops == 2);
+	SEXY_CHECK(isMemoryFixed);
+	SEXY_CHECK(aPlayStalls == 0);
+	SEXY_CHECK(aStallsAtOpen <= MAX_OPEN_STALLS && aSeekStalls <= MAX_SEEK_STALLS * NUM_STEPS);
+
+	ov_clear(&aWantFile);
+	ov_clear(&aFile);
+
+	// The same track played by SDL_mixer from the pak in real time, seeking to
+	// a second before the end so it loops, then into the middle
+	SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+	SDLSoundManager* aManager = new SDLSoundManager();
+	if (!aManager->Initialized())
+	{
+		printf("  no dummy audio driver, playback skipped\n");
+		delete aManager;
+		return;
+	}
+
+	aRW = SDLMusicStream::CreateRW("music/long.ogg");
+	SEXY_CHECK(aRW != NULL);
+	aStream = (SDLMusicStream*) aRW->hidden.unknown.data1;
+	Mix_Music* aMusic = Mix_LoadMUS_RW(aRW, 1);
+	SEXY_CHECK(aMusic != NULL);
+	if (aMusic != NULL)
+	{
+		double aDuration = Mix_MusicDuration(aMusic);
+		SEXY_CHECK(Mix_PlayMusicStream(aMusic, -1) == 0);
+		SEXY_CHECK(Mix_SetMusicPositionStream(aMusic, aDuration - 1.0) == 0);
+
+		bool isPlaying = true;
+		Uint32 aStartTime = SDL_GetTicks();
+		while (SDL_GetTicks() - aStartTime < 2500)
+		{
+			isPlaying &= Mix_PlayingMusicStream(aMusic) != 0;
+			isMemoryFixed &= CheckStreamMemory(aStream);
+			SDL_Delay(10);
+		}
+		SEXY_CHECK(Mix_GetMusicPosition(aMusic) < aDuration - 1.0);
+
+		SEXY_CHECK(Mix_SetMusicPositionStream(aMusic, aDuration / 2) == 0);
+		aStartTime = SDL_GetTicks();
+		while (SDL_GetTicks() - aStartTime < 1000)
+		{
+			isPlaying &= Mix_PlayingMusicStream(aMusic) != 0;
+			isMemoryFixed &= CheckStreamMemory(aStream);
+			SDL_Delay(10);
+		}
+
+		printf("  played 3.5 s on the dummy driver with %d stalls\n", aStream->mStalls);
+		SEXY_CHECK(isPlaying && isMemoryFixed);
+		SEXY_CHECK(aStream->mStalls <= MAX_OPEN_STALLS + MAX_SEEK_STALLS * 2);
+
+		Mix_HaltMusicStream(aMusic);
+		Mix_FreeMusic(aMusic);
+	}
+
+	delete aManager;
+}
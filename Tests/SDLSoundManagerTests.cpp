@@ -0,0 +1,177 @@
+#include "TestHarness.h"
+#include "sound/SDLSoundManager.h"
+#include "sound/SoundInstance.h"
+#include "sound/SoundMixer.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Opens up the channel allocator, and plays on SDL's dummy audio driver so
+// sounds are mixed and finish in real time without a sound card.
+///////////////////////////////////////////////////////////////////////////////
+class TestSoundManager : public SDLSoundManager
+{
+public:
+	using SDLSoundManager::AllocChannel;
+	using SDLSoundManager::StealChannel;
+
+	static TestSoundManager* Create()
+	{
+		SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+		return new TestSoundManager();
+	}
+
+	int						GetNumFreeChannels() { return mNumFreeChannels; }
+	int						GetNumVoicesPlaying() { return mMixer->GetNumPlaying(); }
+
+	// A quiet sound in the mixer's format, theMs long
+	void					AddSound(unsigned int theSfxID, int theMs, int thePriority)
+	{
+		int aSize = mMixerFreq * theMs / 1000 * mMixerChannels * sizeof(int16_t);
+
+		Mix_Chunk* aChunk = (Mix_Chunk*) SDL_malloc(sizeof(Mix_Chunk));
+		aChunk->abuf = (Uint8*) SDL_malloc(aSize);
+		for (int i = 0; i < aSize / 2; i++)
+			((int16_t*) aChunk->abuf)[i] = (int16_t) ((i & 64) ? 100 : -100);
+		aChunk->alen = aSize;
+		aChunk->allocated = 1;
+		aChunk->volume = 128;
+
+		SDLDecodedSound* aSound = new SDLDecodedSound;
+		aSound->mChunk = aChunk;
+		aSound->mStreamed = NULL;
+		LoadDecodedSound(theSfxID, "", aSound);
+		SetBasePriority(theSfxID, thePriority);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Five one-shots a millisecond for two seconds, more than there are channels
+// to play them.  Finished ones are reclaimed and the oldest are stolen, so
+// none are dropped, and the pool is never added to.  The held sound is never
+// stolen.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SDLSoundManagerOneShots)
+{
+	TestSoundManager* aManager = TestSoundManager::Create();
+	if (!aManager->Initialized())
+	{
+		printf("  no dummy audio driver, skipped\n");
+		delete aManager;
+		return;
+	}
+
+	aManager->AddSound(0, 10, 0);
+	aManager->AddSound(1, 100, 0);
+	aManager->AddSound(2, 1000, 0);
+
+	SoundInstance* aHeld = aManager->GetSoundInstance(2);
+	SEXY_CHECK(aHeld != NULL && aHeld->Play(true, false));
+
+	int aNumPlays = 0;
+	int aNumPlayed = 0;
+	int aMostVoices = 0;
+	Uint32 aStartTime = SDL_GetTicks();
+	while (SDL_GetTicks() - aStartTime < 2000)
+	{
+		for (int i = 0; i < 5; i++, aNumPlays++)
+		{
+			SoundInstance* anInstance = aManager->GetSoundInstance(aNumPlays % 3 == 0 ? 1 : 0);
+			if (anInstance == NULL)
+				continue;
+
+			anInstance->SetPan(aNumPlays % 2000 - 1000);
+			anInstance->AdjustPitch(aNumPlays % 5);
+			if (anInstance->Play(false, true))
+				aNumPlayed++;
+		}
+
+		aMostVoices = std::max(aMostVoices, aManager->GetNumVoicesPlaying());
+		SDL_Delay(1);
+	}
+
+	const SDLSoundStats& aStats = aManager->GetStats();
+	printf("  %d requests: %d reclaimed, %d stolen, %d dropped, %d allocations, at most %d voices\n",
+		aStats.mRequests, aStats.mReclaimed, aStats.mStolen, aStats.mDropped, aStats.mAllocations, aMostVoices);
+
+	SEXY_CHECK(aNumPlays >= 1000);
+	SEXY_CHECK(aStats.mRequests == aNumPlays + 1);
+	SEXY_CHECK(aNumPlayed == aNumPlays);
+	SEXY_CHECK(aStats.mDropped == 0);
+	SEXY_CHECK(aStats.mReclaimed > 0);
+	SEXY_CHECK(aStats.mAllocations == MAX_CHANNELS);
+	SEXY_CHECK(aMostVoices <= MAX_CHANNELS);
+	SEXY_CHECK(aHeld->IsPlaying());
+
+	aHeld->Release();
+	aManager->ReleaseChannels();
+	SEXY_CHECK(aManager->GetNumFreeChannels() == MAX_CHANNELS);
+	delete aManager;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// With every channel playing a looping sound nothing is reclaimed, so it's up
+// to StealChannel: the oldest auto-released sound of the lowest priority goes,
+// if it's no more important than the new one, and held sounds never go.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SDLSoundManagerStealing)
+{
+	TestSoundManager* aManager = TestSoundManager::Create();
+	if (!aManager->Initialized())
+	{
+		printf("  no dummy audio driver, skipped\n");
+		delete aManager;
+		return;
+	}
+
+	aManager->AddSound(0, 500, 0);
+	aManager->AddSound(1, 500, 1);
+	aManager->AddSound(2, 500, 2);
+
+	SoundInstance* aFirst = NULL;
+	SoundInstance* aSecond = NULL;
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		SoundInstance* anInstance = aManager->GetSoundInstance(1);
+		SEXY_CHECK(anInstance != NULL && anInstance->Play(true, true));
+		if (i == 0)
+			aFirst = anInstance;
+		else if (i == 1)
+			aSecond = anInstance;
+	}
+	SEXY_CHECK(aManager->GetNumFreeChannels() == 0);
+
+	// Less important than everything playing
+	SEXY_CHECK(aManager->GetSoundInstance(0) == NULL);
+	SEXY_CHECK(!aManager->StealChannel(0));
+	SEXY_CHECK(aManager->AllocChannel(0) == -1);
+	SEXY_CHECK(aManager->GetStats().mDropped == 1);
+
+	// As important, so the oldest makes way, and its pooled instance comes back
+	SEXY_CHECK(aManager->GetSoundInstance(1) == aFirst);
+	SEXY_CHECK(aManager->StealChannel(2));
+	SEXY_CHECK(aManager->GetNumFreeChannels() == 1);
+	SEXY_CHECK(aManager->GetSoundInstance(2) == aSecond);
+	SEXY_CHECK(aManager->GetStats().mStolen == 1);
+	SEXY_CHECK(aManager->GetStats().mDropped == 1);
+
+	// Held sounds are never stolen, whatever comes along
+	aManager->ReleaseChannels();
+	SEXY_CHECK(aManager->GetNumFreeChannels() == MAX_CHANNELS);
+	for (int i = 0; i < MAX_CHANNELS; i++)
+	{
+		SoundInstance* anInstance = aManager->GetSoundInstance(0);
+		SEXY_CHECK(anInstance != NULL && anInstance->Play(true, false));
+	}
+	SEXY_CHECK(!aManager->StealChannel(100));
+	SEXY_CHECK(aManager->GetSoundInstance(2) == NULL);
+
+	const SDLSoundStats& aStats = aManager->GetStats();
+	SEXY_CHECK(aStats.mRequests == MAX_CHANNELS * 2 + 4);
+	SEXY_CHECK(aStats.mStolen == 1);
+	SEXY_CHECK(aStats.mDropped == 2);
+	SEXY_CHECK(aStats.mAllocations == MAX_CHANNELS);
+
+	aManager->ReleaseChannels();
+	delete aManager;
+}
@@ -0,0 +1,304 @@
+#include "TestFiles.h"
+#include "graphics/SWTri.h"
+#include "graphics/MemoryImage.h"
+#include "graphics/Graphics.h"
+#include "graphics/TriVertex.h"
+#include "misc/MTRand.h"
+#include "misc/SexyMatrix.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void FillRandom(MemoryImage* theImage, MTRand& theRand, bool opaque)
+{
+	uint32_t* aBits = theImage->GetBits();
+	for (int i = 0; i < theImage->mWidth * theImage->mHeight; i++)
+	{
+		aBits[i] = (uint32_t)theRand.Next();
+		if (opaque)
+			aBits[i] |= 0xFF000000;
+	}
+	theImage->BitsChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Triangles of every size scattered over (and a little past) the target, half
+// of them with vertex colors.
+///////////////////////////////////////////////////////////////////////////////
+static void MakeTriangles(std::vector<TriVertex>& theVertices, int theNumTriangles, int theWidth, int theHeight, MTRand& theRand)
+{
+	theVertices.resize(theNumTriangles * 3);
+	for (int i = 0; i < theNumTriangles; i++)
+	{
+		unsigned long aSize = 4 + theRand.Next(120UL);
+		float aX = theRand.Next(theWidth + 40UL) - 20.0f;
+		float aY = theRand.Next(theHeight + 40UL) - 20.0f;
+		bool colored = (i & 1) != 0;
+		for (int j = 0; j < 3; j++)
+		{
+			TriVertex& aVertex = theVertices[i * 3 + j];
+			aVertex.x = aX + theRand.Next(aSize) + theRand.Next(256UL) / 256.0f;
+			aVertex.y = aY + theRand.Next(aSize) + theRand.Next(256UL) / 256.0f;
+			aVertex.u = theRand.Next(1000UL) / 1000.0f;
+			aVertex.v = theRand.Next(1000UL) / 1000.0f;
+			aVertex.color = colored ? ((uint32_t)theRand.Next() | 0x40000000) : 0;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void DrawTriangles(MemoryImage* theImage, MemoryImage* theTexture, const std::vector<TriVertex>& theVertices, const Color& theColor, int theDrawMode)
+{
+	const TriVertex (*aTris)[3] = (const TriVertex (*)[3])&theVertices[0];
+	theImage->BltTrianglesTex(theTexture, aTris, (int)theVertices.size() / 3, Rect(0, 0, theImage->mWidth, theImage->mHeight), theColor, theDrawMode, 0, 0, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draws on a copy of theStart in thePixelFormat and returns the surface.
+// 8888 and 888 are MemoryImage targets, 565 and 555 are the 16 bit surfaces
+// the helper draws on for a locked display surface.
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<uint8_t> DrawOnTarget(int thePixelFormat, const MemoryImage& theStart, MemoryImage* theTexture, const std::vector<TriVertex>& theVertices, const Color& theColor, int theDrawMode)
+{
+	MemoryImage anImage(theStart);
+	int aNumPixels = anImage.mWidth * anImage.mHeight;
+
+	if (thePixelFormat == 0x8888 || thePixelFormat == 0x888)
+	{
+		anImage.mForcedMode = thePixelFormat == 0x888;
+		anImage.mHasAlpha = false;
+		anImage.mHasTrans = false;
+		DrawTriangles(&anImage, theTexture, theVertices, theColor, theDrawMode);
+
+		const uint8_t* aBits = (const uint8_t*)anImage.GetBits();
+		return std::vector<uint8_t>(aBits, aBits + aNumPixels * 4);
+	}
+
+	std::vector<uint16_t> aSurface(aNumPixels);
+	const uint32_t* aBits = anImage.GetBits();
+	for (int i = 0; i < aNumPixels; i++)
+	{
+		uint32_t aPixel = aBits[i];
+		if (thePixelFormat == 0x565)
+			aSurface[i] = (uint16_t)(((aPixel >> 8) & 0xF800) | ((aPixel >> 5) & 0x07E0) | ((aPixel >> 3) & 0x001F));
+		else
+			aSurface[i] = (uint16_t)(((aPixel >> 9) & 0x7C00) | ((aPixel >> 6) & 0x03E0) | ((aPixel >> 3) & 0x001F));
+	}
+
+	const TriVertex (*aTris)[3] = (const TriVertex (*)[3])&theVertices[0];
+	anImage.BltTrianglesTexHelper(theTexture, aTris, (int)theVertices.size() / 3, Rect(0, 0, anImage.mWidth, anImage.mHeight), theColor, theDrawMode, &aSurface[0], anImage.mWidth * 2, thePixelFormat, 0, 0, true);
+
+	const uint8_t* aSurfaceBytes = (const uint8_t*)&aSurface[0];
+	return std::vector<uint8_t>(aSurfaceBytes, aSurfaceBytes + aNumPixels * 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Banding only changes which thread draws a row, so every thread count has to
+// give the serial result exactly, on every target format.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SWTriBandsMatchSerial)
+{
+	static const Color aColors[] = { Color::White, Color(255, 128, 0, 160) };
+	static const int aDrawModes[] = { Graphics::DRAWMODE_NORMAL, Graphics::DRAWMODE_ADDITIVE };
+	static const int aNumThreads[] = { 2, 3, 4, 8 };
+	static const int aPixelFormats[] = { 0x8888, 0x888, 0x565, 0x555 };
+
+	TestInitGLInterface();
+	SWTri_AddAllDrawTriFuncs();
+	MTRand aRand(4321);
+
+	MemoryImage aTexture;
+	aTexture.Create(64, 64);
+	FillRandom(&aTexture, aRand, false);
+
+	MemoryImage aStart;
+	aStart.Create(320, 240);
+	FillRandom(&aStart, aRand, true);
+
+	std::vector<TriVertex> aVertices;
+	MakeTriangles(aVertices, 500, aStart.mWidth, aStart.mHeight, aRand);
+
+	for (int aFormat = 0; aFormat < 4; aFormat++)
+	{
+		for (int aMode = 0; aMode < 2; aMode++)
+		{
+			for (int aColor = 0; aColor < 2; aColor++)
+			{
+				SWHelper::SetRasterThreads(1);
+				std::vector<uint8_t> aWant = DrawOnTarget(aPixelFormats[aFormat], aStart, &aTexture, aVertices, aColors[aColor], aDrawModes[aMode]);
+
+				for (int i = 0; i < 4; i++)
+				{
+					SWHelper::SetRasterThreads(aNumThreads[i]);
+					std::vector<uint8_t> aGot = DrawOnTarget(aPixelFormats[aFormat], aStart, &aTexture, aVertices, aColors[aColor], aDrawModes[aMode]);
+
+					int aNumBad = 0;
+					for (size_t aByte = 0; aByte < aWant.size(); aByte++)
+						aNumBad += aGot[aByte] != aWant[aByte];
+					if (aNumBad != 0)
+						printf("  %x mode %d color %d, %d threads: %d bytes differ\n", aPixelFormats[aFormat], aMode, aColor, aNumThreads[i], aNumBad);
+					SEXY_CHECK(aNumBad == 0);
+				}
+			}
+		}
+	}
+
+	SWHelper::SetRasterThreads(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sprites like the demo's: planet cels spinning in place and beams stretched
+// across the board, drawn through BltMatrix the way DrawImageMatrix does in
+// software.
+///////////////////////////////////////////////////////////////////////////////
+struct SWTriSprite
+{
+	bool					mBeam;
+	float					mX, mY;
+	float					mAngle, mSpin;
+	float					mLength;
+	int						mCel;
+};
+
+static void MakeSprites(std::vector<SWTriSprite>& theSprites, int theNumPlanets, int theNumBeams, int theWidth, int theHeight, MTRand& theRand)
+{
+	theSprites.resize(theNumPlanets + theNumBeams);
+	for (int i = 0; i < (int)theSprites.size(); i++)
+	{
+		SWTriSprite& aSprite = theSprites[i];
+		aSprite.mBeam = i >= theNumPlanets;
+		aSprite.mX = (float)theRand.Next((unsigned long)theWidth);
+		aSprite.mY = (float)theRand.Next((unsigned long)theHeight);
+		aSprite.mAngle = theRand.Next(6283UL) / 1000.0f;
+		aSprite.mSpin = (theRand.Next(200UL) - 100.0f) / 1000.0f;
+		aSprite.mLength = 0.5f + theRand.Next(400UL) / 100.0f;
+		aSprite.mCel = theRand.Next(4UL);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// One frame of theSprites, binned as a whole the way a frame of triangles is.
+///////////////////////////////////////////////////////////////////////////////
+static void DrawSprites(MemoryImage* theImage, MemoryImage* thePlanets, MemoryImage* theBeam, const std::vector<SWTriSprite>& theSprites, int theFrame)
+{
+	Rect aClipRect(0, 0, theImage->mWidth, theImage->mHeight);
+	int aCelWidth = thePlanets->mWidth / 4;
+
+	SWHelper::BeginBinning();
+	for (int i = 0; i < (int)theSprites.size(); i++)
+	{
+		const SWTriSprite& aSprite = theSprites[i];
+		SexyTransform2D aMatrix;
+		if (aSprite.mBeam)
+		{
+			aMatrix.Scale(1.0f, aSprite.mLength);
+			aMatrix.RotateRad((aSprite.mCel & 1) * 1.5707963f);
+			theImage->BltMatrix(theBeam, aSprite.mX, aSprite.mY, aMatrix, aClipRect, Color(255, 255, 255, 192), Graphics::DRAWMODE_ADDITIVE, Rect(0, 0, theBeam->mWidth, theBeam->mHeight), true);
+		}
+		else
+		{
+			aMatrix.RotateRad(aSprite.mAngle + aSprite.mSpin * theFrame);
+			theImage->BltMatrix(thePlanets, aSprite.mX, aSprite.mY, aMatrix, aClipRect, Color::White, Graphics::DRAWMODE_NORMAL, Rect(aSprite.mCel * aCelWidth, 0, aCelWidth, thePlanets->mHeight), true);
+		}
+	}
+	SWHelper::EndBinning();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static void MakeSpriteImages(MemoryImage* thePlanets, MemoryImage* theBeam, MTRand& theRand)
+{
+	thePlanets->Create(4 * 64, 64);
+	FillRandom(thePlanets, theRand, false);
+	theBeam->Create(16, 128);
+	FillRandom(theBeam, theRand, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The benchmark's sprites, binned, come out the same as drawn one by one.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SWTriBandedSpritesMatchSerial)
+{
+	TestInitGLInterface();
+	SWTri_AddAllDrawTriFuncs();
+	MTRand aRand(99);
+
+	MemoryImage aPlanets, aBeam;
+	MakeSpriteImages(&aPlanets, &aBeam, aRand);
+
+	MemoryImage aStart;
+	aStart.Create(640, 480);
+	FillRandom(&aStart, aRand, true);
+
+	std::vector<SWTriSprite> aSprites;
+	MakeSprites(aSprites, 200, 20, aStart.mWidth, aStart.mHeight, aRand);
+
+	SWHelper::SetRasterThreads(1);
+	MemoryImage aWant(aStart);
+	DrawSprites(&aWant, &aPlanets, &aBeam, aSprites, 7);
+
+	// Most of the board is covered, so a sprite going missing would show
+	int aNumDrawn = 0;
+	for (int aPixel = 0; aPixel < aStart.mWidth * aStart.mHeight; aPixel++)
+		aNumDrawn += aWant.GetBits()[aPixel] != aStart.GetBits()[aPixel];
+	SEXY_CHECK(aNumDrawn > aStart.mWidth * aStart.mHeight / 2);
+
+	for (int aNumThreads = 2; aNumThreads <= 8; aNumThreads *= 2)
+	{
+		SWHelper::SetRasterThreads(aNumThreads);
+		MemoryImage aGot(aStart);
+		DrawSprites(&aGot, &aPlanets, &aBeam, aSprites, 7);
+
+		int aNumBad = 0;
+		for (int aPixel = 0; aPixel < aStart.mWidth * aStart.mHeight; aPixel++)
+			aNumBad += aGot.GetBits()[aPixel] != aWant.GetBits()[aPixel];
+		if (aNumBad != 0)
+			printf("  %d threads: %d pixels differ\n", aNumThreads, aNumBad);
+		SEXY_CHECK(aNumBad == 0);
+	}
+
+	SWHelper::SetRasterThreads(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Frames of the demo's rotated planets and stretched beams on its 640x480
+// board, many more of them than the demo has so there's work to spread, at
+// each thread count.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(SWTriThreadScaling)
+{
+	TestInitGLInterface();
+	SWTri_AddAllDrawTriFuncs();
+	MTRand aRand(77);
+
+	MemoryImage aPlanets, aBeam;
+	MakeSpriteImages(&aPlanets, &aBeam, aRand);
+
+	MemoryImage anImage;
+	anImage.Create(640, 480);
+	FillRandom(&anImage, aRand, true);
+
+	std::vector<SWTriSprite> aSprites;
+	MakeSprites(aSprites, 600, 60, anImage.mWidth, anImage.mHeight, aRand);
+
+	double aSerialTime = 0;
+	for (int aNumThreads = 1; aNumThreads <= 8; aNumThreads *= 2)
+	{
+		SWHelper::SetRasterThreads(aNumThreads);
+
+		const int NUM_FRAMES = 20;
+		PerfTimer aTimer;
+		aTimer.Start();
+		for (int aFrame = 0; aFrame < NUM_FRAMES; aFrame++)
+			DrawSprites(&anImage, &aPlanets, &aBeam, aSprites, aFrame);
+		double aTime = aTimer.GetDuration() / NUM_FRAMES;
+
+		if (aNumThreads == 1)
+			aSerialTime = aTime;
+		printf("  %d threads: %.2f ms a frame, %.2fx\n", aNumThreads, aTime, aSerialTime / aTime);
+	}
+
+	SWHelper::SetRasterThreads(1);
+}
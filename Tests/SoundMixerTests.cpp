@@ -0,0 +1,223 @@
+#include "TestHarness.h"
+#include "sound/SoundMixer.h"
+#include "misc/CPUFeatures.h"
+#include "misc/MTRand.h"
+
+#include <math.h>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<int16_t> MakeNoise(int theNumSamples, unsigned long theSeed)
+{
+	MTRand aRand(theSeed);
+	std::vector<int16_t> aSamples(theNumSamples);
+	for (int i = 0; i < theNumSamples; i++)
+		aSamples[i] = (int16_t) aRand.Next();
+	return aSamples;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// What a voice should add, worked out in doubles with plain linear
+// interpolation.
+///////////////////////////////////////////////////////////////////////////////
+static void AddReference(std::vector<double>& theDest, int theDestChannels, const std::vector<int16_t>& theSrc, int theSrcChannels, double theRate, float theGainLeft, float theGainRight, bool looping, int theFrames)
+{
+	int aNumFrames = (int) theSrc.size() / theSrcChannels;
+	uint64_t aPos = 0;
+	uint64_t aStep = (uint64_t) (theRate * 4294967296.0 + 0.5);
+	uint64_t anEnd = (uint64_t) aNumFrames << 32;
+
+	for (int i = 0; i < theFrames; i++, aPos += aStep)
+	{
+		if (aPos >= anEnd)
+		{
+			if (!looping)
+				break;
+			aPos %= anEnd;
+		}
+
+		int aFrame = (int) (aPos >> 32);
+		int aNextFrame = (aFrame + 1 < aNumFrames) ? aFrame + 1 : (looping ? 0 : aFrame);
+		double aFrac = (aPos & 0xFFFFFFFF) / 4294967296.0;
+
+		double aLeft = theSrc[aFrame * theSrcChannels] + (theSrc[aNextFrame * theSrcChannels] - theSrc[aFrame * theSrcChannels]) * aFrac;
+		double aRight = aLeft;
+		if (theSrcChannels == 2)
+			aRight = theSrc[aFrame * 2 + 1] + (theSrc[aNextFrame * 2 + 1] - theSrc[aFrame * 2 + 1]) * aFrac;
+
+		if (theDestChannels == 2)
+		{
+			theDest[i * 2] += aLeft * theGainLeft;
+			theDest[i * 2 + 1] += aRight * theGainRight;
+		}
+		else
+			theDest[i] += (aLeft * theGainLeft + aRight * theGainRight) * 0.5;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Two voices in every layout, at rate 1 and resampled, looping and not, mixed
+// in uneven blocks.  Every SIMD level has to give the same samples, within a
+// sample of the reference.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SoundMixerMatchesReference)
+{
+	static const double aRates[] = { 1.0, 0.75, 1.3, 2.0 };
+	const int NUM_FRAMES = 3000;
+
+	int aMaxDiff = 0;
+	int aNumMismatches = 0;
+	for (int anOutChannels = 1; anOutChannels <= 2; anOutChannels++)
+	{
+		for (int aSrcChannels = 1; aSrcChannels <= 2; aSrcChannels++)
+		{
+			for (int aRate = 0; aRate < 4; aRate++)
+			{
+				for (int looping = 0; looping < 2; looping++)
+				{
+					std::vector<int16_t> aFirst = MakeNoise(1001 * aSrcChannels, 1);
+					std::vector<int16_t> aSecond = MakeNoise(777 * aSrcChannels, 2);
+
+					std::vector<int16_t> aScalarOut;
+					for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+					{
+						SetSIMDLevel((SIMDLevel) aLevel);
+						if (GetSIMDLevel() != aLevel)
+							continue;
+
+						SoundMixer aMixer(44100, anOutChannels, 32);
+						aMixer.SetResampleMode(RESAMPLE_LINEAR);
+						int aFirstVoice = aMixer.Play(&aFirst[0], 1001, aSrcChannels, 0.3f, 0.2f, aRates[aRate], looping != 0);
+						int aSecondVoice = aMixer.Play(&aSecond[0], 777, aSrcChannels, 0.25f, 0.1f, 1.0, looping != 0);
+
+						std::vector<int16_t> anOut(NUM_FRAMES * anOutChannels, 0);
+						for (int aFrame = 0; aFrame < NUM_FRAMES; )
+						{
+							int aCount = std::min(NUM_FRAMES - aFrame, 37 + aFrame % 500);
+							aMixer.Mix(&anOut[aFrame * anOutChannels], aCount);
+							aFrame += aCount;
+						}
+
+						SEXY_CHECK(aMixer.IsPlaying(aFirstVoice) == (looping != 0));
+						SEXY_CHECK(aMixer.IsPlaying(aSecondVoice) == (looping != 0));
+
+						if (aLevel == SIMDLevel_None)
+							aScalarOut = anOut;
+						else if (anOut != aScalarOut)
+							aNumMismatches++;
+					}
+
+					std::vector<double> aWant(NUM_FRAMES * anOutChannels, 0);
+					AddReference(aWant, anOutChannels, aFirst, aSrcChannels, aRates[aRate], 0.3f, 0.2f, looping != 0, NUM_FRAMES);
+					AddReference(aWant, anOutChannels, aSecond, aSrcChannels, 1.0, 0.25f, 0.1f, looping != 0, NUM_FRAMES);
+					for (int i = 0; i < NUM_FRAMES * anOutChannels; i++)
+					{
+						double aClamped = std::max(-32768.0, std::min(32767.0, aWant[i]));
+						aMaxDiff = std::max(aMaxDiff, (int) fabs(aScalarOut[i] - aClamped));
+					}
+				}
+			}
+		}
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+
+	printf("  %d SIMD mismatches, %d most off the reference\n", aNumMismatches, aMaxDiff);
+	SEXY_CHECK(aNumMismatches == 0);
+	SEXY_CHECK(aMaxDiff <= 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Voices sharing one buffer keep their own gains, stale handles do nothing,
+// and the sum saturates on top of what's already in the output.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(SoundMixerVoices)
+{
+	std::vector<int16_t> aSamples(2000, 10000);
+	std::vector<int16_t> anOut;
+
+	SoundMixer aMixer(44100, 2, 4);
+	int aFirstVoice = aMixer.Play(&aSamples[0], 1000, 2, 1.0f, 0.0f, 1.0, true);
+	int aSecondVoice = aMixer.Play(&aSamples[0], 1000, 2, 0.0f, 0.5f, 1.0, true);
+
+	anOut.assign(64, 0);
+	aMixer.Mix(&anOut[0], 32);
+	SEXY_CHECK(anOut[0] == 10000 && anOut[1] == 5000);
+
+	aMixer.SetGain(aSecondVoice, 0.0f, 0.25f);
+	anOut.assign(64, 0);
+	aMixer.Mix(&anOut[0], 32);
+	SEXY_CHECK(anOut[0] == 10000 && anOut[1] == 2500);
+
+	// The freed voice is reused under a new handle
+	aMixer.Stop(aFirstVoice);
+	int aThirdVoice = aMixer.Play(&aSamples[0], 1000, 2, 1.0f, 1.0f, 1.0, false);
+	SEXY_CHECK((aThirdVoice & 0xFF) == (aFirstVoice & 0xFF));
+	SEXY_CHECK(!aMixer.IsPlaying(aFirstVoice));
+	SEXY_CHECK(aMixer.IsPlaying(aThirdVoice));
+	aMixer.Stop(aFirstVoice);
+	SEXY_CHECK(aMixer.IsPlaying(aThirdVoice));
+
+	anOut.assign(64, 30000);
+	aMixer.Mix(&anOut[0], 32);
+	SEXY_CHECK(anOut[0] == 32767);
+
+	aMixer.StopSource(&aSamples[0]);
+	SEXY_CHECK(aMixer.GetNumPlaying() == 0);
+	anOut.assign(64, 123);
+	aMixer.Mix(&anOut[0], 32);
+	SEXY_CHECK(anOut[5] == 123);
+
+	for (int i = 0; i < 4; i++)
+		aMixer.Play(&aSamples[0], 1000, 2, 1.0f, 1.0f, 1.0, false);
+	SEXY_CHECK(aMixer.Play(&aSamples[0], 1000, 2, 1.0f, 1.0f, 1.0, false) == -1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// What a voice costs: 32 looping voices rendered to memory for ten seconds of
+// 44.1kHz stereo, at each SIMD level, source layout and resample mode.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(SoundMixerVoiceCost)
+{
+	static const char* aLevelNames[] = { "scalar", "SSE2", "AVX2", "NEON" };
+	const int NUM_VOICES = 32;
+	const int FREQ = 44100;
+	const int NUM_SECONDS = 10;
+	const int BLOCK_FRAMES = 2048;
+
+	std::vector<int16_t> anOut(BLOCK_FRAMES * 2);
+	for (int aLevel = SIMDLevel_None; aLevel <= SIMDLevel_NEON; aLevel++)
+	{
+		SetSIMDLevel((SIMDLevel) aLevel);
+		if (GetSIMDLevel() != aLevel)
+			continue;
+
+		for (int aSrcChannels = 2; aSrcChannels >= 1; aSrcChannels--)
+		{
+			std::vector<int16_t> aSamples = MakeNoise(FREQ * 3 * aSrcChannels, 3);
+
+			// Rate 1 copies, the others interpolate
+			for (int aKind = 0; aKind < 3; aKind++)
+			{
+				SoundMixer aMixer(FREQ, 2, NUM_VOICES);
+				aMixer.SetResampleMode(aKind == 2 ? RESAMPLE_CUBIC : RESAMPLE_LINEAR);
+				for (int i = 0; i < NUM_VOICES; i++)
+					aMixer.Play(&aSamples[0], FREQ * 3, aSrcChannels, 0.03f, 0.03f, aKind == 0 ? 1.0 : 1.1, true);
+
+				PerfTimer aTimer;
+				aTimer.Start();
+				for (int aBlock = 0; aBlock < FREQ * NUM_SECONDS / BLOCK_FRAMES; aBlock++)
+					aMixer.Mix(&anOut[0], BLOCK_FRAMES);
+				double aTime = aTimer.GetDuration();
+
+				static const char* aKindNames[] = { "rate 1", "linear", "cubic " };
+				printf("  %-6s %s %s: %.3f ms per voice per second of audio\n", aLevelNames[aLevel], aSrcChannels == 2 ? "stereo" : "mono  ",
+					aKindNames[aKind], aTime / NUM_VOICES / NUM_SECONDS);
+			}
+		}
+	}
+
+	SetSIMDLevel(SIMDLevel_NEON);
+}
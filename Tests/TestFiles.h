@@ -0,0 +1,204 @@
+#pragma once
+
+#include "TestHarness.h"
+#include "SexyAppBase.h"
+#include "graphics/GLInterface.h"
+#include "graphics/GLImage.h"
+#include "imagelib/ImageCache.h"
+#include "imagelib/ImageLib.h"
+#include "misc/ResourceManager.h"
+#include "misc/MTRand.h"
+#include "paklib/PakInterface.h"
+
+namespace Sexy
+{
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes theData to theFileName, making its directory first.
+///////////////////////////////////////////////////////////////////////////////
+inline bool TestWriteFile(const std::string& theFileName, const void* theData, size_t theSize)
+{
+	MkDir(GetFileDir(theFileName));
+
+	FILE* aFP = fopen(theFileName.c_str(), "wb");
+	if (aFP == NULL)
+		return false;
+	bool isWritten = (theSize == 0) || (fwrite(theData, 1, theSize, aFP) == theSize);
+	return (fclose(aFP) == 0) && isWritten;
+}
+
+inline bool TestWriteFile(const std::string& theFileName, const std::string& theData)
+{
+	return TestWriteFile(theFileName, theData.data(), theData.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A resources.xml with theNumResources images, sounds and fonts split into
+// groups of 250, using most of the attributes ResourceManager reads.  Image
+// paths are images/gN/imgM, sounds are sounds/sM, and every group starts
+// with a SetDefaults.
+///////////////////////////////////////////////////////////////////////////////
+inline std::string TestMakeManifest(int theNumResources, unsigned long theSeed = 1)
+{
+	MTRand aRand(theSeed);
+	std::string aManifest = "<?xml version=\"1.0\"?>\n<ResourceManifest>\n";
+
+	char aLine[512];
+	for (int aGroup = 0; aGroup * 250 < theNumResources; aGroup++)
+	{
+		sprintf(aLine, "  <Resources id=\"Group%d\">\n    <SetDefaults path=\"images/g%d\" idprefix=\"IMAGE_\"/>\n", aGroup, aGroup);
+		aManifest += aLine;
+
+		for (int i = aGroup * 250; i < std::min(theNumResources, (aGroup + 1) * 250); i++)
+		{
+			int aKind = aRand.Next(10UL);
+			if (aKind < 6)
+			{
+				static const char* EXTRAS[] = { "", " alphaimage=\"img_a\" nopal=\"1\"", " rows=\"4\" cols=\"1\" anim=\"loop\" framedelay=\"5\" perframedelay=\"1,2,3,4\"",
+					" nobits3d=\"true\" alphacolor=\"FF00FF\" variant=\"hi\"", " alphagrid=\"img_g\" a8r8g8b8=\"1\" minsubdivide=\"1\"",
+					" ddsurface=\"1\" noalpha=\"1\" a4r4g4b4=\"1\" nobits2d=\"1\" rows=\"2\" cols=\"3\" anim=\"pingpong\" framemap=\"0,2,1\"" };
+				sprintf(aLine, "    <Image id=\"G%d_IMG%d\" path=\"img%d\"%s/>\n", aGroup, i, i, EXTRAS[aKind]);
+			}
+			else if (aKind < 9)
+			{
+				static const char* STREAMS[] = { " stream=\"true\"", " stream=\"0\"", "" };
+				sprintf(aLine, "    <Sound id=\"SOUND_G%d_%d\" path=\"sounds/s%d\" volume=\"0.%d\" pan=\"%d\"%s/>\n", aGroup, i, i, aKind, aKind * 10 - 80, STREAMS[aKind - 6]);
+			}
+			else if (i & 1)
+				sprintf(aLine, "    <Font id=\"FONT_G%d_%d\" path=\"fonts/f%d.txt\" image=\"fonts/f%d.png\" tags=\"bold\"/>\n", aGroup, i, i, i);
+			else
+				sprintf(aLine, "    <Font id=\"FONT_G%d_%d\" path=\"!sys:Arial\" size=\"%d\" bold=\"true\" shadow=\"1\"/>\n", aGroup, i, 10 + i % 5);
+			aManifest += aLine;
+		}
+
+		aManifest += "  </Resources>\n";
+	}
+
+	aManifest += "</ResourceManifest>\n";
+	return aManifest;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes theNumImages images theSize pixels square to theDir and returns a
+// resources.xml with them all in theGroup.  Three in four are PNGs with an
+// alpha gradient, the rest JPEGs with their alpha in a PNG named by
+// alphaimage.
+///////////////////////////////////////////////////////////////////////////////
+inline std::string TestMakeImageGroup(const std::string& theDir, const std::string& theGroup, int theNumImages, int theSize, unsigned long theSeed = 1)
+{
+	MTRand aRand(theSeed);
+	MkDir(theDir);
+
+	ImageLib::Image anImage;
+	anImage.mWidth = theSize;
+	anImage.mHeight = theSize;
+	anImage.mBits = new uint32_t[theSize * theSize];
+
+	std::string aManifest = StrFormat("<ResourceManifest>\n  <Resources id=\"%s\">\n    <SetDefaults path=\"%s\" idprefix=\"IMAGE_\"/>\n",
+		theGroup.c_str(), theDir.c_str());
+
+	for (int i = 0; i < theNumImages; i++)
+	{
+		bool isJPEG = (i % 4) == 3;
+		for (int y = 0; y < theSize; y++)
+		{
+			for (int x = 0; x < theSize; x++)
+			{
+				uint32_t aNoise = aRand.Next(32UL);
+				uint32_t anAlpha = isJPEG ? 255 : (x * 255 / theSize);
+				anImage.mBits[y * theSize + x] = (anAlpha << 24) | (((x + aNoise) & 0xFF) << 16) | (((y * 2 + aNoise) & 0xFF) << 8) | ((x ^ y) & 0xFF);
+			}
+		}
+
+		std::string aName = StrFormat("%s%d", theGroup.c_str(), i);
+		if (isJPEG)
+		{
+			SEXY_CHECK(ImageLib::WriteJPEGImage(theDir + aName + ".jpg", &anImage));
+			for (int j = 0; j < theSize * theSize; j++)
+				anImage.mBits[j] = 0xFF000000 | (anImage.mBits[j] >> 8);
+			SEXY_CHECK(ImageLib::WritePNGImage(theDir + aName + "_alpha.png", &anImage));
+			aManifest += StrFormat("    <Image id=\"%s\" path=\"%s\" alphaimage=\"%s_alpha\"/>\n", aName.c_str(), aName.c_str(), aName.c_str());
+		}
+		else
+		{
+			SEXY_CHECK(ImageLib::WritePNGImage(theDir + aName + ".png", &anImage));
+			aManifest += StrFormat("    <Image id=\"%s\" path=\"%s\"/>\n", aName.c_str(), aName.c_str());
+		}
+	}
+
+	aManifest += "  </Resources>\n</ResourceManifest>\n";
+	return aManifest;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GLImages need the app's GLInterface, which makes no GL calls until it is
+// initialized.  Like the app, it's left to the OS.
+///////////////////////////////////////////////////////////////////////////////
+inline void TestInitGLInterface()
+{
+	if (gSexyAppBase->mGLInterface == NULL)
+		gSexyAppBase->mGLInterface = new GLInterface(gSexyAppBase);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Frees the images along with the resources, rather than leaving them shared
+// for the next load to find.
+///////////////////////////////////////////////////////////////////////////////
+inline void TestDeleteImages(ResourceManager& theManager)
+{
+	theManager.DeleteResources("");
+	gSexyAppBase->mCleanupSharedImages = true;
+	gSexyAppBase->CleanSharedImages();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Loads theGroup from scratch with theNumThreads and hashes every image's
+// pixels and alpha flags, in id order.  Returns how long the load took, or a
+// negative number if it failed.
+///////////////////////////////////////////////////////////////////////////////
+inline double TestLoadImageGroup(ResourceManager& theManager, const std::string& theGroup, int theNumThreads, std::vector<uint64_t>& theHashes)
+{
+	TestDeleteImages(theManager);
+	theManager.SetLoadThreads(theNumThreads);
+
+	PerfTimer aTimer;
+	aTimer.Start();
+	theManager.StartLoadResources(theGroup);
+	while (theManager.LoadNextResource())
+		;
+	double aTime = aTimer.GetDuration();
+
+	if (theManager.HadError())
+	{
+		printf("  %s\n", theManager.GetErrorText().c_str());
+		return -1;
+	}
+
+	theHashes.clear();
+	for (ResourceManager::ResMap::iterator anItr = theManager.mImageMap.begin(); anItr != theManager.mImageMap.end(); ++anItr)
+	{
+		GLImage* anImage = (GLImage*)((ResourceManager::ImageRes*)anItr->second)->mImage;
+		if (anImage == NULL || anImage->mBits == NULL)
+			return -1;
+
+		uint64_t aHash = ImageLib::ImageCache::Hash(anImage->mBits, anImage->mWidth * anImage->mHeight * sizeof(uint32_t));
+		theHashes.push_back(aHash * 4 + anImage->mHasAlpha * 2 + anImage->mHasTrans);
+	}
+
+	return aTime;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Points p_fopen and the rest at thePak for as long as it's in scope.
+///////////////////////////////////////////////////////////////////////////////
+class TestPakScope
+{
+public:
+	PakInterface*			mOldPak;
+
+public:
+	TestPakScope(PakInterface* thePak) { mOldPak = gPakInterface; gPakInterface = thePak; }
+	~TestPakScope() { gPakInterface = mOldPak; }
+};
+
+}
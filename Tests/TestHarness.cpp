@@ -0,0 +1,116 @@
+#include "TestHarness.h"
+#include "SexyAppBase.h"
+#include <SDL2/SDL.h>
+
+using namespace Sexy;
+
+static TestCase* gFirstTestCase = NULL;
+static TestCase* gLastTestCase = NULL;
+static int gCheckFailures = 0;
+static std::string gTempDir;
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TestCase::TestCase(const char* theName, TestProc theProc, bool isBenchmark)
+{
+	mName = theName;
+	mProc = theProc;
+	mIsBenchmark = isBenchmark;
+	mNext = NULL;
+
+	// Keep them in the order each file declares them
+	if (gLastTestCase != NULL)
+		gLastTestCase->mNext = this;
+	else
+		gFirstTestCase = this;
+	gLastTestCase = this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+TestCase* TestCase::GetFirst()
+{
+	return gFirstTestCase;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+void Sexy::TestCheckFailed(const char* theFile, int theLine, const char* theCheck)
+{
+	printf("  %s(%d): check failed: %s\n", theFile, theLine, theCheck);
+	gCheckFailures++;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+std::string Sexy::TestGetTempDir()
+{
+	if (gTempDir.empty())
+	{
+		gTempDir = "SexyTestsTemp/";
+		MkDir(gTempDir);
+	}
+
+	return gTempDir;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+std::string Sexy::TestGetDataDir()
+{
+	return "data/";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv)
+{
+	bool doBenchmarks = false;
+	const char* aFilter = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-bench") == 0)
+			doBenchmarks = true;
+		else
+			aFilter = argv[i];
+	}
+
+	// Images register themselves with gSexyAppBase, so the tests get an app
+	// that's never initialized.  It's left to the OS, since its destructor
+	// expects an app that was.
+	new SexyAppBase();
+
+	int aNumRun = 0;
+	int aNumFailed = 0;
+	for (TestCase* aCase = TestCase::GetFirst(); aCase != NULL; aCase = aCase->mNext)
+	{
+		if (aCase->mIsBenchmark != doBenchmarks)
+			continue;
+		if (aFilter != NULL && strstr(aCase->mName, aFilter) == NULL)
+			continue;
+
+		printf("%s\n", aCase->mName);
+		fflush(stdout);
+
+		int aFailuresBefore = gCheckFailures;
+		PerfTimer aTimer;
+		aTimer.Start();
+		aCase->mProc();
+		aTimer.Stop();
+
+		aNumRun++;
+		if (gCheckFailures != aFailuresBefore)
+		{
+			printf("  FAILED\n");
+			aNumFailed++;
+		}
+		else if (!doBenchmarks)
+			printf("  ok (%.0f ms)\n", aTimer.GetDuration());
+	}
+
+	if (!gTempDir.empty())
+		Deltree(gTempDir);
+
+	printf("%d run, %d failed\n", aNumRun, aNumFailed);
+	return aNumFailed != 0 ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Common.h"
+#include "misc/PerfTimer.h"
+
+namespace Sexy
+{
+
+typedef void (*TestProc)();
+
+///////////////////////////////////////////////////////////////////////////////
+// A test or benchmark, registered by the SEXY_TEST and SEXY_BENCHMARK macros
+// below.  SexyTests runs every test and exits with 1 if any check failed.
+// Benchmarks only run when asked for with -bench, since they take a while and
+// their numbers only mean something in a Release build.
+//
+//	SexyTests [-bench] [name]
+//
+// runs only the tests (or with -bench, the benchmarks) whose names contain
+// name.
+///////////////////////////////////////////////////////////////////////////////
+class TestCase
+{
+public:
+	const char*				mName;
+	TestProc				mProc;
+	bool					mIsBenchmark;
+	TestCase*				mNext;
+
+public:
+	TestCase(const char* theName, TestProc theProc, bool isBenchmark);
+
+	static TestCase*		GetFirst();
+};
+
+void						TestCheckFailed(const char* theFile, int theLine, const char* theCheck);
+
+// A directory the running test may write scratch files to, with a trailing slash
+std::string					TestGetTempDir();
+
+// Where the files checked in under Tests/data are, relative to Tests, which
+// is where Visual Studio runs SexyTests from
+std::string					TestGetDataDir();
+
+}
+
+#define SEXY_TEST(theName) \
+	static void theName(); \
+	static Sexy::TestCase theName##Case(#theName, theName, false); \
+	static void theName()
+
+#define SEXY_BENCHMARK(theName) \
+	static void theName(); \
+	static Sexy::TestCase theName##Case(#theName, theName, true); \
+	static void theName()
+
+// Records a failure and carries on, so one run reports every broken check
+#define SEXY_CHECK(theCheck) \
+	do { if (!(theCheck)) Sexy::TestCheckFailed(__FILE__, __LINE__, #theCheck); } while (0)
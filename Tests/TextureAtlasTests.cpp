@@ -0,0 +1,276 @@
+#include "TestHarness.h"
+#include "graphics/TextureAtlas.h"
+#include "misc/MTRand.h"
+#include "misc/Rect.h"
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Paints each entry's padded rect into a grid per page with the entry's
+// number, and returns false if any two overlap or one leaves its page.
+///////////////////////////////////////////////////////////////////////////////
+typedef std::map<AtlasPage*, std::vector<int> > AtlasGridMap;
+
+static bool PaintEntries(TextureAtlas* theAtlas, const std::vector<AtlasEntry*>& theEntries, AtlasGridMap& theGrids)
+{
+	theGrids.clear();
+	for (int i = 0; i < (int)theAtlas->mPages.size(); i++)
+		theGrids[theAtlas->mPages[i]].assign(theAtlas->mPageWidth * theAtlas->mPageHeight, -1);
+
+	int aGutter = theAtlas->mGutter;
+	for (int i = 0; i < (int)theEntries.size(); i++)
+	{
+		AtlasEntry* anEntry = theEntries[i];
+		int aLeft = anEntry->mX - aGutter;
+		int aTop = anEntry->mY - aGutter;
+		int aRight = anEntry->mX + anEntry->mWidth + aGutter;
+		int aBottom = anEntry->mY + anEntry->mHeight + aGutter;
+		if (aLeft < 0 || aTop < 0 || aRight > theAtlas->mPageWidth || aBottom > theAtlas->mPageHeight)
+			return false;
+
+		std::vector<int>& aGrid = theGrids[anEntry->mPage];
+		for (int y = aTop; y < aBottom; y++)
+		{
+			for (int x = aLeft; x < aRight; x++)
+			{
+				if (aGrid[y * theAtlas->mPageWidth + x] != -1)
+					return false;
+				aGrid[y * theAtlas->mPageWidth + x] = i;
+			}
+		}
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// What the pages say they hold has to match the entries that are live.
+///////////////////////////////////////////////////////////////////////////////
+static bool CheckPageAccounting(TextureAtlas* theAtlas)
+{
+	int aGutter = theAtlas->mGutter;
+	for (int i = 0; i < (int)theAtlas->mPages.size(); i++)
+	{
+		AtlasPage* aPage = theAtlas->mPages[i];
+		int anArea = 0;
+		for (AtlasPage::EntrySet::iterator anItr = aPage->mEntries.begin(); anItr != aPage->mEntries.end(); ++anItr)
+			anArea += ((*anItr)->mWidth + aGutter * 2) * ((*anItr)->mHeight + aGutter * 2);
+		if (anArea != aPage->mUsedArea || aPage->mShelfTop > aPage->mHeight)
+			return false;
+
+		for (int j = 0; j < (int)aPage->mShelves.size(); j++)
+		{
+			AtlasShelf::SpanVector& aSpans = aPage->mShelves[j].mFreeSpans;
+			for (int k = 0; k + 1 < (int)aSpans.size(); k++)
+			{
+				// Sorted and merged
+				if (aSpans[k].mX + aSpans[k].mWidth >= aSpans[k + 1].mX)
+					return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocates the way GLInterface does: the existing pages, then a compacted
+// one, then a new one.
+///////////////////////////////////////////////////////////////////////////////
+static AtlasEntry* AllocateOrGrow(TextureAtlas* theAtlas, int theWidth, int theHeight)
+{
+	AtlasEntry* anEntry = theAtlas->Allocate(theWidth, theHeight);
+	if (anEntry == NULL)
+	{
+		AtlasPage* aPage = theAtlas->FindFragmentedPage();
+		AtlasMoveVector aMoves;
+		if (aPage != NULL && theAtlas->Compact(aPage, aMoves))
+			anEntry = theAtlas->Allocate(theWidth, theHeight);
+	}
+
+	if (anEntry == NULL && theAtlas->AddPage() != NULL)
+		anEntry = theAtlas->Allocate(theWidth, theHeight);
+
+	return anEntry;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Small images coming and going for a long time, with compaction on the way.
+// Nothing may ever overlap (gutters included) or leave its page.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(AtlasChurnNeverOverlaps)
+{
+	MTRand aRand(2);
+	TextureAtlas anAtlas(512, 512, 2, 128, 4);
+	std::vector<AtlasEntry*> anEntries;
+	AtlasGridMap aGrids;
+
+	int aNumBad = 0;
+	for (int i = 0; i < 20000; i++)
+	{
+		if (anEntries.size() < 200 && aRand.Next(3UL) != 0)
+		{
+			AtlasEntry* anEntry = AllocateOrGrow(&anAtlas, 1 + aRand.Next(128UL), 1 + aRand.Next(64UL));
+			if (anEntry != NULL)
+				anEntries.push_back(anEntry);
+		}
+		else if (!anEntries.empty())
+		{
+			int anIndex = aRand.Next((unsigned long)anEntries.size());
+			anAtlas.Free(anEntries[anIndex]);
+			anEntries.erase(anEntries.begin() + anIndex);
+		}
+
+		if (i % 500 == 0)
+			aNumBad += !PaintEntries(&anAtlas, anEntries, aGrids) || !CheckPageAccounting(&anAtlas);
+	}
+	SEXY_CHECK(aNumBad == 0);
+
+	// Everything freed gives every row back
+	for (int i = 0; i < (int)anEntries.size(); i++)
+		anAtlas.Free(anEntries[i]);
+	for (int i = 0; i < (int)anAtlas.mPages.size(); i++)
+	{
+		SEXY_CHECK(anAtlas.mPages[i]->mShelfTop == 0);
+		SEXY_CHECK(anAtlas.mPages[i]->mUsedArea == 0);
+		SEXY_CHECK(anAtlas.mPages[i]->mEntries.empty());
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A UI's worth of icons, buttons and font glyphs.  They have to pack densely,
+// and with one bind per page instead of per image.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(AtlasPackingEfficiency)
+{
+	MTRand aRand(5);
+	TextureAtlas anAtlas(1024, 1024, 2, 128, 8);
+	std::vector<AtlasEntry*> anEntries;
+
+	const int NUM_IMAGES = 1500;
+	int aNumFailed = 0;
+	int aPow2Area = 0;
+	for (int i = 0; i < NUM_IMAGES; i++)
+	{
+		int aWidth, aHeight;
+		switch (i % 3)
+		{
+		case 0: aWidth = 6 + aRand.Next(20UL); aHeight = 18 + aRand.Next(4UL); break;	// glyphs
+		case 1: aWidth = 16 + aRand.Next(48UL); aHeight = 16 + aRand.Next(48UL); break;	// icons
+		default: aWidth = 40 + aRand.Next(88UL); aHeight = 20 + aRand.Next(30UL); break; // buttons
+		}
+
+		AtlasEntry* anEntry = AllocateOrGrow(&anAtlas, aWidth, aHeight);
+		if (anEntry == NULL)
+			aNumFailed++;
+		else
+			anEntries.push_back(anEntry);
+
+		int aTexWidth = 1, aTexHeight = 1;
+		while (aTexWidth < aWidth)
+			aTexWidth <<= 1;
+		while (aTexHeight < aHeight)
+			aTexHeight <<= 1;
+		aPow2Area += aTexWidth * aTexHeight;
+	}
+
+	AtlasGridMap aGrids;
+	SEXY_CHECK(aNumFailed == 0);
+	SEXY_CHECK(PaintEntries(&anAtlas, anEntries, aGrids));
+
+	// Every page but the last is full enough that it's worth its texture
+	float anEfficiency = anAtlas.GetPackingEfficiency();
+	float aFullPagesEfficiency = 0;
+	for (int i = 0; i + 1 < (int)anAtlas.mPages.size(); i++)
+		aFullPagesEfficiency += (float)anAtlas.mPages[i]->mUsedArea / (anAtlas.mPageWidth * anAtlas.mPageHeight) / (anAtlas.mPages.size() - 1);
+
+	printf("  %d images on %d pages, %.0f%% of their texels used (%.0f%% of the full pages with gutters)\n",
+		NUM_IMAGES, (int)anAtlas.mPages.size(), anEfficiency * 100, aFullPagesEfficiency * 100);
+	printf("  as %d power of two textures, a bind each, they'd take %.1f pages worth of texels\n", NUM_IMAGES, (float)aPow2Area / (anAtlas.mPageWidth * anAtlas.mPageHeight));
+	SEXY_CHECK(anAtlas.mPages.size() > 1);
+	SEXY_CHECK(aFullPagesEfficiency > 0.75f);
+	SEXY_CHECK(anAtlas.GetPageArea() < aPow2Area);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Freeing most of a page leaves holes that a big image won't fit in until
+// the page is compacted.  The moves Compact reports have to carry every
+// entry's texels to where the entry now says it is.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(AtlasFreeAndCompact)
+{
+	MTRand aRand(9);
+	TextureAtlas anAtlas(256, 256, 1, 128, 1);
+	anAtlas.AddPage();
+	AtlasPage* aPage = anAtlas.mPages[0];
+
+	std::vector<AtlasEntry*> anEntries;
+	AtlasEntry* anEntry;
+	while ((anEntry = anAtlas.Allocate(8 + aRand.Next(24UL), 8 + aRand.Next(24UL))) != NULL)
+		anEntries.push_back(anEntry);
+	printf("  %.0f%% used when the first allocation fails\n", anAtlas.GetPackingEfficiency() * 100);
+	SEXY_CHECK(anAtlas.FindFragmentedPage() == NULL);
+
+	// Keep one in four, spread all over the page
+	std::vector<AtlasEntry*> aKept;
+	for (int i = 0; i < (int)anEntries.size(); i++)
+	{
+		if (i % 4 == 0)
+			aKept.push_back(anEntries[i]);
+		else
+			anAtlas.Free(anEntries[i]);
+	}
+	SEXY_CHECK(CheckPageAccounting(&anAtlas));
+	float aFragmentation = aPage->GetFragmentation();
+	SEXY_CHECK(aFragmentation > anAtlas.mCompactThreshold);
+	SEXY_CHECK(anAtlas.FindFragmentedPage() == aPage);
+	SEXY_CHECK(anAtlas.Allocate(120, 100) == NULL);
+
+	AtlasGridMap aBefore;
+	SEXY_CHECK(PaintEntries(&anAtlas, aKept, aBefore));
+
+	std::vector<Rect> anOldRects;
+	for (int i = 0; i < (int)aKept.size(); i++)
+		anOldRects.push_back(Rect(aKept[i]->mX, aKept[i]->mY, aKept[i]->mWidth, aKept[i]->mHeight));
+
+	AtlasMoveVector aMoves;
+	SEXY_CHECK(anAtlas.Compact(aPage, aMoves));
+	SEXY_CHECK(!aMoves.empty());
+	SEXY_CHECK(aPage->mEntries.size() == aKept.size());
+	printf("  fragmentation with one in four kept: %.0f%% before compacting, %.0f%% after\n", aFragmentation * 100, aPage->GetFragmentation() * 100);
+	SEXY_CHECK(aPage->GetFragmentation() < aFragmentation / 2);
+	SEXY_CHECK(anAtlas.FindFragmentedPage() == NULL);
+	SEXY_CHECK(CheckPageAccounting(&anAtlas));
+
+	// Copy the old page's texels the way the renderer does, from a snapshot
+	std::vector<int>& anOld = aBefore[aPage];
+	std::vector<int> aNew = anOld;
+	for (int i = 0; i < (int)aMoves.size(); i++)
+	{
+		AtlasMove& aMove = aMoves[i];
+		for (int y = 0; y < aMove.mHeight; y++)
+		{
+			for (int x = 0; x < aMove.mWidth; x++)
+				aNew[(aMove.mDestY + y) * 256 + aMove.mDestX + x] = anOld[(aMove.mSrcY + y) * 256 + aMove.mSrcX + x];
+		}
+	}
+
+	AtlasGridMap anAfter;
+	SEXY_CHECK(PaintEntries(&anAtlas, aKept, anAfter));
+	int aNumLost = 0;
+	for (int i = 0; i < (int)aKept.size(); i++)
+	{
+		SEXY_CHECK(aKept[i]->mWidth == anOldRects[i].mWidth && aKept[i]->mHeight == anOldRects[i].mHeight);
+		for (int y = aKept[i]->mY - 1; y < aKept[i]->mY + aKept[i]->mHeight + 1; y++)
+		{
+			for (int x = aKept[i]->mX - 1; x < aKept[i]->mX + aKept[i]->mWidth + 1; x++)
+				aNumLost += aNew[y * 256 + x] != i;
+		}
+	}
+	SEXY_CHECK(aNumLost == 0);
+
+	// And the room freed up is in one piece now
+	anEntry = anAtlas.Allocate(120, 100);
+	SEXY_CHECK(anEntry != NULL);
+	anAtlas.Free(anEntry);
+}
@@ -0,0 +1,315 @@
+#include <SDL2/SDL.h>
+
+#include "TestHarness.h"
+#include "graphics/TextureUploadQueue.h"
+#include "misc/MTRand.h"
+
+#include <map>
+
+using namespace Sexy;
+
+static const int PIECE_SIZE = 64;
+
+///////////////////////////////////////////////////////////////////////////////
+// Stands in for TextureData: draws are skipped while mUploadJob is set, the
+// same as GLInterface::CreateImageTexture does.
+///////////////////////////////////////////////////////////////////////////////
+struct FakeTexture
+{
+	TextureUploadJob*		mUploadJob;
+	std::vector<uint32_t>	mBits;
+	int						mWidth, mHeight;
+	std::vector<GLuint>		mPieces;
+	int						mSkippedDraws;
+	bool					mCompleteWhenResident;	// every piece was there when the job completed
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Keeps every uploaded piece by texture name and runs a clock that only moves
+// when a piece is uploaded, so the budget is exact.
+///////////////////////////////////////////////////////////////////////////////
+class FakeUploadBackend : public TextureUploadBackend
+{
+public:
+	uint64_t				mTime;
+	int						mPieceMicros;
+	int						mFramePieces;
+	std::map<GLuint, std::vector<uint8_t> > mTextures;
+
+public:
+	FakeUploadBackend(int thePieceMicros)
+	{
+		mTime = 0;
+		mPieceMicros = thePieceMicros;
+		mFramePieces = 0;
+	}
+
+	virtual void UploadPiece(TextureUploadJob* theJob, const TextureUploadPiece& thePiece, const void* theData)
+	{
+		int aSize = thePiece.mTexWidth * thePiece.mTexHeight * GetPixelFormatSize(theJob->mFormat);
+		mTextures[thePiece.mTexture].assign((const uint8_t*)theData, (const uint8_t*)theData + aSize);
+		mTime += mPieceMicros;
+		mFramePieces++;
+	}
+
+	virtual void JobCompleted(TextureUploadJob* theJob)
+	{
+		FakeTexture* aTexture = (FakeTexture*)theJob->mOwner;
+		aTexture->mUploadJob = NULL;
+
+		aTexture->mCompleteWhenResident = true;
+		for (size_t i = 0; i < aTexture->mPieces.size(); i++)
+			aTexture->mCompleteWhenResident &= mTextures.count(aTexture->mPieces[i]) != 0;
+	}
+
+	virtual uint64_t GetMicroseconds()
+	{
+		return mTime;
+	}
+};
+
+static uint16_t Pixel565(uint32_t aPixel)
+{
+	return ((aPixel >> 8) & 0xF800) | ((aPixel >> 5) & 0x07E0) | ((aPixel >> 3) & 0x001F);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Makes the job CreateImageTexture would for a new large image, cut into
+// PIECE_SIZE pieces named from theNextName up.
+///////////////////////////////////////////////////////////////////////////////
+static void SubmitTexture(TextureUploadScheduler* theScheduler, FakeTexture* theTexture, MTRand& theRand, int theWidth, int theHeight, GLuint& theNextName)
+{
+	theTexture->mWidth = theWidth;
+	theTexture->mHeight = theHeight;
+	theTexture->mBits.resize(theWidth * theHeight);
+	for (size_t i = 0; i < theTexture->mBits.size(); i++)
+		theTexture->mBits[i] = (uint32_t)theRand.Next();
+	theTexture->mSkippedDraws = 0;
+	theTexture->mCompleteWhenResident = false;
+
+	TextureUploadJob* aJob = new TextureUploadJob(theTexture, PixelFormat_R5G6B5);
+	aJob->SetSource(&theTexture->mBits[0], NULL, NULL, theWidth, theHeight);
+	for (int y = 0; y < theHeight; y += PIECE_SIZE)
+	{
+		for (int x = 0; x < theWidth; x += PIECE_SIZE)
+		{
+			theTexture->mPieces.push_back(theNextName);
+			aJob->AddPiece(theNextName++, x, y, PIECE_SIZE, PIECE_SIZE);
+		}
+	}
+
+	theTexture->mUploadJob = aJob;
+	theScheduler->Submit(aJob);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Checks every uploaded piece against theBits, padding column and row
+// included.  Returns the number of wrong texels.
+///////////////////////////////////////////////////////////////////////////////
+static int CheckTexture(FakeUploadBackend& theBackend, const FakeTexture& theTexture, const std::vector<uint32_t>& theBits)
+{
+	int aNumBad = 0;
+	int i = 0;
+	for (int py = 0; py < theTexture.mHeight; py += PIECE_SIZE)
+	{
+		for (int px = 0; px < theTexture.mWidth; px += PIECE_SIZE, i++)
+		{
+			std::vector<uint8_t>& aData = theBackend.mTextures[theTexture.mPieces[i]];
+			if (aData.size() != PIECE_SIZE * PIECE_SIZE * 2)
+			{
+				aNumBad++;
+				continue;
+			}
+
+			const uint16_t* aTexels = (const uint16_t*)&aData[0];
+			int aWidth = std::min(PIECE_SIZE, theTexture.mWidth - px);
+			int aHeight = std::min(PIECE_SIZE, theTexture.mHeight - py);
+			for (int y = 0; y < std::min(aHeight + 1, PIECE_SIZE); y++)
+			{
+				for (int x = 0; x < std::min(aWidth + 1, PIECE_SIZE); x++)
+				{
+					int sx = std::min(px + x, theTexture.mWidth - 1);
+					int sy = std::min(py + y, theTexture.mHeight - 1);
+					aNumBad += aTexels[y * PIECE_SIZE + x] != Pixel565(theBits[sy * theTexture.mWidth + sx]);
+				}
+			}
+		}
+	}
+
+	return aNumBad;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A level's worth of big images, with pieces costing 1ms against a 2.5ms
+// budget: never more than 3 pieces a frame, none lost, and what arrives is the
+// image as it was at submit time even though it was scribbled on right after.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(UploadQueueDrainsWithinBudget)
+{
+	const int NUM_TEXTURES = 5;
+
+	for (int aNumWorkers = 0; aNumWorkers <= 2; aNumWorkers += 2)
+	{
+		FakeUploadBackend aBackend(1000);
+		TextureUploadScheduler aScheduler(&aBackend, aNumWorkers, 2500);
+
+		MTRand aRand(3);
+		GLuint aNextName = 1;
+		FakeTexture aTextures[NUM_TEXTURES];
+		std::vector<uint32_t> anOriginals[NUM_TEXTURES];
+		for (int i = 0; i < NUM_TEXTURES; i++)
+		{
+			SubmitTexture(&aScheduler, &aTextures[i], aRand, 200 + i * 10, 150, aNextName);
+			anOriginals[i] = aTextures[i].mBits;
+			std::fill(aTextures[i].mBits.begin(), aTextures[i].mBits.end(), 0);
+		}
+
+		int aNumPieces = aNextName - 1;
+		int aNumFrames = 0;
+		int aMostPieces = 0;
+		while (aScheduler.GetPendingCount() > 0 && aNumFrames < 10000)
+		{
+			if (aNumWorkers > 0)
+				SDL_Delay(1);
+
+			aBackend.mFramePieces = 0;
+			aScheduler.Update();
+			aMostPieces = std::max(aMostPieces, aBackend.mFramePieces);
+			aNumFrames++;
+		}
+
+		printf("  %d workers: %d pieces in %d frames, at most %d a frame\n", aNumWorkers, aNumPieces, aNumFrames, aMostPieces);
+		SEXY_CHECK(aScheduler.GetPendingCount() == 0);
+		SEXY_CHECK(aMostPieces == 3);
+		SEXY_CHECK((int)aBackend.mTextures.size() == aNumPieces);
+		SEXY_CHECK(aScheduler.mStats.mPiecesUploaded == aNumPieces);
+		SEXY_CHECK(aScheduler.mStats.mBytesUploaded == (int64_t)aNumPieces * PIECE_SIZE * PIECE_SIZE * 2);
+		SEXY_CHECK(aScheduler.mStats.mJobsCompleted == NUM_TEXTURES);
+		if (aNumWorkers == 0)
+			SEXY_CHECK(aNumFrames == (aNumPieces + 2) / 3);
+
+		for (int i = 0; i < NUM_TEXTURES; i++)
+		{
+			SEXY_CHECK(aTextures[i].mUploadJob == NULL);
+			SEXY_CHECK(CheckTexture(aBackend, aTextures[i], anOriginals[i]) == 0);
+		}
+	}
+
+	// A piece bigger than the whole budget still goes through, one a frame
+	FakeUploadBackend aBackend(10000);
+	TextureUploadScheduler aScheduler(&aBackend, 0, 2500);
+	MTRand aRand(4);
+	GLuint aNextName = 1;
+	FakeTexture aTexture;
+	SubmitTexture(&aScheduler, &aTexture, aRand, 256, 128, aNextName);
+
+	int aNumFrames = 0;
+	for (; aScheduler.GetPendingCount() > 0 && aNumFrames < 100; aNumFrames++)
+	{
+		aBackend.mFramePieces = 0;
+		aScheduler.Update();
+		SEXY_CHECK(aBackend.mFramePieces == 1);
+	}
+	SEXY_CHECK(aNumFrames == 8);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draws of an image are skipped until its last piece is up, then never again.
+// Finish makes a pending image resident on the spot, whatever the budget, and
+// cancelled images never reach the backend.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(UploadQueueSkipsDrawsUntilResident)
+{
+	for (int aNumWorkers = 0; aNumWorkers <= 2; aNumWorkers += 2)
+	{
+		FakeUploadBackend aBackend(1000);
+		TextureUploadScheduler aScheduler(&aBackend, aNumWorkers, 2500);
+
+		MTRand aRand(9);
+		GLuint aNextName = 1;
+		FakeTexture aDrawn[3], aFinished, aCancelled;
+		for (int i = 0; i < 3; i++)
+			SubmitTexture(&aScheduler, &aDrawn[i], aRand, 192, 192, aNextName);
+		SubmitTexture(&aScheduler, &aCancelled, aRand, 256, 256, aNextName);
+		SubmitTexture(&aScheduler, &aFinished, aRand, 256, 256, aNextName);
+
+		// The image went away before the queue got to it
+		aScheduler.Cancel(aCancelled.mUploadJob);
+		aCancelled.mUploadJob = NULL;
+
+		// RecoverBits needs it now, all 16 pieces go up in this one call
+		aScheduler.Finish(aFinished.mUploadJob);
+		SEXY_CHECK(aFinished.mUploadJob == NULL && aFinished.mCompleteWhenResident);
+		SEXY_CHECK(CheckTexture(aBackend, aFinished, aFinished.mBits) == 0);
+
+		int aNumFrames = 0;
+		bool drawnEarly = false;
+		while (aScheduler.GetPendingCount() > 0 && aNumFrames < 10000)
+		{
+			if (aNumWorkers > 0)
+				SDL_Delay(1);
+
+			aScheduler.Update();
+			aNumFrames++;
+
+			for (int i = 0; i < 3; i++)
+			{
+				if (aDrawn[i].mUploadJob != NULL)
+					aDrawn[i].mSkippedDraws++;
+				else
+					drawnEarly |= !aDrawn[i].mCompleteWhenResident;
+			}
+		}
+
+		SEXY_CHECK(aScheduler.GetPendingCount() == 0);
+		SEXY_CHECK(!drawnEarly);
+		for (int i = 0; i < 3; i++)
+		{
+			SEXY_CHECK(aDrawn[i].mCompleteWhenResident);
+			SEXY_CHECK(CheckTexture(aBackend, aDrawn[i], aDrawn[i].mBits) == 0);
+		}
+
+		// 9 pieces each at 3 a frame, so in order each waits 3 frames longer
+		printf("  %d workers: draws skipped %d, %d, %d\n", aNumWorkers, aDrawn[0].mSkippedDraws, aDrawn[1].mSkippedDraws, aDrawn[2].mSkippedDraws);
+		SEXY_CHECK(aDrawn[0].mSkippedDraws < aDrawn[1].mSkippedDraws && aDrawn[1].mSkippedDraws < aDrawn[2].mSkippedDraws);
+		if (aNumWorkers == 0)
+			SEXY_CHECK(aDrawn[0].mSkippedDraws == 2 && aDrawn[2].mSkippedDraws == 8);
+
+		for (size_t i = 0; i < aCancelled.mPieces.size(); i++)
+			SEXY_CHECK(aBackend.mTextures.count(aCancelled.mPieces[i]) == 0);
+		SEXY_CHECK(aScheduler.mStats.mJobsCancelled == 1);
+		SEXY_CHECK(aScheduler.mStats.mJobsCompleted == 4);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Palettized sources go through the same pieces, in both 32 bit layouts.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(ConvertTexturePiecePalette)
+{
+	MTRand aRand(12);
+	const int WIDTH = 37, HEIGHT = 21;
+	std::vector<uint8_t> anIndices(WIDTH * HEIGHT);
+	std::vector<uint32_t> aPalette(256);
+	for (size_t i = 0; i < anIndices.size(); i++)
+		anIndices[i] = (uint8_t)aRand.Next(256UL);
+	for (int i = 0; i < 256; i++)
+		aPalette[i] = (uint32_t)aRand.Next();
+
+	TextureUploadSource aSource = { NULL, &anIndices[0], &aPalette[0], WIDTH, HEIGHT };
+	std::vector<uint32_t> aDest(32 * 32);
+	std::vector<uint16_t> aDest16(32 * 32);
+	ConvertTexturePiece(aSource, PixelFormat_A8R8G8B8, 32, 0, 32, 32, &aDest[0]);
+	ConvertTexturePiece(aSource, PixelFormat_R5G6B5, 0, 0, 32, 32, &aDest16[0]);
+
+	int aNumBad = 0;
+	for (int y = 0; y <= HEIGHT; y++)
+	{
+		int sy = std::min(y, HEIGHT - 1);
+		for (int x = 0; x <= WIDTH - 32; x++)
+			aNumBad += aDest[y * 32 + x] != aPalette[anIndices[sy * WIDTH + 32 + std::min(x, WIDTH - 33)]];
+		for (int x = 0; x < 32; x++)
+			aNumBad += aDest16[y * 32 + x] != Pixel565(aPalette[anIndices[sy * WIDTH + x]]);
+	}
+	SEXY_CHECK(aNumBad == 0);
+}
@@ -0,0 +1,314 @@
+#include "TestFiles.h"
+#include "misc/XMLParser.h"
+#include "Tools/PakBuilder/PakBuild.h"
+
+#include <new>
+
+using namespace Sexy;
+
+///////////////////////////////////////////////////////////////////////////////
+// Counts every allocation the program makes while gCountAllocs is set, for
+// the benchmarks that compare how much parsing allocates.
+///////////////////////////////////////////////////////////////////////////////
+static int gNumAllocs = 0;
+static bool gCountAllocs = false;
+
+void* operator new(size_t theSize)
+{
+	if (gCountAllocs)
+		gNumAllocs++;
+
+	void* aPtr = malloc((theSize != 0) ? theSize : 1);
+	if (aPtr == NULL)
+		throw std::bad_alloc();
+	return aPtr;
+}
+
+void operator delete(void* thePtr) noexcept
+{
+	free(thePtr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the file a character at a time through p_fread, the way every file
+// was parsed before OpenFile took them into memory.  UTF-16 files still are.
+///////////////////////////////////////////////////////////////////////////////
+class StreamingXMLParser : public XMLParser
+{
+public:
+	bool					OpenStreaming(const std::string& theFileName)
+	{
+		mFile = p_fopen(theFileName.c_str(), "r");
+		if (mFile == NULL)
+			return false;
+
+		mFileName = theFileName;
+		Init();
+		return true;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Every element on a line of its own, and how the parse ended, so two parses
+// of the same file can be compared.
+///////////////////////////////////////////////////////////////////////////////
+static std::string DumpElements(XMLParser& theParser)
+{
+	std::string aDump;
+	XMLElement anElement;
+	while (theParser.NextElement(&anElement))
+	{
+		aDump += StrFormat("%d|%s|%s|%s", anElement.mType, anElement.mSection.c_str(), anElement.mValue.c_str(), anElement.mInstruction.c_str());
+		for (XMLParamMap::iterator anItr = anElement.mAttributes.begin(); anItr != anElement.mAttributes.end(); ++anItr)
+			aDump += "|" + anItr->first + "=" + anItr->second;
+		aDump += "\n";
+		anElement.mAttributeIteratorList.clear();
+	}
+
+	aDump += StrFormat("failed %d at line %d", theParser.HasFailed(), theParser.GetCurrentLineNum());
+	return aDump;
+}
+
+static const char* gSourceNames[] = { "disk", "version 0 pak, loaded", "version 0 pak, mapped", "compressed pak, mapped" };
+static const int NUM_SOURCES = 4;
+
+///////////////////////////////////////////////////////////////////////////////
+// Writes theManifest as resources.xml on disk, and packs it in a version 0
+// pak and a compressed one.  OpenSource adds the pak source theSource needs
+// to thePak and returns the name to open the manifest by.
+///////////////////////////////////////////////////////////////////////////////
+static void WriteManifestSources(const std::string& theManifest)
+{
+	std::string aDir = TestGetTempDir() + "xmltree/";
+	SEXY_CHECK(TestWriteFile(aDir + "resources.xml", theManifest));
+
+	PakBuildOptions anOptions;
+	anOptions.mVersion = 0;
+	SEXY_CHECK(BuildPak(TestGetTempDir() + "xml0.pak", aDir, anOptions).mError == 0);
+	anOptions.mVersion = 1;
+	anOptions.mBlockSize = 16 * 1024;
+	SEXY_CHECK(BuildPak(TestGetTempDir() + "xml1.pak", aDir, anOptions).mError == 0);
+}
+
+static std::string OpenSource(int theSource, PakInterface& thePak)
+{
+	if (theSource == 0)
+		return TestGetTempDir() + "xmltree/resources.xml";
+
+	thePak.mMapPakFiles = theSource != 1;
+	SEXY_CHECK(thePak.AddPakFile(TestGetTempDir() + (theSource == 3 ? "xml1.pak" : "xml0.pak")));
+	return "resources.xml";
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The same manifest parses the same from disk and from every kind of pak,
+// whether it's read in one go or a character at a time, and a stored record
+// in a loaded pak is parsed where it lies.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_TEST(XMLParseSameFromEverySource)
+{
+	WriteManifestSources(TestMakeManifest(2000));
+
+	std::string aWant;
+	{
+		StreamingXMLParser aParser;
+		SEXY_CHECK(aParser.OpenStreaming(TestGetTempDir() + "xmltree/resources.xml"));
+		aWant = DumpElements(aParser);
+	}
+	SEXY_CHECK(aWant.find("failed 0") != std::string::npos);
+
+	for (int aSource = 0; aSource < NUM_SOURCES; aSource++)
+	{
+		PakInterface aPak;
+		std::string aFileName = OpenSource(aSource, aPak);
+		TestPakScope aScope(&aPak);
+
+		XMLParser aParser;
+		SEXY_CHECK(aParser.OpenFile(aFileName));
+		bool isSame = DumpElements(aParser) == aWant;
+
+		StreamingXMLParser aStreamingParser;
+		SEXY_CHECK(aStreamingParser.OpenStreaming(aFileName));
+		isSame &= DumpElements(aStreamingParser) == aWant;
+
+		if (!isSame)
+			printf("  %s: elements differ\n", gSourceNames[aSource]);
+		SEXY_CHECK(isSame);
+
+		PFILE* aFP = p_fopen(aFileName.c_str(), "r");
+		int64_t aSize = 0;
+		SEXY_CHECK((aFP != NULL) && ((p_fdata(aFP, &aSize) != NULL) == (aSource == 1)));
+		if (aFP != NULL)
+			p_fclose(aFP);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parsing a 20000 resource manifest from disk and from paks, read in one go
+// by OpenFile and a character at a time through p_fread.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(XMLParseResourcesSources)
+{
+	const int NUM_PASSES = 5;
+
+	std::string aManifest = TestMakeManifest(20000);
+	WriteManifestSources(aManifest);
+	double aMegabytes = aManifest.size() / (1024.0 * 1024.0);
+	printf("  resources.xml of %.2f MB\n", aMegabytes);
+
+	for (int aSource = 0; aSource < NUM_SOURCES; aSource++)
+	{
+		PakInterface aPak;
+		std::string aFileName = OpenSource(aSource, aPak);
+		TestPakScope aScope(&aPak);
+
+		double aTimes[2];
+		for (int isStreaming = 0; isStreaming < 2; isStreaming++)
+		{
+			PerfTimer aTimer;
+			aTimer.Start();
+			for (int aPass = 0; aPass < NUM_PASSES; aPass++)
+			{
+				StreamingXMLParser aParser;
+				SEXY_CHECK(isStreaming ? aParser.OpenStreaming(aFileName) : aParser.OpenFile(aFileName));
+
+				XMLElement anElement;
+				while (aParser.NextElement(&anElement))
+					anElement.mAttributeIteratorList.clear();
+				SEXY_CHECK(!aParser.HasFailed());
+			}
+			aTimes[isStreaming] = aTimer.GetDuration() / NUM_PASSES;
+		}
+
+		printf("  %-24s OpenFile %6.1f ms (%5.1f MB/s), a character at a time %6.1f ms (%5.1f MB/s)\n", gSourceNames[aSource],
+			aTimes[0], aMegabytes * 1000.0 / aTimes[0], aTimes[1], aMegabytes * 1000.0 / aTimes[1]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A properties.xml of theNumProperties of every kind PropertiesParser reads,
+// with a comment before each.
+///////////////////////////////////////////////////////////////////////////////
+static std::string MakeProperties(int theNumProperties)
+{
+	std::string aProperties = "<?xml version=\"1.0\"?>\n<Properties>\n";
+	for (int i = 0; i < theNumProperties; i++)
+	{
+		aProperties += StrFormat("  <!-- property %d -->\n", i);
+		switch (i % 5)
+		{
+		case 0: aProperties += StrFormat("  <String id=\"Str%d\">Some text for string %d &amp; more</String>\n", i, i); break;
+		case 1: aProperties += StrFormat("  <StringArray id=\"Array%d\">\n    <String>first</String>\n    <String>second %d</String>\n  </StringArray>\n", i, i); break;
+		case 2: aProperties += StrFormat("  <Boolean id=\"Bool%d\">%s</Boolean>\n", i, (i & 1) ? "TRUE" : "NO"); break;
+		case 3: aProperties += StrFormat("  <Integer id=\"Int%d\">%d</Integer>\n", i, i * 37); break;
+		default: aProperties += StrFormat("  <Double id=\"Double%d\">%d.25</Double>\n", i, i); break;
+		}
+	}
+	aProperties += "</Properties>\n";
+	return aProperties;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Text heavy and nested: sections of paragraphs with entities, each
+// paragraph with a handful of attributes.
+///////////////////////////////////////////////////////////////////////////////
+static std::string MakeTextDocument(int theNumSections)
+{
+	std::string aDocument = "<?xml version=\"1.0\"?>\n<Document title=\"Synthetic\">\n";
+	for (int i = 0; i < theNumSections; i++)
+	{
+		aDocument += StrFormat("  <Section id=\"s%d\" level=\"%d\">\n", i, i % 4);
+		for (int j = 0; j < 8; j++)
+		{
+			aDocument += StrFormat("    <Para id=\"p%d_%d\" style=\"body\" align=\"left\" indent=\"%d\" lang=\"en\">", i, j, j * 4);
+			aDocument += "The quick brown fox &amp; the lazy dog &lt;again&gt;, with enough words to make a line of ordinary prose.</Para>\n";
+		}
+		aDocument += "  </Section>\n";
+	}
+	aDocument += "</Document>\n";
+	return aDocument;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parsing the framework's own kinds of XML file, a resources.xml and a
+// properties.xml of the size a game ships, and synthetic large documents,
+// the old way (a character at a time into an XMLElement per element), with
+// NextElement over the in-memory source, and with NextNode.  Allocations
+// are per parse, opening the file included.
+///////////////////////////////////////////////////////////////////////////////
+SEXY_BENCHMARK(XMLParseOldVsNew)
+{
+	static const char* WAYS[] = { "old", "NextElement", "NextNode" };
+
+	std::string aDir = TestGetTempDir() + "xmlbench/";
+	std::vector<std::string> aNames;
+	std::vector<std::string> aDocuments;
+	aNames.push_back("resources.xml, 300 resources");
+	aDocuments.push_back(TestMakeManifest(300));
+	aNames.push_back("properties.xml, 200 properties");
+	aDocuments.push_back(MakeProperties(200));
+	aNames.push_back("resources.xml, 50000 resources");
+	aDocuments.push_back(TestMakeManifest(50000));
+	aNames.push_back("text document, 5000 sections");
+	aDocuments.push_back(MakeTextDocument(5000));
+
+	for (int aDoc = 0; aDoc < (int)aDocuments.size(); aDoc++)
+	{
+		std::string aFileName = aDir + StrFormat("doc%d.xml", aDoc);
+		SEXY_CHECK(TestWriteFile(aFileName, aDocuments[aDoc]));
+		double aMegabytes = aDocuments[aDoc].size() / (1024.0 * 1024.0);
+		int aNumPasses = std::max(3, (int)(4.0 / aMegabytes));
+		printf("  %s, %.2f MB\n", aNames[aDoc].c_str(), aMegabytes);
+
+		int aNumElements[3];
+		double aTimes[3];
+		for (int aWay = 0; aWay < 3; aWay++)
+		{
+			PerfTimer aTimer;
+			aTimer.Start();
+			for (int aPass = 0; aPass < aNumPasses; aPass++)
+			{
+				if (aPass == 0)
+					gNumAllocs = 0;
+				gCountAllocs = aPass == 0;
+
+				StreamingXMLParser aParser;
+				SEXY_CHECK((aWay == 0) ? aParser.OpenStreaming(aFileName) : aParser.OpenFile(aFileName));
+
+				int aCount = 0;
+				if (aWay == 2)
+				{
+					XMLNode aNode;
+					while (aParser.NextNode(&aNode))
+						aCount++;
+				}
+				else
+				{
+					XMLElement anElement;
+					while (aParser.NextElement(&anElement))
+					{
+						anElement.mAttributeIteratorList.clear();
+						aCount++;
+					}
+				}
+				SEXY_CHECK(!aParser.HasFailed());
+
+				gCountAllocs = false;
+				if (aPass == 0)
+					aNumElements[aWay] = aCount;
+			}
+			aTimes[aWay] = aTimer.GetDuration() / aNumPasses;
+
+			printf("    %-11s %7.2f ms %6.1f MB/s %9d allocations, %.2f per element\n", WAYS[aWay], aTimes[aWay], aMegabytes * 1000.0 / aTimes[aWay],
+				gNumAllocs, (double)gNumAllocs / std::max(1, aNumElements[aWay]));
+		}
+
+		SEXY_CHECK(aNumElements[1] == aNumElements[0] && aNumElements[2] == aNumElements[0]);
+		printf("    %d elements, NextElement %.1fx and NextNode %.1fx the old speed\n", aNumElements[0], aTimes[0] / aTimes[1], aTimes[0] / aTimes[2]);
+
+		StreamingXMLParser anOldParser;
+		XMLParser aParser;
+		SEXY_CHECK(anOldParser.OpenStreaming(aFileName) && aParser.OpenFile(aFileName));
+		SEXY_CHECK(DumpElements(anOldParser) == DumpElements(aParser));
+	}
+}
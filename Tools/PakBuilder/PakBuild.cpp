@@ -0,0 +1,287 @@
+// PakBuild: the packing code behind PakBuilder.
+//
+// Version 1 paks compress each file in independent blocks with zlib, keeping
+// files that don't shrink enough stored.  Version 0 paks are written
+// uncompressed for older readers.  Like the framework, every byte of the pak
+// is XORed with 0xF7.
+
+#include "PakBuild.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+typedef unsigned char uchar;
+
+enum
+{
+	FILEFLAGS_END = 0x80
+};
+
+enum
+{
+	PAKCODEC_STORE = 0,
+	PAKCODEC_ZLIB = 1
+};
+
+static const uint32_t PAK_MAGIC = 0xBAC04AC0;
+static const uchar PAK_XOR_KEY = 0xF7;
+
+class PakEntry
+{
+public:
+	std::string				mFileName;		// full path on disk
+	std::string				mRelName;		// name in the pak, '\\' separated like PopPak
+	int64_t					mFileTime;		// FILETIME, 100ns units since 1601
+	uint64_t				mSize;
+	uint64_t				mOffset;		// of the stored data, from the end of the directory
+	uchar					mCodec;
+	std::vector<uint32_t>	mBlockSizes;	// stored size of each block when compressed
+	uint64_t				mStoredSize;
+};
+
+// Thrown by Fail and turned into a PakBuildResult by BuildPak
+struct PakBuildError
+{
+	int						mCode;
+	std::string				mMessage;
+};
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+static void Fail(const std::string& theMessage, int theCode)
+{
+	PakBuildError anError = { theCode, theMessage };
+	throw anError;
+}
+
+static void XorWrite(const void* theData, size_t theSize, FILE* theFP)
+{
+	uchar aBuffer[4096];
+	const uchar* aSrc = (const uchar*) theData;
+
+	while (theSize > 0)
+	{
+		size_t aCount = std::min(theSize, sizeof(aBuffer));
+		for (size_t i = 0; i < aCount; i++)
+			aBuffer[i] = aSrc[i] ^ PAK_XOR_KEY;
+		if (fwrite(aBuffer, 1, aCount, theFP) != aCount)
+			Fail("write failed", 5);
+		aSrc += aCount;
+		theSize -= aCount;
+	}
+}
+
+template <typename T> static void XorWriteValue(const T& theValue, FILE* theFP)
+{
+	XorWrite(&theValue, sizeof(T), theFP);
+}
+
+static int64_t GetFileTime(const std::string& theFileName)
+{
+	struct stat aStat;
+	if (stat(theFileName.c_str(), &aStat) != 0)
+		return 0;
+	return ((int64_t) aStat.st_mtime + 11644473600LL) * 10000000LL;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sorted so the same tree always gives the same pak.
+//////////////////////////////////////////////////////////////////////////
+static void FindFiles(const fs::path& theDir, std::vector<PakEntry>& theEntries)
+{
+	std::error_code anError;
+	for (fs::recursive_directory_iterator anItr(theDir, anError), anEnd; anItr != anEnd; anItr.increment(anError))
+	{
+		if (anError)
+			Fail("unable to read '" + theDir.string() + "'", 4);
+		if (!anItr->is_regular_file())
+			continue;
+
+		PakEntry anEntry;
+		anEntry.mFileName = anItr->path().string();
+		anEntry.mRelName = anItr->path().lexically_relative(theDir).generic_string();
+		std::replace(anEntry.mRelName.begin(), anEntry.mRelName.end(), '/', '\\');
+		if (anEntry.mRelName.length() > 255)
+			Fail("name too long '" + anEntry.mRelName + "'", 6);
+
+		anEntry.mFileTime = GetFileTime(anEntry.mFileName);
+		anEntry.mSize = 0;
+		anEntry.mOffset = 0;
+		anEntry.mCodec = PAKCODEC_STORE;
+		anEntry.mStoredSize = 0;
+		theEntries.push_back(anEntry);
+	}
+
+	std::sort(theEntries.begin(), theEntries.end(), [](const PakEntry& a, const PakEntry& b) { return a.mRelName < b.mRelName; });
+}
+
+static std::vector<uchar> ReadWholeFile(const std::string& theFileName)
+{
+	FILE* aFP = fopen(theFileName.c_str(), "rb");
+	if (aFP == NULL)
+		Fail("unable to open source file '" + theFileName + "'", 4);
+
+	std::vector<uchar> aData;
+	uchar aBuffer[65536];
+	size_t aCount;
+	while ((aCount = fread(aBuffer, 1, sizeof(aBuffer), aFP)) > 0)
+		aData.insert(aData.end(), aBuffer, aBuffer + aCount);
+
+	fclose(aFP);
+	return aData;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Writes theEntry's stored data to theDataFP (not XORed yet) and fills in
+// its codec and sizes.  Blocks that don't shrink are stored as they are,
+// which the reader recognizes by their stored size.
+//////////////////////////////////////////////////////////////////////////
+static void StoreEntry(PakEntry& theEntry, FILE* theDataFP, const PakBuildOptions& theOptions)
+{
+	std::vector<uchar> aData = ReadWholeFile(theEntry.mFileName);
+	theEntry.mSize = aData.size();
+	if ((theOptions.mVersion == 0) && (theEntry.mSize > 0x7FFFFFFF))
+		Fail("'" + theEntry.mRelName + "' is too big for a version 0 pak", 7);
+
+	if ((theOptions.mVersion > 0) && (theOptions.mLevel > 0) && (theEntry.mSize > 0))
+	{
+		std::vector<uchar> aStored;
+		std::vector<uchar> aBlock(compressBound(theOptions.mBlockSize));
+		std::vector<uint32_t> aBlockSizes;
+
+		for (uint64_t aPos = 0; aPos < theEntry.mSize; aPos += theOptions.mBlockSize)
+		{
+			uLong aSize = (uLong) std::min((uint64_t) theOptions.mBlockSize, theEntry.mSize - aPos);
+			uLongf aDestLen = (uLongf) aBlock.size();
+
+			if ((compress2(&aBlock[0], &aDestLen, &aData[aPos], aSize, theOptions.mLevel) == Z_OK) && (aDestLen < aSize))
+				aStored.insert(aStored.end(), aBlock.begin(), aBlock.begin() + aDestLen);
+			else
+			{
+				aDestLen = aSize;
+				aStored.insert(aStored.end(), aData.begin() + aPos, aData.begin() + aPos + aSize);
+			}
+			aBlockSizes.push_back((uint32_t) aDestLen);
+		}
+
+		if (aStored.size() * 100 <= theEntry.mSize * (100 - theOptions.mMinSavingsPct))
+		{
+			theEntry.mCodec = PAKCODEC_ZLIB;
+			theEntry.mBlockSizes.swap(aBlockSizes);
+			aData.swap(aStored);
+		}
+	}
+
+	theEntry.mStoredSize = aData.size();
+	if ((!aData.empty()) && (fwrite(&aData[0], 1, aData.size(), theDataFP) != aData.size()))
+		Fail("unable to write temporary data", 5);
+}
+
+static void WriteDirectory(const std::vector<PakEntry>& theEntries, FILE* theFP, const PakBuildOptions& theOptions)
+{
+	XorWriteValue(PAK_MAGIC, theFP);
+	XorWriteValue((uint32_t) theOptions.mVersion, theFP);
+
+	for (const PakEntry& anEntry : theEntries)
+	{
+		XorWriteValue((uchar) 0, theFP);
+		XorWriteValue((uchar) anEntry.mRelName.length(), theFP);
+		XorWrite(anEntry.mRelName.c_str(), anEntry.mRelName.length(), theFP);
+
+		if (theOptions.mVersion == 0)
+		{
+			XorWriteValue((int) anEntry.mSize, theFP);
+			XorWriteValue(anEntry.mFileTime, theFP);
+			continue;
+		}
+
+		XorWriteValue(anEntry.mCodec, theFP);
+		XorWriteValue(anEntry.mFileTime, theFP);
+		XorWriteValue(anEntry.mOffset, theFP);
+		XorWriteValue(anEntry.mSize, theFP);
+		if (anEntry.mCodec != PAKCODEC_STORE)
+		{
+			XorWriteValue(theOptions.mBlockSize, theFP);
+			XorWrite(&anEntry.mBlockSizes[0], anEntry.mBlockSizes.size() * sizeof(uint32_t), theFP);
+		}
+	}
+
+	XorWriteValue((uchar) FILEFLAGS_END, theFP);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+static void WritePak(const std::string& thePakName, const fs::path& theDir, const PakBuildOptions& theOptions, PakBuildResult& theResult)
+{
+	if (!fs::is_directory(theDir))
+		Fail("'" + theDir.string() + "' is not a directory", 4);
+
+	std::vector<PakEntry> anEntries;
+	FindFiles(theDir, anEntries);
+
+	// The directory needs every offset and block size, so the data goes to a
+	// temporary file first.  Both files are closed however Fail leaves.
+	std::unique_ptr<FILE, int (*)(FILE*)> aDataFP(tmpfile(), fclose);
+	if (aDataFP == NULL)
+		Fail("unable to create a temporary file", 2);
+
+	uint64_t anOffset = 0;
+	for (size_t i = 0; i < anEntries.size(); i++)
+	{
+		if (theOptions.mShowProgress)
+		{
+			std::cout << "Packing: " << ((i * 100) / anEntries.size()) << "%\r";
+			std::cout.flush();
+		}
+
+		anEntries[i].mOffset = anOffset;
+		StoreEntry(anEntries[i], aDataFP.get(), theOptions);
+		anOffset += anEntries[i].mStoredSize;
+		theResult.mTotalSize += anEntries[i].mSize;
+	}
+	theResult.mNumFiles = anEntries.size();
+	theResult.mStoredSize = anOffset;
+
+	std::unique_ptr<FILE, int (*)(FILE*)> aDestFP(fopen(thePakName.c_str(), "wb"), fclose);
+	if (aDestFP == NULL)
+		Fail("unable to create '" + thePakName + "'", 2);
+
+	WriteDirectory(anEntries, aDestFP.get(), theOptions);
+
+	rewind(aDataFP.get());
+	uchar aBuffer[65536];
+	size_t aCount;
+	while ((aCount = fread(aBuffer, 1, sizeof(aBuffer), aDataFP.get())) > 0)
+		XorWrite(aBuffer, aCount, aDestFP.get());
+
+	if (fclose(aDestFP.release()) != 0)
+		Fail("unable to finish '" + thePakName + "'", 5);
+}
+
+PakBuildResult BuildPak(const std::string& thePakName, const std::string& theDir, const PakBuildOptions& theOptions)
+{
+	PakBuildResult aResult;
+	try
+	{
+		WritePak(thePakName, theDir, theOptions, aResult);
+	}
+	catch (const PakBuildError& anError)
+	{
+		aResult.mError = anError.mCode;
+		aResult.mMessage = anError.mMessage;
+	}
+	return aResult;
+}
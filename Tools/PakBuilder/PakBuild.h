@@ -0,0 +1,32 @@
+#pragma once
+
+// The packing half of PakBuilder, kept apart from its command line so the
+// framework's tests can round trip a tree through the same code.
+
+#include <cstdint>
+#include <string>
+
+struct PakBuildOptions
+{
+	int						mVersion;		// 0 writes uncompressed version 0 paks
+	int						mLevel;			// zlib level, 0 stores every file
+	uint32_t				mBlockSize;
+	int						mMinSavingsPct;	// files saving less than this are stored
+	bool					mShowProgress;
+
+	PakBuildOptions() : mVersion(1), mLevel(9), mBlockSize(64 * 1024), mMinSavingsPct(5), mShowProgress(false) {}
+};
+
+struct PakBuildResult
+{
+	int						mError;			// 0, or PakBuilder's exit code
+	std::string				mMessage;
+	uint64_t				mNumFiles;
+	uint64_t				mTotalSize;		// of the files as they are
+	uint64_t				mStoredSize;	// of the data in the pak
+
+	PakBuildResult() : mError(0), mNumFiles(0), mTotalSize(0), mStoredSize(0) {}
+};
+
+// Packs every file under theDir into thePakName.
+PakBuildResult				BuildPak(const std::string& thePakName, const std::string& theDir, const PakBuildOptions& theOptions);
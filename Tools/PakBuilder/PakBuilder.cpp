@@ -0,0 +1,66 @@
+// PakBuilder: packs a directory tree into a .pak that PakInterface can read.
+//
+// Portable replacement for PopPak's /P mode, it only needs a C++17 compiler
+// and zlib.  PakBuilder.vcxproj builds it with the rest of the solution, or:
+//   g++ -std=c++17 -O2 PakBuilder.cpp PakBuild.cpp -lz -o PakBuilder
+//   cl /std:c++17 /O2 /EHsc PakBuilder.cpp PakBuild.cpp zlib.lib
+//
+// The packing itself is in PakBuild.cpp.
+
+#include "PakBuild.h"
+
+#include <cstdlib>
+#include <algorithm>
+#include <iostream>
+
+static void Usage()
+{
+	std::cerr << "Usage: PakBuilder [/0] [/S] [/L level] [/B blockKB] <FileName> <DirPath>" << std::endl;
+	std::cerr << "  /0    Writes an uncompressed version 0 pak" << std::endl;
+	std::cerr << "  /S    Stores every file uncompressed" << std::endl;
+	std::cerr << "  /L    zlib level, 1-9 (default 9)" << std::endl;
+	std::cerr << "  /B    Compression block size in KB (default 64)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	PakBuildOptions anOptions;
+	anOptions.mShowProgress = true;
+
+	int anArgPos = 1;
+	for (; (anArgPos < argc) && ((argv[anArgPos][0] == '/') || (argv[anArgPos][0] == '-')) && (argv[anArgPos][1] != 0) && (argv[anArgPos][2] == 0); anArgPos++)
+	{
+		char anOption = (char) toupper((unsigned char) argv[anArgPos][1]);
+		if (anOption == '0')
+			anOptions.mVersion = 0;
+		else if (anOption == 'S')
+			anOptions.mLevel = 0;
+		else if ((anOption == 'L') && (anArgPos + 1 < argc))
+			anOptions.mLevel = std::max(1, std::min(9, atoi(argv[++anArgPos])));
+		else if ((anOption == 'B') && (anArgPos + 1 < argc))
+			anOptions.mBlockSize = (uint32_t) std::max(1, std::min(16 * 1024, atoi(argv[++anArgPos]))) * 1024;
+		else
+		{
+			Usage();
+			return 101;
+		}
+	}
+
+	if (argc != anArgPos + 2)
+	{
+		Usage();
+		return 102;
+	}
+
+	PakBuildResult aResult = BuildPak(argv[anArgPos], argv[anArgPos + 1], anOptions);
+	if (aResult.mError != 0)
+	{
+		std::cerr << "Error: " << aResult.mMessage << std::endl;
+		return aResult.mError;
+	}
+
+	if (aResult.mNumFiles == 0)
+		std::cout << "Warning: no files!" << std::endl;
+	std::cout << "Packed " << aResult.mNumFiles << " files, " << aResult.mTotalSize << " bytes into " << aResult.mStoredSize << " bytes of data" << std::endl;
+	return 0;
+}
@@ -0,0 +1,45 @@
+// ResourceCompiler: writes the compiled form of resource manifests.
+//
+// Each manifest is parsed the way ResourceManager parses it and saved next to
+// it, properties/resources.xml as properties/resources.bin.  Run it over a
+// game's manifests before packing them with PakBuilder.  A game then loads the
+// compiled manifest after calling ResourceManager::SetUseCompiledResources,
+// and goes back to the XML whenever the XML no longer matches.
+//
+// Games whose ResourceManager overrides the Parse functions shouldn't use
+// compiled manifests, they hold what the stock parser made of the XML.
+
+#include "SexyAppFramework/SexyAppBase.h"
+#include "SexyAppFramework/misc/ResourceManager.h"
+
+#include <iostream>
+
+using namespace Sexy;
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: ResourceCompiler <resources.xml> [more.xml ...]" << std::endl;
+		return 101;
+	}
+
+	// Parsing only asks the app whether it's 3D accelerated, so it never has
+	// to be initialized
+	SexyAppBase* anApp = new SexyAppBase();
+
+	int aNumFailed = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		ResourceManager aManager(anApp);
+		if (aManager.CompileResourcesFile(argv[i]))
+			std::cout << argv[i] << " -> " << ResourceManager::GetCompiledResourcesName(argv[i]) << std::endl;
+		else
+		{
+			std::cerr << "Error: " << aManager.GetErrorText() << std::endl;
+			aNumFailed++;
+		}
+	}
+
+	return (aNumFailed != 0) ? 1 : 0;
+}